@@ -40,4 +40,32 @@ bool affinity_is_pinned(pthread_t thread, int code_id);
 */
 void affinity_print(pthread_t thread);
 
+/*
+    Parse a core list like "2,4-7,10" (the cpuset/taskset format) into
+    `cores`, in the given order. Ranges are inclusive, a core may not appear
+    twice.
+        Return the number of cores (1..max), or -1 if the list is malformed or
+        longer than `max`.
+*/
+int affinity_parse_core_list(const char *s, int *cores, int max);
+
+/*
+    NUMA topology, read from /sys/devices/system/node.
+*/
+
+/* Number of NUMA nodes (1 on UMA systems, or if sysfs can't tell). */
+int affinity_numa_nodes(void);
+
+/* NUMA node of CPU `core_id`, 0 if unknown. */
+int affinity_core_node(int core_id);
+
+/* NUMA node the NIC `iface` is attached to, -1 if unknown (virtual device, UMA). */
+int affinity_iface_node(const char *iface);
+
+/*
+    NUMA node of the CPU the calling thread runs on. For pinned threads this
+    is stable; for others it is only a hint.
+*/
+int affinity_self_node(void);
+
 #endif
\ No newline at end of file
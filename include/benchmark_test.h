@@ -6,6 +6,8 @@
 #include <stdio.h>
 #include <time.h>
 
+#include "json.h"
+
 /* Collect system information. */
 typedef struct {
     char cpu_model[256]; /* e.g. "Intel(R) Xeon(R) CPU E5-2680 v4" */
@@ -21,25 +23,6 @@ typedef struct {
 */
 void benchmark_get_system_info(system_info_t *info);
 
-/*
-    JSON Output helpers.
-*/
-
-typedef struct {
-    FILE *out; /* Output stream (stdout or file) */
-    int indent_level; /* Current nesting depth (0 = top level) */
-    bool needs_comma;
-} json_ctx_t;
-
-void json_init(json_ctx_t *ctx, FILE *out);
-void json_begin_object(json_ctx_t *ctx); /* Prints '{' */
-void json_end_object(json_ctx_t *ctx); /* Prints '}' */
-void json_key_string(json_ctx_t *ctx, const char *key, const char *value);
-void json_key_int(json_ctx_t *ctx, const char *key, int64_t value);
-void json_key_double(json_ctx_t *ctx, const char *key, double value);
-void json_key_bool(json_ctx_t *ctx, const char *key, bool value);
-void json_begin_nested_object(json_ctx_t *ctx, const char *key);
-
 /*
     Get current timestamp using CLOCK_MONOTONIC_RAW.
         Returns time in seconds (double precision).
@@ -61,6 +44,12 @@ size_t benchmark_parse_size_t(const char *option_name);
 int benchmark_parse_int(const char *option_name);
 double benchmark_parse_double(const char *option_name);
 
+/*
+    Comma-separated sweep points ("10,100,1000"), each > 0, into out[0..max).
+        Returns the number of values.
+*/
+size_t benchmark_parse_list(const char *option_name, size_t *out, size_t max);
+
 /*
     Variance Calculation.
 
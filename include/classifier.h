@@ -0,0 +1,101 @@
+#ifndef CLASSIFIER_H
+#define CLASSIFIER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parser.h"
+#include "rule_table.h"
+
+/*
+    Tuple Space Search classifier, compiled from a priority-sorted rule array.
+
+    Rules that use the same combination of masks (src mask, dst mask, and which
+    of proto/sport/dport are exact) form a "tuple". Within a tuple, every rule
+    is an exact-match key once the packet is masked the same way, so each tuple
+    is one hash table lookup. A lookup costs O(#tuples) instead of O(#rules),
+    and real rule sets have only a few distinct mask combinations.
+
+    First-match semantics are kept: each entry stores the best rule with that
+    key, tuples are ordered by their best rule, and the search stops once no
+    remaining tuple can beat the best match found so far. "Best" is the match
+    order of the rule array, (priority, rule_id), see cls_order().
+
+    Entries name rules by rule_id, not by position in the array, so a tuple
+    stays valid when other rules are added or removed: classifier_update()
+    builds only the tuples a change touches and takes the rest over.
+*/
+
+/* Masked packet fields: src[2], dst[2], {sport, dport, proto, ip_ver} */
+#define CLS_KEY_WORDS 5
+
+typedef struct {
+    uint64_t w[CLS_KEY_WORDS];
+    uint32_t rule_id;  /* CLS_EMPTY if unused */
+    uint32_t priority; /* Of that rule, for the match order without a lookup */
+} cls_entry_t;
+
+typedef struct {
+    uint64_t mask[CLS_KEY_WORDS];
+    uint64_t min_order; /* Best cls_order() in this tuple */
+    uint32_t count;
+    uint32_t slot_mask; /* Slots - 1 (power of two) */
+    cls_entry_t *slots;
+} cls_tuple_t;
+
+struct classifier {
+    const rule_t **by_id; /* Rule of each id in the rule array, NULL if none */
+    uint32_t id_count;
+    cls_tuple_t *tuples; /* Sorted by min_order */
+    size_t tuple_count;
+    /* Per tuple: the slots are ours to free. Not if they are mapped from a rule
+     * file (rule_file.h, owned == NULL), still shared with the classifier this
+     * one was updated from, or handed to a newer one (classifier_take_over()). */
+    bool *owned;
+};
+
+#define CLS_EMPTY UINT32_MAX
+
+/* Match order of a rule: lower wins, as in the rule array. */
+static inline uint64_t cls_order(uint32_t priority, uint32_t rule_id) {
+    return ((uint64_t)priority << 32) | rule_id;
+}
+
+/*
+    Build the classifier for `rules[0..count)`, which must be in match order
+    (as kept by rule_table_add()). The array must stay unchanged while the
+    classifier is in use.
+        Returns 0 on success, -1 on allocation failure.
+*/
+int classifier_init(classifier_t *c, const rule_t *rules, size_t count);
+
+/*
+    Build `c` for `rules[0..count)` from `old`, the classifier of the rules
+    before a change. `changed` lists the rules the change removed and added
+    (both versions of a modified one); ids of all other rules are the same in
+    both arrays. Only the tuples of the changed rules' masks are built; the
+    others are shared with `old`, which still owns them: destroying `c` leaves
+    `old` intact until classifier_take_over() moves them to `c`.
+        Returns 0 on success, -1 on allocation failure (`old` unchanged).
+*/
+int classifier_update(classifier_t *c, classifier_t *old, const rule_t *rules, size_t count,
+                      const rule_t *changed, size_t n_changed);
+
+/*
+    Make `c`, built by classifier_update() from `old`, the owner of the tuples
+    it shares with `old`. Call once `c` replaces `old` for good: `old` stays
+    usable until destroyed, but destroying it no longer frees them. A no-op if
+    `c` shares nothing with `old`. Cannot fail.
+*/
+void classifier_take_over(classifier_t *c, classifier_t *old);
+
+void classifier_destroy(classifier_t *c);
+
+/*
+    Find the first rule matching `k`. Only IPv4/IPv6 keys (ip_ver 4 or 6).
+        Returns the matching rule or NULL if no match.
+*/
+const rule_t *classifier_lookup(const classifier_t *c, const flow_key_t *k);
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef CONNTRACK_H
+#define CONNTRACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flow_cache.h"
+#include "parser.h"
+#include "rule_table.h"
+
+/*
+    Per-worker connection tracking for TCP and UDP ("allow established").
+
+    A flow whose first packet matches a FWD rule becomes a connection. Later
+    packets of it, in either direction, are forwarded without classification:
+    the reply direction is allowed even if no rule (or a DROP rule) matches it.
+    flow_hash() is symmetric, so both directions reach the same worker and the
+    table needs no locks. (Not so with AF_XDP per-worker queues, unless the
+    NIC's RSS key is symmetric.)
+
+    Table:
+        Open addressing over an index of (hash, entry) slots, linear probing,
+        at most half full; removal shifts the following slots back, so there
+        are no tombstones. Entries live in a separate array and never move.
+
+    Expiry:
+        A timer wheel of one-second slots. Each entry is linked into the slot
+        of the second it expires at. A packet only moves `expires` forward;
+        the entry is moved to its new slot when the old one comes up, so a
+        refresh costs no list operations. A full table evicts the entry whose
+        slot comes up next.
+*/
+
+#define CONNTRACK_WHEEL_SLOTS 512 /* Seconds, longer than any timeout */
+
+/* Idle timeouts in seconds */
+#define CONNTRACK_TIMEOUT_NEW 30   /* No reply seen yet */
+#define CONNTRACK_TIMEOUT_TCP 300  /* Established */
+#define CONNTRACK_TIMEOUT_UDP 120  /* Replied */
+#define CONNTRACK_TIMEOUT_CLOSE 10 /* FIN or RST seen: let the last segments through */
+
+#define CONNTRACK_NONE UINT32_MAX
+#define CONNTRACK_ENTRIES_MAX (1 << 22) /* Per table: about 400 MB with the index */
+
+typedef enum {
+    CT_NEW = 0,
+    CT_ESTABLISHED = 1,
+    CT_CLOSING = 2
+} ct_state_t;
+
+/* Key of both directions: the lower endpoint (address, port) is `src`. */
+typedef struct {
+    flow_cache_key_t key;
+    bool swapped; /* The packet went from the higher endpoint to the lower one */
+} conntrack_key_t;
+
+typedef struct {
+    flow_cache_key_t key; /* Canonical, see conntrack_key_t */
+    const rule_t *rule;   /* Rule that admitted the connection */
+    uint32_t rule_gen;    /* rule_table_t.generation `rule` belongs to */
+    uint32_t expires;     /* Second it times out at, unless refreshed */
+    uint32_t slot_tick;   /* Second of the wheel slot it is linked into */
+    uint32_t prev, next;  /* Wheel list; `next` also links the free entries */
+    uint8_t state;        /* ct_state_t */
+    bool orig_swapped;    /* conntrack_key_t.swapped of the first packet */
+} conntrack_entry_t;
+
+typedef struct {
+    uint32_t sig; /* Low 32 bits of the hash */
+    uint32_t idx; /* Entry, CONNTRACK_NONE if the slot is empty */
+} conntrack_slot_t;
+
+typedef struct {
+    conntrack_slot_t *index;
+    uint32_t index_mask;
+    conntrack_entry_t *entries;
+    uint32_t capacity;
+    uint32_t free_head;
+    uint32_t *wheel; /* CONNTRACK_WHEEL_SLOTS list heads */
+    uint32_t now;    /* Second the wheel was advanced to */
+
+    /* Counters [hot, read by the stats thread] */
+    uint64_t count; /* Live connections */
+    uint64_t hits;  /* Packets that skipped classification */
+    uint64_t inserts;
+    uint64_t evictions; /* Table full */
+    uint64_t expired;
+} conntrack_t;
+
+/*
+    Allocate a table for `entries` connections (1 .. CONNTRACK_ENTRIES_MAX),
+    with the clock at second `now`.
+        Returns 0 if successful, -1 if not.
+*/
+int conntrack_init(conntrack_t *ct, size_t entries, uint32_t now);
+void conntrack_destroy(conntrack_t *ct);
+
+/* Bytes allocated for the table, index and wheel. */
+size_t conntrack_memory(const conntrack_t *ct);
+
+/* Build the key of the connection a parsed packet belongs to. */
+void conntrack_key(const flow_key_t *k, conntrack_key_t *out);
+
+/* Same for both directions of a connection. */
+static inline uint64_t conntrack_hash(const conntrack_key_t *ck) {
+    return flow_cache_hash(&ck->key);
+}
+
+/*
+    Find the live connection of `ck` (an expired one is removed). Counts a hit.
+        Returns the entry or NULL.
+*/
+conntrack_entry_t *conntrack_lookup(conntrack_t *ct, const conntrack_key_t *ck, uint64_t hash);
+
+/*
+    Insert a connection for `ck`, which must not be in the table, in CT_NEW
+    state with `ck` as the original direction. Evicts one if the table is full.
+        Returns the entry, never NULL.
+*/
+conntrack_entry_t *conntrack_insert(conntrack_t *ct, const conntrack_key_t *ck, uint64_t hash,
+                                    const rule_t *rule, uint32_t rule_gen);
+
+/*
+    Account a packet of `e`: `reply` is its direction, `tcp_flags` its flags
+    (see flow_key_t). Moves the state on and restarts the idle timeout.
+*/
+void conntrack_update(conntrack_t *ct, conntrack_entry_t *e, bool reply, uint8_t tcp_flags);
+
+/* Remove `e` from the table. */
+void conntrack_remove(conntrack_t *ct, conntrack_entry_t *e);
+
+/* Move the clock to second `now` and remove the connections that timed out. */
+void conntrack_advance(conntrack_t *ct, uint32_t now);
+
+#endif
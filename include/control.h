@@ -0,0 +1,115 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arp_table.h"
+#include "ndp_table.h"
+#include "parser.h"
+#include "pktbuf.h"
+#include "ring.h"
+#include "tx.h"
+#include "worker.h"
+
+/*
+    Control plane: ARP and NDP off the forwarding path.
+
+    Learning a neighbour takes the table's write lock, and answering an ARP
+    request is a syscall; done inline, an ARP storm stalls every worker. So a
+    worker only recognizes control frames (control_frame()) and hands them over
+    an SPSC ring (worker_t.ctrl_ring) to the control thread, which
+        - learns all neighbours of a burst in one locked update per table
+          (arp_update_bulk(), ndp_update_bulk()): one generation change, so
+          the workers' cached MACs are invalidated once per burst,
+        - answers ARP requests for the address of its TX context, at most
+          `reply_rate` per second (token bucket, one second of burst),
+        - and sends the replies of a burst with one tx_send_batch().
+
+    If a ring is full the frame is dropped by the worker (worker_t.ctrl_dropped):
+    a storm costs neighbour updates, never forwarding.
+
+    Same threading as a TX stage: one or more rings, round robin, one burst per
+    ring and round; backoff when all are empty.
+*/
+
+#define CONTROL_MAX_RINGS 64
+#define CONTROL_RING_SIZE 1024           /* Per worker */
+#define CONTROL_REPLY_RATE_DEFAULT 1000  /* ARP replies per second */
+
+typedef struct {
+    /* Thread metadata [cold] */
+    pthread_t thread;
+    int core_id; /* -1: no pinning */
+
+    spsc_ring_t *rings[CONTROL_MAX_RINGS]; /* One per worker */
+    unsigned int ring_count;
+    const tx_ctx_t *tx; /* Replies: sent from its MAC, for its IPv4 address */
+    arp_table_t *arpt;
+    ndp_table_t *ndpt;
+
+    /* Reply token bucket */
+    uint32_t reply_rate; /* Per second, 0 = unlimited */
+    uint32_t tokens;
+    uint64_t refill_ns; /* CLOCK_MONOTONIC of the last refill */
+
+    /* Set by the owner once the workers are joined: drain the rings, then exit. */
+    atomic_bool stop;
+
+    /* Counters [written by the control thread, read by the stats thread] */
+    uint64_t arp_frames;
+    uint64_t ndp_frames;
+    uint64_t replies_sent;
+    uint64_t replies_limited; /* Over reply_rate, not answered */
+    uint64_t replies_dropped; /* Rejected by the kernel, or the TX ring was full */
+    uint32_t idle_streak;
+} control_plane_t;
+
+/*
+    Whether a frame that did not parse as a flow is ARP, or an NDP Neighbor
+    Solicitation or Advertisement: cheap enough for the worker's fast path.
+*/
+static inline bool control_frame(const pktbuf_t *b) {
+    const struct eth_hdr *eth = (const struct eth_hdr *)b->data;
+    if (b->len < sizeof(struct eth_hdr)) return false;
+
+    uint16_t ethertype = ntohs(eth->ethertype);
+    if (ethertype == ETH_TYPE_ARP) return true;
+    if (ethertype != ETH_TYPE_IPV6 ||
+        b->len < sizeof(struct eth_hdr) + sizeof(struct ipv6_hdr) + sizeof(struct ndp_na_hdr)) {
+        return false;
+    }
+
+    const struct ipv6_hdr *ip6 = (const struct ipv6_hdr *)(b->data + sizeof(struct eth_hdr));
+    if (ip6->next_header != IP_PROTO_ICMPV6) return false;
+    const struct ndp_na_hdr *ndp =
+        (const struct ndp_na_hdr *)(b->data + sizeof(struct eth_hdr) + sizeof(struct ipv6_hdr));
+    return ndp->type == ICMPV6_NEIGHBOR_SOL || ndp->type == ICMPV6_NEIGHBOR_ADV;
+}
+
+/* Returns 0 if successful, -1 if not. `reply_rate` 0: no limit. */
+int control_init(control_plane_t *c, int core_id, const tx_ctx_t *tx, arp_table_t *arpt,
+                 ndp_table_t *ndpt, uint32_t reply_rate);
+
+/*
+    Serve `r` too (before control_start()).
+        Returns 0 if successful, -1 if it already has CONTROL_MAX_RINGS.
+*/
+int control_add_ring(control_plane_t *c, spsc_ring_t *r);
+
+/*
+    Learn from and answer a burst of control frames (at most WORKER_BURST_SIZE),
+    then free them. `now_ns` (CLOCK_MONOTONIC) refills the reply bucket.
+    The control thread calls it for each burst it takes from a ring.
+*/
+void control_process(control_plane_t *c, pktbuf_t **bufs, unsigned int n, uint64_t now_ns);
+
+int control_start(control_plane_t *c);
+
+/* Let the thread handle what is left in its rings, then join it. */
+void control_stop(control_plane_t *c);
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef FLOW_CACHE_H
+#define FLOW_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parser.h"
+#include "rule_table.h"
+
+/*
+    Per-worker exact-match flow cache, in front of rule_table_match().
+
+    Most packets belong to long-lived flows, so the result of the first lookup
+    (matched rule and resolved next-hop MAC) is remembered per 5-tuple. The
+    cache is private to one worker: no locks, no atomics on the hot path.
+
+    Layout:
+        The table is split into buckets of FLOW_CACHE_WAYS entries. Each bucket
+        has one 64 byte header line holding a 32-bit signature per way, so a
+        lookup reads the header line and at most one entry line (one entry is
+        also one cache line).
+
+    Eviction:
+        CLOCK per bucket. A hit sets the way's reference bit; an insert into a
+        full bucket advances the hand, clearing reference bits, until it finds
+        a way that was not used since the last pass.
+
+    Invalidation:
+        Every entry stores the generation of the rule table it was matched
+        against, and of the ARP/NDP table its MAC came from. A different
+        generation means a stale entry; nothing has to be flushed on reload.
+*/
+
+#define FLOW_CACHE_WAYS 8              /* Entries per bucket */
+#define FLOW_CACHE_DEFAULT_ENTRIES 4096 /* Per worker, 256 KB of entries */
+
+/* Canonical key: v4 addresses are zero extended, no padding bytes. */
+typedef struct {
+    uint64_t src[2];
+    uint64_t dst[2];
+    uint64_t meta; /* sport | dport << 16 | proto << 32 | ip_ver << 40 */
+} flow_cache_key_t;
+
+typedef struct {
+    _Alignas(64) flow_cache_key_t key;
+    const rule_t *rule;  /* NULL: no rule matched (cached drop) */
+    uint32_t rule_gen;   /* rule_table_t.generation at insert, 0 = unused */
+    uint32_t neigh_gen;  /* ARP/NDP table generation dst_mac was resolved at */
+    uint8_t dst_mac[6];
+    bool mac_valid;      /* false: neighbour not resolved yet */
+} flow_cache_entry_t;
+
+typedef struct {
+    _Alignas(64) uint32_t sig[FLOW_CACHE_WAYS]; /* 0 = empty way */
+    uint8_t ref;                                 /* CLOCK reference bit per way */
+    uint8_t hand;                                /* Next eviction candidate */
+} flow_cache_bucket_t;
+
+typedef struct {
+    flow_cache_bucket_t *buckets;
+    flow_cache_entry_t *entries; /* [bucket * FLOW_CACHE_WAYS + way] */
+    uint32_t bucket_mask;
+
+    /* Counters [hot, read by the stats thread] */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} flow_cache_t;
+
+/*
+    Allocate a cache with room for `entries` flows (rounded up to a power of
+    two, at least one bucket).
+        Returns 0 if successful, -1 if not.
+*/
+int flow_cache_init(flow_cache_t *c, size_t entries);
+void flow_cache_destroy(flow_cache_t *c);
+
+/* Build the canonical key of a parsed flow. */
+void flow_cache_key(const flow_key_t *k, flow_cache_key_t *out);
+
+/* Bucket/signature hash of a canonical key. */
+uint64_t flow_cache_hash(const flow_cache_key_t *key);
+
+/*
+    Find the entry of `key` that was filled against rule table generation
+    `rule_gen`. Counts a hit or a miss.
+        Returns the entry or NULL.
+*/
+flow_cache_entry_t *flow_cache_lookup(flow_cache_t *c, const flow_cache_key_t *key, uint64_t hash,
+                                      uint32_t rule_gen);
+
+/*
+    Insert (or overwrite) the entry for `key`, evicting by CLOCK if the bucket
+    is full. The caller fills in the MAC fields of the returned entry.
+        Returns the entry, never NULL.
+*/
+flow_cache_entry_t *flow_cache_insert(flow_cache_t *c, const flow_cache_key_t *key, uint64_t hash,
+                                      const rule_t *rule, uint32_t rule_gen);
+
+#endif
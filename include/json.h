@@ -0,0 +1,30 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+    JSON Output helpers: pretty-printed, 4 spaces per level, written straight
+    to a stream. Keys and string values are printed as they are (no escaping).
+*/
+
+typedef struct {
+    FILE *out; /* Output stream (stdout, a file or a memory stream) */
+    int indent_level; /* Current nesting depth (0 = top level) */
+    bool needs_comma;
+} json_ctx_t;
+
+void json_init(json_ctx_t *ctx, FILE *out);
+void json_begin_object(json_ctx_t *ctx); /* Prints '{', also an array element */
+void json_end_object(json_ctx_t *ctx); /* Prints '}' */
+void json_key_string(json_ctx_t *ctx, const char *key, const char *value);
+void json_key_int(json_ctx_t *ctx, const char *key, int64_t value);
+void json_key_double(json_ctx_t *ctx, const char *key, double value);
+void json_key_bool(json_ctx_t *ctx, const char *key, bool value);
+void json_begin_nested_object(json_ctx_t *ctx, const char *key);
+void json_begin_nested_array(json_ctx_t *ctx, const char *key); /* Prints '"key": [' */
+void json_end_array(json_ctx_t *ctx); /* Prints ']' */
+
+#endif
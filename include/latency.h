@@ -18,7 +18,22 @@ static inline uint64_t rdtsc(void) {
     return ((uint64_t)hi << 32) | (uint64_t)lo;
 }
 
-#define LATENCY_NUM_BUCKETS 8
+/*
+    Log-linear (HDR-style) buckets: every power of two is split into
+    2^LATENCY_PRECISION_BITS equal sub-buckets, below that each nanosecond has
+    its own. A value lands in a bucket at most 2^-LATENCY_PRECISION_BITS of it
+    wide (1.6% by default), whatever its magnitude. Values of 2^LATENCY_MAX_BITS
+    ns (~4.3 s) and above go into the last bucket.
+
+    Build with -DLATENCY_PRECISION_BITS=n to trade memory for precision: the
+    histogram is (LATENCY_MAX_BITS - n + 1) << n counters (13.5 KB for 6).
+*/
+#ifndef LATENCY_PRECISION_BITS
+#define LATENCY_PRECISION_BITS 6
+#endif
+#define LATENCY_MAX_BITS 32
+#define LATENCY_NUM_BUCKETS \
+    ((LATENCY_MAX_BITS - LATENCY_PRECISION_BITS + 1) << LATENCY_PRECISION_BITS)
 
 typedef struct {
     uint64_t buckets[LATENCY_NUM_BUCKETS];
@@ -28,42 +43,63 @@ typedef struct {
     uint64_t sum_ns;
 } latency_histogram_t;
 
-static const uint64_t latency_bucket_bounds[LATENCY_NUM_BUCKETS] = {
-    100, /* Bucket 0: < 100 ns (L1/L2 cache hits) */
-    500, /* Bucket 1: < 500 ns (typical fast-path processing) */
-    1000, /* Bucket 2: < 1 us (cache misses or branch mispredicts) */
-    5000, /* Bucket 3: < 5 us (TLB miss, or contention on global pool) */
-    10000, /* Bucket 4: < 10 us (cross-NUMA access or scheduling jitter) */
-    50000, /* Bucket 5: < 50 us (context switch or interrupt) */
-    100000, /* Bucket 6: < 100 us (something went wrong) */
-    1000000 /* Bucket 7: >= 100 us (catch-all, everything will fit here) */
-};
-
 /* How many TSC cycles correspond to one nanosecond. */
 double latency_calibrate_tsc(void);
 
 /*
     Initialize a histogram to zero state.
-    Sets min_ns to 1000000 (MAX) => first sample becomes the new min.
+    Sets min_ns to UINT64_MAX => first sample becomes the new min.
 */
 void latency_histogram_init(latency_histogram_t *h);
 
+/*
+    Bucket of a latency: the sub-bucket bits right below the most significant
+    one, offset by the power of two. Shifts and adds only.
+*/
+static inline unsigned int latency_bucket_index(uint64_t ns) {
+    const uint64_t sub = 1ULL << LATENCY_PRECISION_BITS;
+
+    if (ns >> LATENCY_MAX_BITS) ns = (1ULL << LATENCY_MAX_BITS) - 1;
+
+    /* OR-ing in `sub` keeps the shift at 0 for the linear range below it */
+    unsigned int shift =
+        (unsigned int)(63 - __builtin_clzll(ns | sub)) - LATENCY_PRECISION_BITS;
+    return (unsigned int)(((uint64_t)shift << LATENCY_PRECISION_BITS) + (ns >> shift));
+}
+
+/*
+    Record `count` samples of the same latency (in ns) into the histogram.
+    Single writer: each worker owns its histogram, readers merge a snapshot.
+*/
+static inline void latency_record_ns(latency_histogram_t *h, uint64_t ns, uint64_t count) {
+    h->buckets[latency_bucket_index(ns)] += count;
+    h->total_count += count;
+    h->sum_ns += ns * count;
+
+    if (ns < h->min_ns) h->min_ns = ns;
+    if (ns > h->max_ns) h->max_ns = ns;
+}
+
 /*
     Record a single latency sample (in TSC cycles) into the histogram.
-    Increment the corresponding latency bucket's counter.
+    ns_per_cycle is 1 / latency_calibrate_tsc(), computed once by the caller.
 */
-void latency_record(latency_histogram_t *h, uint64_t cycles, double cycles_per_ns);
+static inline void latency_record(latency_histogram_t *h, uint64_t cycles, double ns_per_cycle) {
+    latency_record_ns(h, (uint64_t)((double)cycles * ns_per_cycle), 1);
+}
 
 /*
     Compute a percentile from the histogram.
-        Returns upper bound (in ns) of the bucket that contains the requested percentile.
+        Returns the highest value (in ns) of the bucket holding the sample of that rank,
+        capped to max_ns: never below the exact percentile, and above it by at most the
+        bucket precision.
 */
 uint64_t latency_percentile(const latency_histogram_t *h, double percentile);
 
 /*
-    Merge histogram 'src' into 'dst.
+    Merge histogram 'src' into 'dst'.
     Not thread-safe, caller to make sure no writer is active on src.
 */
 void latency_histogram_merge(latency_histogram_t *dst, const latency_histogram_t *src);
 
-#endif
\ No newline at end of file
+#endif
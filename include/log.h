@@ -2,7 +2,10 @@
 #define LOG_H
 
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 typedef enum {
     LOG_ERROR = 0,
@@ -12,6 +15,10 @@ typedef enum {
 } log_level_t;
 
 void log_set_level(log_level_t level);
+log_level_t log_get_level(void);
+
+/* Where the lines go, stderr by default. Set it before log_async_start(). */
+void log_set_output(FILE *out);
 
 /*
   printf-style logging.
@@ -23,4 +30,72 @@ void log_msg(log_level_t level, const char *fmt, ...);
 /* Print hexdump of a memory region. */
 void log_hexdump(log_level_t level, const void *data, size_t len);
 
-#endif
\ No newline at end of file
+/*
+    Asynchronous logging, for the dataplane threads.
+
+    A thread that called log_thread_attach() does not format or write: its
+    log_msg() stores the format pointer and the arguments, in binary, in a
+    record of its own SPSC ring (strings are copied), and a background thread
+    formats and writes them in batches. A full ring drops the record and
+    counts it (log_dropped()). Threads that never attach log synchronously.
+
+    Records of one thread stay in order; lines of different threads may
+    interleave out of order by up to one drain pass (10ms).
+*/
+#define LOG_RING_SLOTS 1024 /* Records per thread, power of two */
+#define LOG_HEXDUMP_MAX 168 /* Bytes of a hexdump kept in the ring */
+
+/*
+    Start the drain thread.
+        Returns 0 if successful, -1 if not.
+*/
+int log_async_start(void);
+
+/*
+    Drain every ring, stop the thread and free the rings. Every attached
+    thread other than the caller must have exited.
+*/
+void log_async_stop(void);
+
+/*
+    Give the calling thread its own ring. No-op (synchronous logging) if the
+    drain thread is not running.
+        Returns 0 if successful, -1 if not.
+*/
+int log_thread_attach(void);
+
+/* Records dropped because a ring was full, all threads. */
+uint64_t log_dropped(void);
+
+/*
+    Rate limit of one call site in one thread: LOG_RATELIMIT_BURST messages
+    per second, the rest are counted and reported as one line when the next
+    second lets a message through.
+*/
+#define LOG_RATELIMIT_BURST 5
+
+typedef struct {
+    uint32_t second;
+    uint32_t count;
+    uint32_t suppressed;
+} log_ratelimit_t;
+
+/* Whether a message with `fmt` may go out at second `now` (coarse, monotonic). */
+bool log_ratelimit(log_ratelimit_t *rl, uint32_t now, log_level_t level, const char *fmt);
+
+/* Coarse monotonic clock in seconds, for log_ratelimit(). */
+uint32_t log_seconds(void);
+
+/*
+  log_msg() for warnings that can repeat per packet or per batch (a failing
+  syscall on the dataplane): at most LOG_RATELIMIT_BURST per second from
+  each call site and thread.
+*/
+#define log_msg_ratelimited(level, fmt, ...)                                                   \
+    do {                                                                                       \
+        static _Thread_local log_ratelimit_t log_rl_;                                          \
+        if ((level) <= log_get_level() && log_ratelimit(&log_rl_, log_seconds(), level, fmt)) \
+            log_msg(level, fmt, __VA_ARGS__);                                                  \
+    } while (0)
+
+#endif
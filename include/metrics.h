@@ -0,0 +1,62 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sock.h"
+
+/*
+    Metrics export: a small HTTP/1.0 server on a UNIX or TCP socket that hands
+    out the last snapshot the stats thread published.
+
+    The stats thread renders each snapshot from the same relaxed counter reads
+    it prints from, and swaps it in under `lock`. Only the stats thread and the
+    server thread ever take that lock, so a scrape (even a slow or stuck one)
+    costs the dataplane nothing: it only ever sees an old snapshot.
+
+        GET /metrics       Prometheus text format (0.0.4)
+        GET /metrics.json  the same as JSON
+
+    One client at a time, with a 1s timeout for its request.
+*/
+
+typedef enum {
+    METRICS_PROMETHEUS = 0,
+    METRICS_JSON = 1,
+    METRICS_FORMATS
+} metrics_format_t;
+
+typedef struct {
+    int fd; /* Listening socket, -1 when not started */
+    char path[SOCK_PATH_MAX]; /* UNIX socket, removed by metrics_server_stop(); "" for TCP */
+    pthread_t thread;
+    atomic_bool stop;
+
+    /* Snapshot [stats thread: swapped once per tick; server thread: copied per scrape] */
+    pthread_mutex_t lock;
+    char *body[METRICS_FORMATS];
+    size_t len[METRICS_FORMATS];
+} metrics_server_t;
+
+/*
+    Listen on `addr` and start the server thread.
+        unix:<path>        UNIX stream socket, owner only (an existing file at path is
+                           replaced)
+        [host:]port        TCP, host defaults to 127.0.0.1; [v6addr]:port for IPv6
+    Returns 0, or -1 (logged) if the address is invalid or cannot be bound.
+*/
+int metrics_server_start(metrics_server_t *m, const char *addr);
+
+/*
+    Replace the snapshot of `fmt` by `body` (malloc'd, e.g. by open_memstream(),
+    the server frees it). Call from one thread only.
+*/
+void metrics_server_publish(metrics_server_t *m, metrics_format_t fmt, char *body, size_t len);
+
+/* Stop the thread (within 500ms), close the socket and free the snapshots. */
+void metrics_server_stop(metrics_server_t *m);
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef MIRROR_H
+#define MIRROR_H
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pktbuf.h"
+#include "ring.h"
+#include "sock.h"
+
+/*
+    Packet mirror: a sample of the matched packets, written as pcapng to a file
+    or streamed to a UNIX socket client, to look at the traffic of a running
+    engine.
+
+    Zero-copy: a worker takes a reference on the buffer (pktbuf_ref()) instead
+    of copying the frame, and hands it over an SPSC ring (one per worker) to
+    the mirror thread. The worker's own release after sendmmsg (or the drop)
+    then no longer returns the buffer to the pool; the mirror thread writes a
+    burst of frames with one writev() straight from the buffers and drops its
+    references. Forwarded packets are taken after the TTL and MAC rewrite, as
+    they leave; dropped ones as they came in.
+
+    Budget: the mirror holds at most `budget` pool buffers at any time, in the
+    rings or being written. A sample above it is skipped, as is one that meets
+    a full ring (worker_counters_t.mirror_skipped), so a slow disk or a stalled
+    reader costs samples, never the buffers RX needs. The mirror thread also
+    flushes its pool cache whenever it runs out of work.
+
+    Sampling: 1 in `mirror` packets of a rule with that key, else 1 in `every`
+    matched packets (--mirror), drawn at random per worker so periodic traffic
+    does not alias with it.
+
+    Output (--mirror-to):
+        <path>       pcapng file, truncated at start
+        unix:<path>  pcapng stream (owner-only socket) to one client at a time, e.g.
+                     socat - UNIX-CONNECT:<path> | wireshark -k -i -
+                     Nothing is sampled while no client is connected.
+*/
+
+#define MIRROR_MAX_RINGS 64
+#define MIRROR_RING_SIZE 256      /* Per worker */
+#define MIRROR_BUDGET_DEFAULT 512 /* Pool buffers held at most */
+#define MIRROR_BURST 64           /* Frames per writev() */
+
+typedef struct {
+    /* Thread metadata [cold] */
+    pthread_t thread;
+    int core_id; /* -1: no pinning */
+
+    spsc_ring_t *rings; /* One per worker */
+    unsigned int ring_count;
+
+    /* Output [mirror thread only] */
+    int fd;        /* File or connected client, -1: none */
+    int listen_fd; /* unix: listening socket, else -1 */
+    char path[SOCK_PATH_MAX]; /* UNIX socket, removed by mirror_destroy(); "" for a file */
+
+    /* TSC of RX arrival to wall clock: CLOCK_REALTIME at mirror_init() and the TSC then. */
+    uint64_t wall0_ns;
+    uint64_t tsc0;
+    double ns_per_cycle;
+
+    atomic_bool stop;
+
+    /* Read by the workers for every matched packet [written on connect/disconnect]. */
+    alignas(CACHE_LINE_SIZE) atomic_bool active; /* Output open: its samples get written */
+    uint32_t every;  /* Global 1 in `every`, 0: only rules with a mirror key */
+    uint32_t budget; /* Buffers held at most */
+
+    /* Buffers taken and not yet released [every worker and the mirror thread] */
+    alignas(CACHE_LINE_SIZE) atomic_uint held;
+
+    /* Counters [written by the mirror thread, read by the stats thread] */
+    alignas(CACHE_LINE_SIZE) uint64_t frames_written;
+    uint64_t bytes_written;
+    uint64_t frames_lost; /* Taken, but the write failed or no output was open */
+    uint64_t clients;     /* Connections accepted on the UNIX socket */
+} mirror_t;
+
+/*
+    Open the output `to` (see above), one ring per worker. `every` 0: global
+    sampling off. `cycles_per_ns` converts the RX timestamps.
+        Returns 0 if successful, -1 (logged) if not.
+*/
+int mirror_init(mirror_t *m, const char *to, unsigned int workers, uint32_t every,
+                uint32_t budget, double cycles_per_ns);
+
+/* Ring of worker `id`, which it pushes its samples to. */
+static inline spsc_ring_t *mirror_ring(mirror_t *m, unsigned int id) { return &m->rings[id]; }
+
+/*
+    Worker: take one more buffer within the budget.
+        Returns false if the mirror already holds `budget`: skip the sample.
+*/
+static inline bool mirror_reserve(mirror_t *m) {
+    if (atomic_fetch_add_explicit(&m->held, 1, memory_order_relaxed) < m->budget) return true;
+    atomic_fetch_sub_explicit(&m->held, 1, memory_order_relaxed);
+    return false;
+}
+
+/* Return `n` reservations whose buffers never made it into a ring. */
+static inline void mirror_unreserve(mirror_t *m, unsigned int n) {
+    atomic_fetch_sub_explicit(&m->held, n, memory_order_relaxed);
+}
+
+/*
+    Write a burst of mirrored buffers (at most MIRROR_BURST) to the output,
+    then release them and their reservations. The mirror thread calls it for
+    each burst it takes from a ring.
+*/
+void mirror_write(mirror_t *m, pktbuf_t **bufs, unsigned int n);
+
+int mirror_start(mirror_t *m);
+
+/* Write what is left in the rings, then join the thread (after the workers). */
+void mirror_stop(mirror_t *m);
+
+/* Close the output, remove the socket file and free the rings. */
+void mirror_destroy(mirror_t *m);
+
+#endif
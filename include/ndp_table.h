@@ -3,6 +3,7 @@
 #define NDP_TABLE_H
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
@@ -17,10 +18,27 @@ typedef struct {
     bool valid;
 } ndp_entry_t;
 
+/*
+    Readers never lock. The table is guarded by a sequence counter (seqlock):
+    a writer makes it odd, modifies entries, then makes it even again. A reader
+    samples it before and after probing and retries if it was odd or moved.
+
+    Writers (learning, expiry) serialize on write_lock. Refreshing the
+    timestamp of an unchanged entry does not touch `seq`, so steady-state
+    traffic never makes readers retry.
+
+    `seq` also acts as the table generation: it only changes when an entry is
+    added, changes MAC or expires, so cached copies of a MAC (flow cache, L1
+    worker cache) are valid while it is unchanged. It is never 0.
+*/
 typedef struct {
+    /* Read by every lookup [shared, read-mostly] */
+    _Alignas(64) atomic_uint seq;
     ndp_entry_t *entries;
     size_t capacity;
-    pthread_rwlock_t lock;
+
+    /* Writers only */
+    _Alignas(64) pthread_mutex_t write_lock;
 } ndp_table_t;
 
 int ndp_table_init(ndp_table_t *t, size_t capacity);
@@ -29,6 +47,10 @@ void ndp_table_destroy(ndp_table_t *t);
 /* Learn / update entry in the table. */
 void ndp_update(ndp_table_t *t, const uint8_t *ip, const uint8_t *mac);
 
+/* Learn or update `n` entries under one lock and in one write section, see arp_update_bulk(). */
+void ndp_update_bulk(ndp_table_t *t, const uint8_t (*ips)[16], const uint8_t (*macs)[6],
+                     size_t n);
+
 /*
     Look up MAC address.
         Return true if found, false otherwise.
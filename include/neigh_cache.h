@@ -0,0 +1,56 @@
+#ifndef NEIGH_CACHE_H
+#define NEIGH_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "parser.h"
+
+/*
+    Per-worker neighbour (next hop -> MAC) cache in front of the shared ARP
+    and NDP tables.
+
+    4-way set associative, NEIGH_CACHE_ENTRIES entries of 32 bytes (8 KB, stays
+    in L1/L2). A set is two cache lines. The victim in a full set is picked
+    round robin.
+
+    Every entry remembers the sequence of its table (arp_table_t.seq or
+    ndp_table_t.seq) at the time it was filled. The table's sequence moves on
+    any learn, MAC change or expiry, which invalidates all cached entries of
+    that family at once without touching them.
+*/
+
+#define NEIGH_CACHE_ENTRIES 256
+#define NEIGH_CACHE_WAYS 4
+#define NEIGH_CACHE_SETS (NEIGH_CACHE_ENTRIES / NEIGH_CACHE_WAYS)
+
+typedef struct {
+    uint64_t ip[2]; /* IPv4 zero extended, or the full IPv6 address */
+    uint32_t seq;   /* Table sequence when filled, 0 = unused */
+    uint8_t ip_ver;
+    uint8_t mac[6];
+} neigh_cache_entry_t;
+
+typedef struct {
+    _Alignas(64) neigh_cache_entry_t entries[NEIGH_CACHE_SETS][NEIGH_CACHE_WAYS];
+    uint8_t next_victim[NEIGH_CACHE_SETS];
+
+    /* Counters [hot, read by the stats thread] */
+    uint64_t hits;
+    uint64_t misses;
+} neigh_cache_t;
+
+void neigh_cache_init(neigh_cache_t *c);
+
+/*
+    Look up the MAC of `ip` (family `ip_ver`) cached at table sequence `seq`.
+        Returns true and writes `out_mac` on a hit.
+*/
+bool neigh_cache_get(neigh_cache_t *c, uint8_t ip_ver, const ip_addr_t *ip, uint32_t seq,
+                     uint8_t out_mac[6]);
+
+/* Remember `mac` for `ip`, as resolved at table sequence `seq`. */
+void neigh_cache_put(neigh_cache_t *c, uint8_t ip_ver, const ip_addr_t *ip, uint32_t seq,
+                     const uint8_t mac[6]);
+
+#endif
@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+
+#include "pktbuf.h"
 
 /* Ethertypes (host byte order, use after ntohs) */
 #define ETH_TYPE_IPV4   0x0800
@@ -15,6 +18,12 @@
 #define IP_PROTO_UDP    17
 #define IP_PROTO_ICMPV6 58
 
+/* TCP flags */
+#define TCP_FLAG_FIN    0x01
+#define TCP_FLAG_SYN    0x02
+#define TCP_FLAG_RST    0x04
+#define TCP_FLAG_ACK    0x10
+
 /* ICMPv6 message types */
 #define ICMPV6_NEIGHBOR_SOL     135
 #define ICMPV6_NEIGHBOR_ADV     136
@@ -138,6 +147,7 @@ typedef struct {
     uint16_t src_port;
     uint16_t dst_port;
     uint8_t protocol;
+    uint8_t tcp_flags; /* TCP_FLAG_*, 0 for other protocols; not part of the flow */
 } flow_key_t;
 
 /*
@@ -146,10 +156,85 @@ typedef struct {
 */
 int parse_flow_key(const uint8_t *pkt, size_t len, flow_key_t *out);
 
-/* Calculate symmetric 5-tuple hash for Software RSS. */
+/* How many packets ahead parse_flow_key_burst() prefetches. */
+#define PARSE_PREFETCH_AHEAD 4
+
+/*
+    Parses a burst of `n` (<= 64) packets into `keys[0..n-1]`, prefetching the
+    headers of packet i + PARSE_PREFETCH_AHEAD while parsing packet i, so the
+    cache misses of a burst overlap instead of being paid one at a time.
+        Returns a bitmask: bit i set if `keys[i]` is valid (parse_flow_key()
+        returned 0). Keys of packets that did not parse are undefined.
+*/
+uint64_t parse_flow_key_burst(pktbuf_t *const *bufs, unsigned int n, flow_key_t *keys);
+
+/*
+    Same as parse_flow_key_burst() for packets held in some other buffer
+    type (DPDK mbufs): packet i is `lens[i]` bytes at `pkts[i]`.
+        Returns a bitmask: bit i set if `keys[i]` is valid.
+*/
+uint64_t parse_flow_key_bulk(const uint8_t *const pkts[], const uint32_t lens[], unsigned int n,
+                             flow_key_t *keys);
+
+/*
+    Calculate symmetric 5-tuple hash for Software RSS: CRC32C of the two
+    endpoints in canonical order, so both directions of a flow hash the same.
+*/
 uint32_t flow_hash(const flow_key_t *k);
 
+/*
+    CRC32C (Castagnoli) of `len` bytes, continuing from `crc`. Uses the SSE4.2
+    instruction when the CPU has it. No pre/post inversion: pass ~0 to start.
+*/
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
 /* Calculate IPv4 Header Checksum */
 uint16_t ipv4_checksum(const void *data, size_t len);
 
+/*
+    Internet checksum of `len` bytes, same result as ipv4_checksum().
+    Sums 32-bit words into wide accumulators, 32 bytes per iteration, which
+    the compiler turns into SIMD adds. For full checksums of longer data.
+*/
+uint16_t inet_checksum(const void *data, size_t len);
+
+/*
+    Incremental checksum update (RFC 1624, eqn. 3): HC' = ~(~HC + ~m + m')
+
+    `csum` is the checksum field as stored in the packet, `old_word`/`new_word`
+    the 16-bit word that changed, as stored in the packet (network order).
+    Works for every one's complement checksum: IPv4 header, and TCP/UDP when
+    a pseudo-header field (address) changes.
+        Returns the new value for the checksum field.
+*/
+static inline uint16_t csum_replace16(uint16_t csum, uint16_t old_word, uint16_t new_word) {
+    uint32_t sum = (uint32_t)(uint16_t)~csum + (uint32_t)(uint16_t)~old_word + (uint32_t)new_word;
+    /* Two folds are enough: the sum of three 16-bit values is below 2^18. */
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+/* Same for a 32-bit field (e.g. an IPv4 address rewritten by NAT). */
+static inline uint16_t csum_replace32(uint16_t csum, uint32_t old_val, uint32_t new_val) {
+    csum = csum_replace16(csum, (uint16_t)(old_val >> 16), (uint16_t)(new_val >> 16));
+    return csum_replace16(csum, (uint16_t)old_val, (uint16_t)new_val);
+}
+
+/*
+    Decrement TTL and patch the header checksum in place, without re-summing
+    the header. Caller checks ttl > 1 before.
+*/
+static inline void ipv4_dec_ttl(struct ipv4_hdr *ip) {
+    /* TTL shares its 16-bit checksum word with the protocol field. */
+    uint8_t *word = (uint8_t *)ip + offsetof(struct ipv4_hdr, ttl);
+    uint16_t old_word;
+    uint16_t new_word;
+
+    memcpy(&old_word, word, 2);
+    word[0]--;
+    memcpy(&new_word, word, 2);
+    ip->checksum = csum_replace16(ip->checksum, old_word, new_word);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+    Hardware counters of one thread (perf_event_open), for a worker's view of
+    where its cycles go: instructions per cycle, LLC and branch misses per
+    packet.
+
+    Each event is its own counter, so one the CPU or the hypervisor does not
+    offer (VMs often lack LLC events) leaves the others working. Counted in
+    the thread's user and, if perf_event_paranoid allows, kernel time; the
+    idle polls are in it too, so per-packet figures mean most under load.
+*/
+typedef enum {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_EVENTS
+} perf_event_id_t;
+
+typedef struct {
+    int fd[PERF_EVENTS]; /* -1: not available */
+} perf_counters_t;
+
+/* Mark every counter as not open. */
+void perf_counters_init(perf_counters_t *pc);
+
+/*
+    Start counting the calling thread.
+        Returns the number of events that could be opened (0 if none).
+*/
+int perf_counters_open(perf_counters_t *pc);
+
+/*
+    Read the counters (from any thread); 0 for the ones not available.
+        Returns false if none is open.
+*/
+bool perf_counters_read(const perf_counters_t *pc, uint64_t out[PERF_EVENTS]);
+
+void perf_counters_close(perf_counters_t *pc);
+
+/* "cycles", "instructions", "llc_misses" or "branch_misses". */
+const char *perf_event_name(perf_event_id_t e);
+
+#endif
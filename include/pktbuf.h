@@ -1,30 +1,152 @@
 #ifndef PKTBUF_H
 #define PKTBUF_H
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
-#define PKTBUF_DATA_SIZE 2048 /* MTU */
+/*
+    Size classes: data room of each class's buffers. Most traffic is small, so
+    a 64-byte frame no longer pins a 2 KB buffer (and its share of huge pages
+    and LLC); pktbuf_classes_t picks the smallest class that fits.
+*/
+#define PKTBUF_SMALL_SIZE 256  /* Small frames, ACKs, control traffic */
+#define PKTBUF_DATA_SIZE 2048  /* Standard: MTU frames. The AF_XDP UMEM class. */
+#define PKTBUF_JUMBO_SIZE 9216 /* Jumbo frames */
+#define PKTBUF_MAX_SIZE PKTBUF_JUMBO_SIZE
+
+typedef enum {
+    PKTBUF_CLASS_SMALL = 0,
+    PKTBUF_CLASS_STD = 1,
+    PKTBUF_CLASS_JUMBO = 2
+} pktbuf_class_t;
+#define PKTBUF_CLASSES 3
+
+#define PKTBUF_META_SIZE 64 /* One cache line of metadata */
+#define PKTBUF_HEADROOM 192 /* Default free space in front of data (encap, VLAN push) */
+#define PKTBUF_HEADROOM_MAX 1024
 
+#define PKTBUF_CACHE_DEFAULT 64 /* Buffers a thread keeps back per pool, by default */
+#define PKTBUF_CACHE_MAX 512    /* Upper limit of pktbuf_pool_set_cache_size() */
+
+struct pktbuf_pool;
+
+/*
+    Buffer layout: [metadata | headroom | data room], `stride` bytes per buffer.
+        The metadata is one cache line; the frame starts at `data`, `headroom`
+        bytes into buf[] when the buffer comes out of the pool. With the default
+        headroom, metadata + headroom is 256 bytes, equal to XDP_PACKET_HEADROOM,
+        so when the pool doubles as an AF_XDP UMEM the kernel writes the frame
+        exactly at `data`.
+*/
 typedef struct pktbuf {
-    uint64_t timestamp; /* TSC cycle count at RX arrival */
+    _Alignas(64) uint64_t timestamp; /* TSC cycle count at RX arrival */
+    uint64_t ring_tsc;         /* TSC when RX pushed it to a worker ring, 0 if it never was */
     size_t len;
-    uint8_t data[PKTBUF_DATA_SIZE];
+    uint8_t *data;             /* Start of the frame, inside buf[] */
+    struct pktbuf_pool *pool;  /* Owner, for pktbuf_release() */
+    uint32_t buf_len;          /* Bytes in buf[]: headroom + data room */
+    uint32_t index;            /* Position in the pool, links the free list */
+    _Atomic uint32_t refcnt;   /* Holders, see pktbuf_ref(); 1 while in the pool */
+    uint8_t _meta_pad[PKTBUF_META_SIZE - 2 * sizeof(uint64_t) - sizeof(size_t) -
+                      2 * sizeof(void *) - 3 * sizeof(uint32_t)];
+    uint8_t buf[];
 } pktbuf_t;
 
-typedef struct {
-    pktbuf_t *buffers;       /* Contiguous array of all buffers. */
-    pktbuf_t **free_stack;   /* Stack of pointers to free buffers. */
-    _Atomic size_t top;      /* Stack top index, modified using atomic CAS. */
+_Static_assert(sizeof(pktbuf_t) == PKTBUF_META_SIZE, "pktbuf_t metadata is one cache line");
+
+/*
+    One more holder of `b` (the packet mirror): the buffer goes back to the pool
+    with the last pktbuf_free()/pktbuf_release() of all holders. The frame and
+    `len` must not change any more once it is shared.
+    A buffer with a single holder is freed without an atomic RMW.
+*/
+static inline void pktbuf_ref(pktbuf_t *b) {
+    atomic_fetch_add_explicit(&b->refcnt, 1, memory_order_relaxed);
+}
+
+/* Bytes in front of the frame, free for prepending headers. */
+static inline size_t pktbuf_headroom(const pktbuf_t *b) { return (size_t)(b->data - b->buf); }
+
+/* Largest frame that fits at b->data. */
+static inline size_t pktbuf_room(const pktbuf_t *b) { return b->buf_len - pktbuf_headroom(b); }
+
+/*
+    Grow the frame by `n` bytes at the front (e.g. a VLAN tag or an outer header).
+        Returns the new frame start, or NULL if the headroom is too small.
+*/
+static inline uint8_t *pktbuf_prepend(pktbuf_t *b, size_t n) {
+    if (pktbuf_headroom(b) < n) return NULL;
+    b->data -= n;
+    b->len += n;
+    return b->data;
+}
+
+typedef struct pktbuf_pool {
+    uint8_t *mem;            /* All buffers, `stride` bytes apart (page aligned if mmap'd). */
+    _Atomic uint32_t *next;  /* Free list link of each buffer, by index. */
     size_t capacity;         /* Total number of buffers in the pool. */
+    size_t stride;           /* Bytes per buffer: metadata + headroom + data room, 64B aligned */
+    uint32_t data_room;      /* Frame bytes a buffer holds behind the default headroom */
+    uint16_t headroom;       /* Default headroom, restored on every free */
+    uint8_t class_id;        /* Size class (selects the thread cache) */
     size_t buffers_mmap_len; /* Size of mmap (rounded to 2MB). 0 if calloc was used. */
     bool use_hugepages;      /* Whether to use hugepages (informational). */
+    int node;                /* NUMA node the buffers live on, -1 = wherever they fell. */
+    _Atomic uint64_t remote_allocs; /* Buffers taken by threads on another node. */
+    size_t cache_size;       /* Per-thread cache capacity; half of it moves per refill/flush. */
+
+    /*
+       Global free list (see pktbuf.c). Own cache line: the fields above are
+       read on every alloc/free, these are written on every refill and flush.
+    */
+    _Alignas(64) _Atomic uint64_t head; /* Tag << 32 | index of the first free buffer */
+    _Atomic size_t free_count;          /* Buffers in the global list (not in thread caches) */
+
+    /*
+       Telemetry, updated on the slow path only (relaxed, read by the stats thread).
+       Own cache line, so counting does not slow down the CAS on `head`.
+    */
+    _Alignas(64) _Atomic uint64_t refills;  /* Global -> thread cache transfers */
+    _Atomic uint64_t flushes;               /* Thread cache -> global transfers */
+    _Atomic uint64_t cas_retries;           /* Lost races on `head` */
+    _Atomic uint64_t alloc_failures;        /* Buffers asked for while the pool was empty */
 } pktbuf_pool_t;
 
+/* Pool of standard-class buffers (PKTBUF_DATA_SIZE, default headroom). */
 int pktbuf_pool_init(pktbuf_pool_t *p, size_t capacity);
+
+/*
+    Same, with the buffers placed on NUMA node `node` (-1: no preference).
+    Placement is a preference (MPOL_PREFERRED): if the node runs out of
+    (huge) pages the kernel falls back to another one instead of failing.
+    Buffers are faulted in here, by the calling thread, never on the data path.
+*/
+int pktbuf_pool_init_node(pktbuf_pool_t *p, size_t capacity, int node);
+
+/*
+    Same, for `data_room` bytes of frame (up to PKTBUF_MAX_SIZE) behind
+    `headroom` bytes (up to PKTBUF_HEADROOM_MAX).
+        Returns 0 if successful, -1 if not.
+*/
+int pktbuf_pool_init_sized(pktbuf_pool_t *p, size_t capacity, uint32_t data_room,
+                           uint16_t headroom, int node);
+
+/* Buffer `i` of the pool. */
+static inline pktbuf_t *pktbuf_at(const pktbuf_pool_t *p, size_t i) {
+    return (pktbuf_t *)(void *)(p->mem + i * p->stride);
+}
 void pktbuf_pool_destroy(pktbuf_pool_t *p);
 
+/*
+    Set the per-thread cache capacity of `p` (2 .. PKTBUF_CACHE_MAX). Larger
+    caches touch the global list less often, but park more buffers in each
+    thread. Call before any thread uses the pool.
+        Returns 0 if successful, -1 if not.
+*/
+int pktbuf_pool_set_cache_size(pktbuf_pool_t *p, size_t size);
+
 /*
     Get a buffer from the pool.
 
@@ -40,7 +162,67 @@ pktbuf_t *pktbuf_alloc(pktbuf_pool_t *p);
 
     Fast path: Adds to thread-local cache (no atomics).
     Slow path: Flushes excess to global poll (atomic CAS).
+    A buffer with other holders (pktbuf_ref()) is left to the last of them.
 */
 void pktbuf_free(pktbuf_pool_t *p, pktbuf_t *buf);
 
-#endif
\ No newline at end of file
+/*
+    Get up to `n` buffers at once into `bufs`.
+    Served from the thread-local cache first; whatever is left is popped from
+    the global pool in one go, so a burst costs at most one CAS per cache-size
+    chunk instead of one call per buffer.
+        Returns the number of buffers written (fewer than `n` if the pool ran dry).
+*/
+unsigned int pktbuf_alloc_bulk(pktbuf_pool_t *p, pktbuf_t **bufs, unsigned int n);
+
+/* Return `n` buffers at once. NULL entries are skipped. */
+void pktbuf_free_bulk(pktbuf_pool_t *p, pktbuf_t *const *bufs, unsigned int n);
+
+/*
+    Free buffers to the pool they came from, whatever class or node that is.
+    For paths that handle buffers of several pools (workers, RX drops).
+    Like pktbuf_free(), a shared buffer only loses a holder.
+*/
+void pktbuf_release(pktbuf_t *b);
+void pktbuf_release_bulk(pktbuf_t *const *bufs, unsigned int n);
+
+/*
+    Size-classed pools: one pool per class, same node and headroom.
+    A class with capacity 0 is left out.
+*/
+typedef struct {
+    pktbuf_pool_t pool[PKTBUF_CLASSES];
+    bool ready[PKTBUF_CLASSES];
+} pktbuf_classes_t;
+
+/*
+    Buffers per class for pktbuf_classes_init(), indexed by pktbuf_class_t.
+        Returns 0 if successful, -1 if not (nothing is left allocated).
+*/
+int pktbuf_classes_init(pktbuf_classes_t *c, const size_t capacity[PKTBUF_CLASSES],
+                        uint16_t headroom, int node);
+void pktbuf_classes_destroy(pktbuf_classes_t *c);
+
+/* Data room of class `k`. */
+uint32_t pktbuf_class_size(pktbuf_class_t k);
+
+/*
+    Pool of the smallest ready class whose buffers hold `len` bytes.
+        Returns NULL if `len` is larger than every ready class.
+*/
+pktbuf_pool_t *pktbuf_classes_pick(pktbuf_classes_t *c, size_t len);
+
+/*
+    Get a buffer for a `len`-byte frame: from the smallest class that fits, or
+    the next larger one(s) while that is empty.
+        Returns NULL if no class has a buffer for it.
+*/
+pktbuf_t *pktbuf_alloc_len(pktbuf_classes_t *c, size_t len);
+
+/*
+    Return the buffers cached by the calling thread to their pools.
+    Call before the thread exits: a dead thread's cache is lost to the pool.
+*/
+void pktbuf_thread_flush(void);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef POLICER_H
+#define POLICER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Token-bucket policer of a rule with a `rate`, one per worker and rule.
+
+    Kept as a theoretical arrival time (GCRA) instead of a token count: a
+    packet conforms if the bucket's TSC deadline is at most `tolerance` ahead
+    of now, and then moves it on by the packet's cost. No refill step, no
+    division, and nothing shared on the packet path: each worker polices its
+    own share of the rate.
+
+    The stats thread sets each worker's share (cost, tolerance) and moves the
+    rate towards the workers that see the traffic, see policer_split(). The
+    worker only loads them (relaxed, a plain load).
+*/
+
+#define POLICER_COST_SHIFT 16 /* cost: TSC cycles per byte in 1/65536 */
+#define POLICER_MIN_RATE 8    /* Bytes per second a share never goes below */
+
+typedef struct {
+    uint64_t tat;               /* Theoretical arrival time, TSC [worker only] */
+    _Atomic uint64_t cost;      /* Cycles per byte << POLICER_COST_SHIFT [stats thread] */
+    _Atomic uint64_t tolerance; /* Cycles `tat` may run ahead of now: the burst [stats thread] */
+    uint64_t mark;              /* Bytes seen at the last rebalance [stats thread only] */
+} policer_t;
+
+/* Whether a packet of `len` bytes arriving at TSC `now` conforms; if so, it is charged. */
+static inline bool policer_conform(policer_t *p, uint64_t now, size_t len) {
+    uint64_t cost = atomic_load_explicit(&p->cost, memory_order_relaxed);
+    uint64_t tolerance = atomic_load_explicit(&p->tolerance, memory_order_relaxed);
+
+    uint64_t tat = p->tat > now ? p->tat : now;
+    if (tat - now > tolerance) return false;
+
+    p->tat = tat + (((uint64_t)len * cost) >> POLICER_COST_SHIFT);
+    return true;
+}
+
+/* Police at `rate` bytes/s with a `burst` of bytes, on a TSC of `tsc_hz`. */
+void policer_configure(policer_t *p, uint64_t rate, uint64_t burst, double tsc_hz);
+
+/*
+    Split `total` over `n` workers by their `demand` (bytes since the last
+    split) into share[0..n). Each worker keeps 1/(4n) of the total, so traffic
+    moving to a worker is not starved until the next split; the rest follows
+    the demand, or is split evenly if there was none. The shares add up to
+    `total`.
+*/
+void policer_split(uint64_t total, const uint64_t *demand, unsigned int n, uint64_t *share);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef QSBR_H
+#define QSBR_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Quiescent-State-Based Reclamation.
+
+    Readers (workers) hold pointers to shared data only while processing a
+    burst. Between two bursts they hold nothing, and say so by copying the
+    global epoch into their own slot (a "quiescent state").
+
+    A writer replaces a pointer, then calls qsbr_synchronize(): it starts a new
+    epoch and waits until every online reader has reported that epoch. From
+    then on no reader can still see the old pointer, so it can be freed.
+
+    Readers pay one load and one store per burst, no locks and no RMW atomics.
+    Offline readers (not started, or exited) never delay the writer.
+*/
+
+#define QSBR_OFFLINE UINT64_MAX
+
+typedef struct {
+    _Alignas(64) atomic_uint_fast64_t seen; /* Last epoch seen quiescent, or QSBR_OFFLINE */
+} qsbr_reader_t;
+
+typedef struct {
+    _Alignas(64) atomic_uint_fast64_t epoch;
+    qsbr_reader_t *readers;
+    size_t count;
+} qsbr_t;
+
+/*
+    Create a domain with `count` reader slots, all offline.
+        Returns 0 if successful, -1 if not.
+*/
+int qsbr_init(qsbr_t *q, size_t count);
+void qsbr_destroy(qsbr_t *q);
+
+/* Report a quiescent state: reader `id` holds no references to shared data. */
+static inline void qsbr_quiescent(qsbr_t *q, size_t id) {
+    /* Acquire pairs with the writer's epoch increment: loads after this point
+     * observe everything published before the new epoch started. */
+    uint_fast64_t e = atomic_load_explicit(&q->epoch, memory_order_acquire);
+    /* Release: reads of the old data are done before the writer sees `e`. */
+    atomic_store_explicit(&q->readers[id].seen, e, memory_order_release);
+}
+
+/* Reader `id` starts (or resumes) taking references. Call before the first burst. */
+void qsbr_online(qsbr_t *q, size_t id);
+
+/* Reader `id` stops taking references (thread exit, long sleep). */
+void qsbr_offline(qsbr_t *q, size_t id);
+
+/*
+    Wait for a grace period: return once every reader that was online has
+    passed a quiescent state after this call started. Writer side only.
+*/
+void qsbr_synchronize(qsbr_t *q);
+
+#endif
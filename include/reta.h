@@ -0,0 +1,146 @@
+#ifndef RETA_H
+#define RETA_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pktbuf.h"
+
+/*
+    Redirection table (RETA) for software RSS: flow hash -> bucket -> ring.
+
+    The RX thread looks up RETA_SIZE buckets instead of masking the hash into
+    a ring index, so the ring count can be anything and the stats thread can
+    move individual buckets off an overloaded worker.
+
+    [Moving a bucket without reordering]
+    Packets of the bucket may still sit in the old ring, or in the old
+    worker's current burst. Sending new ones to the new ring right away could
+    overtake them. So the RX thread:
+        1. Flushes its staging batch of the old ring and marks the old ring's
+           head (total packets pushed so far).
+        2. Holds packets of the bucket in a small buffer instead of sending them.
+        3. Once the old worker's completed counter reaches the mark, points the
+           bucket at the new ring and sends the held packets there, first.
+    "Completed" means sent: in pipeline mode (tx_stage.h) a worker counts a
+    burst only once its TX stage has taken it off the worker's TX ring, so a
+    bucket can move to a worker of another stage, or to another ring of the
+    same stage, and its new packets still leave after the old ones.
+    One move is in flight at a time; it takes about one ring drain. If the
+    hold buffer fills up first, the move is given up: the held packets go to
+    the old ring after all, still in order, and the rebalancer may retry later.
+*/
+
+#define RETA_SIZE 512      /* Buckets, power of two */
+#define RETA_HOLD_SIZE 256 /* Packets of a moving bucket held back at most */
+
+#define RETA_HOLD (-1) /* reta_lookup(): bucket is moving, hold the packet */
+
+/* Rebalance when the busiest ring gets this much more than the mean (percent). */
+#define RETA_IMBALANCE_PCT 25
+
+typedef struct {
+    /* Bucket -> ring [RX: read per packet, written on a move; stats thread: read] */
+    _Atomic uint16_t table[RETA_SIZE];
+    uint16_t ring_count;
+
+    /* Packets per bucket [RX: written per packet; stats thread: read] */
+    atomic_uint_fast64_t hits[RETA_SIZE];
+
+    /* Completed packets of each ring's worker (worker_t.pkts_done), set by the owner. */
+    const atomic_uint_fast64_t **done;
+
+    /* Move requested by the stats thread: 0 = none, else (bucket + 1) << 16 | ring. */
+    _Alignas(64) atomic_uint pending;
+
+    /* Move in flight [RX only] */
+    _Alignas(64) int moving; /* Bucket being moved, -1 = none */
+    uint16_t move_from;
+    uint16_t move_to;
+    uint64_t move_mark;
+    pktbuf_t *hold[RETA_HOLD_SIZE];
+    unsigned int hold_count;
+
+    /* Counters [RX writes, stats thread reads] */
+    atomic_uint_fast64_t moves;
+    atomic_uint_fast64_t aborts; /* Hold buffer filled before the old worker drained */
+
+    /* Rebalancer state [stats thread only] */
+    uint64_t last_hits[RETA_SIZE];
+} reta_t;
+
+/*
+    Spread the buckets round robin over `ring_count` rings (any count >= 1).
+        Returns 0 if successful, -1 if not.
+*/
+int reta_init(reta_t *t, uint16_t ring_count);
+void reta_destroy(reta_t *t);
+
+/*
+    RX: ring for a packet with flow hash `hash`, or RETA_HOLD if its bucket is
+    being moved (pass the packet to reta_hold()).
+*/
+static inline int reta_lookup(reta_t *t, uint32_t hash) {
+    uint32_t b = hash & (RETA_SIZE - 1);
+
+    /* Single writer: a relaxed load/store pair instead of a locked add. */
+    uint_fast64_t n = atomic_load_explicit(&t->hits[b], memory_order_relaxed);
+    atomic_store_explicit(&t->hits[b], n + 1, memory_order_relaxed);
+
+    if ((int)b == t->moving) return RETA_HOLD;
+    return atomic_load_explicit(&t->table[b], memory_order_relaxed);
+}
+
+/*
+    RX: keep `b` back until the move of its bucket completes.
+        Returns false if the hold buffer is full: the caller gives up the move
+        with reta_move_abort().
+*/
+bool reta_hold(reta_t *t, pktbuf_t *b);
+
+/*
+    RX: give up the move in flight, the bucket stays on its ring.
+        Returns that ring: the caller sends the t->hold_count held packets
+        there, in order, then sets hold_count = 0.
+*/
+uint16_t reta_move_abort(reta_t *t);
+
+/*
+    RX: start the pending move, if any and none is in flight.
+        Returns the ring the bucket leaves; the caller flushes its staging
+        batch to that ring, then calls reta_arm() with the ring's head.
+        Returns -1 if there is nothing to start.
+*/
+int reta_move_begin(reta_t *t);
+void reta_arm(reta_t *t, uint64_t mark);
+
+/*
+    RX: finish the move in flight once the old worker has completed every
+    packet up to the mark. Returns true if the bucket now points at its new
+    ring: the caller sends the t->hold_count held packets there, in order,
+    then sets hold_count = 0.
+*/
+bool reta_move_try_finish(reta_t *t);
+
+/*
+    Stats thread: ask RX to move `bucket` to `ring`.
+        Returns 0 if queued, -1 if a request is still pending.
+*/
+int reta_request_move(reta_t *t, uint32_t bucket, uint16_t ring);
+
+/*
+    Stats thread, called periodically: find the busiest ring by `ring_load`
+    (packets each worker took in since the last call). If it is more than
+    RETA_IMBALANCE_PCT above the mean and has built up a backlog
+    (`ring_backlog` >= `ring_capacity` / 8, i.e. its worker falls behind),
+    request moving its bucket with the largest load that still fits in the gap
+    to the least loaded ring. A single elephant bucket is left in place, the
+    other buckets move away from it instead.
+        Returns 1 if a move was requested, 0 if not.
+*/
+int reta_rebalance(reta_t *t, const uint64_t *ring_load, const size_t *ring_backlog,
+                   size_t ring_capacity);
+
+#endif
@@ -4,18 +4,45 @@
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdalign.h>
 
 #define CACHE_LINE_SIZE 64
 
-typedef struct {
+struct spsc_ring;
+
+/*
+    Watermark callback, run by the producer inside ring_push_burst() or
+    ring_check_watermarks(): `high` is true when the occupancy reached the
+    high watermark, false when it fell back to the low one.
+*/
+typedef void (*ring_wm_fn)(struct spsc_ring *r, bool high, void *arg);
+
+typedef struct spsc_ring {
     void **slots;    /* void, so ring doesn't have to know about pktbuf_t* */
     size_t capacity; /* must be power of two */
     size_t mask;
 
-    /* producer writes at head, consumer reads at tail */
+    /*
+        Producer writes at head, consumer reads at tail. Each side keeps a
+        private copy of the other's index and only reloads it (a cache miss on
+        a line the other core writes) when the copy says full/empty for the
+        request at hand.
+    */
+    /* [producer] */
     alignas(CACHE_LINE_SIZE) atomic_size_t head;
+    size_t tail_cache;
+    atomic_size_t high_water; /* Largest occupancy the producer saw [read by the stats thread] */
+    size_t wm_high;           /* 0: no watermarks */
+    size_t wm_low;
+    bool wm_above;
+    ring_wm_fn wm_fn;
+    void *wm_arg;
+
+    /* [consumer] */
     alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+    size_t head_cache;
+    _Atomic uint32_t waiting; /* 1 while the consumer sleeps in ring_wait() (futex word) */
 } spsc_ring_t;
 
 int ring_init(spsc_ring_t *r, size_t capacity);
@@ -45,4 +72,59 @@ void *ring_pop(spsc_ring_t *r);
 */
 unsigned int ring_pop_burst(spsc_ring_t *r, void **objs, unsigned int count);
 
-#endif
\ No newline at end of file
+/*
+    Consumer: up to `max` entries at the front of the ring, in place, without
+    copying them out. `*slots` points at the first one. The entries are
+    contiguous, so the peek stops at the end of the slot array; the next one
+    continues at its start.
+    The slots stay the consumer's until ring_pop_commit(): the producer cannot
+    overwrite them meanwhile.
+        Returns the number of entries.
+*/
+unsigned int ring_peek_burst(spsc_ring_t *r, void ***slots, unsigned int max);
+
+/* Consumer: release the first `n` peeked entries to the producer. */
+void ring_pop_commit(spsc_ring_t *r, unsigned int n);
+
+/*
+    Producer: call `fn` when the occupancy reaches `high` (it is at or above
+    it after a push), and again when it is back at or below `low`. Between the
+    two the producer reloads the tail on every push, so the low crossing is
+    seen as soon as it pushes again, or calls ring_check_watermarks().
+        Returns 0 if successful, -1 if not (needs 0 <= low < high <= capacity).
+*/
+int ring_set_watermarks(spsc_ring_t *r, size_t high, size_t low, ring_wm_fn fn, void *arg);
+
+/*
+    Producer: re-evaluate the watermarks against the consumer's current tail,
+    e.g. while not pushing because the ring is above the high one.
+*/
+void ring_check_watermarks(spsc_ring_t *r);
+
+/*
+    Any thread: largest occupancy the producer has seen. Sampled whenever it
+    reloads the tail: exact at and above the high watermark (reloaded on
+    every push there), and when the ring ran full.
+*/
+size_t ring_high_water(const spsc_ring_t *r);
+
+/*
+    Consumer: sleep until the producer calls ring_notify(), or `timeout_us`
+    passes. Returns at once if the ring is not empty.
+        Returns true if it slept.
+*/
+bool ring_wait(spsc_ring_t *r, unsigned int timeout_us);
+
+/*
+    Producer: after a push, wake the consumer if it sleeps in ring_wait().
+    Costs a fence and a load when it does not; a syscall when it does.
+*/
+void ring_notify(spsc_ring_t *r);
+
+/*
+    Any thread: number of entries currently in the ring. Only a snapshot,
+    for monitoring.
+*/
+size_t ring_occupancy(const spsc_ring_t *r);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef RULE_API_H
+#define RULE_API_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "rule_table.h"
+#include "sock.h"
+
+/*
+    Rule API: incremental rule updates over a UNIX stream socket.
+
+    A client sends one delta per connection, one change per line, and gets one
+    reply once the delta has been applied or rejected as a whole:
+
+        add <key=value>...            New rule, the keys of a [rule] section
+        modify <id> <key=value>...    Replace rule <id>: same id, counters kept
+        delete <id>
+        commit                        End of the delta (or close the write side)
+
+        ok <rules> rules, generation <g>    Then "added <id>" per add, in order
+        error: <what>                       Nothing was changed
+
+    The server thread only parses. The delta goes to the stats thread, which
+    owns the rule table: it takes it with rule_api_poll() between its ticks,
+    builds the new table with rule_table_apply(), publishes it and answers
+    with rule_api_reply(). One client at a time, with a 1s timeout for its
+    request. The socket is created mode 0600: updates need the owner's rights.
+*/
+
+#define RULE_API_MAX_DELTAS 4096
+#define RULE_API_REQUEST_MAX (1024 * 1024) /* Bytes */
+
+typedef struct {
+    rule_delta_t *deltas;
+    size_t count;
+    char *reply; /* Written by the stats thread, reply_cap bytes */
+    size_t reply_cap;
+    bool done;
+} rule_api_request_t;
+
+typedef struct {
+    int fd;         /* Listening socket, -1 when not started */
+    char path[SOCK_PATH_MAX]; /* Removed again by rule_api_stop() */
+    pthread_t thread;
+    atomic_bool stop;
+
+    /* Hand-over [server thread: submits and waits; stats thread: takes and replies] */
+    pthread_mutex_t lock;
+    pthread_cond_t cond; /* CLOCK_MONOTONIC */
+    rule_api_request_t *pending;
+} rule_api_t;
+
+/*
+    Listen on the owner-only UNIX socket `path` (an existing file is replaced)
+    and start the server thread.
+        Returns 0, or -1 (logged) if the path is invalid or cannot be bound.
+*/
+int rule_api_start(rule_api_t *a, const char *path);
+
+/*
+    Wait up to `timeout_ms` for a delta.
+        Returns it, to be answered with rule_api_reply(), or NULL.
+*/
+rule_api_request_t *rule_api_poll(rule_api_t *a, int timeout_ms);
+
+/* Send req->reply (a NUL-terminated string) to the client of `req`. */
+void rule_api_reply(rule_api_t *a, rule_api_request_t *req);
+
+/* Stop the thread (within 500ms), refuse a delta not taken yet, remove the socket. */
+void rule_api_stop(rule_api_t *a);
+
+/*
+    Parse a request (lines as above) into deltas[0..*count), at most `max`.
+        Returns 1 when `commit` ended it, 0 at the end of `buf`, -1 on error
+        (what is wrong in err[err_len]).
+*/
+int rule_api_parse(char *buf, rule_delta_t *deltas, size_t max, size_t *count, char *err,
+                   size_t err_len);
+
+#endif
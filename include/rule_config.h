@@ -1,6 +1,8 @@
 #ifndef RULE_CONFIG_H
 #define RULE_CONFIG_H
 
+#include <stddef.h>
+
 #include "rule_table.h"
 
 /*
@@ -9,4 +11,11 @@
 */
 int rule_config_load(const char *path, rule_table_t *rt);
 
+/*
+    Parse one rule given as the keys of a [rule] section on a single line,
+    separated by blanks, e.g. "priority=10 protocol=tcp dst_port=80 action=drop".
+        Returns 0 on success, -1 on error (what is wrong in err[err_len]).
+*/
+int rule_config_parse_line(const char *line, rule_t *r, char *err, size_t err_len);
+
 #endif
\ No newline at end of file
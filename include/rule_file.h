@@ -0,0 +1,93 @@
+#ifndef RULE_FILE_H
+#define RULE_FILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "classifier.h"
+#include "rule_table.h"
+
+/*
+    Compiled rule set (written by upe-rulec): the priority-sorted rules and the
+    classifier's tuple hash tables, laid out so that rule_file_load() maps the
+    file and uses both in place. Loading is one mmap(), a checksum and a bounds
+    check of every index: no parsing, sorting or hashing, so a large rule set
+    loads (and reloads on SIGHUP) in milliseconds.
+
+    Layout, host byte order, each section 64-byte aligned:
+        header   rule_file_header_t
+        ifaces   iface_count x rule_file_iface_t
+        rules    rule_count x rule_t
+        tuples   tuple_count x rule_file_tuple_t
+        slots    per tuple, slot_mask + 1 x cls_entry_t
+
+    The file belongs to the build that wrote it: the version, the struct sizes
+    and a byte-order mark must all match, otherwise it is rejected (compile the
+    text rules again). Interface indexes are host state, so each out_ifindex is
+    stored with the interface name and resolved again when the file is loaded.
+*/
+
+#define RULE_FILE_MAGIC "UPERULES" /* 8 bytes, no terminator in the file */
+#define RULE_FILE_VERSION 4 /* 3: policer rate and burst, 4: mirror rate in the rule action */
+#define RULE_FILE_BYTE_ORDER 0x01020304u
+#define RULE_FILE_ALIGN 64
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order; /* RULE_FILE_BYTE_ORDER as the writer stored it */
+    uint32_t rule_size;  /* sizeof(rule_t) */
+    uint32_t entry_size; /* sizeof(cls_entry_t) */
+    uint32_t rule_count;
+    uint32_t tuple_count;
+    uint32_t iface_count;
+    uint32_t reserved;
+    uint64_t ifaces_off; /* Section offsets from the start of the file */
+    uint64_t rules_off;
+    uint64_t tuples_off;
+    uint64_t file_size;
+    uint64_t checksum; /* Over everything after the header, see rule_file_checksum() */
+} rule_file_header_t;
+
+typedef struct {
+    char name[16]; /* IF_NAMESIZE, NUL-terminated */
+    int32_t ifindex; /* When the file was written */
+    uint32_t reserved;
+} rule_file_iface_t;
+
+typedef struct {
+    uint64_t mask[CLS_KEY_WORDS];
+    uint64_t min_order;
+    uint32_t count;
+    uint32_t slot_mask;
+    uint64_t slots_off; /* From the start of the file */
+} rule_file_tuple_t;
+
+/*
+    Write the compiled table `rt` (rule_table_compile() succeeded) to `path`.
+        Returns 0 on success, -1 on error (logged).
+*/
+int rule_file_write(const char *path, const rule_table_t *rt);
+
+/*
+    Map a compiled rule file into `rt` (not initialized): the rules and the
+    classifier point into the mapping until rule_table_destroy().
+        Returns 0 on success, -1 if the file is invalid or from another build (logged).
+*/
+int rule_file_load(const char *path, rule_table_t *rt);
+
+/* Whether `path` starts like a compiled rule file (any version). */
+bool rule_file_detect(const char *path);
+
+/*
+    Load rules from `path` into `rt` (not initialized), whichever format it
+    holds: a compiled file is mapped, a text file parsed and then compiled. A
+    failed classifier build leaves the linear scan (check rt->cls).
+        Returns 0 on success, -1 on error (logged).
+*/
+int rule_table_load(const char *path, rule_table_t *rt);
+
+/* Checksum of `len` bytes (a multiple of 8): FNV-1a over 64-bit words. */
+uint64_t rule_file_checksum(const void *data, size_t len);
+
+#endif
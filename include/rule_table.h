@@ -14,6 +14,10 @@ typedef enum {
 typedef struct {
     action_type_t type;
     int out_ifindex; /* linux interface index for TX */
+    /* Policer (ACT_FWD only): packets above `rate` are dropped, see policer.h */
+    uint64_t rate;  /* Bytes per second, 0 = not policed */
+    uint64_t burst; /* Bytes */
+    uint32_t mirror; /* Mirror 1 in `mirror` packets (see mirror.h), 0 = the global rate */
 } flow_action_t;
 
 typedef struct {
@@ -34,10 +38,24 @@ typedef struct {
     uint32_t rule_id;
 } rule_t;
 
+/* Compiled lookup structure, see classifier.h */
+typedef struct classifier classifier_t;
+
+/* Initial capacity of tables loaded from a file; a table grows as rules are added. */
+#define RULE_TABLE_DEFAULT_CAPACITY 1024
+
 typedef struct {
     rule_t *rules;
     size_t count;
-    size_t capacity;
+    size_t capacity;   /* Above every rule id too: it sizes the per-rule stats */
+    uint32_t next_id;  /* Id of the next rule added; ids are never reused */
+    classifier_t *cls; /* Built by rule_table_compile(), NULL = linear scan */
+    uint32_t generation; /* Changes whenever rule pointers change meaning, never 0 */
+
+    /* Compiled rule file the rules (and the classifier) are mapped from, see
+     * rule_file.h. NULL: both are on the heap. Adding a rule copies them out. */
+    void *map;
+    size_t map_len;
 } rule_table_t;
 
 /*
@@ -51,11 +69,62 @@ void rule_table_destroy(rule_table_t *t);
 
 /*
     Add rule, the table will contain a copy of the rule & assign rule id
-    Rules are sorted by priority after insertion
+    Rules are sorted by priority after insertion; the table grows as needed.
         Returns 0 if successful, -1 if not.
 */
 int rule_table_add(rule_table_t *t, const rule_t *r_in);
 
+/*
+    Add `n` rules (ids in array order) with a single sort at the end: the way
+    to load a rule set, rule_table_add() sorts after every rule.
+        Returns 0 if successful, -1 if not (the table is unchanged).
+*/
+int rule_table_add_bulk(rule_table_t *t, const rule_t *rules, size_t n);
+
+typedef enum {
+    RULE_ADD = 0,
+    RULE_DELETE = 1,
+    RULE_MODIFY = 2
+} rule_op_t;
+
+/* One change of a rule_table_apply() delta. */
+typedef struct {
+    rule_op_t op;
+    uint32_t rule_id; /* DELETE, MODIFY: the rule. ADD: set to the new rule's id */
+    rule_t rule;      /* ADD, MODIFY: the new version (its rule_id is ignored) */
+} rule_delta_t;
+
+/*
+    Build `next` (not initialized) as `cur` with `deltas[0..n)` applied in order,
+    leaving `cur` in use by its readers. Rules keep their ids; a modified rule
+    too. Added ones get ids never used before, so per-rule counters indexed by
+    id stay valid for every rule the delta does not touch, and the capacity is
+    kept unless the new ids need more. A compiled `cur` is updated: only the
+    classifier tuples of the changed rules are built again, the others are
+    shared with `cur` (see classifier_update()) until rule_table_take_over().
+    Destroying `next` before that leaves `cur` intact.
+        Returns 0 if successful, -1 if not: *failed is the index of the delta
+        naming an unknown rule, or n on allocation failure. `cur` is unchanged.
+*/
+int rule_table_apply(rule_table_t *next, rule_table_t *cur, rule_delta_t *deltas, size_t n,
+                     size_t *failed);
+
+/*
+    Commit `next` as the successor of `cur`: `next` takes over what it shares
+    with `cur` since rule_table_apply(), so `cur` can be destroyed once no
+    reader uses it any more. Call only once the switch to `next` cannot fail.
+    A no-op for tables not built by rule_table_apply() from `cur`.
+*/
+void rule_table_take_over(rule_table_t *next, rule_table_t *cur);
+
+/*
+    Compile the current rules into the classifier used by rule_table_match().
+    Call once the table is fully loaded; rule_table_add() drops the compiled
+    classifier again, falling back to the linear scan.
+        Returns 0 if successful, -1 if not (the linear scan stays in use).
+*/
+int rule_table_compile(rule_table_t *t);
+
 /*
     Return the first matching rule (highest priority due to sorting).
         Returns matching rule_t or NULL if no match.
@@ -76,4 +145,4 @@ bool ipv4_mask_from_prefix(uint8_t prefix_len, uint32_t *out_mask);
 */
 bool ipv6_mask_from_prefix(uint8_t prefix_len, uint8_t out_mask[16]);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,32 +1,135 @@
 #ifndef RX_H
 #define RX_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include "pktbuf.h"
+#include "reta.h"
 #include "ring.h"
 #include "rule_table.h"
 
 #define RX_BURST_SIZE 32
 
+typedef enum {
+    RX_MODE_PCAP = 0,     /* libpcap: live capture or offline .pcap replay */
+    RX_MODE_AFPACKET = 1, /* AF_PACKET TPACKET_V3 mmap'd RX ring (live only) */
+    RX_MODE_XDP = 2       /* AF_XDP socket, UMEM = packet pool (live only) */
+} rx_mode_t;
+
 typedef struct {
     pktbuf_t *buffer[RX_BURST_SIZE];
     unsigned int count;
 } rx_batch_t;
 
 typedef struct {
+    rx_mode_t mode;
     const char *iface;
     const char *pcap_file;
 
-    pktbuf_pool_t *pool;
+    pktbuf_classes_t *pools; /* Size-classed; AF_XDP uses the standard class as UMEM */
 
     spsc_ring_t *rings;
-    uint16_t ring_count;
+    uint16_t ring_count; /* Any count, not only powers of two */
+    bool wake_workers;   /* Workers sleep in ring_wait(): ring_notify() after each push */
     rx_batch_t *batches;
+    bool *congested;     /* Per ring: above its high watermark, only control traffic goes in */
+
+    reta_t *reta;        /* NULL: ring = flow hash % ring_count, never rebalanced */
+    uint32_t reta_tick;  /* Packets since RETA moves were last looked at */
+
+    uint64_t nobuf_drops;     /* pcap: packets dropped because the pool was empty */
+    uint64_t oversized_drops; /* pcap: packets larger than the largest size class */
+    uint64_t early_drops;     /* Data packets dropped at a congested ring */
 } rx_ctx_t;
 
+/*
+    Run the RX loop of the backend selected by rx->mode (blocking).
+        Returns 0 when stopped or on EOF, -1 on setup error.
+*/
 int rx_start(rx_ctx_t *rx);
+
+/* Ask the running RX loop to return. Async-signal-safe. */
 void rx_stop(void);
 
-#endif
\ No newline at end of file
+/*
+    Helpers shared by the RX backends.
+*/
+
+/*
+    Allocate the staging batches and congestion flags of the rings and set
+    their watermarks; rx_start() does it before the backend runs. A caller
+    that feeds rx_dispatch() itself (benchmark_throughput --pcap) uses this
+    pair instead of rx_start().
+        Returns 0 if successful, -1 if not.
+*/
+int rx_ctx_setup(rx_ctx_t *rx);
+
+/* Return packets a RETA move still holds and free what rx_ctx_setup() allocated. */
+void rx_ctx_teardown(rx_ctx_t *rx);
+
+/*
+    Software RSS: pick a worker ring for `b` by flow hash (through rx->reta) and
+    stage it in that ring's batch. A full batch is pushed right away; packets
+    that don't fit in the ring are dropped.
+*/
+void rx_dispatch(rx_ctx_t *rx, pktbuf_t *b);
+
+/* Push every partially filled staging batch to its ring, and drive RETA moves. */
+void rx_flush(rx_ctx_t *rx);
+
+/* True once rx_stop() has been called. */
+bool rx_should_stop(void);
+
+/* pcap backend (rx_pcap.c), called by rx_start()/rx_stop(). */
+int rx_pcap_run(rx_ctx_t *rx);
+void rx_pcap_stop(void);
+
+/*
+    AF_PACKET TPACKET_V3 RX ring.
+
+    The kernel fills fixed-size blocks with many frames and hands a whole block
+    over by flipping its status to TP_STATUS_USER. We walk all frames of a
+    block, then return the block to the kernel. No syscall per packet and no
+    per-packet callback; poll() is only needed when the ring is empty.
+*/
+typedef struct {
+    int fd;
+    uint8_t *map;             /* mmap'd ring: block_count * block_size bytes */
+    size_t map_len;
+    unsigned int block_size;
+    unsigned int block_count;
+
+    /* Walk cursor [accessed on every burst] */
+    unsigned int block_idx;   /* Block currently owned by user space (or next to wait on) */
+    uint32_t pkts_left;       /* Frames not yet consumed in the current block, 0 = none */
+    const uint8_t *next_pkt;  /* Next tpacket3_hdr in the current block */
+
+    uint64_t oversized_drops; /* Frames larger than the largest size class */
+    uint64_t nobuf_drops;     /* Frames dropped because the pool was empty */
+} rx_afpacket_t;
+
+/*
+    Open an AF_PACKET socket on `iface`, set up a TPACKET_V3 RX ring and mmap it.
+    With `fanout_group` >= 0 the socket joins that PACKET_FANOUT_HASH group, so
+    the kernel spreads flows across all member sockets.
+        Returns 0 on success, -1 on error.
+*/
+int rx_afpacket_open(rx_afpacket_t *s, const char *iface, int fanout_group);
+
+/*
+    Copy up to `max` received frames into buffers from `pools`, each into the
+    smallest size class that holds it.
+    Never blocks; returns 0 if the kernel has not retired a block yet.
+        Returns the number of buffers written to `out`.
+*/
+unsigned int rx_afpacket_recv_burst(rx_afpacket_t *s, pktbuf_classes_t *pools, pktbuf_t **out,
+                                    unsigned int max);
+
+/* Wait up to `timeout_ms` for the next block. Returns poll() result. */
+int rx_afpacket_wait(rx_afpacket_t *s, int timeout_ms);
+
+void rx_afpacket_close(rx_afpacket_t *s);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef SOCK_H
+#define SOCK_H
+
+#include <stddef.h>
+
+/*
+    UNIX stream socket helpers of the control sockets (metrics, rule API,
+    packet mirror): one thread serves one client at a time, with timeouts so
+    that a stuck client cannot hold it up.
+
+    The sockets are created owner-only (0600): they hand out counters and
+    packet contents, or take rule changes. Give access to other users through
+    the directory the socket is in.
+*/
+
+/* Longest socket path, including the terminating NUL (sockaddr_un.sun_path). */
+#define SOCK_PATH_MAX 108
+
+/*
+    Bind a UNIX stream socket to `path` (an existing file there is replaced),
+    restrict it to the owner and listen with `backlog`. `who` prefixes the log
+    messages, e.g. "Metrics".
+        Returns the listening socket, or -1 (logged; nothing is left at path).
+*/
+int sock_listen_unix(const char *path, int backlog, const char *who);
+
+/*
+    Wait up to `timeout_ms` for a client on `listen_fd` and accept it. Reads and
+    writes on the client socket give up after `io_timeout_ms`.
+        Returns the client socket, or -1 if none came.
+*/
+int sock_accept(int listen_fd, int timeout_ms, int io_timeout_ms);
+
+/*
+    Write all of `buf` (no SIGPIPE if the peer is gone).
+        Returns 0, or -1 if the peer closed or the write timed out.
+*/
+int sock_send_all(int fd, const void *buf, size_t len);
+
+#endif
@@ -6,16 +6,29 @@
 
 #define TX_BATCH_MAX 64
 
+/* mmap'd PACKET_TX_RING state, private to tx_afpacket.c. */
+typedef struct tx_ring tx_ring_t;
+
 typedef struct {
     int sock_fd;
     int ifindex;
     uint8_t eth_addr[6];
     uint32_t ip4_addr;
+    tx_ring_t *ring; /* NULL: sendto/sendmmsg path */
 } tx_ctx_t;
 
 /* Initialize a TX context bound to an interface. Returns 0 on success, -1 on failure. */
 int tx_init(tx_ctx_t *ctx, const char *out_iface);
 
+/*
+    Switch an initialized context to a TPACKET_V2 TX ring with qdisc bypass.
+    Afterwards tx_send()/tx_send_batch() copy frames into ring slots and kick the
+    kernel with one send() per call. The ring has a single producer, so every
+    thread needs its own context.
+        Returns 0 on success, -1 on failure (the context stays on sendmmsg).
+*/
+int tx_ring_enable(tx_ctx_t *ctx);
+
 /*
     Send an Ethernet frame.
         Returns 0 on success, -1 on failure.
@@ -24,10 +37,12 @@ int tx_send(const tx_ctx_t *ctx, const uint8_t *frame, size_t len);
 
 /*
     Send a batch of Ethernet frames in a single kernel entry.
+    With a TX ring, a frame counts as sent once it is queued in the ring; a
+    frame too large for a ring slot is dropped without ending the batch.
         Returns number of successfully sent messages, or -1 on error.
 */
 int tx_send_batch(const tx_ctx_t *ctx, const uint8_t *const *frames, const size_t *lens, int count);
 
 void tx_close(tx_ctx_t *ctx);
 
-#endif
\ No newline at end of file
+#endif
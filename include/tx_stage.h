@@ -0,0 +1,67 @@
+#ifndef TX_STAGE_H
+#define TX_STAGE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ring.h"
+#include "tx.h"
+#include "worker.h"
+
+/*
+    TX stage of the pipeline mode (--mode pipeline).
+
+    In run-to-completion mode a worker parses, classifies, rewrites and sends
+    its own packets. With a rule set heavy enough that a core can't do all of
+    it at line rate, the pipeline splits the send off: workers hand finished
+    packets over an SPSC ring (worker_t.tx_ring) to a TX stage thread on
+    another core, which owns the TX context and frees the buffers.
+
+    A stage serves one or more workers' rings, round robin, one burst per ring
+    and round. Packets of one worker leave in order. The ring's tail tells the
+    worker how far the stage got: a worker only reports a burst completed to
+    RETA bucket moves (reta.h) once the tail passed it, so a moved flow stays
+    in order across stages too.
+*/
+
+#define TX_STAGE_MAX_RINGS 64
+
+typedef struct {
+    /* Thread metadata [cold] */
+    pthread_t thread;
+    int stage_id;
+    int core_id; /* -1: no pinning */
+
+    spsc_ring_t *rings[TX_STAGE_MAX_RINGS]; /* One per worker it serves */
+    unsigned int ring_count;
+    const tx_ctx_t *tx;
+    idle_mode_t idle_mode; /* wakeup behaves like backoff: no single ring to sleep on */
+
+    /* Set by the owner once the workers are joined: drain the rings, then exit. */
+    atomic_bool stop;
+
+    /* Counters [written by the stage, read by the stats thread] */
+    uint64_t pkts_sent;
+    uint64_t pkts_dropped; /* Rejected by the kernel, or the TX ring was full */
+    uint64_t bursts;
+    uint32_t idle_streak;
+} tx_stage_t;
+
+/* Returns 0 if successful, -1 if not. */
+int tx_stage_init(tx_stage_t *s, int stage_id, int core_id, const tx_ctx_t *tx,
+                  idle_mode_t idle_mode);
+
+/*
+    Serve `r` too (before tx_stage_start()).
+        Returns 0 if successful, -1 if the stage already has TX_STAGE_MAX_RINGS.
+*/
+int tx_stage_add_ring(tx_stage_t *s, spsc_ring_t *r);
+
+int tx_stage_start(tx_stage_t *s);
+
+/* Let the stage send what is left in its rings, then join it. */
+void tx_stage_stop(tx_stage_t *s);
+
+#endif
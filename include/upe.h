@@ -6,11 +6,44 @@
 #include <stdint.h>
 
 #include "rule_table.h"
+#include "rx.h"
+#include "worker.h"
+
+#define UPE_WORKERS_DEFAULT 2
+#define UPE_WORKERS_MAX 64           /* Also the most rings a TX stage serves */
+#define UPE_RING_SIZE_DEFAULT 1024   /* Entries per worker ring, power of two */
+#define UPE_RING_SIZE_MAX 65536
+#define UPE_POOL_SIZE_DEFAULT 4096   /* Standard-class buffers per pool */
+#define UPE_POOL_SIZE_MAX (1 << 20)
+#define UPE_CORES_MAX 256            /* Entries of --cores */
 
 typedef struct {
     const char *iface;      /* interface name */
     const char *pcap_file;  /* offline pcap file path */
     const char *rules_file; /* path to rules INI file */
+    const char *metrics_addr; /* --metrics: unix:<path> or [host:]port, NULL = no export */
+    const char *rule_api_path; /* --rule-api: UNIX socket for rule deltas, NULL = off */
+    const char *mirror_to;  /* --mirror-to: pcapng file or unix:<path>, NULL = no mirror */
+    uint32_t mirror_every;  /* Mirror 1 in n matched packets, 0 = only rules with mirror= */
+    uint32_t mirror_budget; /* Pool buffers the mirror holds at most */
+    rx_mode_t rx_mode;      /* RX backend */
+    bool tx_ring;           /* PACKET_TX_RING instead of sendmmsg */
+    bool per_worker_rx;     /* Each worker owns an RX source, no RX thread */
+    size_t flow_cache_entries; /* Per worker, 0 = no flow cache */
+    size_t conntrack_entries; /* Per worker, 0 = stateless (no connection tracking) */
+    bool perf;              /* Hardware counters per worker (perf_event_open) */
+    size_t pool_cache;      /* Per-thread packet pool cache, in buffers */
+    uint16_t headroom;      /* Bytes in front of each frame, for pushed headers */
+    idle_mode_t idle_mode;  /* What workers do while their source is empty */
+    uint32_t stage_sample;  /* Bursts per stage-timed one, 0 = no stage timing */
+    uint32_t reply_rate;    /* ARP replies per second from the control plane, 0 = no limit */
+    int workers;            /* Worker threads (and rings) */
+    size_t ring_size;       /* Entries per worker ring (and TX stage ring) */
+    size_t pool_size;       /* Standard-class buffers per pool; other classes scale with it */
+    bool pipeline;          /* Workers hand TX off to TX stage threads */
+    int tx_stages;          /* Pipeline mode: TX stage threads, 1..workers */
+    int cores[UPE_CORES_MAX]; /* --cores: RX, workers, TX stages, stats in this order */
+    int core_count;         /* 0: placed automatically */
     int verbose;            /* 0..2 */
     int duration_sec;       /* 0 = run forever */
 
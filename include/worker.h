@@ -3,23 +3,168 @@
 
 #define _POSIX_C_SOURCE 200809L
 #include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "arp_table.h"
+#include "conntrack.h"
+#include "flow_cache.h"
 #include "ndp_table.h"
+#include "neigh_cache.h"
+#include "perf.h"
 #include "pktbuf.h"
+#include "policer.h"
+#include "qsbr.h"
 #include "ring.h"
 #include "rule_table.h"
+#include "rx.h"
 #include "tx.h"
 #include "latency.h"
+#include "mirror.h"
+#include "xsk.h"
 
 #define WORKER_BURST_SIZE 32
+#define WORKER_TX_MAX_PORTS 8 /* Egress interfaces per worker, the default one included */
 
+/*
+    What a worker does when its source comes up empty.
+        - poll: spin with a pause instruction, never give up the core. Lowest
+          latency, 100% CPU at any load.
+        - backoff: spin, doubling the pauses per empty poll, then sched_yield(),
+          then sleep, doubling from 1us up to WORKER_IDLE_SLEEP_MAX_US. Any
+          packet resets it to spinning.
+        - wakeup: spin briefly, then sleep until the producer signals (futex on
+          the ring, see ring_wait()) or 1ms passes. With an own RX source the
+          kernel is the producer: the worker waits in poll().
+*/
+typedef enum {
+    IDLE_MODE_BACKOFF = 0,
+    IDLE_MODE_POLL = 1,
+    IDLE_MODE_WAKEUP = 2
+} idle_mode_t;
+
+#define WORKER_IDLE_SPIN_ROUNDS 10   /* Empty polls spent spinning: 1, 2, .. 512 pauses */
+#define WORKER_IDLE_YIELD_ROUNDS 16  /* Then empty polls answered with sched_yield() */
+#define WORKER_IDLE_SLEEP_MAX_US 512 /* Longest backoff sleep */
+
+/*
+    Stages of a packet's way through a worker, each with its own latency
+    histogram. Measured on one burst in `stage_sample` only, so they can stay
+    on: a timed burst costs a few TSC reads per stage and for each neighbour
+    lookup.
+        - rx: RX arrival to the push onto the worker's ring (RX batching).
+        - ring: in the ring until the worker takes the burst.
+        - parse, classify, tx: the whole stage over the burst, counted for every
+          packet in it (each one waits for all of it). tx is the rewrite plus
+          the flush (sendmmsg, TX ring or XSK).
+        - neigh: the burst's next-hop MAC lookups, taken out of classify.
+    rx and ring only exist in the ring layout; an own source has no queue.
+*/
+typedef enum {
+    WORKER_STAGE_RX = 0,
+    WORKER_STAGE_RING,
+    WORKER_STAGE_PARSE,
+    WORKER_STAGE_CLASSIFY,
+    WORKER_STAGE_NEIGH,
+    WORKER_STAGE_TX,
+    WORKER_STAGES
+} worker_stage_t;
+
+#define WORKER_STAGE_SAMPLE_DEFAULT 64 /* One timed burst in 64 */
+
+/* Spin-wait hint: lets the sibling hyperthread run and saves power while polling. */
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#else
+    atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+/*
+    RX source owned by a single worker (per-worker layout). The worker polls it
+    directly instead of its rx_ring, so RX, parse, match and TX of a flow all
+    happen on one core. With AF_XDP the worker also transmits through it.
+*/
+typedef struct {
+    rx_mode_t mode;    /* RX_MODE_AFPACKET (fanout member) or RX_MODE_XDP (one queue) */
+    rx_afpacket_t afp;
+    xsk_t xsk;
+} worker_rx_src_t;
+
+/*
+    Counters of one rule in one worker, and the worker's share of the rule's
+    policer next to them (64 bytes).
+*/
 typedef struct {
     uint64_t packets;
     uint64_t bytes;
+    uint64_t conform; /* Packets within the policer rate (policed rules only) */
+    uint64_t exceed;  /* Packets above it, dropped */
+    policer_t policer;
 } rule_stat_t;
 
+/*
+    Rule table and the per-rule counters sized for it. Published to a worker
+    as one pointer, so a reload can never pair a table with a stats array of
+    another table.
+*/
+typedef struct {
+    const rule_table_t *rt;
+    rule_stat_t *stats; /* Indexed by rule_id, rt->capacity entries */
+} worker_rules_t;
+
+/*
+    One egress interface of a worker: its TX context and the batch being
+    filled for it during a burst. Each worker has its own contexts, so every
+    socket (and TX ring) has a single writer.
+    Port 0 is `tx`, the default interface: packets of rules without an
+    out_iface (or one the worker has no port for) go there, and only port 0
+    uses the pipeline TX ring or the XSK socket. The other ports are AF_PACKET
+    contexts added with worker_add_tx_port().
+*/
+typedef struct {
+    const tx_ctx_t *tx;
+    /* These must stay in sync; frames[i], lens[i] point into bufs[i]->data. */
+    const uint8_t *frames[WORKER_BURST_SIZE]; /* sendmmsg reads it. */
+    size_t lens[WORKER_BURST_SIZE];
+    pktbuf_t *bufs[WORKER_BURST_SIZE]; /* Deferred free after sendmmsg. */
+    int count;                        /* In queue. */
+    uint64_t pkts_sent;
+    uint64_t pkts_dropped; /* Rejected by the socket or ring */
+} worker_tx_port_t;
+
+/*
+    Packet and idle counters of a worker. The worker counts in its own copy
+    (a cache line nobody else reads) and publishes it once per burst, inside a
+    seqcount, see worker_read_counters().
+*/
+typedef struct {
+    uint64_t pkts_in;
+    uint64_t pkts_parsed;
+    uint64_t pkts_matched;
+    uint64_t pkts_forwarded;
+    uint64_t pkts_dropped;
+    uint64_t pkts_control; /* Handed to the control plane */
+    uint64_t ctrl_dropped; /* Control ring full (also in pkts_dropped) */
+    uint64_t pkts_mirrored;  /* Sampled and handed to the packet mirror */
+    uint64_t mirror_skipped; /* Sampled, but over the mirror's budget or its ring was full */
+    uint64_t idle_spins;   /* Empty polls answered by spinning */
+    uint64_t idle_yields;
+    uint64_t idle_sleeps; /* Timed sleeps, futex or kernel waits */
+} worker_counters_t;
+
+#define WORKER_COUNTERS (sizeof(worker_counters_t) / sizeof(uint64_t))
+
+/*
+    Worker state. Sections written by different threads, or by the worker for
+    every packet, start on their own cache lines, and so does the struct: the
+    workers sit in one array, and neighbours must not share a line.
+*/
 typedef struct {
     /* Thread metadata [cold, accessed once at startup] */
     pthread_t thread;
@@ -27,57 +172,156 @@ typedef struct {
 
     /* Pointers [cold, dereferenced but the pointer itself rarely changes] */
     spsc_ring_t *rx_ring;
-    pktbuf_pool_t *pool;
-    const rule_table_t *rt;
-    const tx_ctx_t *tx;
+    worker_rx_src_t *rx_src; /* NULL: fed by the RX thread via rx_ring */
+    pktbuf_classes_t *pools;
+    _Atomic(worker_rules_t *) rules; /* Written by the reload thread, see worker_swap_rules() */
+    qsbr_t *qsbr;                    /* NULL: rules are never swapped */
+    size_t qsbr_id;
+    const tx_ctx_t *tx;      /* Forwarded packets of the default port, see tx_ports */
+    spsc_ring_t *tx_ring;    /* Pipeline mode: forwarded packets go to a TX stage instead */
+    spsc_ring_t *ctrl_ring;  /* ARP/NDP frames to the control plane; NULL: dropped */
+    mirror_t *mirror;        /* Packet mirror; NULL: off */
+    spsc_ring_t *mirror_ring; /* Its ring for this worker */
     arp_table_t *arpt;
     ndp_table_t *ndpt;
 
-    /* Per-worker counters [hot, accessed for every packet] */
-    uint64_t pkts_in;
-    uint64_t pkts_parsed;
-    uint64_t pkts_matched;
-    uint64_t pkts_forwarded;
-    uint64_t pkts_dropped;
+    /* Per-worker counters [hot, worker only: updated for every packet] */
+    alignas(CACHE_LINE_SIZE) worker_counters_t ctr;
+
+    /* Their snapshot, taken at the end of each burst and empty poll [written
+     * by the worker, read by the stats thread]. `ctr_seq` is odd while the
+     * copy is in progress. */
+    alignas(CACHE_LINE_SIZE) _Atomic uint32_t ctr_seq;
+    _Atomic uint64_t ctr_snap[WORKER_COUNTERS];
+
+    /* pkts_in once the burst is done (TX included: in pipeline mode, taken by
+     * the TX stage), for RETA bucket moves [written once per burst, read by
+     * the RX thread] */
+    alignas(CACHE_LINE_SIZE) atomic_uint_fast64_t pkts_done;
+
+    /* Hardware counters of the worker thread, see worker_set_perf() [opened by
+     * the worker, read by the stats thread once `perf_ready` is set] */
+    perf_counters_t perf;
+    atomic_bool perf_ready;
 
     /* Per-packet latency histogram [hot, updated for every packet]. */
-    latency_histogram_t latency_hist;
+    alignas(CACHE_LINE_SIZE) latency_histogram_t latency_hist;
 
-    /* Per-rule statistics [warm, accessed per matched packet]
-     * ... indexed by rule_id. size=rt->capacity. */
-    rule_stat_t *rule_stats;
+    /* Stage timing [warm, only touched by the timed bursts] */
+    uint32_t stage_sample;    /* Every n-th burst is timed, 0 = none */
+    uint32_t stage_countdown; /* Bursts until the next timed one */
+    uint64_t stage_tx_tsc;    /* Start of the timed burst's TX stage */
+    latency_histogram_t stage_hist[WORKER_STAGES];
 
-    /* L1 ARP Cache (1st level before looking into the ARP table)
-     * [warm, accessed per forwarded packet] */
-    uint32_t last_arp_ip;
-    uint8_t last_arp_mac[6];
+    /* Snapshot of `rules`, taken by the worker itself at every quiescent state
+     * [hot, read for every packet]. */
+    const rule_table_t *rt;
+    rule_stat_t *rule_stats; /* Indexed by rule_id. size=rt->capacity. */
+
+    /* Exact-match flow cache [hot, probed for every parsed packet] */
+    flow_cache_t fcache;
+
+    /* Connection tracking [hot, probed for every TCP/UDP packet]; ct.entries
+     * NULL: off, every packet is classified */
+    conntrack_t ct;
 
-    /* L1 NDP Cache (1st level before looking into the NDP table)
-     * [warm, accessed per forwarded packet] */
-    uint8_t last_ndp_ip[16];
-    uint8_t last_ndp_mac[6];
+    /* Next-hop MAC cache (1st level before looking into the ARP/NDP tables)
+     * [warm, accessed per forwarded packet that misses the flow cache MAC] */
+    neigh_cache_t ncache;
+
+    /* Mirror samples of the current burst, pushed once it is processed [warm,
+     * only touched while the mirror has an output] */
+    uint64_t mirror_rng; /* xorshift64 state of the sampling */
+    unsigned int mirror_count;
+    pktbuf_t *mirror_bufs[WORKER_BURST_SIZE];
 
     /* CPU core assigned to this worker [cold, accessed once at startup] */
     int core_id;
 
-    /* TX batch accumulating: filled by process_packet.
-     * These must stay in sync; tx_frames[i], tx_lens[i] point into tx_bufs[i]->data. */
-    const uint8_t *tx_frames[WORKER_BURST_SIZE]; /* sendmmsg reads it. */
-    size_t tx_lens[WORKER_BURST_SIZE];
-    pktbuf_t *tx_bufs[WORKER_BURST_SIZE]; /* Deferred free after sendmmsg. */
-    int tx_count; /* In queue. */
+    /* Idle policy [written while the source is empty]; counted in `ctr` */
+    idle_mode_t idle_mode;
+    uint32_t idle_streak; /* Empty polls in a row */
+
+    /* Pipeline mode: the burst pkts_done waits for until the TX stage has taken
+     * everything up to it off tx_ring, see worker_complete() [worker only] */
+    uint64_t done_pending; /* pkts_in after that burst, 0 = none */
+    size_t done_mark;      /* tx_ring head after that burst */
+
+    /* Egress ports [hot: looked up per forwarded packet, one batch per port].
+     * tx_ifindex[] is kept apart from the batches so the lookup reads one line. */
+    alignas(CACHE_LINE_SIZE) int tx_ifindex[WORKER_TX_MAX_PORTS];
+    unsigned int tx_port_count;
+    int tx_count; /* In all port queues. */
+    worker_tx_port_t tx_ports[WORKER_TX_MAX_PORTS];
 } worker_t;
 
 /* Set TSC calibration for latency measurement (call before starting workers). */
 void worker_set_tsc_calibration(double cycles_per_ns);
 
+/* Flow cache entries per worker, for workers initialized afterwards (0 = disabled). */
+void worker_set_flow_cache_size(size_t entries);
+
+/* Conntrack entries per worker, for workers initialized afterwards (0 = disabled). */
+void worker_set_conntrack_size(size_t entries);
+
+/*
+    Count cycles, instructions, LLC and branch misses of each worker thread
+    started afterwards (perf_event_open), see worker_t.perf.
+*/
+void worker_set_perf(bool enable);
+
+/*
+    Idle policy for workers initialized afterwards. With IDLE_MODE_WAKEUP the
+    ring producer must call ring_notify() after each push.
+*/
+void worker_set_idle_mode(idle_mode_t mode);
+
+/* "poll", "backoff" or "wakeup". */
+const char *idle_mode_name(idle_mode_t mode);
+
+/* Time one burst in `every` per stage, for workers initialized afterwards (0 = never). */
+void worker_set_stage_sampling(uint32_t every);
+
+/* "rx", "ring", "parse", "classify", "neigh" or "tx". */
+const char *worker_stage_name(worker_stage_t stage);
+
 /* Initialize worker, allocate stats memory for it. */
-int worker_init(worker_t *w, int worker_id, int core_id, spsc_ring_t *rx_ring, pktbuf_pool_t *pool,
-                const rule_table_t *rt, const tx_ctx_t *tx, arp_table_t *arpt, ndp_table_t *ndpt);
+int worker_init(worker_t *w, int worker_id, int core_id, spsc_ring_t *rx_ring,
+                pktbuf_classes_t *pools, const rule_table_t *rt, const tx_ctx_t *tx,
+                arp_table_t *arpt, ndp_table_t *ndpt);
 /* Free worker memory. */
 void worker_destroy(worker_t *w);
 
+/*
+    Add an egress port for the interface of `tx` (before the worker starts).
+    Returns 0, or -1 if the worker already has WORKER_TX_MAX_PORTS ports.
+*/
+int worker_add_tx_port(worker_t *w, const tx_ctx_t *tx);
+
+/* Port for FWD packets to `ifindex`: 0, the default port, when it has none of its own. */
+static inline unsigned int worker_tx_port(const worker_t *w, int ifindex) {
+    for (unsigned int p = 1; p < w->tx_port_count; p++) {
+        if (w->tx_ifindex[p] == ifindex) return p;
+    }
+    return 0;
+}
+
+/*
+    Publish `next` to worker `w` and return the previous rules. The caller may
+    free the old table/stats only after qsbr_synchronize() on w->qsbr.
+*/
+worker_rules_t *worker_swap_rules(worker_t *w, worker_rules_t *next);
+
 int worker_start(worker_t *w);
 void worker_join(worker_t *w);
 
-#endif
\ No newline at end of file
+/*
+    Stats thread: a consistent copy of the worker's counters as of its last
+    burst or empty poll. Never blocks the worker; retries while it copies.
+*/
+void worker_read_counters(const worker_t *w, worker_counters_t *out);
+
+/* Stats thread: the worker's hardware counters. Returns false if it has none. */
+bool worker_read_perf(const worker_t *w, uint64_t out[PERF_EVENTS]);
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef XSK_H
+#define XSK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pktbuf.h"
+
+/*
+    AF_XDP sockets on top of the packet pool.
+
+    The pool's buffer array is registered as the UMEM, one chunk per buffer
+    (unaligned chunk mode, since the stride is not a power of two). A UMEM
+    address is therefore just the byte offset of a buffer in pool->mem, and
+    an RX descriptor maps back to its pktbuf_t with a division, no copy.
+    Only standard-class pools qualify: a chunk may not exceed a page.
+
+    Buffer ownership:
+        - Fill ring:        pool -> kernel (pktbuf_alloc'd, waiting for a frame)
+        - RX ring:          kernel -> user (handed out as a normal pktbuf_t)
+        - TX ring:          user -> kernel (was a pktbuf_t, now being sent)
+        - Completion ring:  kernel -> pool (pktbuf_free'd when reaped)
+*/
+
+#define XSK_RING_SIZE 2048  /* Descriptors per ring (power of two) */
+#define XSK_FILL_TARGET 512 /* Buffers kept posted on the fill ring */
+#define XSK_MAX_QUEUES 64   /* Entries in the XSKMAP (NIC queues) */
+#define XSK_BULK_SIZE 64    /* Buffers moved per pktbuf_alloc_bulk()/free_bulk() call */
+
+/* One mmap'd single-producer/single-consumer descriptor ring shared with the kernel. */
+typedef struct {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descs; /* struct xdp_desc[] (RX/TX) or uint64_t[] (fill/completion) */
+    uint32_t mask;
+    uint32_t size;
+    uint32_t cached_prod; /* Local copies, refreshed only when exhausted */
+    uint32_t cached_cons;
+    void *map;
+    size_t map_len;
+} xsk_ring_t;
+
+/* XDP program redirecting every queue that has a socket in its XSKMAP slot. */
+typedef struct {
+    int ifindex;
+    int prog_fd;
+    int map_fd;
+    int link_fd; /* Closing the link detaches the program */
+} xdp_prog_t;
+
+typedef struct {
+    int fd;
+    uint32_t queue_id;
+    bool zero_copy; /* Driver mode with XDP_ZEROCOPY, otherwise XDP_COPY */
+    pktbuf_pool_t *pool;
+
+    xsk_ring_t rx;
+    xsk_ring_t tx;
+    xsk_ring_t fill;
+    xsk_ring_t comp;
+
+    uint32_t fill_posted; /* Buffers currently owned by the kernel via the fill ring */
+    uint32_t tx_pending;  /* Buffers submitted on TX, not yet completed */
+
+    uint64_t fill_empty;   /* Pool had no buffer to post */
+    uint64_t tx_ring_full; /* tx_burst could not queue everything */
+} xsk_t;
+
+/* UMEM address of a pool buffer (its byte offset in pool->mem). */
+static inline uint64_t xsk_buf_addr(const pktbuf_pool_t *pool, const pktbuf_t *b) {
+    return (uint64_t)((const uint8_t *)b - pool->mem);
+}
+
+/* Pool buffer containing a UMEM address. `addr` must already be offset-resolved. */
+static inline pktbuf_t *xsk_addr_buf(const pktbuf_pool_t *pool, uint64_t addr) {
+    return pktbuf_at(pool, addr / pool->stride);
+}
+
+/*
+    Load the redirect program and XSKMAP, attach it to `iface` (driver mode,
+    falling back to generic/SKB mode).
+        Returns 0 on success, -1 on error.
+*/
+int xdp_prog_attach(xdp_prog_t *p, const char *iface);
+
+/* Point the program's slot for x->queue_id at socket `x`. Returns 0 on success. */
+int xdp_prog_add_xsk(const xdp_prog_t *p, const xsk_t *x);
+
+void xdp_prog_detach(xdp_prog_t *p);
+
+/*
+    Create an AF_XDP socket on `iface` queue `queue_id`, with `pool` as UMEM,
+    and pre-post XSK_FILL_TARGET buffers. The pool must be mmap-backed.
+        Returns 0 on success, -1 on error.
+*/
+int xsk_open(xsk_t *x, const char *iface, uint32_t queue_id, pktbuf_pool_t *pool);
+
+/*
+    Take up to `max` received frames and top the fill ring back up.
+    Never blocks.
+        Returns the number of buffers written to `out`.
+*/
+unsigned int xsk_rx_burst(xsk_t *x, pktbuf_t **out, unsigned int max);
+
+/*
+    Queue `n` buffers for transmission, zero-copy, from b->data / b->len.
+    The socket owns accepted buffers and frees them on completion; the caller
+    keeps ownership of bufs[ret..n).
+        Returns the number of buffers accepted.
+*/
+unsigned int xsk_tx_burst(xsk_t *x, pktbuf_t *const *bufs, unsigned int n);
+
+/* Return completed TX buffers to the pool. */
+void xsk_reap_tx(xsk_t *x);
+
+/* Wait up to `timeout_ms` for RX. Returns poll() result. */
+int xsk_wait(const xsk_t *x, int timeout_ms);
+
+void xsk_close(xsk_t *x);
+
+#endif
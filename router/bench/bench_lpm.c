@@ -0,0 +1,368 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lpm.h"
+
+static int g_tests_run = 0;
+static int g_tests_passed = 0;
+static int g_tests_failed = 0;
+
+#define ASSERT(cond, msg)                                                                          \
+    do {                                                                                           \
+        g_tests_run++;                                                                             \
+        if (cond) {                                                                                \
+            g_tests_passed++;                                                                      \
+        } else {                                                                                   \
+            g_tests_failed++;                                                                      \
+            fprintf(stderr, "FAIL [%s:%d] %s\n", __FILE__, __LINE__, msg);                         \
+        }                                                                                          \
+    } while (0)
+
+#define BURST 32
+
+static uint32_t g_rand = 2463534242u; /* xorshift32, deterministic */
+
+static uint32_t next_rand(void) {
+    g_rand ^= g_rand << 13;
+    g_rand ^= g_rand >> 17;
+    g_rand ^= g_rand << 5;
+    return g_rand;
+}
+
+/* Reference: linear scan for the longest matching route */
+typedef struct {
+    uint8_t addr[16];
+    uint8_t depth;
+    uint32_t value;
+} ref_route_t;
+
+static bool prefix_matches(const uint8_t *addr, const uint8_t *prefix, uint8_t depth) {
+    for (unsigned int b = 0; b < depth; b++) {
+        unsigned int mask = 0x80u >> (b % 8);
+        if ((addr[b / 8] & mask) != (prefix[b / 8] & mask)) return false;
+    }
+    return true;
+}
+
+static bool ref_lookup(const ref_route_t *routes, unsigned int n, const uint8_t *addr,
+                       uint32_t *value) {
+    int best = -1;
+    for (unsigned int i = 0; i < n; i++) {
+        if (prefix_matches(addr, routes[i].addr, routes[i].depth) &&
+            (best < 0 || routes[i].depth >= routes[best].depth)) {
+            best = (int)i; /* Later routes replace earlier ones of the same prefix */
+        }
+    }
+    if (best >= 0) *value = routes[best].value;
+    return best >= 0;
+}
+
+static void v4_bytes(uint32_t ip, uint8_t out[4]) {
+    out[0] = (uint8_t)(ip >> 24);
+    out[1] = (uint8_t)(ip >> 16);
+    out[2] = (uint8_t)(ip >> 8);
+    out[3] = (uint8_t)ip;
+}
+
+static uint32_t v4_of(const uint8_t b[4]) {
+    return (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 8 | b[3];
+}
+
+/* -----------------------------------------------------------------------
+ * Property 1: Longest Prefix Wins
+ *
+ * Nested routes added in any order: every address resolves to the
+ * longest route covering it, and nothing outside them resolves.
+ * -----------------------------------------------------------------------
+ */
+static void test_longest_prefix_wins(void) {
+    static const struct { uint32_t prefix; uint8_t depth; } routes[] = {
+        {0x0A000000, 8},  /* 10.0.0.0/8 */
+        {0x0A010000, 16}, /* 10.1.0.0/16 */
+        {0x0A010200, 24}, /* 10.1.2.0/24 */
+        {0x0A010280, 25}, /* 10.1.2.128/25 */
+        {0x0A0102C0, 28}, /* 10.1.2.192/28 */
+        {0x0A0102C5, 32}, /* 10.1.2.197/32 */
+    };
+    static const struct { uint32_t ip; uint32_t expect; } probes[] = {
+        {0x0A7F0001, 0}, {0x0A010001, 1}, {0x0A010201, 2}, {0x0A010281, 3},
+        {0x0A0102C1, 4}, {0x0A0102C5, 5}, {0x0A0102C6, 4}, {0x0A0102D0, 3},
+        {0x0A0103FF, 1},
+    };
+    static const unsigned int orders[3][6] = {
+        {0, 1, 2, 3, 4, 5}, {5, 4, 3, 2, 1, 0}, {3, 0, 5, 1, 4, 2}};
+
+    for (unsigned int o = 0; o < 3; o++) {
+        lpm_t lpm;
+        ASSERT(lpm4_init(&lpm, 16) == 0, "P1: init must succeed");
+
+        for (unsigned int i = 0; i < 6; i++) {
+            unsigned int r = orders[o][i];
+            ASSERT(lpm4_add(&lpm, routes[r].prefix, routes[r].depth, r) == 0,
+                   "P1: add must succeed");
+        }
+
+        for (unsigned int p = 0; p < sizeof(probes) / sizeof(probes[0]); p++) {
+            uint32_t v = 0;
+            bool found = lpm4_lookup(&lpm, probes[p].ip, &v);
+            ASSERT(found && v == probes[p].expect, "P1: the longest route must win");
+        }
+
+        uint32_t v;
+        ASSERT(!lpm4_lookup(&lpm, 0x0B000001, &v), "P1: uncovered address must miss");
+        ASSERT(lpm.used_groups == 1, "P1: routes past /24 in one /24 must share one group");
+        lpm_destroy(&lpm);
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * Property 2: Replace and Default Route
+ *
+ * Adding a prefix again replaces its next hop only; a /0 catches
+ * everything no other route covers.
+ * -----------------------------------------------------------------------
+ */
+static void test_replace_and_default(void) {
+    lpm_t lpm;
+    lpm4_init(&lpm, 4);
+
+    lpm4_add(&lpm, 0xC0A80000, 16, 1);  /* 192.168.0.0/16 */
+    lpm4_add(&lpm, 0xC0A80100, 30, 2);  /* 192.168.1.0/30 */
+    lpm4_add(&lpm, 0xC0A80000, 16, 7);  /* Replaces the /16 */
+    lpm4_add(&lpm, 0x00000000, 0, 9);   /* Default */
+
+    uint32_t v = 0;
+    ASSERT(lpm4_lookup(&lpm, 0xC0A80203, &v) && v == 7, "P2: replaced route must take effect");
+    ASSERT(lpm4_lookup(&lpm, 0xC0A80102, &v) && v == 2, "P2: replace must not touch longer routes");
+    ASSERT(lpm4_lookup(&lpm, 0xC0A80104, &v) && v == 7,
+           "P2: group entries outside the /30 must follow the replaced route");
+    ASSERT(lpm4_lookup(&lpm, 0x08080808, &v) && v == 9, "P2: default route must catch the rest");
+
+    ASSERT(lpm4_add(&lpm, 0, 33, 1) == -1, "P2: depth past 32 must be rejected");
+    ASSERT(lpm4_add(&lpm, 0, 8, LPM_VALUE_MASK + 1) == -1, "P2: oversized value must be rejected");
+    lpm_destroy(&lpm);
+}
+
+/* -----------------------------------------------------------------------
+ * Property 3: Out of Groups
+ *
+ * When no group is left for a route past /24, the add fails and the
+ * routes already in place keep working.
+ * -----------------------------------------------------------------------
+ */
+static void test_out_of_groups(void) {
+    lpm_t lpm;
+    lpm4_init(&lpm, 2);
+
+    ASSERT(lpm4_add(&lpm, 0x0A000001, 32, 1) == 0, "P3: first /24 gets a group");
+    ASSERT(lpm4_add(&lpm, 0x0A000101, 32, 2) == 0, "P3: second /24 gets a group");
+    ASSERT(lpm4_add(&lpm, 0x0A000201, 32, 3) == -1, "P3: third /24 must fail");
+    ASSERT(lpm4_add(&lpm, 0x0A000203, 24, 4) == 0, "P3: /24 routes need no group");
+
+    uint32_t v = 0;
+    ASSERT(lpm4_lookup(&lpm, 0x0A000101, &v) && v == 2, "P3: existing routes must survive");
+    ASSERT(lpm4_lookup(&lpm, 0x0A000201, &v) && v == 4, "P3: failed route must not be installed");
+    ASSERT(lpm6_init(&lpm, 0) == -1, "P3: zero groups must be rejected");
+    lpm_destroy(&lpm);
+}
+
+/* -----------------------------------------------------------------------
+ * Property 4: Random Routes Match a Linear Scan
+ *
+ * For random route sets of both families, single and bulk lookups agree
+ * with a brute force longest-prefix scan, for addresses inside and
+ * around the routes.
+ * -----------------------------------------------------------------------
+ */
+#define P4_ROUTES 300
+#define P4_PROBES 4096
+
+static void check_random_routes(bool v6) {
+    static ref_route_t routes[P4_ROUTES];
+    lpm_t lpm;
+    if (v6) {
+        lpm6_init(&lpm, 4096);
+    } else {
+        lpm4_init(&lpm, 4096);
+    }
+
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < P4_ROUTES; i++) {
+        ref_route_t *r = &routes[n];
+        memset(r->addr, 0, sizeof(r->addr));
+        unsigned int len = v6 ? 16 : 4;
+        /* Few top bytes so routes nest and overlap */
+        r->addr[0] = (uint8_t)(0x20 + next_rand() % 2);
+        for (unsigned int b = 1; b < len; b++) {
+            r->addr[b] = (uint8_t)(b < len / 2 ? next_rand() % 4 : next_rand());
+        }
+        r->depth = (uint8_t)(next_rand() % (len * 8 + 1));
+        r->value = i;
+
+        int ret = v6 ? lpm6_add(&lpm, r->addr, r->depth, r->value)
+                     : lpm4_add(&lpm, v4_of(r->addr), r->depth, r->value);
+        if (ret == 0) n++;
+    }
+    ASSERT(n == P4_ROUTES, "P4: every random route must fit");
+
+    unsigned int mismatches = 0, bulk_mismatches = 0;
+    for (unsigned int p = 0; p < P4_PROBES; p += BURST) {
+        uint8_t addrs[BURST][16];
+        const uint8_t *ptrs[BURST];
+        uint32_t ips[BURST], values[BURST];
+
+        for (unsigned int j = 0; j < BURST; j++) {
+            /* Half near a route, half anywhere in the same space */
+            const ref_route_t *r = &routes[next_rand() % n];
+            memcpy(addrs[j], r->addr, 16);
+            unsigned int len = v6 ? 16 : 4;
+            for (unsigned int b = (j % 2) ? 0 : len - 2; b < len; b++) {
+                addrs[j][b] ^= (uint8_t)next_rand();
+            }
+            ptrs[j] = addrs[j];
+            ips[j] = v4_of(addrs[j]);
+        }
+
+        uint64_t hits = v6 ? lpm6_lookup_bulk(&lpm, ptrs, BURST, values)
+                           : lpm4_lookup_bulk(&lpm, ips, BURST, values);
+
+        for (unsigned int j = 0; j < BURST; j++) {
+            uint32_t want = 0, got = 0;
+            bool ref = ref_lookup(routes, n, addrs[j], &want);
+            bool found = v6 ? lpm6_lookup(&lpm, addrs[j], &got) : lpm4_lookup(&lpm, ips[j], &got);
+
+            if (found != ref || (ref && got != want)) mismatches++;
+            bool bulk = (hits >> j) & 1;
+            if (bulk != ref || (ref && values[j] != want)) bulk_mismatches++;
+        }
+    }
+
+    ASSERT(mismatches == 0, v6 ? "P4: IPv6 lookups must match the linear scan"
+                               : "P4: IPv4 lookups must match the linear scan");
+    ASSERT(bulk_mismatches == 0, v6 ? "P4: IPv6 bulk lookups must match the linear scan"
+                                    : "P4: IPv4 bulk lookups must match the linear scan");
+    lpm_destroy(&lpm);
+}
+
+static void test_random_routes(void) {
+    check_random_routes(false);
+    check_random_routes(true);
+}
+
+/* -----------------------------------------------------------------------
+ * Throughput
+ * -----------------------------------------------------------------------
+ */
+#define BENCH_ROUTES 20000
+#define BENCH_LOOKUPS (1u << 22)
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void bench_throughput(void) {
+    lpm_t lpm4, lpm6;
+    lpm4_init(&lpm4, 8192);
+    lpm6_init(&lpm6, 32768);
+
+    uint32_t *ips = malloc(BENCH_LOOKUPS * sizeof(uint32_t));
+    uint8_t (*ip6s)[16] = malloc((size_t)BENCH_LOOKUPS * 16);
+    if (!ips || !ip6s) {
+        free(ips);
+        free(ip6s);
+        lpm_destroy(&lpm4);
+        lpm_destroy(&lpm6);
+        return;
+    }
+
+    /* A table shaped like a full view: mostly /16-/24, some longer */
+    for (uint32_t i = 0; i < BENCH_ROUTES; i++) {
+        uint32_t r = next_rand();
+        uint8_t depth = (uint8_t)(i % 8 == 0 ? 25 + r % 8 : 16 + r % 9);
+        lpm4_add(&lpm4, r, depth, i % 64);
+
+        uint8_t p6[16] = {0x20, 0x01};
+        v4_bytes(next_rand(), &p6[2]);
+        lpm6_add(&lpm6, p6, (uint8_t)(32 + next_rand() % 17), i % 64);
+    }
+    lpm4_add(&lpm4, 0, 0, 63);
+
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        ips[i] = next_rand();
+        uint8_t a[16] = {0x20, 0x01};
+        v4_bytes(next_rand(), &a[2]);
+        memcpy(ip6s[i], a, 16);
+    }
+
+    uint64_t found = 0;
+    double t0 = now_sec();
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        uint32_t v;
+        found += lpm4_lookup(&lpm4, ips[i], &v);
+    }
+    double t_single = now_sec() - t0;
+
+    t0 = now_sec();
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i += BURST) {
+        uint32_t values[BURST];
+        found += (uint64_t)__builtin_popcountll(lpm4_lookup_bulk(&lpm4, &ips[i], BURST, values));
+    }
+    double t_bulk = now_sec() - t0;
+
+    uint64_t found6 = 0, found6_bulk = 0;
+    t0 = now_sec();
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        uint32_t v;
+        found6 += lpm6_lookup(&lpm6, ip6s[i], &v);
+    }
+    double t6_single = now_sec() - t0;
+
+    t0 = now_sec();
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i += BURST) {
+        const uint8_t *burst[BURST];
+        uint32_t values[BURST];
+        for (uint32_t j = 0; j < BURST; j++) burst[j] = ip6s[i + j];
+        found6_bulk += (uint64_t)__builtin_popcountll(lpm6_lookup_bulk(&lpm6, burst, BURST, values));
+    }
+    double t6_bulk = now_sec() - t0;
+
+    printf("\nThroughput (%u routes per family, %u random lookups each):\n", BENCH_ROUTES,
+           BENCH_LOOKUPS);
+    printf("  lpm4 lookup:      %6.1f Mops/s\n", BENCH_LOOKUPS / t_single / 1e6);
+    printf("  lpm4 lookup_bulk: %6.1f Mops/s (bursts of %d)\n", BENCH_LOOKUPS / t_bulk / 1e6,
+           BURST);
+    printf("  lpm6 lookup:      %6.1f Mops/s\n", BENCH_LOOKUPS / t6_single / 1e6);
+    printf("  lpm6 lookup_bulk: %6.1f Mops/s (bursts of %d)\n", BENCH_LOOKUPS / t6_bulk / 1e6,
+           BURST);
+    ASSERT(found == 2ULL * BENCH_LOOKUPS, "Bench: the default route must catch every address");
+    ASSERT(found6 == found6_bulk, "Bench: bulk and single IPv6 lookups must agree");
+
+    free(ips);
+    free(ip6s);
+    lpm_destroy(&lpm4);
+    lpm_destroy(&lpm6);
+}
+
+int main(void) {
+    printf("Running LPM Property-Based Correctness Tests...\n");
+    printf("--------------------------------------------------\n");
+
+    test_longest_prefix_wins();
+    test_replace_and_default();
+    test_out_of_groups();
+    test_random_routes();
+    bench_throughput();
+
+    printf("\nTest Execution Summary:\n");
+    printf("  Total Assertions Run: %d\n", g_tests_run);
+    printf("  Passed:               %d\n", g_tests_passed);
+    printf("  Failed:               %d\n", g_tests_failed);
+
+    return (g_tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,8 +1,11 @@
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "mac_table.h"
 #include "router.h"
@@ -60,7 +63,7 @@ static void make_broadcast_mac(uint8_t mac[MAC_ADDR_LEN]) {
  */
 static void test_insert_lookup_roundtrip(void) {
     mac_table_t table;
-    mac_table_init(&table, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
+    mac_table_init(&table, MAC_TABLE_DEFAULT_CAPACITY, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
 
     for (int seed = 0; seed < 200; seed++) {
         uint8_t mac[MAC_ADDR_LEN];
@@ -82,6 +85,8 @@ static void test_insert_lookup_roundtrip(void) {
         ASSERT(found, "P1: lookup should find just inserted MAC");
         ASSERT(out_port == insert_port, "P1: lookup should return correct port");
     }
+
+    mac_table_destroy(&table);
 }
 
 /* -----------------------------------------------------------------------
@@ -93,7 +98,7 @@ static void test_insert_lookup_roundtrip(void) {
  */
 static void test_port_update(void) {
     mac_table_t table;
-    mac_table_init(&table, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
+    mac_table_init(&table, MAC_TABLE_DEFAULT_CAPACITY, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
 
     uint8_t mac[MAC_ADDR_LEN];
     make_unicast_mac(mac, 0xAA);
@@ -116,6 +121,8 @@ static void test_port_update(void) {
     found = mac_table_lookup(&table, mac, tsc2, &out_port);
     ASSERT(found, "P2: after port update, MAC must still be found");
     ASSERT(out_port == 1, "P2: after port update, port must be 1");
+
+    mac_table_destroy(&table);
 }
 
 /* -----------------------------------------------------------------------
@@ -127,7 +134,7 @@ static void test_port_update(void) {
  */
 static void test_aging_timeout(void) {
     mac_table_t table;
-    mac_table_init(&table, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
+    mac_table_init(&table, MAC_TABLE_DEFAULT_CAPACITY, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
 
     uint8_t mac[MAC_ADDR_LEN];
     make_unicast_mac(mac, 0xBB);
@@ -144,6 +151,8 @@ static void test_aging_timeout(void) {
     uint64_t tsc_expired = tsc_insert + FAKE_AGING_TIMEOUT_TSC + 1;
     bool found_expired = mac_table_lookup(&table, mac, tsc_expired, &out_port);
     ASSERT(!found_expired, "P3: MAC must be treated as expired after timeout window");
+
+    mac_table_destroy(&table);
 }
 
 /* -----------------------------------------------------------------------
@@ -155,7 +164,7 @@ static void test_aging_timeout(void) {
  */
 static void test_entry_refresh(void) {
     mac_table_t table;
-    mac_table_init(&table, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
+    mac_table_init(&table, MAC_TABLE_DEFAULT_CAPACITY, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
 
     uint8_t mac[MAC_ADDR_LEN];
     make_unicast_mac(mac, 0xCC);
@@ -175,6 +184,8 @@ static void test_entry_refresh(void) {
 
     ASSERT(found, "P4: Refreshed MAC should not age out relative to original timestamp");
     ASSERT(out_port == port, "P4: Port should remain intact after refresh");
+
+    mac_table_destroy(&table);
 }
 
 /* -----------------------------------------------------------------------
@@ -195,145 +206,480 @@ static void test_ignore_non_unicast_sources(void) {
     ASSERT(!mac_is_unicast(bc_mac), "P5: Broadcast MAC must not be classified as unicast");
 }
 
+/* Find `n` MACs whose two candidate buckets differ. */
+static void make_two_bucket_macs(const mac_table_t *table, uint8_t macs[][MAC_ADDR_LEN],
+                                 uint32_t n) {
+    uint32_t found = 0;
+
+    for (uint32_t suffix = 0; found < n; suffix++) {
+        uint8_t mac[MAC_ADDR_LEN] = {0x02, 0x00, 0x00, (uint8_t)(suffix >> 16),
+                                     (uint8_t)(suffix >> 8), (uint8_t)suffix};
+        uint32_t hash = mac_hash(mac);
+
+        if (mac_bucket_primary(table, hash) != mac_bucket_secondary(table, hash)) {
+            memcpy(macs[found++], mac, MAC_ADDR_LEN);
+        }
+    }
+}
+
 /* -----------------------------------------------------------------------
- * Property 6: Table Saturation Behavior and Max Probe Limit
+ * Property 6: Table Saturation Behavior
  *
- * Fill the table by inserting MACs that hash to consecutive slots (0, 1, 2, ...).
- * Continue until the probe limit is reached, then verify that further insertions
- * into the next slot fail.
+ * The smallest table has two buckets. Fill them with MACs that may go to
+ * either one, then verify that one more insert fails, is counted, and
+ * leaves the entries in place.
  * -----------------------------------------------------------------------
  */
-static void test_table_saturation_and_probe_limit(void) {
+static void test_table_saturation(void) {
     mac_table_t table;
-    mac_table_init(&table, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
+    mac_table_init(&table, MAC_TABLE_MIN_CAPACITY, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
 
-    uint8_t macs[MAC_TABLE_MAX_PROBE + 1][MAC_ADDR_LEN];
+    uint8_t macs[MAC_TABLE_MIN_CAPACITY + 1][MAC_ADDR_LEN];
     uint64_t tsc = 1000;
 
-    /* Generate MACs that will map to consective slots: 0, 1, 2...
-     * Base seed is incremented and the final byte is adjusted until
-     * it lands exactly on the target sequential index. */
-    for (uint32_t i = 0; i < (MAC_TABLE_MAX_PROBE + 1); i++) {
-        uint8_t temp_mac[MAC_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
-        uint32_t suffix = 0;
-
-        /* Force the last MAC to map to slot 0 instead of MAC_TABLE_MAX_PROBE + 1.
-         * This is required, otherwise it will map to MAC_TABLE_MAX_PROBE + 1
-         * and there will be no collision... */
-        uint32_t target_index = (i == MAC_TABLE_MAX_PROBE) ? 0 : i;
-
-        while (1) {
-            /* Encode i into bytes 1-2 to make each MAC unique */
-            temp_mac[1] = (uint8_t)(i >> 8);
-            temp_mac[2] = (uint8_t)(i & 0xFF);
-            /* Mutate bytes 4-5 to hunt for the target index */
-            temp_mac[4] = (uint8_t)(suffix & 0xFF);
-            temp_mac[5] = (uint8_t)((suffix >> 8) & 0xFF);
-
-            // FNV-1a calculating from mac_table.c
-            uint32_t hash = 2166136261u;
-            for (int b = 0; b < MAC_ADDR_LEN; b++) {
-                hash ^= temp_mac[b];
-                hash *= 16777619u;
-            }
-            uint32_t index = hash & (MAC_TABLE_CAPACITY - 1);
-
-            /* This MAC should land exactly at slot i */
-            if (index == target_index) {
-                memcpy(macs[i], temp_mac, MAC_ADDR_LEN);
-                break;
-            }
-            suffix++;
-        }
-    }
+    make_two_bucket_macs(&table, macs, MAC_TABLE_MIN_CAPACITY + 1);
 
-    /* Fill the table up to the max allowed probe depth */
-    for (int i = 0; i < MAC_TABLE_MAX_PROBE; i++) {
+    /* An insert goes to the less loaded bucket, so every slot gets used */
+    for (int i = 0; i < MAC_TABLE_MIN_CAPACITY; i++) {
         bool ok = mac_table_insert(&table, macs[i], (uint16_t)(i % NUM_PORTS), tsc);
         ASSERT(ok, "P6: Insert within table bounds should succeed");
     }
 
-    /* The next MAC is hashed to slot 0, but slots 0 -> slot 15 are occupied.
-     * This will exhaust the probe distance and must fail. */
-    uint32_t initial_full_count = table.table_full_count;
-    bool overflow_ok = mac_table_insert(&table, macs[MAC_TABLE_MAX_PROBE], 1, tsc);
+    uint64_t initial_full_count = atomic_load(&table.table_full_count);
+    bool overflow_ok = mac_table_insert(&table, macs[MAC_TABLE_MIN_CAPACITY], 1, tsc);
 
-    ASSERT(!overflow_ok, "P6: Insertion beyond MAX_PROBE bounds must fail");
-    ASSERT(table.table_full_count == initial_full_count + 1, "P6: table_full_count must increase");
+    ASSERT(!overflow_ok, "P6: Insertion into two full buckets must fail");
+    ASSERT(atomic_load(&table.table_full_count) == initial_full_count + 1,
+           "P6: table_full_count must increase");
 
     /* Original entries must not be modified, deleted by the failed insert */
-    for (int i = 0; i < MAC_TABLE_MAX_PROBE; i++) {
+    for (int i = 0; i < MAC_TABLE_MIN_CAPACITY; i++) {
         uint16_t out_port = 0xFF;
         bool found = mac_table_lookup(&table, macs[i], tsc, &out_port);
         ASSERT(found, "P6: Original entries must remain after overflow error");
         ASSERT(out_port == (uint16_t)(i % NUM_PORTS),
                "P6: Original entry port mapping must remain");
     }
+    mac_table_destroy(&table);
 }
 
 /* -----------------------------------------------------------------------
  * Property 7: Transparent Overwrite Stability
  *
  * When a MAC address ages out, the slot it was using should be instantly
- * reusable by a new MAC that hashes to that same spot. The table shouldn't
- * waste space by skipping expired entries and using fresh slots further down.
+ * reusable by a new MAC: even in a table full of expired entries the
+ * insert must succeed.
  * -----------------------------------------------------------------------
  */
 static void test_transparent_overwrite_stability(void) {
     mac_table_t table;
-    mac_table_init(&table, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
-
-    uint8_t mac_old[MAC_ADDR_LEN];
-    uint8_t mac_new[MAC_ADDR_LEN];
-
-    /* Find two different MACs that both land in Slot 5 */
-    uint32_t target_slot = 5;
-    uint32_t suffix = 0;
-    int found = 0;
+    mac_table_init(&table, MAC_TABLE_MIN_CAPACITY, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
 
-    while (found < 2) {
-        uint8_t temp_mac[MAC_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
-        temp_mac[1] = (uint8_t)(found + suffix >> 8);
-        temp_mac[5] = (uint8_t)(suffix & 0xFF);
-
-        uint32_t hash = 2166136261u;
-        for (int b = 0; b < MAC_ADDR_LEN; b++) {
-            hash ^= temp_mac[b];
-            hash *= 16777619u;
-        }
-        uint32_t index = hash & (MAC_TABLE_CAPACITY - 1);
-
-        if (index == target_slot) {
-            if (found == 0)
-                memcpy(mac_old, temp_mac, MAC_ADDR_LEN);
-            else
-                memcpy(mac_new, temp_mac, MAC_ADDR_LEN);
-            found++;
-        }
-        suffix++;
-    }
+    uint8_t macs[MAC_TABLE_MIN_CAPACITY + 1][MAC_ADDR_LEN];
+    make_two_bucket_macs(&table, macs, MAC_TABLE_MIN_CAPACITY + 1);
 
     uint64_t tsc = 1000;
 
-    /* Put the first MAC into Slot 5 */
-    bool ok1 = mac_table_insert(&table, mac_old, 0, tsc);
-    ASSERT(ok1, "P7: Initial insertion should succeed");
+    /* Fill every slot */
+    for (int i = 0; i < MAC_TABLE_MIN_CAPACITY; i++) {
+        mac_table_insert(&table, macs[i], 0, tsc);
+    }
 
-    /* Advance tsc to age out the MAC */
+    /* Advance tsc to age out the MACs */
     uint64_t tsc_expired = tsc + FAKE_AGING_TIMEOUT_TSC + 100;
 
-    /* Insert the new MAC (that also hashes to Slot 5) */
-    bool ok2 = mac_table_insert(&table, mac_new, 1, tsc_expired);
-    ASSERT(ok2, "P7: Overwriting an expired entry slot should succeed");
+    /* Insert the new MAC */
+    bool ok = mac_table_insert(&table, macs[MAC_TABLE_MIN_CAPACITY], 1, tsc_expired);
+    ASSERT(ok, "P7: Overwriting an expired entry slot should succeed");
 
     /* Verification */
     uint16_t out_port = 0xFF;
-    bool found_old = mac_table_lookup(&table, mac_old, tsc_expired, &out_port);
+    bool found_old = mac_table_lookup(&table, macs[0], tsc_expired, &out_port);
     ASSERT(!found_old, "P7: Expired MAC must no longer be seen");
 
-    bool found_new = mac_table_lookup(&table, mac_new, tsc_expired, &out_port);
+    bool found_new = mac_table_lookup(&table, macs[MAC_TABLE_MIN_CAPACITY], tsc_expired,
+                                      &out_port);
     ASSERT(found_new, "p7: New MAC should be seen");
     ASSERT(out_port == 1, "P7: New MAC must map to the updated port (1)");
+    mac_table_destroy(&table);
+}
+
+/* -----------------------------------------------------------------------
+ * Property 8: Capacity
+ *
+ * The capacity is rounded up to a power of two and must be in range.
+ * -----------------------------------------------------------------------
+ */
+static void test_capacity(void) {
+    mac_table_t table;
+
+    ASSERT(mac_table_init(&table, 1000, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS) == 0,
+           "P8: init with 1000 entries should succeed");
+    ASSERT(table.capacity == 1024, "P8: capacity must round up to 1024");
+    ASSERT(table.bucket_mask + 1 == 1024 / MAC_BUCKET_ENTRIES, "P8: bucket count must match");
+    mac_table_destroy(&table);
+
+    ASSERT(mac_table_init(&table, MAC_TABLE_MIN_CAPACITY - 1, FAKE_AGING_TIMEOUT_SEC,
+                          FAKE_CYCLES_PER_NS) == -1,
+           "P8: capacity below the minimum must be rejected");
+    ASSERT(mac_table_init(&table, MAC_TABLE_MAX_CAPACITY + 1, FAKE_AGING_TIMEOUT_SEC,
+                          FAKE_CYCLES_PER_NS) == -1,
+           "P8: capacity above the maximum must be rejected");
+}
+
+/* -----------------------------------------------------------------------
+ * Property 9: Bulk Lookup
+ *
+ * mac_table_lookup_bulk() must agree with mac_table_lookup() for every MAC
+ * of a burst, known or not.
+ * -----------------------------------------------------------------------
+ */
+static void test_lookup_bulk(void) {
+    mac_table_t table;
+    mac_table_init(&table, MAC_TABLE_DEFAULT_CAPACITY, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
+
+    uint8_t macs[64][MAC_ADDR_LEN];
+    const uint8_t *burst[64];
+    uint64_t tsc = 1000;
+
+    /* Even entries are known, odd ones are not */
+    for (int i = 0; i < 64; i++) {
+        make_unicast_mac(macs[i], (uint8_t)(i * 2));
+        burst[i] = macs[i];
+        if (i % 2 == 0) mac_table_insert(&table, macs[i], (uint16_t)(i / 2 % NUM_PORTS), tsc);
+    }
+
+    uint16_t ports[64];
+    uint64_t hits = mac_table_lookup_bulk(&table, burst, 64, tsc, ports);
+
+    for (int i = 0; i < 64; i++) {
+        uint16_t port = 0xFF;
+        bool found = mac_table_lookup(&table, macs[i], tsc, &port);
+        ASSERT(found == (bool)((hits >> i) & 1), "P9: bulk hit must match a single lookup");
+        if (found) ASSERT(ports[i] == port, "P9: bulk port must match a single lookup");
+    }
+    ASSERT(hits == 0x5555555555555555ULL, "P9: exactly the known MACs must hit");
+    mac_table_destroy(&table);
+}
+
+/* -----------------------------------------------------------------------
+ * Property 10: Lock-free Readers
+ *
+ * While one thread keeps moving MACs between ports and another learns new
+ * ones, readers must always find the moving MACs, on a valid port.
+ * -----------------------------------------------------------------------
+ */
+#define P10_MACS 64
+#define P10_ROUNDS 20000
+
+typedef struct {
+    mac_table_t *table;
+    uint8_t (*macs)[MAC_ADDR_LEN];
+    atomic_bool *done;
+    uint64_t misses;
+    uint64_t bad_ports;
+} p10_arg_t;
+
+static void *p10_mover(void *arg) {
+    p10_arg_t *a = arg;
+    for (int r = 0; r < P10_ROUNDS; r++) {
+        for (int i = 0; i < P10_MACS; i++) {
+            mac_table_insert(a->table, a->macs[i], (uint16_t)((r + i) % NUM_PORTS), 1000);
+        }
+    }
+    atomic_store(a->done, true);
+    return NULL;
+}
+
+static void *p10_learner(void *arg) {
+    p10_arg_t *a = arg;
+    for (uint32_t i = 0; i < 4096; i++) {
+        uint8_t mac[MAC_ADDR_LEN] = {0x04, 0x00, 0x00, 0x00, (uint8_t)(i >> 8), (uint8_t)i};
+        mac_table_insert(a->table, mac, 1, 1000);
+    }
+    return NULL;
+}
+
+static void *p10_reader(void *arg) {
+    p10_arg_t *a = arg;
+    while (!atomic_load(a->done)) {
+        for (int i = 0; i < P10_MACS; i++) {
+            uint16_t port = 0xFF;
+            if (!mac_table_lookup(a->table, a->macs[i], 1000, &port)) {
+                a->misses++;
+            } else if (port >= NUM_PORTS) {
+                a->bad_ports++;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void test_concurrent_readers(void) {
+    mac_table_t table;
+    mac_table_init(&table, MAC_TABLE_DEFAULT_CAPACITY, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
+
+    uint8_t macs[P10_MACS][MAC_ADDR_LEN];
+    for (int i = 0; i < P10_MACS; i++) {
+        make_unicast_mac(macs[i], (uint8_t)(i * 2));
+        mac_table_insert(&table, macs[i], 0, 1000);
+    }
+
+    atomic_bool done;
+    atomic_init(&done, false);
+    p10_arg_t args[4];
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++) {
+        args[t] = (p10_arg_t){.table = &table, .macs = macs, .done = &done};
+    }
+
+    pthread_create(&threads[0], NULL, p10_reader, &args[0]);
+    pthread_create(&threads[1], NULL, p10_reader, &args[1]);
+    pthread_create(&threads[2], NULL, p10_learner, &args[2]);
+    pthread_create(&threads[3], NULL, p10_mover, &args[3]);
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    ASSERT(args[0].misses + args[1].misses == 0, "P10: a moving MAC must never be missed");
+    ASSERT(args[0].bad_ports + args[1].bad_ports == 0, "P10: readers must see a valid port");
+
+    bool all_learned = true;
+    for (uint32_t i = 0; i < 4096; i++) {
+        uint8_t mac[MAC_ADDR_LEN] = {0x04, 0x00, 0x00, 0x00, (uint8_t)(i >> 8), (uint8_t)i};
+        uint16_t port;
+        all_learned &= mac_table_lookup(&table, mac, 1000, &port) && port == 1;
+    }
+    ASSERT(all_learned, "P10: MACs learned next to the mover must all be found");
+    mac_table_destroy(&table);
+}
+
+/* -----------------------------------------------------------------------
+ * Property 11: Aging Sweep
+ *
+ * Sweepers splitting the buckets between them visit every bucket within a
+ * cycle, remove exactly the expired entries, and leave live ones alone.
+ * -----------------------------------------------------------------------
+ */
+static void test_aging_sweep(void) {
+    mac_table_t table;
+    mac_table_init(&table, 1024, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
+
+    uint64_t tsc_old = 1000;
+    uint64_t tsc_new = tsc_old + FAKE_AGING_TIMEOUT_TSC / 2;
+    uint64_t tsc_sweep = tsc_old + FAKE_AGING_TIMEOUT_TSC + 1;
+
+    /* Even MACs are old (expired at tsc_sweep), odd ones were seen recently */
+    for (int i = 0; i < 100; i++) {
+        uint8_t mac[MAC_ADDR_LEN];
+        make_unicast_mac(mac, (uint8_t)(i * 2));
+        mac_table_insert(&table, mac, 0, i % 2 == 0 ? tsc_old : tsc_new);
+    }
+
+    mac_sweep_t sweeps[3];
+    uint32_t covered = 0;
+    for (unsigned int p = 0; p < 3; p++) {
+        mac_sweep_init(&sweeps[p], &table, p, 3);
+        covered += sweeps[p].end - sweeps[p].begin;
+    }
+    ASSERT(covered == table.bucket_mask + 1, "P11: sweepers must cover every bucket");
+    ASSERT(sweeps[0].begin == 0 && sweeps[1].begin == sweeps[0].end &&
+               sweeps[2].begin == sweeps[1].end,
+           "P11: sweeper ranges must be disjoint and adjacent");
+
+    /* One full cycle of each range */
+    unsigned int removed = 0;
+    for (unsigned int p = 0; p < 3; p++) {
+        uint32_t len = sweeps[p].end - sweeps[p].begin;
+        for (uint32_t done = 0; done < len; done += MAC_SWEEP_BUCKETS) {
+            removed += mac_table_sweep(&table, &sweeps[p], tsc_sweep);
+        }
+    }
+    ASSERT(removed == 50, "P11: exactly the expired entries must be removed");
+    ASSERT(sweeps[0].expired + sweeps[1].expired + sweeps[2].expired == 50,
+           "P11: sweepers must count what they remove");
+
+    /* A second cycle finds nothing left to do */
+    unsigned int again = 0;
+    for (unsigned int p = 0; p < 3; p++) {
+        uint32_t len = sweeps[p].end - sweeps[p].begin;
+        for (uint32_t done = 0; done < len; done += MAC_SWEEP_BUCKETS) {
+            again += mac_table_sweep(&table, &sweeps[p], tsc_sweep);
+        }
+    }
+    ASSERT(again == 0, "P11: removed entries must stay removed");
+
+    uint32_t keys_left = 0;
+    for (uint32_t b = 0; b <= table.bucket_mask; b++) {
+        for (int e = 0; e < MAC_BUCKET_ENTRIES; e++) {
+            keys_left += (atomic_load(&table.buckets[b].keys[e]) & MAC_KEY_VALID) != 0;
+        }
+    }
+    ASSERT(keys_left == 50, "P11: expired slots must be empty after the sweep");
+
+    for (int i = 0; i < 100; i++) {
+        uint8_t mac[MAC_ADDR_LEN];
+        uint16_t port;
+        make_unicast_mac(mac, (uint8_t)(i * 2));
+        bool found = mac_table_lookup(&table, mac, tsc_sweep, &port);
+        ASSERT(found == (i % 2 == 1), "P11: only live entries must remain");
+    }
+    mac_table_destroy(&table);
+}
+
+/* -----------------------------------------------------------------------
+ * Property 12: Sweep vs. Learning
+ *
+ * A MAC just learned into an expired slot is never taken for expired by a
+ * sweep running on another lcore at the same time.
+ * -----------------------------------------------------------------------
+ */
+#define P12_ROUNDS 200000
+
+typedef struct {
+    mac_table_t *table;
+    _Atomic uint64_t *now; /* The learner's TSC */
+    atomic_bool *done;
+} p12_arg_t;
+
+static void *p12_sweeper(void *arg) {
+    p12_arg_t *a = arg;
+    mac_sweep_t sweep;
+    mac_sweep_init(&sweep, a->table, 0, 1);
+    while (!atomic_load(a->done)) {
+        mac_table_sweep(a->table, &sweep, atomic_load(a->now));
+    }
+    return NULL;
+}
+
+static void test_sweep_vs_learning(void) {
+    mac_table_t table;
+    mac_table_init(&table, MAC_TABLE_MIN_CAPACITY, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
+
+    _Atomic uint64_t now;
+    atomic_init(&now, 1000);
+    atomic_bool done;
+    atomic_init(&done, false);
+    p12_arg_t arg = {.table = &table, .now = &now, .done = &done};
+    pthread_t sweeper;
+    pthread_create(&sweeper, NULL, p12_sweeper, &arg);
+
+    /* Every round is a timeout later: the MACs of the earlier rounds have all
+     * expired, so each new one lands in a slot the sweeper is clearing. */
+    uint32_t lost = 0;
+    for (uint32_t i = 0; i < P12_ROUNDS; i++) {
+        uint64_t tsc = 1000 + (uint64_t)i * (FAKE_AGING_TIMEOUT_TSC + 1);
+        atomic_store(&now, tsc);
+        uint8_t mac[MAC_ADDR_LEN] = {0x06, 0x00, (uint8_t)(i >> 24), (uint8_t)(i >> 16),
+                                     (uint8_t)(i >> 8), (uint8_t)i};
+        uint16_t port;
+        if (mac_table_insert(&table, mac, 1, tsc) && !mac_table_lookup(&table, mac, tsc, &port)) {
+            lost++;
+        }
+    }
+    atomic_store(&done, true);
+    pthread_join(sweeper, NULL);
+
+    ASSERT(lost == 0, "P12: a sweep must not remove an entry that was just learned");
+    mac_table_destroy(&table);
+}
+
+/* -----------------------------------------------------------------------
+ * Throughput (informational, no pass/fail)
+ *
+ * A default-size table filled to 75%, looked up in random order: one at a
+ * time, in bursts of BURST_SIZE, and refreshed by inserts.
+ * -----------------------------------------------------------------------
+ */
+#define BENCH_LOOKUPS (1u << 22)
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void bench_throughput(void) {
+    mac_table_t table;
+    mac_table_init(&table, MAC_TABLE_DEFAULT_CAPACITY, FAKE_AGING_TIMEOUT_SEC, FAKE_CYCLES_PER_NS);
+
+    uint32_t n = table.capacity / 4 * 3;
+    uint8_t (*macs)[MAC_ADDR_LEN] = malloc((size_t)n * MAC_ADDR_LEN);
+    uint32_t *order = malloc(BENCH_LOOKUPS * sizeof(uint32_t));
+    if (!macs || !order) {
+        free(macs);
+        free(order);
+        mac_table_destroy(&table);
+        return;
+    }
+
+    uint32_t stored = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t mac[MAC_ADDR_LEN] = {0x02, 0x00, (uint8_t)(i >> 24), (uint8_t)(i >> 16),
+                                     (uint8_t)(i >> 8), (uint8_t)i};
+        memcpy(macs[i], mac, MAC_ADDR_LEN);
+        stored += mac_table_insert(&table, mac, (uint16_t)(i % NUM_PORTS), 1000);
+    }
+
+    uint32_t x = 2463534242u; /* xorshift32 */
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        order[i] = x % n;
+    }
+
+    uint64_t found = 0;
+    double t0 = now_sec();
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        uint16_t port;
+        found += mac_table_lookup(&table, macs[order[i]], 1000, &port);
+    }
+    double t_single = now_sec() - t0;
+
+    t0 = now_sec();
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i += BURST_SIZE) {
+        const uint8_t *burst[BURST_SIZE];
+        uint16_t ports[BURST_SIZE];
+        for (uint32_t j = 0; j < BURST_SIZE; j++) {
+            burst[j] = macs[order[i + j]];
+        }
+        found += (uint64_t)__builtin_popcountll(
+            mac_table_lookup_bulk(&table, burst, BURST_SIZE, 1000, ports));
+    }
+    double t_bulk = now_sec() - t0;
+
+    t0 = now_sec();
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++) {
+        uint32_t k = order[i];
+        mac_table_insert(&table, macs[k], (uint16_t)(k % NUM_PORTS), 1000);
+    }
+    double t_insert = now_sec() - t0;
+
+    t0 = now_sec();
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i += BURST_SIZE) {
+        const uint8_t *burst[BURST_SIZE];
+        for (uint32_t j = 0; j < BURST_SIZE; j++) {
+            burst[j] = macs[order[i + j]];
+        }
+        /* One port for the whole burst, as on an RX queue */
+        mac_table_insert_bulk(&table, burst, BURST_SIZE, 0, 1000);
+    }
+    double t_insert_bulk = now_sec() - t0;
+
+    printf("\nThroughput (%u entries, %u/%u stored, %u ops each):\n", table.capacity, stored, n,
+           BENCH_LOOKUPS);
+    printf("  lookup:        %6.1f Mops/s\n", BENCH_LOOKUPS / t_single / 1e6);
+    printf("  lookup_bulk:   %6.1f Mops/s (bursts of %d)\n", BENCH_LOOKUPS / t_bulk / 1e6,
+           BURST_SIZE);
+    printf("  insert (known):%6.1f Mops/s\n", BENCH_LOOKUPS / t_insert / 1e6);
+    printf("  insert_bulk:   %6.1f Mops/s (bursts of %d)\n", BENCH_LOOKUPS / t_insert_bulk / 1e6,
+           BURST_SIZE);
+    ASSERT(found == 2ULL * BENCH_LOOKUPS || stored < n, "Bench: every stored MAC must be found");
+
+    free(macs);
+    free(order);
+    mac_table_destroy(&table);
 }
 
 int main(void) {
@@ -345,8 +691,14 @@ int main(void) {
     test_aging_timeout();
     test_entry_refresh();
     test_ignore_non_unicast_sources();
-    test_table_saturation_and_probe_limit();
+    test_table_saturation();
     test_transparent_overwrite_stability();
+    test_capacity();
+    test_lookup_bulk();
+    test_concurrent_readers();
+    test_aging_sweep();
+    test_sweep_vs_learning();
+    bench_throughput();
 
     printf("\nTest Execution Summary:\n");
     printf("  Total Assertions Run: %d\n", g_tests_run);
@@ -80,6 +80,12 @@ static inline void rte_pktmbuf_free(struct rte_mbuf *m) {
     }
 }
 
+/* Adds `value` to the reference count, returns the new count */
+static inline uint16_t rte_mbuf_refcnt_update(struct rte_mbuf *m, int16_t value) {
+    m->refcnt = (uint16_t)(m->refcnt + value);
+    return m->refcnt;
+}
+
 /* Copies metadata only and shares the parent's payload (by copying just the pointer addr) */
 static inline struct rte_mbuf *rte_pktmbuf_clone(struct rte_mbuf *md, void *mp) {
     (void)mp;
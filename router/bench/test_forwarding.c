@@ -28,12 +28,22 @@ static int g_tests_failed = 0;
 /* Test data */
 static const uint8_t MAC_HOST_A[6] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x0A};
 static const uint8_t MAC_HOST_B[6] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x0B};
+static const uint8_t MAC_HOST_C[6] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x0C};
 static const uint8_t MAC_BROADCAST[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
+/* Shared by the contexts of a test, like the lcores share g_router.mac_table */
+static mac_table_t g_table;
+
+static void reset_table(void) {
+    mac_table_destroy(&g_table);
+    mac_table_init(&g_table, MAC_TABLE_DEFAULT_CAPACITY, 30, 2.0);
+}
+
 static void setup_ctx(rx_lcore_ctx_t *ctx) {
     memset(ctx, 0, sizeof(rx_lcore_ctx_t));
-    mac_table_init(&ctx->mac_table, 30, 2.0);
-    ctx->cycles_per_ns = 2.0;
+    reset_table();
+    ctx->mac_table = &g_table;
+    ctx->ns_per_cycle = 0.5;
 }
 
 static void test_mac_learning_and_flooding() {
@@ -44,10 +54,10 @@ static void test_mac_learning_and_flooding() {
     struct rte_mbuf *pkt = mock_build_packet(0, MAC_HOST_A, MAC_HOST_B, 0x0800);
 
     /* Process the packet */
-    forward_mbuf(&ctx, pkt, 0, rdtsc());
+    forward_burst(&ctx, &pkt, 1, 0, rdtsc());
 
     uint16_t learned_port;
-    bool found = mac_table_lookup(&ctx.mac_table, MAC_HOST_A, rdtsc(), &learned_port);
+    bool found = mac_table_lookup(ctx.mac_table, MAC_HOST_A, rdtsc(), &learned_port);
 
     ASSERT(found == true, "MAC Table should have learned Host A's MAC");
     ASSERT(learned_port == 0, "Host A's MAC should be mapped to Port 0");
@@ -63,12 +73,12 @@ static void test_unicast_forwarding() {
     setup_ctx(&ctx);
 
     /* Populate MAC table with Host B on Port 1 */
-    mac_table_insert(&ctx.mac_table, MAC_HOST_B, 1, rdtsc());
+    mac_table_insert(ctx.mac_table, MAC_HOST_B, 1, rdtsc());
 
     /* Host A (Port 0) sends a packet to Host B */
     struct rte_mbuf *pkt = mock_build_packet(0, MAC_HOST_A, MAC_HOST_B, 0x0800);
 
-    forward_mbuf(&ctx, pkt, 0, rdtsc());
+    forward_burst(&ctx, &pkt, 1, 0, rdtsc());
 
     ASSERT(ctx.packets_forwarded == 1, "Packet should be unicast forwarded, not flooded");
     ASSERT(ctx.packets_flooded == 0, "Packet shouldn't be flooded");
@@ -82,10 +92,14 @@ static void test_broadcast_flooding() {
     /* Host A (Port 0) sends an ARP Broadcast */
     struct rte_mbuf *pkt = mock_build_packet(0, MAC_HOST_A, MAC_BROADCAST, 0x0806);
 
-    forward_mbuf(&ctx, pkt, 0, rdtsc());
+    uint32_t allocated_before = mock_mbuf_allocated;
+    forward_burst(&ctx, &pkt, 1, 0, rdtsc());
 
     ASSERT(ctx.packets_flooded == 1, "Broadcast packet must be flooded");
     ASSERT(ctx.tx_buffers[1].count == 1, "Broadcast copy should go to Port 1");
+    ASSERT(mock_mbuf_allocated == allocated_before, "Flood must not allocate mbufs");
+    ASSERT(ctx.tx_buffers[1].mbufs[0] == pkt && pkt->refcnt == 1,
+           "Flood must send the original mbuf, one reference per egress port");
 }
 
 static void test_hairpin_drop() {
@@ -93,12 +107,12 @@ static void test_hairpin_drop() {
     setup_ctx(&ctx);
 
     /* Host A is on Port 0 */
-    mac_table_insert(&ctx.mac_table, MAC_HOST_A, 0, rdtsc());
+    mac_table_insert(ctx.mac_table, MAC_HOST_A, 0, rdtsc());
 
     /* Something on Port 0 sends a packet to Host A */
     struct rte_mbuf *pkt = mock_build_packet(0, MAC_HOST_B, MAC_HOST_A, 0x0800);
 
-    forward_mbuf(&ctx, pkt, 0, rdtsc());
+    forward_burst(&ctx, &pkt, 1, 0, rdtsc());
 
     ASSERT(ctx.packets_dropped == 1, "Packet should be dropped if ingress == egress port");
     ASSERT(ctx.tx_buffers[0].count == 0, "Packet shouldn't be queued for transmission");
@@ -110,7 +124,7 @@ static void test_system_mac_migration() {
 
     /* Host A sends a packet on Port 0 to Host B */
     struct rte_mbuf *pkt1 = mock_build_packet(0, MAC_HOST_A, MAC_HOST_B, 0x0800);
-    forward_mbuf(&ctx, pkt1, 0, rdtsc());
+    forward_burst(&ctx, &pkt1, 1, 0, rdtsc());
 
     /* Snapshot the counters before the reply */
     uint32_t prev_forwarded = ctx.packets_forwarded;
@@ -118,7 +132,7 @@ static void test_system_mac_migration() {
 
     /* Host B replies to Host A from Port 1 */
     struct rte_mbuf *pkt2 = mock_build_packet(1, MAC_HOST_B, MAC_HOST_A, 0x0800);
-    forward_mbuf(&ctx, pkt2, 1, rdtsc());
+    forward_burst(&ctx, &pkt2, 1, 1, rdtsc());
 
     /* Verify the reply was unicast to Port 0 */
     ASSERT(ctx.tx_buffers[0].count == 1, "Reply should be in Port 0's TX queue");
@@ -134,13 +148,13 @@ static void test_system_mac_migration() {
 
     /* Host A unplugs and sends a packet from Port 1 now */
     struct rte_mbuf *pkt3 = mock_build_packet(1, MAC_HOST_A, MAC_HOST_B, 0x0800);
-    forward_mbuf(&ctx, pkt3, 1, rdtsc());
+    forward_burst(&ctx, &pkt3, 1, 1, rdtsc());
 
     ASSERT(ctx.packets_dropped == 1, "Pkt3 should be a hairpin drop");
 
     /* Host B unplugs and sends a packet from Port 0 to Host A */
     struct rte_mbuf *pkt4 = mock_build_packet(0, MAC_HOST_B, MAC_HOST_A, 0x0800);
-    forward_mbuf(&ctx, pkt4, 0, rdtsc());
+    forward_burst(&ctx, &pkt4, 1, 0, rdtsc());
 
     /* Verify the reply was unicast unicast to Port 1 */
     ASSERT(ctx.tx_buffers[1].count == 1, "Last reply must be in Port 1's TX queue");
@@ -162,12 +176,346 @@ static void test_system_malformed_packet_drop() {
 
     uint32_t freed_before = mock_mbuf_freed;
 
-    forward_mbuf(&ctx, bad_pkt, 0, rdtsc());
+    forward_burst(&ctx, &bad_pkt, 1, 0, rdtsc());
 
     ASSERT(ctx.packets_dropped == 1, "Malformed frame should be dropped");
     ASSERT(mock_mbuf_freed == freed_before + 1, "Malformed frame buffer must be released");
 }
 
+static void test_shared_table_across_lcores() {
+    rx_lcore_ctx_t ctx0, ctx1;
+    setup_ctx(&ctx0);
+    setup_ctx(&ctx1);
+    ctx0.mac_table = ctx1.mac_table = &g_table;
+    ctx1.index = 1;
+    ctx1.queue_id = 1;
+
+    /* Host A (Port 0) sends on lcore 0's queue */
+    struct rte_mbuf *pkt1 = mock_build_packet(0, MAC_HOST_A, MAC_HOST_B, 0x0800);
+    forward_burst(&ctx0, &pkt1, 1, 0, rdtsc());
+
+    /* Host B replies on lcore 1's queue: unicast to Port 0 without a flood */
+    struct rte_mbuf *pkt2 = mock_build_packet(1, MAC_HOST_B, MAC_HOST_A, 0x0800);
+    forward_burst(&ctx1, &pkt2, 1, 1, rdtsc());
+    ASSERT(ctx1.packets_forwarded == 1, "Reply should be unicast with lcore 0's entry");
+    ASSERT(ctx1.packets_flooded == 0, "Reply mustn't be flooded");
+    ASSERT(ctx1.tx_buffers[0].count == 1, "Reply should be in Port 0's TX queue");
+
+    /* Host A moves to Port 1, seen by lcore 1: lcore 0 follows at once */
+    struct rte_mbuf *pkt3 = mock_build_packet(1, MAC_HOST_A, MAC_HOST_B, 0x0800);
+    forward_burst(&ctx1, &pkt3, 1, 1, rdtsc());
+
+    uint16_t port = 0;
+    ASSERT(mac_table_lookup(ctx0.mac_table, MAC_HOST_A, rdtsc(), &port) && port == 1,
+           "Move must be visible to lcore 0");
+}
+
+static void test_burst_forwarding() {
+    rx_lcore_ctx_t ctx;
+    setup_ctx(&ctx);
+
+    /* Host B is on Port 1 */
+    mac_table_insert(ctx.mac_table, MAC_HOST_B, 1, rdtsc());
+
+    struct rte_mbuf *burst[4];
+    burst[0] = mock_build_packet(0, MAC_HOST_A, MAC_BROADCAST, 0x0806); /* Flood */
+    burst[1] = mock_build_packet(0, MAC_HOST_A, MAC_HOST_B, 0x0800);    /* Unicast */
+    burst[2] = rte_pktmbuf_alloc(NULL);                                /* Runt */
+    burst[2]->data_len = 10;
+    burst[2]->pkt_len = 10;
+    burst[3] = mock_build_packet(0, MAC_HOST_C, MAC_HOST_A, 0x0800); /* Hairpin */
+
+    uint32_t freed_before = mock_mbuf_freed;
+    forward_burst(&ctx, burst, 4, 0, rdtsc());
+
+    ASSERT(ctx.packets_flooded == 1, "Broadcast in a burst must be flooded");
+    ASSERT(ctx.packets_forwarded == 1, "Unicast in a burst must be forwarded");
+    ASSERT(ctx.packets_dropped == 2, "Runt and hairpin in a burst must be dropped");
+    ASSERT(mock_mbuf_freed == freed_before + 2, "Dropped buffers must be released");
+    ASSERT(ctx.tx_buffers[1].count == 2, "Flood copy and unicast should be in Port 1's queue");
+    ASSERT(ctx.tx_buffers[1].mbufs[0] == burst[0] && ctx.tx_buffers[1].mbufs[1] == burst[1],
+           "Port 1's queue must keep the burst's arrival order");
+}
+
+/* Routing: port 0 is 10.0.0.1 on 10.0.0.0/24, port 1 reaches 10.1.0.0/16 via 10.0.1.254 */
+static const uint8_t MAC_PORT0[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x10};
+static const uint8_t MAC_PORT1[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x11};
+static const uint8_t MAC_GATEWAY[6] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x0F};
+static const uint8_t IP6_DST[16] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x42};
+
+static route_table_t g_routes;
+
+static void setup_routes(void) {
+    route_table_init(&g_routes);
+
+    ip_addr_t ip, gw;
+    ip.v4 = 0x0A000000;
+    route_table_add(&g_routes, 4, &ip, 24, 0, NULL);
+    ip.v4 = 0x0A010000;
+    gw.v4 = 0x0A0001FE;
+    route_table_add(&g_routes, 4, &ip, 16, 1, &gw);
+
+    memset(&ip, 0, sizeof(ip));
+    memcpy(ip.v6, IP6_DST, 16);
+    route_table_add(&g_routes, 6, &ip, 64, 1, NULL); /* 2001:db8::/64 connected */
+
+    g_routes.port_ip4[0] = 0x0A000001;
+    arp_update(&g_routes.arp, 0x0A0001FE, MAC_GATEWAY);
+    ndp_update(&g_routes.ndp, IP6_DST, MAC_HOST_C);
+}
+
+static void setup_routed_ctx(rx_lcore_ctx_t *ctx) {
+    setup_ctx(ctx);
+    ctx->routes = &g_routes;
+    memcpy(ctx->port_mac[0].addr_bytes, MAC_PORT0, 6);
+    memcpy(ctx->port_mac[1].addr_bytes, MAC_PORT1, 6);
+    neigh_cache_init(&ctx->neigh_cache);
+}
+
+static uint16_t header_checksum(const uint8_t *hdr, size_t len) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < len; i += 2)
+        sum += (uint32_t)(hdr[i] << 8 | hdr[i + 1]);
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+/* IPv4 packet from Host A to our port 0 MAC, with a valid header checksum */
+static struct rte_mbuf *build_ipv4(uint32_t dst_ip, uint8_t ttl) {
+    struct rte_mbuf *m = mock_build_packet(0, MAC_HOST_A, MAC_PORT0, 0x0800);
+    uint8_t *ip = (uint8_t *)m->buf_addr + 14;
+
+    memset(ip, 0, 20);
+    ip[0] = 0x45;
+    ip[3] = 20;
+    ip[8] = ttl;
+    ip[9] = 17;
+    ip[12] = 10; /* 10.0.0.2 */
+    ip[15] = 2;
+    ip[16] = (uint8_t)(dst_ip >> 24);
+    ip[17] = (uint8_t)(dst_ip >> 16);
+    ip[18] = (uint8_t)(dst_ip >> 8);
+    ip[19] = (uint8_t)dst_ip;
+    uint16_t csum = header_checksum(ip, 20);
+    ip[10] = (uint8_t)(csum >> 8);
+    ip[11] = (uint8_t)csum;
+
+    m->data_len = m->pkt_len = 34;
+    return m;
+}
+
+static void test_routed_ipv4() {
+    rx_lcore_ctx_t ctx;
+    setup_routed_ctx(&ctx);
+
+    struct rte_mbuf *pkt = build_ipv4(0x0A010203, 64); /* 10.1.2.3 */
+    forward_burst(&ctx, &pkt, 1, 0, rdtsc());
+
+    const uint8_t *frame = (const uint8_t *)pkt->buf_addr;
+    ASSERT(ctx.packets_routed == 1 && ctx.packets_forwarded == 1, "Packet should be routed");
+    ASSERT(ctx.tx_buffers[1].count == 1 && ctx.tx_buffers[1].mbufs[0] == pkt,
+           "Routed packet should be in the next hop's port queue");
+    ASSERT(memcmp(frame, MAC_GATEWAY, 6) == 0, "Destination MAC must be the gateway's");
+    ASSERT(memcmp(frame + 6, MAC_PORT1, 6) == 0, "Source MAC must be the egress port's");
+    ASSERT(frame[14 + 8] == 63, "TTL must be decremented");
+    ASSERT(header_checksum(frame + 14, 20) == 0, "IPv4 checksum must stay valid");
+    ASSERT(ctx.packets_flooded == 0, "Routed packet mustn't be bridged");
+}
+
+static void test_routed_drops() {
+    rx_lcore_ctx_t ctx;
+    setup_routed_ctx(&ctx);
+
+    struct rte_mbuf *burst[3];
+    burst[0] = build_ipv4(0xC0A80001, 64); /* 192.168.0.1: no route */
+    burst[1] = build_ipv4(0x0A010203, 1);  /* TTL expires here */
+    burst[2] = build_ipv4(0x0A000063, 64); /* 10.0.0.99: connected, never seen */
+
+    uint32_t freed_before = mock_mbuf_freed;
+    forward_burst(&ctx, burst, 3, 0, rdtsc());
+
+    ASSERT(ctx.no_route == 1, "Destination without a route must be counted");
+    ASSERT(ctx.no_neigh == 1, "Unresolved neighbour must be counted");
+    ASSERT(ctx.packets_dropped == 3, "All three packets must be dropped");
+    ASSERT(mock_mbuf_freed == freed_before + 3, "Dropped buffers must be released");
+    ASSERT(ctx.tx_buffers[0].count == 0 && ctx.tx_buffers[1].count == 0,
+           "Nothing should be queued");
+}
+
+static void test_routed_ipv6() {
+    rx_lcore_ctx_t ctx;
+    setup_routed_ctx(&ctx);
+
+    struct rte_mbuf *pkt = mock_build_packet(0, MAC_HOST_A, MAC_PORT0, 0x86DD);
+    uint8_t *ip6 = (uint8_t *)pkt->buf_addr + 14;
+    memset(ip6, 0, 40);
+    ip6[0] = 0x60;
+    ip6[6] = 17; /* UDP */
+    ip6[7] = 2;  /* Hop limit */
+    memcpy(ip6 + 24, IP6_DST, 16);
+    pkt->data_len = pkt->pkt_len = 54;
+
+    forward_burst(&ctx, &pkt, 1, 0, rdtsc());
+
+    const uint8_t *frame = (const uint8_t *)pkt->buf_addr;
+    ASSERT(ctx.packets_routed == 1, "IPv6 packet should be routed");
+    ASSERT(ctx.tx_buffers[1].count == 1, "IPv6 packet should be in Port 1's queue");
+    ASSERT(memcmp(frame, MAC_HOST_C, 6) == 0, "Destination MAC must come from NDP");
+    ASSERT(frame[14 + 7] == 1, "Hop limit must be decremented");
+}
+
+static void test_arp_reply_and_learning() {
+    rx_lcore_ctx_t ctx;
+    setup_routed_ctx(&ctx);
+
+    /* Host A (10.0.0.2) asks who has 10.0.0.1, the port's address */
+    struct rte_mbuf *req = mock_build_packet(0, MAC_HOST_A, MAC_BROADCAST, 0x0806);
+    uint8_t *arp = (uint8_t *)req->buf_addr + 14;
+    const uint8_t body[28] = {0, 1, 0x08, 0, 6, 4, 0, 1, 0x00, 0x11, 0x22, 0x33, 0x44, 0x0A,
+                              10, 0, 0, 2, 0, 0, 0, 0, 0, 0, 10, 0, 0, 1};
+    memcpy(arp, body, sizeof(body));
+    req->data_len = req->pkt_len = 42;
+
+    forward_burst(&ctx, &req, 1, 0, rdtsc());
+
+    const uint8_t *frame = (const uint8_t *)req->buf_addr;
+    ASSERT(ctx.tx_buffers[0].count == 1 && ctx.tx_buffers[0].mbufs[0] == req,
+           "Reply should go back out the ingress port");
+    ASSERT(ctx.packets_flooded == 0, "A request for our address mustn't be flooded");
+    ASSERT(arp[7] == 2 && memcmp(arp + 8, MAC_PORT0, 6) == 0, "Frame must be an ARP reply from us");
+    ASSERT(memcmp(frame, MAC_HOST_A, 6) == 0, "Reply must be addressed to the requester");
+
+    /* Host A is known now: routed packets to it go straight out */
+    struct rte_mbuf *pkt = build_ipv4(0x0A000002, 64);
+    memcpy(pkt->buf_addr, MAC_PORT1, 6); /* Arrives on port 1 */
+    forward_burst(&ctx, &pkt, 1, 1, rdtsc());
+    ASSERT(ctx.tx_buffers[0].count == 2 && memcmp(pkt->buf_addr, MAC_HOST_A, 6) == 0,
+           "Sender of the request must be learned");
+}
+
+static void test_bridging_with_routes() {
+    rx_lcore_ctx_t ctx;
+    setup_routed_ctx(&ctx);
+
+    /* Not for our MAC: the bridge handles it as before */
+    struct rte_mbuf *pkt = mock_build_packet(0, MAC_HOST_A, MAC_HOST_B, 0x0800);
+    forward_burst(&ctx, &pkt, 1, 0, rdtsc());
+
+    ASSERT(ctx.packets_flooded == 1, "Unknown unicast must still be flooded");
+    ASSERT(ctx.packets_routed == 0, "Frames to other MACs mustn't be routed");
+}
+
+static void test_route_config_load() {
+    const char *tmp = "/tmp/test-routes.conf";
+    FILE *f = fopen(tmp, "w");
+    ASSERT(f != NULL, "Temp file must open");
+    if (!f) return;
+
+    fprintf(f, "# Two ports\n"
+               "[address]\n"
+               "port = 1\n"
+               "ip = 192.168.1.1\n"
+               "\n"
+               "[route]\n"
+               "dst = 192.168.1.0/24\n"
+               "port = 1\n"
+               "\n"
+               "[route]\n"
+               "dst = 0.0.0.0/0\n"
+               "port = 1\n"
+               "via = 192.168.1.254\n"
+               "\n"
+               "[route]\n"
+               "dst = 2001:db8::/32\n"
+               "port = 0\n"
+               "via = fe80::1\n");
+    fclose(f);
+
+    route_table_t rt;
+    route_table_init(&rt);
+    ASSERT(route_config_load(tmp, &rt, NUM_PORTS) == 0, "Valid routes file must load");
+    ASSERT(rt.nb_routes == 3 && rt.nb_nexthops == 3, "Every route must get its next hop");
+    ASSERT(rt.port_ip4[1] == 0xC0A80101, "Port address must be set");
+
+    const route_nexthop_t *nh = route_lookup4(&rt, 0x08080808);
+    ASSERT(nh && nh->port == 1 && !nh->connected && nh->gateway.v4 == 0xC0A801FE,
+           "Default route must go via the gateway");
+    nh = route_lookup4(&rt, 0xC0A80105);
+    ASSERT(nh && nh->connected, "Subnet route must be connected");
+    const uint8_t v6[16] = {0x20, 0x01, 0x0d, 0xb8, 0x12};
+    nh = route_lookup6(&rt, v6);
+    ASSERT(nh && nh->port == 0 && nh->ip_ver == 6, "IPv6 route must be loaded");
+    route_table_destroy(&rt);
+
+    /* Errors: port out of range, then mixed families */
+    f = fopen(tmp, "w");
+    fprintf(f, "[route]\ndst = 10.0.0.0/8\nport = 2\n");
+    fclose(f);
+    route_table_init(&rt);
+    ASSERT(route_config_load(tmp, &rt, NUM_PORTS) == -1, "Port past the last must be rejected");
+    route_table_destroy(&rt);
+
+    f = fopen(tmp, "w");
+    fprintf(f, "[route]\ndst = 10.0.0.0/8\nport = 0\nvia = fe80::1\n");
+    fclose(f);
+    route_table_init(&rt);
+    ASSERT(route_config_load(tmp, &rt, NUM_PORTS) == -1, "Gateway of another family must fail");
+    route_table_destroy(&rt);
+    remove(tmp);
+}
+
+/* UDP packet from Host A to Host B (bridged) */
+static struct rte_mbuf *build_udp(uint16_t dst_port) {
+    struct rte_mbuf *m = build_ipv4(0x0A000003, 64);
+    memcpy(m->buf_addr, MAC_HOST_B, 6);
+    uint8_t *udp = (uint8_t *)m->buf_addr + 34;
+    memset(udp, 0, 8);
+    udp[2] = (uint8_t)(dst_port >> 8);
+    udp[3] = (uint8_t)dst_port;
+    m->data_len = m->pkt_len = 42;
+    return m;
+}
+
+static void test_acl_rules() {
+    rule_table_t rules;
+    rule_table_init(&rules, 16);
+
+    rule_t r;
+    memset(&r, 0, sizeof(r));
+    r.priority = 10;
+    r.protocol = 17;
+    r.dst_port = 53;
+    r.action.type = ACT_DROP;
+    rule_table_add(&rules, &r);
+    r.priority = 20;
+    r.dst_port = 0;
+    r.action.type = ACT_FWD;
+    r.action.out_ifindex = 1;
+    rule_table_add(&rules, &r);
+    ASSERT(rule_table_compile(&rules) == 0, "Rules must compile");
+
+    rx_lcore_ctx_t ctx;
+    setup_ctx(&ctx);
+    ctx.rules = &rules;
+
+    struct rte_mbuf *burst[3];
+    burst[0] = build_udp(53);                                           /* Dropped */
+    burst[1] = build_udp(80);                                           /* Fwd: bridged */
+    burst[2] = mock_build_packet(0, MAC_HOST_A, MAC_BROADCAST, 0x0806); /* Not IP */
+
+    uint32_t freed_before = mock_mbuf_freed;
+    forward_burst(&ctx, burst, 3, 0, rdtsc());
+
+    ASSERT(ctx.acl_dropped == 1 && ctx.packets_dropped == 1, "Drop rule must drop its packet");
+    ASSERT(mock_mbuf_freed == freed_before + 1, "Dropped buffer must be released");
+    ASSERT(ctx.packets_flooded == 2, "Fwd matches and non-IP frames must be bridged");
+    ASSERT(ctx.tx_buffers[1].count == 2 && ctx.tx_buffers[1].mbufs[0] == burst[1],
+           "Permitted packets must keep their order");
+
+    rule_table_destroy(&rules);
+}
+
 int main() {
     printf("Running Forwarding Tests...\n");
     printf("--------------------------------------------------\n");
@@ -178,6 +526,20 @@ int main() {
     test_hairpin_drop();
     test_system_mac_migration();
     test_system_malformed_packet_drop();
+    test_shared_table_across_lcores();
+    test_burst_forwarding();
+    test_acl_rules();
+
+    setup_routes();
+    test_routed_ipv4();
+    test_routed_drops();
+    test_routed_ipv6();
+    test_arp_reply_and_learning();
+    test_bridging_with_routes();
+    test_route_config_load();
+    route_table_destroy(&g_routes);
+
+    mac_table_destroy(&g_table);
 
     printf("\nResults: %d Passed, %d Failed\n", g_tests_passed, g_tests_failed);
 
@@ -0,0 +1,146 @@
+#ifndef LPM_H
+#define LPM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Longest prefix match tables for IPv4 and IPv6 destinations.
+
+    Both are multibit tries of 32-bit entries: a root table indexed by the
+    first root_bits of the address, then groups of 256 entries indexed by
+    one more byte each. IPv4 is DIR-24-8: a 2^24 entry root (64 MB of mostly
+    untouched pages), so any /24 or shorter resolves with one load, longer
+    ones with two. IPv6 has a 2^16 entry root and up to 14 group levels.
+
+    Routes are expanded into every entry they cover, and an entry remembers
+    the depth of the route that filled it: a shorter route never overwrites
+    a longer one, whatever the order they are added in. An entry that points
+    to a group has copied its route into all 256 children.
+
+    Tables are built before the lcores start and only read afterwards: no
+    locking, no route removal.
+*/
+
+#define LPM_GROUP_ENTRIES 256
+#define LPM_MAX_GROUPS 65536
+#define LPM4_ROOT_BITS 24
+#define LPM6_ROOT_BITS 16
+
+/* Entry layout: value (next hop) in bits 0-21, route depth in 22-29. */
+#define LPM_VALID (1u << 31)
+#define LPM_GROUP (1u << 30) /* Value is the index of the group one level down */
+#define LPM_DEPTH_SHIFT 22
+#define LPM_DEPTH_MASK 0xFFu
+#define LPM_VALUE_MASK ((1u << LPM_DEPTH_SHIFT) - 1)
+
+typedef struct {
+    uint32_t *root;   /* 2^root_bits entries */
+    uint32_t *groups; /* nb_groups * LPM_GROUP_ENTRIES entries */
+    uint32_t nb_groups;
+    uint32_t used_groups;
+    uint8_t root_bits;
+    uint8_t addr_bits; /* 32 or 128 */
+} lpm_t;
+
+/**
+ * Initialize an IPv4 (DIR-24-8) table
+ * @param lpm Pointer to table structure
+ * @param nb_groups Groups for routes longer than /24 (1 to LPM_MAX_GROUPS), one per /24
+ *        that has any
+ * @return 0 if successful, -1 if nb_groups is out of range or allocation failed
+*/
+int lpm4_init(lpm_t *lpm, uint32_t nb_groups);
+
+/**
+ * Initialize an IPv6 table
+ * @param lpm Pointer to table structure
+ * @param nb_groups Groups for routes longer than /16 (1 to LPM_MAX_GROUPS), a /64
+ *        route takes up to 6
+ * @return 0 if successful, -1 if nb_groups is out of range or allocation failed
+*/
+int lpm6_init(lpm_t *lpm, uint32_t nb_groups);
+
+/**
+ * Free the tables (no lcore may use them any more)
+ * @param lpm Pointer to table structure
+*/
+void lpm_destroy(lpm_t *lpm);
+
+/**
+ * Add an IPv4 route, replacing one with the same prefix
+ * @param lpm Pointer to table structure
+ * @param prefix Address in host byte order, bits past depth are ignored
+ * @param depth Prefix length (0-32)
+ * @param value Next hop (up to LPM_VALUE_MASK)
+ * @return 0 if successful, -1 if an argument is out of range or the groups ran out
+*/
+int lpm4_add(lpm_t *lpm, uint32_t prefix, uint8_t depth, uint32_t value);
+
+/**
+ * Add an IPv6 route, replacing one with the same prefix
+ * @param lpm Pointer to table structure
+ * @param prefix Address in network byte order, bits past depth are ignored
+ * @param depth Prefix length (0-128)
+ * @param value Next hop (up to LPM_VALUE_MASK)
+ * @return 0 if successful, -1 if an argument is out of range or the groups ran out
+*/
+int lpm6_add(lpm_t *lpm, const uint8_t prefix[16], uint8_t depth, uint32_t value);
+
+/**
+ * Lookup a burst of IPv4 destinations. Every root entry is prefetched
+ * before the first is read, then every group entry needed.
+ * @param lpm Pointer to table structure
+ * @param ips Addresses in host byte order
+ * @param n Number of addresses (up to 64)
+ * @param values Output for the next hop of each address routed
+ * @return Bit i set if ips[i] matched a route
+*/
+uint64_t lpm4_lookup_bulk(const lpm_t *lpm, const uint32_t ips[], unsigned int n,
+                          uint32_t values[]);
+
+/**
+ * Lookup a burst of IPv6 destinations, one trie level at a time over the
+ * whole burst, prefetching each packet's next entry
+ * @param lpm Pointer to table structure
+ * @param ips Addresses in network byte order
+ * @param n Number of addresses (up to 64)
+ * @param values Output for the next hop of each address routed
+ * @return Bit i set if ips[i] matched a route
+*/
+uint64_t lpm6_lookup_bulk(const lpm_t *lpm, const uint8_t *const ips[], unsigned int n,
+                          uint32_t values[]);
+
+/**
+ * Lookup one IPv4 destination
+ * @param lpm Pointer to table structure
+ * @param ip Address in host byte order
+ * @param value Output for the next hop if found
+ * @return true if a route matched
+*/
+static inline bool lpm4_lookup(const lpm_t *lpm, uint32_t ip, uint32_t *value) {
+    uint32_t e = lpm->root[ip >> 8];
+    if (e & LPM_GROUP) {
+        e = lpm->groups[(e & LPM_VALUE_MASK) * LPM_GROUP_ENTRIES + (ip & 0xFF)];
+    }
+    *value = e & LPM_VALUE_MASK;
+    return (e & LPM_VALID) != 0;
+}
+
+/**
+ * Lookup one IPv6 destination
+ * @param lpm Pointer to table structure
+ * @param ip Address in network byte order
+ * @param value Output for the next hop if found
+ * @return true if a route matched
+*/
+static inline bool lpm6_lookup(const lpm_t *lpm, const uint8_t ip[16], uint32_t *value) {
+    uint32_t e = lpm->root[(uint32_t)ip[0] << 8 | ip[1]];
+    for (unsigned int i = 2; (e & LPM_GROUP) && i < 16; i++) {
+        e = lpm->groups[(e & LPM_VALUE_MASK) * LPM_GROUP_ENTRIES + ip[i]];
+    }
+    *value = e & LPM_VALUE_MASK;
+    return (e & LPM_VALID) != 0;
+}
+
+#endif /* LPM_H */
@@ -1,45 +1,120 @@
 #ifndef MAC_TABLE_H
 #define MAC_TABLE_H
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+/*
+    MAC table shared by all forwarding lcores.
+
+    Buckets of 8 entries, two candidate buckets per MAC. An entry's key packs
+    the MAC, the port and a valid bit into one 64-bit word, so the 8 keys of
+    a bucket fill one cache line and a lookup compares full keys without a
+    separate tag. The TSCs sit in the bucket's second line, read on a hit only:
+    a lookup touches 1-2 lines per candidate bucket, usually just the first.
+
+    Readers take no lock: keys and TSCs are single atomic words, and a reader
+    re-checks the key after reading the TSC, retrying if the slot changed
+    under it. Writers store the TSC first, then claim and update slots with
+    CAS, so whoever sees a new key also sees its TSC. Learning races between
+    lcores are benign: the worst outcome is a dropped learn (two lcores claim
+    a slot for the same new MAC, see each other and both give up), which the
+    host's next frame repairs.
+
+    To keep shared lines clean, a known MAC's TSC is only rewritten once it
+    is MAC_TABLE_REFRESH_DIV-th of the aging timeout old: entries may age out
+    that much early.
+
+    [Aging]
+    Lookups still check the TSC, but expired entries are removed by a sweep:
+    every lcore owns a range of buckets (mac_sweep_t) and clears the expired
+    keys of MAC_SWEEP_BUCKETS of them per RX pass. A cleared slot is free
+    without reading its TSC line, and new MACs land in the first free slot.
+    The buckets bound every lookup to two, so there are no probe chains to
+    shift back. A freshly claimed slot is never swept: its key is published
+    after its TSC. A sweep that races the refresh of an entry already there
+    may still drop it: relearned with the host's next frame.
+*/
+
 #define MAC_ADDR_LEN 6
-#define MAC_TABLE_CAPACITY 2048
-#define MAC_TABLE_MAX_PROBE 16  /* Maximum linear probe distance before giving up */
+#define MAC_BUCKET_ENTRIES 8
+#define MAC_TABLE_DEFAULT_CAPACITY 65536 /* Entries, rounded up to a power of two */
+#define MAC_TABLE_MIN_CAPACITY (2 * MAC_BUCKET_ENTRIES)
+#define MAC_TABLE_MAX_CAPACITY (1u << 24)
+#define MAC_TABLE_REFRESH_DIV 64
+#define MAC_SWEEP_BUCKETS 16 /* Buckets an lcore sweeps per RX pass */
+
+/* Key layout: MAC in bits 0-47, port in 48-62, bit 63 set if the slot is used. */
+#define MAC_KEY_VALID (1ULL << 63)
+#define MAC_KEY_MAC_MASK ((1ULL << 48) - 1)
+#define MAC_KEY_PORT_SHIFT 48
+#define MAC_KEY_PORT_MASK 0x7FFFu
 
 typedef struct {
-    uint8_t mac[MAC_ADDR_LEN];
-    uint16_t port_id;
-    uint64_t last_seen_tsc;
-    bool occupied;
-} mac_entry_t;
+    _Alignas(64) _Atomic uint64_t keys[MAC_BUCKET_ENTRIES];
+    _Atomic uint64_t last_seen_tsc[MAC_BUCKET_ENTRIES];
+} mac_bucket_t;
 
 typedef struct {
-    mac_entry_t entries[MAC_TABLE_CAPACITY];
-    uint64_t table_full_count;  /* How many times table was full */
-    uint64_t aging_timeout_tsc; /* Timeout in TSC cycles (default 30s) */
+    mac_bucket_t *buckets;
+    uint32_t bucket_mask;
+    uint32_t capacity;                      /* Entries */
+    atomic_uint_fast64_t table_full_count;  /* How many times table was full */
+    uint64_t aging_timeout_tsc;             /* Timeout in TSC cycles (default 30s) */
+    uint64_t refresh_tsc;                   /* Rewrite a known MAC's TSC after this long */
 } mac_table_t;
 
+/* One lcore's share of the sweep */
+typedef struct {
+    uint32_t begin; /* Buckets [begin, end) */
+    uint32_t end;
+    uint32_t next;
+    uint64_t expired; /* Entries removed so far */
+} mac_sweep_t;
+
 /**
  * Initialize MAC table
  * @param table Pointer to table structure
+ * @param capacity Entries, rounded up to a power of two (MAC_TABLE_MIN_CAPACITY to
+ *        MAC_TABLE_MAX_CAPACITY)
  * @param aging_timeout_sec Aging timeout in seconds
  * @param cycles_per_ns TSC cycles per nanosecond (from calibration)
+ * @return 0 if successful, -1 if the capacity is out of range or allocation failed
 */
-void mac_table_init(mac_table_t *table, uint32_t aging_timeout_sec,
-                    double cycles_per_ns);
+int mac_table_init(mac_table_t *table, uint32_t capacity, uint32_t aging_timeout_sec,
+                   double cycles_per_ns);
 
 /**
- * Insert or update a MAC entry in the table
+ * Free the buckets (no lcore may use the table any more)
+ * @param table Pointer to table structure
+*/
+void mac_table_destroy(mac_table_t *table);
+
+/**
+ * Insert or update a MAC entry in the table. Safe to call from several lcores.
  * @param table Pointer to table structure
  * @param mac MAC address to insert
  * @param port_id Port ID where the MAC was seen
- * @return true if successful, false if table is full
+ * @param current_tsc Current TSC value
+ * @return true if successful, false if both candidate buckets are full
 */
 bool mac_table_insert(mac_table_t *table, const uint8_t mac[MAC_ADDR_LEN],
                       uint16_t port_id, uint64_t current_tsc);
 
+/**
+ * Insert or update a burst of MACs seen on the same port, prefetching every
+ * MAC's first bucket before the first write
+ * @param table Pointer to table structure
+ * @param macs MAC addresses to insert
+ * @param n Number of MACs (up to 64)
+ * @param port_id Port ID where the MACs were seen
+ * @param current_tsc Current TSC value
+ * @return Number of MACs stored (the rest found the table full)
+*/
+unsigned int mac_table_insert_bulk(mac_table_t *table, const uint8_t *const macs[], unsigned int n,
+                                   uint16_t port_id, uint64_t current_tsc);
+
 /**
  * Lookup MAC address in table
  * @param table Pointer to table structure
@@ -51,6 +126,67 @@ bool mac_table_insert(mac_table_t *table, const uint8_t mac[MAC_ADDR_LEN],
 bool mac_table_lookup(mac_table_t *table, const uint8_t mac[MAC_ADDR_LEN],
                       uint64_t current_tsc, uint16_t *out_port);
 
+/**
+ * Lookup a burst of MAC addresses. Hashes every MAC and prefetches its
+ * first bucket before the first compare, so the misses overlap.
+ * @param table Pointer to table structure
+ * @param macs MAC addresses to lookup
+ * @param n Number of MACs (up to 64)
+ * @param current_tsc Current TSC value for aging check
+ * @param out_ports Output for port_id of each MAC found
+ * @return Bit i set if macs[i] was found and not expired
+*/
+uint64_t mac_table_lookup_bulk(mac_table_t *table, const uint8_t *const macs[], unsigned int n,
+                               uint64_t current_tsc, uint16_t out_ports[]);
+
+/**
+ * Give part `part` of `parts` (one per lcore) of the buckets to a sweeper
+ * @param sweep Sweeper state
+ * @param table Pointer to table structure
+ * @param part 0..parts-1
+ * @param parts Number of sweepers
+*/
+void mac_sweep_init(mac_sweep_t *sweep, const mac_table_t *table, unsigned int part,
+                    unsigned int parts);
+
+/**
+ * Remove the expired entries of the next MAC_SWEEP_BUCKETS buckets of the
+ * sweeper's range, wrapping around at its end
+ * @param table Pointer to table structure
+ * @param sweep Sweeper state
+ * @param current_tsc Current TSC value for aging check
+ * @return Number of expired entries removed
+*/
+unsigned int mac_table_sweep(mac_table_t *table, mac_sweep_t *sweep, uint64_t current_tsc);
+
+/**
+ * FNV-1a hash of a MAC address
+ * @param mac MAC address
+ * @return 32-bit hash
+*/
+static inline uint32_t mac_hash(const uint8_t mac[MAC_ADDR_LEN]) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < MAC_ADDR_LEN; i++) {
+        hash ^= mac[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Candidate buckets of a hash (may be the same bucket)
+ * @param table Pointer to table structure
+ * @param hash From mac_hash()
+ * @return Bucket index
+*/
+static inline uint32_t mac_bucket_primary(const mac_table_t *table, uint32_t hash) {
+    return hash & table->bucket_mask;
+}
+
+static inline uint32_t mac_bucket_secondary(const mac_table_t *table, uint32_t hash) {
+    return (hash ^ ((hash >> 16) * 0x9E3779B1u)) & table->bucket_mask;
+}
+
 /**
  * Check if MAC address is unicast (the first octet's LSB is 0)
  * @param mac MAC address to check
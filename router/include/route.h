@@ -0,0 +1,131 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "arp_table.h"
+#include "lpm.h"
+#include "ndp_table.h"
+#include "parser.h"
+
+/*
+    L3 forwarding state shared by all lcores: one LPM table per family whose
+    values index a next-hop table, and the neighbour tables (the engine's
+    ARP/NDP tables) that give each next hop its MAC.
+
+    A next hop is an egress port plus either a gateway, or nothing for a
+    connected route: the packet's own destination is the neighbour then.
+    Neighbours are learned from the ARP and NDP frames crossing the router.
+
+    Routes and next hops are loaded before the lcores start and only read
+    afterwards. The neighbour tables have their own locking, see arp_table.h.
+*/
+
+#define ROUTE_MAX_NEXTHOPS 256
+#define ROUTE_LPM4_GROUPS 1024 /* /24s with longer routes in them */
+#define ROUTE_LPM6_GROUPS 4096
+#define ROUTE_NEIGH_ENTRIES 1024
+#define ROUTE_MAX_PORTS 16
+
+typedef struct {
+    ip_addr_t gateway; /* Unused for a connected route */
+    uint16_t port;
+    uint8_t ip_ver;
+    bool connected;
+} route_nexthop_t;
+
+typedef struct {
+    lpm_t lpm4;
+    lpm_t lpm6;
+    route_nexthop_t nexthops[ROUTE_MAX_NEXTHOPS];
+    uint32_t nb_nexthops;
+    uint32_t nb_routes;
+    uint32_t port_ip4[ROUTE_MAX_PORTS]; /* Host byte order, 0 if none */
+    arp_table_t arp;
+    ndp_table_t ndp;
+} route_table_t;
+
+/**
+ * Initialize an empty route table
+ * @param rt Pointer to table structure
+ * @return 0 if successful, -1 if allocation failed
+*/
+int route_table_init(route_table_t *rt);
+
+/**
+ * Free the tables (no lcore may use them any more)
+ * @param rt Pointer to table structure
+*/
+void route_table_destroy(route_table_t *rt);
+
+/**
+ * Add a route, sharing the next hop with earlier routes through the same
+ * port and gateway
+ * @param rt Pointer to table structure
+ * @param ip_ver 4 or 6
+ * @param prefix Destination (IPv4 in host byte order)
+ * @param depth Prefix length
+ * @param port Egress port
+ * @param gateway Next router (same family), NULL for a connected route
+ * @return 0 if successful, -1 if the prefix is invalid or a table is full
+*/
+int route_table_add(route_table_t *rt, uint8_t ip_ver, const ip_addr_t *prefix, uint8_t depth,
+                    uint16_t port, const ip_addr_t *gateway);
+
+/**
+ * Load routes and port addresses from an INI file:
+ *     [route]    dst = <prefix>/<len>, port = <n>, via = <gateway> (optional)
+ *     [address]  port = <n>, ip = <IPv4 address> (answered to ARP requests)
+ * @param path File to read
+ * @param rt Pointer to an initialized table
+ * @param nb_ports Ports of the router, `port` must be below it
+ * @return 0 if successful, -1 on the first invalid line (logged)
+*/
+int route_config_load(const char *path, route_table_t *rt, uint16_t nb_ports);
+
+/**
+ * Learn the sender of an ARP frame, and turn a request for the address of
+ * `port` into the reply, in place
+ * @param rt Pointer to table structure
+ * @param frame Ethernet frame
+ * @param len Frame length
+ * @param port Ingress port
+ * @param port_mac MAC address of the ingress port
+ * @return true if the frame is now a reply to send back on `port`
+*/
+bool route_arp_input(route_table_t *rt, uint8_t *frame, uint32_t len, uint16_t port,
+                     const uint8_t port_mac[6]);
+
+/**
+ * Learn the link-layer address of a Neighbor Solicitation or Advertisement
+ * @param rt Pointer to table structure
+ * @param frame Ethernet frame carrying IPv6
+ * @param len Frame length
+*/
+void route_ndp_input(route_table_t *rt, const uint8_t *frame, uint32_t len);
+
+/**
+ * Next hop of an IPv4 destination
+ * @param rt Pointer to table structure
+ * @param dst Address in host byte order
+ * @return Next hop, NULL if no route matched
+*/
+static inline const route_nexthop_t *route_lookup4(const route_table_t *rt, uint32_t dst) {
+    uint32_t nh;
+    return lpm4_lookup(&rt->lpm4, dst, &nh) ? &rt->nexthops[nh] : NULL;
+}
+
+/**
+ * Next hop of an IPv6 destination
+ * @param rt Pointer to table structure
+ * @param dst Address in network byte order
+ * @return Next hop, NULL if no route matched
+*/
+static inline const route_nexthop_t *route_lookup6(const route_table_t *rt,
+                                                   const uint8_t dst[16]) {
+    uint32_t nh;
+    return lpm6_lookup(&rt->lpm6, dst, &nh) ? &rt->nexthops[nh] : NULL;
+}
+
+#endif /* ROUTE_H */
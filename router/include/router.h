@@ -3,16 +3,23 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <rte_ether.h>
 #include <rte_mbuf.h>
 #include "mac_table.h"
 #include "latency.h"
+#include "neigh_cache.h"
+#include "route.h"
+#include "rule_table.h"
 
 #define NUM_PORTS 2
 
 #define BURST_SIZE 32 /* RX/TX burst size */
 
-/* Memory pool configuration */
-#define MBUF_POOL_SIZE 4096
+/* Descriptors per RX/TX queue (the driver may round them) */
+#define RX_DESC_DEFAULT 128
+#define TX_DESC_DEFAULT 512
+
+/* Memory pool configuration, the size is derived from the rings (see main.c) */
 #define MBUF_CACHE_SIZE 256
 #define MBUF_DATA_SIZE RTE_MBUF_DEFAULT_BUF_SIZE
 
@@ -20,6 +27,8 @@
 
 #define DEFAULT_LINK_WAIT_SEC 5
 
+#define MAX_QUEUES 64 /* RX/TX queue pairs per port, one per forwarding lcore */
+
 /* Router configuration */
 typedef struct {
     bool dev_mode; /* Use tap vdevs instead of physical NIC */
@@ -27,6 +36,10 @@ typedef struct {
     uint32_t benchmark_duration_sec;
     uint32_t aging_timeout_sec; /* MAC table aging timeout */
     uint32_t link_wait_sec;
+    uint16_t nb_queues; /* 0: one per worker lcore */
+    uint32_t mac_table_size; /* Entries */
+    const char *routes_path; /* NULL: bridge only */
+    const char *rules_path;  /* NULL: no ACL */
 } router_config_t;
 
 /* Per-port TX burst buffer */
@@ -35,17 +48,31 @@ typedef struct {
     uint16_t count;
 } tx_buffer_t;
 
-/* RX lcore context (worker thread data) */
+/*
+    RX lcore context (worker thread data), one per forwarding lcore. Lcore
+    `index` polls RX queue `queue_id` of every port, and sends on TX queue
+    `queue_id` of every port: no queue is shared, so TX needs no lock.
+*/
 typedef struct {
-    mac_table_t mac_table;
+    uint16_t index;    /* 0..nb_queues-1 */
+    uint16_t queue_id; /* Same as index */
+    mac_table_t *mac_table; /* Shared by all lcores */
+    mac_sweep_t mac_sweep;  /* This lcore's share of the aging sweep */
+    route_table_t *routes;  /* Shared by all lcores, NULL: bridge only */
+    const rule_table_t *rules; /* Shared by all lcores, NULL: no ACL */
+    struct rte_ether_addr port_mac[NUM_PORTS]; /* Frames to these are routed */
+    neigh_cache_t neigh_cache; /* In front of routes->arp and routes->ndp */
     latency_histogram_t latency_hist[NUM_PORTS];
     tx_buffer_t tx_buffers[NUM_PORTS];
     uint64_t packets_forwarded;
     uint64_t bytes_forwarded;
     uint64_t packets_flooded;
     uint64_t packets_dropped;
-    uint64_t pool_exhaustion_count;
-    double cycles_per_ns;
+    uint64_t packets_routed; /* Also in packets_forwarded */
+    uint64_t no_route;       /* Also in packets_dropped */
+    uint64_t no_neigh;       /* Also in packets_dropped */
+    uint64_t acl_dropped;    /* Also in packets_dropped */
+    double ns_per_cycle;     /* Inverse of the TSC calibration */
     volatile bool stop;
 } rx_lcore_ctx_t;
 
@@ -54,7 +81,13 @@ typedef struct {
     router_config_t config;
     struct rte_mempool *mbuf_pool;
     uint16_t port_ids[NUM_PORTS];
-    rx_lcore_ctx_t rx_ctx;
+    uint16_t nb_queues;
+    rx_lcore_ctx_t *rx_ctx[MAX_QUEUES]; /* On the socket of its lcore */
+    unsigned int rx_lcore[MAX_QUEUES];
+    mac_table_t mac_table;
+    route_table_t routes; /* Loaded if config.routes_path is set */
+    rule_table_t rules;   /* Loaded if config.rules_path is set */
+    struct rte_ether_addr port_mac[NUM_PORTS];
     uint64_t start_tsc;
     uint64_t end_tsc;
 } router_state_t;
@@ -0,0 +1,172 @@
+#include "lpm.h"
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint8_t entry_depth(uint32_t e) {
+    return (uint8_t)((e >> LPM_DEPTH_SHIFT) & LPM_DEPTH_MASK);
+}
+
+static inline uint32_t *group_of(const lpm_t *lpm, uint32_t e) {
+    return &lpm->groups[(e & LPM_VALUE_MASK) * LPM_GROUP_ENTRIES];
+}
+
+static int lpm_init(lpm_t *lpm, uint8_t root_bits, uint8_t addr_bits, uint32_t nb_groups) {
+    if (!lpm || nb_groups == 0 || nb_groups > LPM_MAX_GROUPS) return -1;
+
+    memset(lpm, 0, sizeof(*lpm));
+    /* calloc() maps fresh zero pages: only the parts routes cover get touched */
+    lpm->root = calloc((size_t)1 << root_bits, sizeof(uint32_t));
+    lpm->groups = calloc((size_t)nb_groups * LPM_GROUP_ENTRIES, sizeof(uint32_t));
+    if (!lpm->root || !lpm->groups) {
+        lpm_destroy(lpm);
+        return -1;
+    }
+
+    lpm->nb_groups = nb_groups;
+    lpm->root_bits = root_bits;
+    lpm->addr_bits = addr_bits;
+    return 0;
+}
+
+int lpm4_init(lpm_t *lpm, uint32_t nb_groups) {
+    return lpm_init(lpm, LPM4_ROOT_BITS, 32, nb_groups);
+}
+
+int lpm6_init(lpm_t *lpm, uint32_t nb_groups) {
+    return lpm_init(lpm, LPM6_ROOT_BITS, 128, nb_groups);
+}
+
+void lpm_destroy(lpm_t *lpm) {
+    if (!lpm) return;
+    free(lpm->root);
+    free(lpm->groups);
+    lpm->root = NULL;
+    lpm->groups = NULL;
+}
+
+/*
+    Write route `entry` of `depth` over n entries of a table, and down into
+    the groups below them, except where a longer route is already in place.
+*/
+static void lpm_fill(lpm_t *lpm, uint32_t *tbl, uint32_t n, uint32_t entry, uint8_t depth) {
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t e = tbl[i];
+        if (e & LPM_GROUP) {
+            lpm_fill(lpm, group_of(lpm, e), LPM_GROUP_ENTRIES, entry, depth);
+        } else if (entry_depth(e) <= depth) {
+            tbl[i] = entry; /* Unused entries have depth 0 */
+        }
+    }
+}
+
+/*
+    Walk down `addr` (network byte order) to the level where a route of
+    `depth` ends, splitting entries into groups on the way, then fill the
+    range of that level the prefix covers.
+*/
+static int lpm_add(lpm_t *lpm, const uint8_t *addr, uint8_t depth, uint32_t value) {
+    if (!lpm || depth > lpm->addr_bits || value > LPM_VALUE_MASK) return -1;
+
+    const uint32_t entry = LPM_VALID | (uint32_t)depth << LPM_DEPTH_SHIFT | value;
+    uint32_t *tbl = lpm->root;
+    unsigned int level_bits = lpm->root_bits;
+    unsigned int done = 0; /* Address bits resolved by the levels above */
+
+    for (;;) {
+        uint32_t idx = 0;
+        for (unsigned int b = done / 8; b < (done + level_bits) / 8; b++) {
+            idx = idx << 8 | addr[b];
+        }
+
+        if (depth <= done + level_bits) {
+            unsigned int span = done + level_bits - depth;
+            lpm_fill(lpm, &tbl[idx & ~((1u << span) - 1)], 1u << span, entry, depth);
+            return 0;
+        }
+
+        if (!(tbl[idx] & LPM_GROUP)) {
+            if (lpm->used_groups == lpm->nb_groups) return -1;
+
+            /* The children inherit the route covering them so far */
+            uint32_t g = lpm->used_groups++;
+            uint32_t *group = &lpm->groups[g * LPM_GROUP_ENTRIES];
+            for (unsigned int i = 0; i < LPM_GROUP_ENTRIES; i++) group[i] = tbl[idx];
+            tbl[idx] = LPM_VALID | LPM_GROUP | g;
+        }
+
+        tbl = group_of(lpm, tbl[idx]);
+        done += level_bits;
+        level_bits = 8;
+    }
+}
+
+int lpm4_add(lpm_t *lpm, uint32_t prefix, uint8_t depth, uint32_t value) {
+    const uint8_t addr[4] = {(uint8_t)(prefix >> 24), (uint8_t)(prefix >> 16),
+                             (uint8_t)(prefix >> 8), (uint8_t)prefix};
+    return lpm_add(lpm, addr, depth, value);
+}
+
+int lpm6_add(lpm_t *lpm, const uint8_t prefix[16], uint8_t depth, uint32_t value) {
+    return lpm_add(lpm, prefix, depth, value);
+}
+
+uint64_t lpm4_lookup_bulk(const lpm_t *lpm, const uint32_t ips[], unsigned int n,
+                          uint32_t values[]) {
+    uint32_t e[64];
+    uint64_t hits = 0;
+
+    for (unsigned int i = 0; i < n; i++) {
+        __builtin_prefetch(&lpm->root[ips[i] >> 8]);
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+        e[i] = lpm->root[ips[i] >> 8];
+        if (e[i] & LPM_GROUP) __builtin_prefetch(&group_of(lpm, e[i])[ips[i] & 0xFF]);
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+        if (e[i] & LPM_GROUP) e[i] = group_of(lpm, e[i])[ips[i] & 0xFF];
+        values[i] = e[i] & LPM_VALUE_MASK;
+        if (e[i] & LPM_VALID) hits |= 1ULL << i;
+    }
+    return hits;
+}
+
+uint64_t lpm6_lookup_bulk(const lpm_t *lpm, const uint8_t *const ips[], unsigned int n,
+                          uint32_t values[]) {
+    uint32_t e[64];
+    uint64_t pending = 0; /* Still pointing to a group */
+    uint64_t hits = 0;
+
+    for (unsigned int i = 0; i < n; i++) {
+        __builtin_prefetch(&lpm->root[(uint32_t)ips[i][0] << 8 | ips[i][1]]);
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+        e[i] = lpm->root[(uint32_t)ips[i][0] << 8 | ips[i][1]];
+        if (e[i] & LPM_GROUP) {
+            __builtin_prefetch(&group_of(lpm, e[i])[ips[i][2]]);
+            pending |= 1ULL << i;
+        }
+    }
+
+    /* One level per pass: the loads of a pass were all prefetched by the last */
+    for (unsigned int level = 2; pending && level < 16; level++) {
+        uint64_t next = 0;
+        for (uint64_t m = pending; m; m &= m - 1) {
+            unsigned int i = (unsigned int)__builtin_ctzll(m);
+            e[i] = group_of(lpm, e[i])[ips[i][level]];
+            if ((e[i] & LPM_GROUP) && level < 15) {
+                __builtin_prefetch(&group_of(lpm, e[i])[ips[i][level + 1]]);
+                next |= 1ULL << i;
+            }
+        }
+        pending = next;
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+        values[i] = e[i] & LPM_VALUE_MASK;
+        if (e[i] & LPM_VALID) hits |= 1ULL << i;
+    }
+    return hits;
+}
@@ -1,79 +1,308 @@
 #include "mac_table.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-static uint32_t mac_hash(const uint8_t mac[MAC_ADDR_LEN]) {
-    /* FNV-1a hash */
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < MAC_ADDR_LEN; i++) {
-        hash ^= mac[i];
-        hash *= 16777619u;
-    }
-    return hash;
+/* MAC address as the low 48 bits of a key. */
+static inline uint64_t mac_bits(const uint8_t mac[MAC_ADDR_LEN]) {
+    return (uint64_t)mac[0] | (uint64_t)mac[1] << 8 | (uint64_t)mac[2] << 16 |
+           (uint64_t)mac[3] << 24 | (uint64_t)mac[4] << 32 | (uint64_t)mac[5] << 40;
+}
+
+/* Is `key` a used slot holding MAC `mac` (from mac_bits())? */
+static inline bool key_holds(uint64_t key, uint64_t mac) {
+    return (key & (MAC_KEY_VALID | MAC_KEY_MAC_MASK)) == (MAC_KEY_VALID | mac);
 }
 
-/* Compare two MAC addresses */
-static bool mac_equal(const uint8_t mac1[MAC_ADDR_LEN], const uint8_t mac2[MAC_ADDR_LEN]) {
-    return memcmp(mac1, mac2, MAC_ADDR_LEN) == 0;
+static inline uint16_t key_port(uint64_t key) {
+    return (uint16_t)((key >> MAC_KEY_PORT_SHIFT) & MAC_KEY_PORT_MASK);
 }
 
-void mac_table_init(mac_table_t *table, uint32_t aging_timeout_sec, double cycles_per_ns) {
+/* Signed: another lcore may have stamped the entry with a slightly newer TSC. */
+static inline bool tsc_older_than(uint64_t seen, uint64_t current_tsc, uint64_t limit) {
+    return (int64_t)(current_tsc - seen) > (int64_t)limit;
+}
+
+/* The candidate buckets of `hash`; returns how many there are (1 if both are the same). */
+static inline unsigned int mac_buckets(mac_table_t *table, uint32_t hash, mac_bucket_t *out[2]) {
+    uint32_t b1 = mac_bucket_primary(table, hash);
+    uint32_t b2 = mac_bucket_secondary(table, hash);
+    out[0] = &table->buckets[b1];
+    out[1] = &table->buckets[b2];
+    return b1 == b2 ? 1 : 2;
+}
+
+int mac_table_init(mac_table_t *table, uint32_t capacity, uint32_t aging_timeout_sec,
+                   double cycles_per_ns) {
+    if (!table || capacity < MAC_TABLE_MIN_CAPACITY || capacity > MAC_TABLE_MAX_CAPACITY) {
+        return -1;
+    }
+
+    uint32_t entries = MAC_TABLE_MIN_CAPACITY;
+    while (entries < capacity) entries <<= 1;
+    uint32_t nb_buckets = entries / MAC_BUCKET_ENTRIES;
+
     memset(table, 0, sizeof(*table));
+    table->buckets = aligned_alloc(64, (size_t)nb_buckets * sizeof(mac_bucket_t));
+    if (!table->buckets) return -1;
+
+    for (uint32_t b = 0; b < nb_buckets; b++) {
+        for (unsigned int s = 0; s < MAC_BUCKET_ENTRIES; s++) {
+            atomic_init(&table->buckets[b].keys[s], 0);
+            atomic_init(&table->buckets[b].last_seen_tsc[s], 0);
+        }
+    }
+
+    table->bucket_mask = nb_buckets - 1;
+    table->capacity = entries;
+    atomic_init(&table->table_full_count, 0);
     /* Convert seconds to TSC cycles */
     table->aging_timeout_tsc = (uint64_t)(aging_timeout_sec * 1000000000.0 * cycles_per_ns);
+    table->refresh_tsc = table->aging_timeout_tsc / MAC_TABLE_REFRESH_DIV;
+    return 0;
+}
+
+void mac_table_destroy(mac_table_t *table) {
+    if (!table) return;
+    free(table->buckets);
+    table->buckets = NULL;
+}
+
+/*
+    One insert attempt. Returns 1 if done, 0 if both buckets are full, -1 if
+    another lcore changed a slot we were about to write (scan again).
+*/
+static int mac_table_try_insert(mac_table_t *table, uint64_t mac, uint64_t key, uint32_t hash,
+                                uint64_t current_tsc) {
+    mac_bucket_t *cand[2];
+    unsigned int nb = mac_buckets(table, hash, cand);
+
+    /* Known MAC (maybe expired): update in place. Keys only, the TSC line of
+     * the one slot that matches. */
+    for (unsigned int i = 0; i < nb; i++) {
+        mac_bucket_t *b = cand[i];
+
+        for (unsigned int s = 0; s < MAC_BUCKET_ENTRIES; s++) {
+            uint64_t old = atomic_load_explicit(&b->keys[s], memory_order_acquire);
+            if (!key_holds(old, mac)) continue;
+
+            uint64_t seen = atomic_load_explicit(&b->last_seen_tsc[s], memory_order_relaxed);
+            /* TSC before key, as for a new MAC below. */
+            if (old != key || tsc_older_than(seen, current_tsc, table->refresh_tsc)) {
+                atomic_store_explicit(&b->last_seen_tsc[s], current_tsc, memory_order_relaxed);
+            }
+            if (old != key &&
+                !atomic_compare_exchange_strong_explicit(&b->keys[s], &old, key,
+                                                         memory_order_acq_rel,
+                                                         memory_order_relaxed)) {
+                return -1;
+            }
+            return 1;
+        }
+    }
+
+    /* New MAC: free slot (empty or expired) in the less loaded bucket */
+    _Atomic uint64_t *free_key = NULL;
+    _Atomic uint64_t *free_tsc = NULL;
+    uint64_t free_old = 0;
+    unsigned int free_live = MAC_BUCKET_ENTRIES + 1;
+
+    for (unsigned int i = 0; i < nb; i++) {
+        mac_bucket_t *b = cand[i];
+        unsigned int live = 0;
+        int first_free = -1;
+        uint64_t first_free_old = 0;
+
+        for (unsigned int s = 0; s < MAC_BUCKET_ENTRIES; s++) {
+            uint64_t old = atomic_load_explicit(&b->keys[s], memory_order_acquire);
+            bool used = (old & MAC_KEY_VALID) &&
+                        !tsc_older_than(atomic_load_explicit(&b->last_seen_tsc[s],
+                                                             memory_order_relaxed),
+                                        current_tsc, table->aging_timeout_tsc);
+            if (used) {
+                live++;
+            } else if (first_free < 0) {
+                first_free = (int)s;
+                first_free_old = old;
+            }
+        }
+
+        if (first_free >= 0 && live < free_live) {
+            free_key = &b->keys[first_free];
+            free_tsc = &b->last_seen_tsc[first_free];
+            free_old = first_free_old;
+            free_live = live;
+        }
+    }
+
+    if (!free_key) return 0;
+
+    /* TSC before key: the release CAS publishes both, so a sweep on another
+     * lcore that sees the new key also sees its fresh TSC and leaves it alone.
+     * A reader racing with us may see the expired old MAC with the fresh TSC
+     * for that moment and forward one frame to its old port. If the CAS fails,
+     * the slot now holds another lcore's claim (as fresh) or is empty. */
+    atomic_store_explicit(free_tsc, current_tsc, memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(free_key, &free_old, key, memory_order_acq_rel,
+                                                 memory_order_relaxed)) {
+        return -1;
+    }
+
+    /* Another lcore may have claimed a slot for the same MAC meanwhile. Whoever
+     * sees the other's copy gives up its own, so no stale duplicate survives. */
+    for (unsigned int i = 0; i < nb; i++) {
+        for (unsigned int s = 0; s < MAC_BUCKET_ENTRIES; s++) {
+            _Atomic uint64_t *k = &cand[i]->keys[s];
+            if (k != free_key && key_holds(atomic_load(k), mac)) {
+                uint64_t ours = key;
+                atomic_compare_exchange_strong(free_key, &ours, 0);
+                return 1;
+            }
+        }
+    }
+    return 1;
+}
+
+static bool mac_table_insert_hashed(mac_table_t *table, const uint8_t mac[MAC_ADDR_LEN],
+                                    uint32_t hash, uint16_t port_id, uint64_t current_tsc) {
+    uint64_t bits = mac_bits(mac);
+    uint64_t key = MAC_KEY_VALID | (uint64_t)(port_id & MAC_KEY_PORT_MASK) << MAC_KEY_PORT_SHIFT |
+                   bits;
+
+    /* A lost race means the slot just changed; a few rescans settle it. */
+    for (int attempt = 0; attempt < 4; attempt++) {
+        int ret = mac_table_try_insert(table, bits, key, hash, current_tsc);
+        if (ret == 1) return true;
+        if (ret == 0) break;
+    }
+
+    /* Table full, no free slot in either bucket */
+    atomic_fetch_add_explicit(&table->table_full_count, 1, memory_order_relaxed);
+    return false;
 }
 
 bool mac_table_insert(mac_table_t *table, const uint8_t mac[MAC_ADDR_LEN], uint16_t port_id,
                       uint64_t current_tsc) {
-    uint32_t hash = mac_hash(mac);
-    uint32_t index = hash & (MAC_TABLE_CAPACITY - 1);
-
-    for (uint32_t probe = 0; probe < MAC_TABLE_MAX_PROBE; probe++) {
-        uint32_t slot = (index + probe) & (MAC_TABLE_CAPACITY - 1);
-        mac_entry_t *entry = &table->entries[slot];
-
-        /* Two birds, one stone: with this we also clean up expired slots */
-        bool expired =
-            entry->occupied && (current_tsc - entry->last_seen_tsc) > table->aging_timeout_tsc;
-
-        /* Empty slot or expired entry or matching MAC */
-        if (!entry->occupied || expired || mac_equal(entry->mac, mac)) {
-            memcpy(entry->mac, mac, MAC_ADDR_LEN);
-            entry->port_id = port_id;
-            entry->last_seen_tsc = current_tsc;
-            entry->occupied = true;
+    return mac_table_insert_hashed(table, mac, mac_hash(mac), port_id, current_tsc);
+}
+
+unsigned int mac_table_insert_bulk(mac_table_t *table, const uint8_t *const macs[], unsigned int n,
+                                   uint16_t port_id, uint64_t current_tsc) {
+    uint32_t hashes[64];
+    unsigned int stored = 0;
+
+    if (n > 64) n = 64;
+
+    /* An update reads the keys and the matching slot's TSC: both lines of the
+     * first bucket, where a known MAC usually is. */
+    for (unsigned int i = 0; i < n; i++) {
+        hashes[i] = mac_hash(macs[i]);
+        mac_bucket_t *b = &table->buckets[mac_bucket_primary(table, hashes[i])];
+        __builtin_prefetch(b->keys);
+        __builtin_prefetch(b->last_seen_tsc);
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+        stored += mac_table_insert_hashed(table, macs[i], hashes[i], port_id, current_tsc);
+    }
+    return stored;
+}
+
+static bool mac_table_lookup_hashed(mac_table_t *table, uint64_t mac, uint32_t hash,
+                                    uint64_t current_tsc, uint16_t *out_port) {
+    mac_bucket_t *cand[2];
+    unsigned int nb = mac_buckets(table, hash, cand);
+
+    for (unsigned int i = 0; i < nb; i++) {
+        mac_bucket_t *b = cand[i];
+
+        for (unsigned int s = 0; s < MAC_BUCKET_ENTRIES; s++) {
+            uint64_t key = atomic_load_explicit(&b->keys[s], memory_order_acquire);
+            if (!key_holds(key, mac)) continue;
+
+            uint64_t seen = atomic_load_explicit(&b->last_seen_tsc[s], memory_order_acquire);
+            if (atomic_load_explicit(&b->keys[s], memory_order_relaxed) != key) {
+                /* Claimed for another MAC or moved meanwhile: look at the slot again. */
+                s--;
+                continue;
+            }
+
+            /* Found matching MAC, but is it expired? */
+            if (tsc_older_than(seen, current_tsc, table->aging_timeout_tsc)) {
+                return false;
+            }
+            *out_port = key_port(key);
             return true;
         }
     }
 
-    /* Table full, no slot within probe distance */
-    table->table_full_count++;
     return false;
 }
 
 bool mac_table_lookup(mac_table_t *table, const uint8_t mac[MAC_ADDR_LEN], uint64_t current_tsc,
                       uint16_t *out_port) {
-    uint32_t hash = mac_hash(mac);
-    uint32_t index = hash & (MAC_TABLE_CAPACITY - 1);
+    return mac_table_lookup_hashed(table, mac_bits(mac), mac_hash(mac), current_tsc, out_port);
+}
+
+uint64_t mac_table_lookup_bulk(mac_table_t *table, const uint8_t *const macs[], unsigned int n,
+                               uint64_t current_tsc, uint16_t out_ports[]) {
+    uint32_t hashes[64];
+    uint64_t hits = 0;
 
-    for (uint32_t probe = 0; probe < MAC_TABLE_MAX_PROBE; probe++) {
-        uint32_t slot = (index + probe) & (MAC_TABLE_CAPACITY - 1);
-        mac_entry_t *entry = &table->entries[slot];
+    if (n > 64) n = 64;
+
+    /* Issue every bucket load first... */
+    for (unsigned int i = 0; i < n; i++) {
+        hashes[i] = mac_hash(macs[i]);
+        __builtin_prefetch(&table->buckets[mac_bucket_primary(table, hashes[i])]);
+    }
 
-        if (!entry->occupied) {
-            /* Empty slot: MAC is not in table */
-            return false;
+    /* ...then compare, by now most lines are on their way or in L1. */
+    for (unsigned int i = 0; i < n; i++) {
+        if (mac_table_lookup_hashed(table, mac_bits(macs[i]), hashes[i], current_tsc,
+                                    &out_ports[i])) {
+            hits |= 1ULL << i;
         }
+    }
+    return hits;
+}
 
-        if (mac_equal(entry->mac, mac)) {
-            /* Found matching MAC, but is it expired? */
-            if ((current_tsc - entry->last_seen_tsc) > table->aging_timeout_tsc) {
-                return false;
+void mac_sweep_init(mac_sweep_t *sweep, const mac_table_t *table, unsigned int part,
+                    unsigned int parts) {
+    uint64_t nb_buckets = (uint64_t)table->bucket_mask + 1;
+
+    sweep->begin = (uint32_t)(nb_buckets * part / parts);
+    sweep->end = (uint32_t)(nb_buckets * (part + 1) / parts);
+    sweep->next = sweep->begin;
+    sweep->expired = 0;
+}
+
+unsigned int mac_table_sweep(mac_table_t *table, mac_sweep_t *sweep, uint64_t current_tsc) {
+    unsigned int removed = 0;
+
+    if (sweep->begin == sweep->end) return 0;
+
+    for (unsigned int n = 0; n < MAC_SWEEP_BUCKETS; n++) {
+        mac_bucket_t *b = &table->buckets[sweep->next];
+
+        for (unsigned int s = 0; s < MAC_BUCKET_ENTRIES; s++) {
+            uint64_t key = atomic_load_explicit(&b->keys[s], memory_order_acquire);
+            if (!(key & MAC_KEY_VALID)) continue;
+
+            uint64_t seen = atomic_load_explicit(&b->last_seen_tsc[s], memory_order_relaxed);
+            if (!tsc_older_than(seen, current_tsc, table->aging_timeout_tsc)) continue;
+
+            /* Only if nobody moved or reclaimed it since we looked. */
+            if (atomic_compare_exchange_strong_explicit(&b->keys[s], &key, 0,
+                                                        memory_order_acq_rel,
+                                                        memory_order_relaxed)) {
+                removed++;
             }
-            *out_port = entry->port_id;
-            return true;
         }
+
+        if (++sweep->next == sweep->end) sweep->next = sweep->begin;
     }
 
-    return false;
+    sweep->expired += removed;
+    return removed;
 }
@@ -5,6 +5,7 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <time.h>
 
 /* DPDK headers */
 #include <rte_eal.h>
@@ -14,6 +15,7 @@
 #include <rte_lcore.h>
 #include <rte_launch.h>
 #include <rte_errno.h>
+#include <rte_malloc.h>
 
 /* UPE engine headers */
 #include "log.h"
@@ -21,14 +23,23 @@
 
 #include "router.h"
 #include "mac_table.h"
+#include "route.h"
+#include "rule_config.h"
+#include "rule_table.h"
 
 
 static router_state_t g_router;
 
+static void stop_lcores(void) {
+    for (uint16_t q = 0; q < g_router.nb_queues; q++) {
+        g_router.rx_ctx[q]->stop = true;
+    }
+}
+
 void signal_handler(int signum) {
     (void)signum;
     log_msg(LOG_INFO, "Signal received, stopping...");
-    g_router.rx_ctx.stop = true;
+    stop_lcores();
 }
 
 static void print_usage(const char *prog_name) {
@@ -38,7 +49,14 @@ static void print_usage(const char *prog_name) {
     printf("  --benchmark             Run in benchmark mode\n");
     printf("  --benchmark-duration N  Benchmark duration in seconds (default: 10)\n");
     printf("  --aging-timeout N       MAC table aging timeout in seconds (default: 30)\n");
+    printf("  --mac-table-size N      MAC table entries, shared by all lcores (default: %u)\n",
+           MAC_TABLE_DEFAULT_CAPACITY);
     printf("  --link-wait N           Link wait timeout in seconds (default: 5)\n");
+    printf("  --queues N              RX/TX queues per port, one lcore each (default: one per\n"
+           "                          worker lcore, capped by the NICs)\n");
+    printf("  --routes FILE           Route frames sent to the ports' MACs by the routes and\n"
+           "                          port addresses in FILE (default: bridge only)\n");
+    printf("  --rules FILE            Drop what the rules in FILE drop (same format as upe)\n");
     printf("  --help                  Show this help message\n");
     printf("\nExample:\n");
     printf("  %s -c 0x3 -n 4 -- --dev-mode\n", prog_name);
@@ -51,14 +69,22 @@ static int parse_app_args(int argc, char **argv, router_config_t *config) {
     config->benchmark_mode = false;
     config->benchmark_duration_sec = 10;
     config->aging_timeout_sec = DEFAULT_AGING_TIMEOUT_SEC;
+    config->mac_table_size = MAC_TABLE_DEFAULT_CAPACITY;
     config->link_wait_sec = DEFAULT_LINK_WAIT_SEC;
+    config->nb_queues = 0;
+    config->routes_path = NULL;
+    config->rules_path = NULL;
 
     static struct option long_options[] = {
         {"dev-mode", no_argument, NULL, 'd'},
         {"benchmark", no_argument, NULL, 'b'},
         {"benchmark-duration", required_argument, NULL, 'D'},
         {"aging-timeout", required_argument, NULL, 'a'},
+        {"mac-table-size", required_argument, NULL, 'm'},
         {"link-wait", required_argument, NULL, 'l'},
+        {"queues", required_argument, NULL, 'q'},
+        {"routes", required_argument, NULL, 'r'},
+        {"rules", required_argument, NULL, 'R'},
         {"help", no_argument, NULL, 'h'},
         {NULL, 0, NULL, 0}
     };
@@ -87,6 +113,16 @@ static int parse_app_args(int argc, char **argv, router_config_t *config) {
                         return -1;
                     }
                     break;
+            case 'm': {
+                    long n = atol(optarg);
+                    if (n < MAC_TABLE_MIN_CAPACITY || n > MAC_TABLE_MAX_CAPACITY) {
+                        log_msg(LOG_ERROR, "MAC table size must be %u-%u", MAC_TABLE_MIN_CAPACITY,
+                                MAC_TABLE_MAX_CAPACITY);
+                        return -1;
+                    }
+                    config->mac_table_size = (uint32_t)n;
+                    break;
+            }
             case 'l':
                     config->link_wait_sec = (uint32_t)atoi(optarg);
                     if (config->link_wait_sec < 1 || config->link_wait_sec > 60) {
@@ -94,6 +130,21 @@ static int parse_app_args(int argc, char **argv, router_config_t *config) {
                         return -1;
                     }
                     break;
+            case 'q': {
+                    int n = atoi(optarg);
+                    if (n < 1 || n > MAX_QUEUES) {
+                        log_msg(LOG_ERROR, "Queues must be 1-%d", MAX_QUEUES);
+                        return -1;
+                    }
+                    config->nb_queues = (uint16_t)n;
+                    break;
+            }
+            case 'r':
+                    config->routes_path = optarg;
+                    break;
+            case 'R':
+                    config->rules_path = optarg;
+                    break;
             case 'h':
                     print_usage(argv[0]);
                     exit(0);
@@ -106,13 +157,18 @@ static int parse_app_args(int argc, char **argv, router_config_t *config) {
     return 0;
 }
 
-static int port_init(uint16_t port_id, struct rte_mempool *mbuf_pool,
+/*
+    Configure `nb_queues` RX and TX queues. With more than one, the NIC spreads
+    flows over the RX queues by RSS hash (IP addresses and L4 ports), so a flow
+    stays on one lcore; TX queue q belongs to lcore q.
+*/
+static int port_init(uint16_t port_id, struct rte_mempool *mbuf_pool, uint16_t nb_queues,
                      uint32_t link_wait_sec) {
     struct rte_eth_conf port_conf = {0};
-    const uint16_t rx_rings = 1;
-    const uint16_t tx_rings = 1;
-    uint16_t nb_rxd = 128; /* RX descriptors */
-    uint16_t nb_txd = 512; /* TX descriptors */
+    const uint16_t rx_rings = nb_queues;
+    const uint16_t tx_rings = nb_queues;
+    uint16_t nb_rxd = RX_DESC_DEFAULT; /* RX descriptors */
+    uint16_t nb_txd = TX_DESC_DEFAULT; /* TX descriptors */
     int ret;
     struct rte_eth_dev_info dev_info;
 
@@ -124,6 +180,18 @@ static int port_init(uint16_t port_id, struct rte_mempool *mbuf_pool,
         return ret;
     }
 
+    if (nb_queues > 1) {
+        /* Hash what the NIC can hash of IP + TCP/UDP; NULL key: the driver default. */
+        uint64_t rss_hf = (RTE_ETH_RSS_IP | RTE_ETH_RSS_TCP | RTE_ETH_RSS_UDP) &
+                          dev_info.flow_type_rss_offloads;
+        if (rss_hf == 0) {
+            log_msg(LOG_WARN, "Port %u: no RSS support, all traffic on queue 0", port_id);
+        }
+        port_conf.rxmode.mq_mode = RTE_ETH_MQ_RX_RSS;
+        port_conf.rx_adv_conf.rss_conf.rss_key = NULL;
+        port_conf.rx_adv_conf.rss_conf.rss_hf = rss_hf;
+    }
+
     /* Configure the device */
     ret = rte_eth_dev_configure(port_id, rx_rings, tx_rings, &port_conf);
     if (ret != 0) {
@@ -139,25 +207,33 @@ static int port_init(uint16_t port_id, struct rte_mempool *mbuf_pool,
                 port_id, rte_strerror(-ret));
         return ret;
     }
+    if (nb_rxd > RX_DESC_DEFAULT || nb_txd > TX_DESC_DEFAULT) {
+        log_msg(LOG_WARN, "Port %u: driver wants %u/%u RX/TX descriptors, the mbuf pool was "
+                "sized for %u/%u", port_id, nb_rxd, nb_txd, RX_DESC_DEFAULT, TX_DESC_DEFAULT);
+    }
 
-    /* Setup RX queue */
-    ret = rte_eth_rx_queue_setup(port_id, 0, nb_rxd,
-                                 rte_eth_dev_socket_id(port_id),
-                                 NULL, mbuf_pool);
-    if (ret < 0) {
-        log_msg(LOG_ERROR, "Failed to setup RX queue for port %u: %s",
-                port_id, rte_strerror(-ret));
-        return ret;
+    for (uint16_t q = 0; q < rx_rings; q++) {
+        /* Setup RX queue */
+        ret = rte_eth_rx_queue_setup(port_id, q, nb_rxd,
+                                     rte_eth_dev_socket_id(port_id),
+                                     NULL, mbuf_pool);
+        if (ret < 0) {
+            log_msg(LOG_ERROR, "Failed to setup RX queue %u for port %u: %s",
+                    q, port_id, rte_strerror(-ret));
+            return ret;
+        }
     }
 
-    /* Setup TX queue */
-    ret = rte_eth_tx_queue_setup(port_id, 0, nb_txd,
-                                 rte_eth_dev_socket_id(port_id),
-                                 NULL);
-    if (ret < 0) {
-        log_msg(LOG_ERROR, "Failed to setup TX queue for port %u: %s",
-                port_id, rte_strerror(-ret));
-        return ret;
+    for (uint16_t q = 0; q < tx_rings; q++) {
+        /* Setup TX queue */
+        ret = rte_eth_tx_queue_setup(port_id, q, nb_txd,
+                                     rte_eth_dev_socket_id(port_id),
+                                     NULL);
+        if (ret < 0) {
+            log_msg(LOG_ERROR, "Failed to setup TX queue %u for port %u: %s",
+                    q, port_id, rte_strerror(-ret));
+            return ret;
+        }
     }
 
     /* Start the device */
@@ -207,32 +283,137 @@ static int port_init(uint16_t port_id, struct rte_mempool *mbuf_pool,
     return 0;
 }
 
-static void print_stats(const rx_lcore_ctx_t *ctx) {
-    /* Print latency histogram for each port */
+static void print_stats(void) {
+    /* Print latency histogram for each port, over all lcores */
     for (uint16_t port = 0; port < NUM_PORTS; port++) {
-        const latency_histogram_t *hist = &ctx->latency_hist[port];
+        latency_histogram_t hist;
+        latency_histogram_init(&hist);
+        for (uint16_t q = 0; q < g_router.nb_queues; q++) {
+            latency_histogram_merge(&hist, &g_router.rx_ctx[q]->latency_hist[port]);
+        }
 
-        if (hist->total_count == 0) {
+        if (hist.total_count == 0) {
             continue; /* No packets on the port yet */
         }
 
-        uint64_t p50 = latency_percentile(hist, 0.50);
-        uint64_t p99 = latency_percentile(hist, 0.99);
-        uint64_t p999 = latency_percentile(hist, 0.999);
+        uint64_t p50 = latency_percentile(&hist, 0.50);
+        uint64_t p99 = latency_percentile(&hist, 0.99);
+        uint64_t p999 = latency_percentile(&hist, 0.999);
+        uint64_t p9999 = latency_percentile(&hist, 0.9999);
 
         log_msg(LOG_INFO,
-                "Port %u: pkts=%lu, p50=%lu ns, p99=%lu ns, p999=%lu ns, "
+                "Port %u: pkts=%lu, p50=%lu ns, p99=%lu ns, p999=%lu ns, p9999=%lu ns, "
                  "min=%lu ns, max=%lu ns",
-                 port, hist->total_count, p50, p99, p999,
-                 hist->min_ns, hist->max_ns);
+                 port, hist.total_count, p50, p99, p999, p9999,
+                 hist.min_ns, hist.max_ns);
+    }
+
+    uint64_t pkts = 0, bytes = 0, flooded = 0, dropped = 0, exhausted = 0, aged = 0;
+    uint64_t routed = 0, no_route = 0, no_neigh = 0, acl_dropped = 0;
+
+    /* RX descriptors the driver couldn't refill: the pool ran dry */
+    for (uint16_t port = 0; port < NUM_PORTS; port++) {
+        struct rte_eth_stats stats;
+        if (rte_eth_stats_get(port, &stats) == 0) exhausted += stats.rx_nombuf;
+    }
+    for (uint16_t q = 0; q < g_router.nb_queues; q++) {
+        const rx_lcore_ctx_t *ctx = g_router.rx_ctx[q];
+        pkts += ctx->packets_forwarded;
+        aged += ctx->mac_sweep.expired;
+        bytes += ctx->bytes_forwarded;
+        flooded += ctx->packets_flooded;
+        dropped += ctx->packets_dropped;
+        routed += ctx->packets_routed;
+        no_route += ctx->no_route;
+        no_neigh += ctx->no_neigh;
+        acl_dropped += ctx->acl_dropped;
+
+        if (g_router.nb_queues > 1) {
+            log_msg(LOG_INFO, "  lcore %u (queue %u): pkts=%lu, flooded=%lu, dropped=%lu",
+                    g_router.rx_lcore[q], ctx->queue_id, ctx->packets_forwarded,
+                    ctx->packets_flooded, ctx->packets_dropped);
+        }
     }
 
     log_msg(LOG_INFO,
             "Forwarding: pkts=%lu, bytes=%lu, flooded=%lu, dropped=%lu, "
-            "pool_exhausted=%lu, mac_table_full=%lu",
-            ctx->packets_forwarded, ctx->bytes_forwarded,
-            ctx->packets_flooded, ctx->packets_dropped,
-            ctx->pool_exhaustion_count, ctx->mac_table.table_full_count);
+            "pool_exhausted=%lu, mac_table_full=%lu, mac_aged=%lu",
+            pkts, bytes, flooded, dropped, exhausted,
+            (uint64_t)atomic_load(&g_router.mac_table.table_full_count), aged);
+
+    if (g_router.config.routes_path) {
+        log_msg(LOG_INFO, "Routing: pkts=%lu, no_route=%lu, no_neigh=%lu", routed, no_route,
+                no_neigh);
+    }
+    if (g_router.config.rules_path) {
+        log_msg(LOG_INFO, "Rules: dropped=%lu", acl_dropped);
+    }
+}
+
+/* Forget neighbours that stopped talking, once per stats interval */
+static void expire_neighbours(void) {
+    if (!g_router.config.routes_path) return;
+
+    time_t now = time(NULL);
+    size_t a = arp_expire(&g_router.routes.arp, now);
+    size_t n = ndp_expire(&g_router.routes.ndp, now);
+    if (a + n > 0) log_msg(LOG_DEBUG, "Expired %zu ARP, %zu NDP entries", a, n);
+}
+
+/*
+    One queue per worker lcore unless --queues says otherwise, and no more
+    than every port supports.
+*/
+static uint16_t pick_nb_queues(uint16_t requested) {
+    unsigned int n = rte_lcore_count() - 1; /* The main lcore only prints stats */
+    if (requested > 0 && requested < n) {
+        n = requested;
+    } else if (requested > n) {
+        log_msg(LOG_WARN, "%u queues requested, only %u worker lcores", requested, n);
+    }
+    if (n > MAX_QUEUES) n = MAX_QUEUES;
+
+    uint16_t port_id;
+    RTE_ETH_FOREACH_DEV(port_id) {
+        if (port_id >= NUM_PORTS) {
+            break;
+        }
+
+        struct rte_eth_dev_info dev_info;
+        if (rte_eth_dev_info_get(port_id, &dev_info) != 0) {
+            continue; /* port_init() reports it */
+        }
+        if (dev_info.max_rx_queues < n) n = dev_info.max_rx_queues;
+        if (dev_info.max_tx_queues < n) n = dev_info.max_tx_queues;
+    }
+    return n > 0 ? (uint16_t)n : 1;
+}
+
+/*
+    Mbufs needed when every ring is full: each queue's RX ring and TX ring on
+    every port, the burst an lcore holds and its TX buffers, then each lcore's
+    mempool cache. Floods share the mbuf (refcount), so they need none. Rounded
+    up to 2^n - 1, the size the mempool uses best.
+*/
+static unsigned int mbuf_pool_size(uint16_t nb_queues, unsigned int nb_lcores) {
+    unsigned int rings = NUM_PORTS * nb_queues * (RX_DESC_DEFAULT + TX_DESC_DEFAULT);
+    unsigned int in_flight = nb_queues * BURST_SIZE * (1 + NUM_PORTS);
+    unsigned int caches = nb_lcores * MBUF_CACHE_SIZE;
+    unsigned int need = rings + in_flight + caches;
+
+    unsigned int size = 1;
+    while (size - 1 < need) size <<= 1;
+    return size - 1;
+}
+
+static void free_state(void) {
+    for (uint16_t q = 0; q < g_router.nb_queues; q++) {
+        rte_free(g_router.rx_ctx[q]);
+        g_router.rx_ctx[q] = NULL;
+    }
+    mac_table_destroy(&g_router.mac_table);
+    if (g_router.config.routes_path) route_table_destroy(&g_router.routes);
+    if (g_router.config.rules_path) rule_table_destroy(&g_router.rules);
 }
 
 int main(int argc, char **argv) {
@@ -271,25 +452,6 @@ int main(int argc, char **argv) {
 
     double cycles_per_ns = latency_calibrate_tsc();
     log_msg(LOG_INFO, "TSC calibration: %.2f cycles/ns", cycles_per_ns);
-    g_router.rx_ctx.cycles_per_ns = cycles_per_ns;
-
-    g_router.mbuf_pool = rte_pktmbuf_pool_create(
-        "mbuf_pool",
-        MBUF_POOL_SIZE,
-        MBUF_CACHE_SIZE,
-        0,
-        MBUF_DATA_SIZE,
-        rte_socket_id()
-    );
-
-    if (g_router.mbuf_pool == NULL) {
-        log_msg(LOG_ERROR, "Failed to create mbuf pool: %s",
-                rte_strerror(rte_errno));
-        rte_eal_cleanup();
-        return EXIT_FAILURE;
-    }
-
-    log_msg(LOG_INFO, "Created mbuf pool with %u mbufs", MBUF_POOL_SIZE);
 
     uint16_t nb_ports;
     if (g_router.config.dev_mode) {
@@ -324,6 +486,30 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
+    uint16_t nb_queues = pick_nb_queues(g_router.config.nb_queues);
+    log_msg(LOG_INFO, "Using %u RX/TX queue(s) per port%s", nb_queues,
+            nb_queues > 1 ? ", RSS" : "");
+
+    unsigned int pool_size = mbuf_pool_size(nb_queues, rte_lcore_count());
+
+    g_router.mbuf_pool = rte_pktmbuf_pool_create(
+        "mbuf_pool",
+        pool_size,
+        MBUF_CACHE_SIZE,
+        0,
+        MBUF_DATA_SIZE,
+        rte_socket_id()
+    );
+
+    if (g_router.mbuf_pool == NULL) {
+        log_msg(LOG_ERROR, "Failed to create mbuf pool: %s",
+                rte_strerror(rte_errno));
+        rte_eal_cleanup();
+        return EXIT_FAILURE;
+    }
+
+    log_msg(LOG_INFO, "Created mbuf pool with %u mbufs", pool_size);
+
     uint16_t port_id;
     RTE_ETH_FOREACH_DEV(port_id) {
         if (port_id >= NUM_PORTS) {
@@ -332,7 +518,7 @@ int main(int argc, char **argv) {
 
         g_router.port_ids[port_id] = port_id;
 
-        ret = port_init(port_id, g_router.mbuf_pool,
+        ret = port_init(port_id, g_router.mbuf_pool, nb_queues,
                         g_router.config.link_wait_sec);
         if (ret < 0) {
             log_msg(LOG_ERROR, "Failed to initialize port %u",
@@ -341,41 +527,121 @@ int main(int argc, char **argv) {
             return EXIT_FAILURE;
         }
 
+        ret = rte_eth_macaddr_get(port_id, &g_router.port_mac[port_id]);
+        if (ret != 0) {
+            log_msg(LOG_ERROR, "Failed to get the MAC address of port %u: %s", port_id,
+                    rte_strerror(-ret));
+            rte_eal_cleanup();
+            return EXIT_FAILURE;
+        }
+
         log_msg(LOG_INFO, "Initialized port %u", port_id);
     }
 
-    mac_table_init(&g_router.rx_ctx.mac_table,
-                   g_router.config.aging_timeout_sec,
-                   cycles_per_ns);
-    
-    for (uint16_t i = 0; i < NUM_PORTS; i++) {
-        latency_histogram_init(&g_router.rx_ctx.latency_hist[i]);
-        g_router.rx_ctx.tx_buffers[i].count = 0;
+    if (mac_table_init(&g_router.mac_table, g_router.config.mac_table_size,
+                       g_router.config.aging_timeout_sec, cycles_per_ns) != 0) {
+        log_msg(LOG_ERROR, "Failed to allocate the MAC table");
+        rte_eal_cleanup();
+        return EXIT_FAILURE;
     }
+    log_msg(LOG_INFO, "MAC table: %u entries, shared by the lcores", g_router.mac_table.capacity);
 
-    g_router.rx_ctx.stop = false;
+    if (g_router.config.routes_path) {
+        if (route_table_init(&g_router.routes) != 0) {
+            log_msg(LOG_ERROR, "Failed to allocate the route table");
+            mac_table_destroy(&g_router.mac_table);
+            rte_eal_cleanup();
+            return EXIT_FAILURE;
+        }
+        if (route_config_load(g_router.config.routes_path, &g_router.routes, NUM_PORTS) != 0) {
+            free_state();
+            rte_eal_cleanup();
+            return EXIT_FAILURE;
+        }
+        log_msg(LOG_INFO, "Routing: %u routes, %u next hops from %s", g_router.routes.nb_routes,
+                g_router.routes.nb_nexthops, g_router.config.routes_path);
+    }
+
+    if (g_router.config.rules_path) {
+        if (rule_table_init(&g_router.rules, RULE_TABLE_DEFAULT_CAPACITY) != 0 ||
+            rule_config_load(g_router.config.rules_path, &g_router.rules) != 0) {
+            log_msg(LOG_ERROR, "Failed to load rules from %s", g_router.config.rules_path);
+            free_state();
+            rte_eal_cleanup();
+            return EXIT_FAILURE;
+        }
+        if (rule_table_compile(&g_router.rules) != 0) {
+            log_msg(LOG_WARN, "Rule classifier build failed, using linear scan");
+        }
+        log_msg(LOG_INFO, "Rules: %zu loaded from %s", g_router.rules.count,
+                g_router.config.rules_path);
+    }
+
+    /* One context per worker lcore, from memory on that lcore's socket */
+    uint16_t q = 0;
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        if (q == nb_queues) {
+            log_msg(LOG_WARN, "lcore %u left idle: no queue for it", lcore_id);
+            continue;
+        }
+
+        rx_lcore_ctx_t *ctx = rte_zmalloc_socket("rx_lcore_ctx", sizeof(*ctx),
+                                                 RTE_CACHE_LINE_SIZE,
+                                                 (int)rte_lcore_to_socket_id(lcore_id));
+        if (ctx == NULL) {
+            log_msg(LOG_ERROR, "Failed to allocate the context of lcore %u", lcore_id);
+            free_state();
+            rte_eal_cleanup();
+            return EXIT_FAILURE;
+        }
+
+        ctx->index = q;
+        ctx->queue_id = q;
+        ctx->mac_table = &g_router.mac_table;
+        mac_sweep_init(&ctx->mac_sweep, &g_router.mac_table, q, nb_queues);
+        if (g_router.config.routes_path) ctx->routes = &g_router.routes;
+        if (g_router.config.rules_path) ctx->rules = &g_router.rules;
+        memcpy(ctx->port_mac, g_router.port_mac, sizeof(ctx->port_mac));
+        neigh_cache_init(&ctx->neigh_cache);
+        ctx->ns_per_cycle = 1.0 / cycles_per_ns;
+
+        for (uint16_t i = 0; i < NUM_PORTS; i++) {
+            latency_histogram_init(&ctx->latency_hist[i]);
+            ctx->tx_buffers[i].count = 0;
+        }
+
+        ctx->stop = false;
+
+        g_router.rx_ctx[q] = ctx;
+        g_router.rx_lcore[q] = lcore_id;
+        g_router.nb_queues = ++q;
+    }
 
-    log_msg(LOG_INFO, "Initialized RX context");
+    log_msg(LOG_INFO, "Initialized %u RX context(s)", g_router.nb_queues);
 
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
-    /* Get the first worker lcore */
-    lcore_id = rte_get_next_lcore(-1, 1, 0);
-    if (lcore_id == RTE_MAX_LCORE) {
-        log_msg(LOG_ERROR, "No worker lcore available");
-        rte_eal_cleanup();
-        return EXIT_FAILURE;
-    }
+    /* One RX worker per queue, each on its dedicated lcore */
+    uint16_t launched = 0;
+    for (; launched < g_router.nb_queues; launched++) {
+        lcore_id = g_router.rx_lcore[launched];
+        log_msg(LOG_INFO, "Launching RX worker for queue %u on lcore %u", launched, lcore_id);
 
-    log_msg(LOG_INFO, "Launching RX worker on lcore %u", lcore_id);
+        ret = rte_eal_remote_launch(rx_lcore_main, g_router.rx_ctx[launched], lcore_id);
+        if (ret < 0) {
+            log_msg(LOG_ERROR, "Failed to launch RX worker: %s",
+                    rte_strerror(-ret));
+            break;
+        }
+    }
 
-    /* Launch RX worker on dedicated lcore */
-    ret = rte_eal_remote_launch(rx_lcore_main, &g_router.rx_ctx,
-                                lcore_id);
-    if (ret < 0) {
-        log_msg(LOG_ERROR, "Failed to launch RX worker: %s",
-                rte_strerror(-ret));
+    if (launched < g_router.nb_queues) {
+        stop_lcores();
+        for (uint16_t i = 0; i < launched; i++) {
+            rte_eal_wait_lcore(g_router.rx_lcore[i]);
+        }
+        free_state();
         rte_eal_cleanup();
         return EXIT_FAILURE;
     }
@@ -388,7 +654,7 @@ int main(int argc, char **argv) {
     }
 
     /* Print stats every second */
-    while (!g_router.rx_ctx.stop) {
+    while (!g_router.rx_ctx[0]->stop) {
         sleep(1);
 
         /* In benchmark mode, check if duration elapsed */
@@ -400,41 +666,55 @@ int main(int argc, char **argv) {
 
             if (elapsed_sec >= g_router.config.benchmark_duration_sec) {
                 g_router.end_tsc = current_tsc;
-                g_router.rx_ctx.stop = true;
+                stop_lcores();
                 break;
             }
         } else {
             /* Normal mode */
-            print_stats(&g_router.rx_ctx);
+            print_stats();
         }
+
+        expire_neighbours();
     }
 
     log_msg(LOG_INFO, "Stopping router...");
 
-    /* Wait for RX worker to finish */
-    ret = rte_eal_wait_lcore(lcore_id);
-    if (ret < 0) {
-        log_msg(LOG_ERROR, "RX worker returned error: %d", ret);
+    /* Wait for the RX workers to finish */
+    for (uint16_t i = 0; i < g_router.nb_queues; i++) {
+        ret = rte_eal_wait_lcore(g_router.rx_lcore[i]);
+        if (ret < 0) {
+            log_msg(LOG_ERROR, "RX worker on lcore %u returned error: %d",
+                    g_router.rx_lcore[i], ret);
+        }
     }
 
     /* Print final stats */
     if (g_router.config.benchmark_mode) {
         double duration_sec = (double)(g_router.end_tsc - g_router.start_tsc) /
                                 (cycles_per_ns * 1000000000.0);
-        double pps = (double)g_router.rx_ctx.packets_forwarded / duration_sec;
-        double gbps = (double)g_router.rx_ctx.bytes_forwarded * 8.0 /
+        uint64_t pkts = 0, bytes = 0;
+        for (uint16_t i = 0; i < g_router.nb_queues; i++) {
+            pkts += g_router.rx_ctx[i]->packets_forwarded;
+            bytes += g_router.rx_ctx[i]->bytes_forwarded;
+        }
+        double pps = (double)pkts / duration_sec;
+        double gbps = (double)bytes * 8.0 /
                         (duration_sec * 1000000000.0);
         
-        uint64_t p50 = 0, p99 = 0, p999 = 0, min_ns = 0, max_ns = 0;
+        uint64_t p50 = 0, p99 = 0, p999 = 0, p9999 = 0, min_ns = 0, max_ns = 0;
         for (uint16_t port = 0; port < NUM_PORTS; port++) {
-            const latency_histogram_t * hist =
-                &g_router.rx_ctx.latency_hist[port];
-            if (hist->total_count > 0) {
-                p50 = latency_percentile(hist, 0.50);
-                p99 = latency_percentile(hist, 0.99);
-                p999 = latency_percentile(hist, 0.999);
-                min_ns = hist->min_ns;
-                max_ns = hist->max_ns;
+            latency_histogram_t hist;
+            latency_histogram_init(&hist);
+            for (uint16_t i = 0; i < g_router.nb_queues; i++) {
+                latency_histogram_merge(&hist, &g_router.rx_ctx[i]->latency_hist[port]);
+            }
+            if (hist.total_count > 0) {
+                p50 = latency_percentile(&hist, 0.50);
+                p99 = latency_percentile(&hist, 0.99);
+                p999 = latency_percentile(&hist, 0.999);
+                p9999 = latency_percentile(&hist, 0.9999);
+                min_ns = hist.min_ns;
+                max_ns = hist.max_ns;
                 break; /* Use first port with data */
             }
         }
@@ -442,6 +722,7 @@ int main(int argc, char **argv) {
             /* Print JSON to stdout */
         printf("{\n");
         printf("  \"duration_sec\": %.3f,\n", duration_sec);
+        printf("  \"queues\": %u,\n", g_router.nb_queues);
         printf("  \"results\": {\n");
         printf("    \"throughput_pps\": %.0f,\n", pps);
         printf("    \"throughput_gbps\": %.3f\n", gbps);
@@ -450,6 +731,7 @@ int main(int argc, char **argv) {
         printf("    \"p50_ns\": %lu,\n", p50);
         printf("    \"p99_ns\": %lu,\n", p99);
         printf("    \"p999_ns\": %lu,\n", p999);
+        printf("    \"p9999_ns\": %lu,\n", p9999);
         printf("    \"min_ns\": %lu,\n", min_ns);
         printf("    \"max_ns\": %lu\n", max_ns);
         printf("  }\n");
@@ -462,7 +744,7 @@ int main(int argc, char **argv) {
     } else {
         /* Normal mode: just print final stats */
         log_msg(LOG_INFO, "Final statistics:");
-        print_stats(&g_router.rx_ctx);
+        print_stats();
     }
 
     /* Stop and close ports */
@@ -481,8 +763,9 @@ int main(int argc, char **argv) {
         rte_eth_dev_close(port_id);
     }
 
+    free_state();
     rte_eal_cleanup();
 
     log_msg(LOG_INFO, "Router stopped cleanly");
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
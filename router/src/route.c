@@ -0,0 +1,346 @@
+#include "route.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#define MAX_LINE 512
+
+int route_table_init(route_table_t *rt) {
+    if (!rt) return -1;
+
+    memset(rt, 0, sizeof(*rt));
+    if (lpm4_init(&rt->lpm4, ROUTE_LPM4_GROUPS) != 0) return -1;
+    if (lpm6_init(&rt->lpm6, ROUTE_LPM6_GROUPS) != 0) {
+        lpm_destroy(&rt->lpm4);
+        return -1;
+    }
+    if (arp_table_init(&rt->arp, ROUTE_NEIGH_ENTRIES) != 0) {
+        lpm_destroy(&rt->lpm4);
+        lpm_destroy(&rt->lpm6);
+        return -1;
+    }
+    if (ndp_table_init(&rt->ndp, ROUTE_NEIGH_ENTRIES) != 0) {
+        arp_table_destroy(&rt->arp);
+        lpm_destroy(&rt->lpm4);
+        lpm_destroy(&rt->lpm6);
+        return -1;
+    }
+    return 0;
+}
+
+void route_table_destroy(route_table_t *rt) {
+    if (!rt) return;
+    lpm_destroy(&rt->lpm4);
+    lpm_destroy(&rt->lpm6);
+    arp_table_destroy(&rt->arp);
+    ndp_table_destroy(&rt->ndp);
+}
+
+/* Index of the next hop through `port` and `gateway`, added if new; -1 if full. */
+static int nexthop_index(route_table_t *rt, uint8_t ip_ver, uint16_t port,
+                         const ip_addr_t *gateway) {
+    route_nexthop_t nh;
+    memset(&nh, 0, sizeof(nh));
+    nh.port = port;
+    nh.ip_ver = ip_ver;
+    nh.connected = gateway == NULL;
+    if (gateway) nh.gateway = *gateway;
+
+    for (uint32_t i = 0; i < rt->nb_nexthops; i++) {
+        if (memcmp(&rt->nexthops[i], &nh, sizeof(nh)) == 0) return (int)i;
+    }
+    if (rt->nb_nexthops == ROUTE_MAX_NEXTHOPS) return -1;
+
+    rt->nexthops[rt->nb_nexthops] = nh;
+    return (int)rt->nb_nexthops++;
+}
+
+int route_table_add(route_table_t *rt, uint8_t ip_ver, const ip_addr_t *prefix, uint8_t depth,
+                    uint16_t port, const ip_addr_t *gateway) {
+    if (!rt || !prefix || (ip_ver != 4 && ip_ver != 6)) return -1;
+
+    int nh = nexthop_index(rt, ip_ver, port, gateway);
+    if (nh < 0) return -1;
+
+    int ret = ip_ver == 4 ? lpm4_add(&rt->lpm4, prefix->v4, depth, (uint32_t)nh)
+                          : lpm6_add(&rt->lpm6, prefix->v6, depth, (uint32_t)nh);
+    if (ret == 0) rt->nb_routes++;
+    return ret;
+}
+
+static char *strip(char *s) {
+    while (*s && isspace((unsigned char)*s)) {
+        s++;
+    }
+
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)*(end - 1))) {
+        end--;
+    }
+
+    *end = '\0';
+    return s;
+}
+
+/*
+    Parse an IPv4 or IPv6 address (IPv4 in host byte order).
+        Returns the family (4 or 6), 0 on error.
+*/
+static uint8_t parse_ip(const char *str, ip_addr_t *ip) {
+    struct in_addr addr4;
+    struct in6_addr addr6;
+
+    memset(ip, 0, sizeof(*ip));
+    if (inet_pton(AF_INET, str, &addr4) == 1) {
+        ip->v4 = ntohl(addr4.s_addr);
+        return 4;
+    }
+    if (inet_pton(AF_INET6, str, &addr6) == 1) {
+        memcpy(ip->v6, addr6.s6_addr, 16);
+        return 6;
+    }
+    return 0;
+}
+
+/*
+    Parse "addr/len" (a host route without "/len").
+        Returns the family (4 or 6), 0 on error.
+*/
+static uint8_t parse_prefix(const char *str, ip_addr_t *ip, uint8_t *depth) {
+    char buf[INET6_ADDRSTRLEN + 4];
+    strncpy(buf, str, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    long len = -1;
+    char *slash = strchr(buf, '/');
+    if (slash) {
+        *slash = '\0';
+        errno = 0;
+        char *end = NULL;
+        len = strtol(slash + 1, &end, 10);
+        if (errno != 0 || end == slash + 1 || *end != '\0' || len < 0) return 0;
+    }
+
+    uint8_t ver = parse_ip(buf, ip);
+    long max = ver == 4 ? 32 : 128;
+    if (ver == 0 || len > max) return 0;
+
+    *depth = (uint8_t)(len < 0 ? max : len);
+    return ver;
+}
+
+static int parse_port(const char *val, uint16_t nb_ports, uint16_t *port) {
+    errno = 0;
+    char *end = NULL;
+    long v = strtol(val, &end, 10);
+    if (errno != 0 || end == val || *end != '\0' || v < 0 || v >= nb_ports) return -1;
+    *port = (uint16_t)v;
+    return 0;
+}
+
+typedef enum { SECTION_NONE, SECTION_ROUTE, SECTION_ADDRESS } section_t;
+
+typedef struct {
+    section_t section;
+    bool has_dst, has_port, has_via, has_ip;
+    uint8_t ver, via_ver, ip_ver;
+    ip_addr_t dst, via, ip;
+    uint8_t depth;
+    uint16_t port;
+} route_entry_t;
+
+/*
+    Flush the section just read into the table.
+        Returns 0 on success, -1 on error.
+*/
+static int flush_section(route_entry_t *e, route_table_t *rt, int line_num) {
+    section_t section = e->section;
+    e->section = SECTION_NONE;
+
+    if (section == SECTION_ROUTE) {
+        if (!e->has_dst || !e->has_port) {
+            log_msg(LOG_ERROR, "routes:%d: route needs dst and port", line_num);
+            return -1;
+        }
+        if (e->has_via && e->via_ver != e->ver) {
+            log_msg(LOG_ERROR, "routes:%d: gateway and dst must be the same family", line_num);
+            return -1;
+        }
+        if (route_table_add(rt, e->ver, &e->dst, e->depth, e->port,
+                            e->has_via ? &e->via : NULL) != 0) {
+            log_msg(LOG_ERROR, "routes:%d: failed to add route (table may be full)", line_num);
+            return -1;
+        }
+    } else if (section == SECTION_ADDRESS) {
+        if (!e->has_ip || !e->has_port || e->ip_ver != 4) {
+            log_msg(LOG_ERROR, "routes:%d: address needs port and an IPv4 ip", line_num);
+            return -1;
+        }
+        rt->port_ip4[e->port] = e->ip.v4;
+    }
+    return 0;
+}
+
+int route_config_load(const char *path, route_table_t *rt, uint16_t nb_ports) {
+    if (!path || !rt || nb_ports > ROUTE_MAX_PORTS) return -1;
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        log_msg(LOG_ERROR, "Unable to open routes file: %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    char line[MAX_LINE];
+    int line_num = 0;
+    route_entry_t current;
+    memset(&current, 0, sizeof(current));
+
+    while (fgets(line, MAX_LINE, f)) {
+        line_num++;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        char *s = strip(line);
+
+        /* Skip empty lines and comments. */
+        if (*s == '\0' || *s == '#' || *s == ';') continue;
+
+        /* Section header. */
+        if (*s == '[') {
+            if (flush_section(&current, rt, line_num) != 0) {
+                fclose(f);
+                return -1;
+            }
+
+            memset(&current, 0, sizeof(current));
+            if (strcmp(s, "[route]") == 0) {
+                current.section = SECTION_ROUTE;
+            } else if (strcmp(s, "[address]") == 0) {
+                current.section = SECTION_ADDRESS;
+            } else {
+                log_msg(LOG_ERROR, "routes:%d: unknown section header: %s", line_num, s);
+                fclose(f);
+                return -1;
+            }
+            continue;
+        }
+
+        if (current.section == SECTION_NONE) {
+            log_msg(LOG_ERROR, "routes:%d: key=value outside a section", line_num);
+            fclose(f);
+            return -1;
+        }
+
+        char *eq = strchr(s, '=');
+        if (!eq) {
+            log_msg(LOG_ERROR, "routes:%d: expected key = value", line_num);
+            fclose(f);
+            return -1;
+        }
+
+        *eq = '\0';
+        char *key = strip(s);
+        char *val = strip(eq + 1);
+        bool ok;
+
+        if (strcmp(key, "port") == 0) {
+            ok = parse_port(val, nb_ports, &current.port) == 0;
+            current.has_port = true;
+        } else if (strcmp(key, "dst") == 0 && current.section == SECTION_ROUTE) {
+            current.ver = parse_prefix(val, &current.dst, &current.depth);
+            ok = current.ver != 0;
+            current.has_dst = true;
+        } else if (strcmp(key, "via") == 0 && current.section == SECTION_ROUTE) {
+            current.via_ver = parse_ip(val, &current.via);
+            ok = current.via_ver != 0;
+            current.has_via = true;
+        } else if (strcmp(key, "ip") == 0 && current.section == SECTION_ADDRESS) {
+            current.ip_ver = parse_ip(val, &current.ip);
+            ok = current.ip_ver != 0;
+            current.has_ip = true;
+        } else {
+            log_msg(LOG_ERROR, "routes:%d: unknown key: %s", line_num, key);
+            fclose(f);
+            return -1;
+        }
+
+        if (!ok) {
+            log_msg(LOG_ERROR, "routes:%d: invalid %s: %s", line_num, key, val);
+            fclose(f);
+            return -1;
+        }
+    }
+
+    int ret = flush_section(&current, rt, line_num);
+    fclose(f);
+    return ret;
+}
+
+bool route_arp_input(route_table_t *rt, uint8_t *frame, uint32_t len, uint16_t port,
+                     const uint8_t port_mac[6]) {
+    if (len < sizeof(struct eth_hdr) + sizeof(struct arp_hdr)) return false;
+
+    struct eth_hdr *eth = (struct eth_hdr *)frame;
+    struct arp_hdr *arp = (struct arp_hdr *)(frame + sizeof(struct eth_hdr));
+
+    if (ntohs(arp->htype) != ARP_HW_ETHERNET || ntohs(arp->ptype) != ETH_TYPE_IPV4 ||
+        arp->hlen != ARP_HW_LEN_ETH || arp->plen != ARP_PROTO_LEN) {
+        return false;
+    }
+
+    /* Learn the sender's MAC/IP mapping */
+    uint32_t spa = ntohl(arp->spa);
+    arp_update(&rt->arp, spa, arp->sha);
+
+    uint32_t local_ip = port < ROUTE_MAX_PORTS ? rt->port_ip4[port] : 0;
+    if (ntohs(arp->op) != ARP_OP_REQUEST || local_ip == 0 || ntohl(arp->tpa) != local_ip) {
+        return false;
+    }
+
+    /* Request for our address: re-use the buffer to build the reply in place */
+    memcpy(eth->dst, eth->src, 6);
+    memcpy(eth->src, port_mac, 6);
+
+    arp->op = htons(ARP_OP_REPLY);
+    memcpy(arp->tha, arp->sha, 6);
+    arp->tpa = arp->spa;
+    memcpy(arp->sha, port_mac, 6);
+    arp->spa = htonl(local_ip);
+    return true;
+}
+
+void route_ndp_input(route_table_t *rt, const uint8_t *frame, uint32_t len) {
+    size_t offset = sizeof(struct eth_hdr) + sizeof(struct ipv6_hdr) + sizeof(struct ndp_na_hdr);
+    if (len < offset) return;
+
+    const struct ipv6_hdr *ip6 = (const struct ipv6_hdr *)(frame + sizeof(struct eth_hdr));
+    const struct ndp_na_hdr *ndp = (const struct ndp_na_hdr *)(frame + sizeof(struct eth_hdr) +
+                                                               sizeof(struct ipv6_hdr));
+    if (ip6->next_header != IP_PROTO_ICMPV6 ||
+        (ndp->type != ICMPV6_NEIGHBOR_SOL && ndp->type != ICMPV6_NEIGHBOR_ADV)) {
+        return;
+    }
+
+    while (offset + 2 <= len) {
+        uint8_t opt_type = frame[offset];
+        uint32_t opt_len = frame[offset + 1] * 8u;
+
+        if (opt_len == 0 || offset + opt_len > len) break;
+
+        /* A solicitation carries the sender's MAC, an advertisement the target's */
+        if (opt_len >= 8 && ndp->type == ICMPV6_NEIGHBOR_SOL && opt_type == NDP_OPT_SRC_LLADDR) {
+            ndp_update(&rt->ndp, ip6->src_addr, &frame[offset + 2]);
+            break;
+        }
+        if (opt_len >= 8 && ndp->type == ICMPV6_NEIGHBOR_ADV && opt_type == NDP_OPT_TGT_LLADDR) {
+            ndp_update(&rt->ndp, ndp->target, &frame[offset + 2]);
+            break;
+        }
+        offset += opt_len;
+    }
+}
@@ -2,12 +2,17 @@
 #include <rte_ethdev.h>
 #include <rte_ether.h>
 #include <rte_mbuf.h>
+#include <arpa/inet.h>
 #include <string.h>
 
 #include "latency.h"
 #include "log.h"
 #include "mac_table.h"
+#include "neigh_cache.h"
+#include "parser.h"
+#include "route.h"
 #include "router.h"
+#include "rule_table.h"
 
 /* Get pointer to the Ethernet header inside an mbuf. */
 static inline struct rte_ether_hdr *eth_hdr(struct rte_mbuf *mbuf) {
@@ -16,10 +21,10 @@ static inline struct rte_ether_hdr *eth_hdr(struct rte_mbuf *mbuf) {
 
 /* Flush TX buffers for a certain port. Qued packets will be sent,
  * unsent ones will be freed. */
-static inline void flush_tx_buffer(uint16_t port_id, tx_buffer_t *buf) {
+static inline void flush_tx_buffer(uint16_t port_id, uint16_t queue_id, tx_buffer_t *buf) {
     if (buf->count == 0) return;
 
-    uint16_t sent = rte_eth_tx_burst(port_id, 0, buf->mbufs, buf->count);
+    uint16_t sent = rte_eth_tx_burst(port_id, queue_id, buf->mbufs, buf->count);
 
     /* If the NIC didn't accept some, free those. */
     for (uint16_t i = sent; i < buf->count; i++)
@@ -28,121 +33,388 @@ static inline void flush_tx_buffer(uint16_t port_id, tx_buffer_t *buf) {
     buf->count = 0;
 }
 
-/* Enqueue a mbuf into TX buffer, flush if it's full. */
-static inline void enqueue_tx(uint16_t port_id, tx_buffer_t *buf, struct rte_mbuf *mbuf) {
-    buf->mbufs[buf->count++] = mbuf;
+/* Append mbufs to a TX buffer, flushing it each time it fills up. */
+static inline void enqueue_tx_bulk(rx_lcore_ctx_t *ctx, uint16_t port_id, struct rte_mbuf **mbufs,
+                                   uint16_t n) {
+    tx_buffer_t *buf = &ctx->tx_buffers[port_id];
 
-    if (buf->count == BURST_SIZE) flush_tx_buffer(port_id, buf);
+    while (n > 0) {
+        uint16_t room = (uint16_t)(BURST_SIZE - buf->count);
+        uint16_t chunk = n < room ? n : room;
+
+        memcpy(&buf->mbufs[buf->count], mbufs, chunk * sizeof(*mbufs));
+        buf->count = (uint16_t)(buf->count + chunk);
+        mbufs += chunk;
+        n = (uint16_t)(n - chunk);
+
+        if (buf->count == BURST_SIZE) flush_tx_buffer(port_id, ctx->queue_id, buf);
+    }
+}
+
+/*
+    Apply the rules (same format and classifier as the Linux engine) to the
+    IP packets of a burst: parse all headers in one pass, then match each.
+    A drop rule frees the packet; fwd rules and no match let it through to
+    the bridge and the router, which pick the egress port.
+        Returns bit i set if mbufs[i] was dropped.
+*/
+static uint64_t acl_burst(rx_lcore_ctx_t *ctx, struct rte_mbuf **mbufs, uint16_t n) {
+    const uint8_t *pkts[BURST_SIZE];
+    uint32_t lens[BURST_SIZE];
+    flow_key_t keys[BURST_SIZE];
+    uint64_t dropped = 0;
+
+    for (uint16_t i = 0; i < n; i++) {
+        pkts[i] = rte_pktmbuf_mtod(mbufs[i], const uint8_t *);
+        lens[i] = mbufs[i]->data_len;
+    }
+
+    uint64_t parsed = parse_flow_key_bulk(pkts, lens, n, keys);
+    for (uint64_t m = parsed; m; m &= m - 1) {
+        unsigned int i = (unsigned int)__builtin_ctzll(m);
+        const rule_t *r = rule_table_match(ctx->rules, &keys[i]);
+
+        if (r && r->action.type == ACT_DROP) {
+            rte_pktmbuf_free(mbufs[i]);
+            ctx->packets_dropped++;
+            ctx->acl_dropped++;
+            dropped |= 1ULL << i;
+        }
+    }
+    return dropped;
 }
 
-/* Forward or flood one mbuf received on ingress_port. */
-static void forward_mbuf(rx_lcore_ctx_t *ctx, struct rte_mbuf *mbuf, uint16_t ingress_port,
-                         uint64_t ingress_tsc) {
+/* Packets of a burst sorted by egress port, in arrival order. */
+typedef struct {
+    struct rte_mbuf *mbufs[NUM_PORTS][BURST_SIZE];
+    uint16_t count[NUM_PORTS];
+} egress_lists_t;
+
+/*
+    Flood one mbuf to all ports except ingress. Every egress port sends the
+    frame unmodified, so they all get the same mbuf, with one reference each:
+    no clone to allocate, so an ARP storm can't drain the pool. The driver
+    frees one reference per transmit. Anything that rewrites the frame per
+    port has to copy it first.
+*/
+static void flood_mbuf(rx_lcore_ctx_t *ctx, struct rte_mbuf *mbuf, uint16_t ingress_port,
+                       egress_lists_t *out) {
+    uint16_t n_egress = 0;
+
+    for (uint16_t p = 0; p < NUM_PORTS; p++) {
+        if (p != ingress_port) {
+            out->mbufs[p][out->count[p]++] = mbuf;
+            n_egress++;
+        }
+    }
+
+    if (n_egress > 1) rte_mbuf_refcnt_update(mbuf, (int16_t)(n_egress - 1));
+
+    ctx->packets_flooded++;
+    ctx->bytes_forwarded += mbuf->pkt_len;
+}
+
+#define LOOKUP_NONE 0xFF    /* Multicast or broadcast destination: flood */
+#define LOOKUP_DROPPED 0xFE /* Runt frame, already freed */
+#define LOOKUP_ROUTED 0xFD  /* Sent to the port's MAC: route_burst() */
+#define LOOKUP_REPLY 0xFC   /* Turned into an ARP reply: back out the ingress port */
+
+typedef enum { L3_BRIDGE, L3_ROUTE, L3_REPLY } l3_verdict_t;
+
+/*
+    What the routing stage makes of a frame, before the bridge sees it.
+    Neighbours are learned from every ARP and NDP frame, those are bridged
+    on unless the ARP request was for the port's own address.
+*/
+static inline l3_verdict_t route_classify(rx_lcore_ctx_t *ctx, struct rte_mbuf *mbuf,
+                                          uint16_t ingress_port) {
     struct rte_ether_hdr *hdr = eth_hdr(mbuf);
-    const uint8_t *src_mac = hdr->src_addr.addr_bytes;
-    const uint8_t *dst_mac = hdr->dst_addr.addr_bytes;
+    uint8_t *frame = rte_pktmbuf_mtod(mbuf, uint8_t *);
+    const uint8_t *port_mac = ctx->port_mac[ingress_port].addr_bytes;
+    uint16_t type = ntohs(hdr->ether_type);
 
-    /* MAC learning of unicast source MACs. */
-    if (mac_is_unicast(src_mac)) {
-        mac_table_insert(&ctx->mac_table, src_mac, ingress_port, ingress_tsc);
+    if (type == ETH_TYPE_ARP) {
+        return route_arp_input(ctx->routes, frame, mbuf->data_len, ingress_port, port_mac)
+                   ? L3_REPLY
+                   : L3_BRIDGE;
     }
 
-    /* Forwarding decision. */
-    bool should_flood = mac_is_broadcast(dst_mac) || !mac_is_unicast(dst_mac);
+    if (type == ETH_TYPE_IPV6) route_ndp_input(ctx->routes, frame, mbuf->data_len);
+
+    if ((type == ETH_TYPE_IPV4 || type == ETH_TYPE_IPV6) &&
+        memcmp(hdr->dst_addr.addr_bytes, port_mac, MAC_ADDR_LEN) == 0) {
+        return L3_ROUTE;
+    }
+    return L3_BRIDGE;
+}
+
+/*
+    MAC of neighbour `ip`: the lcore's neigh_cache first, valid while the
+    ARP/NDP table's sequence is unchanged, the shared table on a miss.
+*/
+static bool neigh_lookup(rx_lcore_ctx_t *ctx, uint8_t ip_ver, const ip_addr_t *ip,
+                         uint8_t mac[6]) {
+    route_table_t *rt = ctx->routes;
+    atomic_uint *seq_ptr = ip_ver == 4 ? &rt->arp.seq : &rt->ndp.seq;
+    uint32_t seq = atomic_load_explicit(seq_ptr, memory_order_acquire);
+
+    if (neigh_cache_get(&ctx->neigh_cache, ip_ver, ip, seq, mac)) return true;
+
+    bool found = ip_ver == 4 ? arp_get_mac(&rt->arp, ip->v4, mac)
+                             : ndp_get_mac(&rt->ndp, ip->v6, mac);
+    if (found) neigh_cache_put(&ctx->neigh_cache, ip_ver, ip, seq, mac);
+    return found;
+}
+
+static inline void drop_routed(rx_lcore_ctx_t *ctx, struct rte_mbuf *mbuf, uint64_t *counter) {
+    rte_pktmbuf_free(mbuf);
+    ctx->packets_dropped++;
+    if (counter) (*counter)++;
+}
+
+/*
+    Send a routed packet to next hop `nh`: resolve the neighbour, decrement
+    the TTL (hop limit), rewrite both MACs. Without a known neighbour the
+    packet is dropped; the neighbour's next ARP/NDP frame resolves it.
+*/
+static void send_routed(rx_lcore_ctx_t *ctx, struct rte_mbuf *mbuf, const route_nexthop_t *nh,
+                        const ip_addr_t *dst, egress_lists_t *out) {
+    uint8_t mac[6];
+    if (!neigh_lookup(ctx, nh->ip_ver, nh->connected ? dst : &nh->gateway, mac)) {
+        drop_routed(ctx, mbuf, &ctx->no_neigh);
+        return;
+    }
+
+    uint8_t *frame = rte_pktmbuf_mtod(mbuf, uint8_t *);
+    if (nh->ip_ver == 4) {
+        ipv4_dec_ttl((struct ipv4_hdr *)(frame + sizeof(struct rte_ether_hdr)));
+    } else {
+        ((struct ipv6_hdr *)(frame + sizeof(struct rte_ether_hdr)))->hop_limit--;
+    }
+
+    struct rte_ether_hdr *hdr = eth_hdr(mbuf);
+    memcpy(hdr->dst_addr.addr_bytes, mac, MAC_ADDR_LEN);
+    memcpy(hdr->src_addr.addr_bytes, ctx->port_mac[nh->port].addr_bytes, MAC_ADDR_LEN);
+
+    out->mbufs[nh->port][out->count[nh->port]++] = mbuf;
+    ctx->packets_forwarded++;
+    ctx->packets_routed++;
+    ctx->bytes_forwarded += mbuf->pkt_len;
+}
+
+/*
+    Route the packets of a burst sent to our MAC, mbufs[idx[0..n-1]]: check
+    the headers and TTL, look every destination of a family up in one bulk
+    LPM call, then send each to its next hop.
+*/
+static void route_burst(rx_lcore_ctx_t *ctx, struct rte_mbuf **mbufs, const uint8_t *idx,
+                        unsigned int n, egress_lists_t *out) {
+    const route_table_t *rt = ctx->routes;
+    uint32_t dst4[BURST_SIZE], nh4[BURST_SIZE];
+    const uint8_t *dst6[BURST_SIZE];
+    uint32_t nh6[BURST_SIZE];
+    struct rte_mbuf *pkt4[BURST_SIZE], *pkt6[BURST_SIZE];
+    unsigned int n4 = 0, n6 = 0;
+
+    for (unsigned int k = 0; k < n; k++) {
+        struct rte_mbuf *mbuf = mbufs[idx[k]];
+        uint8_t *l3 = rte_pktmbuf_mtod(mbuf, uint8_t *) + sizeof(struct rte_ether_hdr);
+        uint32_t l3_len = mbuf->data_len - (uint32_t)sizeof(struct rte_ether_hdr);
+
+        if (ntohs(eth_hdr(mbuf)->ether_type) == ETH_TYPE_IPV4) {
+            const struct ipv4_hdr *ip = (const struct ipv4_hdr *)l3;
+            if (l3_len < sizeof(*ip) || (ip->ver_ihl >> 4) != 4 || ip->ttl <= 1) {
+                drop_routed(ctx, mbuf, NULL);
+                continue;
+            }
+            pkt4[n4] = mbuf;
+            dst4[n4++] = ntohl(ip->dst_ip);
+        } else {
+            const struct ipv6_hdr *ip6 = (const struct ipv6_hdr *)l3;
+            if (l3_len < sizeof(*ip6) || (l3[0] >> 4) != 6 || ip6->hop_limit <= 1) {
+                drop_routed(ctx, mbuf, NULL);
+                continue;
+            }
+            pkt6[n6] = mbuf;
+            dst6[n6++] = ip6->dst_addr;
+        }
+    }
+
+    uint64_t hits4 = n4 > 0 ? lpm4_lookup_bulk(&rt->lpm4, dst4, n4, nh4) : 0;
+    uint64_t hits6 = n6 > 0 ? lpm6_lookup_bulk(&rt->lpm6, dst6, n6, nh6) : 0;
+
+    for (unsigned int k = 0; k < n4; k++) {
+        if (!((hits4 >> k) & 1)) {
+            drop_routed(ctx, pkt4[k], &ctx->no_route);
+            continue;
+        }
+        ip_addr_t dst = {.v4 = dst4[k]};
+        send_routed(ctx, pkt4[k], &rt->nexthops[nh4[k]], &dst, out);
+    }
 
-    uint16_t egress_port = 0;
-    if (!should_flood) {
-        /* Try unicast lookup */
-        if (!mac_table_lookup(&ctx->mac_table, dst_mac, ingress_tsc, &egress_port)) {
-            should_flood = true; /* Unknown dst. */
+    for (unsigned int k = 0; k < n6; k++) {
+        if (!((hits6 >> k) & 1)) {
+            drop_routed(ctx, pkt6[k], &ctx->no_route);
+            continue;
         }
+        ip_addr_t dst;
+        memcpy(dst.v6, dst6[k], 16);
+        send_routed(ctx, pkt6[k], &rt->nexthops[nh6[k]], &dst, out);
+    }
+}
+
+/*
+    Forward or flood a burst received on ingress_port, in stages over the
+    whole burst so the cache misses of different packets overlap:
+        1. prefetch every Ethernet header (written by the NIC, not in L1),
+           then drop what the rules drop, if there are rules
+        2. learn all unicast sources in one mac_table_insert_bulk()
+        3. look all unicast destinations up in one mac_table_lookup_bulk()
+        4. sort the packets (and flood copies) by egress port
+        5. route the packets sent to our MAC, if there are routes
+        6. append each port's list to its TX buffer, with one egress TSC
+*/
+static void forward_burst(rx_lcore_ctx_t *ctx, struct rte_mbuf **mbufs, uint16_t n,
+                          uint16_t ingress_port, uint64_t ingress_tsc) {
+    const uint8_t *src_macs[BURST_SIZE];
+    const uint8_t *dst_macs[BURST_SIZE];
+    uint16_t egress_ports[BURST_SIZE];
+    uint8_t lookup_of[BURST_SIZE]; /* Index into dst_macs, or LOOKUP_* */
+    uint8_t routed[BURST_SIZE];    /* Index into mbufs */
+    unsigned int nb_src = 0, nb_lookup = 0, nb_routed = 0;
+    egress_lists_t out;
+
+    for (uint16_t i = 0; i < n; i++) {
+        __builtin_prefetch(rte_pktmbuf_mtod(mbufs[i], void *));
     }
 
-    if (!should_flood) {
-        if (egress_port == ingress_port) {
+    uint64_t denied = ctx->rules ? acl_burst(ctx, mbufs, n) : 0;
+
+    for (uint16_t i = 0; i < n; i++) {
+        struct rte_mbuf *mbuf = mbufs[i];
+
+        if ((denied >> i) & 1) {
+            lookup_of[i] = LOOKUP_DROPPED; /* Already freed */
+            continue;
+        }
+
+        if (mbuf->data_len < sizeof(struct rte_ether_hdr)) {
             rte_pktmbuf_free(mbuf);
             ctx->packets_dropped++;
-        } else {
-            uint64_t egress_tsc = rdtsc();
-            latency_record(&ctx->latency_hist[ingress_port], egress_tsc - ingress_tsc,
-                           ctx->cycles_per_ns);
-            enqueue_tx(egress_port, &ctx->tx_buffers[egress_port], mbuf);
-            ctx->packets_forwarded++;
-            ctx->bytes_forwarded += mbuf->pkt_len;
+            lookup_of[i] = LOOKUP_DROPPED;
+            continue;
         }
-    } else { /* Flood to all ports except ingress. */
-        struct rte_mbuf *copies[NUM_PORTS];
-        uint16_t egress_ports[NUM_PORTS];
-        uint16_t n_egress = 0;
 
-        for (uint16_t p = 0; p < NUM_PORTS; p++) {
-            if (p != ingress_port) egress_ports[n_egress++] = p;
+        struct rte_ether_hdr *hdr = eth_hdr(mbuf);
+        const uint8_t *src_mac = hdr->src_addr.addr_bytes;
+        const uint8_t *dst_mac = hdr->dst_addr.addr_bytes;
+
+        /* MAC learning of unicast source MACs, once per run of the same sender. */
+        if (mac_is_unicast(src_mac) &&
+            (nb_src == 0 || memcmp(src_macs[nb_src - 1], src_mac, MAC_ADDR_LEN) != 0)) {
+            src_macs[nb_src++] = src_mac;
         }
 
-        /* Allocate colones for the egress port. */
-        bool alloc_ok = true;
-        copies[0] = mbuf; /* First egress gets the original pointer. */
-
-        for (uint16_t i = 1; i < n_egress; i++) {
-            copies[i] = rte_pktmbuf_clone(mbuf, mbuf->pool);
-            if (copies[i] == NULL) {
-                log_msg(LOG_WARN, "Pool exhausted during flood clone");
-                ctx->pool_exhaustion_count++;
-                log_msg(LOG_WARN, "Pool exhaustion count: %lu", ctx->pool_exhaustion_count);
-
-                rte_pktmbuf_free(mbuf);
-                for (uint16_t j = 1; j < i; j++)
-                    rte_pktmbuf_free(copies[j]);
-                alloc_ok = false;
-                break;
+        if (ctx->routes) {
+            l3_verdict_t v = route_classify(ctx, mbuf, ingress_port);
+            if (v == L3_REPLY) {
+                lookup_of[i] = LOOKUP_REPLY;
+                continue;
+            }
+            if (v == L3_ROUTE) {
+                lookup_of[i] = LOOKUP_ROUTED;
+                routed[nb_routed++] = (uint8_t)i;
+                continue;
             }
         }
 
-        if (alloc_ok) {
-            for (uint16_t i = 0; i < n_egress; i++) {
-                uint64_t egress_tsc = rdtsc();
-                latency_record(&ctx->latency_hist[ingress_port], egress_tsc - ingress_tsc,
-                               ctx->cycles_per_ns);
-                enqueue_tx(egress_ports[i], &ctx->tx_buffers[egress_ports[i]], copies[i]);
-            }
-            ctx->packets_flooded++;
+        if (mac_is_unicast(dst_mac)) {
+            lookup_of[i] = (uint8_t)nb_lookup;
+            dst_macs[nb_lookup++] = dst_mac;
+        } else {
+            lookup_of[i] = LOOKUP_NONE;
+        }
+    }
+
+    /* Learn first: a reply later in the burst already finds its sender. */
+    if (nb_src > 0) {
+        mac_table_insert_bulk(ctx->mac_table, src_macs, nb_src, ingress_port, ingress_tsc);
+    }
+
+    uint64_t hits = 0;
+    if (nb_lookup > 0) {
+        hits = mac_table_lookup_bulk(ctx->mac_table, dst_macs, nb_lookup, ingress_tsc,
+                                     egress_ports);
+    }
+
+    /* Forwarding decision. */
+    memset(out.count, 0, sizeof(out.count));
+    for (uint16_t i = 0; i < n; i++) {
+        uint8_t k = lookup_of[i];
+        if (k == LOOKUP_DROPPED || k == LOOKUP_ROUTED) continue;
+
+        struct rte_mbuf *mbuf = mbufs[i];
+        if (k == LOOKUP_REPLY) {
+            out.mbufs[ingress_port][out.count[ingress_port]++] = mbuf;
+        } else if (k == LOOKUP_NONE || !((hits >> k) & 1)) {
+            flood_mbuf(ctx, mbuf, ingress_port, &out); /* Unknown dst. */
+        } else if (egress_ports[k] == ingress_port) {
+            rte_pktmbuf_free(mbuf);
+            ctx->packets_dropped++;
+        } else {
+            uint16_t p = egress_ports[k];
+            out.mbufs[p][out.count[p]++] = mbuf;
+            ctx->packets_forwarded++;
             ctx->bytes_forwarded += mbuf->pkt_len;
         }
     }
+
+    if (nb_routed > 0) route_burst(ctx, mbufs, routed, nb_routed, &out);
+
+    /* The burst leaves together: one TSC read (and its lfence) for all of it. */
+    uint64_t egress_tsc = rdtsc();
+    uint64_t latency_ns = (uint64_t)((double)(egress_tsc - ingress_tsc) * ctx->ns_per_cycle);
+    for (uint16_t p = 0; p < NUM_PORTS; p++) {
+        if (out.count[p] > 0) {
+            latency_record_ns(&ctx->latency_hist[ingress_port], latency_ns, out.count[p]);
+            enqueue_tx_bulk(ctx, p, out.mbufs[p], out.count[p]);
+        }
+    }
 }
 
 int rx_lcore_main(void *arg) {
     rx_lcore_ctx_t *ctx = (rx_lcore_ctx_t *)arg;
+    uint16_t queue = ctx->queue_id;
 
-    log_msg(LOG_INFO, "RX lcore %u started", rte_lcore_id());
+    log_msg(LOG_INFO, "RX lcore %u started (queue %u)", rte_lcore_id(), queue);
 
     struct rte_mbuf *rx_mbufs[BURST_SIZE];
 
     while (!ctx->stop) {
         for (uint16_t port = 0; port < NUM_PORTS; port++) {
-            uint16_t nb_rx = rte_eth_rx_burst(port, 0, rx_mbufs, BURST_SIZE);
+            uint16_t nb_rx = rte_eth_rx_burst(port, queue, rx_mbufs, BURST_SIZE);
 
             if (nb_rx > 0) {
                 uint64_t ingress_tsc = rdtsc();
-
-                for (uint16_t i = 0; i < nb_rx; i++) {
-                    forward_mbuf(ctx, rx_mbufs[i], port, ingress_tsc);
-                }
+                forward_burst(ctx, rx_mbufs, nb_rx, port, ingress_tsc);
             }
         }
 
         /* Flush happens at every pass */
         for (uint16_t p = 0; p < NUM_PORTS; p++) {
-            flush_tx_buffer(p, &ctx->tx_buffers[p]);
+            flush_tx_buffer(p, queue, &ctx->tx_buffers[p]);
         }
+
+        /* Then a slice of aging, with the packets already on their way */
+        mac_table_sweep(ctx->mac_table, &ctx->mac_sweep, rdtsc());
     }
 
     log_msg(LOG_INFO, "RX lcore %u stopping, will flush TX buffers...", rte_lcore_id());
 
     for (uint16_t p = 0; p < NUM_PORTS; p++) {
-        flush_tx_buffer(p, &ctx->tx_buffers[p]);
+        flush_tx_buffer(p, queue, &ctx->tx_buffers[p]);
     }
 
     log_msg(LOG_INFO, "RX lcore %u stopped", rte_lcore_id());
     return 0;
-}
\ No newline at end of file
+}
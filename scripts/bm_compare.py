@@ -18,8 +18,9 @@ def main():
     parser = argparse.ArgumentParser(description="Compare benchmark results")
     parser.add_argument("baseline", help="Baseline JSON file (from main)")
     parser.add_argument("current", help="Current JSON file (from pull request)")
-    parser.add_argument("--metric", required=True,
-                        help="Dot seperated path to metric (e.g. results.consumer.throughput_mpps)")
+    parser.add_argument("--metric", required=True, action="append",
+                        help="Dot seperated path to metric (e.g. results.consumer.throughput_mpps), "
+                             "repeat it to gate several points of a sweep")
     parser.add_argument("--threshold", type=float, default=10.0,
                         help="Max allowed regression in percent (default: 10)")
     args = parser.parse_args()
@@ -34,28 +35,39 @@ def main():
     with open(args.current) as f:
         current = json.load(f)
 
-    base_val = extract_metric(baseline, args.metric)
-    curr_val = extract_metric(current, args.metric)
+    regressed = []
+    for metric in args.metric:
+        try:
+            base_val = extract_metric(baseline, metric)
+        except KeyError:
+            # A sweep point the baseline did not run yet.
+            print(f"Metric '{metric}' not in baseline, skipping.\n")
+            continue
+        curr_val = extract_metric(current, metric)
 
-    if base_val == 0:
-        print(f"Baseline metric '{args.metric} is 0, skipping.")
-        sys.exit(0)
+        if base_val == 0:
+            print(f"Baseline metric '{metric} is 0, skipping.\n")
+            continue
+
+        change_pct = ((curr_val - base_val) / base_val) * 100.0
 
-    change_pct = ((curr_val - base_val) / base_val) * 100.0
+        print(f"Metric:    {metric}")
+        print(f"Baseline:  {base_val:.4f}")
+        print(f"Current:   {curr_val:.4f}")
+        print(f"Change:    {change_pct:+.2f}%")
+        print(f"Threshold: -{args.threshold:.1f}%\n")
 
-    print(f"Metric:    {args.metric}")
-    print(f"Baseline:  {base_val:.4f}")
-    print(f"Current:   {curr_val:.4f}")
-    print(f"Change:    {change_pct:+.2f}%")
-    print(f"Threshold: -{args.threshold:.1f}%")
+        if change_pct < -args.threshold:
+            regressed.append((metric, change_pct))
 
-    if change_pct < -args.threshold:
-        print(f"\nFAIL: Performance regressed by {abs(change_pct):.2f}% (limit: {args.threshold}%)")
+    if regressed:
+        for metric, change_pct in regressed:
+            print(f"FAIL: {metric} regressed by {abs(change_pct):.2f}% (limit: {args.threshold}%)")
         # Don't fail, as running this on the Github Runners is not reliable.
         # sys.exit(1)
         sys.exit(0)
     else:
-        print("\nPASS")
+        print("PASS")
         sys.exit(0)
 
 if __name__ == "__main__":
@@ -4,8 +4,12 @@
 
 #include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#define MAX_NUMA_NODES 64
+
 int affinity_get_num_cores(void) {
     long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
     if (nprocs < 1) {
@@ -120,4 +124,92 @@ void affinity_print(pthread_t thread) {
     }
 
     log_msg(LOG_INFO, "Thread affinity: cores {%s} (%d total)", cores_str, count);
-}
\ No newline at end of file
+}
+
+/* Decimal core number at `*s`, advancing past it. */
+static int parse_core(const char **s, int *out) {
+    if (**s < '0' || **s > '9') return -1;
+    long v = 0;
+    while (**s >= '0' && **s <= '9') {
+        v = v * 10 + (**s - '0');
+        if (v >= CPU_SETSIZE) return -1;
+        (*s)++;
+    }
+    *out = (int)v;
+    return 0;
+}
+
+int affinity_parse_core_list(const char *s, int *cores, int max) {
+    if (!s || !cores || max <= 0) return -1;
+
+    cpu_set_t seen;
+    CPU_ZERO(&seen);
+    int n = 0;
+
+    while (1) {
+        int first;
+        int last;
+        if (parse_core(&s, &first) != 0) return -1;
+        last = first;
+        if (*s == '-') {
+            s++;
+            if (parse_core(&s, &last) != 0 || last < first) return -1;
+        }
+
+        for (int c = first; c <= last; c++) {
+            if (n == max || CPU_ISSET((size_t)c, &seen)) return -1;
+            CPU_SET((size_t)c, &seen);
+            cores[n++] = c;
+        }
+
+        if (*s == '\0') break;
+        if (*s != ',') return -1;
+        s++;
+    }
+    return n;
+}
+
+int affinity_numa_nodes(void) {
+    /* Nodes are numbered densely: count nodeN directories until one is missing. */
+    char path[64];
+    int n = 0;
+    while (n < MAX_NUMA_NODES) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", n);
+        if (access(path, F_OK) != 0) break;
+        n++;
+    }
+    return n > 0 ? n : 1;
+}
+
+int affinity_core_node(int core_id) {
+    /* Each node directory holds a cpuN link for every CPU of the node. */
+    char path[96];
+    int nodes = affinity_numa_nodes();
+    for (int n = 0; n < nodes; n++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpu%d", n, core_id);
+        if (access(path, F_OK) == 0) return n;
+    }
+    return 0;
+}
+
+int affinity_iface_node(const char *iface) {
+    if (!iface) return -1;
+
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", iface);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    int node = -1;
+    if (fscanf(f, "%d", &node) != 1) node = -1;
+    fclose(f);
+    return node;
+}
+
+int affinity_self_node(void) {
+    /* getcpu() returns the node directly; glibc only wraps it since 2.29. */
+    unsigned int cpu = 0;
+    unsigned int node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) return 0;
+    return (int)node;
+}
@@ -4,6 +4,29 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* Seqlock helpers, see arp_table.h. */
+static inline void write_begin(arp_table_t *t) {
+    atomic_fetch_add_explicit(&t->seq, 1, memory_order_relaxed); /* odd */
+    atomic_thread_fence(memory_order_release); /* ... before any entry store */
+}
+
+static inline void write_end(arp_table_t *t) {
+    atomic_fetch_add_explicit(&t->seq, 1, memory_order_release); /* even */
+}
+
+static inline unsigned read_begin(arp_table_t *t) {
+    unsigned s;
+    /* Odd: a writer is in the middle of an update, which takes microseconds. */
+    while ((s = atomic_load_explicit(&t->seq, memory_order_acquire)) & 1u) {
+    }
+    return s;
+}
+
+static inline bool read_retry(arp_table_t *t, unsigned s) {
+    atomic_thread_fence(memory_order_acquire); /* Entry loads complete first */
+    return atomic_load_explicit(&t->seq, memory_order_relaxed) != s;
+}
+
 int arp_table_init(arp_table_t *t, size_t capacity) {
     if (!t || capacity == 0 || (capacity & (capacity - 1)) != 0) return -1;
 
@@ -11,72 +34,103 @@ int arp_table_init(arp_table_t *t, size_t capacity) {
     if (!t->entries) return -1;
 
     t->capacity = capacity;
-    pthread_rwlock_init(&t->lock, NULL);
+    atomic_init(&t->seq, 2);
+    pthread_mutex_init(&t->write_lock, NULL);
     return 0;
 }
 
 void arp_table_destroy(arp_table_t *t) {
     if (!t) return;
-    pthread_rwlock_destroy(&t->lock);
+    pthread_mutex_destroy(&t->write_lock);
     free(t->entries);
     t->entries = NULL;
     t->capacity = 0;
 }
 
-void arp_update(arp_table_t *t, uint32_t ip, const uint8_t *mac) {
-    if (!t || !mac) return;
-
+/* Insert or refresh one entry; opens the write section (once) if anything changes. */
+static void arp_upsert(arp_table_t *t, uint32_t ip, const uint8_t *mac, time_t now,
+                       bool *writing) {
     size_t idx = ip & (t->capacity - 1);
 
-    pthread_rwlock_wrlock(&t->lock);
-
     for (size_t i = 0; i < t->capacity; i++) {
         size_t curr = (idx + i) & (t->capacity - 1);
 
         if (!t->entries[curr].valid) {
             /* Empty slot, insert here. */
+            if (!*writing) write_begin(t);
+            *writing = true;
             t->entries[curr].valid = true;
             t->entries[curr].ip = ip;
             memcpy(t->entries[curr].mac, mac, 6);
-            t->entries[curr].update_at = time(NULL);
-            break;
+            t->entries[curr].update_at = now;
+            return;
         }
 
         if (t->entries[curr].ip == ip) {
             /* Existing entry, update it. */
-            memcpy(t->entries[curr].mac, mac, 6);
-            t->entries[curr].update_at = time(NULL);
-            break;
+            if (memcmp(t->entries[curr].mac, mac, 6) != 0) {
+                if (!*writing) write_begin(t);
+                *writing = true;
+                memcpy(t->entries[curr].mac, mac, 6);
+            }
+            t->entries[curr].update_at = now;
+            return;
         }
     }
-    pthread_rwlock_unlock(&t->lock);
+}
+
+void arp_update(arp_table_t *t, uint32_t ip, const uint8_t *mac) {
+    if (!mac) return;
+    arp_update_bulk(t, &ip, (const uint8_t(*)[6])mac, 1);
+}
+
+void arp_update_bulk(arp_table_t *t, const uint32_t *ips, const uint8_t (*macs)[6], size_t n) {
+    if (!t || !ips || !macs || n == 0) return;
+
+    time_t now = time(NULL);
+    bool writing = false;
+
+    pthread_mutex_lock(&t->write_lock);
+    for (size_t i = 0; i < n; i++) {
+        arp_upsert(t, ips[i], macs[i], now, &writing);
+    }
+    if (writing) write_end(t);
+    pthread_mutex_unlock(&t->write_lock);
 }
 
 bool arp_get_mac(arp_table_t *t, uint32_t ip, uint8_t *out_mac) {
     if (!t || !out_mac) return false;
 
     size_t idx = ip & (t->capacity - 1);
+    bool found;
+    unsigned seq;
+
+    do {
+        seq = read_begin(t);
+        found = false;
+
+        for (size_t i = 0; i < t->capacity; i++) {
+            size_t curr = (idx + i) & (t->capacity - 1);
+            const arp_entry_t *e = &t->entries[curr];
+
+            /* Values read here may be torn by a concurrent writer; read_retry()
+             * discards them in that case, so only use them after it passes. */
+            if (e->valid && e->ip == ip) {
+                memcpy(out_mac, e->mac, 6);
+                found = true;
+                break;
+            }
 
-    pthread_rwlock_rdlock(&t->lock);
-    for (size_t i = 0; i < t->capacity; i++) {
-        size_t curr = (idx + i) & (t->capacity - 1);
-
-        if (t->entries[curr].valid && t->entries[curr].ip == ip) {
-            memcpy(out_mac, t->entries[curr].mac, 6);
-            pthread_rwlock_unlock(&t->lock);
-            return true;
+            /*
+                This would have been a valid spot for the entry, but it is not here.
+                Then, it will not be further in the hash map either: there are no
+                tombstones, expiry shifts the rest of the cluster back instead.
+            */
+            if (!e->valid) break;
         }
+    } while (read_retry(t, seq));
 
-        /*
-            This would have been a valid spot for the entry, but it is not here.
-            Then, it will not be further in the hash map either, because the current
-            implementation of ARP table does not support deletion -> no tombstones.
-        */
-        if (!t->entries[curr].valid) break;
-    }
-    pthread_rwlock_unlock(&t->lock);
-
-    return false;
+    return found;
 }
 
 size_t arp_expire(arp_table_t *t, time_t now) {
@@ -84,7 +138,7 @@ size_t arp_expire(arp_table_t *t, time_t now) {
 
     size_t evicted = 0;
 
-    pthread_rwlock_wrlock(&t->lock);
+    pthread_mutex_lock(&t->write_lock);
 
     for (size_t i = 0; i < t->capacity; i++) {
         if (!t->entries[i].valid) continue;
@@ -98,6 +152,9 @@ size_t arp_expire(arp_table_t *t, time_t now) {
          * unreachable. We fix this by shifting each subsequent entry in the same
          * cluster back into its natural position.
         */
+        /* One write section for the whole sweep, opened at the first eviction:
+         * the shifts below move entries that readers may be probing for. */
+        if (evicted == 0) write_begin(t);
         t->entries[i].valid = false;
         evicted++;
 
@@ -132,6 +189,7 @@ size_t arp_expire(arp_table_t *t, time_t now) {
         }
     }
 
-    pthread_rwlock_unlock(&t->lock);
+    if (evicted) write_end(t);
+    pthread_mutex_unlock(&t->write_lock);
     return evicted;
 }
\ No newline at end of file
@@ -94,86 +94,6 @@ void benchmark_get_system_info(system_info_t *info) {
     info->numa_nodes = numa_count > 0 ? numa_count : 1;
 }
 
-/*
-    JSON Output helpers.
-*/
-
-void json_init(json_ctx_t *ctx, FILE *out) {
-    ctx->out = out;
-    ctx->indent_level = 0;
-    ctx->needs_comma = false;
-}
-
-static void json_print_indent(json_ctx_t *ctx) {
-    for (int i = 0; i < ctx->indent_level; i++) {
-        fprintf(ctx->out, "    ");
-    }
-}
-
-void json_begin_object(json_ctx_t *ctx) {
-    if (ctx->needs_comma) {
-        fprintf(ctx->out, ",\n");
-    }
-    json_print_indent(ctx);
-    fprintf(ctx->out, "{\n");
-    ctx->indent_level++;
-    ctx->needs_comma = false;
-}
-
-void json_end_object(json_ctx_t *ctx) {
-    fprintf(ctx->out, "\n");
-    ctx->indent_level--;
-    json_print_indent(ctx);
-    fprintf(ctx->out, "}");
-    ctx->needs_comma = true;
-}
-
-void json_key_string(json_ctx_t *ctx, const char *key, const char *value) {
-    if (ctx->needs_comma) {
-        fprintf(ctx->out, ",\n");
-    }
-    json_print_indent(ctx);
-    fprintf(ctx->out, "\"%s\": \"%s\"", key, value);
-    ctx->needs_comma = true;
-}
-
-void json_key_int(json_ctx_t *ctx, const char *key, int64_t value) {
-    if (ctx->needs_comma) {
-        fprintf(ctx->out, ",\n");
-    }
-    json_print_indent(ctx);
-    fprintf(ctx->out, "\"%s\": %ld", key, (long)value);
-    ctx->needs_comma = true;
-}
-
-void json_key_double(json_ctx_t *ctx, const char *key, double value) {
-    if (ctx->needs_comma) {
-        fprintf(ctx->out, ",\n");
-    }
-    json_print_indent(ctx);
-    fprintf(ctx->out, "\"%s\": %.6f", key, value);
-    ctx->needs_comma = true;
-}
-
-void json_key_bool(json_ctx_t *ctx, const char *key, bool value) {
-    if (ctx->needs_comma) {
-        fprintf(ctx->out, ",\n");
-    }
-    json_print_indent(ctx);
-    fprintf(ctx->out, "\"%s\": %s", key, value ? "true" : "false");
-    ctx->needs_comma = true;
-}
-
-void json_begin_nested_object(json_ctx_t *ctx, const char *key) {
-    if (ctx->needs_comma) {
-        fprintf(ctx->out, ",\n");
-    }
-    json_print_indent(ctx);
-    fprintf(ctx->out, "\"%s\": {\n", key);
-    ctx->indent_level++;
-    ctx->needs_comma = false;
-}
-
 /*
     Timing related.
 */
@@ -243,6 +163,31 @@ int benchmark_parse_int(const char *option_name) {
     return (int)val;
 }
 
+size_t benchmark_parse_list(const char *option_name, size_t *out, size_t max) {
+    size_t n = 0;
+    const char *p = optarg;
+
+    while (*p != '\0') {
+        char *endptr;
+        errno = 0;
+        unsigned long val = strtoul(p, &endptr, 10);
+        if (errno == ERANGE || endptr == p || (*endptr != ',' && *endptr != '\0') || val == 0 ||
+            n == max) {
+            fprintf(stderr, "Error: Invalid value for --%s: '%s' (up to %zu values > 0)\n",
+                    option_name, optarg, max);
+            exit(EXIT_FAILURE);
+        }
+        out[n++] = (size_t)val;
+        p = *endptr == ',' ? endptr + 1 : endptr;
+    }
+
+    if (n == 0) {
+        fprintf(stderr, "Error: --%s needs at least one value\n", option_name);
+        exit(EXIT_FAILURE);
+    }
+    return n;
+}
+
 double benchmark_parse_double(const char *option_name) {
     char *endptr;
     errno = 0;
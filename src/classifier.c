@@ -0,0 +1,453 @@
+#include "classifier.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CLS_MIN_SLOTS 8
+
+/* Field layout of key word 4. */
+#define CLS_SPORT_SHIFT 0
+#define CLS_DPORT_SHIFT 16
+#define CLS_PROTO_SHIFT 32
+#define CLS_VER_SHIFT 40
+
+/* Temporary (key, rule) list of one tuple while building. */
+typedef struct {
+    cls_entry_t *items;
+    size_t count;
+    size_t cap;
+} cls_build_list_t;
+
+static inline uint32_t cls_hash(const uint64_t w[CLS_KEY_WORDS]) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < CLS_KEY_WORDS; i++) {
+        h ^= w[i];
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+    }
+    return (uint32_t)h;
+}
+
+static inline bool cls_key_eq(const uint64_t a[CLS_KEY_WORDS], const uint64_t b[CLS_KEY_WORDS]) {
+    /* Non short-circuit on purpose: 5 independent compares, one branch. */
+    return ((a[0] ^ b[0]) | (a[1] ^ b[1]) | (a[2] ^ b[2]) | (a[3] ^ b[3]) | (a[4] ^ b[4])) == 0;
+}
+
+/*
+    Build mask and masked key of rule `r` as applied to `ip_ver` packets.
+    Mirrors match_rule() in rule_table.c: a zero port/proto is a wildcard, and a
+    rule with ip_ver 0 uses the v4 view of its masks for IPv4 packets and the v6
+    view for IPv6 packets.
+*/
+static void rule_to_key(const rule_t *r, uint8_t ip_ver, uint64_t mask[CLS_KEY_WORDS],
+                        uint64_t key[CLS_KEY_WORDS]) {
+    uint64_t ip[4];
+
+    if (ip_ver == 4) {
+        mask[0] = r->src_mask.v4;
+        mask[1] = 0;
+        mask[2] = r->dst_mask.v4;
+        mask[3] = 0;
+        ip[0] = r->src_ip.v4;
+        ip[1] = 0;
+        ip[2] = r->dst_ip.v4;
+        ip[3] = 0;
+    } else {
+        memcpy(&mask[0], r->src_mask.v6, 16);
+        memcpy(&mask[2], r->dst_mask.v6, 16);
+        memcpy(&ip[0], r->src_ip.v6, 16);
+        memcpy(&ip[2], r->dst_ip.v6, 16);
+    }
+
+    mask[4] = (0xffULL << CLS_VER_SHIFT);
+    key[4] = ((uint64_t)ip_ver << CLS_VER_SHIFT);
+    if (r->src_port) {
+        mask[4] |= (0xffffULL << CLS_SPORT_SHIFT);
+        key[4] |= ((uint64_t)r->src_port << CLS_SPORT_SHIFT);
+    }
+    if (r->dst_port) {
+        mask[4] |= (0xffffULL << CLS_DPORT_SHIFT);
+        key[4] |= ((uint64_t)r->dst_port << CLS_DPORT_SHIFT);
+    }
+    if (r->protocol) {
+        mask[4] |= (0xffULL << CLS_PROTO_SHIFT);
+        key[4] |= ((uint64_t)r->protocol << CLS_PROTO_SHIFT);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        key[i] = ip[i] & mask[i];
+    }
+}
+
+/* Tuples being built, each with its (key, rule) list. */
+typedef struct {
+    cls_tuple_t *tuples;
+    cls_build_list_t *lists;
+    size_t count;
+    size_t cap;
+} cls_build_t;
+
+static bool mask_eq(const uint64_t a[CLS_KEY_WORDS], const uint64_t b[CLS_KEY_WORDS]) {
+    return memcmp(a, b, CLS_KEY_WORDS * sizeof(uint64_t)) == 0;
+}
+
+/* Linear search is fine here: compile time only, and tuples are few. */
+static cls_build_list_t *find_or_add_tuple(cls_build_t *b, const uint64_t mask[CLS_KEY_WORDS],
+                                           uint64_t order) {
+    for (size_t i = 0; i < b->count; i++) {
+        if (mask_eq(b->tuples[i].mask, mask)) return &b->lists[i];
+    }
+
+    if (b->count == b->cap) {
+        size_t new_cap = b->cap ? b->cap * 2 : 8;
+        cls_tuple_t *t = realloc(b->tuples, new_cap * sizeof(cls_tuple_t));
+        if (!t) return NULL;
+        b->tuples = t;
+        cls_build_list_t *l = realloc(b->lists, new_cap * sizeof(cls_build_list_t));
+        if (!l) return NULL;
+        b->lists = l;
+        b->cap = new_cap;
+    }
+
+    cls_tuple_t *t = &b->tuples[b->count];
+    memset(t, 0, sizeof(*t));
+    memcpy(t->mask, mask, sizeof(t->mask));
+    t->min_order = order; /* Rules arrive in order: the first one is the best */
+
+    cls_build_list_t *l = &b->lists[b->count];
+    memset(l, 0, sizeof(*l));
+
+    b->count++;
+    return l;
+}
+
+static int list_push(cls_build_list_t *l, const uint64_t key[CLS_KEY_WORDS], const rule_t *r) {
+    if (l->count == l->cap) {
+        size_t new_cap = l->cap ? l->cap * 2 : 8;
+        cls_entry_t *e = realloc(l->items, new_cap * sizeof(cls_entry_t));
+        if (!e) return -1;
+        l->items = e;
+        l->cap = new_cap;
+    }
+    memcpy(l->items[l->count].w, key, sizeof(l->items[l->count].w));
+    l->items[l->count].rule_id = r->rule_id;
+    l->items[l->count].priority = r->priority;
+    l->count++;
+    return 0;
+}
+
+/* Turn the build list of a tuple into its open-addressing hash table. */
+static int tuple_build_table(cls_tuple_t *t, const cls_build_list_t *l) {
+    size_t slots = CLS_MIN_SLOTS;
+    while (slots < l->count * 2) {
+        slots <<= 1; /* Load factor <= 0.5 keeps probe chains short. */
+    }
+
+    t->slots = malloc(slots * sizeof(cls_entry_t));
+    if (!t->slots) return -1;
+    for (size_t i = 0; i < slots; i++) {
+        t->slots[i].rule_id = CLS_EMPTY;
+    }
+    t->slot_mask = (uint32_t)(slots - 1);
+
+    for (size_t i = 0; i < l->count; i++) {
+        const cls_entry_t *e = &l->items[i];
+        uint32_t idx = cls_hash(e->w) & t->slot_mask;
+
+        while (t->slots[idx].rule_id != CLS_EMPTY) {
+            /* Same key again: an earlier (better) rule already owns it, and a
+             * later rule with an identical key can never be the first match. */
+            if (cls_key_eq(t->slots[idx].w, e->w)) break;
+            idx = (idx + 1) & t->slot_mask;
+        }
+        if (t->slots[idx].rule_id == CLS_EMPTY) {
+            t->slots[idx] = *e;
+            t->count++;
+        }
+    }
+    return 0;
+}
+
+static int tuple_cmp(const void *a, const void *b) {
+    const cls_tuple_t *ta = (const cls_tuple_t *)a;
+    const cls_tuple_t *tb = (const cls_tuple_t *)b;
+    if (ta->min_order < tb->min_order) return -1;
+    if (ta->min_order > tb->min_order) return 1;
+    return 0;
+}
+
+/*
+    Build the tuples of `rules[0..count)`, sorted, into b->tuples: all of them,
+    or only those whose mask is one of `only[0..n_only)` (only != NULL).
+        Returns 0 on success, -1 on allocation failure (nothing left allocated).
+*/
+static int build_tuples(cls_build_t *b, const rule_t *rules, size_t count,
+                        const uint64_t (*only)[CLS_KEY_WORDS], size_t n_only) {
+    memset(b, 0, sizeof(*b));
+    int rc = 0;
+
+    for (size_t i = 0; i < count && rc == 0; i++) {
+        const rule_t *r = &rules[i];
+
+        /* ip_ver 0 matches both families: one entry in a v4 and one in a v6 tuple. */
+        for (uint8_t ver = 4; ver <= 6; ver += 2) {
+            if (r->ip_ver != 0 && r->ip_ver != ver) continue;
+
+            uint64_t mask[CLS_KEY_WORDS];
+            uint64_t key[CLS_KEY_WORDS];
+            rule_to_key(r, ver, mask, key);
+
+            if (only) {
+                size_t k = 0;
+                while (k < n_only && !mask_eq(only[k], mask)) k++;
+                if (k == n_only) continue;
+            }
+
+            cls_build_list_t *l = find_or_add_tuple(b, mask, cls_order(r->priority, r->rule_id));
+            if (!l || list_push(l, key, r) != 0) {
+                rc = -1;
+                break;
+            }
+        }
+    }
+
+    size_t built = 0;
+    for (size_t i = 0; i < b->count; i++) {
+        if (rc == 0) rc = tuple_build_table(&b->tuples[i], &b->lists[i]);
+        if (rc == 0) built++;
+        free(b->lists[i].items);
+    }
+    free(b->lists);
+    b->lists = NULL;
+
+    if (rc != 0) {
+        for (size_t i = 0; i < built; i++) {
+            free(b->tuples[i].slots);
+        }
+        free(b->tuples);
+        b->tuples = NULL;
+        b->count = 0;
+        return -1;
+    }
+
+    qsort(b->tuples, b->count, sizeof(cls_tuple_t), tuple_cmp);
+    return 0;
+}
+
+/* The by_id index of `rules[0..count)`. */
+static int build_by_id(classifier_t *c, const rule_t *rules, size_t count) {
+    uint32_t ids = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (rules[i].rule_id >= ids) ids = rules[i].rule_id + 1;
+    }
+
+    c->by_id = calloc(ids ? ids : 1, sizeof(const rule_t *));
+    if (!c->by_id) return -1;
+    for (size_t i = 0; i < count; i++) {
+        c->by_id[rules[i].rule_id] = &rules[i];
+    }
+    c->id_count = ids;
+    return 0;
+}
+
+int classifier_init(classifier_t *c, const rule_t *rules, size_t count) {
+    if (!c || (!rules && count > 0)) return -1;
+
+    memset(c, 0, sizeof(*c));
+
+    cls_build_t b;
+    if (build_tuples(&b, rules, count, NULL, 0) != 0) return -1;
+    c->tuples = b.tuples;
+    c->tuple_count = b.count;
+
+    c->owned = malloc((b.count ? b.count : 1) * sizeof(bool));
+    if (!c->owned || build_by_id(c, rules, count) != 0) {
+        for (size_t i = 0; i < b.count; i++) {
+            free(b.tuples[i].slots);
+        }
+        free(c->owned);
+        free(c->tuples);
+        memset(c, 0, sizeof(*c));
+        return -1;
+    }
+    for (size_t i = 0; i < c->tuple_count; i++) {
+        c->owned[i] = true;
+    }
+    return 0;
+}
+
+/* Masks of the tuples `r` is in, appended to masks[*n] unless present. */
+static void add_masks(const rule_t *r, uint64_t (*masks)[CLS_KEY_WORDS], size_t *n) {
+    for (uint8_t ver = 4; ver <= 6; ver += 2) {
+        if (r->ip_ver != 0 && r->ip_ver != ver) continue;
+
+        uint64_t mask[CLS_KEY_WORDS];
+        uint64_t key[CLS_KEY_WORDS];
+        rule_to_key(r, ver, mask, key);
+
+        size_t k = 0;
+        while (k < *n && !mask_eq(masks[k], mask)) k++;
+        if (k == *n) memcpy(masks[(*n)++], mask, sizeof(mask));
+    }
+}
+
+int classifier_update(classifier_t *c, classifier_t *old, const rule_t *rules, size_t count,
+                      const rule_t *changed, size_t n_changed) {
+    if (!c || !old || (!rules && count > 0) || (!changed && n_changed > 0)) return -1;
+
+    memset(c, 0, sizeof(*c));
+
+    /* The tuples a change touches: those of the old and of the new versions. */
+    uint64_t (*touched)[CLS_KEY_WORDS] = malloc((2 * n_changed + 1) * sizeof(*touched));
+    if (!touched) return -1;
+    size_t n_touched = 0;
+    for (size_t i = 0; i < n_changed; i++) {
+        add_masks(&changed[i], touched, &n_touched);
+    }
+
+    cls_build_t b;
+    if (build_tuples(&b, rules, count, (const uint64_t(*)[CLS_KEY_WORDS])touched, n_touched) !=
+        0) {
+        free(touched);
+        return -1;
+    }
+
+    size_t cap = old->tuple_count + b.count;
+    c->tuples = malloc((cap ? cap : 1) * sizeof(cls_tuple_t));
+    c->owned = malloc((cap ? cap : 1) * sizeof(bool));
+    int rc = (c->tuples && c->owned && build_by_id(c, rules, count) == 0) ? 0 : -1;
+
+    /* Merge the untouched old tuples (their order is unchanged) with the new
+     * ones, both sorted by min_order. */
+    size_t o = 0, n = 0;
+    while (rc == 0 && (o < old->tuple_count || n < b.count)) {
+        if (o < old->tuple_count) {
+            size_t k = 0;
+            while (k < n_touched && !mask_eq(touched[k], old->tuples[o].mask)) k++;
+            if (k < n_touched) {
+                o++;
+                continue;
+            }
+        }
+
+        if (n == b.count ||
+            (o < old->tuple_count && old->tuples[o].min_order <= b.tuples[n].min_order)) {
+            cls_tuple_t *t = &c->tuples[c->tuple_count];
+            *t = old->tuples[o];
+            if (old->owned && old->owned[o]) {
+                c->owned[c->tuple_count] = false; /* Until classifier_take_over() */
+            } else {
+                /* Mapped from a file that goes away with `old`: copy, no hashing. */
+                size_t bytes = ((size_t)t->slot_mask + 1) * sizeof(cls_entry_t);
+                t->slots = malloc(bytes);
+                if (!t->slots) {
+                    rc = -1;
+                    break;
+                }
+                memcpy(t->slots, old->tuples[o].slots, bytes);
+                c->owned[c->tuple_count] = true;
+            }
+            o++;
+        } else {
+            c->tuples[c->tuple_count] = b.tuples[n++];
+            c->owned[c->tuple_count] = true;
+        }
+        c->tuple_count++;
+    }
+    free(touched);
+
+    if (rc != 0) {
+        /* The new tuples not merged yet are only in b. */
+        for (; n < b.count; n++) {
+            free(b.tuples[n].slots);
+        }
+        free(b.tuples);
+        if (c->owned) {
+            classifier_destroy(c);
+        } else {
+            free(c->tuples);
+            free(c->by_id);
+        }
+        memset(c, 0, sizeof(*c));
+        return -1;
+    }
+    free(b.tuples);
+    return 0;
+}
+
+void classifier_take_over(classifier_t *c, classifier_t *old) {
+    if (!c || !c->owned || !old || !old->owned) return;
+
+    /* The shared tuples are in the same order in both: one pass over each. */
+    size_t o = 0;
+    for (size_t t = 0; t < c->tuple_count; t++) {
+        if (c->owned[t]) continue;
+        while (o < old->tuple_count && old->tuples[o].slots != c->tuples[t].slots) o++;
+        if (o == old->tuple_count) return;
+        /* `old` keeps using the slots until destroyed, but no longer frees them. */
+        old->owned[o] = false;
+        c->owned[t] = true;
+    }
+}
+
+void classifier_destroy(classifier_t *c) {
+    if (!c) return;
+    for (size_t i = 0; i < c->tuple_count && c->owned; i++) {
+        if (c->owned[i]) free(c->tuples[i].slots);
+    }
+    free(c->tuples);
+    free(c->owned);
+    free(c->by_id);
+    c->tuples = NULL;
+    c->owned = NULL;
+    c->by_id = NULL;
+    c->tuple_count = 0;
+    c->id_count = 0;
+}
+
+const rule_t *classifier_lookup(const classifier_t *c, const flow_key_t *k) {
+    uint64_t p[CLS_KEY_WORDS];
+
+    if (k->ip_ver == 4) {
+        p[0] = k->src_ip.v4;
+        p[1] = 0;
+        p[2] = k->dst_ip.v4;
+        p[3] = 0;
+    } else {
+        memcpy(&p[0], k->src_ip.v6, 16);
+        memcpy(&p[2], k->dst_ip.v6, 16);
+    }
+    p[4] = ((uint64_t)k->src_port << CLS_SPORT_SHIFT) | ((uint64_t)k->dst_port << CLS_DPORT_SHIFT) |
+           ((uint64_t)k->protocol << CLS_PROTO_SHIFT) | ((uint64_t)k->ip_ver << CLS_VER_SHIFT);
+
+    uint64_t best = UINT64_MAX;
+    uint32_t best_id = CLS_EMPTY;
+
+    for (size_t i = 0; i < c->tuple_count; i++) {
+        const cls_tuple_t *t = &c->tuples[i];
+
+        /* Tuples are sorted by their best rule: nothing further can win. */
+        if (t->min_order >= best) break;
+
+        uint64_t q[CLS_KEY_WORDS];
+        for (int j = 0; j < CLS_KEY_WORDS; j++) {
+            q[j] = p[j] & t->mask[j];
+        }
+
+        uint32_t idx = cls_hash(q) & t->slot_mask;
+        while (t->slots[idx].rule_id != CLS_EMPTY) {
+            const cls_entry_t *e = &t->slots[idx];
+            if (cls_key_eq(e->w, q)) {
+                uint64_t order = cls_order(e->priority, e->rule_id);
+                if (order < best) {
+                    best = order;
+                    best_id = e->rule_id;
+                }
+                break;
+            }
+            idx = (idx + 1) & t->slot_mask;
+        }
+    }
+
+    return (best_id == CLS_EMPTY) ? NULL : c->by_id[best_id];
+}
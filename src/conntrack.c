@@ -0,0 +1,284 @@
+#include "conntrack.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define WHEEL_MASK (CONNTRACK_WHEEL_SLOTS - 1)
+
+_Static_assert((CONNTRACK_WHEEL_SLOTS & WHEEL_MASK) == 0, "wheel size must be a power of two");
+_Static_assert(CONNTRACK_TIMEOUT_TCP < CONNTRACK_WHEEL_SLOTS, "timeouts must fit the wheel");
+
+static inline bool key_eq(const flow_cache_key_t *a, const flow_cache_key_t *b) {
+    return ((a->src[0] ^ b->src[0]) | (a->src[1] ^ b->src[1]) | (a->dst[0] ^ b->dst[0]) |
+            (a->dst[1] ^ b->dst[1]) | (a->meta ^ b->meta)) == 0;
+}
+
+int conntrack_init(conntrack_t *ct, size_t entries, uint32_t now) {
+    if (!ct) return -1;
+    memset(ct, 0, sizeof(*ct));
+    if (entries == 0 || entries > CONNTRACK_ENTRIES_MAX) return -1;
+
+    size_t slots = 2;
+    while (slots < 2 * entries) {
+        slots <<= 1;
+    }
+
+    ct->index = malloc(slots * sizeof(conntrack_slot_t));
+    ct->entries = malloc(entries * sizeof(conntrack_entry_t));
+    ct->wheel = malloc(CONNTRACK_WHEEL_SLOTS * sizeof(uint32_t));
+    if (!ct->index || !ct->entries || !ct->wheel) {
+        conntrack_destroy(ct);
+        return -1;
+    }
+
+    for (size_t i = 0; i < slots; i++) {
+        ct->index[i].sig = 0;
+        ct->index[i].idx = CONNTRACK_NONE;
+    }
+    memset(ct->entries, 0, entries * sizeof(conntrack_entry_t));
+    for (size_t i = 0; i < entries; i++) {
+        ct->entries[i].next = i + 1 < entries ? (uint32_t)(i + 1) : CONNTRACK_NONE;
+    }
+    for (size_t i = 0; i < CONNTRACK_WHEEL_SLOTS; i++) {
+        ct->wheel[i] = CONNTRACK_NONE;
+    }
+
+    ct->index_mask = (uint32_t)(slots - 1);
+    ct->capacity = (uint32_t)entries;
+    ct->free_head = 0;
+    ct->now = now;
+    return 0;
+}
+
+void conntrack_destroy(conntrack_t *ct) {
+    if (!ct) return;
+    free(ct->index);
+    free(ct->entries);
+    free(ct->wheel);
+    ct->index = NULL;
+    ct->entries = NULL;
+    ct->wheel = NULL;
+}
+
+size_t conntrack_memory(const conntrack_t *ct) {
+    if (!ct || !ct->entries) return 0;
+    return ((size_t)ct->index_mask + 1) * sizeof(conntrack_slot_t) +
+           (size_t)ct->capacity * sizeof(conntrack_entry_t) +
+           CONNTRACK_WHEEL_SLOTS * sizeof(uint32_t);
+}
+
+void conntrack_key(const flow_key_t *k, conntrack_key_t *out) {
+    flow_cache_key_t fk;
+    flow_cache_key(k, &fk);
+
+    /* Same order as flow_hash(): address first, then port. Any total order
+     * works, as long as both directions agree on it. */
+    bool swap = fk.src[0] > fk.dst[0] || (fk.src[0] == fk.dst[0] && fk.src[1] > fk.dst[1]) ||
+                (fk.src[0] == fk.dst[0] && fk.src[1] == fk.dst[1] && k->src_port > k->dst_port);
+    out->swapped = swap;
+    if (!swap) {
+        out->key = fk;
+        return;
+    }
+
+    out->key.src[0] = fk.dst[0];
+    out->key.src[1] = fk.dst[1];
+    out->key.dst[0] = fk.src[0];
+    out->key.dst[1] = fk.src[1];
+    out->key.meta = (uint64_t)k->dst_port | ((uint64_t)k->src_port << 16) |
+                    (fk.meta & ~(uint64_t)0xffffffffu);
+}
+
+/* Timer wheel: link `e` into the slot of second `tick`. */
+static void wheel_link(conntrack_t *ct, uint32_t idx, uint32_t tick) {
+    conntrack_entry_t *e = &ct->entries[idx];
+    uint32_t *head = &ct->wheel[tick & WHEEL_MASK];
+
+    e->slot_tick = tick;
+    e->prev = CONNTRACK_NONE;
+    e->next = *head;
+    if (*head != CONNTRACK_NONE) ct->entries[*head].prev = idx;
+    *head = idx;
+}
+
+static void wheel_unlink(conntrack_t *ct, uint32_t idx) {
+    conntrack_entry_t *e = &ct->entries[idx];
+
+    if (e->prev != CONNTRACK_NONE) {
+        ct->entries[e->prev].next = e->next;
+    } else {
+        ct->wheel[e->slot_tick & WHEEL_MASK] = e->next;
+    }
+    if (e->next != CONNTRACK_NONE) ct->entries[e->next].prev = e->prev;
+}
+
+/* Index slot holding entry `idx`. */
+static uint32_t index_find(const conntrack_t *ct, uint32_t idx) {
+    const conntrack_entry_t *e = &ct->entries[idx];
+    uint32_t i = (uint32_t)flow_cache_hash(&e->key) & ct->index_mask;
+    while (ct->index[i].idx != idx) {
+        i = (i + 1) & ct->index_mask;
+    }
+    return i;
+}
+
+/* Empty index slot `i`, shifting back the slots after it that probed past it. */
+static void index_delete(conntrack_t *ct, uint32_t i) {
+    uint32_t j = i;
+    for (;;) {
+        j = (j + 1) & ct->index_mask;
+        if (ct->index[j].idx == CONNTRACK_NONE) break;
+
+        /* Slot j may move to i unless its home lies cyclically in (i, j]. */
+        uint32_t home = ct->index[j].sig & ct->index_mask;
+        bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (stays) continue;
+
+        ct->index[i] = ct->index[j];
+        i = j;
+    }
+    ct->index[i].idx = CONNTRACK_NONE;
+}
+
+static void entry_free(conntrack_t *ct, uint32_t idx) {
+    wheel_unlink(ct, idx);
+    index_delete(ct, index_find(ct, idx));
+    ct->entries[idx].next = ct->free_head;
+    ct->free_head = idx;
+    ct->count--;
+}
+
+void conntrack_remove(conntrack_t *ct, conntrack_entry_t *e) {
+    entry_free(ct, (uint32_t)(e - ct->entries));
+}
+
+conntrack_entry_t *conntrack_lookup(conntrack_t *ct, const conntrack_key_t *ck, uint64_t hash) {
+    uint32_t sig = (uint32_t)hash;
+
+    for (uint32_t i = sig & ct->index_mask; ct->index[i].idx != CONNTRACK_NONE;
+         i = (i + 1) & ct->index_mask) {
+        if (ct->index[i].sig != sig) continue;
+
+        uint32_t idx = ct->index[i].idx;
+        conntrack_entry_t *e = &ct->entries[idx];
+        if (!key_eq(&e->key, &ck->key)) continue;
+
+        /* Timed out, the wheel just has not come round to it yet. */
+        if (e->expires <= ct->now) {
+            entry_free(ct, idx);
+            ct->expired++;
+            return NULL;
+        }
+        ct->hits++;
+        return e;
+    }
+    return NULL;
+}
+
+/*
+    The entry that times out next. Entries refreshed since they were linked
+    are moved on to their own slot on the way, as the wheel would do anyway.
+*/
+static uint32_t evict_candidate(conntrack_t *ct) {
+    for (uint32_t t = 1; t <= CONNTRACK_WHEEL_SLOTS; t++) {
+        uint32_t idx = ct->wheel[(ct->now + t) & WHEEL_MASK];
+        while (idx != CONNTRACK_NONE) {
+            conntrack_entry_t *e = &ct->entries[idx];
+            uint32_t next = e->next;
+            if (e->expires <= e->slot_tick) return idx;
+            wheel_unlink(ct, idx);
+            wheel_link(ct, idx, e->expires);
+            idx = next;
+        }
+    }
+    return CONNTRACK_NONE; /* Not reached: a full table has linked entries */
+}
+
+conntrack_entry_t *conntrack_insert(conntrack_t *ct, const conntrack_key_t *ck, uint64_t hash,
+                                    const rule_t *rule, uint32_t rule_gen) {
+    if (ct->free_head == CONNTRACK_NONE) {
+        entry_free(ct, evict_candidate(ct));
+        ct->evictions++;
+    }
+
+    uint32_t idx = ct->free_head;
+    conntrack_entry_t *e = &ct->entries[idx];
+    ct->free_head = e->next;
+
+    e->key = ck->key;
+    e->rule = rule;
+    e->rule_gen = rule_gen;
+    e->expires = ct->now + CONNTRACK_TIMEOUT_NEW;
+    e->state = CT_NEW;
+    e->orig_swapped = ck->swapped;
+    wheel_link(ct, idx, e->expires);
+
+    uint32_t sig = (uint32_t)hash;
+    uint32_t i = sig & ct->index_mask;
+    while (ct->index[i].idx != CONNTRACK_NONE) {
+        i = (i + 1) & ct->index_mask;
+    }
+    ct->index[i].sig = sig;
+    ct->index[i].idx = idx;
+
+    ct->count++;
+    ct->inserts++;
+    return e;
+}
+
+void conntrack_update(conntrack_t *ct, conntrack_entry_t *e, bool reply, uint8_t tcp_flags) {
+    bool tcp = (uint8_t)(e->key.meta >> 32) == IP_PROTO_TCP;
+
+    if (tcp && (tcp_flags & (TCP_FLAG_FIN | TCP_FLAG_RST))) {
+        e->state = CT_CLOSING;
+    } else if (tcp && e->state == CT_CLOSING && !reply &&
+               (tcp_flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_SYN) {
+        e->state = CT_NEW; /* The port pair is reused for a new connection */
+    } else if (reply && e->state == CT_NEW) {
+        e->state = CT_ESTABLISHED;
+    }
+
+    uint32_t timeout = e->state == CT_NEW       ? CONNTRACK_TIMEOUT_NEW
+                       : e->state == CT_CLOSING ? CONNTRACK_TIMEOUT_CLOSE
+                       : tcp                    ? CONNTRACK_TIMEOUT_TCP
+                                                : CONNTRACK_TIMEOUT_UDP;
+    e->expires = ct->now + timeout;
+
+    /* Later: the wheel moves it when its slot comes up. Earlier: now. */
+    if (e->expires < e->slot_tick) {
+        uint32_t idx = (uint32_t)(e - ct->entries);
+        wheel_unlink(ct, idx);
+        wheel_link(ct, idx, e->expires);
+    }
+}
+
+void conntrack_advance(conntrack_t *ct, uint32_t now) {
+    if (now <= ct->now) return;
+
+    /* Every slot once at most: after a long pause the oldest seconds share one pass. */
+    uint32_t from = now - ct->now > CONNTRACK_WHEEL_SLOTS ? now - CONNTRACK_WHEEL_SLOTS + 1
+                                                          : ct->now + 1;
+    ct->now = now;
+
+    for (uint32_t t = from; t != now + 1; t++) {
+        /* Detach the list first: entries relinked below may land in this slot again. */
+        uint32_t idx = ct->wheel[t & WHEEL_MASK];
+        ct->wheel[t & WHEEL_MASK] = CONNTRACK_NONE;
+
+        while (idx != CONNTRACK_NONE) {
+            conntrack_entry_t *e = &ct->entries[idx];
+            uint32_t next = e->next;
+            if (e->expires <= now) {
+                /* Unlinked already with the whole list. */
+                index_delete(ct, index_find(ct, idx));
+                e->next = ct->free_head;
+                ct->free_head = idx;
+                ct->count--;
+                ct->expired++;
+            } else {
+                wheel_link(ct, idx, e->expires);
+            }
+            idx = next;
+        }
+    }
+}
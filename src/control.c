@@ -0,0 +1,263 @@
+#define _POSIX_C_SOURCE 200809L
+#include "control.h"
+#include "affinity.h"
+#include "log.h"
+
+#include <string.h>
+#include <time.h>
+
+#define NS_PER_SEC 1000000000ULL
+
+int control_init(control_plane_t *c, int core_id, const tx_ctx_t *tx, arp_table_t *arpt,
+                 ndp_table_t *ndpt, uint32_t reply_rate) {
+    if (!c || !tx || !arpt || !ndpt) return -1;
+
+    c->core_id = core_id;
+    c->ring_count = 0;
+    c->tx = tx;
+    c->arpt = arpt;
+    c->ndpt = ndpt;
+    c->reply_rate = reply_rate;
+    c->tokens = reply_rate;
+    c->refill_ns = 0;
+    atomic_init(&c->stop, false);
+    c->arp_frames = 0;
+    c->ndp_frames = 0;
+    c->replies_sent = 0;
+    c->replies_limited = 0;
+    c->replies_dropped = 0;
+    c->idle_streak = 0;
+    return 0;
+}
+
+int control_add_ring(control_plane_t *c, spsc_ring_t *r) {
+    if (!c || !r || c->ring_count == CONTROL_MAX_RINGS) return -1;
+    c->rings[c->ring_count++] = r;
+    return 0;
+}
+
+/* Token bucket: reply_rate tokens per second, at most one second's worth banked. */
+static void refill(control_plane_t *c, uint64_t now_ns) {
+    if (c->reply_rate == 0) return;
+
+    uint64_t elapsed = now_ns - c->refill_ns;
+    if (elapsed >= NS_PER_SEC) {
+        c->tokens = c->reply_rate;
+        c->refill_ns = now_ns;
+        return;
+    }
+
+    uint64_t add = elapsed * c->reply_rate / NS_PER_SEC;
+    if (add == 0) return;
+    /* Advance by what the tokens were worth, so the remainder is not lost. */
+    c->refill_ns += add * NS_PER_SEC / c->reply_rate;
+    uint64_t tokens = c->tokens + add;
+    c->tokens = tokens > c->reply_rate ? c->reply_rate : (uint32_t)tokens;
+}
+
+static bool take_token(control_plane_t *c) {
+    if (c->reply_rate == 0) return true;
+    if (c->tokens == 0) return false;
+    c->tokens--;
+    return true;
+}
+
+/*
+    Sender of an ARP frame into (ip, mac); turn a request for our address into
+    the reply, in place.
+        Returns true if the frame is now a reply to send.
+*/
+static bool arp_input(control_plane_t *c, pktbuf_t *b, uint32_t *ip, uint8_t mac[6],
+                      bool *learned) {
+    *learned = false;
+    if (b->len < sizeof(struct eth_hdr) + sizeof(struct arp_hdr)) return false;
+
+    struct eth_hdr *eth = (struct eth_hdr *)b->data;
+    struct arp_hdr *arp = (struct arp_hdr *)(b->data + sizeof(struct eth_hdr));
+    if (ntohs(arp->htype) != ARP_HW_ETHERNET || ntohs(arp->ptype) != ETH_TYPE_IPV4 ||
+        arp->hlen != ARP_HW_LEN_ETH || arp->plen != ARP_PROTO_LEN) {
+        return false;
+    }
+
+    /* Learn the sender's MAC/IP mapping */
+    *ip = ntohl(arp->spa);
+    memcpy(mac, arp->sha, 6);
+    *learned = true;
+    log_msg(LOG_DEBUG, "Learned ARP: %08X -> %02X:%02X:%02X:%02X:%02X:%02X", *ip, mac[0], mac[1],
+            mac[2], mac[3], mac[4], mac[5]);
+
+    const tx_ctx_t *tx = c->tx;
+    if (ntohs(arp->op) != ARP_OP_REQUEST || tx->ip4_addr == 0 ||
+        ntohl(arp->tpa) != tx->ip4_addr) {
+        return false;
+    }
+    if (!take_token(c)) {
+        c->replies_limited++;
+        return false;
+    }
+
+    /* Re-use the incoming buffer to build the reply in-place */
+    memcpy(eth->dst, eth->src, 6);
+    memcpy(eth->src, tx->eth_addr, 6);
+
+    arp->op = htons(ARP_OP_REPLY);
+    memcpy(arp->tha, arp->sha, 6);
+    arp->tpa = arp->spa;
+    memcpy(arp->sha, tx->eth_addr, 6);
+    arp->spa = htonl(tx->ip4_addr);
+    return true;
+}
+
+/*
+    Link-layer address of a Neighbor Solicitation (source option, for the
+    sender) or Advertisement (target option, for the target).
+        Returns true if it carried one.
+*/
+static bool ndp_input(const pktbuf_t *b, uint8_t ip[16], uint8_t mac[6]) {
+    const struct ipv6_hdr *ip6 = (const struct ipv6_hdr *)(b->data + sizeof(struct eth_hdr));
+    const struct ndp_na_hdr *ndp =
+        (const struct ndp_na_hdr *)(b->data + sizeof(struct eth_hdr) + sizeof(struct ipv6_hdr));
+    uint8_t want = ndp->type == ICMPV6_NEIGHBOR_SOL ? NDP_OPT_SRC_LLADDR : NDP_OPT_TGT_LLADDR;
+    size_t offset = sizeof(struct eth_hdr) + sizeof(struct ipv6_hdr) + sizeof(struct ndp_na_hdr);
+
+    while (offset + 2 <= b->len) {
+        uint8_t opt_type = b->data[offset];
+        size_t opt_len = (size_t)b->data[offset + 1] * 8;
+
+        if (opt_len == 0 || offset + opt_len > b->len) break;
+
+        if (opt_type == want && opt_len >= 8) {
+            memcpy(ip, ndp->type == ICMPV6_NEIGHBOR_SOL ? ip6->src_addr : ndp->target, 16);
+            memcpy(mac, b->data + offset + 2, 6);
+            log_msg(LOG_DEBUG, "Learned NDP (%s): %02x:%02x:%02x:%02x:%02x:%02x",
+                    ndp->type == ICMPV6_NEIGHBOR_SOL ? "NS" : "NA", mac[0], mac[1], mac[2],
+                    mac[3], mac[4], mac[5]);
+            return true;
+        }
+        offset += opt_len;
+    }
+    return false;
+}
+
+void control_process(control_plane_t *c, pktbuf_t **bufs, unsigned int n, uint64_t now_ns) {
+    uint32_t arp_ips[WORKER_BURST_SIZE];
+    uint8_t arp_macs[WORKER_BURST_SIZE][6];
+    uint8_t ndp_ips[WORKER_BURST_SIZE][16];
+    uint8_t ndp_macs[WORKER_BURST_SIZE][6];
+    const uint8_t *frames[WORKER_BURST_SIZE];
+    size_t lens[WORKER_BURST_SIZE];
+    size_t arp_n = 0, ndp_n = 0;
+    int replies = 0;
+
+    if (n > WORKER_BURST_SIZE) n = WORKER_BURST_SIZE;
+    refill(c, now_ns);
+
+    for (unsigned int i = 0; i < n; i++) {
+        pktbuf_t *b = bufs[i];
+        const struct eth_hdr *eth = (const struct eth_hdr *)b->data;
+
+        if (ntohs(eth->ethertype) == ETH_TYPE_ARP) {
+            c->arp_frames++;
+            bool learned;
+            if (arp_input(c, b, &arp_ips[arp_n], arp_macs[arp_n], &learned)) {
+                frames[replies] = b->data;
+                lens[replies] = b->len;
+                replies++;
+            }
+            if (learned) arp_n++;
+        } else {
+            c->ndp_frames++;
+            if (ndp_input(b, ndp_ips[ndp_n], ndp_macs[ndp_n])) ndp_n++;
+        }
+    }
+
+    /* One lock and one generation change per table for the whole burst. */
+    if (arp_n > 0) arp_update_bulk(c->arpt, arp_ips, (const uint8_t(*)[6])arp_macs, arp_n);
+    if (ndp_n > 0) {
+        ndp_update_bulk(c->ndpt, (const uint8_t(*)[16])ndp_ips, (const uint8_t(*)[6])ndp_macs,
+                        ndp_n);
+    }
+
+    if (replies > 0) {
+        int sent = tx_send_batch(c->tx, frames, lens, replies);
+        if (sent < 0) sent = 0;
+        c->replies_sent += (uint64_t)sent;
+        c->replies_dropped += (uint64_t)(replies - sent);
+    }
+
+    /* The replies are copied into the socket buffer or a TX ring slot by now. */
+    pktbuf_release_bulk(bufs, n);
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+/* Same steps as a TX stage: spin, then sleep up to WORKER_IDLE_SLEEP_MAX_US. */
+static void control_idle(control_plane_t *c) {
+    uint32_t streak = c->idle_streak++;
+
+    if (streak < WORKER_IDLE_SPIN_ROUNDS) {
+        for (uint32_t i = 0; i < 1u << streak; i++) {
+            cpu_relax();
+        }
+        return;
+    }
+
+    streak -= WORKER_IDLE_SPIN_ROUNDS;
+    long us = streak < 10 ? 1L << streak : WORKER_IDLE_SLEEP_MAX_US;
+    if (us > WORKER_IDLE_SLEEP_MAX_US) us = WORKER_IDLE_SLEEP_MAX_US;
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = us * 1000};
+    nanosleep(&ts, NULL);
+}
+
+static void *control_main(void *arg) {
+    control_plane_t *c = (control_plane_t *)arg;
+
+    if (c->core_id >= 0) {
+        if (affinity_pin_self(c->core_id) != 0) {
+            log_msg(LOG_WARN, "Control plane: failed to pin to core %d", c->core_id);
+        } else {
+            log_msg(LOG_INFO, "Control plane: pinned to core %d", c->core_id);
+        }
+    }
+
+    while (1) {
+        /* Read before the rings: once set, no worker pushes any more. */
+        bool stop = atomic_load_explicit(&c->stop, memory_order_acquire);
+
+        unsigned int total = 0;
+        for (unsigned int i = 0; i < c->ring_count; i++) {
+            void **slots;
+            unsigned int n = ring_peek_burst(c->rings[i], &slots, WORKER_BURST_SIZE);
+            if (n == 0) continue;
+            control_process(c, (pktbuf_t **)slots, n, monotonic_ns());
+            ring_pop_commit(c->rings[i], n);
+            total += n;
+        }
+
+        if (total > 0) {
+            c->idle_streak = 0;
+        } else if (stop) {
+            break;
+        } else {
+            control_idle(c);
+        }
+    }
+
+    pktbuf_thread_flush();
+    return NULL;
+}
+
+int control_start(control_plane_t *c) {
+    if (!c) return -1;
+    return pthread_create(&c->thread, NULL, control_main, c);
+}
+
+void control_stop(control_plane_t *c) {
+    if (!c) return;
+    atomic_store_explicit(&c->stop, true, memory_order_release);
+    pthread_join(c->thread, NULL);
+}
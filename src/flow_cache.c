@@ -0,0 +1,138 @@
+#include "flow_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static inline bool key_eq(const flow_cache_key_t *a, const flow_cache_key_t *b) {
+    return ((a->src[0] ^ b->src[0]) | (a->src[1] ^ b->src[1]) | (a->dst[0] ^ b->dst[0]) |
+            (a->dst[1] ^ b->dst[1]) | (a->meta ^ b->meta)) == 0;
+}
+
+/* Signature stored in the bucket header. Never 0, which marks an empty way. */
+static inline uint32_t hash_sig(uint64_t hash) {
+    uint32_t sig = (uint32_t)(hash >> 32);
+    return sig ? sig : 1;
+}
+
+int flow_cache_init(flow_cache_t *c, size_t entries) {
+    if (!c) return -1;
+    memset(c, 0, sizeof(*c));
+
+    size_t buckets = 1;
+    while (buckets * FLOW_CACHE_WAYS < entries) {
+        buckets <<= 1;
+    }
+
+    /* Both sizes are multiples of 64, as aligned_alloc() requires. */
+    c->buckets = aligned_alloc(64, buckets * sizeof(flow_cache_bucket_t));
+    c->entries = aligned_alloc(64, buckets * FLOW_CACHE_WAYS * sizeof(flow_cache_entry_t));
+    if (!c->buckets || !c->entries) {
+        flow_cache_destroy(c);
+        return -1;
+    }
+    memset(c->buckets, 0, buckets * sizeof(flow_cache_bucket_t));
+    memset(c->entries, 0, buckets * FLOW_CACHE_WAYS * sizeof(flow_cache_entry_t));
+
+    c->bucket_mask = (uint32_t)(buckets - 1);
+    return 0;
+}
+
+void flow_cache_destroy(flow_cache_t *c) {
+    if (!c) return;
+    free(c->buckets);
+    free(c->entries);
+    c->buckets = NULL;
+    c->entries = NULL;
+}
+
+void flow_cache_key(const flow_key_t *k, flow_cache_key_t *out) {
+    if (k->ip_ver == 4) {
+        out->src[0] = k->src_ip.v4;
+        out->src[1] = 0;
+        out->dst[0] = k->dst_ip.v4;
+        out->dst[1] = 0;
+    } else {
+        memcpy(out->src, k->src_ip.v6, 16);
+        memcpy(out->dst, k->dst_ip.v6, 16);
+    }
+    out->meta = (uint64_t)k->src_port | ((uint64_t)k->dst_port << 16) |
+                ((uint64_t)k->protocol << 32) | ((uint64_t)k->ip_ver << 40);
+}
+
+uint64_t flow_cache_hash(const flow_cache_key_t *key) {
+    /* Multiply-xorshift per word. Unlike flow_hash() it is not symmetric:
+     * the two directions of a flow are different cache entries. */
+    const uint64_t w[5] = {key->src[0], key->src[1], key->dst[0], key->dst[1], key->meta};
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < 5; i++) {
+        h ^= w[i];
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+    }
+    return h;
+}
+
+flow_cache_entry_t *flow_cache_lookup(flow_cache_t *c, const flow_cache_key_t *key, uint64_t hash,
+                                      uint32_t rule_gen) {
+    uint32_t b = (uint32_t)hash & c->bucket_mask;
+    flow_cache_bucket_t *bkt = &c->buckets[b];
+    uint32_t sig = hash_sig(hash);
+
+    for (uint32_t way = 0; way < FLOW_CACHE_WAYS; way++) {
+        if (bkt->sig[way] != sig) continue;
+
+        flow_cache_entry_t *e = &c->entries[b * FLOW_CACHE_WAYS + way];
+        if (!key_eq(&e->key, key)) continue;
+
+        if (e->rule_gen != rule_gen) break; /* Matched against an old rule table. */
+
+        /* Only write the header line when the bit actually changes. */
+        uint8_t bit = (uint8_t)(1u << way);
+        if (!(bkt->ref & bit)) bkt->ref |= bit;
+        c->hits++;
+        return e;
+    }
+
+    c->misses++;
+    return NULL;
+}
+
+flow_cache_entry_t *flow_cache_insert(flow_cache_t *c, const flow_cache_key_t *key, uint64_t hash,
+                                      const rule_t *rule, uint32_t rule_gen) {
+    uint32_t b = (uint32_t)hash & c->bucket_mask;
+    flow_cache_bucket_t *bkt = &c->buckets[b];
+    uint32_t sig = hash_sig(hash);
+    uint32_t victim = FLOW_CACHE_WAYS;
+
+    for (uint32_t way = 0; way < FLOW_CACHE_WAYS; way++) {
+        /* A stale entry for the same flow is refreshed in place. */
+        if (bkt->sig[way] == sig && key_eq(&c->entries[b * FLOW_CACHE_WAYS + way].key, key)) {
+            victim = way;
+            break;
+        }
+        if (bkt->sig[way] == 0 && victim == FLOW_CACHE_WAYS) victim = way;
+    }
+
+    if (victim == FLOW_CACHE_WAYS) {
+        /* Bucket full: CLOCK. Terminates within two rounds, since every step
+         * clears the bit it skips. */
+        while (bkt->ref & (1u << bkt->hand)) {
+            bkt->ref &= (uint8_t)~(1u << bkt->hand);
+            bkt->hand = (uint8_t)((bkt->hand + 1) & (FLOW_CACHE_WAYS - 1));
+        }
+        victim = bkt->hand;
+        bkt->hand = (uint8_t)((bkt->hand + 1) & (FLOW_CACHE_WAYS - 1));
+        c->evictions++;
+    }
+
+    flow_cache_entry_t *e = &c->entries[b * FLOW_CACHE_WAYS + victim];
+    e->key = *key;
+    e->rule = rule;
+    e->rule_gen = rule_gen;
+    e->neigh_gen = 0;
+    e->mac_valid = false;
+
+    bkt->sig[victim] = sig;
+    bkt->ref |= (uint8_t)(1u << victim);
+    return e;
+}
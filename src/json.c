@@ -0,0 +1,95 @@
+#include "json.h"
+
+void json_init(json_ctx_t *ctx, FILE *out) {
+    ctx->out = out;
+    ctx->indent_level = 0;
+    ctx->needs_comma = false;
+}
+
+static void json_print_indent(json_ctx_t *ctx) {
+    for (int i = 0; i < ctx->indent_level; i++) {
+        fprintf(ctx->out, "    ");
+    }
+}
+
+void json_begin_object(json_ctx_t *ctx) {
+    if (ctx->needs_comma) {
+        fprintf(ctx->out, ",\n");
+    }
+    json_print_indent(ctx);
+    fprintf(ctx->out, "{\n");
+    ctx->indent_level++;
+    ctx->needs_comma = false;
+}
+
+void json_end_object(json_ctx_t *ctx) {
+    fprintf(ctx->out, "\n");
+    ctx->indent_level--;
+    json_print_indent(ctx);
+    fprintf(ctx->out, "}");
+    ctx->needs_comma = true;
+}
+
+void json_key_string(json_ctx_t *ctx, const char *key, const char *value) {
+    if (ctx->needs_comma) {
+        fprintf(ctx->out, ",\n");
+    }
+    json_print_indent(ctx);
+    fprintf(ctx->out, "\"%s\": \"%s\"", key, value);
+    ctx->needs_comma = true;
+}
+
+void json_key_int(json_ctx_t *ctx, const char *key, int64_t value) {
+    if (ctx->needs_comma) {
+        fprintf(ctx->out, ",\n");
+    }
+    json_print_indent(ctx);
+    fprintf(ctx->out, "\"%s\": %ld", key, (long)value);
+    ctx->needs_comma = true;
+}
+
+void json_key_double(json_ctx_t *ctx, const char *key, double value) {
+    if (ctx->needs_comma) {
+        fprintf(ctx->out, ",\n");
+    }
+    json_print_indent(ctx);
+    fprintf(ctx->out, "\"%s\": %.6f", key, value);
+    ctx->needs_comma = true;
+}
+
+void json_key_bool(json_ctx_t *ctx, const char *key, bool value) {
+    if (ctx->needs_comma) {
+        fprintf(ctx->out, ",\n");
+    }
+    json_print_indent(ctx);
+    fprintf(ctx->out, "\"%s\": %s", key, value ? "true" : "false");
+    ctx->needs_comma = true;
+}
+
+void json_begin_nested_object(json_ctx_t *ctx, const char *key) {
+    if (ctx->needs_comma) {
+        fprintf(ctx->out, ",\n");
+    }
+    json_print_indent(ctx);
+    fprintf(ctx->out, "\"%s\": {\n", key);
+    ctx->indent_level++;
+    ctx->needs_comma = false;
+}
+
+void json_begin_nested_array(json_ctx_t *ctx, const char *key) {
+    if (ctx->needs_comma) {
+        fprintf(ctx->out, ",\n");
+    }
+    json_print_indent(ctx);
+    fprintf(ctx->out, "\"%s\": [\n", key);
+    ctx->indent_level++;
+    ctx->needs_comma = false;
+}
+
+void json_end_array(json_ctx_t *ctx) {
+    fprintf(ctx->out, "\n");
+    ctx->indent_level--;
+    json_print_indent(ctx);
+    fprintf(ctx->out, "]");
+    ctx->needs_comma = true;
+}
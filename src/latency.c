@@ -34,50 +34,43 @@ double latency_calibrate_tsc(void) {
 
 void latency_histogram_init(latency_histogram_t *h) {
     memset(h, 0, sizeof(*h));
-    h->min_ns = 1000000;
+    h->min_ns = UINT64_MAX;
 }
 
-/* Record a single latency sample (in TSC cycles) into the histogram. */
-void latency_record(latency_histogram_t *h, uint64_t cycles, double cycles_per_ns) {
-    uint64_t ns = (uint64_t)((double)cycles / cycles_per_ns);
-
-    /* Walk bucket bounds to find where this sample lands */
-    int bucket = LATENCY_NUM_BUCKETS - 1; /* Default is the catch-all bucket */
-    for (int i = 0; i < LATENCY_NUM_BUCKETS; i++) {
-        if (ns < latency_bucket_bounds[i]) {
-            bucket = i;
-            break;
-        }
-    }
-
-    h->buckets[bucket]++;
-    h->total_count++;
-    h->sum_ns += ns;
-
-    if (ns < h->min_ns) h->min_ns = ns;
-    if (ns > h->max_ns) h->max_ns = ns;
+/* Highest latency that lands in bucket idx: the inverse of latency_bucket_index(). */
+static uint64_t bucket_highest(unsigned int idx) {
+    unsigned int group = idx >> LATENCY_PRECISION_BITS;
+    unsigned int shift = group > 0 ? group - 1 : 0;
+    uint64_t lowest = (uint64_t)(idx - (shift << LATENCY_PRECISION_BITS)) << shift;
+    return lowest + (1ULL << shift) - 1;
 }
 
 uint64_t latency_percentile(const latency_histogram_t *h, double percentile) {
     if (h->total_count == 0) return 0;
 
-    /*  Number of samples that must fall at or below the target percentile */
-    uint64_t target = (uint64_t)(percentile * (double)h->total_count);
+    /* Rank of the sample at the percentile, rounded up: p50 of 3 samples is the 2nd */
+    double exact = percentile * (double)h->total_count;
+    uint64_t target = (uint64_t)exact;
+    if ((double)target < exact) target++;
+    if (target == 0) target = 1;
+    if (target > h->total_count) target = h->total_count;
 
     uint64_t cumulative = 0;
-    for (int i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+    for (unsigned int i = 0; i < LATENCY_NUM_BUCKETS; i++) {
         cumulative += h->buckets[i];
         if (cumulative >= target) {
-            return latency_bucket_bounds[i];
+            /* The last bucket has no upper bound but max_ns */
+            uint64_t v = i < LATENCY_NUM_BUCKETS - 1 ? bucket_highest(i) : h->max_ns;
+            return v < h->max_ns ? v : h->max_ns;
         }
     }
 
-    /* Should never reach here, because the last bucket is 1000000 (MAX) */
-    return latency_bucket_bounds[LATENCY_NUM_BUCKETS - 1];
+    /* Only if the buckets do not add up to total_count (a torn snapshot) */
+    return h->max_ns;
 }
 
 void latency_histogram_merge(latency_histogram_t *dst, const latency_histogram_t *src) {
-    for (int i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+    for (unsigned int i = 0; i < LATENCY_NUM_BUCKETS; i++) {
         dst->buckets[i] += src->buckets[i];
     }
 
@@ -87,4 +80,4 @@ void latency_histogram_merge(latency_histogram_t *dst, const latency_histogram_t
     /* Keep the global min, max */
     if (src->min_ns < dst->min_ns) dst->min_ns = src->min_ns;
     if (src->max_ns > dst->max_ns) dst->max_ns = src->max_ns;
-}
\ No newline at end of file
+}
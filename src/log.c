@@ -1,15 +1,32 @@
 #define _POSIX_C_SOURCE 200809L
 #include "log.h"
 
-#include <stdio.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 static log_level_t g_level = LOG_INFO;
+static FILE *g_out = NULL; /* NULL: stderr, which is not a constant */
 
 void log_set_level(log_level_t level) {
     g_level = level;
 }
 
+log_level_t log_get_level(void) {
+    return g_level;
+}
+
+void log_set_output(FILE *out) {
+    g_out = out;
+}
+
+static FILE *output(void) {
+    return g_out ? g_out : stderr;
+}
+
 static const char *level_to_string(log_level_t level) {
     switch (level) {
     case LOG_ERROR:
@@ -25,29 +42,613 @@ static const char *level_to_string(log_level_t level) {
     }
 }
 
+static void format_time(time_t t, char *tbuf, size_t cap) {
+    struct tm tm_now;
+    localtime_r(&t, &tm_now);
+    strftime(tbuf, cap, "%Y-%m-%d %H:%M:%S", &tm_now);
+}
+
+/* One hexdump line: offset, 16 bytes in hex, then as ASCII. */
+static void hexdump_line(char *line, size_t cap, const unsigned char *p, size_t off, size_t len) {
+    size_t pos = (size_t)snprintf(line, cap, "%04zx  ", off); /* Offset */
+
+    /* Hex bytes */
+    for (size_t j = 0; j < 16 && pos < cap; j++) {
+        if (off + j < len)
+            pos += (size_t)snprintf(line + pos, cap - pos, "%02x  ", p[off + j]);
+        else
+            pos += (size_t)snprintf(line + pos, cap - pos, "    ");
+    }
+
+    /* ASCII characters */
+    if (pos < cap) pos += (size_t)snprintf(line + pos, cap - pos, " |");
+    for (size_t j = 0; j < 16 && off + j < len && pos + 1 < cap; j++) {
+        unsigned char c = p[off + j];
+        /* Print printable chars, otherwise dot */
+        line[pos++] = (char)((c >= 32 && c <= 126) ? c : '.');
+    }
+    if (pos < cap) snprintf(line + pos, cap - pos, "|\n");
+}
+
+/* === Asynchronous logging === */
+
+#define LOG_CACHE_LINE 64
+#define LOG_MAX_ARGS 8
+#define LOG_RING_MASK (LOG_RING_SLOTS - 1)
+#define LOG_DRAIN_INTERVAL_NS (10 * 1000 * 1000)
+#define LOG_DRAIN_BUF (64 * 1024)
+
+_Static_assert((LOG_RING_SLOTS & LOG_RING_MASK) == 0, "LOG_RING_SLOTS must be a power of two");
+
+typedef enum {
+    REC_MSG = 0,  /* fmt + args, strings in data */
+    REC_TEXT = 1, /* Formatted on the spot into data: the format was not encodable */
+    REC_HEX = 2   /* args[0] bytes, the first LOG_HEXDUMP_MAX in data */
+} rec_kind_t;
+
+/* 256 bytes, four cache lines. */
+typedef struct {
+    const char *fmt;
+    int64_t time; /* Wall clock, seconds */
+    uint8_t level;
+    uint8_t kind;
+    uint8_t nargs;
+    uint16_t used; /* Bytes of data taken by strings */
+    uint64_t args[LOG_MAX_ARGS];
+    char data[LOG_HEXDUMP_MAX];
+} log_record_t;
+
+_Static_assert(sizeof(log_record_t) == 256, "log_record_t should be 256 bytes");
+
+typedef struct log_ring {
+    /* [producer: the thread that owns the ring] */
+    alignas(LOG_CACHE_LINE) _Atomic size_t head;
+    _Atomic uint64_t dropped;
+
+    /* [consumer: the drain thread] */
+    alignas(LOG_CACHE_LINE) _Atomic size_t tail;
+    struct log_ring *next;
+
+    log_record_t slots[LOG_RING_SLOTS];
+} log_ring_t;
+
+static pthread_mutex_t g_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_ring_t *g_rings;         /* [g_rings_lock] */
+static uint64_t g_dropped_reported; /* [g_rings_lock] */
+static atomic_bool g_running;
+static pthread_t g_drain_th;
+static _Thread_local log_ring_t *t_ring;
+
+/*
+    Conversion specification parser, shared by the producer (which must pull
+    each argument with its own type) and the drain thread (which passes it
+    back to snprintf with the same type).
+*/
+typedef enum { ARG_PCT, ARG_INT, ARG_UINT, ARG_DBL, ARG_STR, ARG_PTR, ARG_BAD } arg_kind_t;
+typedef enum { LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_Z, LEN_J, LEN_T, LEN_LD } arg_len_t;
+
+typedef struct {
+    const char *start; /* The '%' */
+    const char *mods;  /* Length modifier, or the conversion if there is none */
+    const char *end;   /* Past the conversion */
+    int stars;         /* '*' width and precision, each an int argument */
+    arg_len_t len;
+    arg_kind_t kind;
+} log_spec_t;
+
+static const char *spec_parse(const char *p, log_spec_t *s) {
+    s->start = p++;
+    s->stars = 0;
+    s->len = LEN_NONE;
+    if (*p == '%') {
+        s->kind = ARG_PCT;
+        s->mods = p;
+        s->end = p + 1;
+        return s->end;
+    }
+
+    while (*p && strchr("-+ #0", *p)) p++;
+    if (*p == '*') {
+        s->stars++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9') p++;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            s->stars++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') p++;
+    }
+
+    s->mods = p;
+    switch (*p) {
+    case 'h':
+        s->len = p[1] == 'h' ? LEN_HH : LEN_H;
+        p += p[1] == 'h' ? 2 : 1;
+        break;
+    case 'l':
+        s->len = p[1] == 'l' ? LEN_LL : LEN_L;
+        p += p[1] == 'l' ? 2 : 1;
+        break;
+    case 'z':
+        s->len = LEN_Z;
+        p++;
+        break;
+    case 'j':
+        s->len = LEN_J;
+        p++;
+        break;
+    case 't':
+        s->len = LEN_T;
+        p++;
+        break;
+    case 'L':
+        s->len = LEN_LD;
+        p++;
+        break;
+    default:
+        break;
+    }
+
+    char conv = *p;
+    s->end = conv ? p + 1 : p;
+    if (conv && strchr("di", conv)) {
+        s->kind = ARG_INT;
+    } else if (conv && strchr("ouxX", conv)) {
+        s->kind = ARG_UINT;
+    } else if (conv == 'c' && s->len == LEN_NONE) {
+        s->kind = ARG_INT;
+    } else if (conv && strchr("eEfFgGaA", conv)) {
+        s->kind = ARG_DBL;
+    } else if (conv == 's' && s->len == LEN_NONE) {
+        s->kind = ARG_STR;
+    } else if (conv == 'p') {
+        s->kind = ARG_PTR;
+    } else {
+        s->kind = ARG_BAD; /* %n, wide characters, or unknown */
+    }
+    if (s->kind != ARG_DBL && s->len == LEN_LD) s->kind = ARG_BAD;
+    return s->end;
+}
+
+static uint64_t pull_arg(const log_spec_t *s, va_list *ap) {
+    switch (s->kind) {
+    case ARG_INT:
+        switch (s->len) {
+        case LEN_HH:
+            return (uint64_t)(int64_t)(signed char)va_arg(*ap, int);
+        case LEN_H:
+            return (uint64_t)(int64_t)(short)va_arg(*ap, int);
+        case LEN_L:
+            return (uint64_t)(int64_t)va_arg(*ap, long);
+        case LEN_LL:
+            return (uint64_t)va_arg(*ap, long long);
+        case LEN_Z:
+            return (uint64_t)va_arg(*ap, size_t); /* The signed type of size_t */
+        case LEN_J:
+            return (uint64_t)va_arg(*ap, intmax_t);
+        case LEN_T:
+            return (uint64_t)va_arg(*ap, ptrdiff_t);
+        default:
+            return (uint64_t)(int64_t)va_arg(*ap, int);
+        }
+    case ARG_UINT:
+        switch (s->len) {
+        case LEN_HH:
+            return (unsigned char)va_arg(*ap, unsigned int);
+        case LEN_H:
+            return (unsigned short)va_arg(*ap, unsigned int);
+        case LEN_L:
+            return va_arg(*ap, unsigned long);
+        case LEN_LL:
+            return va_arg(*ap, unsigned long long);
+        case LEN_Z:
+            return va_arg(*ap, size_t);
+        case LEN_J:
+            return va_arg(*ap, uintmax_t);
+        case LEN_T:
+            return (uint64_t)va_arg(*ap, ptrdiff_t);
+        default:
+            return va_arg(*ap, unsigned int);
+        }
+    case ARG_DBL: {
+        double d = s->len == LEN_LD ? (double)va_arg(*ap, long double) : va_arg(*ap, double);
+        uint64_t v;
+        memcpy(&v, &d, sizeof(v));
+        return v;
+    }
+    case ARG_PTR:
+        return (uint64_t)(uintptr_t)va_arg(*ap, void *);
+    default:
+        return 0;
+    }
+}
+
+/* Copy a %s argument into the record; returns its offset in data. */
+static uint64_t store_string(log_record_t *rec, const char *str) {
+    if (!str) str = "(null)";
+    size_t room = sizeof(rec->data) - rec->used;
+    if (room == 0) return sizeof(rec->data) - 1; /* The previous string's NUL */
+
+    size_t n = strnlen(str, room - 1);
+    memcpy(rec->data + rec->used, str, n);
+    rec->data[rec->used + n] = '\0';
+    uint64_t off = rec->used;
+    rec->used = (uint16_t)(rec->used + n + 1);
+    return off;
+}
+
+/* Take the arguments of `fmt` out of `ap` into `rec`. Returns false if they don't fit. */
+static bool encode_args(log_record_t *rec, const char *fmt, va_list ap) {
+    va_list aq;
+    va_copy(aq, ap);
+    bool ok = true;
+
+    for (const char *p = strchr(fmt, '%'); p && ok; p = strchr(p, '%')) {
+        log_spec_t s;
+        p = spec_parse(p, &s);
+        if (s.kind == ARG_PCT) continue;
+        if (s.kind == ARG_BAD || rec->nargs + s.stars + 1 > LOG_MAX_ARGS) {
+            ok = false;
+            break;
+        }
+        for (int i = 0; i < s.stars; i++) {
+            rec->args[rec->nargs++] = (uint64_t)(int64_t)va_arg(aq, int);
+        }
+        rec->args[rec->nargs++] = s.kind == ARG_STR ? store_string(rec, va_arg(aq, const char *))
+                                                    : pull_arg(&s, &aq);
+    }
+    va_end(aq);
+    return ok;
+}
+
+static log_record_t *ring_reserve(log_ring_t *r, size_t *head) {
+    *head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (*head - tail >= LOG_RING_SLOTS) {
+        /* Only the owner writes it: no RMW needed. */
+        uint64_t d = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+        atomic_store_explicit(&r->dropped, d + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    log_record_t *rec = &r->slots[*head & LOG_RING_MASK];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    rec->time = (int64_t)ts.tv_sec;
+    rec->nargs = 0;
+    rec->used = 0;
+    return rec;
+}
+
+static void ring_commit(log_ring_t *r, size_t head) {
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+static void ring_put_msg(log_ring_t *r, log_level_t level, const char *fmt, va_list ap) {
+    size_t head;
+    log_record_t *rec = ring_reserve(r, &head);
+    if (!rec) return;
+
+    rec->fmt = fmt;
+    rec->level = (uint8_t)level;
+    rec->kind = REC_MSG;
+    if (!encode_args(rec, fmt, ap)) {
+        rec->kind = REC_TEXT;
+        vsnprintf(rec->data, sizeof(rec->data), fmt, ap);
+    }
+    ring_commit(r, head);
+}
+
+static void ring_put_hex(log_ring_t *r, log_level_t level, const void *data, size_t len) {
+    size_t head;
+    log_record_t *rec = ring_reserve(r, &head);
+    if (!rec) return;
+
+    rec->level = (uint8_t)level;
+    rec->kind = REC_HEX;
+    rec->args[0] = len;
+    memcpy(rec->data, data, len < sizeof(rec->data) ? len : sizeof(rec->data));
+    ring_commit(r, head);
+}
+
+/* snprintf of one conversion; the format was checked by spec_parse() on both sides. */
+static int format_one(char *out, size_t cap, const char *spec, ...) {
+    va_list ap;
+    va_start(ap, spec);
+    int n = vsnprintf(out, cap, spec, ap);
+    va_end(ap);
+    return n;
+}
+
+/* Format one conversion of `rec`, args from `*a`. */
+static int format_arg(char *out, size_t cap, const log_record_t *rec, const log_spec_t *s,
+                      unsigned int *a) {
+    /* The specification as written, with the length modifier the stored value has. */
+    char spec[32];
+    size_t head = (size_t)(s->mods - s->start);
+    if (head + 4 > sizeof(spec)) return 0;
+    memcpy(spec, s->start, head);
+    char conv = s->end[-1];
+    bool wide = (s->kind == ARG_INT || s->kind == ARG_UINT) && conv != 'c';
+    snprintf(spec + head, sizeof(spec) - head, "%s%c", wide ? "ll" : "", conv);
+
+    int star[2] = {0, 0};
+    for (int i = 0; i < s->stars; i++) {
+        star[i] = (int)(int64_t)rec->args[(*a)++];
+    }
+    uint64_t v = rec->args[(*a)++];
+
+#define FORMAT_VALUE(x)                                                                 \
+    (s->stars == 0   ? format_one(out, cap, spec, x)                                    \
+     : s->stars == 1 ? format_one(out, cap, spec, star[0], x)                           \
+                     : format_one(out, cap, spec, star[0], star[1], x))
+
+    switch (s->kind) {
+    case ARG_INT:
+        if (!wide) return FORMAT_VALUE((int)(int64_t)v);
+        return FORMAT_VALUE((long long)v);
+    case ARG_UINT:
+        return FORMAT_VALUE((unsigned long long)v);
+    case ARG_DBL: {
+        double d;
+        memcpy(&d, &v, sizeof(d));
+        return FORMAT_VALUE(d);
+    }
+    case ARG_STR:
+        return FORMAT_VALUE(rec->data + v);
+    case ARG_PTR:
+        return FORMAT_VALUE((void *)(uintptr_t)v);
+    default:
+        return 0;
+    }
+#undef FORMAT_VALUE
+}
+
+/* The message text of a REC_MSG or REC_TEXT record. */
+static void format_record(const log_record_t *rec, char *out, size_t cap) {
+    if (rec->kind == REC_TEXT) {
+        snprintf(out, cap, "%s", rec->data);
+        return;
+    }
+
+    size_t pos = 0;
+    unsigned int a = 0;
+    const char *p = rec->fmt;
+    while (*p && pos + 1 < cap) {
+        if (*p != '%') {
+            out[pos++] = *p++;
+            continue;
+        }
+        log_spec_t s;
+        p = spec_parse(p, &s);
+        if (s.kind == ARG_PCT) {
+            out[pos++] = '%';
+            continue;
+        }
+        int n = format_arg(out + pos, cap - pos, rec, &s, &a);
+        if (n > 0) pos += (size_t)n < cap - pos ? (size_t)n : cap - pos - 1;
+    }
+    out[pos] = '\0';
+}
+
+typedef struct {
+    char buf[LOG_DRAIN_BUF];
+    size_t len;
+    int64_t tsec; /* Second `tbuf` shows */
+    char tbuf[32];
+} drain_buf_t;
+
+static void drain_flush(drain_buf_t *d) {
+    if (d->len == 0) return;
+    fwrite(d->buf, 1, d->len, output());
+    fflush(output());
+    d->len = 0;
+}
+
+static void drain_put(drain_buf_t *d, const char *s) {
+    size_t n = strlen(s);
+    if (d->len + n > sizeof(d->buf)) drain_flush(d);
+    if (n > sizeof(d->buf)) n = sizeof(d->buf);
+    memcpy(d->buf + d->len, s, n);
+    d->len += n;
+}
+
+static void drain_line(drain_buf_t *d, int64_t t, log_level_t level, const char *msg) {
+    if (t != d->tsec) {
+        format_time((time_t)t, d->tbuf, sizeof(d->tbuf));
+        d->tsec = t;
+    }
+    char line[1024];
+    snprintf(line, sizeof(line), "%s [%s] %s\n", d->tbuf, level_to_string(level), msg);
+    drain_put(d, line);
+}
+
+static void drain_record(drain_buf_t *d, const log_record_t *rec) {
+    if (rec->kind == REC_HEX) {
+        size_t len = (size_t)rec->args[0];
+        size_t shown = len < sizeof(rec->data) ? len : sizeof(rec->data);
+        char line[128];
+        for (size_t i = 0; i < shown; i += 16) {
+            hexdump_line(line, sizeof(line), (const unsigned char *)rec->data, i, shown);
+            drain_put(d, line);
+        }
+        if (shown < len) {
+            snprintf(line, sizeof(line), "....  (%zu more bytes)\n", len - shown);
+            drain_put(d, line);
+        }
+        return;
+    }
+
+    char msg[768];
+    format_record(rec, msg, sizeof(msg));
+    drain_line(d, rec->time, (log_level_t)rec->level, msg);
+}
+
+/* Format every queued record. Returns how many there were. */
+static size_t drain_pass(drain_buf_t *d) {
+    size_t n = 0;
+    uint64_t dropped = 0;
+
+    pthread_mutex_lock(&g_rings_lock);
+    for (log_ring_t *r = g_rings; r; r = r->next) {
+        size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        for (; tail != head; tail++, n++) {
+            drain_record(d, &r->slots[tail & LOG_RING_MASK]);
+            /* Hand the slot back at once: a busy producer should not see the ring full. */
+            atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+        }
+        dropped += atomic_load_explicit(&r->dropped, memory_order_relaxed);
+    }
+
+    if (dropped > g_dropped_reported) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "log: %llu messages dropped (ring full)",
+                 (unsigned long long)(dropped - g_dropped_reported));
+        g_dropped_reported = dropped;
+        drain_line(d, (int64_t)time(NULL), LOG_WARN, msg);
+    }
+    pthread_mutex_unlock(&g_rings_lock);
+
+    drain_flush(d);
+    return n;
+}
+
+static void *drain_thread_func(void *arg) {
+    drain_buf_t *d = (drain_buf_t *)arg;
+    while (atomic_load_explicit(&g_running, memory_order_acquire)) {
+        if (drain_pass(d) == 0) {
+            struct timespec ts = {.tv_sec = 0, .tv_nsec = LOG_DRAIN_INTERVAL_NS};
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+static drain_buf_t *g_drain;
+
+int log_async_start(void) {
+    if (atomic_load(&g_running)) return -1;
+
+    g_drain = calloc(1, sizeof(*g_drain));
+    if (!g_drain) return -1;
+    g_drain->tsec = -1;
+
+    atomic_store(&g_running, true);
+    if (pthread_create(&g_drain_th, NULL, drain_thread_func, g_drain) != 0) {
+        atomic_store(&g_running, false);
+        free(g_drain);
+        g_drain = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void log_async_stop(void) {
+    if (!atomic_load(&g_running)) return;
+
+    atomic_store(&g_running, false);
+    pthread_join(g_drain_th, NULL);
+    t_ring = NULL;
+    drain_pass(g_drain);
+
+    pthread_mutex_lock(&g_rings_lock);
+    while (g_rings) {
+        log_ring_t *r = g_rings;
+        g_rings = r->next;
+        free(r);
+    }
+    g_dropped_reported = 0;
+    pthread_mutex_unlock(&g_rings_lock);
+
+    free(g_drain);
+    g_drain = NULL;
+}
+
+int log_thread_attach(void) {
+    if (t_ring) return 0;
+    if (!atomic_load(&g_running)) return 0;
+
+    log_ring_t *r = aligned_alloc(LOG_CACHE_LINE, sizeof(log_ring_t));
+    if (!r) return -1;
+    memset(r, 0, sizeof(*r));
+
+    pthread_mutex_lock(&g_rings_lock);
+    r->next = g_rings;
+    g_rings = r;
+    pthread_mutex_unlock(&g_rings_lock);
+
+    t_ring = r;
+    return 0;
+}
+
+uint64_t log_dropped(void) {
+    uint64_t dropped = 0;
+    pthread_mutex_lock(&g_rings_lock);
+    for (log_ring_t *r = g_rings; r; r = r->next) {
+        dropped += atomic_load_explicit(&r->dropped, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&g_rings_lock);
+    return dropped;
+}
+
+bool log_ratelimit(log_ratelimit_t *rl, uint32_t now, log_level_t level, const char *fmt) {
+    if (now != rl->second) {
+        uint32_t suppressed = rl->suppressed;
+        rl->second = now;
+        rl->count = 0;
+        rl->suppressed = 0;
+        if (suppressed > 0) log_msg(level, "Suppressed %u messages like: %s", suppressed, fmt);
+    }
+    if (rl->count < LOG_RATELIMIT_BURST) {
+        rl->count++;
+        return true;
+    }
+    rl->suppressed++;
+    return false;
+}
+
+uint32_t log_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t)ts.tv_sec;
+}
+
+/* === Synchronous logging, and the entry points === */
+
 void log_msg(log_level_t level, const char *fmt, ...) {
     if (level > g_level) {
         return;
     }
 
-    /* Timestamp */
-    time_t now = time(NULL);
-    struct tm tm_now;
-    localtime_r(&now, &tm_now);
+    va_list ap;
+    va_start(ap, fmt);
+    if (t_ring) {
+        ring_put_msg(t_ring, level, fmt, ap);
+        va_end(ap);
+        return;
+    }
 
+    /* Timestamp */
     char tbuf[32];
-    strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", &tm_now);
+    format_time(time(NULL), tbuf, sizeof(tbuf));
+
+    /* One locked stream: lines of the drain thread don't cut in. */
+    FILE *out = output();
+    flockfile(out);
 
     /* Print prefix */
-    fprintf(stderr, "%s [%s] ", tbuf, level_to_string(level));
+    fprintf(out, "%s [%s] ", tbuf, level_to_string(level));
 
     /* Variadic printing */
-    va_list ap;
-    va_start(ap, fmt);
-    vfprintf(stderr, fmt, ap);
+    vfprintf(out, fmt, ap);
     va_end(ap);
 
-    fprintf(stderr, "\n");
+    fprintf(out, "\n");
+    funlockfile(out);
 }
 
 void log_hexdump(log_level_t level, const void *data, size_t len) {
@@ -55,28 +656,19 @@ void log_hexdump(log_level_t level, const void *data, size_t len) {
         return;
     }
 
+    if (t_ring) {
+        ring_put_hex(t_ring, level, data, len);
+        return;
+    }
+
     const unsigned char *p = (const unsigned char *)data;
+    FILE *out = output();
+    char line[128];
 
+    flockfile(out);
     for (size_t i = 0; i < len; i += 16) {
-        fprintf(stderr, "%04zx  ", i); /* Offset */
-
-        /* Hex bytes */
-        for (size_t j = 0; j < 16; j++) {
-            if (i + j < len)
-                fprintf(stderr, "%02x  ", p[i + j]);
-            else
-                fprintf(stderr, "    ");
-        }
-
-        /* ASCII characters */
-        fprintf(stderr, " |");
-        for (size_t j = 0; j < 16; j++) {
-            if (i + j < len) {
-                unsigned char c = p[i + j];
-                /* Print printable chars, otherwise dot */
-                fprintf(stderr, "%c", (c >= 32 && c <= 126) ? c : '.');
-            }
-        }
-        fprintf(stderr, "|\n");
+        hexdump_line(line, sizeof(line), p, i, len);
+        fputs(line, out);
     }
-}
\ No newline at end of file
+    funlockfile(out);
+}
@@ -10,17 +10,33 @@
 
 #include "affinity.h"
 #include "arp_table.h"
+#include "classifier.h"
+#include "conntrack.h"
+#include "control.h"
+#include "flow_cache.h"
 #include "latency.h"
+#include "json.h"
 #include "log.h"
+#include "metrics.h"
+#include "mirror.h"
 #include "ndp_table.h"
 #include "pktbuf.h"
+#include "policer.h"
+#include "qsbr.h"
+#include "reta.h"
 #include "ring.h"
-#include "rule_config.h"
+#include "rule_api.h"
+#include "rule_file.h"
 #include "rule_table.h"
 #include "rx.h"
 #include "tx.h"
+#include "tx_stage.h"
 #include "upe.h"
 #include "worker.h"
+#include "xsk.h"
+
+#include <net/if.h>
+#include <unistd.h>
 
 #define NEIGHBOUR_SWEEP_INTERVAL_SEC 300
 
@@ -65,11 +81,59 @@ static void install_signal_handlers(void) {
 
 static void usage(const char *prog) {
     fprintf(stderr,
-            "Usage: %s [--iface <name> | --pcap <file>] [--verbose <0..2>] [--duration <sec>]\n"
+            "Usage: %s [--iface <name> | --pcap <file>] [--rx <pcap|afpacket|xdp>]\n"
+            "          [--tx <mmsg|ring>] [--layout <ring|per-worker>] [--flow-cache <n>]\n"
+            "          [--conntrack <n>] [--pool-cache <n>] [--headroom <n>]\n"
+            "          [--idle <poll|backoff|wakeup>]\n"
+            "          [--workers <n>] [--ring-size <n>] [--pool-size <n>] [--cores <list>]\n"
+            "          [--mode <rtc|pipeline>] [--tx-stages <n>] [--stage-sample <n>]\n"
+            "          [--reply-rate <n>] [--rule-api <path>] [--perf]\n"
+            "          [--mirror <n>] [--mirror-to <file|unix:path>] [--mirror-budget <n>]\n"
+            "          [--metrics <unix:path|[host:]port>] [--verbose <0..2>] [--duration <sec>]\n"
             "\n"
             "  --iface     Network interface name (e.g., eth0)\n"
-            "  --rules     Rule config file (INI format).\n"
+            "  --rules     Rule file: INI text, or compiled by upe-rulec (mapped, no parsing)\n"
             "  --pcap      PCAP file to read from (offline mode)\n"
+            "  --rx        Live RX backend: pcap (default), afpacket (TPACKET_V3 mmap ring)\n"
+            "              or xdp (AF_XDP on queue 0, zero-copy into the packet pool)\n"
+            "  --tx        TX backend: mmsg (sendmmsg, default) or ring (PACKET_TX_RING)\n"
+            "  --layout    ring: one RX thread feeds the workers (default)\n"
+            "              per-worker: each worker owns a PACKET_FANOUT_HASH socket\n"
+            "              (--rx afpacket) or NIC queue <worker id> (--rx xdp)\n"
+            "  --flow-cache Flow cache entries per worker (0 = off, default 4096)\n"
+            "  --conntrack Connections tracked per worker (0 = off, default; up to 4194304):\n"
+            "              packets of a TCP/UDP flow admitted by a FWD rule skip the rules,\n"
+            "              replies included\n"
+            "  --pool-cache Packet buffers each thread caches (2..512, default 64)\n"
+            "  --headroom  Bytes kept free in front of each frame for pushed headers\n"
+            "              (0..1024, default 192; AF_XDP needs at least 192)\n"
+            "  --idle      Worker with nothing to do: poll (busy-poll), backoff (spin, yield,\n"
+            "              then sleep; default) or wakeup (sleep until RX signals)\n"
+            "  --workers   Worker threads (1..64, default 2)\n"
+            "  --ring-size Entries per worker ring, power of two (64..65536, default 1024)\n"
+            "  --pool-size 2 KB buffers per pool (1024..1048576, default 4096); the 256 B\n"
+            "              class gets twice as many, the 9 KB class 1/16\n"
+            "  --cores     Cores to pin to, in order: RX (ring layout), workers, TX stages,\n"
+            "              stats; e.g. 2,4-7. Default: NIC's NUMA node first\n"
+            "  --mode      rtc: each worker sends its own packets (run to completion, default)\n"
+            "              pipeline: workers hand them to TX stage threads over rings\n"
+            "  --tx-stages TX stage threads in pipeline mode (1..workers, default 1)\n"
+            "  --stage-sample Time one worker burst in n per stage: RX batching, ring,\n"
+            "              parse, classify, neighbour lookup, TX (0 = off, default 64)\n"
+            "  --reply-rate ARP replies per second the control plane sends at most\n"
+            "              (0 = no limit, default 1000)\n"
+            "  --rule-api  UNIX socket for incremental rule updates (add, modify, delete\n"
+            "              by rule id; counters of untouched rules are kept)\n"
+            "  --metrics   Serve Prometheus text (/metrics) and JSON (/metrics.json) over HTTP\n"
+            "              on a UNIX socket or TCP (host defaults to 127.0.0.1). Without a\n"
+            "              terminal, the console dashboard is then left out\n"
+            "  --mirror    Mirror 1 in n matched packets (rules: mirror = n), zero-copy\n"
+            "  --mirror-to Where mirrored packets go as pcapng: a file, or unix:<path> to\n"
+            "              stream them to a client of that socket (required for mirroring)\n"
+            "  --mirror-budget Packet buffers the mirror may hold at once; samples above\n"
+            "              are skipped (default 512)\n"
+            "  --perf      Count cycles, instructions, LLC and branch misses per worker\n"
+            "              (perf_event_open): exported, and per packet on the dashboard\n"
             "  --verbose   0=warn+error, 1=info (default), 2=debug\n"
             "  --duration  Run time in seconds (0 = forever, default 0)\n",
             prog);
@@ -91,7 +155,29 @@ static int parse_int(const char *s, int *out) {
 static int parse_args(int argc, char **argv, upe_config_t *cfg) {
     cfg->iface = NULL;
     cfg->rules_file = NULL;
+    cfg->metrics_addr = NULL;
+    cfg->rule_api_path = NULL;
+    cfg->mirror_to = NULL;
+    cfg->mirror_every = 0;
+    cfg->mirror_budget = MIRROR_BUDGET_DEFAULT;
     cfg->pcap_file = NULL;
+    cfg->rx_mode = RX_MODE_PCAP;
+    cfg->tx_ring = false;
+    cfg->per_worker_rx = false;
+    cfg->flow_cache_entries = FLOW_CACHE_DEFAULT_ENTRIES;
+    cfg->conntrack_entries = 0;
+    cfg->perf = false;
+    cfg->pool_cache = PKTBUF_CACHE_DEFAULT;
+    cfg->headroom = PKTBUF_HEADROOM;
+    cfg->idle_mode = IDLE_MODE_BACKOFF;
+    cfg->stage_sample = WORKER_STAGE_SAMPLE_DEFAULT;
+    cfg->reply_rate = CONTROL_REPLY_RATE_DEFAULT;
+    cfg->workers = UPE_WORKERS_DEFAULT;
+    cfg->ring_size = UPE_RING_SIZE_DEFAULT;
+    cfg->pool_size = UPE_POOL_SIZE_DEFAULT;
+    cfg->pipeline = false;
+    cfg->tx_stages = 1;
+    cfg->core_count = 0;
     cfg->verbose = 1;
     cfg->duration_sec = 0;
 
@@ -104,9 +190,150 @@ static int parse_args(int argc, char **argv, upe_config_t *cfg) {
         } else if (strcmp(arg, "--rules") == 0) {
             if (i + 1 >= argc) return -1;
             cfg->rules_file = argv[++i];
+        } else if (strcmp(arg, "--metrics") == 0) {
+            if (i + 1 >= argc) return -1;
+            cfg->metrics_addr = argv[++i];
+        } else if (strcmp(arg, "--rule-api") == 0) {
+            if (i + 1 >= argc) return -1;
+            cfg->rule_api_path = argv[++i];
+        } else if (strcmp(arg, "--mirror") == 0) {
+            if (i + 1 >= argc) return -1;
+            int n = 0;
+            if (parse_int(argv[++i], &n) != 0) return -1;
+            if (n < 1) return -1;
+            cfg->mirror_every = (uint32_t)n;
+        } else if (strcmp(arg, "--mirror-to") == 0) {
+            if (i + 1 >= argc) return -1;
+            cfg->mirror_to = argv[++i];
+        } else if (strcmp(arg, "--mirror-budget") == 0) {
+            if (i + 1 >= argc) return -1;
+            int n = 0;
+            if (parse_int(argv[++i], &n) != 0) return -1;
+            if (n < 1) return -1;
+            cfg->mirror_budget = (uint32_t)n;
         } else if (strcmp(arg, "--pcap") == 0) {
             if (i + 1 >= argc) return -1;
             cfg->pcap_file = argv[++i];
+        } else if (strcmp(arg, "--rx") == 0) {
+            if (i + 1 >= argc) return -1;
+            const char *mode = argv[++i];
+            if (strcmp(mode, "pcap") == 0) {
+                cfg->rx_mode = RX_MODE_PCAP;
+            } else if (strcmp(mode, "afpacket") == 0) {
+                cfg->rx_mode = RX_MODE_AFPACKET;
+            } else if (strcmp(mode, "xdp") == 0) {
+                cfg->rx_mode = RX_MODE_XDP;
+            } else {
+                return -1;
+            }
+        } else if (strcmp(arg, "--stage-sample") == 0) {
+            if (i + 1 >= argc) return -1;
+            int n = 0;
+            if (parse_int(argv[++i], &n) != 0) return -1;
+            if (n < 0) return -1;
+            cfg->stage_sample = (uint32_t)n;
+        } else if (strcmp(arg, "--reply-rate") == 0) {
+            if (i + 1 >= argc) return -1;
+            int n = 0;
+            if (parse_int(argv[++i], &n) != 0) return -1;
+            if (n < 0) return -1;
+            cfg->reply_rate = (uint32_t)n;
+        } else if (strcmp(arg, "--idle") == 0) {
+            if (i + 1 >= argc) return -1;
+            const char *mode = argv[++i];
+            if (strcmp(mode, "poll") == 0) {
+                cfg->idle_mode = IDLE_MODE_POLL;
+            } else if (strcmp(mode, "backoff") == 0) {
+                cfg->idle_mode = IDLE_MODE_BACKOFF;
+            } else if (strcmp(mode, "wakeup") == 0) {
+                cfg->idle_mode = IDLE_MODE_WAKEUP;
+            } else {
+                return -1;
+            }
+        } else if (strcmp(arg, "--tx") == 0) {
+            if (i + 1 >= argc) return -1;
+            const char *mode = argv[++i];
+            if (strcmp(mode, "mmsg") == 0) {
+                cfg->tx_ring = false;
+            } else if (strcmp(mode, "ring") == 0) {
+                cfg->tx_ring = true;
+            } else {
+                return -1;
+            }
+        } else if (strcmp(arg, "--layout") == 0) {
+            if (i + 1 >= argc) return -1;
+            const char *layout = argv[++i];
+            if (strcmp(layout, "ring") == 0) {
+                cfg->per_worker_rx = false;
+            } else if (strcmp(layout, "per-worker") == 0) {
+                cfg->per_worker_rx = true;
+            } else {
+                return -1;
+            }
+        } else if (strcmp(arg, "--flow-cache") == 0) {
+            if (i + 1 >= argc) return -1;
+            int n = 0;
+            if (parse_int(argv[++i], &n) != 0) return -1;
+            if (n < 0) return -1;
+            cfg->flow_cache_entries = (size_t)n;
+        } else if (strcmp(arg, "--conntrack") == 0) {
+            if (i + 1 >= argc) return -1;
+            int n = 0;
+            if (parse_int(argv[++i], &n) != 0) return -1;
+            if (n < 0 || n > CONNTRACK_ENTRIES_MAX) return -1;
+            cfg->conntrack_entries = (size_t)n;
+        } else if (strcmp(arg, "--pool-cache") == 0) {
+            if (i + 1 >= argc) return -1;
+            int n = 0;
+            if (parse_int(argv[++i], &n) != 0) return -1;
+            if (n < 2 || n > PKTBUF_CACHE_MAX) return -1;
+            cfg->pool_cache = (size_t)n;
+        } else if (strcmp(arg, "--headroom") == 0) {
+            if (i + 1 >= argc) return -1;
+            int n = 0;
+            if (parse_int(argv[++i], &n) != 0) return -1;
+            if (n < 0 || n > PKTBUF_HEADROOM_MAX) return -1;
+            cfg->headroom = (uint16_t)n;
+        } else if (strcmp(arg, "--workers") == 0) {
+            if (i + 1 >= argc) return -1;
+            int n = 0;
+            if (parse_int(argv[++i], &n) != 0) return -1;
+            if (n < 1 || n > UPE_WORKERS_MAX) return -1;
+            cfg->workers = n;
+        } else if (strcmp(arg, "--ring-size") == 0) {
+            if (i + 1 >= argc) return -1;
+            int n = 0;
+            if (parse_int(argv[++i], &n) != 0) return -1;
+            if (n < 64 || n > UPE_RING_SIZE_MAX || (n & (n - 1)) != 0) return -1;
+            cfg->ring_size = (size_t)n;
+        } else if (strcmp(arg, "--pool-size") == 0) {
+            if (i + 1 >= argc) return -1;
+            int n = 0;
+            if (parse_int(argv[++i], &n) != 0) return -1;
+            if (n < 1024 || n > UPE_POOL_SIZE_MAX) return -1;
+            cfg->pool_size = (size_t)n;
+        } else if (strcmp(arg, "--cores") == 0) {
+            if (i + 1 >= argc) return -1;
+            cfg->core_count = affinity_parse_core_list(argv[++i], cfg->cores, UPE_CORES_MAX);
+            if (cfg->core_count < 0) return -1;
+        } else if (strcmp(arg, "--mode") == 0) {
+            if (i + 1 >= argc) return -1;
+            const char *mode = argv[++i];
+            if (strcmp(mode, "rtc") == 0) {
+                cfg->pipeline = false;
+            } else if (strcmp(mode, "pipeline") == 0) {
+                cfg->pipeline = true;
+            } else {
+                return -1;
+            }
+        } else if (strcmp(arg, "--tx-stages") == 0) {
+            if (i + 1 >= argc) return -1;
+            int n = 0;
+            if (parse_int(argv[++i], &n) != 0) return -1;
+            if (n < 1 || n > UPE_WORKERS_MAX) return -1;
+            cfg->tx_stages = n;
+        } else if (strcmp(arg, "--perf") == 0) {
+            cfg->perf = true;
         } else if (strcmp(arg, "--verbose") == 0) {
             if (i + 1 >= argc) return -1;
             int v = 0;
@@ -129,6 +356,26 @@ static int parse_args(int argc, char **argv, upe_config_t *cfg) {
     if (cfg->iface == NULL && cfg->pcap_file == NULL) {
         return -1;
     }
+    /* Offline replay is only supported by libpcap. */
+    if (cfg->pcap_file && cfg->rx_mode != RX_MODE_PCAP) {
+        return -1;
+    }
+    /* Per-worker sources need a backend that can be split across sockets. */
+    if (cfg->per_worker_rx && (cfg->rx_mode == RX_MODE_PCAP || !cfg->iface)) {
+        return -1;
+    }
+    /* Sampling with nowhere to write the samples to. */
+    if (cfg->mirror_every && !cfg->mirror_to) {
+        return -1;
+    }
+    /* A stage with no worker to serve would only spin. */
+    if (cfg->pipeline && cfg->tx_stages > cfg->workers) {
+        return -1;
+    }
+    /* Per-worker AF_XDP transmits zero-copy through the worker's own socket. */
+    if (cfg->pipeline && cfg->per_worker_rx && cfg->rx_mode == RX_MODE_XDP) {
+        return -1;
+    }
     return 0;
 }
 
@@ -140,50 +387,812 @@ static log_level_t verbosity_to_level(int verbose) {
     return LOG_DEBUG;
 }
 
-static int assign_cores(int num_workers, int *rx_core, int *worker_cores, int *stats_core) {
-    int total_cores = affinity_get_num_cores();
-    int required_cores = 1 + num_workers + 1; /* RX + Workers + Stats */
+/*
+    Topology-aware placement. Cores are ordered home node first (the node of
+    the NIC, or node 0), then the other nodes:
+        - RX (ring layout only), the workers and the TX stages (pipeline mode)
+          take the first cores, so the datapath stays on the NIC's node while
+          it has cores left.
+        - Stats takes the last core of that order: on a multi-node box one of
+          another node, away from the datapath.
+    With --cores the order is the given list instead.
+    Without enough cores every thread runs unpinned (core -1).
+        Returns 0 if successful (pinned or not), -1 if --cores can't be used.
+*/
+static int assign_cores(const upe_config_t *cfg, int home_node, int *rx_core, int *worker_cores,
+                        int *stage_cores, int *stats_core) {
+    int num_workers = cfg->workers;
+    int num_stages = cfg->pipeline ? cfg->tx_stages : 0;
+    int num_rx = cfg->per_worker_rx ? 0 : 1;
+    int required_cores = num_rx + num_workers + num_stages + 1; /* + Stats */
+
+    *rx_core = -1;
+    *stats_core = -1;
+    for (int i = 0; i < num_workers; i++) {
+        worker_cores[i] = -1;
+    }
+    for (int i = 0; i < num_stages; i++) {
+        stage_cores[i] = -1;
+    }
 
-    if (total_cores < required_cores) {
+    int total_cores = affinity_get_num_cores();
+    if (cfg->core_count > 0) {
+        if (cfg->core_count < required_cores) {
+            log_msg(LOG_ERROR,
+                    "--cores lists %d cores, need %d (%d RX + %d workers + %d TX stages + 1 stats)",
+                    cfg->core_count, required_cores, num_rx, num_workers, num_stages);
+            return -1;
+        }
+        for (int i = 0; i < cfg->core_count; i++) {
+            if (cfg->cores[i] >= total_cores) {
+                log_msg(LOG_ERROR, "--cores: core %d does not exist (%d cores online)",
+                        cfg->cores[i], total_cores);
+                return -1;
+            }
+        }
+    } else if (total_cores < required_cores) {
         log_msg(LOG_WARN,
-                "Not enough cores for affinity: need %d (1 RX + %d workers + 1 stats), have %d. "
-                "Running without CPU pinning (performance may suffer).",
-                required_cores, num_workers, total_cores);
-
-        /* Disable affinity by setting all cores to -1. */
-        *rx_core = -1;
-        *stats_core = -1;
-        for (int i = 0; i < num_workers; i++) {
-            worker_cores[i] = -1;
+                "Not enough cores for affinity: need %d (%d RX + %d workers + %d TX stages + 1 "
+                "stats), have %d. Running without CPU pinning (performance may suffer).",
+                required_cores, num_rx, num_workers, num_stages, total_cores);
+        return 0;
+    }
+
+    const int *order = cfg->cores;
+    int n = cfg->core_count;
+    int *topo = NULL;
+    if (n == 0) {
+        topo = malloc((size_t)total_cores * sizeof(int));
+        if (!topo) return 0;
+        for (int c = 0; c < total_cores; c++) {
+            if (affinity_core_node(c) == home_node) topo[n++] = c;
         }
-        return -1;
+        for (int c = 0; c < total_cores; c++) {
+            if (affinity_core_node(c) != home_node) topo[n++] = c;
+        }
+        order = topo;
     }
 
     /* Assign cores. */
-    *rx_core = 0;
+    int next = 0;
+    if (num_rx) *rx_core = order[next++];
     for (int i = 0; i < num_workers; i++) {
-        worker_cores[i] = 1 + i;
+        worker_cores[i] = order[next++];
+    }
+    for (int i = 0; i < num_stages; i++) {
+        stage_cores[i] = order[next++];
     }
-    *stats_core = 1 + num_workers;
+    *stats_core = order[n - 1];
+    free(topo);
 
-    log_msg(LOG_INFO, "CPU affinity enabled: %d cores available", total_cores);
-    log_msg(LOG_INFO, " RX      core %d", *rx_core);
-    log_msg(LOG_INFO, " Workers cores: %d-%d", worker_cores[0], worker_cores[num_workers - 1]);
-    log_msg(LOG_INFO, " Stats    core %d", *stats_core);
+    log_msg(LOG_INFO, "CPU affinity enabled: %d cores available, home NUMA node %d", total_cores,
+            home_node);
+    if (num_rx) {
+        log_msg(LOG_INFO, " RX      core %d (node %d)", *rx_core, affinity_core_node(*rx_core));
+    }
+    for (int i = 0; i < num_workers; i++) {
+        log_msg(LOG_INFO, " Worker %d core %d (node %d)", i, worker_cores[i],
+                affinity_core_node(worker_cores[i]));
+    }
+    for (int i = 0; i < num_stages; i++) {
+        log_msg(LOG_INFO, " TX stage %d core %d (node %d)", i, stage_cores[i],
+                affinity_core_node(stage_cores[i]));
+    }
+    log_msg(LOG_INFO, " Stats    core %d (node %d)", *stats_core, affinity_core_node(*stats_core));
 
     return 0;
 }
 
+/*
+    Open one RX source per worker for the per-worker layout.
+        - afpacket: all sockets join one PACKET_FANOUT_HASH group.
+        - xdp: worker i gets NIC queue i; one XDP program serves all queues.
+      Its UMEM is the standard-class pool of the worker's node, `pools[i]`.
+    Returns 0 on success, -1 on error.
+*/
+static int open_worker_rx_sources(const upe_config_t *cfg, worker_rx_src_t *srcs, int count,
+                                  pktbuf_classes_t *const *pools, xdp_prog_t *prog) {
+    if (cfg->rx_mode == RX_MODE_XDP) {
+        if (xdp_prog_attach(prog, cfg->iface) != 0) return -1;
+    }
+
+    int fanout_group = (int)(getpid() & 0xffff);
+
+    for (int i = 0; i < count; i++) {
+        srcs[i].mode = cfg->rx_mode;
+
+        if (cfg->rx_mode == RX_MODE_XDP) {
+            pktbuf_pool_t *umem = &pools[i]->pool[PKTBUF_CLASS_STD];
+            if (xsk_open(&srcs[i].xsk, cfg->iface, (uint32_t)i, umem) != 0) return -1;
+            if (xdp_prog_add_xsk(prog, &srcs[i].xsk) != 0) return -1;
+        } else {
+            if (rx_afpacket_open(&srcs[i].afp, cfg->iface, fanout_group) != 0) return -1;
+        }
+    }
+
+    log_msg(LOG_INFO, "Per-worker RX on %s: %d %s", cfg->iface, count,
+            cfg->rx_mode == RX_MODE_XDP ? "AF_XDP queues" : "AF_PACKET fanout sockets");
+    return 0;
+}
+
 typedef struct {
     worker_t *workers;
     int num_workers;
-    const rule_table_t *rt;
+    rule_table_t *rt;
     int core_id;
     const char *rules_file;
+    rule_api_t *rule_api; /* NULL: no incremental updates */
+    /* Counters of the stats arrays a rule update retired, by rule id, added to
+     * the workers' (rt->capacity entries). NULL: none. */
+    rule_stat_t *rule_base;
     arp_table_t *arpt;
     ndp_table_t *ndpt;
+    qsbr_t *qsbr; /* Grace periods for rule reloads */
+    reta_t *reta; /* NULL: per-worker layout, nothing to rebalance */
+    spsc_ring_t *rings;
+    tx_stage_t *stages; /* Pipeline mode, else NULL */
+    const control_plane_t *control;
+    const mirror_t *mirror; /* NULL: no mirror */
+    int num_stages;
+    pktbuf_classes_t *pools; /* One set per NUMA node, in use if pool_ready[node] */
+    const bool *pool_ready;
+    int numa_nodes;
+    metrics_server_t *metrics; /* NULL: no export */
+    bool dashboard;            /* Print the console dashboard every tick */
+    double tsc_hz;             /* For the policers */
+    bool perf;                 /* Workers count hardware events, see worker_read_perf() */
 } stats_ctx_t;
 
+/*
+    Egress interfaces of the FWD rules other than `dflt`, each once, in rule
+    order: the extra TX ports every worker gets. Returns how many (at most `max`).
+*/
+static size_t egress_ifaces(const rule_table_t *rt, int dflt, int *out, size_t max) {
+    size_t n = 0;
+    for (size_t i = 0; i < rt->count; i++) {
+        const flow_action_t *a = &rt->rules[i].action;
+        if (a->type != ACT_FWD || a->out_ifindex == dflt) continue;
+
+        bool seen = false;
+        for (size_t k = 0; k < n && !seen; k++) seen = out[k] == a->out_ifindex;
+        if (seen) continue;
+        if (n == max) {
+            log_msg(LOG_WARN, "Rule %u: more than %d egress interfaces, ifindex %d uses the "
+                              "default one", rt->rules[i].rule_id, WORKER_TX_MAX_PORTS,
+                    a->out_ifindex);
+            continue;
+        }
+        out[n++] = a->out_ifindex;
+    }
+    return n;
+}
+
+/* Ports are fixed at start-up: say which reloaded rules fall back to the default one. */
+static void warn_missing_egress(const worker_t *w, const rule_table_t *rt) {
+    for (size_t i = 0; i < rt->count; i++) {
+        const flow_action_t *a = &rt->rules[i].action;
+        if (a->type != ACT_FWD || a->out_ifindex == w->tx_ifindex[0]) continue;
+        if (worker_tx_port(w, a->out_ifindex) == 0) {
+            log_msg(LOG_WARN, "Rule reload: rule %u sends to ifindex %d, which had no rule at "
+                              "start-up; using the default interface (restart to add it)",
+                    rt->rules[i].rule_id, a->out_ifindex);
+        }
+    }
+}
+
+static uint64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    if (clock_gettime(clock, &ts) != 0) return 0;
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Sum of one rule's counters over all workers. Only the stats thread replaces
+ * `rules`, so the stats arrays belong to ctx->rt. */
+static void rule_totals(const stats_ctx_t *ctx, uint32_t rid, rule_stat_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (int w = 0; w < ctx->num_workers; w++) {
+        const worker_rules_t *wr =
+            atomic_load_explicit(&ctx->workers[w].rules, memory_order_relaxed);
+        out->packets += wr->stats[rid].packets;
+        out->bytes += wr->stats[rid].bytes;
+        out->conform += wr->stats[rid].conform;
+        out->exceed += wr->stats[rid].exceed;
+    }
+    if (ctx->rule_base) {
+        out->packets += ctx->rule_base[rid].packets;
+        out->bytes += ctx->rule_base[rid].bytes;
+        out->conform += ctx->rule_base[rid].conform;
+        out->exceed += ctx->rule_base[rid].exceed;
+    }
+}
+
+/*
+    Give every worker its share of each policed rule of `rt` (rules[w] is
+    worker w's stats array), by the bytes each one matched since the last
+    call: the rate follows the traffic, while the total stays the rule's.
+*/
+static void configure_policers(const rule_table_t *rt, worker_rules_t *const *rules, int workers,
+                               double tsc_hz) {
+    uint64_t demand[UPE_WORKERS_MAX];
+    uint64_t share[UPE_WORKERS_MAX];
+
+    for (size_t i = 0; i < rt->count; i++) {
+        const rule_t *r = &rt->rules[i];
+        if (!r->action.rate) continue;
+
+        for (int w = 0; w < workers; w++) {
+            rule_stat_t *st = &rules[w]->stats[r->rule_id];
+            uint64_t bytes = st->bytes;
+            demand[w] = bytes - st->policer.mark;
+            st->policer.mark = bytes;
+        }
+        policer_split(r->action.rate, demand, (unsigned int)workers, share);
+        for (int w = 0; w < workers; w++) {
+            uint64_t burst =
+                (uint64_t)((double)r->action.burst * (double)share[w] / (double)r->action.rate);
+            policer_configure(&rules[w]->stats[r->rule_id].policer, share[w], burst, tsc_hz);
+        }
+    }
+}
+
+/* Dataplane latency over all workers (stage < 0), or of one stage. */
+static void merge_latency(const stats_ctx_t *ctx, int stage, latency_histogram_t *out) {
+    latency_histogram_init(out);
+    for (int w = 0; w < ctx->num_workers; w++) {
+        latency_histogram_merge(out, stage < 0 ? &ctx->workers[w].latency_hist
+                                               : &ctx->workers[w].stage_hist[stage]);
+    }
+}
+
+static const double metrics_quantiles[] = {0.5, 0.99, 0.999, 0.9999};
+#define METRICS_QUANTILES (sizeof(metrics_quantiles) / sizeof(metrics_quantiles[0]))
+
+static void prom_header(FILE *f, const char *name, const char *type, const char *help) {
+    fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Quantiles, sum and count of a summary; `labels` is "" or `key="value",`. */
+static void prom_summary(FILE *f, const char *name, const char *labels,
+                         const latency_histogram_t *h) {
+    for (size_t q = 0; q < METRICS_QUANTILES; q++) {
+        fprintf(f, "%s{%squantile=\"%g\"} %lu\n", name, labels, metrics_quantiles[q],
+                (unsigned long)latency_percentile(h, metrics_quantiles[q]));
+    }
+    /* The labels again without their trailing comma, if any */
+    char tail[64] = "";
+    size_t len = strlen(labels);
+    if (len > 0) snprintf(tail, sizeof(tail), "{%.*s}", (int)(len - 1), labels);
+    fprintf(f, "%s_sum%s %lu\n", name, tail, (unsigned long)h->sum_ns);
+    fprintf(f, "%s_count%s %lu\n", name, tail, (unsigned long)h->total_count);
+}
+
+static void write_prometheus(FILE *f, const stats_ctx_t *ctx) {
+    static const char *const pkt_names[] = {"in", "parsed", "matched", "forwarded", "dropped"};
+
+    prom_header(f, "upe_worker_packets_total", "counter", "Packets per worker and step");
+    for (int w = 0; w < ctx->num_workers; w++) {
+        worker_counters_t c;
+        worker_read_counters(&ctx->workers[w], &c);
+        const uint64_t v[] = {c.pkts_in, c.pkts_parsed, c.pkts_matched, c.pkts_forwarded,
+                              c.pkts_dropped};
+        for (size_t i = 0; i < sizeof(v) / sizeof(v[0]); i++) {
+            fprintf(f, "upe_worker_packets_total{worker=\"%d\",step=\"%s\"} %lu\n", w,
+                    pkt_names[i], (unsigned long)v[i]);
+        }
+    }
+
+    prom_header(f, "upe_worker_flow_cache_total", "counter", "Flow cache lookups and evictions");
+    for (int w = 0; w < ctx->num_workers; w++) {
+        const flow_cache_t *fc = &ctx->workers[w].fcache;
+        fprintf(f, "upe_worker_flow_cache_total{worker=\"%d\",result=\"hit\"} %lu\n", w,
+                (unsigned long)fc->hits);
+        fprintf(f, "upe_worker_flow_cache_total{worker=\"%d\",result=\"miss\"} %lu\n", w,
+                (unsigned long)fc->misses);
+        fprintf(f, "upe_worker_flow_cache_total{worker=\"%d\",result=\"eviction\"} %lu\n", w,
+                (unsigned long)fc->evictions);
+    }
+
+    if (ctx->workers[0].ct.entries) {
+        prom_header(f, "upe_worker_conntrack_total", "counter",
+                    "Connection tracking hits, inserts, evictions and expiries");
+        for (int w = 0; w < ctx->num_workers; w++) {
+            const conntrack_t *ct = &ctx->workers[w].ct;
+            const uint64_t v[] = {ct->hits, ct->inserts, ct->evictions, ct->expired};
+            static const char *const names[] = {"hit", "insert", "eviction", "expiry"};
+            for (size_t i = 0; i < sizeof(v) / sizeof(v[0]); i++) {
+                fprintf(f, "upe_worker_conntrack_total{worker=\"%d\",event=\"%s\"} %lu\n", w,
+                        names[i], (unsigned long)v[i]);
+            }
+        }
+        prom_header(f, "upe_worker_conntrack_entries", "gauge", "Tracked connections");
+        for (int w = 0; w < ctx->num_workers; w++) {
+            fprintf(f, "upe_worker_conntrack_entries{worker=\"%d\"} %lu\n", w,
+                    (unsigned long)ctx->workers[w].ct.count);
+        }
+        prom_header(f, "upe_worker_conntrack_memory_bytes", "gauge",
+                    "Memory of the connection tracking table");
+        for (int w = 0; w < ctx->num_workers; w++) {
+            fprintf(f, "upe_worker_conntrack_memory_bytes{worker=\"%d\"} %zu\n", w,
+                    conntrack_memory(&ctx->workers[w].ct));
+        }
+    }
+
+    prom_header(f, "upe_worker_idle_total", "counter", "Empty polls per worker and reaction");
+    for (int w = 0; w < ctx->num_workers; w++) {
+        worker_counters_t c;
+        worker_read_counters(&ctx->workers[w], &c);
+        fprintf(f, "upe_worker_idle_total{worker=\"%d\",action=\"spin\"} %lu\n", w,
+                (unsigned long)c.idle_spins);
+        fprintf(f, "upe_worker_idle_total{worker=\"%d\",action=\"yield\"} %lu\n", w,
+                (unsigned long)c.idle_yields);
+        fprintf(f, "upe_worker_idle_total{worker=\"%d\",action=\"sleep\"} %lu\n", w,
+                (unsigned long)c.idle_sleeps);
+    }
+
+    if (ctx->perf) {
+        prom_header(f, "upe_worker_perf_total", "counter",
+                    "Hardware events of the worker thread (perf_event_open)");
+        for (int w = 0; w < ctx->num_workers; w++) {
+            uint64_t v[PERF_EVENTS];
+            if (!worker_read_perf(&ctx->workers[w], v)) continue;
+            for (int e = 0; e < PERF_EVENTS; e++) {
+                fprintf(f, "upe_worker_perf_total{worker=\"%d\",event=\"%s\"} %lu\n", w,
+                        perf_event_name((perf_event_id_t)e), (unsigned long)v[e]);
+            }
+        }
+    }
+
+    prom_header(f, "upe_worker_tx_packets_total", "counter", "Forwarded packets per egress port");
+    for (int w = 0; w < ctx->num_workers; w++) {
+        const worker_t *wk = &ctx->workers[w];
+        for (unsigned int i = 0; i < wk->tx_port_count; i++) {
+            const worker_tx_port_t *p = &wk->tx_ports[i];
+            fprintf(f,
+                    "upe_worker_tx_packets_total{worker=\"%d\",ifindex=\"%d\",result=\"sent\"} "
+                    "%lu\n",
+                    w, wk->tx_ifindex[i], (unsigned long)p->pkts_sent);
+            fprintf(f,
+                    "upe_worker_tx_packets_total{worker=\"%d\",ifindex=\"%d\",result=\"dropped\"} "
+                    "%lu\n",
+                    w, wk->tx_ifindex[i], (unsigned long)p->pkts_dropped);
+        }
+    }
+
+    prom_header(f, "upe_worker_control_total", "counter",
+                "Control frames per worker: handed to the control plane, or dropped (ring full)");
+    for (int w = 0; w < ctx->num_workers; w++) {
+        worker_counters_t c;
+        worker_read_counters(&ctx->workers[w], &c);
+        fprintf(f, "upe_worker_control_total{worker=\"%d\",result=\"queued\"} %lu\n", w,
+                (unsigned long)c.pkts_control);
+        fprintf(f, "upe_worker_control_total{worker=\"%d\",result=\"dropped\"} %lu\n", w,
+                (unsigned long)c.ctrl_dropped);
+    }
+
+    const control_plane_t *c = ctx->control;
+    prom_header(f, "upe_control_frames_total", "counter", "Frames the control plane handled");
+    fprintf(f, "upe_control_frames_total{type=\"arp\"} %lu\n", (unsigned long)c->arp_frames);
+    fprintf(f, "upe_control_frames_total{type=\"ndp\"} %lu\n", (unsigned long)c->ndp_frames);
+    prom_header(f, "upe_control_replies_total", "counter", "ARP replies per outcome");
+    fprintf(f, "upe_control_replies_total{result=\"sent\"} %lu\n",
+            (unsigned long)c->replies_sent);
+    fprintf(f, "upe_control_replies_total{result=\"limited\"} %lu\n",
+            (unsigned long)c->replies_limited);
+    fprintf(f, "upe_control_replies_total{result=\"dropped\"} %lu\n",
+            (unsigned long)c->replies_dropped);
+
+    if (ctx->mirror) {
+        const mirror_t *m = ctx->mirror;
+        prom_header(f, "upe_worker_mirror_total", "counter",
+                    "Mirror samples per worker: queued, or skipped (budget or ring full)");
+        for (int w = 0; w < ctx->num_workers; w++) {
+            worker_counters_t wc;
+            worker_read_counters(&ctx->workers[w], &wc);
+            fprintf(f, "upe_worker_mirror_total{worker=\"%d\",result=\"queued\"} %lu\n", w,
+                    (unsigned long)wc.pkts_mirrored);
+            fprintf(f, "upe_worker_mirror_total{worker=\"%d\",result=\"skipped\"} %lu\n", w,
+                    (unsigned long)wc.mirror_skipped);
+        }
+        prom_header(f, "upe_mirror_frames_total", "counter", "Mirrored frames per outcome");
+        fprintf(f, "upe_mirror_frames_total{result=\"written\"} %lu\n",
+                (unsigned long)m->frames_written);
+        fprintf(f, "upe_mirror_frames_total{result=\"lost\"} %lu\n",
+                (unsigned long)m->frames_lost);
+        prom_header(f, "upe_mirror_bytes_total", "counter", "pcapng bytes of mirrored frames");
+        fprintf(f, "upe_mirror_bytes_total %lu\n", (unsigned long)m->bytes_written);
+        prom_header(f, "upe_mirror_buffers_held", "gauge",
+                    "Pool buffers the mirror holds, of upe_mirror_buffers_budget");
+        fprintf(f, "upe_mirror_buffers_held %u\n",
+                atomic_load_explicit(&m->held, memory_order_relaxed));
+        prom_header(f, "upe_mirror_buffers_budget", "gauge", "Pool buffers the mirror may hold");
+        fprintf(f, "upe_mirror_buffers_budget %u\n", m->budget);
+    }
+
+    prom_header(f, "upe_log_dropped_total", "counter", "Log records dropped at a full ring");
+    fprintf(f, "upe_log_dropped_total %lu\n", (unsigned long)log_dropped());
+
+    prom_header(f, "upe_ring_occupancy", "gauge", "Packets waiting in a worker's ring");
+    for (int w = 0; w < ctx->num_workers; w++) {
+        fprintf(f, "upe_ring_occupancy{worker=\"%d\"} %zu\n", w, ring_occupancy(&ctx->rings[w]));
+    }
+    prom_header(f, "upe_ring_high_water", "gauge", "Highest occupancy of a worker's ring");
+    for (int w = 0; w < ctx->num_workers; w++) {
+        fprintf(f, "upe_ring_high_water{worker=\"%d\"} %zu\n", w,
+                ring_high_water(&ctx->rings[w]));
+    }
+
+    prom_header(f, "upe_rule_packets_total", "counter", "Packets matched per rule");
+    for (size_t i = 0; i < ctx->rt->count; i++) {
+        const rule_t *r = &ctx->rt->rules[i];
+        rule_stat_t t;
+        rule_totals(ctx, r->rule_id, &t);
+        fprintf(f, "upe_rule_packets_total{rule=\"%u\",priority=\"%u\",action=\"%s\"} %lu\n",
+                r->rule_id, r->priority, r->action.type == ACT_DROP ? "drop" : "fwd",
+                (unsigned long)t.packets);
+    }
+    prom_header(f, "upe_rule_bytes_total", "counter", "Bytes matched per rule");
+    for (size_t i = 0; i < ctx->rt->count; i++) {
+        const rule_t *r = &ctx->rt->rules[i];
+        rule_stat_t t;
+        rule_totals(ctx, r->rule_id, &t);
+        fprintf(f, "upe_rule_bytes_total{rule=\"%u\",priority=\"%u\",action=\"%s\"} %lu\n",
+                r->rule_id, r->priority, r->action.type == ACT_DROP ? "drop" : "fwd",
+                (unsigned long)t.bytes);
+    }
+    prom_header(f, "upe_rule_policer_packets_total", "counter",
+                "Packets of policed rules within (conform) and above (exceed) the rate");
+    for (size_t i = 0; i < ctx->rt->count; i++) {
+        const rule_t *r = &ctx->rt->rules[i];
+        if (!r->action.rate) continue;
+        rule_stat_t t;
+        rule_totals(ctx, r->rule_id, &t);
+        fprintf(f, "upe_rule_policer_packets_total{rule=\"%u\",result=\"conform\"} %lu\n",
+                r->rule_id, (unsigned long)t.conform);
+        fprintf(f, "upe_rule_policer_packets_total{rule=\"%u\",result=\"exceed\"} %lu\n",
+                r->rule_id, (unsigned long)t.exceed);
+    }
+
+    /* A metric's lines must stay together: one pass over the pools per metric. */
+    static const char *const pool_metrics[][3] = {
+        {"upe_pool_buffers", "gauge", "Buffers per pool"},
+        {"upe_pool_free_buffers", "gauge", "Buffers on a pool's global free list"},
+        {"upe_pool_alloc_failures_total", "counter", "Allocations an empty pool failed"}};
+    for (int i = 0; i < 3; i++) {
+        prom_header(f, pool_metrics[i][0], pool_metrics[i][1], pool_metrics[i][2]);
+        for (int n = 0; n < ctx->numa_nodes; n++) {
+            if (!ctx->pool_ready[n]) continue;
+            for (int k = 0; k < PKTBUF_CLASSES; k++) {
+                if (!ctx->pools[n].ready[k]) continue;
+                const pktbuf_pool_t *p = &ctx->pools[n].pool[k];
+                size_t v = i == 0   ? p->capacity
+                           : i == 1 ? atomic_load_explicit(&p->free_count, memory_order_relaxed)
+                                    : (size_t)atomic_load_explicit(&p->alloc_failures,
+                                                                   memory_order_relaxed);
+                fprintf(f, "%s{node=\"%d\",size=\"%u\"} %zu\n", pool_metrics[i][0], n,
+                        p->data_room, v);
+            }
+        }
+    }
+
+    latency_histogram_t h;
+    merge_latency(ctx, -1, &h);
+    prom_header(f, "upe_latency_ns", "summary", "RX arrival to TX queue or drop, per packet");
+    prom_summary(f, "upe_latency_ns", "", &h);
+
+    prom_header(f, "upe_stage_latency_ns", "summary", "Per-stage latency of the timed bursts");
+    for (int s = 0; s < WORKER_STAGES; s++) {
+        char labels[32];
+        snprintf(labels, sizeof(labels), "stage=\"%s\",", worker_stage_name((worker_stage_t)s));
+        merge_latency(ctx, s, &h);
+        prom_summary(f, "upe_stage_latency_ns", labels, &h);
+    }
+}
+
+static void json_latency(json_ctx_t *j, const char *key, const latency_histogram_t *h) {
+    json_begin_nested_object(j, key);
+    json_key_int(j, "samples", (int64_t)h->total_count);
+    json_key_int(j, "p50_ns", (int64_t)latency_percentile(h, 0.50));
+    json_key_int(j, "p99_ns", (int64_t)latency_percentile(h, 0.99));
+    json_key_int(j, "p999_ns", (int64_t)latency_percentile(h, 0.999));
+    json_key_int(j, "p9999_ns", (int64_t)latency_percentile(h, 0.9999));
+    json_key_int(j, "max_ns", (int64_t)h->max_ns);
+    json_end_object(j);
+}
+
+static void write_json(FILE *f, const stats_ctx_t *ctx) {
+    json_ctx_t j;
+    json_init(&j, f);
+    json_begin_object(&j);
+
+    json_begin_nested_array(&j, "workers");
+    for (int w = 0; w < ctx->num_workers; w++) {
+        const worker_t *wk = &ctx->workers[w];
+        json_begin_object(&j);
+        json_key_int(&j, "id", w);
+        worker_counters_t c;
+        worker_read_counters(wk, &c);
+        json_key_int(&j, "pkts_in", (int64_t)c.pkts_in);
+        json_key_int(&j, "pkts_parsed", (int64_t)c.pkts_parsed);
+        json_key_int(&j, "pkts_matched", (int64_t)c.pkts_matched);
+        json_key_int(&j, "pkts_forwarded", (int64_t)c.pkts_forwarded);
+        json_key_int(&j, "pkts_dropped", (int64_t)c.pkts_dropped);
+        json_key_int(&j, "flow_cache_hits", (int64_t)wk->fcache.hits);
+        json_key_int(&j, "flow_cache_misses", (int64_t)wk->fcache.misses);
+        if (wk->ct.entries) {
+            json_key_int(&j, "conntrack_entries", (int64_t)wk->ct.count);
+            json_key_int(&j, "conntrack_hits", (int64_t)wk->ct.hits);
+            json_key_int(&j, "conntrack_inserts", (int64_t)wk->ct.inserts);
+            json_key_int(&j, "conntrack_evictions", (int64_t)wk->ct.evictions);
+            json_key_int(&j, "conntrack_expired", (int64_t)wk->ct.expired);
+            json_key_int(&j, "conntrack_memory_bytes", (int64_t)conntrack_memory(&wk->ct));
+        }
+        json_key_int(&j, "pkts_control", (int64_t)c.pkts_control);
+        json_key_int(&j, "ctrl_dropped", (int64_t)c.ctrl_dropped);
+        if (ctx->mirror) {
+            json_key_int(&j, "pkts_mirrored", (int64_t)c.pkts_mirrored);
+            json_key_int(&j, "mirror_skipped", (int64_t)c.mirror_skipped);
+        }
+        uint64_t pv[PERF_EVENTS];
+        if (ctx->perf && worker_read_perf(wk, pv)) {
+            json_begin_nested_object(&j, "perf");
+            for (int e = 0; e < PERF_EVENTS; e++) {
+                json_key_int(&j, perf_event_name((perf_event_id_t)e), (int64_t)pv[e]);
+            }
+            json_end_object(&j);
+        }
+        json_key_int(&j, "ring_occupancy", (int64_t)ring_occupancy(&ctx->rings[w]));
+        json_key_int(&j, "ring_high_water", (int64_t)ring_high_water(&ctx->rings[w]));
+        json_begin_nested_array(&j, "tx_ports");
+        for (unsigned int i = 0; i < wk->tx_port_count; i++) {
+            json_begin_object(&j);
+            json_key_int(&j, "ifindex", wk->tx_ifindex[i]);
+            json_key_int(&j, "sent", (int64_t)wk->tx_ports[i].pkts_sent);
+            json_key_int(&j, "dropped", (int64_t)wk->tx_ports[i].pkts_dropped);
+            json_end_object(&j);
+        }
+        json_end_array(&j);
+        json_end_object(&j);
+    }
+    json_end_array(&j);
+
+    json_begin_nested_array(&j, "rules");
+    for (size_t i = 0; i < ctx->rt->count; i++) {
+        const rule_t *r = &ctx->rt->rules[i];
+        rule_stat_t t;
+        rule_totals(ctx, r->rule_id, &t);
+        json_begin_object(&j);
+        json_key_int(&j, "id", r->rule_id);
+        json_key_int(&j, "priority", r->priority);
+        json_key_string(&j, "action", r->action.type == ACT_DROP ? "drop" : "fwd");
+        json_key_int(&j, "packets", (int64_t)t.packets);
+        json_key_int(&j, "bytes", (int64_t)t.bytes);
+        if (r->action.rate) {
+            json_key_int(&j, "rate_bps", (int64_t)(r->action.rate * 8));
+            json_key_int(&j, "burst_bytes", (int64_t)r->action.burst);
+            json_key_int(&j, "conform", (int64_t)t.conform);
+            json_key_int(&j, "exceed", (int64_t)t.exceed);
+        }
+        if (r->action.mirror) json_key_int(&j, "mirror", r->action.mirror);
+        json_end_object(&j);
+    }
+    json_end_array(&j);
+
+    json_begin_nested_array(&j, "pools");
+    for (int n = 0; n < ctx->numa_nodes; n++) {
+        if (!ctx->pool_ready[n]) continue;
+        for (int k = 0; k < PKTBUF_CLASSES; k++) {
+            if (!ctx->pools[n].ready[k]) continue;
+            const pktbuf_pool_t *p = &ctx->pools[n].pool[k];
+            json_begin_object(&j);
+            json_key_int(&j, "node", n);
+            json_key_int(&j, "buffer_size", p->data_room);
+            json_key_int(&j, "buffers", (int64_t)p->capacity);
+            json_key_int(&j, "free", (int64_t)atomic_load_explicit(&p->free_count,
+                                                                   memory_order_relaxed));
+            json_key_int(&j, "alloc_failures",
+                         (int64_t)atomic_load_explicit(&p->alloc_failures, memory_order_relaxed));
+            json_end_object(&j);
+        }
+    }
+    json_end_array(&j);
+
+    json_begin_nested_object(&j, "control");
+    json_key_int(&j, "arp_frames", (int64_t)ctx->control->arp_frames);
+    json_key_int(&j, "ndp_frames", (int64_t)ctx->control->ndp_frames);
+    json_key_int(&j, "replies_sent", (int64_t)ctx->control->replies_sent);
+    json_key_int(&j, "replies_limited", (int64_t)ctx->control->replies_limited);
+    json_key_int(&j, "replies_dropped", (int64_t)ctx->control->replies_dropped);
+    json_end_object(&j);
+    if (ctx->mirror) {
+        const mirror_t *m = ctx->mirror;
+        json_begin_nested_object(&j, "mirror");
+        json_key_int(&j, "frames_written", (int64_t)m->frames_written);
+        json_key_int(&j, "frames_lost", (int64_t)m->frames_lost);
+        json_key_int(&j, "bytes_written", (int64_t)m->bytes_written);
+        json_key_int(&j, "clients", (int64_t)m->clients);
+        json_key_int(&j, "buffers_held", atomic_load_explicit(&m->held, memory_order_relaxed));
+        json_key_int(&j, "buffers_budget", m->budget);
+        json_end_object(&j);
+    }
+    json_key_int(&j, "log_dropped", (int64_t)log_dropped());
+
+    latency_histogram_t h;
+    merge_latency(ctx, -1, &h);
+    json_latency(&j, "latency", &h);
+
+    json_begin_nested_object(&j, "stages");
+    for (int s = 0; s < WORKER_STAGES; s++) {
+        merge_latency(ctx, s, &h);
+        json_latency(&j, worker_stage_name((worker_stage_t)s), &h);
+    }
+    json_end_object(&j);
+
+    json_end_object(&j);
+    fprintf(f, "\n");
+}
+
+/* Render both formats into memory and hand them to the metrics server. */
+static void publish_metrics(const stats_ctx_t *ctx) {
+    for (int fmt = 0; fmt < METRICS_FORMATS; fmt++) {
+        char *buf = NULL;
+        size_t len = 0;
+        FILE *f = open_memstream(&buf, &len);
+        if (!f) {
+            log_msg(LOG_WARN, "Metrics: open_memstream failed, snapshot not updated");
+            return;
+        }
+        if (fmt == METRICS_JSON) {
+            write_json(f, ctx);
+        } else {
+            write_prometheus(f, ctx);
+        }
+        fclose(f);
+        metrics_server_publish(ctx->metrics, (metrics_format_t)fmt, buf, len);
+    }
+}
+
+/*
+    Swap `new_rt` in on every worker, then free the old table after the grace
+    period. With `keep_stats` the counters carry over by rule id: each worker
+    keeps its stats array if the capacity stayed, else the old arrays are added
+    to ctx->rule_base once no worker writes them any more. Without, every rule
+    starts from zero.
+        Returns 0, or -1 (logged; new_rt is destroyed and the old rules stay).
+*/
+static int publish_rules(stats_ctx_t *ctx, rule_table_t *new_rt, bool keep_stats) {
+    rule_table_t *old_rt = ctx->rt;
+    bool share = keep_stats && new_rt->capacity == old_rt->capacity;
+
+    rule_stat_t *base = NULL;
+    if (keep_stats && !share) {
+        base = calloc(new_rt->capacity, sizeof(rule_stat_t));
+        if (base && ctx->rule_base) {
+            memcpy(base, ctx->rule_base, old_rt->capacity * sizeof(rule_stat_t));
+        }
+    }
+
+    /* One (table, stats) pair per worker, built before anything is published
+     * so that a failure leaves every worker on the old rules. */
+    worker_rules_t **next = calloc((size_t)ctx->num_workers, sizeof(worker_rules_t *));
+    bool ok = next && (base || !keep_stats || share);
+    for (int i = 0; ok && i < ctx->num_workers; i++) {
+        next[i] = malloc(sizeof(worker_rules_t));
+        if (!next[i]) {
+            ok = false;
+            break;
+        }
+        next[i]->rt = new_rt;
+        next[i]->stats = share ? atomic_load(&ctx->workers[i].rules)->stats
+                               : calloc(new_rt->capacity, sizeof(rule_stat_t));
+        ok = next[i]->stats != NULL;
+    }
+    if (!ok) {
+        log_msg(LOG_ERROR, "Rule update: stats alloc failed, using old rules");
+        for (int i = 0; next && i < ctx->num_workers; i++) {
+            if (next[i] && !share) free(next[i]->stats);
+            free(next[i]);
+        }
+        free(next);
+        free(base);
+        rule_table_destroy(new_rt);
+        free(new_rt);
+        return -1;
+    }
+
+    /* Nothing can fail from here on: only now may new_rt own what it shares
+     * with old_rt (rule_table_apply()), which the workers still read. */
+    rule_table_take_over(new_rt, old_rt);
+
+    warn_missing_egress(&ctx->workers[0], new_rt);
+    configure_policers(new_rt, next, ctx->num_workers, ctx->tsc_hz);
+
+    for (int i = 0; i < ctx->num_workers; i++) {
+        /* The swap hands back the old pair; keep it until the grace period. */
+        next[i] = worker_swap_rules(&ctx->workers[i], next[i]);
+    }
+    ctx->rt = new_rt;
+
+    /* Grace period: every worker has finished the burst that may have used
+     * the old table. Takes about one burst, not a fixed sleep. */
+    qsbr_synchronize(ctx->qsbr);
+
+    if (base) {
+        for (int i = 0; i < ctx->num_workers; i++) {
+            for (size_t id = 0; id < old_rt->capacity; id++) {
+                base[id].packets += next[i]->stats[id].packets;
+                base[id].bytes += next[i]->stats[id].bytes;
+                base[id].conform += next[i]->stats[id].conform;
+                base[id].exceed += next[i]->stats[id].exceed;
+            }
+        }
+    }
+    if (base || !keep_stats) {
+        free(ctx->rule_base);
+        ctx->rule_base = base;
+    }
+
+    rule_table_destroy(old_rt);
+    free(old_rt);
+    for (int i = 0; i < ctx->num_workers; i++) {
+        if (!share) free(next[i]->stats);
+        free(next[i]);
+    }
+    free(next);
+    return 0;
+}
+
+/* Apply a delta from the rule API and answer it. */
+static void apply_rule_update(stats_ctx_t *ctx, rule_api_request_t *req) {
+    rule_table_t *new_rt = malloc(sizeof(rule_table_t));
+    size_t failed = req->count;
+
+    if (!new_rt || rule_table_apply(new_rt, ctx->rt, req->deltas, req->count, &failed) != 0) {
+        free(new_rt);
+        if (failed < req->count) {
+            snprintf(req->reply, req->reply_cap, "error: change %zu: no rule with id %u\n",
+                     failed + 1, req->deltas[failed].rule_id);
+        } else {
+            snprintf(req->reply, req->reply_cap, "error: out of memory\n");
+        }
+        rule_api_reply(ctx->rule_api, req);
+        return;
+    }
+    if (!new_rt->cls && rule_table_compile(new_rt) != 0) {
+        log_msg(LOG_WARN, "Rule update: classifier build failed, using linear scan");
+    }
+
+    if (publish_rules(ctx, new_rt, true) != 0) {
+        snprintf(req->reply, req->reply_cap, "error: out of memory\n");
+    } else {
+        size_t len = (size_t)snprintf(req->reply, req->reply_cap, "ok %zu rules, generation %u\n",
+                                      new_rt->count, new_rt->generation);
+        for (size_t i = 0; i < req->count && len < req->reply_cap; i++) {
+            if (req->deltas[i].op != RULE_ADD) continue;
+            len += (size_t)snprintf(req->reply + len, req->reply_cap - len, "added %u\n",
+                                    req->deltas[i].rule_id);
+        }
+        log_msg(LOG_INFO, "Rule API: applied %zu changes, %zu rules", req->count, new_rt->count);
+    }
+    rule_api_reply(ctx->rule_api, req);
+}
+
+/* One second between ticks; rule updates are applied as they come in. */
+static void wait_tick(stats_ctx_t *ctx) {
+    if (!ctx->rule_api) {
+        sleep(1);
+        return;
+    }
+
+    uint64_t end = now_ns(CLOCK_MONOTONIC) + 1000000000ull;
+    for (;;) {
+        uint64_t now = now_ns(CLOCK_MONOTONIC);
+        if (now >= end || g_stop) return;
+        rule_api_request_t *req =
+            rule_api_poll(ctx->rule_api, (int)((end - now) / 1000000u) + 1);
+        if (req) apply_rule_update(ctx, req);
+    }
+}
+
 static void *stats_thread_func(void *arg) {
     stats_ctx_t *ctx = (stats_ctx_t *)arg;
 
@@ -195,8 +1204,44 @@ static void *stats_thread_func(void *arg) {
         }
     }
 
+    /* Per-worker pkts_in at the previous tick, ring loads for the rebalancer. */
+    uint64_t *last_in = calloc((size_t)ctx->num_workers, sizeof(uint64_t));
+    uint64_t *ring_load = calloc((size_t)ctx->num_workers, sizeof(uint64_t));
+    size_t *ring_backlog = calloc((size_t)ctx->num_workers, sizeof(size_t));
+    if (!last_in || !ring_load || !ring_backlog) {
+        log_msg(LOG_WARN, "Stats thread: alloc failed, RETA rebalancing disabled");
+        ctx->reta = NULL;
+    }
+
+    /* Worker CPU time at the previous tick, for the cost of the idle policy. */
+    uint64_t *last_cpu_ns = calloc((size_t)ctx->num_workers, sizeof(uint64_t));
+    uint64_t last_wall_ns = 0;
+
+    /* Hardware counters and pkts_in at the previous tick, for the per-packet figures. */
+    uint64_t(*last_perf)[PERF_EVENTS + 1] =
+        ctx->perf ? calloc((size_t)ctx->num_workers, sizeof(*last_perf)) : NULL;
+
+    /* Conntrack totals at the previous tick, for insert and eviction rates. */
+    uint64_t last_ct_inserts = 0;
+    uint64_t last_ct_evictions = 0;
+
     while (!g_stop) {
-        sleep(1); /* Stats thread wakes up every second. */
+        wait_tick(ctx); /* Stats thread wakes up every second. */
+
+        /* Move one RETA bucket per tick off a worker that falls behind. */
+        if (ctx->reta) {
+            for (int w = 0; w < ctx->num_workers; w++) {
+                worker_counters_t c;
+                worker_read_counters(&ctx->workers[w], &c);
+                uint64_t in = c.pkts_in;
+                ring_load[w] = in - last_in[w];
+                last_in[w] = in;
+                ring_backlog[w] = ring_occupancy(&ctx->rings[w]);
+            }
+            if (reta_rebalance(ctx->reta, ring_load, ring_backlog, ctx->rings[0].capacity)) {
+                log_msg(LOG_INFO, "RETA: moving a bucket off a busy worker");
+            }
+        }
 
         /* Sweep the ARP and NDP tables for stale entries once per
          * NEIGHBOUR_SWEEP_INTERVAL_SEC seconds. Each table applies its own
@@ -224,64 +1269,33 @@ static void *stats_thread_func(void *arg) {
                     log_msg(LOG_ERROR, "Rule reload: malloc failed");
                     goto reload_done;
                 }
-                rule_table_init(new_rt, 1024);
-
-                if (rule_config_load(ctx->rules_file, new_rt) != 0) {
-                    log_msg(LOG_ERROR, "Rule reload: failed to parse %s, using old rules",
+                /* A compiled file is mapped, a text one parsed and compiled. */
+                if (rule_table_load(ctx->rules_file, new_rt) != 0) {
+                    log_msg(LOG_ERROR, "Rule reload: failed to load %s, using old rules",
                             ctx->rules_file);
-                    rule_table_destroy(new_rt);
                     free(new_rt);
                     goto reload_done;
                 }
-
-                rule_stat_t **new_stats = calloc((size_t)ctx->num_workers, sizeof(rule_stat_t *));
-                if (!new_stats) {
-                    log_msg(LOG_ERROR, "Rule reload: stats alloc failed");
-                    rule_table_destroy(new_rt);
-                    free(new_rt);
-                    goto reload_done;
-                }
-                for (int i = 0; i < ctx->num_workers; i++) {
-                    new_stats[i] = calloc(new_rt->capacity, sizeof(rule_stat_t));
-                    if (!new_stats[i]) {
-                        log_msg(LOG_ERROR, "Rule reload: stats alloc failed for worker %d", i);
-                        for (int j = 0; j < i; j++) {
-                            free(new_stats[j]);
-                        }
-                        free(new_stats);
-                        rule_table_destroy(new_rt);
-                        free(new_rt);
-                        goto reload_done;
-                    }
-                }
-
-                const rule_table_t *old_rt = ctx->rt;
-                rule_stat_t **old_stats = calloc((size_t)ctx->num_workers, sizeof(rule_stat_t *));
-                for (int i = 0; i < ctx->num_workers; i++) {
-                    old_stats[i] = ctx->workers[i].rule_stats;
-                    ctx->workers[i].rule_stats = new_stats[i];
-                    ctx->workers[i].rt = new_rt;
-                }
-                ctx->rt = new_rt;
-
-                /* Grace period waiting for all workers to finish procesing with old table. */
-                sleep(1);
-
-                rule_table_destroy((rule_table_t *)old_rt);
-                free((void *)old_rt);
-                for (int i = 0; i < ctx->num_workers; i++) {
-                    free(old_stats[i]);
+                /* Rule ids start again from 0 and mean other rules: counters too. */
+                if (publish_rules(ctx, new_rt, false) == 0) {
+                    log_msg(LOG_INFO, "Rules reloaded: %zu rules from %s", new_rt->count,
+                            ctx->rules_file);
                 }
-                free(old_stats);
-                free(new_stats);
-
-                log_msg(LOG_INFO, "Rules reloaded: %zu rules from %s", new_rt->count,
-                        ctx->rules_file);
             }
         reload_done:;
         }
 
-        printf("\033[2J\033[H");
+        /* Move each policer's rate towards the workers its traffic went to. */
+        worker_rules_t *cur[UPE_WORKERS_MAX];
+        for (int w = 0; w < ctx->num_workers; w++) {
+            cur[w] = atomic_load_explicit(&ctx->workers[w].rules, memory_order_relaxed);
+        }
+        configure_policers(ctx->rt, cur, ctx->num_workers, ctx->tsc_hz);
+
+        if (ctx->metrics) publish_metrics(ctx);
+        if (!ctx->dashboard) continue;
+
+        if (isatty(STDOUT_FILENO)) printf("\033[2J\033[H");
         printf("=== UPE Statistics ===\n");
         printf("%-6s %-8s %-10s %-15s %-15s\n", "RuleID", "Priority", "Action", "Packets", "Bytes");
         printf("-------------------------------------------------------------\n");
@@ -294,16 +1308,9 @@ static void *stats_thread_func(void *arg) {
             const rule_t *r = &ctx->rt->rules[i];
             uint32_t rid = r->rule_id;
 
-            uint64_t p_sum = 0;
-            uint64_t b_sum = 0;
-
-            /* Aggregate stats from all workers. */
-            for (int w = 0; w < ctx->num_workers; w++) {
-                if (ctx->workers[w].rule_stats) {
-                    p_sum += ctx->workers[w].rule_stats[rid].packets;
-                    b_sum += ctx->workers[w].rule_stats[rid].bytes;
-                }
-            }
+            rule_stat_t t;
+            rule_totals(ctx, rid, &t);
+            uint64_t p_sum = t.packets, b_sum = t.bytes;
 
             if (p_sum > 0) {
                 printf("%-6u %-8u %-10s %-15lu %-15lu\n", rid, r->priority,
@@ -316,14 +1323,229 @@ static void *stats_thread_func(void *arg) {
         printf("-------------------------------------------------------------\n");
         printf("TOTAL: %lu packets, %lu bytes\n", total_pkts, total_bytes);
 
-        /* Aggregate latency histograms from all workers. */
-        latency_histogram_t combined;
-        latency_histogram_init(&combined);
+        /* Policed rules: what the rate let through and what it dropped. */
+        bool policers = false;
+        for (size_t i = 0; i < ctx->rt->count; i++) {
+            const rule_t *r = &ctx->rt->rules[i];
+            if (!r->action.rate) continue;
+            if (!policers) printf("\n=== Policers ===\n");
+            policers = true;
+            rule_stat_t t;
+            rule_totals(ctx, r->rule_id, &t);
+            printf("    Rule %u: %.3f Mbit/s, burst %lu B  Conform: %lu  Exceed: %lu\n",
+                   r->rule_id, (double)r->action.rate * 8.0 / 1e6,
+                   (unsigned long)r->action.burst, (unsigned long)t.conform,
+                   (unsigned long)t.exceed);
+        }
 
+        /* Flow cache counters, summed over workers. */
+        uint64_t fc_hits = 0;
+        uint64_t fc_misses = 0;
+        uint64_t fc_evictions = 0;
         for (int w = 0; w < ctx->num_workers; w++) {
-            latency_histogram_merge(&combined, &ctx->workers[w].latency_hist);
+            fc_hits += ctx->workers[w].fcache.hits;
+            fc_misses += ctx->workers[w].fcache.misses;
+            fc_evictions += ctx->workers[w].fcache.evictions;
+        }
+        if (fc_hits + fc_misses > 0) {
+            double rate = (double)fc_hits / (double)(fc_hits + fc_misses) * 100.0;
+            printf("\n=== Flow cache ===\n");
+            printf("    Hits: %lu  Misses: %lu  (%.1f%% hit rate)\n", fc_hits, fc_misses, rate);
+            printf("    Evictions: %lu\n", fc_evictions);
         }
 
+        /* Connection tracking, summed over workers. */
+        if (ctx->workers[0].ct.entries) {
+            uint64_t ct_count = 0, ct_hits = 0, ct_inserts = 0, ct_evictions = 0, ct_expired = 0;
+            size_t ct_memory = 0;
+            for (int w = 0; w < ctx->num_workers; w++) {
+                const conntrack_t *ct = &ctx->workers[w].ct;
+                ct_count += ct->count;
+                ct_hits += ct->hits;
+                ct_inserts += ct->inserts;
+                ct_evictions += ct->evictions;
+                ct_expired += ct->expired;
+                ct_memory += conntrack_memory(ct);
+            }
+            printf("\n=== Connection tracking ===\n");
+            printf("    Connections: %lu  Memory: %.1f MB  Hits: %lu\n", (unsigned long)ct_count,
+                   (double)ct_memory / (1024.0 * 1024.0), (unsigned long)ct_hits);
+            printf("    Inserts: %lu (%lu/s)  Evictions: %lu (%lu/s)  Expired: %lu\n",
+                   (unsigned long)ct_inserts, (unsigned long)(ct_inserts - last_ct_inserts),
+                   (unsigned long)ct_evictions, (unsigned long)(ct_evictions - last_ct_evictions),
+                   (unsigned long)ct_expired);
+            last_ct_inserts = ct_inserts;
+            last_ct_evictions = ct_evictions;
+        }
+
+        /* Per-worker neighbour caches. */
+        uint64_t nc_hits = 0;
+        uint64_t nc_misses = 0;
+        for (int w = 0; w < ctx->num_workers; w++) {
+            nc_hits += ctx->workers[w].ncache.hits;
+            nc_misses += ctx->workers[w].ncache.misses;
+        }
+        if (nc_hits + nc_misses > 0) {
+            double rate = (double)nc_hits / (double)(nc_hits + nc_misses) * 100.0;
+            printf("\n=== Neighbour cache ===\n");
+            printf("    Hits: %lu  Misses: %lu  (%.1f%% hit rate)\n", nc_hits, nc_misses, rate);
+        }
+
+        if (ctx->reta) {
+            printf("\n=== RETA ===\n");
+            printf("    Buckets: %d  Moves: %lu  Aborted: %lu\n", RETA_SIZE,
+                   (unsigned long)atomic_load(&ctx->reta->moves),
+                   (unsigned long)atomic_load(&ctx->reta->aborts));
+            for (int w = 0; w < ctx->num_workers; w++) {
+                printf("    Worker %d: %lu pkts/s, ring %zu (max %zu)\n", w,
+                       (unsigned long)ring_load[w], ring_backlog[w],
+                       ring_high_water(&ctx->rings[w]));
+            }
+        }
+
+        /* CPU a worker burns is its idle policy's price: poll is a full core at any
+         * load, backoff and wakeup should track the traffic. */
+        uint64_t wall_ns = now_ns(CLOCK_MONOTONIC);
+        if (last_cpu_ns) {
+            printf("\n=== Workers (idle: %s) ===\n", idle_mode_name(ctx->workers[0].idle_mode));
+            for (int w = 0; w < ctx->num_workers; w++) {
+                const worker_t *wk = &ctx->workers[w];
+                clockid_t cid;
+                uint64_t cpu_ns = 0;
+                if (pthread_getcpuclockid(wk->thread, &cid) == 0) cpu_ns = now_ns(cid);
+
+                double cpu = 0.0;
+                /* A worker that already exited has no clock left: 0. */
+                if (last_wall_ns && wall_ns > last_wall_ns && cpu_ns >= last_cpu_ns[w]) {
+                    cpu = (double)(cpu_ns - last_cpu_ns[w]) / (double)(wall_ns - last_wall_ns) *
+                          100.0;
+                }
+                last_cpu_ns[w] = cpu_ns;
+                worker_counters_t c;
+                worker_read_counters(wk, &c);
+                printf("    Worker %d: CPU %5.1f%%  Spins: %lu  Yields: %lu  Sleeps: %lu\n", w, cpu,
+                       (unsigned long)c.idle_spins, (unsigned long)c.idle_yields,
+                       (unsigned long)c.idle_sleeps);
+            }
+        }
+        last_wall_ns = wall_ns;
+
+        /* Where the cycles go, per packet over the last tick (idle polls included). */
+        if (last_perf) {
+            printf("\n=== Hardware counters ===\n");
+            for (int w = 0; w < ctx->num_workers; w++) {
+                uint64_t v[PERF_EVENTS];
+                if (!worker_read_perf(&ctx->workers[w], v)) {
+                    printf("    Worker %d: n/a\n", w);
+                    continue;
+                }
+                worker_counters_t c;
+                worker_read_counters(&ctx->workers[w], &c);
+                uint64_t *last = last_perf[w];
+                uint64_t d[PERF_EVENTS];
+                for (int e = 0; e < PERF_EVENTS; e++) {
+                    d[e] = v[e] - last[e];
+                    last[e] = v[e];
+                }
+                uint64_t pkts = c.pkts_in - last[PERF_EVENTS];
+                last[PERF_EVENTS] = c.pkts_in;
+
+                double per_pkt = pkts ? 1.0 / (double)pkts : 0.0;
+                double ipc =
+                    d[PERF_CYCLES] ? (double)d[PERF_INSTRUCTIONS] / (double)d[PERF_CYCLES] : 0.0;
+                printf("    Worker %d: IPC %.2f  Cycles/pkt: %.0f  LLC misses/pkt: %.2f  "
+                       "Branch misses/pkt: %.2f\n",
+                       w, ipc,
+                       (double)d[PERF_CYCLES] * per_pkt, (double)d[PERF_LLC_MISSES] * per_pkt,
+                       (double)d[PERF_BRANCH_MISSES] * per_pkt);
+            }
+        }
+
+        /* A stage backlog that keeps growing means TX is the bottleneck: add stages. */
+        if (ctx->num_stages > 0) {
+            printf("\n=== TX stages ===\n");
+            for (int t = 0; t < ctx->num_stages; t++) {
+                const tx_stage_t *st = &ctx->stages[t];
+                size_t backlog = 0;
+                for (unsigned int r = 0; r < st->ring_count; r++) {
+                    backlog += ring_occupancy(st->rings[r]);
+                }
+                printf("    Stage %d (%u workers): Sent: %lu  Dropped: %lu  Backlog: %zu\n", t,
+                       st->ring_count, (unsigned long)st->pkts_sent,
+                       (unsigned long)st->pkts_dropped, backlog);
+            }
+        }
+
+        /* Ring drops mean the control plane cannot keep up (an ARP storm): neighbours are
+         * learned late, forwarding is unaffected. */
+        {
+            const control_plane_t *c = ctx->control;
+            uint64_t queued = 0, ring_drops = 0;
+            for (int w = 0; w < ctx->num_workers; w++) {
+                worker_counters_t wc;
+                worker_read_counters(&ctx->workers[w], &wc);
+                queued += wc.pkts_control;
+                ring_drops += wc.ctrl_dropped;
+            }
+            printf("\n=== Control plane ===\n");
+            printf("    Frames: %lu (ARP %lu, NDP %lu)  Ring full: %lu\n", (unsigned long)queued,
+                   (unsigned long)c->arp_frames, (unsigned long)c->ndp_frames,
+                   (unsigned long)ring_drops);
+            printf("    ARP replies: Sent: %lu  Rate limited: %lu  Dropped: %lu\n",
+                   (unsigned long)c->replies_sent, (unsigned long)c->replies_limited,
+                   (unsigned long)c->replies_dropped);
+        }
+
+        /* Skipped samples: the budget (or a ring) was full, the writer falls behind. */
+        if (ctx->mirror) {
+            const mirror_t *m = ctx->mirror;
+            uint64_t queued = 0, skipped = 0;
+            for (int w = 0; w < ctx->num_workers; w++) {
+                worker_counters_t wc;
+                worker_read_counters(&ctx->workers[w], &wc);
+                queued += wc.pkts_mirrored;
+                skipped += wc.mirror_skipped;
+            }
+            printf("\n=== Mirror (%s) ===\n",
+                   atomic_load_explicit(&m->active, memory_order_relaxed) ? "writing" : "idle");
+            printf("    Sampled: %lu  Skipped: %lu  Written: %lu (%lu B)  Lost: %lu\n",
+                   (unsigned long)queued, (unsigned long)skipped,
+                   (unsigned long)m->frames_written, (unsigned long)m->bytes_written,
+                   (unsigned long)m->frames_lost);
+            printf("    Buffers held: %u of %u\n",
+                   atomic_load_explicit(&m->held, memory_order_relaxed), m->budget);
+        }
+
+        /* Failed allocations are RX drops; CAS retries show contention on the global
+         * stack; buffers handed to threads of another node cost a remote access per
+         * packet. */
+        printf("\n=== Packet pools ===\n");
+        for (int n = 0; n < ctx->numa_nodes; n++) {
+            if (!ctx->pool_ready[n]) continue;
+            for (int k = 0; k < PKTBUF_CLASSES; k++) {
+                if (!ctx->pools[n].ready[k]) continue;
+                const pktbuf_pool_t *p = &ctx->pools[n].pool[k];
+                printf("    Node %d, %u B: %zu buffers, %zu free globally (cache %zu/thread)\n",
+                       n, p->data_room, p->capacity,
+                       atomic_load_explicit(&p->free_count, memory_order_relaxed), p->cache_size);
+                printf("    Refills: %lu  Flushes: %lu  CAS retries: %lu  Alloc failures: %lu\n",
+                       (unsigned long)atomic_load_explicit(&p->refills, memory_order_relaxed),
+                       (unsigned long)atomic_load_explicit(&p->flushes, memory_order_relaxed),
+                       (unsigned long)atomic_load_explicit(&p->cas_retries, memory_order_relaxed),
+                       (unsigned long)atomic_load_explicit(&p->alloc_failures,
+                                                           memory_order_relaxed));
+                if (ctx->numa_nodes > 1) {
+                    printf("    Remote allocs: %lu\n",
+                           (unsigned long)atomic_load_explicit(&p->remote_allocs,
+                                                               memory_order_relaxed));
+                }
+            }
+        }
+
+        /* Aggregate latency histograms from all workers. */
+        latency_histogram_t combined;
+        merge_latency(ctx, -1, &combined);
+
         if (combined.total_count > 0) {
             uint64_t mean_ns = combined.sum_ns / combined.total_count;
 
@@ -334,22 +1556,33 @@ static void *stats_thread_func(void *arg) {
             printf("    p50: %lu ns\n", latency_percentile(&combined, 0.50));
             printf("    p95: %lu ns\n", latency_percentile(&combined, 0.95));
             printf("    p99: %lu ns\n", latency_percentile(&combined, 0.99));
-            printf("    Max:     %lu ns\n", combined.max_ns);
-
-            printf("\n  Distribution:\n");
-            static const char *bucket_labels[LATENCY_NUM_BUCKETS] = {
-                "<100ns", "<500ns", "<1us", "<5us", "<10us", "<50us", "<100us", ">=100us"};
-
-            for (int i = 0; i < LATENCY_NUM_BUCKETS; i++) {
-                if (combined.buckets[i] > 0) {
-                    /* Percentage of total samples in this bucket. */
-                    double pct = (double)combined.buckets[i] / (double)combined.total_count * 100.0;
-                    printf("    %-8s %10lu  (%5.1f%%)\n", bucket_labels[i], combined.buckets[i],
-                           pct);
-                }
+            printf("    p99.9: %lu ns\n", latency_percentile(&combined, 0.999));
+            printf("    p99.99: %lu ns\n", latency_percentile(&combined, 0.9999));
+            printf("    Max: %lu ns\n", combined.max_ns);
+        }
+
+        /* Where the time goes: the stages of the timed bursts. */
+        bool stage_header = false;
+        for (int s = 0; s < WORKER_STAGES; s++) {
+            latency_histogram_t stage;
+            merge_latency(ctx, s, &stage);
+            if (stage.total_count == 0) continue;
+
+            if (!stage_header) {
+                printf("\n=== Stage latency (1 burst in %u) ===\n", ctx->workers[0].stage_sample);
+                stage_header = true;
             }
+            printf("    %-8s p50: %lu ns, p99: %lu ns, p99.9: %lu ns, max: %lu ns\n",
+                   worker_stage_name((worker_stage_t)s), latency_percentile(&stage, 0.50),
+                   latency_percentile(&stage, 0.99), latency_percentile(&stage, 0.999),
+                   stage.max_ns);
         }
     }
+    free(last_in);
+    free(ring_load);
+    free(ring_backlog);
+    free(last_cpu_ns);
+    free(last_perf);
     return NULL;
 }
 
@@ -364,53 +1597,139 @@ int main(int argc, char **argv) {
     log_set_level(verbosity_to_level(cfg.verbose));
     install_signal_handlers();
 
-    const uint16_t WORKERS_NUM = 2;
-    const size_t RING_CAPACITY = 1024;
-    const size_t POOL_CAPACITY = 4096;
+    const int WORKERS_NUM = cfg.workers;
+    const int STAGES_NUM = cfg.pipeline ? cfg.tx_stages : 0;
+    /* Buffers per size class (256 B, 2 KB, 9 KB): mostly small control and ACK
+     * frames, MTU-sized data, a few jumbo frames. */
+    const size_t POOL_CAPACITY[PKTBUF_CLASSES] = {
+        2 * cfg.pool_size, cfg.pool_size, cfg.pool_size / 16 > 64 ? cfg.pool_size / 16 : 64};
 
     /* === CPU affinity setup. === */
     int rx_core = -1;
     int stats_core = -1;
     int worker_cores[WORKERS_NUM];
+    int stage_cores[STAGES_NUM > 0 ? STAGES_NUM : 1];
+
+    /* Home node: where the NIC is attached, packets are DMA'd (and
+     * copied by RX) into memory there. */
+    int numa_nodes = affinity_numa_nodes();
+    int home_node = affinity_iface_node(cfg.iface);
+    if (home_node < 0 || home_node >= numa_nodes) home_node = 0;
 
     int num_cores = affinity_get_num_cores();
     if (num_cores > 0) {
-        log_msg(LOG_INFO, "System has %d CPU cores available", num_cores);
-        assign_cores(WORKERS_NUM, &rx_core, worker_cores, &stats_core);
+        log_msg(LOG_INFO, "System has %d CPU cores available, %d NUMA node(s)", num_cores,
+                numa_nodes);
+        if (assign_cores(&cfg, home_node, &rx_core, worker_cores, stage_cores, &stats_core) != 0) {
+            return 1;
+        }
     } else {
         log_msg(LOG_WARN, "Failed to detect CPU cores, disabling affinity");
-        rx_core = stats_core - 1;
         for (int i = 0; i < WORKERS_NUM; i++) {
             worker_cores[i] = -1;
         }
+        for (int i = 0; i < STAGES_NUM; i++) {
+            stage_cores[i] = -1;
+        }
     }
 
     /* ============================ */
 
-    /* I. Init packet pool. */
-    pktbuf_pool_t pool;
-    if (pktbuf_pool_init(&pool, POOL_CAPACITY) != 0) {
-        log_msg(LOG_ERROR, "pktbuf_pool_init failed");
+    /*
+        I. Init packet pools, one set of size classes per NUMA node that allocates buffers.
+            - ring layout: RX allocates every buffer, so a single pool on the home node.
+            - per-worker layout: each worker allocates its own, from its node's pool.
+        On a single node there is nothing to place (node -1, no mbind).
+    */
+    pktbuf_classes_t *pools = calloc((size_t)numa_nodes, sizeof(pktbuf_classes_t));
+    bool *pool_ready = calloc((size_t)numa_nodes, sizeof(bool));
+    pktbuf_classes_t *worker_pools[WORKERS_NUM];
+    if (!pools || !pool_ready) {
+        log_msg(LOG_ERROR, "pool alloc failed");
         return 1;
     }
-    log_msg(LOG_INFO, "Packet pool uses %s",
-            pool.use_hugepages ? "2MB huge pages" : "standard pages");
+    for (int i = -1; i < WORKERS_NUM; i++) {
+        int node = home_node; /* i == -1: the RX thread */
+        if (i >= 0 && cfg.per_worker_rx && worker_cores[i] >= 0) {
+            node = affinity_core_node(worker_cores[i]);
+        }
+        if (!pool_ready[node]) {
+            if (pktbuf_classes_init(&pools[node], POOL_CAPACITY, cfg.headroom,
+                                    numa_nodes > 1 ? node : -1) != 0) {
+                log_msg(LOG_ERROR, "pktbuf_classes_init failed");
+                return 1;
+            }
+            for (int k = 0; k < PKTBUF_CLASSES; k++) {
+                pktbuf_pool_set_cache_size(&pools[node].pool[k], cfg.pool_cache);
+            }
+            pool_ready[node] = true;
+            log_msg(LOG_INFO, "Packet pools (node %d, headroom %u) use %s", node, cfg.headroom,
+                    pools[node].pool[PKTBUF_CLASS_STD].use_hugepages ? "2MB huge pages"
+                                                                     : "standard pages");
+        }
+        if (i >= 0) worker_pools[i] = &pools[node];
+    }
+    pktbuf_classes_t *rx_pools = &pools[home_node];
 
-    /* II. Init rings; one per worker. */
+    /* II. Init rings; one per worker, plus one per worker to its TX stage in pipeline mode. */
     spsc_ring_t *rings = calloc((size_t)WORKERS_NUM, sizeof(spsc_ring_t));
+    spsc_ring_t *tx_rings = cfg.pipeline ? calloc((size_t)WORKERS_NUM, sizeof(spsc_ring_t)) : NULL;
+    if (!rings || (cfg.pipeline && !tx_rings)) {
+        log_msg(LOG_ERROR, "ring alloc failed");
+        return 1;
+    }
     for (int i = 0; i < WORKERS_NUM; i++) {
-        if (ring_init(&rings[i], RING_CAPACITY) != 0) {
+        if (ring_init(&rings[i], cfg.ring_size) != 0 ||
+            (tx_rings && ring_init(&tx_rings[i], cfg.ring_size) != 0)) {
             log_msg(LOG_ERROR, "ring_init failed");
             return 1;
         }
     }
+    /* Full rings hold buffers the RX side can't allocate any more. */
+    size_t ring_slots = (size_t)WORKERS_NUM * cfg.ring_size * (cfg.pipeline ? 2 : 1);
+    if (ring_slots >= cfg.pool_size) {
+        log_msg(LOG_WARN, "Rings can hold %zu packets, the 2 KB pool has %zu: consider --pool-size",
+                ring_slots, cfg.pool_size);
+    }
 
-    /* III. Init TX context */
-    tx_ctx_t tx;
-    if (tx_init(&tx, cfg.iface ? cfg.iface : "lo") != 0) {
-        log_msg(LOG_ERROR, "tx_init failed");
+    /* III. Init TX contexts; one per worker, a TX ring has a single producer. */
+    tx_ctx_t *txs = calloc((size_t)WORKERS_NUM, sizeof(tx_ctx_t));
+    if (!txs) {
+        log_msg(LOG_ERROR, "tx context alloc failed");
         return 1;
     }
+    for (int i = 0; i < WORKERS_NUM; i++) {
+        if (tx_init(&txs[i], cfg.iface ? cfg.iface : "lo") != 0) {
+            log_msg(LOG_ERROR, "tx_init failed");
+            return 1;
+        }
+        /* Pipeline: a TX stage sends the default port's frames; the worker's
+         * context only supplies its MAC and ifindex for the rewrite. */
+        if (cfg.tx_ring && !cfg.pipeline) {
+            if (tx_ring_enable(&txs[i]) != 0) {
+                log_msg(LOG_WARN, "Worker %d: TX ring unavailable, using sendmmsg", i);
+            }
+        }
+    }
+    tx_ctx_t *stage_txs = NULL;
+    tx_stage_t *stages = NULL;
+    if (cfg.pipeline) {
+        stage_txs = calloc((size_t)STAGES_NUM, sizeof(tx_ctx_t));
+        stages = calloc((size_t)STAGES_NUM, sizeof(tx_stage_t));
+        if (!stage_txs || !stages) {
+            log_msg(LOG_ERROR, "TX stage alloc failed");
+            return 1;
+        }
+        for (int i = 0; i < STAGES_NUM; i++) {
+            if (tx_init(&stage_txs[i], cfg.iface ? cfg.iface : "lo") != 0) {
+                log_msg(LOG_ERROR, "tx_init failed");
+                return 1;
+            }
+            if (cfg.tx_ring && tx_ring_enable(&stage_txs[i]) != 0) {
+                log_msg(LOG_WARN, "TX stage %d: TX ring unavailable, using sendmmsg", i);
+            }
+        }
+    }
 
     /* IV. Init rule table, load rules */
     rule_table_t *rt = malloc(sizeof(rule_table_t));
@@ -418,12 +1737,49 @@ int main(int argc, char **argv) {
         log_msg(LOG_ERROR, "rule_table_init malloc failed");
         return 1;
     }
-    rule_table_init(rt, 1024);
     if (cfg.rules_file) {
-        if (rule_config_load(cfg.rules_file, rt) != 0) {
+        if (rule_table_load(cfg.rules_file, rt) != 0) {
             log_msg(LOG_ERROR, "Failed to load rules from %s", cfg.rules_file);
             return 1;
         }
+    } else {
+        rule_table_init(rt, RULE_TABLE_DEFAULT_CAPACITY);
+        rule_table_compile(rt);
+    }
+    if (rt->cls) {
+        log_msg(LOG_INFO, "Rule classifier: %zu rules in %zu tuples", rt->count,
+                rt->cls->tuple_count);
+    }
+
+    /* Extra TX ports: one context per worker for each other interface a rule forwards to.
+     * The worker sends on them itself, also in pipeline mode (the stages own the default one). */
+    int egress[WORKER_TX_MAX_PORTS - 1];
+    size_t egress_num = egress_ifaces(rt, txs[0].ifindex, egress, WORKER_TX_MAX_PORTS - 1);
+    tx_ctx_t *port_txs = NULL;
+    if (egress_num > 0) {
+        port_txs = calloc((size_t)WORKERS_NUM * egress_num, sizeof(tx_ctx_t));
+        if (!port_txs) {
+            log_msg(LOG_ERROR, "tx context alloc failed");
+            return 1;
+        }
+    }
+    for (size_t e = 0; e < egress_num; e++) {
+        char name[IF_NAMESIZE];
+        if (!if_indextoname((unsigned int)egress[e], name)) {
+            log_msg(LOG_ERROR, "No interface with ifindex %d: %s", egress[e], strerror(errno));
+            return 1;
+        }
+        for (int i = 0; i < WORKERS_NUM; i++) {
+            tx_ctx_t *t = &port_txs[(size_t)i * egress_num + e];
+            if (tx_init(t, name) != 0) {
+                log_msg(LOG_ERROR, "tx_init(%s) failed", name);
+                return 1;
+            }
+            if (cfg.tx_ring && tx_ring_enable(t) != 0) {
+                log_msg(LOG_WARN, "Worker %d: TX ring on %s unavailable, using sendmmsg", i, name);
+            }
+        }
+        log_msg(LOG_INFO, "Egress port %zu: %s (ifindex %d)", e + 1, name, egress[e]);
     }
 
     /* V. Init ARP Table */
@@ -440,15 +1796,138 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    /* VII. Start workers */
-    worker_t *workers = calloc((size_t)WORKERS_NUM, sizeof(worker_t));
+    /* Control plane: ARP/NDP from every worker's ring, replies through its own context. */
+    spsc_ring_t *ctrl_rings = calloc((size_t)WORKERS_NUM, sizeof(spsc_ring_t));
+    tx_ctx_t ctrl_tx;
+    if (!ctrl_rings) {
+        log_msg(LOG_ERROR, "control ring alloc failed");
+        return 1;
+    }
+    for (int i = 0; i < WORKERS_NUM; i++) {
+        if (ring_init(&ctrl_rings[i], CONTROL_RING_SIZE) != 0) {
+            log_msg(LOG_ERROR, "control ring_init failed");
+            return 1;
+        }
+    }
+    if (tx_init(&ctrl_tx, cfg.iface ? cfg.iface : "lo") != 0) {
+        log_msg(LOG_ERROR, "tx_init failed");
+        return 1;
+    }
+    control_plane_t control;
+    control_init(&control, -1, &ctrl_tx, &arpt, &ndpt, cfg.reply_rate);
+    for (int i = 0; i < WORKERS_NUM; i++) {
+        control_add_ring(&control, &ctrl_rings[i]);
+    }
+
+    /* VII. Per-worker RX sources (per-worker layout only) */
+    worker_rx_src_t *rx_srcs = NULL;
+    xdp_prog_t xdp_prog = {.ifindex = 0, .prog_fd = -1, .map_fd = -1, .link_fd = -1};
+    if (cfg.per_worker_rx) {
+        rx_srcs = calloc((size_t)WORKERS_NUM, sizeof(worker_rx_src_t));
+        if (!rx_srcs ||
+            open_worker_rx_sources(&cfg, rx_srcs, WORKERS_NUM, worker_pools, &xdp_prog) != 0) {
+            log_msg(LOG_ERROR, "Failed to open per-worker RX sources on %s", cfg.iface);
+            return 1;
+        }
+    }
+
+    /* Bound before any thread starts, so a taken address fails the start-up cleanly. */
+    metrics_server_t metrics;
+    if (cfg.metrics_addr && metrics_server_start(&metrics, cfg.metrics_addr) != 0) {
+        return 1;
+    }
+    rule_api_t rule_api;
+    if (cfg.rule_api_path && rule_api_start(&rule_api, cfg.rule_api_path) != 0) {
+        return 1;
+    }
+
+    /* VIII. Start workers */
+    /* Aligned: each worker_t starts on its own cache line (see worker.h). */
+    worker_t *workers = aligned_alloc(CACHE_LINE_SIZE, (size_t)WORKERS_NUM * sizeof(worker_t));
+    if (workers) memset(workers, 0, (size_t)WORKERS_NUM * sizeof(worker_t));
     double cycles_per_ns = latency_calibrate_tsc();
     log_msg(LOG_INFO, "TSC calibration: %.2f cycles/ns", cycles_per_ns);
     worker_set_tsc_calibration(cycles_per_ns);
+    worker_set_flow_cache_size(cfg.flow_cache_entries);
+    worker_set_conntrack_size(cfg.conntrack_entries);
+    worker_set_perf(cfg.perf);
+    worker_set_idle_mode(cfg.idle_mode);
+    worker_set_stage_sampling(cfg.stage_sample);
+
+    /* Packet mirror: a ring per worker to the mirror thread, which writes pcapng. */
+    mirror_t mirror;
+    if (cfg.mirror_to && mirror_init(&mirror, cfg.mirror_to, (unsigned int)WORKERS_NUM,
+                                     cfg.mirror_every, cfg.mirror_budget, cycles_per_ns) != 0) {
+        return 1;
+    }
+
+    /* One QSBR reader slot per worker, for rule reloads. */
+    qsbr_t qsbr;
+    if (qsbr_init(&qsbr, (size_t)WORKERS_NUM) != 0) {
+        log_msg(LOG_ERROR, "qsbr_init failed");
+        return 1;
+    }
+
+    /* From here on the dataplane threads log through rings, see log.h. */
+    if (log_async_start() != 0) {
+        log_msg(LOG_WARN, "log_async_start failed, logging synchronously");
+    }
+
+    /* Pipeline: TX stages first, so nothing a worker hands off sits unserved.
+     * Worker i goes to stage i % STAGES_NUM. */
+    for (int s = 0; s < STAGES_NUM; s++) {
+        tx_stage_init(&stages[s], s, stage_cores[s], &stage_txs[s], cfg.idle_mode);
+        for (int i = s; i < WORKERS_NUM; i += STAGES_NUM) {
+            tx_stage_add_ring(&stages[s], &tx_rings[i]);
+        }
+        if (tx_stage_start(&stages[s]) != 0) {
+            log_msg(LOG_ERROR, "tx_stage_start(%d) failed", s);
+            return 1;
+        }
+    }
+    if (cfg.pipeline) {
+        log_msg(LOG_INFO, "Pipeline mode: %d workers hand TX off to %d TX stage(s)", WORKERS_NUM,
+                STAGES_NUM);
+    }
+
+    if (control_start(&control) != 0) {
+        log_msg(LOG_ERROR, "control_start failed");
+        return 1;
+    }
+    if (cfg.mirror_to && mirror_start(&mirror) != 0) {
+        log_msg(LOG_ERROR, "mirror_start failed");
+        return 1;
+    }
 
     for (int i = 0; i < WORKERS_NUM; i++) {
-        worker_init(&workers[i], i, worker_cores[i], &rings[i], &pool, rt, &tx, &arpt, &ndpt);
+        if (worker_init(&workers[i], i, worker_cores[i], &rings[i], worker_pools[i], rt, &txs[i],
+                        &arpt, &ndpt) != 0) {
+            log_msg(LOG_ERROR, "worker_init(%d) failed", i);
+            return 1;
+        }
+        workers[i].rx_src = rx_srcs ? &rx_srcs[i] : NULL;
+        workers[i].tx_ring = tx_rings ? &tx_rings[i] : NULL;
+        workers[i].ctrl_ring = &ctrl_rings[i];
+        if (cfg.mirror_to) {
+            workers[i].mirror = &mirror;
+            workers[i].mirror_ring = mirror_ring(&mirror, (unsigned int)i);
+        }
+        workers[i].qsbr = &qsbr;
+        workers[i].qsbr_id = (size_t)i;
+        for (size_t e = 0; e < egress_num; e++) {
+            worker_add_tx_port(&workers[i], &port_txs[(size_t)i * egress_num + e]);
+        }
+    }
 
+    /* Policers start evenly split; the stats thread moves the shares after. */
+    double tsc_hz = cycles_per_ns * 1e9;
+    worker_rules_t *initial[UPE_WORKERS_MAX];
+    for (int i = 0; i < WORKERS_NUM; i++) {
+        initial[i] = atomic_load(&workers[i].rules);
+    }
+    configure_policers(rt, initial, WORKERS_NUM, tsc_hz);
+
+    for (int i = 0; i < WORKERS_NUM; i++) {
         if (worker_start(&workers[i]) != 0) {
             log_msg(LOG_ERROR, "worker_start(%d) failed", i);
             return 1;
@@ -464,13 +1943,34 @@ int main(int argc, char **argv) {
         }
     }
 
-    /* VIII. Start RX (blocking) */
+    /* IX. Start RX (blocking) */
     rx_ctx_t rx;
+    rx.mode = cfg.rx_mode;
     rx.iface = cfg.iface;
     rx.pcap_file = cfg.pcap_file;
-    rx.pool = &pool;
+    rx.pools = rx_pools;
     rx.rings = rings;
-    rx.ring_count = WORKERS_NUM;
+    rx.ring_count = (uint16_t)WORKERS_NUM;
+    rx.wake_workers = cfg.idle_mode == IDLE_MODE_WAKEUP;
+    rx.reta = NULL;
+    rx.reta_tick = 0;
+    rx.nobuf_drops = 0;
+    rx.oversized_drops = 0;
+    rx.early_drops = 0;
+
+    /* RETA: flow hash buckets -> worker rings, rebalanced by the stats thread. */
+    reta_t *reta = NULL;
+    if (!cfg.per_worker_rx) {
+        reta = malloc(sizeof(reta_t));
+        if (!reta || reta_init(reta, (uint16_t)WORKERS_NUM) != 0) {
+            log_msg(LOG_ERROR, "reta_init failed");
+            return 1;
+        }
+        for (int i = 0; i < WORKERS_NUM; i++) {
+            reta->done[i] = &workers[i].pkts_done;
+        }
+        rx.reta = reta;
+    }
 
     /* Start stats thread */
     pthread_t stats_th;
@@ -479,40 +1979,117 @@ int main(int argc, char **argv) {
                              .rt          = rt,
                              .core_id     = stats_core,
                              .rules_file  = cfg.rules_file,
+                             .rule_api    = cfg.rule_api_path ? &rule_api : NULL,
+                             .rule_base   = NULL,
                              .arpt        = &arpt,
-                             .ndpt        = &ndpt};
+                             .ndpt        = &ndpt,
+                             .qsbr        = &qsbr,
+                             .reta        = reta,
+                             .rings       = rings,
+                             .stages      = stages,
+                             .control     = &control,
+                             .mirror      = cfg.mirror_to ? &mirror : NULL,
+                             .num_stages  = STAGES_NUM,
+                             .pools       = pools,
+                             .pool_ready  = pool_ready,
+                             .numa_nodes  = numa_nodes,
+                             .metrics     = cfg.metrics_addr ? &metrics : NULL,
+                             /* Under systemd or a supervisor the scrape replaces the screen. */
+                             .dashboard   = !cfg.metrics_addr || isatty(STDOUT_FILENO),
+                             .tsc_hz      = tsc_hz,
+                             .perf        = cfg.perf};
     pthread_create(&stats_th, NULL, stats_thread_func, &stats_ctx);
 
-    rx_start(&rx);
+    if (cfg.per_worker_rx) {
+        /* Workers poll their own sources; the main thread only waits for a signal. */
+        while (!g_stop) {
+            struct timespec ts = {.tv_sec = 0, .tv_nsec = 100 * 1000 * 1000};
+            nanosleep(&ts, NULL);
+        }
+    } else {
+        log_thread_attach();
+        rx_start(&rx);
+    }
 
-    /* IX. RX returned => stop workers and join */
+    /* X. RX returned => stop workers and join */
     sleep(1);
     g_stop = 1;
 
     /* Join stats thread */
     pthread_join(stats_th, NULL);
+    if (stats_ctx.metrics) metrics_server_stop(stats_ctx.metrics);
+    if (stats_ctx.rule_api) rule_api_stop(stats_ctx.rule_api);
 
     for (int i = 0; i < WORKERS_NUM; i++) {
         worker_join(&workers[i]);
     }
+    /* Workers are gone: the stages send what they handed off last, then stop. */
+    for (int i = 0; i < STAGES_NUM; i++) {
+        tx_stage_stop(&stages[i]);
+    }
+    control_stop(&control);
+    /* Before the pools go: the last samples still hold buffers. */
+    if (cfg.mirror_to) {
+        mirror_stop(&mirror);
+        mirror_destroy(&mirror);
+    }
 
-    /* X. Cleanup */
-    tx_close(&tx);
+    /* XI. Cleanup */
+    if (rx_srcs) {
+        for (int i = 0; i < WORKERS_NUM; i++) {
+            if (rx_srcs[i].mode == RX_MODE_XDP) {
+                xsk_close(&rx_srcs[i].xsk);
+            } else {
+                rx_afpacket_close(&rx_srcs[i].afp);
+            }
+        }
+        free(rx_srcs);
+    }
+    xdp_prog_detach(&xdp_prog);
+    for (int i = 0; i < WORKERS_NUM; i++) {
+        tx_close(&txs[i]);
+    }
+    free(txs);
+    for (size_t i = 0; i < (size_t)WORKERS_NUM * egress_num; i++) {
+        tx_close(&port_txs[i]);
+    }
+    free(port_txs);
+    for (int i = 0; i < STAGES_NUM; i++) {
+        tx_close(&stage_txs[i]);
+    }
+    free(stage_txs);
+    tx_close(&ctrl_tx);
+    for (int i = 0; i < WORKERS_NUM; i++) {
+        ring_destroy(&ctrl_rings[i]);
+    }
+    free(ctrl_rings);
+    free(stages);
     for (int i = 0; i < WORKERS_NUM; i++) {
         ring_destroy(&rings[i]);
+        if (tx_rings) ring_destroy(&tx_rings[i]);
     }
     free(rings);
+    free(tx_rings);
 
-    pktbuf_pool_destroy(&pool);
+    for (int n = 0; n < numa_nodes; n++) {
+        if (pool_ready[n]) pktbuf_classes_destroy(&pools[n]);
+    }
+    free(pools);
+    free(pool_ready);
     arp_table_destroy(&arpt);
     ndp_table_destroy(&ndpt);
     /* rt probably has been replaced by SIGHUP reload, so read the current pointer */
-    rule_table_destroy((rule_table_t *)stats_ctx.rt);
-    free((void *)stats_ctx.rt);
+    rule_table_destroy(stats_ctx.rt);
+    free(stats_ctx.rt);
+    free(stats_ctx.rule_base);
     for (int i = 0; i < WORKERS_NUM; i++) {
         worker_destroy(&workers[i]);
     }
     free(workers);
+    qsbr_destroy(&qsbr);
+    reta_destroy(reta);
+    free(reta);
+    log_async_stop();
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,199 @@
+#define _POSIX_C_SOURCE 200809L
+#include "metrics.h"
+#include "log.h"
+#include "sock.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define METRICS_REQUEST_MAX 1024
+
+static int listen_tcp(const char *addr) {
+    char host[256] = "127.0.0.1";
+    const char *port = addr;
+
+    const char *colon = strrchr(addr, ':');
+    if (colon) {
+        const char *h = addr;
+        size_t hlen = (size_t)(colon - addr);
+        if (hlen >= 2 && h[0] == '[' && h[hlen - 1] == ']') {
+            h++;
+            hlen -= 2;
+        }
+        if (hlen == 0 || hlen >= sizeof(host)) {
+            log_msg(LOG_ERROR, "Metrics: invalid address '%s'", addr);
+            return -1;
+        }
+        memcpy(host, h, hlen);
+        host[hlen] = '\0';
+        port = colon + 1;
+    }
+
+    char *end = NULL;
+    long p = strtol(port, &end, 10);
+    if (end == port || *end != '\0' || p < 0 || p > 65535) {
+        log_msg(LOG_ERROR, "Metrics: invalid port in '%s'", addr);
+        return -1;
+    }
+
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    int rc = getaddrinfo(host, port, &hints, &res);
+    if (rc != 0) {
+        log_msg(LOG_ERROR, "Metrics: cannot resolve '%s': %s", host, gai_strerror(rc));
+        return -1;
+    }
+
+    int fd = socket(res->ai_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        log_msg(LOG_ERROR, "socket() failed: %s", strerror(errno));
+        freeaddrinfo(res);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, res->ai_addr, res->ai_addrlen) != 0) {
+        log_msg(LOG_ERROR, "Metrics: bind(%s) failed: %s", addr, strerror(errno));
+        close(fd);
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+    if (listen(fd, 16) != 0) {
+        log_msg(LOG_ERROR, "Metrics: listen() failed: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Read the request head (up to the empty line) and answer it. */
+static void serve_client(metrics_server_t *m, int fd) {
+    char req[METRICS_REQUEST_MAX];
+    size_t used = 0;
+
+    for (;;) {
+        ssize_t n = recv(fd, req + used, sizeof(req) - 1 - used, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return; /* Closed early, or the 1s timeout */
+        used += (size_t)n;
+        req[used] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+        if (used == sizeof(req) - 1) break; /* The request line is all we need */
+    }
+
+    /* "GET <path> HTTP/1.x": anything else is not ours. */
+    char path[256] = "";
+    if (sscanf(req, "GET %255s", path) != 1) path[0] = '\0';
+    char *query = strchr(path, '?');
+    if (query) *query = '\0';
+
+    int fmt = -1;
+    if (strcmp(path, "/metrics") == 0 || strcmp(path, "/") == 0) {
+        fmt = METRICS_PROMETHEUS;
+    } else if (strcmp(path, "/metrics.json") == 0) {
+        fmt = METRICS_JSON;
+    }
+
+    if (fmt < 0) {
+        static const char not_found[] = "HTTP/1.0 404 Not Found\r\n"
+                                        "Content-Length: 0\r\nConnection: close\r\n\r\n";
+        sock_send_all(fd, not_found, sizeof(not_found) - 1);
+        return;
+    }
+
+    /* Copy out, so a slow client never holds up the next publish. */
+    pthread_mutex_lock(&m->lock);
+    size_t len = m->len[fmt];
+    char *body = len > 0 ? malloc(len) : NULL;
+    if (body) memcpy(body, m->body[fmt], len);
+    pthread_mutex_unlock(&m->lock);
+    if (!body) len = 0;
+
+    char head[160];
+    int hlen = snprintf(head, sizeof(head),
+                        "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                        "Connection: close\r\n\r\n",
+                        fmt == METRICS_JSON ? "application/json"
+                                            : "text/plain; version=0.0.4",
+                        len);
+    if (sock_send_all(fd, head, (size_t)hlen) == 0 && len > 0) sock_send_all(fd, body, len);
+    free(body);
+}
+
+static void *metrics_thread_func(void *arg) {
+    metrics_server_t *m = (metrics_server_t *)arg;
+
+    while (!atomic_load_explicit(&m->stop, memory_order_relaxed)) {
+        int c = sock_accept(m->fd, 500, 1000);
+        if (c < 0) continue;
+
+        serve_client(m, c);
+        close(c);
+    }
+    return NULL;
+}
+
+int metrics_server_start(metrics_server_t *m, const char *addr) {
+    memset(m, 0, sizeof(*m));
+    m->fd = -1;
+    if (!addr) return -1;
+
+    int fd;
+    if (strncmp(addr, "unix:", 5) == 0) {
+        fd = sock_listen_unix(addr + 5, 16, "Metrics");
+        if (fd >= 0) strcpy(m->path, addr + 5);
+    } else {
+        fd = listen_tcp(addr);
+    }
+    if (fd < 0) return -1;
+
+    m->fd = fd;
+    atomic_init(&m->stop, false);
+    pthread_mutex_init(&m->lock, NULL);
+    if (pthread_create(&m->thread, NULL, metrics_thread_func, m) != 0) {
+        log_msg(LOG_ERROR, "Metrics: failed to start the server thread");
+        pthread_mutex_destroy(&m->lock);
+        close(fd);
+        if (m->path[0]) unlink(m->path);
+        m->fd = -1;
+        return -1;
+    }
+
+    log_msg(LOG_INFO, "Metrics: serving /metrics and /metrics.json on %s", addr);
+    return 0;
+}
+
+void metrics_server_publish(metrics_server_t *m, metrics_format_t fmt, char *body, size_t len) {
+    pthread_mutex_lock(&m->lock);
+    char *old = m->body[fmt];
+    m->body[fmt] = body;
+    m->len[fmt] = body ? len : 0;
+    pthread_mutex_unlock(&m->lock);
+    free(old);
+}
+
+void metrics_server_stop(metrics_server_t *m) {
+    if (m->fd < 0) return;
+
+    atomic_store(&m->stop, true);
+    pthread_join(m->thread, NULL);
+    close(m->fd);
+    m->fd = -1;
+    if (m->path[0]) unlink(m->path);
+
+    for (int f = 0; f < METRICS_FORMATS; f++) {
+        free(m->body[f]);
+        m->body[f] = NULL;
+        m->len[f] = 0;
+    }
+    pthread_mutex_destroy(&m->lock);
+}
@@ -0,0 +1,344 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mirror.h"
+#include "affinity.h"
+#include "latency.h"
+#include "log.h"
+#include "sock.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NS_PER_SEC 1000000000ULL
+#define MIRROR_IDLE_US 100 /* Sleep while the rings are empty */
+#define MIRROR_ACCEPT_MS 100 /* Wait for a client at a time, while there is none */
+
+/*
+    pcapng blocks, in host byte order (the section header's magic tells it).
+    One Ethernet interface with nanosecond timestamps; each frame is an
+    Enhanced Packet Block: header, frame, padding to 4 bytes, total length.
+*/
+#define PCAPNG_SHB 0x0A0D0D0Au
+#define PCAPNG_IDB 0x00000001u
+#define PCAPNG_EPB 0x00000006u
+#define PCAPNG_BYTE_ORDER 0x1A2B3C4Du
+#define PCAPNG_LINKTYPE_ETHERNET 1
+#define PCAPNG_OPT_TSRESOL 9
+
+typedef struct {
+    uint32_t type;
+    uint32_t len;
+    uint32_t byte_order;
+    uint16_t major;
+    uint16_t minor;
+    uint32_t section_len[2]; /* -1: not given */
+    uint32_t len_again;
+} pcapng_shb_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t len;
+    uint16_t linktype;
+    uint16_t reserved;
+    uint32_t snaplen;
+    uint16_t tsresol_code;
+    uint16_t tsresol_len;
+    uint8_t tsresol; /* 9: 10^-9 s */
+    uint8_t tsresol_pad[3];
+    uint32_t opt_end;
+    uint32_t len_again;
+} pcapng_idb_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t len;
+    uint32_t iface;
+    uint32_t ts_high;
+    uint32_t ts_low;
+    uint32_t caplen;
+    uint32_t origlen;
+} pcapng_epb_t;
+
+_Static_assert(sizeof(pcapng_shb_t) == 28, "pcapng section header layout");
+_Static_assert(sizeof(pcapng_idb_t) == 32, "pcapng interface description layout");
+_Static_assert(sizeof(pcapng_epb_t) == 28, "pcapng enhanced packet header layout");
+
+/* Write all of iov[0..cnt), across partial writes. Returns 0, or -1 on failure. */
+static int write_all(mirror_t *m, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t n;
+        if (m->listen_fd >= 0) {
+            /* A client that left must not raise SIGPIPE: sendmsg() is writev() with flags. */
+            struct msghdr msg = {.msg_iov = iov, .msg_iovlen = (size_t)cnt};
+            n = sendmsg(m->fd, &msg, MSG_NOSIGNAL);
+        } else {
+            n = writev(m->fd, iov, cnt);
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        size_t done = (size_t)n;
+        while (cnt > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    return 0;
+}
+
+/* Section header and our one interface: the start of every file and stream. */
+static int write_header(mirror_t *m) {
+    pcapng_shb_t shb = {.type = PCAPNG_SHB,
+                        .len = sizeof(shb),
+                        .byte_order = PCAPNG_BYTE_ORDER,
+                        .major = 1,
+                        .minor = 0,
+                        .section_len = {UINT32_MAX, UINT32_MAX},
+                        .len_again = sizeof(shb)};
+    pcapng_idb_t idb = {.type = PCAPNG_IDB,
+                        .len = sizeof(idb),
+                        .linktype = PCAPNG_LINKTYPE_ETHERNET,
+                        .snaplen = PKTBUF_MAX_SIZE,
+                        .tsresol_code = PCAPNG_OPT_TSRESOL,
+                        .tsresol_len = 1,
+                        .tsresol = 9,
+                        .len_again = sizeof(idb)};
+    struct iovec iov[2] = {{.iov_base = &shb, .iov_len = sizeof(shb)},
+                           {.iov_base = &idb, .iov_len = sizeof(idb)}};
+    return write_all(m, iov, 2);
+}
+
+/* The output failed (client gone, disk full): stop sampling until there is a new one. */
+static void output_failed(mirror_t *m) {
+    atomic_store_explicit(&m->active, false, memory_order_relaxed);
+    if (m->listen_fd >= 0) {
+        log_msg(LOG_INFO, "Mirror: client on %s disconnected", m->path);
+    } else {
+        log_msg(LOG_ERROR, "Mirror: write failed: %s, mirroring stopped", strerror(errno));
+    }
+    close(m->fd);
+    m->fd = -1;
+}
+
+/* Wall clock of an RX timestamp; frames without one get the time of writing. */
+static uint64_t frame_time_ns(const mirror_t *m, uint64_t tsc) {
+    if (tsc == 0 || m->ns_per_cycle == 0.0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (uint64_t)ts.tv_sec * NS_PER_SEC + (uint64_t)ts.tv_nsec;
+    }
+    double delta = (double)(int64_t)(tsc - m->tsc0) * m->ns_per_cycle;
+    return (uint64_t)((int64_t)m->wall0_ns + (int64_t)delta);
+}
+
+void mirror_write(mirror_t *m, pktbuf_t **bufs, unsigned int n) {
+    pcapng_epb_t hdr[MIRROR_BURST];
+    uint8_t tail[MIRROR_BURST][8]; /* Padding, then the block length again */
+    struct iovec iov[3 * MIRROR_BURST];
+    int cnt = 0;
+    uint64_t bytes = 0;
+
+    if (n > MIRROR_BURST) n = MIRROR_BURST;
+
+    if (m->fd < 0) {
+        m->frames_lost += n;
+    } else {
+        for (unsigned int i = 0; i < n; i++) {
+            const pktbuf_t *b = bufs[i];
+            size_t pad = (4 - (b->len & 3)) & 3;
+            uint32_t total = (uint32_t)(sizeof(pcapng_epb_t) + b->len + pad + sizeof(uint32_t));
+            uint64_t ts = frame_time_ns(m, b->timestamp);
+
+            hdr[i] = (pcapng_epb_t){.type = PCAPNG_EPB,
+                                    .len = total,
+                                    .iface = 0,
+                                    .ts_high = (uint32_t)(ts >> 32),
+                                    .ts_low = (uint32_t)ts,
+                                    .caplen = (uint32_t)b->len,
+                                    .origlen = (uint32_t)b->len};
+            memset(tail[i], 0, sizeof(tail[i]));
+            memcpy(tail[i] + pad, &total, sizeof(total));
+
+            /* The frame itself is written from the pool buffer, not copied. */
+            iov[cnt++] = (struct iovec){.iov_base = &hdr[i], .iov_len = sizeof(hdr[i])};
+            iov[cnt++] = (struct iovec){.iov_base = b->data, .iov_len = b->len};
+            iov[cnt++] = (struct iovec){.iov_base = tail[i], .iov_len = pad + sizeof(total)};
+            bytes += total;
+        }
+
+        if (write_all(m, iov, cnt) == 0) {
+            m->frames_written += n;
+            m->bytes_written += bytes;
+        } else {
+            m->frames_lost += n;
+            output_failed(m);
+        }
+    }
+
+    pktbuf_release_bulk(bufs, n);
+    mirror_unreserve(m, n);
+}
+
+/* Wait up to `timeout_ms` for a client; a new one gets the pcapng header first. */
+static void accept_client(mirror_t *m, int timeout_ms) {
+    /* A reader that stops reading is dropped after 1s instead of blocking the thread. */
+    int c = sock_accept(m->listen_fd, timeout_ms, 1000);
+    if (c < 0) return;
+
+    m->fd = c;
+    if (write_header(m) != 0) {
+        close(c);
+        m->fd = -1;
+        return;
+    }
+    m->clients++;
+    log_msg(LOG_INFO, "Mirror: client connected on %s", m->path);
+    atomic_store_explicit(&m->active, true, memory_order_relaxed);
+}
+
+int mirror_init(mirror_t *m, const char *to, unsigned int workers, uint32_t every,
+                uint32_t budget, double cycles_per_ns) {
+    if (!m) return -1;
+    memset(m, 0, sizeof(*m));
+    m->core_id = -1;
+    m->fd = -1;
+    m->listen_fd = -1;
+    if (!to || workers == 0 || workers > MIRROR_MAX_RINGS || budget == 0) return -1;
+
+    m->every = every;
+    m->budget = budget;
+    atomic_init(&m->held, 0);
+    atomic_init(&m->active, false);
+    atomic_init(&m->stop, false);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    m->tsc0 = rdtsc();
+    m->wall0_ns = (uint64_t)ts.tv_sec * NS_PER_SEC + (uint64_t)ts.tv_nsec;
+    m->ns_per_cycle = cycles_per_ns > 0.0 ? 1.0 / cycles_per_ns : 0.0;
+
+    /* Aligned: the ring heads and tails are on cache lines of their own. */
+    m->rings = aligned_alloc(CACHE_LINE_SIZE, workers * sizeof(spsc_ring_t));
+    if (m->rings) memset(m->rings, 0, workers * sizeof(spsc_ring_t));
+    if (!m->rings) {
+        log_msg(LOG_ERROR, "Mirror: ring alloc failed");
+        return -1;
+    }
+    for (unsigned int i = 0; i < workers; i++) {
+        if (ring_init(&m->rings[i], MIRROR_RING_SIZE) != 0) {
+            log_msg(LOG_ERROR, "Mirror: ring_init failed");
+            mirror_destroy(m);
+            return -1;
+        }
+        m->ring_count++;
+    }
+
+    if (strncmp(to, "unix:", 5) == 0) {
+        m->listen_fd = sock_listen_unix(to + 5, 1, "Mirror");
+        if (m->listen_fd < 0) {
+            mirror_destroy(m);
+            return -1;
+        }
+        strcpy(m->path, to + 5);
+        log_msg(LOG_INFO, "Mirror: pcapng stream on %s (1 in %u, budget %u buffers)", to, every,
+                budget);
+        return 0;
+    }
+
+    m->fd = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m->fd < 0 || write_header(m) != 0) {
+        log_msg(LOG_ERROR, "Mirror: cannot write %s: %s", to, strerror(errno));
+        mirror_destroy(m);
+        return -1;
+    }
+    atomic_store_explicit(&m->active, true, memory_order_relaxed);
+    log_msg(LOG_INFO, "Mirror: writing pcapng to %s (1 in %u, budget %u buffers)", to, every,
+            budget);
+    return 0;
+}
+
+static void *mirror_main(void *arg) {
+    mirror_t *m = (mirror_t *)arg;
+    pktbuf_t *bufs[MIRROR_BURST];
+
+    if (m->core_id >= 0) {
+        if (affinity_pin_self(m->core_id) != 0) {
+            log_msg(LOG_WARN, "Mirror: failed to pin to core %d", m->core_id);
+        } else {
+            log_msg(LOG_INFO, "Mirror: pinned to core %d", m->core_id);
+        }
+    }
+
+    while (1) {
+        /* Read before the rings: once set, no worker pushes any more. */
+        bool stop = atomic_load_explicit(&m->stop, memory_order_acquire);
+
+        unsigned int total = 0;
+        for (unsigned int i = 0; i < m->ring_count; i++) {
+            unsigned int n = ring_pop_burst(&m->rings[i], (void **)bufs, MIRROR_BURST);
+            if (n == 0) continue;
+            mirror_write(m, bufs, n);
+            total += n;
+        }
+        if (total > 0) continue;
+        if (stop) break;
+
+        /* Out of work: the buffers this thread released go back to their pools
+         * now, not only once its cache overflows, so the budget is all it holds. */
+        pktbuf_thread_flush();
+        if (m->listen_fd >= 0 && m->fd < 0) {
+            accept_client(m, MIRROR_ACCEPT_MS);
+        } else {
+            struct timespec ts = {.tv_sec = 0, .tv_nsec = MIRROR_IDLE_US * 1000};
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    pktbuf_thread_flush();
+    return NULL;
+}
+
+int mirror_start(mirror_t *m) {
+    if (!m || !m->rings) return -1;
+    return pthread_create(&m->thread, NULL, mirror_main, m);
+}
+
+void mirror_stop(mirror_t *m) {
+    if (!m) return;
+    atomic_store_explicit(&m->stop, true, memory_order_release);
+    pthread_join(m->thread, NULL);
+}
+
+void mirror_destroy(mirror_t *m) {
+    if (!m) return;
+    atomic_store_explicit(&m->active, false, memory_order_relaxed);
+    if (m->fd >= 0) close(m->fd);
+    m->fd = -1;
+    if (m->listen_fd >= 0) close(m->listen_fd);
+    m->listen_fd = -1;
+    if (m->path[0]) unlink(m->path);
+    m->path[0] = '\0';
+
+    /* Left in the rings if the thread never ran: back to the pools unwritten. */
+    pktbuf_t *bufs[MIRROR_BURST];
+    for (unsigned int i = 0; i < m->ring_count; i++) {
+        unsigned int n;
+        while ((n = ring_pop_burst(&m->rings[i], (void **)bufs, MIRROR_BURST)) > 0) {
+            mirror_write(m, bufs, n);
+        }
+        ring_destroy(&m->rings[i]);
+    }
+    free(m->rings);
+    m->rings = NULL;
+    m->ring_count = 0;
+}
@@ -3,6 +3,29 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* Seqlock helpers, see ndp_table.h. */
+static inline void write_begin(ndp_table_t *t) {
+    atomic_fetch_add_explicit(&t->seq, 1, memory_order_relaxed); /* odd */
+    atomic_thread_fence(memory_order_release); /* ... before any entry store */
+}
+
+static inline void write_end(ndp_table_t *t) {
+    atomic_fetch_add_explicit(&t->seq, 1, memory_order_release); /* even */
+}
+
+static inline unsigned read_begin(ndp_table_t *t) {
+    unsigned s;
+    /* Odd: a writer is in the middle of an update, which takes microseconds. */
+    while ((s = atomic_load_explicit(&t->seq, memory_order_acquire)) & 1u) {
+    }
+    return s;
+}
+
+static inline bool read_retry(ndp_table_t *t, unsigned s) {
+    atomic_thread_fence(memory_order_acquire); /* Entry loads complete first */
+    return atomic_load_explicit(&t->seq, memory_order_relaxed) != s;
+}
+
 static size_t hash_ipv6(const uint8_t *ip, size_t capacity) {
     /* Fold the 16 bytes, XOR the parts */
     uint32_t h = 0;
@@ -23,66 +46,99 @@ int ndp_table_init(ndp_table_t *t, size_t capacity) {
     if (!t->entries) return -1;
 
     t->capacity = capacity;
-    pthread_rwlock_init(&t->lock, NULL);
+    atomic_init(&t->seq, 2);
+    pthread_mutex_init(&t->write_lock, NULL);
     return 0;
 }
 
 void ndp_table_destroy(ndp_table_t *t) {
     if (!t) return;
 
-    pthread_rwlock_destroy(&t->lock);
+    pthread_mutex_destroy(&t->write_lock);
     free(t->entries);
     t->entries = NULL;
     t->capacity = 0;
 }
 
-void ndp_update(ndp_table_t *t, const uint8_t *ip, const uint8_t *mac) {
-    if (!t || !ip || !mac) return;
-
+/* Insert or refresh one entry; opens the write section (once) if anything changes. */
+static void ndp_upsert(ndp_table_t *t, const uint8_t *ip, const uint8_t *mac, time_t now,
+                       bool *writing) {
     size_t idx = hash_ipv6(ip, t->capacity);
 
-    pthread_rwlock_wrlock(&t->lock);
     for (size_t i = 0; i < t->capacity; i++) {
         size_t curr = (idx + i) & (t->capacity - 1);
 
         if (!t->entries[curr].valid) {
             /* Empty slot */
+            if (!*writing) write_begin(t);
+            *writing = true;
             t->entries[curr].valid = true;
             memcpy(t->entries[curr].ip, ip, 16);
             memcpy(t->entries[curr].mac, mac, 6);
-            t->entries[curr].update_at = time(NULL);
-            break;
+            t->entries[curr].update_at = now;
+            return;
         }
 
         if (memcmp(t->entries[curr].ip, ip, 16) == 0) {
             /* Update existing entry */
-            memcpy(t->entries[curr].mac, mac, 6);
-            t->entries[curr].update_at = time(NULL);
-            break;
+            if (memcmp(t->entries[curr].mac, mac, 6) != 0) {
+                if (!*writing) write_begin(t);
+                *writing = true;
+                memcpy(t->entries[curr].mac, mac, 6);
+            }
+            t->entries[curr].update_at = now;
+            return;
         }
     }
-    pthread_rwlock_unlock(&t->lock);
+}
+
+void ndp_update(ndp_table_t *t, const uint8_t *ip, const uint8_t *mac) {
+    if (!ip || !mac) return;
+    ndp_update_bulk(t, (const uint8_t(*)[16])ip, (const uint8_t(*)[6])mac, 1);
+}
+
+void ndp_update_bulk(ndp_table_t *t, const uint8_t (*ips)[16], const uint8_t (*macs)[6],
+                     size_t n) {
+    if (!t || !ips || !macs || n == 0) return;
+
+    time_t now = time(NULL);
+    bool writing = false;
+
+    pthread_mutex_lock(&t->write_lock);
+    for (size_t i = 0; i < n; i++) {
+        ndp_upsert(t, ips[i], macs[i], now, &writing);
+    }
+    if (writing) write_end(t);
+    pthread_mutex_unlock(&t->write_lock);
 }
 
 bool ndp_get_mac(ndp_table_t *t, const uint8_t *ip, uint8_t *out_mac) {
     if (!t || !ip || !out_mac) return false;
 
     size_t idx = hash_ipv6(ip, t->capacity);
+    bool found;
+    unsigned seq;
+
+    do {
+        seq = read_begin(t);
+        found = false;
+
+        /* Possibly torn reads, validated by read_retry(), see arp_get_mac(). */
+        for (size_t i = 0; i < t->capacity; i++) {
+            size_t curr = (idx + i) & (t->capacity - 1);
+            const ndp_entry_t *e = &t->entries[curr];
+
+            if (e->valid && memcmp(e->ip, ip, 16) == 0) {
+                memcpy(out_mac, e->mac, 6);
+                found = true;
+                break;
+            }
 
-    pthread_rwlock_rdlock(&t->lock);
-    for (size_t i = 0; i < t->capacity; i++) {
-        size_t curr = (idx + i) & (t->capacity - 1);
-
-        if (t->entries[curr].valid && memcmp(t->entries[curr].ip, ip, 16) == 0) {
-            memcpy(out_mac, t->entries[curr].mac, 6);
-            pthread_rwlock_unlock(&t->lock);
-            return true;
+            if (!e->valid) break;
         }
+    } while (read_retry(t, seq));
 
-        if (!t->entries[curr].valid) break;
-    }
-    pthread_rwlock_unlock(&t->lock);
-    return false;
+    return found;
 }
 
 size_t ndp_expire(ndp_table_t *t, time_t now) {
@@ -90,13 +146,16 @@ size_t ndp_expire(ndp_table_t *t, time_t now) {
 
     size_t evicted = 0;
 
-    pthread_rwlock_wrlock(&t->lock);
+    pthread_mutex_lock(&t->write_lock);
 
     for (size_t i = 0; i < t->capacity; i++) {
         if (!t->entries[i].valid) continue;
 
         if (now - t->entries[i].update_at < (time_t)NDP_TIMEOUT_SEC) continue;
 
+        /* One write section for the whole sweep, opened at the first eviction:
+         * the shifts below move entries that readers may be probing for. */
+        if (evicted == 0) write_begin(t);
         t->entries[i].valid = false;
         evicted++;
 
@@ -125,6 +184,7 @@ size_t ndp_expire(ndp_table_t *t, time_t now) {
         }
     }
 
-    pthread_rwlock_unlock(&t->lock);
+    if (evicted) write_end(t);
+    pthread_mutex_unlock(&t->write_lock);
     return evicted;
 }
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "neigh_cache.h"
+
+#include <string.h>
+
+_Static_assert(sizeof(neigh_cache_entry_t) == 32, "two neighbour entries per cache line");
+
+static inline void make_key(uint8_t ip_ver, const ip_addr_t *ip, uint64_t key[2]) {
+    if (ip_ver == 4) {
+        key[0] = ip->v4;
+        key[1] = 0;
+    } else {
+        memcpy(key, ip->v6, 16);
+    }
+}
+
+static inline uint32_t set_of(const uint64_t key[2]) {
+    /* Next hops often differ only in the low bits of the address: mix them up
+     * into the bits that select the set. */
+    uint64_t h = (key[0] ^ key[1]) * 0x9e3779b97f4a7c15ULL;
+    return (uint32_t)(h >> 58) & (NEIGH_CACHE_SETS - 1);
+}
+
+void neigh_cache_init(neigh_cache_t *c) {
+    memset(c, 0, sizeof(*c));
+}
+
+bool neigh_cache_get(neigh_cache_t *c, uint8_t ip_ver, const ip_addr_t *ip, uint32_t seq,
+                     uint8_t out_mac[6]) {
+    uint64_t key[2];
+    make_key(ip_ver, ip, key);
+    const neigh_cache_entry_t *set = c->entries[set_of(key)];
+
+    for (int way = 0; way < NEIGH_CACHE_WAYS; way++) {
+        const neigh_cache_entry_t *e = &set[way];
+        if (e->seq == seq && e->ip_ver == ip_ver && e->ip[0] == key[0] && e->ip[1] == key[1]) {
+            memcpy(out_mac, e->mac, 6);
+            c->hits++;
+            return true;
+        }
+    }
+    c->misses++;
+    return false;
+}
+
+void neigh_cache_put(neigh_cache_t *c, uint8_t ip_ver, const ip_addr_t *ip, uint32_t seq,
+                     const uint8_t mac[6]) {
+    uint64_t key[2];
+    make_key(ip_ver, ip, key);
+    uint32_t s = set_of(key);
+    neigh_cache_entry_t *set = c->entries[s];
+
+    /* Reuse the slot of the same address, or an empty/stale one, before evicting.
+     * Stale only means something within one family: the two tables' sequences
+     * are unrelated. */
+    int way = -1;
+    for (int i = 0; i < NEIGH_CACHE_WAYS; i++) {
+        if (set[i].ip_ver == ip_ver && set[i].ip[0] == key[0] && set[i].ip[1] == key[1]) {
+            way = i;
+            break;
+        }
+        if (way < 0 && (set[i].seq == 0 || (set[i].ip_ver == ip_ver && set[i].seq != seq))) {
+            way = i;
+        }
+    }
+    if (way < 0) {
+        way = c->next_victim[s];
+        c->next_victim[s] = (uint8_t)((way + 1) & (NEIGH_CACHE_WAYS - 1));
+    }
+
+    neigh_cache_entry_t *e = &set[way];
+    e->ip[0] = key[0];
+    e->ip[1] = key[1];
+    e->ip_ver = ip_ver;
+    e->seq = seq;
+    memcpy(e->mac, mac, 6);
+}
@@ -0,0 +1,83 @@
+#define _GNU_SOURCE /* syscall() */
+#include "perf.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const uint64_t EVENT_CONFIG[PERF_EVENTS] = {
+    [PERF_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+    [PERF_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+    [PERF_LLC_MISSES] = PERF_COUNT_HW_CACHE_MISSES, /* Last level cache */
+    [PERF_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES};
+
+static int perf_open(uint64_t config, bool exclude_kernel) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = exclude_kernel ? 1 : 0;
+    attr.exclude_hv = 1;
+
+    /* pid 0, cpu -1: the calling thread, on whichever CPU it runs. */
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void perf_counters_init(perf_counters_t *pc) {
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        pc->fd[e] = -1;
+    }
+}
+
+int perf_counters_open(perf_counters_t *pc) {
+    int opened = 0;
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        int fd = perf_open(EVENT_CONFIG[e], false);
+        /* perf_event_paranoid >= 2 leaves unprivileged users their own user time. */
+        if (fd < 0 && (errno == EACCES || errno == EPERM)) fd = perf_open(EVENT_CONFIG[e], true);
+        pc->fd[e] = fd;
+        if (fd < 0) continue;
+
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        opened++;
+    }
+    return opened;
+}
+
+bool perf_counters_read(const perf_counters_t *pc, uint64_t out[PERF_EVENTS]) {
+    bool any = false;
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        uint64_t v = 0;
+        if (pc->fd[e] >= 0 && read(pc->fd[e], &v, sizeof(v)) == (ssize_t)sizeof(v)) any = true;
+        out[e] = v;
+    }
+    return any;
+}
+
+void perf_counters_close(perf_counters_t *pc) {
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        if (pc->fd[e] >= 0) close(pc->fd[e]);
+        pc->fd[e] = -1;
+    }
+}
+
+const char *perf_event_name(perf_event_id_t e) {
+    switch (e) {
+    case PERF_CYCLES:
+        return "cycles";
+    case PERF_INSTRUCTIONS:
+        return "instructions";
+    case PERF_LLC_MISSES:
+        return "llc_misses";
+    case PERF_BRANCH_MISSES:
+        return "branch_misses";
+    default:
+        return "unknown";
+    }
+}
@@ -1,14 +1,17 @@
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS, MAP_HUGETLB, MAP_HUGE_SHIFT */
 #include "pktbuf.h"
+#include "affinity.h"
 #include "log.h"
 
+#include <linux/mempolicy.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
-#define LOCAL_CACHE_SIZE 64
-#define BULK_TRANSFER_SIZE (LOCAL_CACHE_SIZE / 2)
 #define HUGE_PAGE_SIZE (2UL * 1024 * 1024) /* 2 MB */
 #define MMAP_HUGE_2MB_FLAG (21 << MAP_HUGE_SHIFT)
 #define ALIGN_UP(n, align) (((n) + (align) - 1) & ~((align) - 1))
@@ -16,24 +19,56 @@
 typedef struct {
     pktbuf_pool_t *pool;
     size_t count;
-    pktbuf_t *items[LOCAL_CACHE_SIZE];
+    pktbuf_t *items[PKTBUF_CACHE_MAX]; /* Only pool->cache_size of them are used. */
 } local_cache_t;
 
 /*
-    Thread-local cache instance.
+    Thread-local cache instances, one per size class, so a thread freeing a mix
+    of small and standard buffers does not flush a cache on every switch.
     _Alignas(64) is to make sure cache starts on a cache line boundary.
     This should prevent false sharing if other thread-local variables are nearby.
     (Initialized to zero: pool=NULL, count=0, items all NULL.)
 */
-static _Thread_local _Alignas(64) local_cache_t t_cache = {0};
+static _Thread_local _Alignas(64) local_cache_t t_cache[PKTBUF_CLASSES];
+
+/* NUMA node of this thread, looked up on its first refill (-1 = not yet). */
+static _Thread_local int t_node = -1;
 
 /*
 -=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 Global Pool Operations
-- A stack implemented as an array with an atomic top index
+- A Treiber stack: free buffers are linked through next[] by buffer index,
+  and `head` packs the index of the first one with a tag.
 -=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 */
 
+/*
+    Why a tag: a popper reads head = A and next[A] = B, then gets preempted.
+    Meanwhile others pop A and B and push A back. head is A again, so a CAS on
+    the index alone would succeed and make B (now in use) the new head: B gets
+    handed out twice. Every successful CAS bumps the tag, so the stale CAS
+    fails instead. 32 bits only wrap if a thread stalls for 4G pool operations.
+
+    An index never goes stale the way a pointer does: next[] lives as long as
+    the pool, so even a popper racing with others reads a valid index
+    (or PKTBUF_NIL) at worst, never freed memory.
+*/
+_Static_assert(ATOMIC_LONG_LOCK_FREE == 2, "64-bit CAS on the stack head must be lock-free");
+
+#define PKTBUF_NIL UINT32_MAX /* End of the free list */
+
+static inline uint64_t head_pack(uint32_t index, uint32_t tag) {
+    return ((uint64_t)tag << 32) | index;
+}
+static inline uint32_t head_index(uint64_t head) { return (uint32_t)head; }
+static inline uint32_t head_tag(uint64_t head) { return (uint32_t)(head >> 32); }
+
+
+/* Retries are summed locally and published once per transfer, not per attempt. */
+static inline void count_retries(pktbuf_pool_t *pool, uint64_t retries) {
+    if (retries > 0) atomic_fetch_add_explicit(&pool->cas_retries, retries, memory_order_relaxed);
+}
+
 /*
     Pop multiple buffers from the global pool (lock-free).
 
@@ -45,60 +80,57 @@ Global Pool Operations
         Return: Actual number of buffers popped.
 
     Steps:
-        1) Read current top.
-        2) Calculate how many can be popped.
-        3) Try to update top atomically using CAS.
-        4) If CAS fails (another thread modified top), retry from step 1.
-        5) If CAS succeeds, copy the buffer pointers.
+        1) Read the current head.
+        2) Walk up to `request` links from it, collecting the buffers.
+        3) Try to swing head to the link after the last one (tag + 1) using CAS.
+        4) If CAS fails (another thread popped or pushed), retry from step 2
+           with the head the CAS returned.
 */
 static size_t global_pop_bulk(pktbuf_pool_t *pool, pktbuf_t **out, size_t request) {
-    size_t old_top;
-    size_t new_top;
-    size_t actual;
+    uint64_t retries = 0;
+    size_t got;
 
-    /* CAS retry loop */
-    do {
-        /* ACQUIRE load so we see buffer pointers published by prior RELEASE stores. */
-        old_top = atomic_load_explicit(&pool->top, memory_order_acquire);
+    /* ACQUIRE load so we see the links published by prior RELEASE pushes. */
+    uint64_t old_head = atomic_load_explicit(&pool->head, memory_order_acquire);
 
-        /* Calculate how many buffers we can take. */
-        if (old_top == 0) {
+    /* CAS retry loop */
+    for (;; retries++) {
+        uint32_t idx = head_index(old_head);
+        if (idx == PKTBUF_NIL) {
+            count_retries(pool, retries);
             return 0; /* Pool is empty. */
         }
 
-        actual = (old_top < request) ? old_top : request;
-        new_top = old_top - actual;
-
         /*
-        CAS loop to update the global top.
-
-        Weak CAS is used for performance, as even if CAS fails for no reason, the loop retries.
+        The links can change under us while we walk (another thread popped and
+        reused some of these buffers). Then head has moved on as well, and the
+        CAS below fails: nothing collected here is used.
+        */
+        got = 0;
+        while (got < request && idx != PKTBUF_NIL) {
+            out[got++] = pktbuf_at(pool, idx);
+            idx = atomic_load_explicit(&pool->next[idx], memory_order_relaxed);
+        }
 
+        /*
         Memory ordering:
-        -   Success (ACQ_REL): acquire ownership of popped buffers and release the updated top to
-                               other threads.
-        -   Failure (ACQUIRE): look at the latest top value before retrying.
+        -   Success (ACQUIRE): take ownership of the popped buffers.
+        -   Failure (ACQUIRE): look at the latest head before walking again.
         */
-    } while (!atomic_compare_exchange_weak_explicit(&pool->top,           /* object */
-                                                    &old_top,             /* expected */
-                                                    new_top,              /* desired */
-                                                    memory_order_acq_rel, /* success order */
-                                                    memory_order_acquire  /* failure order */
-                                                    ));
-
-    /*
-    CAS succeded. Copy buffer pointers to output array.
-
-    The successful CAS reserves the range [new_top, old_top) for this thread,
-    so it is safe to read and copy those entries into the output array.
-
-    Example: old_top=10, actual=3 -> indices [7,10) → 7, 8, 9
-    */
-    for (size_t i = 0; i < actual; i++) {
-        out[i] = pool->free_stack[new_top + i];
+        uint64_t new_head = head_pack(idx, head_tag(old_head) + 1);
+        if (atomic_compare_exchange_weak_explicit(&pool->head,          /* object */
+                                                  &old_head,            /* expected */
+                                                  new_head,             /* desired */
+                                                  memory_order_acquire, /* success order */
+                                                  memory_order_acquire  /* failure order */
+                                                  )) {
+            break;
+        }
     }
+    count_retries(pool, retries);
+    atomic_fetch_sub_explicit(&pool->free_count, got, memory_order_relaxed);
 
-    return actual;
+    return got;
 }
 
 /*
@@ -109,37 +141,42 @@ static size_t global_pop_bulk(pktbuf_pool_t *pool, pktbuf_t **out, size_t reques
         - bufs:     Array of buffer pointers to push
         - count:    Number of buffers to push
 */
-static void global_push_bulk(pktbuf_pool_t *pool, pktbuf_t **bufs, size_t count) {
-    size_t old_top;
-    size_t new_top;
+static void global_push_bulk(pktbuf_pool_t *pool, pktbuf_t *const *bufs, size_t count) {
+    if (count == 0) return;
 
-    /*
-    Reserve space in the global stack.
+    uint64_t retries = 0;
 
-    Speculatively write buffers above the current top, then publish
-    them by advancing `top` via CAS.
+    /* Chain the buffers in order while they are still private: bufs[0] is
+     * popped first again. */
+    for (size_t i = 0; i + 1 < count; i++) {
+        atomic_store_explicit(&pool->next[bufs[i]->index], bufs[i + 1]->index,
+                              memory_order_relaxed);
+    }
+    uint32_t first = bufs[0]->index;
+    uint32_t last = bufs[count - 1]->index;
 
-    Slots at indices >= top are not visible to poppers. A successful CAS
-    publishes the new range; failed CAS attempts discard the speculative writes.
+    /*
+    Hang the old list off the last buffer, then publish the chain by swinging
+    head to the first one. Only the link of `last` is rewritten per retry;
+    nobody else can see the chain until the CAS succeeds.
     */
-    do {
-        old_top = atomic_load_explicit(&pool->top, memory_order_acquire);
-        new_top = old_top + count;
-
-        /* Speculative writes of our buffers to the stack.
-         * Slots are above top, no one is reading them. */
-        for (size_t i = 0; i < count; i++) {
-            pool->free_stack[old_top + i] = bufs[i];
+    uint64_t old_head = atomic_load_explicit(&pool->head, memory_order_relaxed);
+    for (;; retries++) {
+        atomic_store_explicit(&pool->next[last], head_index(old_head), memory_order_relaxed);
+
+        /* Success (RELEASE): make the links visible to the next popper. */
+        uint64_t new_head = head_pack(first, head_tag(old_head) + 1);
+        if (atomic_compare_exchange_weak_explicit(&pool->head,          /* object */
+                                                  &old_head,            /* expected */
+                                                  new_head,             /* desired */
+                                                  memory_order_release, /* success order */
+                                                  memory_order_relaxed  /* failure order */
+                                                  )) {
+            break;
         }
-
-    } while (!atomic_compare_exchange_weak_explicit(&pool->top,           /* object */
-                                                    &old_top,             /* expected */
-                                                    new_top,              /* desired */
-                                                    memory_order_acq_rel, /* success order */
-                                                    memory_order_acquire  /* failure order */
-                                                    ));
-
-    /* CAS succeeded: our writes are now "committed" and visible to poppers. */
+    }
+    count_retries(pool, retries);
+    atomic_fetch_add_explicit(&pool->free_count, count, memory_order_relaxed);
 }
 
 /*
@@ -151,38 +188,66 @@ from/to global pool)
 -=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 */
 
+/*
+    Remote-node accounting costs nothing on the fast path: it runs once per
+    transfer from the global pool. Threads are pinned before they touch a
+    pool, so the node is looked up once.
+*/
+static void count_remote(pktbuf_pool_t *pool, size_t got) {
+    if (pool->node >= 0 && got > 0) {
+        if (t_node < 0) t_node = affinity_self_node();
+        if (t_node != pool->node) {
+            atomic_fetch_add_explicit(&pool->remote_allocs, got, memory_order_relaxed);
+        }
+    }
+}
+
 /*
     Refill the local cache from the global pool.
     - Called when local cache is EMPTY and buffers are needed.
 */
-static void refill_local_cache(pktbuf_pool_t *pool) {
-    size_t got = global_pop_bulk(pool, t_cache.items, BULK_TRANSFER_SIZE);
-    t_cache.count = got;
-    t_cache.pool = pool;
+static void refill_local_cache(local_cache_t *c, pktbuf_pool_t *pool) {
+    size_t got = global_pop_bulk(pool, c->items, pool->cache_size / 2);
+    c->count = got;
+
+    if (got > 0) atomic_fetch_add_explicit(&pool->refills, 1, memory_order_relaxed);
+    count_remote(pool, got);
 }
 
 /*
     Flush excess buffers from local cache to the global pool.
     - Called when local cache is FULL, to free buffers.
 */
-static void flush_local_cache(pktbuf_pool_t *pool) {
-    size_t return_count = BULK_TRANSFER_SIZE;
-    size_t start_idx = t_cache.count - return_count; /* returning from the END of the cache. */
+static void flush_local_cache(local_cache_t *c, pktbuf_pool_t *pool) {
+    size_t return_count = pool->cache_size / 2;
+    size_t start_idx = c->count - return_count; /* returning from the END of the cache. */
 
-    global_push_bulk(pool, &t_cache.items[start_idx], return_count);
+    global_push_bulk(pool, &c->items[start_idx], return_count);
+    atomic_fetch_add_explicit(&pool->flushes, 1, memory_order_relaxed);
 
-    t_cache.count -= return_count;
+    c->count -= return_count;
 }
 
 /*
     Flush ALL buffers from local cache to global pool.
     - Called when switching pools or during cleanup.
 */
-static void flush_all_local_cache(void) {
-    if (t_cache.pool != NULL && t_cache.count > 0) {
-        global_push_bulk(t_cache.pool, t_cache.items, t_cache.count);
-        t_cache.count = 0;
+static void flush_all_local_cache(local_cache_t *c) {
+    if (c->pool != NULL && c->count > 0) {
+        global_push_bulk(c->pool, c->items, c->count);
+        atomic_fetch_add_explicit(&c->pool->flushes, 1, memory_order_relaxed);
     }
+    c->count = 0;
+}
+
+/* This thread's cache for `pool`; a cache holding another pool's buffers is flushed first. */
+static inline local_cache_t *cache_of(pktbuf_pool_t *pool) {
+    local_cache_t *c = &t_cache[pool->class_id];
+    if (c->pool != pool) {
+        flush_all_local_cache(c);
+        c->pool = pool;
+    }
+    return c;
 }
 
 /*
@@ -191,25 +256,70 @@ Public API
 -=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 */
 
+/*
+    Ask the kernel to take the pages of [addr, addr + len) from `node`, then
+    fault them in. Must run before the first touch: placement happens at fault.
+*/
+static void place_on_node(void *addr, size_t len, int node, size_t page_size) {
+    unsigned long mask = 1UL << node;
+    if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0) != 0) {
+        log_msg(LOG_WARN, "pktbuf: mbind to node %d failed, buffers stay unplaced", node);
+    }
+    for (size_t off = 0; off < len; off += page_size) {
+        ((volatile uint8_t *)addr)[off] = 0;
+    }
+}
+
 int pktbuf_pool_init(pktbuf_pool_t *p, size_t capacity) {
-    if (p == NULL || capacity == 0) {
+    return pktbuf_pool_init_node(p, capacity, -1);
+}
+
+int pktbuf_pool_init_node(pktbuf_pool_t *p, size_t capacity, int node) {
+    return pktbuf_pool_init_sized(p, capacity, PKTBUF_DATA_SIZE, PKTBUF_HEADROOM, node);
+}
+
+/* Smallest class whose data room covers `data_room` (the thread cache slot). */
+static uint8_t class_for(uint32_t data_room) {
+    for (int k = 0; k < PKTBUF_CLASSES - 1; k++) {
+        if (data_room <= pktbuf_class_size((pktbuf_class_t)k)) return (uint8_t)k;
+    }
+    return PKTBUF_CLASSES - 1;
+}
+
+int pktbuf_pool_init_sized(pktbuf_pool_t *p, size_t capacity, uint32_t data_room,
+                           uint16_t headroom, int node) {
+    /* Buffer indices are 32 bits, PKTBUF_NIL is reserved. */
+    if (p == NULL || capacity == 0 || capacity >= PKTBUF_NIL || node >= 64 || data_room == 0 ||
+        data_room > PKTBUF_MAX_SIZE || headroom > PKTBUF_HEADROOM_MAX) {
         return -1;
     }
 
     /* Allocation of the buffer array. */
-    size_t raw_size = capacity * sizeof(pktbuf_t);
+    size_t stride = ALIGN_UP(PKTBUF_META_SIZE + (size_t)headroom + data_room, (size_t)64);
+    size_t raw_size = capacity * stride;
     size_t mmap_len = ALIGN_UP(raw_size, HUGE_PAGE_SIZE);
 
     p->use_hugepages = false;
     p->buffers_mmap_len = 0;
-    p->buffers = NULL;
+    p->mem = NULL;
+    p->stride = stride;
+    p->data_room = data_room;
+    p->headroom = headroom;
+    p->class_id = class_for(data_room);
+    p->node = node;
+    atomic_init(&p->remote_allocs, 0);
+    p->cache_size = PKTBUF_CACHE_DEFAULT;
+    atomic_init(&p->refills, 0);
+    atomic_init(&p->flushes, 0);
+    atomic_init(&p->cas_retries, 0);
+    atomic_init(&p->alloc_failures, 0);
 
     /* Attempt 1: mmap with 2MB huge pages. */
     void *mem = mmap(NULL, mmap_len, PROT_READ | PROT_WRITE,
                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MMAP_HUGE_2MB_FLAG, -1, 0);
 
     if (mem != MAP_FAILED) {
-        p->buffers = (pktbuf_t *)mem;
+        p->mem = (uint8_t *)mem;
         p->buffers_mmap_len = mmap_len;
         p->use_hugepages = true;
         log_msg(LOG_INFO, "pktbuf: allocated %zu bytes using 2MB huge pages (%zu pages)", mmap_len,
@@ -220,46 +330,71 @@ int pktbuf_pool_init(pktbuf_pool_t *p, size_t capacity) {
         mem = mmap(NULL, mmap_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
         if (mem != MAP_FAILED) {
-            p->buffers = (pktbuf_t *)mem;
+            p->mem = (uint8_t *)mem;
             p->buffers_mmap_len = mmap_len;
             log_msg(LOG_INFO, "pktbuf: allocated %zu bytes using regular mmap", mmap_len);
         } else {
             /* Atempt 3: calloc as last resort. */
             log_msg(LOG_WARN, "pktbuf: regular mmap failed, falling back to calloc");
-            p->buffers = (pktbuf_t *)calloc(capacity, sizeof(pktbuf_t));
+            p->mem = aligned_alloc(64, raw_size);
+            if (p->mem) memset(p->mem, 0, raw_size);
         }
     }
 
-    if (p->buffers == NULL) {
+    if (p->mem == NULL) {
         return -1;
     }
 
-    /* Allocation of the free stack (array of pointers). */
-    p->free_stack = (pktbuf_t **)calloc(capacity, sizeof(pktbuf_t *));
-    if (p->free_stack == NULL) {
-        free(p->buffers);
-        p->buffers = NULL;
+    if (node >= 0 && p->buffers_mmap_len > 0) {
+        place_on_node(p->mem, p->buffers_mmap_len, node,
+                      p->use_hugepages ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE));
+        log_msg(LOG_INFO, "pktbuf: %zu buffers on NUMA node %d", capacity, node);
+    }
+
+    /* Allocation of the free list links, one per buffer. */
+    p->next = calloc(capacity, sizeof(*p->next));
+    if (p->next == NULL) {
+        if (p->buffers_mmap_len > 0) {
+            munmap(p->mem, p->buffers_mmap_len);
+        } else {
+            free(p->mem);
+        }
+        p->mem = NULL;
         return -1;
     }
 
     /*
-    Initialize the free stack with all buffers.
-    free_stack will become:
-        [&buffers[0]] [&buffers[1]] ... [&buffers[capacity-1]]
+    Set up each buffer's metadata and link all buffers into the free list, in
+    array order:
+        head -> 0 -> 1 -> ... -> capacity-1 -> NIL
+    atomic_init: non-atomic initialization of atomic variables.
+        - safe as no other thread can see 'p' yet.
     */
     for (size_t i = 0; i < capacity; i++) {
-        p->free_stack[i] = &p->buffers[i];
+        pktbuf_t *b = pktbuf_at(p, i);
+        b->pool = p;
+        b->index = (uint32_t)i;
+        atomic_init(&b->refcnt, 1);
+        b->buf_len = (uint32_t)(stride - PKTBUF_META_SIZE);
+        b->data = b->buf + headroom;
+        b->len = 0;
+        b->timestamp = 0;
+        b->ring_tsc = 0;
+        atomic_init(&p->next[i], i + 1 < capacity ? (uint32_t)(i + 1) : PKTBUF_NIL);
     }
 
     p->capacity = capacity;
+    atomic_init(&p->head, head_pack(0, 0));
+    atomic_init(&p->free_count, capacity);
 
-    /*
-    Atomically initialize top. It will be full (top=capacity) at init.
-    atomic_init: non-atomic initialization of atomic variable.
-        - safe as no other thread can see 'p' yet.
-    */
-    atomic_init(&p->top, capacity);
+    return 0;
+}
 
+int pktbuf_pool_set_cache_size(pktbuf_pool_t *p, size_t size) {
+    if (p == NULL || size < 2 || size > PKTBUF_CACHE_MAX) {
+        return -1;
+    }
+    p->cache_size = size;
     return 0;
 }
 
@@ -271,23 +406,24 @@ void pktbuf_pool_destroy(pktbuf_pool_t *p) {
     /*
        Non-thread-safe operation. Threads must have stopped using the pool when calling this.
        Buffers that stuck in thread-local caches will be leaked, but the underlying memory
-       (p->buffers) will be freed, causing use-after-free if any thread tries to use a cached
+       (p->mem) will be freed, causing use-after-free if any thread tries to use a cached
        buffer.
     */
-    free(p->free_stack);
+    free((void *)p->next);
 
     if (p->buffers_mmap_len > 0) {
-        munmap(p->buffers, p->buffers_mmap_len);
+        munmap(p->mem, p->buffers_mmap_len);
     } else {
-        free(p->buffers);
+        free(p->mem);
     }
 
-    p->free_stack = NULL;
-    p->buffers = NULL;
+    p->next = NULL;
+    p->mem = NULL;
     p->capacity = 0;
     p->buffers_mmap_len = 0;
     p->use_hugepages = false;
-    atomic_store(&p->top, 0);
+    atomic_store(&p->head, head_pack(PKTBUF_NIL, 0));
+    atomic_store(&p->free_count, 0);
 }
 
 pktbuf_t *pktbuf_alloc(pktbuf_pool_t *p) {
@@ -296,55 +432,217 @@ pktbuf_t *pktbuf_alloc(pktbuf_pool_t *p) {
     }
 
     /* Check if we switched pools. */
-    if (t_cache.pool != p) {
-        flush_all_local_cache();
-        t_cache.pool = p;
-        t_cache.count = 0;
-    }
+    local_cache_t *c = cache_of(p);
 
     /* Fast path: allocate from local cache.
      * Most allocations should hit this path. */
-    if (t_cache.count > 0) {
-        return t_cache.items[--t_cache.count];
+    if (c->count > 0) {
+        return c->items[--c->count];
     }
 
     /* Slow path: cache is empty, refill from global pool.
-     * This uses atomic CAS operations, once every BULK_TRANSFER_SIZE. */
-    refill_local_cache(p);
+     * This uses atomic CAS operations, once every cache_size / 2. */
+    refill_local_cache(c, p);
 
     /* Retry again after refill. */
-    if (t_cache.count > 0) {
-        return t_cache.items[--t_cache.count];
+    if (c->count > 0) {
+        return c->items[--c->count];
     }
 
     /* Global pool is also empty (all buffers are in use). */
+    atomic_fetch_add_explicit(&p->alloc_failures, 1, memory_order_relaxed);
     return NULL;
 }
 
+/* Back to the state pktbuf_alloc() hands buffers out in: empty, default headroom. */
+static inline void reset_buf(const pktbuf_pool_t *p, pktbuf_t *buf) {
+    buf->len = 0;
+    buf->data = buf->buf + p->headroom;
+}
+
+/*
+    Drop one holder of `buf`. Returns true if it was the last one: the buffer
+    goes back to the pool, with its count restored to 1. A sole holder (nearly
+    every buffer) costs one load; the acquire pairs with the release of the
+    holders before, so their reads are done when the buffer is reused.
+*/
+static inline bool put_ref(pktbuf_t *buf) {
+    if (atomic_load_explicit(&buf->refcnt, memory_order_acquire) <= 1) return true;
+    if (atomic_fetch_sub_explicit(&buf->refcnt, 1, memory_order_acq_rel) != 1) return false;
+    atomic_store_explicit(&buf->refcnt, 1, memory_order_relaxed);
+    return true;
+}
+
 void pktbuf_free(pktbuf_pool_t *p, pktbuf_t *buf) {
-    if (p == NULL || buf == NULL) {
+    if (p == NULL || buf == NULL || !put_ref(buf)) {
         return;
     }
 
-    buf->len = 0;
+    reset_buf(p, buf);
 
     /* Check if we switched pools. */
-    if (t_cache.pool != p) {
-        flush_all_local_cache();
-        t_cache.pool = p;
-        t_cache.count = 0;
-    }
+    local_cache_t *c = cache_of(p);
 
     /* Fast path: free to the local cache.
      * Most frees should hit this path. */
-    if (t_cache.count < LOCAL_CACHE_SIZE) {
-        t_cache.items[t_cache.count++] = buf;
+    if (c->count < p->cache_size) {
+        c->items[c->count++] = buf;
         return;
     }
 
-    /* Slow path: cache is full, flush BULK_TRANSFER_SIZE to global pool. */
-    flush_local_cache(p);
+    /* Slow path: cache is full, flush half of it to the global pool. */
+    flush_local_cache(c, p);
 
     /* Now there's space in the cache. Add buffer to local cache. */
-    t_cache.items[t_cache.count++] = buf;
-}
\ No newline at end of file
+    c->items[c->count++] = buf;
+}
+
+unsigned int pktbuf_alloc_bulk(pktbuf_pool_t *p, pktbuf_t **bufs, unsigned int n) {
+    if (p == NULL) {
+        return 0;
+    }
+
+    local_cache_t *c = cache_of(p);
+
+    unsigned int got = 0;
+    while (got < n) {
+        /* Fast path: take from the top of the local cache. */
+        size_t take = c->count < n - got ? c->count : n - got;
+        for (size_t i = 0; i < take; i++) {
+            bufs[got++] = c->items[--c->count];
+        }
+        if (got == n) break;
+
+        /* Cache is empty. Requests of at least a refill's worth go straight from
+         * the global pool into `bufs`, without a copy through the cache. */
+        size_t want = n - got;
+        if (want >= p->cache_size / 2) {
+            size_t popped = global_pop_bulk(p, &bufs[got], want);
+            if (popped == 0) break;
+            atomic_fetch_add_explicit(&p->refills, 1, memory_order_relaxed);
+            count_remote(p, popped);
+            got += (unsigned int)popped;
+        } else {
+            refill_local_cache(c, p);
+            if (c->count == 0) break;
+        }
+    }
+
+    if (got < n) {
+        atomic_fetch_add_explicit(&p->alloc_failures, n - got, memory_order_relaxed);
+    }
+    return got;
+}
+
+void pktbuf_free_bulk(pktbuf_pool_t *p, pktbuf_t *const *bufs, unsigned int n) {
+    if (p == NULL) {
+        return;
+    }
+
+    local_cache_t *c = cache_of(p);
+
+    /* Fill the cache up, then hand what does not fit to the global pool in one
+     * go (per PKTBUF_CACHE_MAX), instead of flushing half a cache at a time. */
+    pktbuf_t *spill[PKTBUF_CACHE_MAX];
+    size_t spilled = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        if (bufs[i] == NULL || !put_ref(bufs[i])) continue;
+        reset_buf(p, bufs[i]);
+
+        if (c->count < p->cache_size) {
+            c->items[c->count++] = bufs[i];
+            continue;
+        }
+        spill[spilled++] = bufs[i];
+        if (spilled == PKTBUF_CACHE_MAX) {
+            global_push_bulk(p, spill, spilled);
+            atomic_fetch_add_explicit(&p->flushes, 1, memory_order_relaxed);
+            spilled = 0;
+        }
+    }
+    if (spilled > 0) {
+        global_push_bulk(p, spill, spilled);
+        atomic_fetch_add_explicit(&p->flushes, 1, memory_order_relaxed);
+    }
+}
+
+void pktbuf_release(pktbuf_t *b) {
+    if (b) pktbuf_free(b->pool, b);
+}
+
+void pktbuf_release_bulk(pktbuf_t *const *bufs, unsigned int n) {
+    /* Runs of buffers from the same pool go back with one pktbuf_free_bulk(). */
+    unsigned int start = 0;
+    while (start < n) {
+        if (bufs[start] == NULL) {
+            start++;
+            continue;
+        }
+        pktbuf_pool_t *pool = bufs[start]->pool;
+        unsigned int end = start + 1;
+        while (end < n && (bufs[end] == NULL || bufs[end]->pool == pool)) end++;
+        pktbuf_free_bulk(pool, &bufs[start], end - start);
+        start = end;
+    }
+}
+
+void pktbuf_thread_flush(void) {
+    for (int k = 0; k < PKTBUF_CLASSES; k++) {
+        flush_all_local_cache(&t_cache[k]);
+        t_cache[k].pool = NULL;
+    }
+}
+
+/*
+-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+Size Classes
+-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+*/
+
+uint32_t pktbuf_class_size(pktbuf_class_t k) {
+    static const uint32_t sizes[PKTBUF_CLASSES] = {PKTBUF_SMALL_SIZE, PKTBUF_DATA_SIZE,
+                                                   PKTBUF_JUMBO_SIZE};
+    return sizes[k];
+}
+
+int pktbuf_classes_init(pktbuf_classes_t *c, const size_t capacity[PKTBUF_CLASSES],
+                        uint16_t headroom, int node) {
+    if (c == NULL) return -1;
+    memset(c, 0, sizeof(*c));
+
+    for (int k = 0; k < PKTBUF_CLASSES; k++) {
+        if (capacity[k] == 0) continue;
+        if (pktbuf_pool_init_sized(&c->pool[k], capacity[k], pktbuf_class_size((pktbuf_class_t)k),
+                                   headroom, node) != 0) {
+            pktbuf_classes_destroy(c);
+            return -1;
+        }
+        c->ready[k] = true;
+    }
+    return 0;
+}
+
+void pktbuf_classes_destroy(pktbuf_classes_t *c) {
+    if (c == NULL) return;
+    for (int k = 0; k < PKTBUF_CLASSES; k++) {
+        if (c->ready[k]) pktbuf_pool_destroy(&c->pool[k]);
+        c->ready[k] = false;
+    }
+}
+
+pktbuf_pool_t *pktbuf_classes_pick(pktbuf_classes_t *c, size_t len) {
+    for (int k = 0; k < PKTBUF_CLASSES; k++) {
+        if (c->ready[k] && len <= c->pool[k].data_room) return &c->pool[k];
+    }
+    return NULL;
+}
+
+pktbuf_t *pktbuf_alloc_len(pktbuf_classes_t *c, size_t len) {
+    for (int k = 0; k < PKTBUF_CLASSES; k++) {
+        if (!c->ready[k] || len > c->pool[k].data_room) continue;
+        pktbuf_t *b = pktbuf_alloc(&c->pool[k]);
+        if (b) return b;
+        /* Class exhausted: a larger buffer beats a drop. */
+    }
+    return NULL;
+}
@@ -0,0 +1,39 @@
+#include "policer.h"
+
+void policer_configure(policer_t *p, uint64_t rate, uint64_t burst, double tsc_hz) {
+    if (rate < POLICER_MIN_RATE) rate = POLICER_MIN_RATE;
+
+    /* 64 KB frames at POLICER_MIN_RATE still fit: len * cost < 2^64 up to ~30 GHz. */
+    uint64_t cost = (uint64_t)(tsc_hz * (double)(1u << POLICER_COST_SHIFT) / (double)rate);
+    uint64_t tolerance = (uint64_t)((double)burst * tsc_hz / (double)rate);
+
+    /* The worker reads this line for every policed packet: only write changes. */
+    if (atomic_load_explicit(&p->cost, memory_order_relaxed) != cost) {
+        atomic_store_explicit(&p->cost, cost, memory_order_relaxed);
+    }
+    if (atomic_load_explicit(&p->tolerance, memory_order_relaxed) != tolerance) {
+        atomic_store_explicit(&p->tolerance, tolerance, memory_order_relaxed);
+    }
+}
+
+void policer_split(uint64_t total, const uint64_t *demand, unsigned int n, uint64_t *share) {
+    if (n == 0) return;
+
+    uint64_t min_share = total / (4 * (uint64_t)n);
+    uint64_t left = total - min_share * n;
+    uint64_t rest = left;
+    uint64_t sum = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        sum += demand[i];
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+        uint64_t part = sum > 0 ? (uint64_t)((double)rest * ((double)demand[i] / (double)sum))
+                                : rest / n;
+        if (part > left) part = left;
+        left -= part;
+        share[i] = min_share + part;
+    }
+    /* Rounding: the last worker gets what is left. */
+    share[n - 1] += left;
+}
@@ -0,0 +1,53 @@
+#define _POSIX_C_SOURCE 200809L
+#include "qsbr.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+int qsbr_init(qsbr_t *q, size_t count) {
+    if (!q || count == 0) return -1;
+
+    q->readers = aligned_alloc(64, count * sizeof(qsbr_reader_t));
+    if (!q->readers) return -1;
+
+    atomic_init(&q->epoch, 1);
+    for (size_t i = 0; i < count; i++) {
+        atomic_init(&q->readers[i].seen, QSBR_OFFLINE);
+    }
+    q->count = count;
+    return 0;
+}
+
+void qsbr_destroy(qsbr_t *q) {
+    if (!q) return;
+    free(q->readers);
+    q->readers = NULL;
+    q->count = 0;
+}
+
+void qsbr_online(qsbr_t *q, size_t id) {
+    /* seq_cst orders this store before the reader's next loads of shared
+     * pointers: a writer that still saw us offline must have published first. */
+    atomic_store(&q->readers[id].seen, atomic_load(&q->epoch));
+}
+
+void qsbr_offline(qsbr_t *q, size_t id) {
+    atomic_store_explicit(&q->readers[id].seen, QSBR_OFFLINE, memory_order_release);
+}
+
+void qsbr_synchronize(qsbr_t *q) {
+    /* seq_cst: the new epoch is visible before we start reading the slots. */
+    uint_fast64_t target = atomic_fetch_add(&q->epoch, 1) + 1;
+
+    for (size_t i = 0; i < q->count; i++) {
+        /* Readers report once per burst, so this normally waits a few
+         * microseconds; an idle worker wakes up at least every 1ms. */
+        while (1) {
+            uint_fast64_t seen = atomic_load(&q->readers[i].seen);
+            if (seen == QSBR_OFFLINE || seen >= target) break;
+
+            struct timespec ts = {.tv_sec = 0, .tv_nsec = 10000};
+            nanosleep(&ts, NULL);
+        }
+    }
+}
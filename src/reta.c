@@ -0,0 +1,133 @@
+#include "reta.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int reta_init(reta_t *t, uint16_t ring_count) {
+    if (!t || ring_count == 0) return -1;
+    memset(t, 0, sizeof(*t));
+
+    t->done = calloc(ring_count, sizeof(*t->done));
+    if (!t->done) return -1;
+
+    for (uint32_t b = 0; b < RETA_SIZE; b++) {
+        atomic_init(&t->table[b], (uint16_t)(b % ring_count));
+        atomic_init(&t->hits[b], 0);
+    }
+    t->ring_count = ring_count;
+    atomic_init(&t->pending, 0);
+    atomic_init(&t->moves, 0);
+    atomic_init(&t->aborts, 0);
+    t->moving = -1;
+    return 0;
+}
+
+void reta_destroy(reta_t *t) {
+    if (!t) return;
+    free(t->done);
+    t->done = NULL;
+}
+
+bool reta_hold(reta_t *t, pktbuf_t *b) {
+    if (t->hold_count == RETA_HOLD_SIZE) return false;
+    t->hold[t->hold_count++] = b;
+    return true;
+}
+
+uint16_t reta_move_abort(reta_t *t) {
+    atomic_store_explicit(&t->aborts, atomic_load_explicit(&t->aborts, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    t->moving = -1;
+    return t->move_from;
+}
+
+int reta_move_begin(reta_t *t) {
+    if (t->moving >= 0) return -1;
+
+    unsigned int req = atomic_exchange_explicit(&t->pending, 0, memory_order_acquire);
+    if (req == 0) return -1;
+
+    uint32_t bucket = (req >> 16) - 1;
+    uint16_t to = (uint16_t)(req & 0xFFFF);
+    if (bucket >= RETA_SIZE || to >= t->ring_count) return -1;
+
+    /* Without the old worker's counter there is no way to tell it drained. */
+    uint16_t from = atomic_load_explicit(&t->table[bucket], memory_order_relaxed);
+    if (to == from || !t->done[from]) return -1;
+
+    t->moving = (int)bucket;
+    t->move_from = from;
+    t->move_to = to;
+    t->move_mark = UINT64_MAX; /* Until armed, never finishes. */
+    t->hold_count = 0;
+    return from;
+}
+
+void reta_arm(reta_t *t, uint64_t mark) { t->move_mark = mark; }
+
+bool reta_move_try_finish(reta_t *t) {
+    if (t->moving < 0) return false;
+
+    /* Acquire: the worker's TX of those packets happened before it published
+     * the counter, so nothing sent to the new ring can overtake them. */
+    uint64_t done = atomic_load_explicit(t->done[t->move_from], memory_order_acquire);
+    if (done < t->move_mark) return false;
+
+    atomic_store_explicit(&t->table[t->moving], t->move_to, memory_order_relaxed);
+    atomic_store_explicit(&t->moves, atomic_load_explicit(&t->moves, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    t->moving = -1;
+    return true;
+}
+
+int reta_request_move(reta_t *t, uint32_t bucket, uint16_t ring) {
+    if (bucket >= RETA_SIZE || ring >= t->ring_count) return -1;
+
+    unsigned int expected = 0;
+    unsigned int req = ((bucket + 1) << 16) | ring;
+    if (!atomic_compare_exchange_strong_explicit(&t->pending, &expected, req,
+                                                 memory_order_release, memory_order_relaxed)) {
+        return -1;
+    }
+    return 0;
+}
+
+int reta_rebalance(reta_t *t, const uint64_t *ring_load, const size_t *ring_backlog,
+                   size_t ring_capacity) {
+    /* Bucket loads since the last call. Always taken, so a skipped round does
+     * not pile up into the next one. */
+    uint64_t delta[RETA_SIZE];
+    for (uint32_t b = 0; b < RETA_SIZE; b++) {
+        uint64_t h = atomic_load_explicit(&t->hits[b], memory_order_relaxed);
+        delta[b] = h - t->last_hits[b];
+        t->last_hits[b] = h;
+    }
+
+    if (t->ring_count < 2) return 0;
+
+    uint16_t hot = 0;
+    uint16_t cold = 0;
+    uint64_t total = 0;
+    for (uint16_t r = 0; r < t->ring_count; r++) {
+        total += ring_load[r];
+        if (ring_load[r] > ring_load[hot]) hot = r;
+        if (ring_load[r] < ring_load[cold]) cold = r;
+    }
+
+    uint64_t mean = total / t->ring_count;
+    if (ring_load[hot] * 100 <= mean * (100 + RETA_IMBALANCE_PCT)) return 0;
+    /* The worker keeps up: moving would only cost cache warmth. */
+    if (ring_backlog[hot] < ring_capacity / 8) return 0;
+
+    /* Moving x packets/interval improves things as long as x < gap. */
+    uint64_t gap = ring_load[hot] - ring_load[cold];
+    int best = -1;
+    for (uint32_t b = 0; b < RETA_SIZE; b++) {
+        if (atomic_load_explicit(&t->table[b], memory_order_relaxed) != hot) continue;
+        if (delta[b] == 0 || delta[b] >= gap) continue;
+        if (best < 0 || delta[b] > delta[best]) best = (int)b;
+    }
+    if (best < 0) return 0;
+
+    return reta_request_move(t, (uint32_t)best, cold) == 0 ? 1 : 0;
+}
@@ -1,5 +1,11 @@
+#define _GNU_SOURCE
 #include "ring.h"
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 /*
     x = 8    = 1000
@@ -21,6 +27,15 @@ int ring_init(spsc_ring_t *r, size_t capacity) {
 
     atomic_store(&r->head, 0);
     atomic_store(&r->tail, 0);
+    r->tail_cache = 0;
+    r->head_cache = 0;
+    atomic_store(&r->high_water, 0);
+    r->wm_high = 0;
+    r->wm_low = 0;
+    r->wm_above = false;
+    r->wm_fn = NULL;
+    r->wm_arg = NULL;
+    atomic_store(&r->waiting, 0);
     return 0;
 }
 
@@ -32,14 +47,47 @@ void ring_destroy(spsc_ring_t *r) {
     r->mask = 0;
 }
 
+/* Producer: reload the consumer's index. Returns the exact occupancy at `head`. */
+static inline size_t refresh_tail(spsc_ring_t *r, size_t head) {
+    r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+    size_t used = head - r->tail_cache;
+
+    /* Single writer: a relaxed load/store pair instead of a locked max. */
+    if (used > atomic_load_explicit(&r->high_water, memory_order_relaxed)) {
+        atomic_store_explicit(&r->high_water, used, memory_order_relaxed);
+    }
+    return used;
+}
+
+/*
+    Producer, after publishing `head`. With a stale tail the occupancy is only
+    an upper bound, so the tail is reloaded before the high callback fires, and
+    on every push while above it (where the low crossing has to be noticed).
+*/
+static void check_watermarks(spsc_ring_t *r, size_t head) {
+    if (!r->wm_above) {
+        if (head - r->tail_cache < r->wm_high) return;
+        if (refresh_tail(r, head) < r->wm_high) return;
+        r->wm_above = true;
+        r->wm_fn(r, true, r->wm_arg);
+    } else {
+        if (refresh_tail(r, head) > r->wm_low) return;
+        r->wm_above = false;
+        r->wm_fn(r, false, r->wm_arg);
+    }
+}
+
 unsigned int ring_push_burst(spsc_ring_t *r, void *const *objs, unsigned int count) {
     size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
-    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
 
-    size_t available = r->capacity - (head - tail);
+    size_t available = r->capacity - (head - r->tail_cache);
     if (count > available) {
-        count = (unsigned int)available;
-        if (count == 0) return 0;
+        /* Looks full: see how far the consumer really got. */
+        available = r->capacity - refresh_tail(r, head);
+        if (count > available) {
+            count = (unsigned int)available;
+            if (count == 0) return 0;
+        }
     }
 
     for (unsigned int i = 0; i < count; i++) {
@@ -47,14 +95,25 @@ unsigned int ring_push_burst(spsc_ring_t *r, void *const *objs, unsigned int cou
     }
 
     atomic_store_explicit(&r->head, head + count, memory_order_release);
+    if (r->wm_fn) check_watermarks(r, head + count);
     return count;
 }
 
+/* Consumer: entries available at `tail`, reloading the head only if fewer than `want`. */
+static inline size_t entries_at(spsc_ring_t *r, size_t tail, size_t want) {
+    size_t entries = r->head_cache - tail;
+    if (entries < want) {
+        /* Looks empty: see what the producer has published since. */
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+        entries = r->head_cache - tail;
+    }
+    return entries;
+}
+
 unsigned int ring_pop_burst(spsc_ring_t *r, void **objs, unsigned int count) {
     size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
-    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
 
-    size_t entries = head - tail;
+    size_t entries = entries_at(r, tail, count);
     if (count > entries) {
         count = (unsigned int)entries;
         if (count == 0) return 0;
@@ -66,4 +125,84 @@ unsigned int ring_pop_burst(spsc_ring_t *r, void **objs, unsigned int count) {
 
     atomic_store_explicit(&r->tail, tail + count, memory_order_release);
     return count;
-}
\ No newline at end of file
+}
+
+unsigned int ring_peek_burst(spsc_ring_t *r, void ***slots, unsigned int max) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t idx = tail & r->mask;
+
+    /* Contiguous only: no more than what is left before the array wraps. */
+    size_t to_end = r->capacity - idx;
+    size_t want = max < to_end ? max : to_end;
+
+    size_t entries = entries_at(r, tail, want);
+    *slots = &r->slots[idx];
+    return (unsigned int)(entries < want ? entries : want);
+}
+
+void ring_pop_commit(spsc_ring_t *r, unsigned int n) {
+    if (n == 0) return;
+    /* Release: we are done reading the slots before the producer may reuse them. */
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+}
+
+int ring_set_watermarks(spsc_ring_t *r, size_t high, size_t low, ring_wm_fn fn, void *arg) {
+    if (!r || !fn || high == 0 || high > r->capacity || low >= high) return -1;
+    r->wm_high = high;
+    r->wm_low = low;
+    r->wm_above = false;
+    r->wm_arg = arg;
+    r->wm_fn = fn;
+    return 0;
+}
+
+void ring_check_watermarks(spsc_ring_t *r) {
+    if (r->wm_fn) check_watermarks(r, atomic_load_explicit(&r->head, memory_order_relaxed));
+}
+
+size_t ring_high_water(const spsc_ring_t *r) {
+    return atomic_load_explicit(&r->high_water, memory_order_relaxed);
+}
+
+size_t ring_occupancy(const spsc_ring_t *r) {
+    /* Tail first: the head loaded afterwards cannot be behind it. */
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    return head - tail;
+}
+
+/*
+    [Lost wakeups]
+    The consumer announces `waiting` before it looks at the ring one last time;
+    the producer publishes `head` before it looks at `waiting`. Both sides are
+    seq_cst, so at least one of them sees the other: either the consumer finds
+    the new entries and does not sleep, or the producer finds it waiting and
+    wakes it. FUTEX_WAIT itself only sleeps while `waiting` is still 1, so a
+    wake that comes between the check and the syscall is not lost either.
+*/
+bool ring_wait(spsc_ring_t *r, unsigned int timeout_us) {
+    atomic_store(&r->waiting, 1);
+
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if (atomic_load(&r->head) != tail) {
+        atomic_store_explicit(&r->waiting, 0, memory_order_relaxed);
+        return false;
+    }
+
+    struct timespec ts = {.tv_sec = timeout_us / 1000000u,
+                          .tv_nsec = (long)(timeout_us % 1000000u) * 1000};
+    syscall(SYS_futex, &r->waiting, FUTEX_WAIT_PRIVATE, 1, &ts, NULL, 0);
+    atomic_store_explicit(&r->waiting, 0, memory_order_relaxed);
+    return true;
+}
+
+void ring_notify(spsc_ring_t *r) {
+    /* Orders the push's head store before the load of `waiting`. */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&r->waiting, memory_order_relaxed) == 0) return;
+
+    if (atomic_exchange(&r->waiting, 0) == 1) {
+        syscall(SYS_futex, &r->waiting, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
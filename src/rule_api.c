@@ -0,0 +1,283 @@
+#define _POSIX_C_SOURCE 200809L
+#include "rule_api.h"
+#include "log.h"
+#include "rule_config.h"
+#include "sock.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+static char *strip(char *s) {
+    while (*s && isspace((unsigned char)*s)) {
+        s++;
+    }
+
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)*(end - 1))) {
+        end--;
+    }
+
+    *end = '\0';
+    return s;
+}
+
+/* Rule id at the start of `s`; *rest is what follows it. */
+static bool parse_id(char *s, uint32_t *id, char **rest) {
+    errno = 0;
+    char *end = NULL;
+    unsigned long v = strtoul(s, &end, 10);
+    if (errno != 0 || end == s || (*end && !isspace((unsigned char)*end)) || v >= UINT32_MAX ||
+        *s == '-') {
+        return false;
+    }
+    *id = (uint32_t)v;
+    *rest = end + strspn(end, " \t");
+    return true;
+}
+
+int rule_api_parse(char *buf, rule_delta_t *deltas, size_t max, size_t *count, char *err,
+                   size_t err_len) {
+    *count = 0;
+    int line_num = 0;
+
+    for (char *p = buf; *p;) {
+        char *nl = strchr(p, '\n');
+        if (nl) *nl = '\0';
+        char *s = strip(p);
+        p = nl ? nl + 1 : p + strlen(p);
+        line_num++;
+
+        /* Skip empty lines and comments. */
+        if (*s == '\0' || *s == '#') continue;
+        if (strcmp(s, "commit") == 0) return 1;
+
+        if (*count == max) {
+            snprintf(err, err_len, "line %d: more than %zu changes", line_num, max);
+            return -1;
+        }
+
+        char *rest = s + strcspn(s, " \t");
+        if (*rest) *rest++ = '\0';
+        rest += strspn(rest, " \t");
+
+        rule_delta_t *d = &deltas[*count];
+        memset(d, 0, sizeof(*d));
+        char what[160] = "";
+        if (strcmp(s, "add") == 0) {
+            d->op = RULE_ADD;
+            if (rule_config_parse_line(rest, &d->rule, what, sizeof(what)) != 0) {
+                snprintf(err, err_len, "line %d: %s", line_num, what);
+                return -1;
+            }
+        } else if (strcmp(s, "delete") == 0 || strcmp(s, "modify") == 0) {
+            d->op = s[0] == 'd' ? RULE_DELETE : RULE_MODIFY;
+            if (!parse_id(rest, &d->rule_id, &rest) || (d->op == RULE_DELETE && *rest)) {
+                snprintf(err, err_len, "line %d: usage: %s <rule id>%s", line_num, s,
+                         d->op == RULE_MODIFY ? " <key=value>..." : "");
+                return -1;
+            }
+            if (d->op == RULE_MODIFY &&
+                rule_config_parse_line(rest, &d->rule, what, sizeof(what)) != 0) {
+                snprintf(err, err_len, "line %d: %s", line_num, what);
+                return -1;
+            }
+        } else {
+            snprintf(err, err_len, "line %d: unknown command: %s", line_num, s);
+            return -1;
+        }
+        (*count)++;
+    }
+    return 0;
+}
+
+/* Whether a line completed in buf[*line_start..used) is "commit"; advances *line_start. */
+static bool saw_commit(char *buf, size_t used, size_t *line_start) {
+    for (size_t i = *line_start; i < used; i++) {
+        if (buf[i] != '\n') continue;
+
+        char line[16];
+        size_t len = i - *line_start;
+        *line_start = i + 1;
+        if (len >= sizeof(line)) continue;
+        memcpy(line, buf + i - len, len);
+        line[len] = '\0';
+        if (strcmp(strip(line), "commit") == 0) return true;
+    }
+    return false;
+}
+
+static void send_reply(int fd, const char *msg) {
+    sock_send_all(fd, msg, strlen(msg));
+}
+
+/* Give `req` to the stats thread and wait until it is answered (or refused on stop). */
+static bool submit(rule_api_t *a, rule_api_request_t *req) {
+    pthread_mutex_lock(&a->lock);
+    a->pending = req;
+    pthread_cond_broadcast(&a->cond);
+    /* Once taken, the stats thread writes into req: wait for it even on stop. */
+    while (!req->done && (a->pending != req || !atomic_load(&a->stop))) {
+        pthread_cond_wait(&a->cond, &a->lock);
+    }
+    if (a->pending == req) a->pending = NULL;
+    pthread_mutex_unlock(&a->lock);
+    return req->done;
+}
+
+/* Read one delta (up to `commit` or EOF), have it applied, answer it. */
+static void serve_client(rule_api_t *a, int fd) {
+    char *buf = malloc(RULE_API_REQUEST_MAX + 1);
+    rule_delta_t *deltas = malloc(RULE_API_MAX_DELTAS * sizeof(rule_delta_t));
+    char err[256];
+    if (!buf || !deltas) {
+        send_reply(fd, "error: out of memory\n");
+        free(buf);
+        free(deltas);
+        return;
+    }
+
+    size_t used = 0, line_start = 0;
+    bool complete = false;
+    while (used < RULE_API_REQUEST_MAX) {
+        ssize_t n = recv(fd, buf + used, RULE_API_REQUEST_MAX - used, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            complete = n == 0; /* Write side closed; otherwise the 1s timeout */
+            break;
+        }
+        used += (size_t)n;
+        if (saw_commit(buf, used, &line_start)) {
+            complete = true;
+            break;
+        }
+    }
+    buf[used] = '\0';
+
+    size_t count = 0;
+    int rc = complete ? rule_api_parse(buf, deltas, RULE_API_MAX_DELTAS, &count, err,
+                                       sizeof(err))
+                      : -1;
+    if (!complete) {
+        snprintf(err, sizeof(err), used == RULE_API_REQUEST_MAX
+                                       ? "request too large"
+                                       : "incomplete request (end it with commit)");
+    } else if (rc >= 0 && count == 0) {
+        snprintf(err, sizeof(err), "empty delta");
+        rc = -1;
+    }
+
+    if (rc < 0) {
+        char msg[300];
+        snprintf(msg, sizeof(msg), "error: %s\n", err);
+        send_reply(fd, msg);
+        log_msg(LOG_WARN, "Rule API: rejected a delta: %s", err);
+    } else {
+        rule_api_request_t req = {.deltas = deltas, .count = count, .done = false};
+        req.reply_cap = 64 + count * 24;
+        req.reply = malloc(req.reply_cap);
+        if (!req.reply) {
+            send_reply(fd, "error: out of memory\n");
+        } else if (!submit(a, &req)) {
+            send_reply(fd, "error: shutting down\n");
+        } else {
+            send_reply(fd, req.reply);
+        }
+        free(req.reply);
+    }
+    free(buf);
+    free(deltas);
+}
+
+static void *rule_api_thread_func(void *arg) {
+    rule_api_t *a = (rule_api_t *)arg;
+
+    while (!atomic_load_explicit(&a->stop, memory_order_relaxed)) {
+        int c = sock_accept(a->fd, 500, 1000);
+        if (c < 0) continue;
+
+        serve_client(a, c);
+        close(c);
+    }
+    return NULL;
+}
+
+int rule_api_start(rule_api_t *a, const char *path) {
+    memset(a, 0, sizeof(*a));
+    a->fd = -1;
+
+    int fd = sock_listen_unix(path, 16, "Rule API");
+    if (fd < 0) return -1;
+    strcpy(a->path, path);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&a->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&a->lock, NULL);
+    atomic_init(&a->stop, false);
+    a->pending = NULL;
+    a->fd = fd;
+
+    if (pthread_create(&a->thread, NULL, rule_api_thread_func, a) != 0) {
+        log_msg(LOG_ERROR, "Rule API: failed to start the server thread");
+        pthread_cond_destroy(&a->cond);
+        pthread_mutex_destroy(&a->lock);
+        close(fd);
+        unlink(path);
+        a->fd = -1;
+        return -1;
+    }
+
+    log_msg(LOG_INFO, "Rule API: accepting rule updates on %s", path);
+    return 0;
+}
+
+rule_api_request_t *rule_api_poll(rule_api_t *a, int timeout_ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&a->lock);
+    while (!a->pending && !atomic_load(&a->stop)) {
+        if (pthread_cond_timedwait(&a->cond, &a->lock, &ts) == ETIMEDOUT) break;
+    }
+    rule_api_request_t *req = a->pending;
+    a->pending = NULL;
+    pthread_mutex_unlock(&a->lock);
+    return req;
+}
+
+void rule_api_reply(rule_api_t *a, rule_api_request_t *req) {
+    pthread_mutex_lock(&a->lock);
+    req->done = true;
+    pthread_cond_broadcast(&a->cond);
+    pthread_mutex_unlock(&a->lock);
+}
+
+void rule_api_stop(rule_api_t *a) {
+    if (a->fd < 0) return;
+
+    pthread_mutex_lock(&a->lock);
+    atomic_store(&a->stop, true);
+    pthread_cond_broadcast(&a->cond);
+    pthread_mutex_unlock(&a->lock);
+    pthread_join(a->thread, NULL);
+
+    close(a->fd);
+    a->fd = -1;
+    unlink(a->path);
+    pthread_cond_destroy(&a->cond);
+    pthread_mutex_destroy(&a->lock);
+}
@@ -1,6 +1,7 @@
 #define _POSIX_C_SOURCE 200809L
 #include "rule_config.h"
 #include "parser.h"
+#include "policer.h"
 #include "rule_table.h"
 
 #include <arpa/inet.h>
@@ -16,6 +17,7 @@
 #include "log.h"
 
 #define MAX_LINE 512
+#define RULE_POLICER_MIN_BURST (4 * 1518) /* Bytes: a few full-size frames */
 
 static char *strip(char *s) {
     while (*s && isspace((unsigned char)*s)) {
@@ -105,24 +107,163 @@ static uint8_t parse_protocol(const char *val) {
     return 0;
 }
 
+static bool parse_u16(const char *val, uint16_t *out) {
+    errno = 0;
+    char *end = NULL;
+    long v = strtol(val, &end, 10);
+    if (errno != 0 || end == val || *end != '\0' || v < 0 || v > 65535) return false;
+    *out = (uint16_t)v;
+    return true;
+}
+
 /*
-    Flush this rule into a table.
+    Parse a count with an optional k, M or G suffix (powers of 1000, as in
+    link speeds) into *out. Returns false if it is not one or too large.
+*/
+static bool parse_scaled(const char *val, uint64_t *out) {
+    errno = 0;
+    char *end = NULL;
+    unsigned long long v = strtoull(val, &end, 10);
+    if (errno != 0 || end == val || *val == '-') return false;
+
+    uint64_t scale = 1;
+    if (*end == 'k' || *end == 'K') {
+        scale = 1000;
+    } else if (*end == 'M') {
+        scale = 1000 * 1000;
+    } else if (*end == 'G') {
+        scale = 1000 * 1000 * 1000;
+    }
+    if (scale > 1) end++;
+    if (*end != '\0' || v > UINT64_MAX / scale) return false;
+
+    *out = (uint64_t)v * scale;
+    return true;
+}
+
+/*
+    Set the field `key` of rule `r` to `val`, one line of a [rule] section.
+        Returns NULL on success, else what is wrong (e.g. "invalid priority").
+*/
+static const char *set_field(rule_t *r, const char *key, const char *val) {
+    if (strcmp(key, "priority") == 0) {
+        errno = 0;
+        char *end = NULL;
+        long v = strtol(val, &end, 10);
+        if (errno != 0 || end == val || *end != '\0' || v < 0 || v > UINT32_MAX) {
+            return "invalid priority";
+        }
+        r->priority = (uint32_t)v;
+    } else if (strcmp(key, "ip_version") == 0) {
+        if (strcmp(val, "4") == 0)
+            r->ip_ver = 4;
+        else if (strcmp(val, "6") == 0)
+            r->ip_ver = 6;
+        else
+            return "invalid ip_version";
+    } else if (strcmp(key, "protocol") == 0) {
+        r->protocol = parse_protocol(val);
+    } else if (strcmp(key, "src") == 0) {
+        uint8_t ver = 0;
+        if (parse_ip_prefix(val, &ver, &r->src_ip, &r->src_mask) != 0) {
+            return "invalid src address";
+        }
+        if (r->ip_ver == 0) r->ip_ver = ver;
+    } else if (strcmp(key, "dst") == 0) {
+        uint8_t ver = 0;
+        if (parse_ip_prefix(val, &ver, &r->dst_ip, &r->dst_mask) != 0) {
+            return "invalid dst address";
+        }
+        if (r->ip_ver == 0) r->ip_ver = ver;
+    } else if (strcmp(key, "src_port") == 0) {
+        if (!parse_u16(val, &r->src_port)) return "invalid src_port";
+    } else if (strcmp(key, "dst_port") == 0) {
+        if (!parse_u16(val, &r->dst_port)) return "invalid dst_port";
+    } else if (strcmp(key, "action") == 0) {
+        if (strcmp(val, "drop") == 0) {
+            r->action.type = ACT_DROP;
+        } else if (strcmp(val, "fwd") == 0) {
+            r->action.type = ACT_FWD;
+        } else {
+            return "invalid action";
+        }
+    } else if (strcmp(key, "rate") == 0) {
+        uint64_t bits = 0;
+        if (!parse_scaled(val, &bits) || bits < 8 * POLICER_MIN_RATE) return "invalid rate";
+        r->action.rate = bits / 8;
+    } else if (strcmp(key, "burst") == 0) {
+        if (!parse_scaled(val, &r->action.burst) || r->action.burst == 0) {
+            return "invalid burst";
+        }
+    } else if (strcmp(key, "mirror") == 0) {
+        uint64_t every = 0;
+        if (!parse_scaled(val, &every) || every == 0 || every > UINT32_MAX) {
+            return "invalid mirror";
+        }
+        r->action.mirror = (uint32_t)every;
+    } else if (strcmp(key, "out_iface") == 0) {
+        unsigned int idx = if_nametoindex(val);
+        if (idx == 0) return "unknown interface";
+        r->action.out_ifindex = (int)idx;
+    } else {
+        return "unknown key";
+    }
+    return NULL;
+}
+
+/*
+    Checks of a complete rule, and the defaults that depend on other keys.
+        Returns NULL if it is fine, else what is wrong.
+*/
+static const char *finish_rule(rule_t *r) {
+    if (r->action.type == ACT_FWD && r->action.out_ifindex == 0) {
+        return "fwd rule missing out_iface";
+    }
+    if (r->action.type != ACT_FWD && (r->action.rate || r->action.burst)) {
+        return "rate and burst need action=fwd";
+    }
+    if (r->action.burst && !r->action.rate) return "burst without rate";
+
+    /* Default burst: 10ms at the rate, at least a few full-size frames. */
+    if (r->action.rate && !r->action.burst) {
+        r->action.burst = r->action.rate / 100;
+        if (r->action.burst < RULE_POLICER_MIN_BURST) r->action.burst = RULE_POLICER_MIN_BURST;
+    }
+    return NULL;
+}
+
+/* Rules of the file so far, added to the table in one go once it parsed. */
+typedef struct {
+    rule_t *items;
+    size_t count;
+    size_t cap;
+} rule_list_t;
+
+/*
+    Flush this rule into the list.
         Returns 0 on success, -1 on error.
 */
-static int flush_rule(rule_t *r, bool *active, rule_table_t *rt, int line_num) {
+static int flush_rule(rule_t *r, bool *active, rule_list_t *list, int line_num) {
     if (!*active) return 0;
     *active = false;
 
-    if (r->action.type == ACT_FWD && r->action.out_ifindex == 0) {
-        log_msg(LOG_ERROR, "rules:%d: fwd rule missing out_iface", line_num);
+    const char *what = finish_rule(r);
+    if (what) {
+        log_msg(LOG_ERROR, "rules:%d: %s", line_num, what);
         return -1;
     }
 
-    if (rule_table_add(rt, r) != 0) {
-        log_msg(LOG_ERROR, "rules:%d: failed to add rule (table may be full)", line_num);
-        return -1;
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 256;
+        rule_t *items = realloc(list->items, cap * sizeof(rule_t));
+        if (!items) {
+            log_msg(LOG_ERROR, "rules:%d: out of memory", line_num);
+            return -1;
+        }
+        list->items = items;
+        list->cap = cap;
     }
-
+    list->items[list->count++] = *r;
     return 0;
 }
 
@@ -139,6 +280,7 @@ int rule_config_load(const char *path, rule_table_t *rt) {
     int line_num = 0;
     rule_t current;
     bool active = false;
+    rule_list_t list = {NULL, 0, 0};
 
     while (fgets(line, MAX_LINE, f)) {
         line_num++;
@@ -153,8 +295,9 @@ int rule_config_load(const char *path, rule_table_t *rt) {
         /* Section header. */
         if (*s == '[') {
             /* Flush previous rule. */
-            if (flush_rule(&current, &active, rt, line_num) != 0) {
+            if (flush_rule(&current, &active, &list, line_num) != 0) {
                 fclose(f);
+                free(list.items);
                 return -1;
             }
 
@@ -164,6 +307,7 @@ int rule_config_load(const char *path, rule_table_t *rt) {
             } else {
                 log_msg(LOG_ERROR, "rules:%d: unknown section header: %s", line_num, s);
                 fclose(f);
+                free(list.items);
                 return -1;
             }
             continue;
@@ -172,6 +316,7 @@ int rule_config_load(const char *path, rule_table_t *rt) {
         if (!active) {
             log_msg(LOG_ERROR, "rules:%d: key=value outside [rule] section", line_num);
             fclose(f);
+            free(list.items);
             return -1;
         }
 
@@ -180,6 +325,7 @@ int rule_config_load(const char *path, rule_table_t *rt) {
         if (!eq) {
             log_msg(LOG_ERROR, "rules:%d: expected key = value", line_num);
             fclose(f);
+            free(list.items);
             return -1;
         }
 
@@ -187,96 +333,66 @@ int rule_config_load(const char *path, rule_table_t *rt) {
         char *key = strip(s);
         char *val = strip(eq + 1);
 
-        if (strcmp(key, "priority") == 0) {
-            errno = 0;
-            char *end = NULL;
-            long v = strtol(val, &end, 10);
-            if (errno != 0 || end == val || *end != '\0' || v < 0) {
-                log_msg(LOG_ERROR, "rules:%d: invalid priority: %s", line_num, val);
-                fclose(f);
-                return -1;
-            }
-            current.priority = (uint32_t)v;
-        } else if (strcmp(key, "ip_version") == 0) {
-            if (strcmp(val, "4") == 0)
-                current.ip_ver = 4;
-            else if (strcmp(val, "6") == 0)
-                current.ip_ver = 6;
-            else {
-                log_msg(LOG_ERROR, "rules:%d: invalid ip_version: %s", line_num, val);
-                fclose(f);
-                return -1;
-            }
-        } else if (strcmp(key, "protocol") == 0) {
-            current.protocol = parse_protocol(val);
-        } else if (strcmp(key, "src") == 0) {
-            uint8_t ver = 0;
-            if (parse_ip_prefix(val, &ver, &current.src_ip, &current.src_mask) != 0) {
-                log_msg(LOG_ERROR, "rules:%d: invalid src address: %s", line_num, val);
-                fclose(f);
-                return -1;
-            }
-            if (current.ip_ver == 0) current.ip_ver = ver;
-        } else if (strcmp(key, "dst") == 0) {
-            uint8_t ver = 0;
-            if (parse_ip_prefix(val, &ver, &current.dst_ip, &current.dst_mask) != 0) {
-                log_msg(LOG_ERROR, "rules:%d: invalid dst address: %s", line_num, val);
-                fclose(f);
-                return -1;
-            }
-            if (current.ip_ver == 0) current.ip_ver = ver;
-        } else if (strcmp(key, "src_port") == 0) {
-            errno = 0;
-            char *end = NULL;
-            long v = strtol(val, &end, 10);
-            if (errno != 0 || end == val || *end != '\0' || v < 0 || v > 65535) {
-                log_msg(LOG_ERROR, "rules:%d: invalid src_port: %s", line_num, val);
-                fclose(f);
-                return -1;
-            }
-            current.src_port = (uint16_t)v;
-        } else if (strcmp(key, "dst_port") == 0) {
-            errno = 0;
-            char *end = NULL;
-            long v = strtol(val, &end, 10);
-            if (errno != 0 || end == val || *end != '\0' || v < 0 || v > 65535) {
-                log_msg(LOG_ERROR, "rules:%d: invalid dst_port: %s", line_num, val);
-                fclose(f);
-                return -1;
-            }
-            current.dst_port = (uint16_t)v;
-        } else if (strcmp(key, "action") == 0) {
-            if (strcmp(val, "drop") == 0) {
-                current.action.type = ACT_DROP;
-            } else if (strcmp(val, "fwd") == 0) {
-                current.action.type = ACT_FWD;
-            } else {
-                log_msg(LOG_ERROR, "rules:%d: invalid action: %s", line_num, val);
-                fclose(f);
-                return -1;
-            }
-        } else if (strcmp(key, "out_iface") == 0) {
-            unsigned int idx = if_nametoindex(val);
-            if (idx == 0) {
-                log_msg(LOG_ERROR, "rules:%d: unknown interface: %s", line_num, val);
-                fclose(f);
-                return -1;
-            }
-            current.action.out_ifindex = (int)idx;
-        } else {
-            log_msg(LOG_ERROR, "rules:%d: unknown key: %s", line, key);
+        const char *what = set_field(&current, key, val);
+        if (what) {
+            log_msg(LOG_ERROR, "rules:%d: %s: %s", line_num, what,
+                    strcmp(what, "unknown key") == 0 ? key : val);
             fclose(f);
+            free(list.items);
             return -1;
         }
     }
 
     /* Flush last rule. */
-    if (flush_rule(&current, &active, rt, line_num) != 0) {
+    if (flush_rule(&current, &active, &list, line_num) != 0) {
         fclose(f);
+        free(list.items);
         return -1;
     }
 
     fclose(f);
+
+    /* One sort for the whole file instead of one per rule. */
+    int rc = rule_table_add_bulk(rt, list.items, list.count);
+    free(list.items);
+    if (rc != 0) {
+        log_msg(LOG_ERROR, "%s: failed to add %zu rules (out of memory)", path, list.count);
+        return -1;
+    }
     log_msg(LOG_INFO, "Loaded %zu rules from %s", rt->count, path);
     return 0;
-}
\ No newline at end of file
+}
+
+int rule_config_parse_line(const char *line, rule_t *r, char *err, size_t err_len) {
+    if (!line || !r) return -1;
+
+    char buf[MAX_LINE];
+    if (snprintf(buf, sizeof(buf), "%s", line) >= (int)sizeof(buf)) {
+        snprintf(err, err_len, "rule too long");
+        return -1;
+    }
+    memset(r, 0, sizeof(*r));
+
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) {
+            snprintf(err, err_len, "expected key=value: %s", tok);
+            return -1;
+        }
+        *eq = '\0';
+        const char *what = set_field(r, tok, eq + 1);
+        if (what) {
+            snprintf(err, err_len, "%s: %s", what,
+                     strcmp(what, "unknown key") == 0 ? tok : eq + 1);
+            return -1;
+        }
+    }
+
+    const char *what = finish_rule(r);
+    if (what) {
+        snprintf(err, err_len, "%s", what);
+        return -1;
+    }
+    return 0;
+}
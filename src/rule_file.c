@@ -0,0 +1,398 @@
+#define _POSIX_C_SOURCE 200809L
+#include "rule_file.h"
+#include "log.h"
+#include "rule_config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t align_up(uint64_t v) {
+    return (v + RULE_FILE_ALIGN - 1) & ~(uint64_t)(RULE_FILE_ALIGN - 1);
+}
+
+uint64_t rule_file_checksum(const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0x100000001b3ULL;
+        h ^= h >> 32; /* A word-wise FNV only mixes upwards: fold the high half back */
+    }
+    return h;
+}
+
+/* Index of `ifindex` in ifaces[0..n), n if absent. */
+static size_t iface_find(const rule_file_iface_t *ifaces, size_t n, int ifindex) {
+    for (size_t i = 0; i < n; i++) {
+        if (ifaces[i].ifindex == ifindex) return i;
+    }
+    return n;
+}
+
+/* Distinct egress interfaces of the FWD rules, by name. *out is malloc'd. */
+static int collect_ifaces(const rule_table_t *rt, rule_file_iface_t **out, size_t *count) {
+    rule_file_iface_t *ifaces = NULL;
+    size_t n = 0, cap = 0;
+
+    for (size_t i = 0; i < rt->count; i++) {
+        const flow_action_t *a = &rt->rules[i].action;
+        if (a->type != ACT_FWD || iface_find(ifaces, n, a->out_ifindex) < n) continue;
+
+        if (n == cap) {
+            cap = cap ? cap * 2 : 8;
+            rule_file_iface_t *grown = realloc(ifaces, cap * sizeof(*ifaces));
+            if (!grown) {
+                free(ifaces);
+                return -1;
+            }
+            ifaces = grown;
+        }
+        memset(&ifaces[n], 0, sizeof(ifaces[n]));
+        char name[IF_NAMESIZE];
+        if (!if_indextoname((unsigned int)a->out_ifindex, name)) {
+            log_msg(LOG_ERROR, "Rule %u: no interface with ifindex %d", rt->rules[i].rule_id,
+                    a->out_ifindex);
+            free(ifaces);
+            return -1;
+        }
+        snprintf(ifaces[n].name, sizeof(ifaces[n].name), "%s", name);
+        ifaces[n].ifindex = a->out_ifindex;
+        n++;
+    }
+
+    *out = ifaces;
+    *count = n;
+    return 0;
+}
+
+int rule_file_write(const char *path, const rule_table_t *rt) {
+    if (!path || !rt || !rt->rules) return -1;
+    if (!rt->cls) {
+        log_msg(LOG_ERROR, "Rule file: the table has no compiled classifier");
+        return -1;
+    }
+    if (rt->next_id != rt->count) {
+        log_msg(LOG_ERROR, "Rule file: rule ids have gaps (rules were deleted)");
+        return -1;
+    }
+    const classifier_t *cls = rt->cls;
+
+    rule_file_iface_t *ifaces = NULL;
+    size_t iface_count = 0;
+    if (collect_ifaces(rt, &ifaces, &iface_count) != 0) return -1;
+
+    /* Layout: every section starts on RULE_FILE_ALIGN, see rule_file.h. */
+    rule_file_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, RULE_FILE_MAGIC, sizeof(h.magic));
+    h.version = RULE_FILE_VERSION;
+    h.byte_order = RULE_FILE_BYTE_ORDER;
+    h.rule_size = (uint32_t)sizeof(rule_t);
+    h.entry_size = (uint32_t)sizeof(cls_entry_t);
+    h.rule_count = (uint32_t)rt->count;
+    h.tuple_count = (uint32_t)cls->tuple_count;
+    h.iface_count = (uint32_t)iface_count;
+
+    uint64_t off = align_up(sizeof(h));
+    h.ifaces_off = off;
+    off = align_up(off + iface_count * sizeof(rule_file_iface_t));
+    h.rules_off = off;
+    off = align_up(off + rt->count * sizeof(rule_t));
+    h.tuples_off = off;
+    off = align_up(off + cls->tuple_count * sizeof(rule_file_tuple_t));
+    uint64_t slots_off = off;
+    for (size_t i = 0; i < cls->tuple_count; i++) {
+        off = align_up(off + ((uint64_t)cls->tuples[i].slot_mask + 1) * sizeof(cls_entry_t));
+    }
+    h.file_size = off;
+
+    /* Zeroed, so padding is deterministic and the same rules give the same file. */
+    uint8_t *buf = calloc(1, (size_t)h.file_size);
+    if (!buf) {
+        log_msg(LOG_ERROR, "Rule file: out of memory (%lu bytes)", (unsigned long)h.file_size);
+        free(ifaces);
+        return -1;
+    }
+    memcpy(buf + h.ifaces_off, ifaces, iface_count * sizeof(rule_file_iface_t));
+    memcpy(buf + h.rules_off, rt->rules, rt->count * sizeof(rule_t));
+    free(ifaces);
+
+    rule_file_tuple_t *tuples = (rule_file_tuple_t *)(buf + h.tuples_off);
+    off = slots_off;
+    for (size_t i = 0; i < cls->tuple_count; i++) {
+        const cls_tuple_t *t = &cls->tuples[i];
+        size_t slots = (size_t)t->slot_mask + 1;
+        memcpy(tuples[i].mask, t->mask, sizeof(tuples[i].mask));
+        tuples[i].min_order = t->min_order;
+        tuples[i].count = t->count;
+        tuples[i].slot_mask = t->slot_mask;
+        tuples[i].slots_off = off;
+        memcpy(buf + off, t->slots, slots * sizeof(cls_entry_t));
+        off = align_up(off + slots * sizeof(cls_entry_t));
+    }
+
+    h.checksum = rule_file_checksum(buf + h.ifaces_off, (size_t)(h.file_size - h.ifaces_off));
+    memcpy(buf, &h, sizeof(h));
+
+    /* Write next to it and rename: a reload never maps a half-written file. */
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        log_msg(LOG_ERROR, "Rule file: path too long: %s", path);
+        free(buf);
+        return -1;
+    }
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        log_msg(LOG_ERROR, "Unable to create %s: %s", tmp, strerror(errno));
+        free(buf);
+        return -1;
+    }
+    size_t written = fwrite(buf, 1, (size_t)h.file_size, f);
+    free(buf);
+    if (fclose(f) != 0 || written != h.file_size || rename(tmp, path) != 0) {
+        log_msg(LOG_ERROR, "Failed to write %s: %s", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Whether [off, off + count * size) lies within the file and starts aligned. */
+static bool section_ok(uint64_t off, uint64_t count, uint64_t size, uint64_t file_size) {
+    if (off % RULE_FILE_ALIGN != 0 || off > file_size) return false;
+    return size == 0 || count <= (file_size - off) / size;
+}
+
+/* Every index the dataplane follows stays inside the file; the first problem is logged. */
+static int rule_file_validate(const uint8_t *base, uint64_t size, const char *path) {
+    const rule_file_header_t *h = (const rule_file_header_t *)base;
+
+    if (h->version != RULE_FILE_VERSION) {
+        log_msg(LOG_ERROR, "%s: rule file version %u, this build reads %u (recompile it)", path,
+                h->version, RULE_FILE_VERSION);
+        return -1;
+    }
+    if (h->byte_order != RULE_FILE_BYTE_ORDER || h->rule_size != sizeof(rule_t) ||
+        h->entry_size != sizeof(cls_entry_t)) {
+        log_msg(LOG_ERROR, "%s: rule file written by another build (recompile it)", path);
+        return -1;
+    }
+    if (h->file_size != size || size % RULE_FILE_ALIGN != 0 ||
+        h->ifaces_off != align_up(sizeof(*h)) ||
+        !section_ok(h->ifaces_off, h->iface_count, sizeof(rule_file_iface_t), size) ||
+        !section_ok(h->rules_off, h->rule_count, sizeof(rule_t), size) ||
+        !section_ok(h->tuples_off, h->tuple_count, sizeof(rule_file_tuple_t), size)) {
+        log_msg(LOG_ERROR, "%s: truncated or malformed rule file", path);
+        return -1;
+    }
+    if (rule_file_checksum(base + h->ifaces_off, (size_t)(size - h->ifaces_off)) != h->checksum) {
+        log_msg(LOG_ERROR, "%s: rule file checksum mismatch", path);
+        return -1;
+    }
+
+    const rule_file_iface_t *ifaces = (const rule_file_iface_t *)(base + h->ifaces_off);
+    for (uint32_t i = 0; i < h->iface_count; i++) {
+        if (memchr(ifaces[i].name, '\0', sizeof(ifaces[i].name)) == NULL) {
+            log_msg(LOG_ERROR, "%s: interface name %u is not terminated", path, i);
+            return -1;
+        }
+    }
+
+    /* Rule ids index the per-worker stats: each one below rule_count, none twice. */
+    const rule_t *rules = (const rule_t *)(base + h->rules_off);
+    uint8_t *seen = calloc((size_t)h->rule_count / 8 + 1, 1);
+    if (!seen) return -1;
+    int rc = 0;
+    for (uint32_t i = 0; i < h->rule_count && rc == 0; i++) {
+        const rule_t *r = &rules[i];
+        if (r->rule_id >= h->rule_count || (seen[r->rule_id / 8] & (1u << (r->rule_id % 8)))) {
+            log_msg(LOG_ERROR, "%s: rule %u: invalid or duplicate id %u", path, i, r->rule_id);
+            rc = -1;
+        } else if ((r->ip_ver != 0 && r->ip_ver != 4 && r->ip_ver != 6) ||
+                   (r->action.type != ACT_DROP && r->action.type != ACT_FWD) ||
+                   (r->action.type == ACT_FWD &&
+                    iface_find(ifaces, h->iface_count, r->action.out_ifindex) == h->iface_count) ||
+                   (r->action.rate != 0 && r->action.type != ACT_FWD)) {
+            log_msg(LOG_ERROR, "%s: rule %u: invalid fields", path, r->rule_id);
+            rc = -1;
+        } else if (i > 0 && (r->priority < rules[i - 1].priority ||
+                             (r->priority == rules[i - 1].priority &&
+                              r->rule_id < rules[i - 1].rule_id))) {
+            log_msg(LOG_ERROR, "%s: rules are not in priority order", path);
+            rc = -1;
+        } else {
+            seen[r->rule_id / 8] |= (uint8_t)(1u << (r->rule_id % 8));
+        }
+    }
+    free(seen);
+    if (rc != 0) return -1;
+
+    /* Lookups stop at the first empty slot: every table needs one. */
+    const rule_file_tuple_t *tuples = (const rule_file_tuple_t *)(base + h->tuples_off);
+    for (uint32_t i = 0; i < h->tuple_count; i++) {
+        const rule_file_tuple_t *t = &tuples[i];
+        uint64_t slots = (uint64_t)t->slot_mask + 1;
+        if ((slots & t->slot_mask) != 0 || t->count >= slots ||
+            (i > 0 && t->min_order < tuples[i - 1].min_order) ||
+            !section_ok(t->slots_off, slots, sizeof(cls_entry_t), size)) {
+            log_msg(LOG_ERROR, "%s: tuple %u is malformed", path, i);
+            return -1;
+        }
+
+        const cls_entry_t *e = (const cls_entry_t *)(base + t->slots_off);
+        uint64_t used = 0;
+        for (uint64_t s = 0; s < slots; s++) {
+            if (e[s].rule_id == CLS_EMPTY) continue;
+            if (e[s].rule_id >= h->rule_count) {
+                log_msg(LOG_ERROR, "%s: tuple %u points past the rules", path, i);
+                return -1;
+            }
+            used++;
+        }
+        if (used != t->count) {
+            log_msg(LOG_ERROR, "%s: tuple %u is malformed", path, i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+bool rule_file_detect(const char *path) {
+    char magic[8];
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    bool is_compiled = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+                       memcmp(magic, RULE_FILE_MAGIC, sizeof(magic)) == 0;
+    fclose(f);
+    return is_compiled;
+}
+
+int rule_file_load(const char *path, rule_table_t *rt) {
+    if (!path || !rt) return -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        log_msg(LOG_ERROR, "Unable to open rules file: %s: %s", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(rule_file_header_t)) {
+        log_msg(LOG_ERROR, "%s: truncated or malformed rule file", path);
+        close(fd);
+        return -1;
+    }
+
+    /* Private and writable: resolving an interface again only copies the pages it patches. */
+    size_t size = (size_t)st.st_size;
+    uint8_t *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        log_msg(LOG_ERROR, "mmap(%s) failed: %s", path, strerror(errno));
+        return -1;
+    }
+    const rule_file_header_t *h = (const rule_file_header_t *)base;
+    if (memcmp(h->magic, RULE_FILE_MAGIC, sizeof(h->magic)) != 0 ||
+        rule_file_validate(base, size, path) != 0) {
+        if (memcmp(h->magic, RULE_FILE_MAGIC, sizeof(h->magic)) != 0) {
+            log_msg(LOG_ERROR, "%s: not a compiled rule file", path);
+        }
+        munmap(base, size);
+        return -1;
+    }
+
+    /* Interfaces by name: the same one may have another index on this host or boot. */
+    rule_file_iface_t *ifaces = (rule_file_iface_t *)(base + h->ifaces_off);
+    rule_t *rules = (rule_t *)(base + h->rules_off);
+    int *resolved = calloc((size_t)h->iface_count + 1, sizeof(int));
+    if (!resolved) {
+        munmap(base, size);
+        return -1;
+    }
+    bool moved = false;
+    for (uint32_t i = 0; i < h->iface_count; i++) {
+        resolved[i] = (int)if_nametoindex(ifaces[i].name);
+        if (resolved[i] == 0) {
+            log_msg(LOG_ERROR, "%s: unknown interface: %s", path, ifaces[i].name);
+            free(resolved);
+            munmap(base, size);
+            return -1;
+        }
+        moved |= resolved[i] != ifaces[i].ifindex;
+    }
+    for (uint32_t i = 0; moved && i < h->rule_count; i++) {
+        if (rules[i].action.type != ACT_FWD) continue;
+        size_t k = iface_find(ifaces, h->iface_count, rules[i].action.out_ifindex);
+        if (resolved[k] != rules[i].action.out_ifindex) rules[i].action.out_ifindex = resolved[k];
+    }
+    free(resolved);
+
+    classifier_t *cls = calloc(1, sizeof(classifier_t));
+    cls_tuple_t *tuples = calloc((size_t)h->tuple_count + 1, sizeof(cls_tuple_t));
+    const rule_t **by_id = calloc((size_t)h->rule_count + 1, sizeof(const rule_t *));
+    /* For the generation: a table that was just mapped must not share one either. */
+    if (!cls || !tuples || !by_id || rule_table_init(rt, 1) != 0) {
+        log_msg(LOG_ERROR, "%s: out of memory", path);
+        free(cls);
+        free(tuples);
+        free(by_id);
+        munmap(base, size);
+        return -1;
+    }
+    free(rt->rules);
+
+    const rule_file_tuple_t *ft = (const rule_file_tuple_t *)(base + h->tuples_off);
+    for (uint32_t i = 0; i < h->tuple_count; i++) {
+        memcpy(tuples[i].mask, ft[i].mask, sizeof(tuples[i].mask));
+        tuples[i].min_order = ft[i].min_order;
+        tuples[i].count = ft[i].count;
+        tuples[i].slot_mask = ft[i].slot_mask;
+        tuples[i].slots = (cls_entry_t *)(base + ft[i].slots_off);
+    }
+    for (uint32_t i = 0; i < h->rule_count; i++) {
+        by_id[rules[i].rule_id] = &rules[i]; /* Ids are 0..rule_count-1, validated */
+    }
+    cls->by_id = by_id;
+    cls->id_count = h->rule_count;
+    cls->tuples = tuples;
+    cls->tuple_count = h->tuple_count;
+    cls->owned = NULL; /* The slots are in the mapping */
+
+    rt->rules = rules;
+    rt->count = h->rule_count;
+    rt->next_id = h->rule_count;
+    rt->capacity = h->rule_count ? h->rule_count : 1; /* Sizes the per-worker stats */
+    rt->cls = cls;
+    rt->map = base;
+    rt->map_len = size;
+
+    log_msg(LOG_INFO, "Mapped %zu compiled rules (%zu tuples) from %s", rt->count,
+            cls->tuple_count, path);
+    return 0;
+}
+
+int rule_table_load(const char *path, rule_table_t *rt) {
+    if (!path || !rt) return -1;
+
+    if (rule_file_detect(path)) return rule_file_load(path, rt);
+
+    if (rule_table_init(rt, RULE_TABLE_DEFAULT_CAPACITY) != 0) {
+        log_msg(LOG_ERROR, "rule_table_init failed");
+        return -1;
+    }
+    if (rule_config_load(path, rt) != 0) {
+        rule_table_destroy(rt);
+        return -1;
+    }
+    if (rule_table_compile(rt) != 0) {
+        log_msg(LOG_WARN, "Rule classifier build failed, using linear scan");
+    }
+    return 0;
+}
@@ -1,7 +1,19 @@
 #include "rule_table.h"
+#include "classifier.h"
 
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+
+/* Source of rule_table_t.generation, shared by all tables so that a reloaded
+ * table never reuses the generation of the one it replaces. */
+static atomic_uint g_rule_generation = 0;
+
+static uint32_t next_generation(void) {
+    uint32_t g = atomic_fetch_add(&g_rule_generation, 1u) + 1u;
+    return g ? g : next_generation(); /* 0 is reserved for "never matched" */
+}
 
 /*
     Helper to create 32-bit mask from prefix length.
@@ -116,53 +128,266 @@ int rule_table_init(rule_table_t *t, size_t capacity) {
 
     t->count = 0;
     t->capacity = capacity;
+    t->next_id = 0;
+    t->cls = NULL;
+    t->generation = next_generation();
+    t->map = NULL;
+    t->map_len = 0;
     return 0;
 }
 
+/* Drop the compiled classifier (it points into the rules array). */
+static void rule_table_uncompile(rule_table_t *t) {
+    if (t->cls) {
+        classifier_destroy(t->cls);
+        free(t->cls);
+        t->cls = NULL;
+    }
+}
+
+/* Give back the rule file mapping, if any. */
+static void rule_table_unmap(rule_table_t *t) {
+    if (t->map) {
+        munmap(t->map, t->map_len);
+        t->map = NULL;
+        t->map_len = 0;
+    }
+}
+
 void rule_table_destroy(rule_table_t *t) {
     if (!t) return;
-    free(t->rules);
+    rule_table_uncompile(t);
+    if (t->map) {
+        rule_table_unmap(t);
+    } else {
+        free(t->rules);
+    }
     t->rules = NULL;
     t->count = 0;
     t->capacity = 0;
 }
 
-int rule_table_add(rule_table_t *t, const rule_t *r_in) {
-    if (!t || !t->rules || !r_in) return -1;
-    if (t->count >= t->capacity) return -1;
+/* Room for `want` rules on the heap: doubles the capacity, copies mapped rules out. */
+static int rule_table_reserve(rule_table_t *t, size_t want) {
+    if (want <= t->capacity && !t->map) return 0;
 
-    /* Copy incoming rule (struct copy, field-by-field by compiler). */
-    rule_t r = *r_in;
+    size_t cap = t->capacity ? t->capacity : 1;
+    while (cap < want) {
+        if (cap > SIZE_MAX / 2 / sizeof(rule_t)) return -1;
+        cap *= 2;
+    }
+
+    rule_t *rules;
+    if (t->map) {
+        rules = malloc(cap * sizeof(rule_t));
+        if (!rules) return -1;
+        memcpy(rules, t->rules, t->count * sizeof(rule_t));
+        rule_table_uncompile(t); /* Its hash tables live in the mapping too */
+        rule_table_unmap(t);
+    } else {
+        rules = realloc(t->rules, cap * sizeof(rule_t));
+        if (!rules) return -1;
+        rule_table_uncompile(t); /* It points into the old array */
+    }
 
-    /* Assign stable rule ID by insertion order. */
-    r.rule_id = (uint32_t)t->count;
+    t->rules = rules;
+    t->capacity = cap;
+    return 0;
+}
 
-    /* If mask=0 (wildcard), src_ip, dst_ip don't matter. */
-    if (r.ip_ver == 4 && r.src_mask.v4 == 0) r.src_ip.v4 = 0;
-    if (r.ip_ver == 4 && r.dst_mask.v4 == 0) r.dst_ip.v4 = 0;
+/* If mask=0 (wildcard), src_ip, dst_ip don't matter. */
+static void rule_normalize(rule_t *r) {
+    if (r->ip_ver == 4 && r->src_mask.v4 == 0) r->src_ip.v4 = 0;
+    if (r->ip_ver == 4 && r->dst_mask.v4 == 0) r->dst_ip.v4 = 0;
 
-    /* If mask=0 (wildcard), src_ip, dst_ip don't matter. */
-    if (r.ip_ver == 6) {
+    if (r->ip_ver == 6) {
         static const uint8_t zero16[16] = {0};
-        if (memcmp(r.src_mask.v6, zero16, 16) == 0) {
-            memset(r.src_ip.v6, 0, 16);
+        if (memcmp(r->src_mask.v6, zero16, 16) == 0) {
+            memset(r->src_ip.v6, 0, 16);
         }
-        if (memcmp(r.dst_mask.v6, zero16, 16) == 0) {
-            memset(r.dst_ip.v6, 0, 16);
+        if (memcmp(r->dst_mask.v6, zero16, 16) == 0) {
+            memset(r->dst_ip.v6, 0, 16);
         }
     }
+}
+
+int rule_table_add(rule_table_t *t, const rule_t *r_in) {
+    if (!r_in) return -1;
+    return rule_table_add_bulk(t, r_in, 1);
+}
+
+int rule_table_add_bulk(rule_table_t *t, const rule_t *rules, size_t n) {
+    if (!t || !t->rules || (!rules && n > 0)) return -1;
+    if (n == 0) return 0;
+    /* Ids index the per-rule stats: the capacity stays above every one of them. */
+    if (n >= UINT32_MAX - t->next_id || rule_table_reserve(t, t->next_id + n) != 0) return -1;
 
-    t->rules[t->count++] = r;
+    rule_table_uncompile(t);
 
-    /* Keep table sorted by priority after each insertion. */
+    for (size_t i = 0; i < n; i++) {
+        /* Copy incoming rule (struct copy, field-by-field by compiler). */
+        rule_t r = rules[i];
+
+        /* Assign stable rule ID by insertion order. */
+        r.rule_id = t->next_id++;
+        rule_normalize(&r);
+        t->rules[t->count++] = r;
+    }
+
+    /* Keep table sorted by priority: one sort for the whole batch. */
     qsort(t->rules, t->count, sizeof(rule_t), rule_priority_cmp);
 
+    /* Rules moved: pointers handed out for the old contents are stale. */
+    t->generation = next_generation();
+    return 0;
+}
+
+int rule_table_apply(rule_table_t *next, rule_table_t *cur, rule_delta_t *deltas, size_t n,
+                     size_t *failed) {
+    size_t unused;
+    if (!failed) failed = &unused;
+    *failed = n;
+    if (!next || !cur || !cur->rules || (!deltas && n > 0)) return -1;
+
+    /* Position of each id in cur->rules, UINT32_MAX if none (never used, or removed). */
+    uint32_t ids = cur->next_id;
+    uint32_t *pos = malloc(((size_t)ids + 1) * sizeof(uint32_t));
+    rule_t *added = malloc((n + 1) * sizeof(rule_t));       /* New versions, by the delta */
+    rule_t *changed = malloc((2 * n + 1) * sizeof(rule_t)); /* Old and new versions */
+    rule_t *rules = NULL;
+    if (!pos || !added || !changed) goto fail;
+    memset(pos, 0xff, ((size_t)ids + 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < cur->count; i++) {
+        pos[cur->rules[i].rule_id] = (uint32_t)i;
+    }
+
+    size_t n_added = 0, n_changed = 0, n_removed = 0;
+    uint32_t next_id = cur->next_id;
+    for (size_t i = 0; i < n; i++) {
+        rule_delta_t *d = &deltas[i];
+
+        if (d->op == RULE_ADD) {
+            if (next_id == UINT32_MAX - 1) goto fail;
+            rule_t r = d->rule;
+            r.rule_id = next_id++;
+            rule_normalize(&r);
+            d->rule_id = r.rule_id;
+            added[n_added++] = r;
+            changed[n_changed++] = r;
+            continue;
+        }
+
+        /* The rule is in `cur`, or was added by an earlier delta of this batch. */
+        size_t a = 0;
+        while (a < n_added && added[a].rule_id != d->rule_id) a++;
+        if (a == n_added) {
+            if (d->rule_id >= ids || pos[d->rule_id] == UINT32_MAX) {
+                *failed = i;
+                goto fail;
+            }
+            changed[n_changed++] = cur->rules[pos[d->rule_id]];
+            pos[d->rule_id] = UINT32_MAX;
+            n_removed++;
+        }
+
+        if (d->op == RULE_DELETE) {
+            if (a < n_added) added[a] = added[--n_added];
+        } else {
+            rule_t r = d->rule;
+            r.rule_id = d->rule_id;
+            rule_normalize(&r);
+            if (a < n_added) {
+                added[a] = r;
+            } else {
+                added[n_added++] = r;
+            }
+            changed[n_changed++] = r;
+        }
+    }
+
+    /* Survivors keep their order: merge them with the sorted new versions. */
+    qsort(added, n_added, sizeof(rule_t), rule_priority_cmp);
+    size_t count = cur->count - n_removed + n_added;
+    size_t cap = cur->capacity;
+    while (cap < next_id || cap < count) {
+        if (cap > SIZE_MAX / 2 / sizeof(rule_t)) goto fail;
+        cap *= 2;
+    }
+    rules = malloc(cap * sizeof(rule_t));
+    if (!rules) goto fail;
+
+    size_t o = 0, a = 0, k = 0;
+    while (k < count) {
+        if (o < cur->count && pos[cur->rules[o].rule_id] == UINT32_MAX) {
+            o++;
+        } else if (a == n_added ||
+                   (o < cur->count && rule_priority_cmp(&cur->rules[o], &added[a]) < 0)) {
+            rules[k++] = cur->rules[o++];
+        } else {
+            rules[k++] = added[a++];
+        }
+    }
+
+    classifier_t *c = NULL;
+    if (cur->cls) {
+        c = malloc(sizeof(classifier_t));
+        if (!c || classifier_update(c, cur->cls, rules, count, changed, n_changed) != 0) {
+            free(c);
+            goto fail;
+        }
+    }
+
+    next->rules = rules;
+    next->count = count;
+    next->capacity = cap;
+    next->next_id = next_id;
+    next->cls = c;
+    next->generation = next_generation();
+    next->map = NULL;
+    next->map_len = 0;
+    free(pos);
+    free(added);
+    free(changed);
+    return 0;
+
+fail:
+    free(rules);
+    free(pos);
+    free(added);
+    free(changed);
+    return -1;
+}
+
+void rule_table_take_over(rule_table_t *next, rule_table_t *cur) {
+    if (!next || !cur || !next->cls || !cur->cls) return;
+    classifier_take_over(next->cls, cur->cls);
+}
+
+int rule_table_compile(rule_table_t *t) {
+    if (!t || !t->rules) return -1;
+
+    rule_table_uncompile(t);
+
+    classifier_t *c = malloc(sizeof(classifier_t));
+    if (!c) return -1;
+    if (classifier_init(c, t->rules, t->count) != 0) {
+        free(c);
+        return -1;
+    }
+
+    t->cls = c;
     return 0;
 }
 
 const rule_t *rule_table_match(const rule_table_t *t, const flow_key_t *k) {
     if (!t || !t->rules || !k) return NULL;
 
+    /* Compiled path: O(#tuples) hash probes. Non-IP keys are rare and only
+     * matched by ip_ver=0 rules, the linear scan below handles them. */
+    if (t->cls && (k->ip_ver == 4 || k->ip_ver == 6)) {
+        return classifier_lookup(t->cls, k);
+    }
+
     /* Get the first match => highest priority.
        PERFORMANCE: O(N_rules) worst case, O(1) best case (first match). */
     for (size_t i = 0; i < t->count; i++) {
@@ -0,0 +1,80 @@
+#define _POSIX_C_SOURCE 200809L
+#include "classifier.h"
+#include "log.h"
+#include "rule_config.h"
+#include "rule_file.h"
+#include "rule_table.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+    upe-rulec: compile a text rule file (rule_config.h) into the binary format
+    of rule_file.h, which upe maps at startup and on SIGHUP instead of parsing.
+*/
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s <rules.ini> <out>   Compile text rules into a rule file\n"
+            "       %s --check <file>      Validate a rule file (text or compiled)\n"
+            "\n"
+            "A compiled file belongs to the build that wrote it: compile again after\n"
+            "upgrading upe. Egress interfaces are stored by name and must exist on the\n"
+            "host that loads it.\n",
+            prog, prog);
+}
+
+static double elapsed_ms(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double)(t1.tv_sec - t0->tv_sec) * 1e3 + (double)(t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+static int check(const char *path) {
+    rule_table_t rt;
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (rule_table_load(path, &rt) != 0) return 1;
+    double ms = elapsed_ms(&t0);
+
+    printf("%s: %s, %zu rules, %zu tuples, loaded in %.3f ms\n", path,
+           rt.map ? "compiled" : "text", rt.count, rt.cls ? rt.cls->tuple_count : (size_t)0, ms);
+    rule_table_destroy(&rt);
+    return 0;
+}
+
+static int compile(const char *in, const char *out) {
+    if (rule_file_detect(in)) {
+        log_msg(LOG_ERROR, "%s is already compiled", in);
+        return 1;
+    }
+
+    rule_table_t rt;
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (rule_table_load(in, &rt) != 0) return 1;
+    if (!rt.cls) {
+        rule_table_destroy(&rt);
+        return 1;
+    }
+    if (rule_file_write(out, &rt) != 0) {
+        rule_table_destroy(&rt);
+        return 1;
+    }
+
+    printf("%s: %zu rules, %zu tuples, compiled in %.3f ms\n", out, rt.count,
+           rt.cls->tuple_count, elapsed_ms(&t0));
+    rule_table_destroy(&rt);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    log_set_level(LOG_WARN);
+
+    if (argc == 3 && strcmp(argv[1], "--check") == 0) return check(argv[2]);
+    if (argc == 3 && argv[1][0] != '-') return compile(argv[1], argv[2]);
+
+    usage(argv[0]);
+    return 2;
+}
@@ -0,0 +1,309 @@
+#include "rx.h"
+#include "latency.h"
+#include "log.h"
+#include "parser.h"
+#include "reta.h"
+#include "xsk.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+static volatile sig_atomic_t g_rx_stop = 0;
+
+bool rx_should_stop(void) { return g_rx_stop != 0; }
+
+void rx_stop(void) {
+    g_rx_stop = 1;
+    rx_pcap_stop(); /* pcap_breakloop() is documented as signal-safe */
+}
+
+/* Round robin distribution of packets across the rings. */
+static uint32_t pick_ring_round_robin(uint32_t ring_count) {
+    static uint32_t rr = 0; /* static, so keeps its value between function calls */
+    uint32_t idx = rr;
+    rr = (rr + 1) % ring_count;
+    return idx;
+}
+
+/* Push the staging batch of ring `i`, stamped for the worker's ring residency stage. */
+static void rx_push_batch(rx_ctx_t *rx, uint32_t i) {
+    if (rx->batches[i].count == 0) return;
+
+    /* One TSC read per batch; the metadata lines were written at RX anyway. */
+    uint64_t now = rdtsc();
+    for (unsigned int k = 0; k < rx->batches[i].count; k++) {
+        rx->batches[i].buffer[k]->ring_tsc = now;
+    }
+
+    unsigned int pushed =
+        ring_push_burst(&rx->rings[i], (void **)rx->batches[i].buffer, rx->batches[i].count);
+    if (pushed > 0 && rx->wake_workers) ring_notify(&rx->rings[i]);
+    /* If ring is full: drop the remaining packets */
+    for (unsigned int k = pushed; k < rx->batches[i].count; k++) {
+        pktbuf_release(rx->batches[i].buffer[k]);
+    }
+    rx->batches[i].count = 0;
+}
+
+/* Add `b` to the batch of ring `ring_id`; a full batch is pushed right away. */
+static void rx_stage(rx_ctx_t *rx, uint32_t ring_id, pktbuf_t *b) {
+    rx->batches[ring_id].buffer[rx->batches[ring_id].count++] = b;
+    if (rx->batches[ring_id].count == RX_BURST_SIZE) rx_push_batch(rx, ring_id);
+}
+
+/* Send the packets held back by a RETA move to ring `ring_id`, in order. */
+static void rx_release_held(rx_ctx_t *rx, uint32_t ring_id) {
+    reta_t *t = rx->reta;
+    for (unsigned int i = 0; i < t->hold_count; i++) {
+        rx_stage(rx, ring_id, t->hold[i]);
+    }
+    t->hold_count = 0;
+}
+
+/*
+    Drive a RETA bucket move (see reta.h): start a requested one, finish the
+    one in flight once the old worker drained, then release the held packets.
+*/
+static void rx_reta_poll(rx_ctx_t *rx) {
+    reta_t *t = rx->reta;
+
+    int from = reta_move_begin(t);
+    if (from >= 0) {
+        /* Packets of the bucket still staged go out before the mark. */
+        rx_push_batch(rx, (uint32_t)from);
+        reta_arm(t, atomic_load_explicit(&rx->rings[from].head, memory_order_relaxed));
+    }
+
+    if (reta_move_try_finish(t)) rx_release_held(rx, t->move_to);
+}
+
+void rx_flush(rx_ctx_t *rx) {
+    for (uint32_t i = 0; i < rx->ring_count; i++) {
+        rx_push_batch(rx, i);
+    }
+    if (rx->reta) rx_reta_poll(rx);
+}
+
+/* Watermark callback of ring `r`: RX stops feeding it data while it is congested. */
+static void rx_ring_watermark(spsc_ring_t *r, bool high, void *arg) {
+    rx_ctx_t *rx = (rx_ctx_t *)arg;
+    rx->congested[r - rx->rings] = high;
+}
+
+/*
+    Early drop: a congested ring would drop at the tail anyway, after RX paid
+    for the staging and the push. Data is dropped right here instead; control
+    traffic still goes in, so the neighbour tables stay fresh while the worker
+    catches up. Control is whatever has no flow key: ARP and other non-IP, and
+    ICMPv6 (NDP), which parse_flow_key() does not take either.
+*/
+static bool rx_early_drop(rx_ctx_t *rx, uint32_t ring_id, bool has_key) {
+    if (!has_key || !rx->congested[ring_id]) return false;
+
+    /* The worker may have drained since the last push. */
+    ring_check_watermarks(&rx->rings[ring_id]);
+    return rx->congested[ring_id];
+}
+
+void rx_dispatch(rx_ctx_t *rx, pktbuf_t *b) {
+    /* Choose a worker ring based on Flow Hash (Software RSS). */
+    flow_key_t k;
+    uint32_t ring_id;
+    bool has_key = parse_flow_key(b->data, b->len, &k) == 0;
+
+    if (has_key) {
+        uint32_t hash = flow_hash(&k);
+        if (rx->reta) {
+            int r = reta_lookup(rx->reta, hash);
+            if (r == RETA_HOLD) {
+                if (reta_hold(rx->reta, b)) return;
+                /* Old worker drains too slowly: stay on its ring, held packets first. */
+                r = reta_move_abort(rx->reta);
+                rx_release_held(rx, (uint32_t)r);
+            }
+            ring_id = (uint32_t)r;
+        } else {
+            ring_id = hash % rx->ring_count;
+        }
+    } else {
+        /* Fallback to Round Robin for non-IP/malformed packets. */
+        ring_id = pick_ring_round_robin(rx->ring_count);
+    }
+
+    if (rx_early_drop(rx, ring_id, has_key)) {
+        rx->early_drops++;
+        pktbuf_release(b);
+    } else {
+        /* Add to local batch buffer */
+        rx_stage(rx, ring_id, b);
+    }
+
+    /* Under full load rx_flush() may never run: look at moves every burst. */
+    if (rx->reta && ++rx->reta_tick == RX_BURST_SIZE) {
+        rx->reta_tick = 0;
+        rx_reta_poll(rx);
+    }
+}
+
+/*
+-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+RX Loops (pcap has its own callback-driven loop in rx_pcap.c)
+-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+*/
+
+static int rx_afpacket_run(rx_ctx_t *rx) {
+    if (!rx->iface) {
+        log_msg(LOG_ERROR, "AF_PACKET RX needs an interface (use --rx pcap for file replay)");
+        return -1;
+    }
+
+    rx_afpacket_t s;
+    if (rx_afpacket_open(&s, rx->iface, -1) != 0) return -1;
+    log_msg(LOG_INFO, "RX started on %s (AF_PACKET TPACKET_V3, %u x %u KB blocks)", rx->iface,
+            s.block_count, s.block_size / 1024);
+
+    pktbuf_t *burst[RX_BURST_SIZE];
+
+    while (!rx_should_stop()) {
+        unsigned int n = rx_afpacket_recv_burst(&s, rx->pools, burst, RX_BURST_SIZE);
+
+        for (unsigned int i = 0; i < n; i++) {
+            rx_dispatch(rx, burst[i]);
+        }
+
+        if (n < RX_BURST_SIZE) {
+            /* Ring drained: push partial batches before going to sleep. */
+            rx_flush(rx);
+            if (n == 0) {
+                /* The block retire timeout wakes us within ~1ms; the poll timeout only
+                 * guarantees rx_stop() is observed even on a silent link. */
+                int rc = rx_afpacket_wait(&s, 100);
+                if (rc < 0 && errno != EINTR) {
+                    log_msg(LOG_ERROR, "poll failed: %s", strerror(errno));
+                    break;
+                }
+            }
+        }
+    }
+
+    if (s.oversized_drops) {
+        log_msg(LOG_INFO, "AF_PACKET RX: dropped %lu oversized frames", s.oversized_drops);
+    }
+    if (s.nobuf_drops) {
+        log_msg(LOG_INFO, "AF_PACKET RX: dropped %lu frames (pool empty)", s.nobuf_drops);
+    }
+    rx_afpacket_close(&s);
+    return 0;
+}
+
+static int rx_xdp_run(rx_ctx_t *rx) {
+    if (!rx->iface) {
+        log_msg(LOG_ERROR, "AF_XDP RX needs an interface");
+        return -1;
+    }
+
+    xdp_prog_t prog;
+    if (xdp_prog_attach(&prog, rx->iface) != 0) return -1;
+
+    xsk_t x;
+    if (xsk_open(&x, rx->iface, 0, &rx->pools->pool[PKTBUF_CLASS_STD]) != 0 ||
+        xdp_prog_add_xsk(&prog, &x) != 0) {
+        xsk_close(&x);
+        xdp_prog_detach(&prog);
+        return -1;
+    }
+    log_msg(LOG_INFO, "RX started on %s queue 0 (AF_XDP)", rx->iface);
+
+    pktbuf_t *burst[RX_BURST_SIZE];
+
+    while (!rx_should_stop()) {
+        unsigned int n = xsk_rx_burst(&x, burst, RX_BURST_SIZE);
+
+        for (unsigned int i = 0; i < n; i++) {
+            rx_dispatch(rx, burst[i]);
+        }
+
+        if (n < RX_BURST_SIZE) {
+            rx_flush(rx);
+            if (n == 0) xsk_wait(&x, 1);
+        }
+    }
+
+    if (x.fill_empty) {
+        log_msg(LOG_INFO, "AF_XDP RX: fill ring starved %lu times (pool empty)", x.fill_empty);
+    }
+    xsk_close(&x);
+    xdp_prog_detach(&prog);
+    return 0;
+}
+
+int rx_ctx_setup(rx_ctx_t *rx) {
+    if (rx->reta && rx->reta->ring_count != rx->ring_count) {
+        log_msg(LOG_ERROR, "RETA has %u rings, RX has %u", rx->reta->ring_count, rx->ring_count);
+        return -1;
+    }
+
+    rx->batches = calloc(rx->ring_count, sizeof(rx_batch_t));
+    if (!rx->batches) {
+        log_msg(LOG_ERROR, "calloc failed for rx->batches");
+        return -1;
+    }
+
+    /* High at 3/4 of the ring, clear again at 1/4: room left for a few bursts
+     * of control traffic, and no flapping around a single threshold. */
+    rx->congested = calloc(rx->ring_count, sizeof(bool));
+    if (!rx->congested) {
+        log_msg(LOG_ERROR, "calloc failed for rx->congested");
+        free(rx->batches);
+        rx->batches = NULL;
+        return -1;
+    }
+    for (uint32_t i = 0; i < rx->ring_count; i++) {
+        size_t cap = rx->rings[i].capacity;
+        ring_set_watermarks(&rx->rings[i], cap - cap / 4, cap / 4, rx_ring_watermark, rx);
+    }
+    return 0;
+}
+
+void rx_ctx_teardown(rx_ctx_t *rx) {
+    /* A move still in flight keeps packets back: return them to the pool. */
+    if (rx->reta) {
+        for (unsigned int i = 0; i < rx->reta->hold_count; i++) {
+            pktbuf_release(rx->reta->hold[i]);
+        }
+        rx->reta->hold_count = 0;
+    }
+
+    if (rx->early_drops > 0) {
+        log_msg(LOG_INFO, "RX: %lu packets dropped early at congested rings", rx->early_drops);
+    }
+
+    free(rx->congested);
+    rx->congested = NULL;
+    free(rx->batches);
+    rx->batches = NULL;
+}
+
+int rx_start(rx_ctx_t *rx) {
+    if (!rx || !rx->pools || !rx->rings || rx->ring_count == 0) return -1;
+    if (rx_ctx_setup(rx) != 0) return -1;
+
+    int rc;
+    switch (rx->mode) {
+    case RX_MODE_AFPACKET:
+        rc = rx_afpacket_run(rx);
+        break;
+    case RX_MODE_XDP:
+        rc = rx_xdp_run(rx);
+        break;
+    case RX_MODE_PCAP:
+    default:
+        rc = rx_pcap_run(rx);
+        break;
+    }
+
+    rx_ctx_teardown(rx);
+    return rc;
+}
@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+#include "latency.h"
+#include "log.h"
+#include "rx.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+/*
+    Ring geometry.
+        - 64 blocks of 256 KB = 16 MB of kernel-shared memory per socket.
+        - Frame size is only a hint for TPACKET_V3 (frames are variable length
+          inside a block), but the kernel still validates frame_nr against it.
+        - The kernel retires a partially filled block after RX_AFP_BLOCK_TMO_MS,
+          which bounds the latency at low packet rates similarly to pcap's to_ms.
+*/
+#define RX_AFP_BLOCK_SIZE (1u << 18)
+#define RX_AFP_BLOCK_COUNT 64u
+#define RX_AFP_FRAME_SIZE 2048u
+#define RX_AFP_BLOCK_TMO_MS 1u
+
+/* TPACKET_ALIGN(sizeof(struct tpacket3_hdr)), spelled out for -Wsign-conversion. */
+#define RX_AFP_HDR_LEN                                                                             \
+    ((sizeof(struct tpacket3_hdr) + TPACKET_ALIGNMENT - 1u) & ~((size_t)TPACKET_ALIGNMENT - 1u))
+
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING 23
+#endif
+
+static inline struct tpacket_block_desc *block_at(const rx_afpacket_t *s, unsigned int idx) {
+    return (struct tpacket_block_desc *)(s->map + (size_t)idx * s->block_size);
+}
+
+int rx_afpacket_open(rx_afpacket_t *s, const char *iface, int fanout_group) {
+    if (!s || !iface) return -1;
+
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+
+    int ifindex = (int)if_nametoindex(iface);
+    if (ifindex == 0) {
+        log_msg(LOG_ERROR, "if_nametoindex(%s) failed: %s", iface, strerror(errno));
+        return -1;
+    }
+
+    int fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (fd < 0) {
+        log_msg(LOG_ERROR, "socket(AF_PACKET) failed: %s", strerror(errno));
+        return -1;
+    }
+
+    int ver = TPACKET_V3;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) < 0) {
+        log_msg(LOG_ERROR, "setsockopt(PACKET_VERSION) failed: %s", strerror(errno));
+        goto fail;
+    }
+
+    /* Loopback prevention, same as pcap_setdirection(PCAP_D_IN). Older kernels
+     * don't know this option, rx_afpacket_recv_burst() filters on pkttype too. */
+    int one = 1;
+    if (setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one)) < 0) {
+        log_msg(LOG_DEBUG, "setsockopt(PACKET_IGNORE_OUTGOING) failed: %s", strerror(errno));
+    }
+
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = RX_AFP_BLOCK_SIZE;
+    req.tp_block_nr = RX_AFP_BLOCK_COUNT;
+    req.tp_frame_size = RX_AFP_FRAME_SIZE;
+    req.tp_frame_nr = (RX_AFP_BLOCK_SIZE / RX_AFP_FRAME_SIZE) * RX_AFP_BLOCK_COUNT;
+    req.tp_retire_blk_tov = RX_AFP_BLOCK_TMO_MS;
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        log_msg(LOG_ERROR, "setsockopt(PACKET_RX_RING) failed: %s", strerror(errno));
+        goto fail;
+    }
+
+    size_t map_len = (size_t)RX_AFP_BLOCK_SIZE * RX_AFP_BLOCK_COUNT;
+    void *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        log_msg(LOG_ERROR, "mmap(PACKET_RX_RING) failed: %s", strerror(errno));
+        goto fail;
+    }
+
+    /* Bind only after the ring exists, so no frame goes through the slow path. */
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        log_msg(LOG_ERROR, "bind(%s) failed: %s", iface, strerror(errno));
+        munmap(map, map_len);
+        goto fail;
+    }
+
+    /* Fanout must be joined after bind. The kernel picks the member socket by
+     * the skb flow hash, which is symmetric, so both directions of a flow land
+     * on the same worker (same property as flow_hash() in rx_dispatch()). */
+    if (fanout_group >= 0) {
+        int arg =
+            (fanout_group & 0xffff) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+        if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+            log_msg(LOG_ERROR, "setsockopt(PACKET_FANOUT) failed: %s", strerror(errno));
+            munmap(map, map_len);
+            goto fail;
+        }
+    }
+
+    s->fd = fd;
+    s->map = map;
+    s->map_len = map_len;
+    s->block_size = RX_AFP_BLOCK_SIZE;
+    s->block_count = RX_AFP_BLOCK_COUNT;
+    return 0;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+/* Hand the current block back to the kernel and move on to the next one. */
+static inline void release_block(rx_afpacket_t *s) {
+    struct tpacket_block_desc *bd = block_at(s, s->block_idx);
+    /* All reads from the block must be done before the kernel may refill it. */
+    __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    s->block_idx = (s->block_idx + 1) % s->block_count;
+    s->pkts_left = 0;
+    s->next_pkt = NULL;
+}
+
+/*
+    Put `b` at out[*n] in front of the `*spare` bulk-allocated buffers stored
+    there: the first spare moves behind the others, or back to `spare_pool` if
+    `out` is full.
+*/
+static void insert_before_spares(pktbuf_t **out, unsigned int *n, unsigned int *spare,
+                                 unsigned int max, pktbuf_pool_t *spare_pool, pktbuf_t *b) {
+    if (*spare > 0) {
+        if (*n + *spare < max) {
+            out[*n + *spare] = out[*n];
+        } else {
+            pktbuf_free(spare_pool, out[*n]);
+            (*spare)--;
+        }
+    }
+    out[(*n)++] = b;
+}
+
+unsigned int rx_afpacket_recv_burst(rx_afpacket_t *s, pktbuf_classes_t *pools, pktbuf_t **out,
+                                    unsigned int max) {
+    unsigned int n = 0;
+    unsigned int spare = 0; /* Allocated but unused buffers, at out[n .. n + spare) */
+    pktbuf_pool_t *spare_pool = NULL;
+
+    while (n < max) {
+        if (s->pkts_left == 0) {
+            struct tpacket_block_desc *bd = block_at(s, s->block_idx);
+            uint32_t status = __atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE);
+            if ((status & TP_STATUS_USER) == 0) break; /* Kernel still owns it */
+
+            s->pkts_left = bd->hdr.bh1.num_pkts;
+            s->next_pkt = (const uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt;
+            if (s->pkts_left == 0) {
+                /* Timer-retired empty block */
+                release_block(s);
+                continue;
+            }
+        }
+
+        const struct tpacket3_hdr *hdr = (const struct tpacket3_hdr *)s->next_pkt;
+        const struct sockaddr_ll *sll = (const struct sockaddr_ll *)(s->next_pkt + RX_AFP_HDR_LEN);
+
+        /* Advance the cursor first: every exit below consumes this frame. */
+        s->next_pkt += hdr->tp_next_offset;
+        s->pkts_left--;
+        if (s->pkts_left > 0) __builtin_prefetch(s->next_pkt);
+
+        if (sll->sll_pkttype != PACKET_OUTGOING) {
+            /* Smallest size class that holds the frame. */
+            pktbuf_pool_t *pool = pktbuf_classes_pick(pools, hdr->tp_snaplen);
+            if (!pool) {
+                s->oversized_drops++;
+            } else {
+                if (spare == 0) {
+                    /* One pool transfer for the rest of the block, as far as `out` has
+                     * room, from the class of its first frame. */
+                    unsigned int want = s->pkts_left + 1;
+                    if (want > max - n) want = max - n;
+                    spare = pktbuf_alloc_bulk(pool, &out[n], want);
+                    spare_pool = pool;
+                }
+
+                pktbuf_t *b = NULL;
+                if (spare > 0 && spare_pool == pool) {
+                    b = out[n++];
+                    spare--;
+                } else {
+                    /* Other class than the spares, or its pool ran dry: a buffer of
+                     * its own, from the next larger class if need be. */
+                    b = pktbuf_alloc_len(pools, hdr->tp_snaplen);
+                    if (b) insert_before_spares(out, &n, &spare, max, spare_pool, b);
+                }
+
+                if (b) {
+                    /* The block goes back to the kernel as soon as it is walked,
+                     * so the frame has to be copied into an owned buffer. */
+                    memcpy(b->data, (const uint8_t *)hdr + hdr->tp_mac, hdr->tp_snaplen);
+                    b->len = hdr->tp_snaplen;
+                    b->timestamp = rdtsc();
+                } else {
+                    /* Every class that fits is empty: drop the packet. */
+                    s->nobuf_drops++;
+                }
+            }
+        }
+
+        if (s->pkts_left == 0) release_block(s);
+    }
+
+    /* Leftovers of a block that ended in outgoing, oversized or other-class frames. */
+    if (spare > 0) pktbuf_free_bulk(spare_pool, &out[n], spare);
+    return n;
+}
+
+int rx_afpacket_wait(rx_afpacket_t *s, int timeout_ms) {
+    struct pollfd pfd = {.fd = s->fd, .events = POLLIN | POLLERR, .revents = 0};
+    return poll(&pfd, 1, timeout_ms);
+}
+
+void rx_afpacket_close(rx_afpacket_t *s) {
+    if (!s) return;
+    if (s->map) munmap(s->map, s->map_len);
+    if (s->fd >= 0) close(s->fd);
+    s->map = NULL;
+    s->fd = -1;
+}
@@ -2,7 +2,6 @@
 #define _BSD_SOURCE
 #include "latency.h"
 #include "log.h"
-#include "parser.h"
 #include "rx.h"
 
 #include <arpa/inet.h>
@@ -12,47 +11,23 @@
 
 static pcap_t *g_pcap = NULL;
 
-void rx_stop(void) {
+void rx_pcap_stop(void) {
     if (g_pcap) pcap_breakloop(g_pcap);
 }
 
-/* Round robin distribution of packets across the rings. */
-static uint32_t pick_ring_round_robin(uint32_t ring_count) {
-    static uint32_t rr = 0; /* static, so keeps its value between function calls */
-    uint32_t idx = rr;
-    rr = (rr + 1) & (ring_count - 1);
-    return idx;
-}
-
-/* Flush pending packets in the staging buffers to the rings. */
-static void flush_rx_buffers(rx_ctx_t *rx) {
-    for (uint32_t i = 0; i < rx->ring_count; i++) {
-        if (rx->batches[i].count > 0) {
-            unsigned int pushed = ring_push_burst(&rx->rings[i], (void **)rx->batches[i].buffer,
-                                                  rx->batches[i].count);
-            /* If ring is full: drop the remaining packets */
-            for (unsigned int k = pushed; k < rx->batches[i].count; k++) {
-                pktbuf_free(rx->pool, rx->batches[i].buffer[k]);
-            }
-            rx->batches[i].count = 0;
-        }
-    }
-}
-
 static void pcap_callback(u_char *user, const struct pcap_pkthdr *hdr, const u_char *bytes) {
     rx_ctx_t *rx = (rx_ctx_t *)user;
 
-    /* Allocate an own buffer. */
-    pktbuf_t *b = pktbuf_alloc(rx->pool);
-    if (!b) {
-        /* Pool is full, drop the packet. */
+    /* Allocate an own buffer, of the smallest size class that holds the packet. */
+    if (!pktbuf_classes_pick(rx->pools, hdr->caplen)) {
+        /* Larger than every class, drop it. */
+        rx->oversized_drops++;
         return;
     }
-
-    /* Make sure packet fits in the buffer. */
-    if (hdr->caplen > PKTBUF_DATA_SIZE) {
-        /* Oversized packet, drop it. */
-        pktbuf_free(rx->pool, b);
+    pktbuf_t *b = pktbuf_alloc_len(rx->pools, hdr->caplen);
+    if (!b) {
+        /* Every class that fits is empty (queued or in flight), drop the packet. */
+        rx->nobuf_drops++;
         return;
     }
 
@@ -64,42 +39,10 @@ static void pcap_callback(u_char *user, const struct pcap_pkthdr *hdr, const u_c
     /* Stamp the arrival time using RDTSC. */
     b->timestamp = rdtsc();
 
-    /* Choose a worker ring based on Flow Hash (Software RSS). */
-    flow_key_t k;
-    uint32_t ring_id;
-
-    if (parse_flow_key(b->data, b->len, &k) == 0) {
-        uint32_t hash = flow_hash(&k);
-        ring_id = hash & (rx->ring_count - 1);
-    } else {
-        /* Fallback to Round Robin for non-IP/malformed packets. */
-        ring_id = pick_ring_round_robin(rx->ring_count);
-    }
-
-    /* Add to local batch buffer */
-    rx->batches[ring_id].buffer[rx->batches[ring_id].count++] = b;
-
-    if (rx->batches[ring_id].count == RX_BURST_SIZE) {
-        /* Buffer is full, time to flush now */
-        unsigned int pushed = ring_push_burst(&rx->rings[ring_id],
-                                              (void **)rx->batches[ring_id].buffer, RX_BURST_SIZE);
-
-        /* Free buffers that didn't fit (drop them) */
-        for (unsigned int i = pushed; i < RX_BURST_SIZE; i++) {
-            pktbuf_free(rx->pool, rx->batches[ring_id].buffer[i]);
-        }
-        rx->batches[ring_id].count = 0;
-    }
+    rx_dispatch(rx, b);
 }
 
-int rx_start(rx_ctx_t *rx) {
-    if (!rx || !rx->pool || !rx->rings || rx->ring_count == 0) return -1;
-
-    if ((rx->ring_count & (rx->ring_count - 1)) != 0) {
-        log_msg(LOG_ERROR, "rx->ring_count (%d) must be power of two", rx->ring_count);
-        return -1;
-    }
-
+int rx_pcap_run(rx_ctx_t *rx) {
     char errbuf[PCAP_ERRBUF_SIZE];
 
     if (rx->pcap_file) {
@@ -124,14 +67,8 @@ int rx_start(rx_ctx_t *rx) {
         }
     }
 
-    rx->batches = calloc(rx->ring_count, sizeof(rx_batch_t));
-    if (!rx->batches) {
-        log_msg(LOG_ERROR, "calloc failed for rx->batches");
-        return -1;
-    }
-
     /* pcap_dispatch is to allow periodic flushing of partial batches */
-    while (1) {
+    while (!rx_should_stop()) {
         /* Process batch of packets from the OS */
         /*
             pcap_dispatch operates on the `pcap_t` handle, that encapsulates the config
@@ -150,7 +87,7 @@ int rx_start(rx_ctx_t *rx) {
         /* Flush packets that are sitting in the staging buffers.
          * It's guaranteed to run at least once every millisecond (1ms timeout
          * coming from pcap_open_live). */
-        flush_rx_buffers(rx);
+        rx_flush(rx);
 
         /* EOF on pcap file */
         if (rc == 0 && rx->pcap_file) {
@@ -159,9 +96,15 @@ int rx_start(rx_ctx_t *rx) {
         }
     }
 
-    pcap_close(g_pcap);
+    if (rx->nobuf_drops) {
+        log_msg(LOG_INFO, "pcap RX: dropped %lu packets (pool empty)", rx->nobuf_drops);
+    }
+    if (rx->oversized_drops) {
+        log_msg(LOG_INFO, "pcap RX: dropped %lu oversized packets", rx->oversized_drops);
+    }
+
+    pcap_t *p = g_pcap;
     g_pcap = NULL;
-    free(rx->batches);
-    rx->batches = NULL;
+    pcap_close(p);
     return 0;
-}
\ No newline at end of file
+}
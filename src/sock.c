@@ -0,0 +1,70 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sock.h"
+#include "log.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(((struct sockaddr_un *)0)->sun_path) == SOCK_PATH_MAX,
+               "SOCK_PATH_MAX must match sun_path");
+
+int sock_listen_unix(const char *path, int backlog, const char *who) {
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (!path || path[0] == '\0' || strlen(path) >= sizeof(sa.sun_path)) {
+        log_msg(LOG_ERROR, "%s: invalid UNIX socket path '%s'", who, path ? path : "");
+        return -1;
+    }
+    strcpy(sa.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        log_msg(LOG_ERROR, "socket(AF_UNIX) failed: %s", strerror(errno));
+        return -1;
+    }
+
+    /* Left behind by an earlier run that did not shut down cleanly. */
+    unlink(path);
+    /* Nobody can connect before listen(): the mode is set by then. */
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0 || chmod(path, 0600) != 0 ||
+        listen(fd, backlog) != 0) {
+        log_msg(LOG_ERROR, "%s: cannot listen on %s: %s", who, path, strerror(errno));
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+int sock_accept(int listen_fd, int timeout_ms, int io_timeout_ms) {
+    struct pollfd pfd = {.fd = listen_fd, .events = POLLIN};
+    if (poll(&pfd, 1, timeout_ms) <= 0) return -1;
+
+    int c = accept(listen_fd, NULL, NULL);
+    if (c < 0) return -1;
+
+    struct timeval tv = {.tv_sec = io_timeout_ms / 1000,
+                         .tv_usec = (io_timeout_ms % 1000) * 1000};
+    setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    return c;
+}
+
+int sock_send_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
@@ -3,16 +3,43 @@
 #include "tx.h"
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <arpa/inet.h>
+#include <linux/if_packet.h>
 #include <net/ethernet.h>
 #include <net/if.h>
-#include <netpacket/packet.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 
+/*
+    TX ring geometry: 256 slots of 4 KB (16 blocks of 64 KB, 1 MB per socket).
+    A slot holds the tpacket2_hdr followed by the frame, so 4 KB leaves room for
+    a full PKTBUF_DATA_SIZE frame. Jumbo-class frames do not fit a slot and are
+    dropped, the rest of the burst still goes out; jumbo traffic needs the
+    sendmmsg backend.
+*/
+#define TX_RING_FRAME_SIZE 4096u
+#define TX_RING_BLOCK_SIZE (1u << 16)
+#define TX_RING_BLOCK_COUNT 16u
+#define TX_RING_FRAME_COUNT ((TX_RING_BLOCK_SIZE / TX_RING_FRAME_SIZE) * TX_RING_BLOCK_COUNT)
+
+/* Without PACKET_TX_HAS_OFF the kernel reads frame data right after the header,
+ * at TPACKET2_HDRLEN - sizeof(struct sockaddr_ll) == TPACKET_ALIGN(sizeof(tpacket2_hdr)).
+ * Spelled out for -Wsign-conversion. */
+#define TX_RING_DATA_OFF                                                                           \
+    ((sizeof(struct tpacket2_hdr) + TPACKET_ALIGNMENT - 1u) & ~((size_t)TPACKET_ALIGNMENT - 1u))
+#define TX_RING_MAX_LEN (TX_RING_FRAME_SIZE - TX_RING_DATA_OFF)
+
+struct tx_ring {
+    uint8_t *map;
+    size_t map_len;
+    unsigned int head; /* Next slot to fill */
+};
+
 int tx_init(tx_ctx_t *tx, const char *out_iface) {
     if (!tx || !out_iface) return -1;
 
@@ -57,9 +84,143 @@ int tx_init(tx_ctx_t *tx, const char *out_iface) {
     return 0;
 }
 
+/*
+    Take the TX ring off the socket again (before it is mapped). While a ring is
+    attached the kernel sends only ring slots and ignores sendmmsg() payloads,
+    so the sendmmsg fallback depends on this.
+*/
+static void tx_ring_detach(int fd) {
+    struct tpacket_req req;
+    memset(&req, 0, sizeof(req));
+    if (setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+        log_msg(LOG_ERROR, "setsockopt(PACKET_TX_RING, detach) failed: %s", strerror(errno));
+    }
+}
+
+int tx_ring_enable(tx_ctx_t *tx) {
+    if (!tx || tx->sock_fd < 0 || tx->ring) return -1;
+
+    int fd = tx->sock_fd;
+
+    /* Allocated first: nothing can fail between attaching the ring and mapping
+     * it that would leave the socket half switched. */
+    tx_ring_t *ring = calloc(1, sizeof(*ring));
+    if (!ring) return -1;
+
+    int ver = TPACKET_V2;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) < 0) {
+        log_msg(LOG_ERROR, "setsockopt(PACKET_VERSION) failed: %s", strerror(errno));
+        free(ring);
+        return -1;
+    }
+
+    /* Hand frames straight to the driver, skipping the qdisc layer. */
+    int one = 1;
+    if (setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)) < 0) {
+        log_msg(LOG_WARN, "setsockopt(PACKET_QDISC_BYPASS) failed: %s", strerror(errno));
+    }
+
+    /* Malformed frames are dropped and their slot is released, instead of
+     * stalling the ring in TP_STATUS_WRONG_FORMAT. */
+    if (setsockopt(fd, SOL_PACKET, PACKET_LOSS, &one, sizeof(one)) < 0) {
+        log_msg(LOG_WARN, "setsockopt(PACKET_LOSS) failed: %s", strerror(errno));
+    }
+
+    struct tpacket_req req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = TX_RING_BLOCK_SIZE;
+    req.tp_block_nr = TX_RING_BLOCK_COUNT;
+    req.tp_frame_size = TX_RING_FRAME_SIZE;
+    req.tp_frame_nr = TX_RING_FRAME_COUNT;
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+        log_msg(LOG_ERROR, "setsockopt(PACKET_TX_RING) failed: %s", strerror(errno));
+        free(ring);
+        return -1;
+    }
+
+    /* Bind with protocol 0: the socket gets a device for the send() kick but no
+     * RX hook, so it doesn't queue a copy of every received packet. The kernel
+     * takes skb->protocol from the Ethernet header. */
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = 0;
+    addr.sll_ifindex = tx->ifindex;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        log_msg(LOG_ERROR, "bind(TX ring) failed: %s", strerror(errno));
+        tx_ring_detach(fd);
+        free(ring);
+        return -1;
+    }
+
+    ring->map_len = (size_t)TX_RING_BLOCK_SIZE * TX_RING_BLOCK_COUNT;
+    void *map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        log_msg(LOG_ERROR, "mmap(PACKET_TX_RING) failed: %s", strerror(errno));
+        tx_ring_detach(fd);
+        free(ring);
+        return -1;
+    }
+    ring->map = map;
+    tx->ring = ring;
+    return 0;
+}
+
+/*
+    Copy frames into free ring slots and mark them TP_STATUS_SEND_REQUEST.
+    A frame larger than a slot is skipped (not queued), the next ones still are.
+        Returns the number of frames queued; stops early when the ring is full.
+*/
+static int tx_ring_queue(tx_ring_t *ring, const uint8_t *const *frames, const size_t *lens,
+                         int count) {
+    int queued = 0;
+
+    for (int i = 0; i < count; i++) {
+        size_t len = lens[i];
+        if (len > TX_RING_MAX_LEN) {
+            log_msg_ratelimited(LOG_WARN, "TX ring: %zu byte frame does not fit a slot, dropped",
+                                len);
+            continue;
+        }
+
+        struct tpacket2_hdr *hdr =
+            (struct tpacket2_hdr *)(ring->map + (size_t)ring->head * TX_RING_FRAME_SIZE);
+
+        /* The kernel flips the slot back to TP_STATUS_AVAILABLE once sent. */
+        uint32_t status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+        if (status != TP_STATUS_AVAILABLE) break; /* Ring full */
+
+        memcpy((uint8_t *)hdr + TX_RING_DATA_OFF, frames[i], len);
+        hdr->tp_len = (uint32_t)len;
+
+        /* Frame bytes must be visible before the kernel sees the request. */
+        __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+        ring->head = (ring->head + 1) % TX_RING_FRAME_COUNT;
+        queued++;
+    }
+
+    return queued;
+}
+
+/* One syscall transmits every slot in TP_STATUS_SEND_REQUEST. */
+static void tx_ring_kick(const tx_ctx_t *tx) {
+    if (send(tx->sock_fd, NULL, 0, MSG_DONTWAIT) < 0 && errno != EAGAIN && errno != ENOBUFS) {
+        log_msg_ratelimited(LOG_WARN, "send(TX ring) failed: %s", strerror(errno));
+    }
+    /* On EAGAIN/ENOBUFS the requests stay queued and go out with the next kick. */
+}
+
 int tx_send(const tx_ctx_t *tx, const uint8_t *frame, size_t len) {
     if (!tx || tx->sock_fd < 0 || !frame || len == 0) return -1;
 
+    /* With a TX ring, sendto() data is ignored: the kernel only sends ring slots. */
+    if (tx->ring) {
+        if (tx_ring_queue(tx->ring, &frame, &len, 1) != 1) return -1;
+        tx_ring_kick(tx);
+        return 0;
+    }
+
     /* Link layer setup. */
     struct sockaddr_ll addr;
     memset(&addr, 0, sizeof(addr));
@@ -84,6 +245,12 @@ int tx_send_batch(const tx_ctx_t *tx, const uint8_t *const *frames, const size_t
         count = TX_BATCH_MAX;
     }
 
+    if (tx->ring) {
+        int queued = tx_ring_queue(tx->ring, frames, lens, count);
+        if (queued > 0) tx_ring_kick(tx);
+        return queued;
+    }
+
     /* Single sockaddr_ll reused for all packets in batch. */
     struct sockaddr_ll addr;
     memset(&addr, 0, sizeof(addr));
@@ -110,7 +277,7 @@ int tx_send_batch(const tx_ctx_t *tx, const uint8_t *const *frames, const size_t
     int sent = sendmmsg(tx->sock_fd, msgs, (unsigned int)count, 0);
 
     if (sent < 0) {
-        log_msg(LOG_WARN, "sendmmsg failed: %s", strerror(errno));
+        log_msg_ratelimited(LOG_WARN, "sendmmsg failed: %s", strerror(errno));
         return 0;
     }
 
@@ -119,6 +286,11 @@ int tx_send_batch(const tx_ctx_t *tx, const uint8_t *const *frames, const size_t
 
 void tx_close(tx_ctx_t *tx) {
     if (!tx) return;
+    if (tx->ring) {
+        munmap(tx->ring->map, tx->ring->map_len);
+        free(tx->ring);
+        tx->ring = NULL;
+    }
     if (tx->sock_fd >= 0) close(tx->sock_fd);
     tx->sock_fd = -1;
     tx->ifindex = 0;
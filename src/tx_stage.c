@@ -0,0 +1,125 @@
+#define _POSIX_C_SOURCE 200809L
+#include "tx_stage.h"
+#include "affinity.h"
+#include "log.h"
+#include "pktbuf.h"
+
+#include <sched.h>
+#include <time.h>
+
+int tx_stage_init(tx_stage_t *s, int stage_id, int core_id, const tx_ctx_t *tx,
+                  idle_mode_t idle_mode) {
+    if (!s || !tx) return -1;
+
+    s->stage_id = stage_id;
+    s->core_id = core_id;
+    s->ring_count = 0;
+    s->tx = tx;
+    s->idle_mode = idle_mode;
+    atomic_init(&s->stop, false);
+    s->pkts_sent = 0;
+    s->pkts_dropped = 0;
+    s->bursts = 0;
+    s->idle_streak = 0;
+    return 0;
+}
+
+int tx_stage_add_ring(tx_stage_t *s, spsc_ring_t *r) {
+    if (!s || !r || s->ring_count == TX_STAGE_MAX_RINGS) return -1;
+    s->rings[s->ring_count++] = r;
+    return 0;
+}
+
+/* Send up to one burst from `r`. Returns the number of packets taken. */
+static unsigned int tx_stage_burst(tx_stage_t *s, spsc_ring_t *r) {
+    const uint8_t *frames[WORKER_BURST_SIZE];
+    size_t lens[WORKER_BURST_SIZE];
+    void **slots;
+
+    unsigned int n = ring_peek_burst(r, &slots, WORKER_BURST_SIZE);
+    if (n == 0) return 0;
+
+    pktbuf_t **bufs = (pktbuf_t **)slots;
+    for (unsigned int i = 0; i < n; i++) {
+        frames[i] = bufs[i]->data;
+        lens[i] = bufs[i]->len;
+    }
+
+    int sent = tx_send_batch(s->tx, frames, lens, (int)n);
+    if (sent < 0) sent = 0;
+
+    /* The frames are copied into the socket buffer or a TX ring slot by now. */
+    pktbuf_release_bulk(bufs, n);
+    ring_pop_commit(r, n);
+
+    s->pkts_sent += (uint64_t)sent;
+    s->pkts_dropped += (uint64_t)(n - (unsigned int)sent);
+    s->bursts++;
+    return n;
+}
+
+/* Same steps as a worker's backoff, minus the yields: a stage has no RX to wait for. */
+static void tx_stage_idle(tx_stage_t *s) {
+    uint32_t streak = s->idle_streak++;
+
+    if (s->idle_mode == IDLE_MODE_POLL || streak < WORKER_IDLE_SPIN_ROUNDS) {
+        uint32_t spins = s->idle_mode == IDLE_MODE_POLL ? 1u : 1u << streak;
+        for (uint32_t i = 0; i < spins; i++) {
+            cpu_relax();
+        }
+        return;
+    }
+
+    streak -= WORKER_IDLE_SPIN_ROUNDS;
+    long us = streak < 10 ? 1L << streak : WORKER_IDLE_SLEEP_MAX_US;
+    if (us > WORKER_IDLE_SLEEP_MAX_US) us = WORKER_IDLE_SLEEP_MAX_US;
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = us * 1000};
+    nanosleep(&ts, NULL);
+}
+
+static void *tx_stage_main(void *arg) {
+    tx_stage_t *s = (tx_stage_t *)arg;
+
+    log_thread_attach();
+
+    if (s->core_id >= 0) {
+        if (affinity_pin_self(s->core_id) != 0) {
+            log_msg(LOG_WARN, "TX stage %d: failed to pin to core %d", s->stage_id, s->core_id);
+        } else {
+            log_msg(LOG_INFO, "TX stage %d: pinned to core %d", s->stage_id, s->core_id);
+        }
+    }
+
+    while (1) {
+        /* Read before the rings: once set, no worker pushes any more, so rings
+         * that are empty afterwards stay empty. */
+        bool stop = atomic_load_explicit(&s->stop, memory_order_acquire);
+
+        unsigned int total = 0;
+        for (unsigned int i = 0; i < s->ring_count; i++) {
+            total += tx_stage_burst(s, s->rings[i]);
+        }
+
+        if (total > 0) {
+            s->idle_streak = 0;
+        } else if (stop) {
+            break;
+        } else {
+            tx_stage_idle(s);
+        }
+    }
+
+    pktbuf_thread_flush();
+    return NULL;
+}
+
+int tx_stage_start(tx_stage_t *s) {
+    if (!s) return -1;
+    return pthread_create(&s->thread, NULL, tx_stage_main, s);
+}
+
+void tx_stage_stop(tx_stage_t *s) {
+    if (!s) return;
+    atomic_store_explicit(&s->stop, true, memory_order_release);
+    pthread_join(s->thread, NULL);
+}
@@ -2,12 +2,18 @@
 #include "worker.h"
 #include "affinity.h"
 #include "arp_table.h"
+#include "conntrack.h"
+#include "control.h"
+#include "flow_cache.h"
 #include "latency.h"
 #include "log.h"
+#include "mirror.h"
 #include "ndp_table.h"
+#include "neigh_cache.h"
 #include "parser.h"
 
 #include <arpa/inet.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdatomic.h>
 #include <stdlib.h>
@@ -17,244 +23,605 @@
 /* Global stop flag from main; required for all workers. */
 extern volatile sig_atomic_t g_stop;
 
-/* TSC calibration factor; CPU-wide constant for all workers.  */
-static double g_cycles_per_ns = 0.0;
+/* TSC calibration factor, inverted for latency_record(); CPU-wide constant for all workers. */
+static double g_ns_per_cycle = 0.0;
 
-static bool handle_control_packet(worker_t *w, pktbuf_t *b) {
-    struct eth_hdr *eth = (struct eth_hdr *)b->data;
-    uint16_t ethertype = ntohs(eth->ethertype);
-
-    /* Handling of ARP packets */
-    if (ethertype == ETH_TYPE_ARP) {
-        struct arp_hdr *arp = (struct arp_hdr *)(b->data + sizeof(struct eth_hdr));
-
-        if (ntohs(arp->htype) == ARP_HW_ETHERNET && ntohs(arp->ptype) == ETH_TYPE_IPV4 &&
-            arp->hlen == ARP_HW_LEN_ETH && arp->plen == ARP_PROTO_LEN) {
-            /* Learn the sender's MAC/IP mapping */
-            uint32_t spa = ntohl(arp->spa);
-            arp_update(w->arpt, spa, arp->sha);
-            log_msg(LOG_DEBUG, "Learned ARP: %08X -> %02X:%02X:%02X:%02X:%02X:%02X", spa,
-                    arp->sha[0], arp->sha[1], arp->sha[2], arp->sha[3], arp->sha[4], arp->sha[5]);
-
-            /* If ARP request is for local IP: Re-use incoming buffer to build a reply in-place */
-            if (ntohs(arp->op) == ARP_OP_REQUEST && w->tx->ip4_addr != 0 &&
-                ntohl(arp->tpa) == w->tx->ip4_addr) {
-                memcpy(eth->dst, eth->src, 6);
-                memcpy(eth->src, w->tx->eth_addr, 6);
-
-                arp->op = htons(ARP_OP_REPLY);
-                memcpy(arp->tha, arp->sha, 6);
-                arp->tpa = arp->spa;
-                memcpy(arp->sha, w->tx->eth_addr, 6);
-                arp->spa = htonl(w->tx->ip4_addr);
-
-                tx_send(w->tx, b->data, b->len);
-                log_msg(LOG_DEBUG, "Sent ARP reply for %08X", w->tx->ip4_addr);
-            }
-        }
+/* Flow cache size for workers initialized from now on; 0 disables the cache. */
+static size_t g_flow_cache_entries = FLOW_CACHE_DEFAULT_ENTRIES;
+
+/* Conntrack size for workers initialized from now on; 0 disables tracking. */
+static size_t g_conntrack_entries = 0;
+
+/* Hardware counters for worker threads started from now on. */
+static bool g_perf = false;
+
+/* Idle policy for workers initialized from now on. */
+static idle_mode_t g_idle_mode = IDLE_MODE_BACKOFF;
+
+/* Stage timing interval (bursts) for workers initialized from now on. */
+static uint32_t g_stage_sample = WORKER_STAGE_SAMPLE_DEFAULT;
+
+/*
+    Neighbour lookup for the destination of `key`, `seq` is the current
+    sequence of the ARP/NDP table.
+    First, check the worker's own neighbour cache: a hit costs no access to
+    the shared table at all. On a miss, look up the table and fill the cache.
+*/
+static bool neigh_lookup(worker_t *w, const flow_key_t *key, uint32_t seq, uint8_t dst_mac[6]) {
+    if (neigh_cache_get(&w->ncache, key->ip_ver, &key->dst_ip, seq, dst_mac)) return true;
+
+    bool found = (key->ip_ver == 4) ? arp_get_mac(w->arpt, key->dst_ip.v4, dst_mac)
+                                    : ndp_get_mac(w->ndpt, key->dst_ip.v6, dst_mac);
+    if (found) neigh_cache_put(&w->ncache, key->ip_ver, &key->dst_ip, seq, dst_mac);
+    return found;
+}
+
+/*
+    Next-hop MAC for a forwarded packet, taken from its flow cache entry `fe`
+    (may be NULL) if the neighbour table did not change since it was resolved.
+        Returns false if the neighbour is unknown (frame is sent unmodified).
+*/
+static bool resolve_dst_mac(worker_t *w, const flow_key_t *key, flow_cache_entry_t *fe,
+                            uint8_t dst_mac[6]) {
+    /* Read the table sequence before the lookup: a change racing with it moves
+     * the sequence on (an odd value never matches later), so the MAC is
+     * re-resolved by the next packet. */
+    atomic_uint *gen_ptr = (key->ip_ver == 4) ? &w->arpt->seq : &w->ndpt->seq;
+    uint32_t gen = atomic_load_explicit(gen_ptr, memory_order_acquire);
+
+    if (!fe) return neigh_lookup(w, key, gen, dst_mac);
+
+    if (fe->mac_valid && fe->neigh_gen == gen) {
+        memcpy(dst_mac, fe->dst_mac, 6);
+        return true;
     }
 
-    /* Handling for IPv6 NDP packets (Neighbor Advertisement/Solicitation) */
-    if (ethertype == ETH_TYPE_IPV6) {
-        if (b->len >=
-            sizeof(struct eth_hdr) + sizeof(struct ipv6_hdr) + sizeof(struct ndp_na_hdr)) {
-            struct ipv6_hdr *ip6 = (struct ipv6_hdr *)(b->data + sizeof(struct eth_hdr));
-
-            /* Next Header 58: ICMPv6 */
-            if (ip6->next_header == IP_PROTO_ICMPV6) {
-                struct ndp_na_hdr *ndp = (struct ndp_na_hdr *)(b->data + sizeof(struct eth_hdr) +
-                                                               sizeof(struct ipv6_hdr));
-                if (ndp->type == ICMPV6_NEIGHBOR_SOL || ndp->type == ICMPV6_NEIGHBOR_ADV) {
-                    size_t offset = sizeof(struct eth_hdr) + sizeof(struct ipv6_hdr) +
-                                    sizeof(struct ndp_na_hdr);
-
-                    while (offset + 2 <= b->len) {
-                        uint8_t opt_type = b->data[offset];
-                        uint8_t opt_len = b->data[offset + 1] * 8;
-
-                        if (opt_len == 0 || offset + opt_len > b->len) break;
-
-                        if (ndp->type == ICMPV6_NEIGHBOR_SOL && opt_type == NDP_OPT_SRC_LLADDR &&
-                            opt_len >= 8) {
-                            uint8_t *mac = b->data + offset + 2;
-                            ndp_update(w->ndpt, ip6->src_addr, mac);
-                            log_msg(LOG_DEBUG, "Learned NDP (NS): %02x:%02x:%02x:%02x:%02x:%02x",
-                                    mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-                            break;
-                        }
-
-                        if (ndp->type == ICMPV6_NEIGHBOR_ADV && opt_type == NDP_OPT_TGT_LLADDR &&
-                            opt_len >= 8) {
-                            uint8_t *mac = b->data + offset + 2;
-                            ndp_update(w->ndpt, ndp->target, mac);
-                            log_msg(LOG_DEBUG, "Learned NDP (NA): %02x:%02x:%02x:%02x:%02x:%02x",
-                                    mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-                            break;
-                        }
-                        offset += opt_len;
-                    }
-                    /* Consume the packet */
-                    pktbuf_free(w->pool, b);
-                    return true;
-                }
-            }
-        }
+    fe->mac_valid = neigh_lookup(w, key, gen, dst_mac);
+    if (fe->mac_valid) {
+        memcpy(fe->dst_mac, dst_mac, 6);
+        fe->neigh_gen = gen;
     }
-    return false;
+    return fe->mac_valid;
 }
 
-static void process_packet(worker_t *w, pktbuf_t *b) {
-    /* Debug: Visualize the raw packet data */
-    log_hexdump(LOG_DEBUG, b->data, b->len);
+/* Drop a packet: count it, record its latency and return the buffer. */
+static inline void drop_packet(worker_t *w, pktbuf_t *b) {
+    w->ctr.pkts_dropped++;
+    if (b->timestamp > 0) {
+        latency_record(&w->latency_hist, rdtsc() - b->timestamp, g_ns_per_cycle);
+    }
+    pktbuf_release(b);
+}
 
-    /* Handle control packets (ARP, NDP) */
-    if (handle_control_packet(w, b)) return;
+/*
+    Whether to mirror a packet of rule `r`: 1 in the rule's `mirror`, else 1
+    in the mirror's global rate, drawn at random. Costs one relaxed load while
+    the mirror has no output.
+*/
+static inline bool mirror_sample(worker_t *w, const rule_t *r) {
+    if (!w->mirror || !atomic_load_explicit(&w->mirror->active, memory_order_relaxed)) {
+        return false;
+    }
+    uint32_t every = r->action.mirror ? r->action.mirror : w->mirror->every;
+    if (every == 0) return false;
+    if (every == 1) return true;
+
+    uint64_t x = w->mirror_rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    w->mirror_rng = x;
+    return x % every == 0;
+}
 
-    struct eth_hdr *eth = (struct eth_hdr *)b->data;
+/*
+    Take a mirror reference on `b`, within the mirror's budget. From here on
+    neither the frame nor its length may change; the buffer goes back to the
+    pool once the worker and the mirror thread have both released it.
+*/
+static void mirror_add(worker_t *w, pktbuf_t *b) {
+    if (!mirror_reserve(w->mirror)) {
+        w->ctr.mirror_skipped++;
+        return;
+    }
+    pktbuf_ref(b);
+    w->mirror_bufs[w->mirror_count++] = b;
+}
+
+/* One push for the burst's samples; a full ring skips them, never waits. */
+static void mirror_flush(worker_t *w) {
+    unsigned int n = w->mirror_count;
+    unsigned int pushed = ring_push_burst(w->mirror_ring, (void *const *)w->mirror_bufs, n);
+    w->ctr.pkts_mirrored += pushed;
+    if (pushed < n) {
+        w->ctr.mirror_skipped += n - pushed;
+        pktbuf_release_bulk(&w->mirror_bufs[pushed], n - pushed);
+        mirror_unreserve(w->mirror, n - pushed);
+    }
+    w->mirror_count = 0;
+}
+
+/*
+    Match a rule: flow cache first, the rule table only for the first packet
+    of a flow (or after the table was replaced).
+        Returns the rule or NULL, and the flow cache entry in `*fe` (if any).
+*/
+static inline const rule_t *classify(worker_t *w, const flow_key_t *key, flow_cache_entry_t **fe) {
+    *fe = NULL;
+    if (!w->fcache.buckets) return rule_table_match(w->rt, key);
+
+    const rule_table_t *rt = w->rt;
+    flow_cache_key_t ck;
+    flow_cache_key(key, &ck);
+    uint64_t h = flow_cache_hash(&ck);
+
+    *fe = flow_cache_lookup(&w->fcache, &ck, h, rt->generation);
+    if (*fe) return (*fe)->rule;
+
+    const rule_t *r = rule_table_match(rt, key);
+    *fe = flow_cache_insert(&w->fcache, &ck, h, r, rt->generation);
+    return r;
+}
+
+/* Coarse clock of the conntrack timeouts (vDSO, no syscall). */
+static inline uint32_t conntrack_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t)ts.tv_sec;
+}
+
+/*
+    Whether the rule that admitted `e` still admits it under the current table,
+    after a reload: the original direction of `key` is classified again.
+*/
+static bool conntrack_revalidate(worker_t *w, conntrack_entry_t *e, const flow_key_t *key,
+                                 bool reply) {
+    flow_key_t orig = *key;
+    if (reply) {
+        orig.src_ip = key->dst_ip;
+        orig.dst_ip = key->src_ip;
+        orig.src_port = key->dst_port;
+        orig.dst_port = key->src_port;
+    }
+
+    flow_cache_entry_t *fe;
+    const rule_t *r = classify(w, &orig, &fe);
+    if (!r || r->action.type != ACT_FWD) return false;
 
-    /* Parse the flow. */
-    flow_key_t key;
-    if (parse_flow_key(b->data, b->len, &key) != 0) {
-        /* Not a valid IPv4/TCP/UDP, drop it. */
-        w->pkts_dropped++;
-        if (b->timestamp > 0) {
-            latency_record(&w->latency_hist, rdtsc() - b->timestamp, g_cycles_per_ns);
+    e->rule = r;
+    e->rule_gen = w->rt->generation;
+    return true;
+}
+
+/*
+    classify() behind connection tracking. A packet of a known TCP/UDP
+    connection is not classified: it gets the rule that admitted the
+    connection, in both directions. A FWD match of an untracked flow starts a
+    connection. `*reply` tells a packet of the reply direction, which leaves
+    through the default port (where the connection's packets come in).
+*/
+static const rule_t *classify_tracked(worker_t *w, const flow_key_t *key,
+                                      flow_cache_entry_t **fe, bool *reply) {
+    *reply = false;
+    if (key->protocol != IP_PROTO_TCP && key->protocol != IP_PROTO_UDP) {
+        return classify(w, key, fe);
+    }
+
+    conntrack_key_t ck;
+    conntrack_key(key, &ck);
+    uint64_t h = conntrack_hash(&ck);
+
+    conntrack_entry_t *e = conntrack_lookup(&w->ct, &ck, h);
+    if (e) {
+        bool rev = ck.swapped != e->orig_swapped;
+        if (e->rule_gen == w->rt->generation || conntrack_revalidate(w, e, key, rev)) {
+            conntrack_update(&w->ct, e, rev, key->tcp_flags);
+            *fe = NULL;
+            *reply = rev;
+            return e->rule;
         }
-        pktbuf_free(w->pool, b);
-        return;
+        conntrack_remove(&w->ct, e); /* No longer allowed: back to the rules */
     }
-    w->pkts_parsed++;
 
-    /* Match a rule. */
-    const rule_t *r = rule_table_match(w->rt, &key);
-    if (!r) {
-        w->pkts_dropped++;
-        if (b->timestamp > 0) {
-            latency_record(&w->latency_hist, rdtsc() - b->timestamp, g_cycles_per_ns);
+    const rule_t *r = classify(w, key, fe);
+    if (r && r->action.type == ACT_FWD && !(key->tcp_flags & TCP_FLAG_RST)) {
+        e = conntrack_insert(&w->ct, &ck, h, r, w->rt->generation);
+        conntrack_update(&w->ct, e, false, key->tcp_flags);
+    }
+    return r;
+}
+
+/*
+    [L3 Processing] of a packet matched by a FWD rule, then queue it for TX.
+        For IPv4, decrement TTL and update checksum.
+        Then rewrite Src, Dst MAC if the next hop `dst_mac` is known (not NULL)
+            Otherwise: transparent bridge.
+    Queued on egress port `port` (see worker_tx_port()). A `mirror` sample is
+    taken as it leaves, after the rewrite (or as it came, if the TTL ran out).
+*/
+static void forward_packet(worker_t *w, pktbuf_t *b, const flow_key_t *key,
+                           const uint8_t *dst_mac, unsigned int port, bool mirror) {
+    struct eth_hdr *eth = (struct eth_hdr *)b->data;
+    worker_tx_port_t *p = &w->tx_ports[port];
+
+    if (key->ip_ver == 4) {
+        struct ipv4_hdr *ip = (struct ipv4_hdr *)(b->data + sizeof(struct eth_hdr));
+
+        if (ip->ttl <= 1) {
+            if (mirror) mirror_add(w, b);
+            drop_packet(w, b);
+            return;
         }
-        pktbuf_free(w->pool, b);
-        return;
+
+        /* Incremental update (RFC 1624): only the TTL word changed. */
+        ipv4_dec_ttl(ip);
+    } else {
+        struct ipv6_hdr *ip6 = (struct ipv6_hdr *)(b->data + sizeof(struct eth_hdr));
+
+        if (ip6->hop_limit <= 1) {
+            if (mirror) mirror_add(w, b);
+            drop_packet(w, b);
+            return;
+        }
+
+        ip6->hop_limit--;
     }
-    w->pkts_matched++;
 
-    /* Update per-rule counters. Lock-free as it's a private array for each worker. */
-    if (w->rule_stats) {
-        w->rule_stats[r->rule_id].packets++;
-        w->rule_stats[r->rule_id].bytes += b->len;
+    if (dst_mac) {
+        memcpy(eth->dst, dst_mac, 6);
+        memcpy(eth->src, p->tx->eth_addr, 6);
     }
+    if (mirror) mirror_add(w, b);
+
+    /* Latency is recorded before queuing for TX (sendmmsg() is kernel/NIC latency, should
+     * not be included in the dataplane latency.)*/
+    if (b->timestamp > 0) {
+        latency_record(&w->latency_hist, rdtsc() - b->timestamp, g_ns_per_cycle);
+    }
+
+    /* Accumulate frame for its port's TX batch (not freed/sent yet). */
+    p->frames[p->count] = b->data;
+    p->lens[p->count] = b->len;
+    p->bufs[p->count] = b;
+    p->count++;
+    w->tx_count++;
+}
 
-    if (r->action.type == ACT_DROP) {
-        w->pkts_dropped++;
-        if (b->timestamp > 0) {
-            latency_record(&w->latency_hist, rdtsc() - b->timestamp, g_cycles_per_ns);
+/* Whether to time this burst's stages: one in w->stage_sample. */
+static inline bool stage_timed(worker_t *w) {
+    if (w->stage_sample == 0 || --w->stage_countdown > 0) return false;
+    w->stage_countdown = w->stage_sample;
+    return true;
+}
+
+/* Record `cycles` spent in `stage`, for `count` packets. */
+static void record_stage(worker_t *w, worker_stage_t stage, uint64_t cycles, uint64_t count) {
+    latency_record_ns(&w->stage_hist[stage], (uint64_t)((double)cycles * g_ns_per_cycle), count);
+}
+
+/*
+    RX batching and ring residency of each packet of a timed burst taken off
+    the ring at `now`. The stamps come from other cores: a skew that puts one
+    after `now` is not recorded.
+*/
+static void record_queue_stages(worker_t *w, pktbuf_t *const *batch, unsigned int n,
+                                uint64_t now) {
+    for (unsigned int i = 0; i < n; i++) {
+        const pktbuf_t *b = batch[i];
+        if (b->ring_tsc == 0 || b->ring_tsc > now) continue;
+
+        if (b->timestamp > 0 && b->timestamp <= b->ring_tsc) {
+            record_stage(w, WORKER_STAGE_RX, b->ring_tsc - b->timestamp, 1);
         }
-        pktbuf_free(w->pool, b);
-        return;
+        record_stage(w, WORKER_STAGE_RING, now - b->ring_tsc, 1);
     }
+}
 
-    if (r->action.type == ACT_FWD) {
-        /*
-            [L3 Processing]
-                For IPv4, decrement TTL and update checksum.
-                Then do ARP lookup and rewrite Src, Dst MAC
-                    Otherwise: transparent bridge.
-        */
-        if (key.ip_ver == 4) {
-            struct ipv4_hdr *ip = (struct ipv4_hdr *)(b->data + sizeof(struct eth_hdr));
-
-            if (ip->ttl <= 1) {
-                w->pkts_dropped++;
-                if (b->timestamp > 0) {
-                    latency_record(&w->latency_hist, rdtsc() - b->timestamp, g_cycles_per_ns);
+_Static_assert(WORKER_BURST_SIZE <= 64, "burst stages track packets in a 64-bit mask");
+
+/*
+    Process a burst in stages rather than one packet start to finish:
+        1. parse all     (headers prefetched a few packets ahead)
+        2. classify all  (control packets and failures leave here), and resolve
+                         the next hop while the flow cache entry is still ours:
+                         a later insert in the same burst may evict it
+        3. rewrite all and queue for TX
+    Each stage runs the same code over the whole burst, so its instructions and
+    tables stay hot, and the header cache misses overlap instead of stalling
+    one after another.
+    A `timed` burst records its stage times (see worker_stage_t) and leaves
+    the start of stage 3 in w->stage_tx_tsc.
+*/
+static void process_burst(worker_t *w, pktbuf_t **batch, unsigned int n, bool timed) {
+    flow_key_t keys[WORKER_BURST_SIZE];
+    uint8_t macs[WORKER_BURST_SIZE][6];
+    uint8_t ports[WORKER_BURST_SIZE];
+    pktbuf_t *ctrl[WORKER_BURST_SIZE];
+    unsigned int ctrl_n = 0;
+    uint64_t t_start = timed ? rdtsc() : 0;
+    uint64_t neigh_cycles = 0;
+    uint64_t now = t_start; /* TSC for the policers, read once a policed rule matches */
+
+    /* Stage 1: parse. */
+    uint64_t parsed = parse_flow_key_burst(batch, n, keys);
+    uint64_t fwd = 0, has_mac = 0, mirror = 0;
+    uint64_t t_parsed = timed ? rdtsc() : 0;
+
+    /* Stage 2: classify. */
+    for (unsigned int i = 0; i < n; i++) {
+        pktbuf_t *b = batch[i];
+
+        /* Debug: Visualize the raw packet data */
+        log_hexdump(LOG_DEBUG, b->data, b->len);
+
+        if (!(parsed & (1ULL << i))) {
+            /* Control packets (ARP, NDP) never parse as a flow; they go to the control
+             * plane. Anything else is not a valid IPv4/IPv6 TCP/UDP/ICMP packet: drop. */
+            if (w->ctrl_ring && control_frame(b)) {
+                ctrl[ctrl_n++] = b;
+            } else {
+                drop_packet(w, b);
+            }
+            continue;
+        }
+        w->ctr.pkts_parsed++;
+
+        flow_cache_entry_t *fe;
+        bool reply = false;
+        const rule_t *r = w->ct.entries ? classify_tracked(w, &keys[i], &fe, &reply)
+                                        : classify(w, &keys[i], &fe);
+        if (!r) {
+            drop_packet(w, b);
+            continue;
+        }
+        w->ctr.pkts_matched++;
+        bool sampled = mirror_sample(w, r);
+
+        /* Update per-rule counters. Lock-free as it's a private array for each worker. */
+        if (w->rule_stats) {
+            rule_stat_t *st = &w->rule_stats[r->rule_id];
+            st->packets++;
+            st->bytes += b->len;
+
+            /* Policer: this worker's share of the rate, one TSC read per burst. */
+            if (r->action.rate) {
+                if (now == 0) now = rdtsc();
+                if (!policer_conform(&st->policer, now, b->len)) {
+                    st->exceed++;
+                    if (sampled) mirror_add(w, b);
+                    drop_packet(w, b);
+                    continue;
                 }
-                pktbuf_free(w->pool, b);
-                return;
+                st->conform++;
             }
+        }
 
-            ip->ttl--;
-            ip->checksum = 0; /* Must be 0 before calculation. */
-            ip->checksum = ipv4_checksum(ip, (ip->ver_ihl & 0x0F) * 4);
-
-            uint8_t dst_mac[6];
-            bool found = false;
-
-            /*
-                First, check the local cache (1 element) to avoid lock contention.
-                If packet is going to the same DstIP as the previous one, re-use the
-                MAC. This way we don't have to use the lock.
-            */
-            if (w->last_arp_ip != 0 && key.dst_ip.v4 == w->last_arp_ip) {
-                memcpy(dst_mac, w->last_arp_mac, 6);
-                found = true;
-            } else if (arp_get_mac(w->arpt, key.dst_ip.v4, dst_mac)) {
-                /* If not in the cache, must do the look up & also update the worker
-                 * cache. */
-                w->last_arp_ip = key.dst_ip.v4;
-                memcpy(w->last_arp_mac, dst_mac, 6);
-                found = true;
-            }
+        if (r->action.type == ACT_FWD) {
+            fwd |= 1ULL << i;
+            if (sampled) mirror |= 1ULL << i;
+            ports[i] = reply ? 0 : (uint8_t)worker_tx_port(w, r->action.out_ifindex);
+            uint64_t t_neigh = timed ? rdtsc() : 0;
+            if (resolve_dst_mac(w, &keys[i], fe, macs[i])) has_mac |= 1ULL << i;
+            if (timed) neigh_cycles += rdtsc() - t_neigh;
+        } else {
+            /* ACT_DROP, or an unknown action => drop it. */
+            if (sampled) mirror_add(w, b);
+            drop_packet(w, b);
+        }
+    }
 
-            if (found) {
-                memcpy(eth->dst, dst_mac, 6);
-                memcpy(eth->src, w->tx->eth_addr, 6);
-            }
-        } else if (key.ip_ver == 6) {
-            struct ipv6_hdr *ip6 = (struct ipv6_hdr *)(b->data + sizeof(struct eth_hdr));
+    /* One push for the burst's control frames; a full ring drops them, never waits. */
+    if (ctrl_n > 0) {
+        unsigned int pushed = ring_push_burst(w->ctrl_ring, (void *const *)ctrl, ctrl_n);
+        w->ctr.pkts_control += pushed;
+        w->ctr.ctrl_dropped += ctrl_n - pushed;
+        for (unsigned int i = pushed; i < ctrl_n; i++) {
+            drop_packet(w, ctrl[i]);
+        }
+    }
 
-            if (ip6->hop_limit <= 1) {
-                w->pkts_dropped++;
-                if (b->timestamp > 0) {
-                    latency_record(&w->latency_hist, rdtsc() - b->timestamp, g_cycles_per_ns);
-                }
-                pktbuf_free(w->pool, b);
-                return;
-            }
+    if (timed) {
+        uint64_t t_classified = rdtsc();
+        record_queue_stages(w, batch, n, t_start);
+        record_stage(w, WORKER_STAGE_PARSE, t_parsed - t_start, n);
+        record_stage(w, WORKER_STAGE_CLASSIFY, t_classified - t_parsed - neigh_cycles, n);
+        if (fwd) {
+            record_stage(w, WORKER_STAGE_NEIGH, neigh_cycles,
+                         (uint64_t)__builtin_popcountll(fwd));
+        }
+        w->stage_tx_tsc = t_classified;
+    }
 
-            ip6->hop_limit--;
+    /* Stage 3: rewrite and queue for TX. */
+    for (unsigned int i = 0; i < n; i++) {
+        if (!(fwd & (1ULL << i))) continue;
+        forward_packet(w, batch[i], &keys[i], (has_mac & (1ULL << i)) ? macs[i] : NULL,
+                       ports[i], mirror & (1ULL << i));
+    }
 
-            uint8_t dst_mac[6];
-            bool found = false;
+    /* Before TX: the references keep the buffers alive past sendmmsg() and the free. */
+    if (w->mirror_count > 0) mirror_flush(w);
+}
 
-            if (memcmp(key.dst_ip.v6, w->last_ndp_ip, 16) == 0) {
-                memcpy(dst_mac, w->last_ndp_mac, 6);
-                found = true;
-            } else if (ndp_get_mac(w->ndpt, key.dst_ip.v6, dst_mac)) {
-                memcpy(w->last_ndp_ip, key.dst_ip.v6, 16);
-                memcpy(w->last_ndp_mac, dst_mac, 6);
-                found = true;
-            }
+/*
+    Next burst from the ring (RX thread layout) or from the worker's own source.
+    From a ring the burst is processed in place in its slots (*burst points into
+    the ring) and handed back with ring_pop_commit() afterwards; an own source
+    fills `local`.
+*/
+static unsigned int worker_rx_burst(worker_t *w, pktbuf_t **local, pktbuf_t ***burst) {
+    if (!w->rx_src) {
+        void **slots;
+        unsigned int n = ring_peek_burst(w->rx_ring, &slots, WORKER_BURST_SIZE);
+        *burst = (pktbuf_t **)slots;
+        return n;
+    }
+    *burst = local;
+    if (w->rx_src->mode == RX_MODE_XDP) {
+        return xsk_rx_burst(&w->rx_src->xsk, local, WORKER_BURST_SIZE);
+    }
+    return rx_afpacket_recv_burst(&w->rx_src->afp, w->pools, local, WORKER_BURST_SIZE);
+}
 
-            if (found) {
-                memcpy(eth->dst, dst_mac, 6);
-                memcpy(eth->src, w->tx->eth_addr, 6);
-            }
+/* Own source: wait in the kernel for the next frames (at most 1ms, so g_stop is
+ * still observed). Finished AF_XDP TX buffers are returned meanwhile. */
+static void worker_wait_src(worker_t *w) {
+    if (w->rx_src->mode == RX_MODE_XDP) {
+        xsk_wait(&w->rx_src->xsk, 1);
+    } else {
+        rx_afpacket_wait(&w->rx_src->afp, 1);
+    }
+}
+
+static void worker_idle(worker_t *w) {
+    uint32_t streak = w->idle_streak++;
+
+    /* AF_XDP TX completions only come back while we look for them. */
+    if (w->rx_src && w->rx_src->mode == RX_MODE_XDP) xsk_reap_tx(&w->rx_src->xsk);
+
+    if (w->idle_mode == IDLE_MODE_POLL) {
+        w->ctr.idle_spins++;
+        cpu_relax();
+        return;
+    }
+
+    /* Traffic in short gaps: the next burst is probably a few hundred ns away,
+     * cheaper to spin through than a context switch. */
+    if (streak < WORKER_IDLE_SPIN_ROUNDS) {
+        w->ctr.idle_spins++;
+        for (uint32_t i = 0; i < (1u << streak); i++) {
+            cpu_relax();
         }
+        return;
+    }
 
-        /* Latency is recorded before queuing for TX (sendmmsg() is kernel/NIC latency, should
-         * not be included in the dataplane latency.)*/
-        if (b->timestamp > 0) {
-            latency_record(&w->latency_hist, rdtsc() - b->timestamp, g_cycles_per_ns);
+    if (w->idle_mode == IDLE_MODE_WAKEUP) {
+        w->ctr.idle_sleeps++;
+        if (w->rx_src) {
+            worker_wait_src(w);
+        } else {
+            ring_wait(w->rx_ring, 1000);
         }
+        return;
+    }
 
-        /* Accumulate frame for TX batch (not freed/sent yet). */
-        w->tx_frames[w->tx_count] = b->data;
-        w->tx_lens[w->tx_count] = b->len;
-        w->tx_bufs[w->tx_count] = b;
-        w->tx_count++;
+    /* Backoff */
+    streak -= WORKER_IDLE_SPIN_ROUNDS;
+    if (streak < WORKER_IDLE_YIELD_ROUNDS) {
+        w->ctr.idle_yields++;
+        sched_yield();
         return;
     }
 
-    /* Unknown action => drop it. */
-    w->pkts_dropped++;
-    if (b->timestamp > 0) {
-        latency_record(&w->latency_hist, rdtsc() - b->timestamp, g_cycles_per_ns);
+    w->ctr.idle_sleeps++;
+    if (w->rx_src) {
+        worker_wait_src(w);
+        return;
     }
-    pktbuf_free(w->pool, b);
+    /* nanosleep() rounds up to the timer slack (50us by default), so the short
+     * steps mostly matter with a lowered slack or on an RT kernel. */
+    streak -= WORKER_IDLE_YIELD_ROUNDS;
+    long us = streak < 10 ? 1L << streak : WORKER_IDLE_SLEEP_MAX_US;
+    if (us > WORKER_IDLE_SLEEP_MAX_US) us = WORKER_IDLE_SLEEP_MAX_US;
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = us * 1000};
+    nanosleep(&ts, NULL);
+}
+
+/* Send (or hand off) one port's batch; returns how many made it. */
+static int flush_port(worker_t *w, worker_tx_port_t *p, bool dflt) {
+    int sent;
+
+    if (dflt && w->tx_ring) {
+        /* Pipeline: the TX stage sends and frees them; a full ring means it
+         * falls behind, the rest is dropped. */
+        sent = (int)ring_push_burst(w->tx_ring, (void *const *)p->bufs, (unsigned int)p->count);
+        pktbuf_release_bulk(&p->bufs[sent], (unsigned int)(p->count - sent));
+    } else if (dflt && w->rx_src && w->rx_src->mode == RX_MODE_XDP) {
+        /* Zero-copy: the socket owns accepted buffers and frees them on completion;
+         * only the ones that did not fit into the TX ring are freed here. */
+        sent = (int)xsk_tx_burst(&w->rx_src->xsk, p->bufs, (unsigned int)p->count);
+        pktbuf_release_bulk(&p->bufs[sent], (unsigned int)(p->count - sent));
+    } else {
+        sent = tx_send_batch(p->tx, p->frames, p->lens, p->count);
+        if (sent < 0) {
+            sent = 0;
+        }
+
+        /* All buffers are freed; the data was already copied into the socket
+         * buffer (sendmmsg) or a TX ring slot. Failed send may be because
+         * the kernel rejected it or the ring is full. */
+        pktbuf_release_bulk(p->bufs, (unsigned int)p->count);
+    }
+    return sent;
+}
+
+/*
+    Advance pkts_done, which RETA bucket moves wait on (reta.h), to the packets
+    whose TX is done. In pipeline mode a burst is only done once the TX stage
+    has taken it off tx_ring: the stage's tail passed the ring head the burst
+    left. One burst is tracked at a time, the oldest, so the mark keeps moving
+    under load and catches up on the next call.
+*/
+static void worker_complete(worker_t *w) {
+    uint64_t in = w->ctr.pkts_in;
+
+    if (!w->tx_ring) {
+        /* Release: the burst's TX is done before RX can see it completed. */
+        atomic_store_explicit(&w->pkts_done, in, memory_order_release);
+        return;
+    }
+
+    /* Acquire: the stage sent the packets before it moved the tail past them. */
+    if (w->done_pending &&
+        atomic_load_explicit(&w->tx_ring->tail, memory_order_acquire) >= w->done_mark) {
+        atomic_store_explicit(&w->pkts_done, w->done_pending, memory_order_release);
+        w->done_pending = 0;
+    }
+    if (!w->done_pending && atomic_load_explicit(&w->pkts_done, memory_order_relaxed) != in) {
+        w->done_pending = in;
+        w->done_mark = atomic_load_explicit(&w->tx_ring->head, memory_order_relaxed);
+    }
+}
+
+/* One batched send per port with packets queued. */
+static void worker_flush_tx(worker_t *w) {
+    for (unsigned int i = 0; i < w->tx_port_count; i++) {
+        worker_tx_port_t *p = &w->tx_ports[i];
+        if (p->count == 0) continue;
+
+        int sent = flush_port(w, p, i == 0);
+        p->pkts_sent += (uint64_t)sent;
+        p->pkts_dropped += (uint64_t)(p->count - sent);
+        w->ctr.pkts_forwarded += (uint64_t)sent;
+        w->ctr.pkts_dropped += (uint64_t)(p->count - sent);
+        p->count = 0;
+    }
+    w->tx_count = 0;
+}
+
+/*
+    Copy the counters to the snapshot the stats thread reads (seqcount write
+    side). Only the worker writes: plain stores, no RMW.
+*/
+static void publish_counters(worker_t *w) {
+    uint64_t v[WORKER_COUNTERS];
+    memcpy(v, &w->ctr, sizeof(v));
+
+    uint32_t seq = atomic_load_explicit(&w->ctr_seq, memory_order_relaxed);
+    atomic_store_explicit(&w->ctr_seq, seq + 1, memory_order_relaxed);
+    /* The odd sequence is visible before any of the new values. */
+    atomic_thread_fence(memory_order_release);
+    for (size_t i = 0; i < WORKER_COUNTERS; i++) {
+        atomic_store_explicit(&w->ctr_snap[i], v[i], memory_order_relaxed);
+    }
+    atomic_store_explicit(&w->ctr_seq, seq + 2, memory_order_release);
 }
 
 static void *worker_main(void *arg) {
     worker_t *w = (worker_t *)arg;
-    void *batch[WORKER_BURST_SIZE];
+    pktbuf_t *batch[WORKER_BURST_SIZE];
+
+    log_thread_attach();
 
     if (w->core_id >= 0) { /* -1: "no pinning" */
         if (affinity_pin_self(w->core_id) != 0) {
@@ -264,73 +631,203 @@ static void *worker_main(void *arg) {
         }
     }
 
+    if (g_perf) {
+        if (perf_counters_open(&w->perf) == 0) {
+            log_msg(LOG_WARN, "Worker %d: no hardware counters (perf_event_open)", w->worker_id);
+        }
+        atomic_store_explicit(&w->perf_ready, true, memory_order_release);
+    }
+
+    if (w->qsbr) qsbr_online(w->qsbr, w->qsbr_id);
+
     while (1) {
-        unsigned int n = ring_pop_burst(w->rx_ring, batch, WORKER_BURST_SIZE);
+        /* Between bursts nothing from the rule table is referenced: report the
+         * quiescent state, then pick up rules published since the last one. */
+        if (w->qsbr) qsbr_quiescent(w->qsbr, w->qsbr_id);
+        worker_rules_t *rules = atomic_load_explicit(&w->rules, memory_order_acquire);
+        w->rt = rules->rt;
+        w->rule_stats = rules->stats;
+
+        pktbuf_t **burst;
+        unsigned int n = worker_rx_burst(w, batch, &burst);
 
         if (n == 0) {
             if (g_stop) {
                 break; /* Stop signal received + ring is empty. */
             }
-            /* Ring empty => avoid burning CPU: sleep for 1us. */
-            struct timespec ts = {.tv_sec = 0, .tv_nsec = 1000};
-            nanosleep(&ts, NULL);
+            worker_idle(w);
+            if (w->tx_ring) worker_complete(w); /* The TX stage may have caught up */
+            publish_counters(w);
             continue;
         }
 
-        w->pkts_in += n;
+        w->ctr.pkts_in += n;
+        w->idle_streak = 0;
+        if (w->ct.entries) conntrack_advance(&w->ct, conntrack_clock());
 
-        for (unsigned int i = 0; i < n; i++) {
-            process_packet(w, (pktbuf_t *)batch[i]);
-        }
+        bool timed = stage_timed(w);
+        process_burst(w, burst, n, timed);
 
-        /* Flush all accumulated TX packets in a sendmmsg() syscall. */
+        /* Flush all accumulated TX packets in one syscall (sendmmsg(), TX ring or XSK kick). */
         if (w->tx_count > 0) {
-            int sent = tx_send_batch(w->tx, w->tx_frames, w->tx_lens, w->tx_count);
-            if (sent < 0) {
-                sent = 0;
+            int queued = w->tx_count;
+            worker_flush_tx(w);
+            if (timed) {
+                record_stage(w, WORKER_STAGE_TX, rdtsc() - w->stage_tx_tsc, (uint64_t)queued);
             }
+        }
 
-            w->pkts_forwarded += (uint64_t)sent;
-            w->pkts_dropped += (uint64_t)(w->tx_count - sent);
+        /* The slots may only be reused once nothing reads them any more. */
+        if (!w->rx_src) ring_pop_commit(w->rx_ring, n);
 
-            for (int i = 0; i < w->tx_count; i++) {
-                /* All buffers are freed; kernel already copied the data at this point
-                 * into the socket buffer during sendmmsg. Failed send may be because
-                 * the kernel rejected it (e.g., queue is full). */
-                pktbuf_free(w->pool, w->tx_bufs[i]);
-            }
-            w->tx_count = 0;
-        }
+        worker_complete(w);
+        publish_counters(w);
     }
 
+    publish_counters(w);
+    if (w->qsbr) qsbr_offline(w->qsbr, w->qsbr_id);
+    pktbuf_thread_flush();
     return NULL;
 }
 
-int worker_init(worker_t *w, int worker_id, int core_id, spsc_ring_t *rx_ring, pktbuf_pool_t *pool,
-                const rule_table_t *rt, const tx_ctx_t *tx, arp_table_t *arpt, ndp_table_t *ndpt) {
+int worker_init(worker_t *w, int worker_id, int core_id, spsc_ring_t *rx_ring,
+                pktbuf_classes_t *pools, const rule_table_t *rt, const tx_ctx_t *tx,
+                arp_table_t *arpt, ndp_table_t *ndpt) {
     if (!w || !rt) return -1;
 
     w->worker_id = worker_id;
     w->core_id = core_id;
     w->rx_ring = rx_ring;
-    w->pool = pool;
-    w->rt = rt;
+    w->rx_src = NULL;
+    w->pools = pools;
+    w->qsbr = NULL;
+    w->qsbr_id = 0;
     w->tx = tx;
+    w->tx_ring = NULL;
+    w->ctrl_ring = NULL;
+    w->mirror = NULL;
+    w->mirror_ring = NULL;
+    w->mirror_rng = 0x9E3779B97F4A7C15u * ((uint64_t)(uint32_t)worker_id + 1); /* Never 0 */
+    w->mirror_count = 0;
     w->arpt = arpt;
     w->ndpt = ndpt;
+    memset(w->tx_ports, 0, sizeof(w->tx_ports));
+    w->tx_ports[0].tx = tx;
+    w->tx_ifindex[0] = tx ? tx->ifindex : 0;
+    w->tx_port_count = 1;
     w->tx_count = 0;
+    w->idle_mode = g_idle_mode;
+    w->idle_streak = 0;
+    w->done_pending = 0;
+    w->done_mark = 0;
+    memset(&w->ctr, 0, sizeof(w->ctr));
+    atomic_init(&w->ctr_seq, 0);
+    for (size_t i = 0; i < WORKER_COUNTERS; i++) {
+        atomic_init(&w->ctr_snap[i], 0);
+    }
+    atomic_init(&w->pkts_done, 0);
+    perf_counters_init(&w->perf);
+    atomic_init(&w->perf_ready, false);
+    neigh_cache_init(&w->ncache);
 
     latency_histogram_init(&w->latency_hist);
+    w->stage_sample = g_stage_sample;
+    w->stage_countdown = g_stage_sample;
+    w->stage_tx_tsc = 0;
+    for (int s = 0; s < WORKER_STAGES; s++) {
+        latency_histogram_init(&w->stage_hist[s]);
+    }
+
+    /* Until everything below succeeded: a failed worker has no rules. */
+    atomic_init(&w->rules, NULL);
+    w->rt = NULL;
+    w->rule_stats = NULL;
+    memset(&w->fcache, 0, sizeof(w->fcache));
+    memset(&w->ct, 0, sizeof(w->ct));
 
     /* Rule table capacity tells the size of the stats array. */
-    w->rule_stats = (rule_stat_t *)calloc(rt->capacity, sizeof(rule_stat_t));
-    if (!w->rule_stats) return -1;
+    worker_rules_t *rules = malloc(sizeof(worker_rules_t));
+    if (!rules) return -1;
+    rules->rt = rt;
+    rules->stats = (rule_stat_t *)calloc(rt->capacity, sizeof(rule_stat_t));
+    if (!rules->stats) {
+        free(rules);
+        return -1;
+    }
 
+    if (g_flow_cache_entries > 0 && flow_cache_init(&w->fcache, g_flow_cache_entries) != 0) {
+        free(rules->stats);
+        free(rules);
+        return -1;
+    }
+
+    if (g_conntrack_entries > 0 &&
+        conntrack_init(&w->ct, g_conntrack_entries, conntrack_clock()) != 0) {
+        flow_cache_destroy(&w->fcache);
+        free(rules->stats);
+        free(rules);
+        return -1;
+    }
+
+    atomic_store(&w->rules, rules);
+    w->rt = rt;
+    w->rule_stats = rules->stats;
     return 0;
 }
 
 void worker_destroy(worker_t *w) {
-    if (w && w->rule_stats) free(w->rule_stats);
+    if (!w) return;
+    worker_rules_t *rules = atomic_load(&w->rules);
+    if (rules) {
+        free(rules->stats);
+        free(rules);
+        atomic_store(&w->rules, NULL);
+    }
+    w->rule_stats = NULL;
+    flow_cache_destroy(&w->fcache);
+    conntrack_destroy(&w->ct);
+    perf_counters_close(&w->perf);
+}
+
+int worker_add_tx_port(worker_t *w, const tx_ctx_t *tx) {
+    if (!w || !tx || w->tx_port_count >= WORKER_TX_MAX_PORTS) return -1;
+
+    worker_tx_port_t *p = &w->tx_ports[w->tx_port_count];
+    memset(p, 0, sizeof(*p));
+    p->tx = tx;
+    w->tx_ifindex[w->tx_port_count] = tx->ifindex;
+    w->tx_port_count++;
+    return 0;
+}
+
+worker_rules_t *worker_swap_rules(worker_t *w, worker_rules_t *next) {
+    /* Release: the table and the zeroed stats are complete before a worker can
+     * load the pointer. */
+    return atomic_exchange_explicit(&w->rules, next, memory_order_acq_rel);
+}
+
+void worker_read_counters(const worker_t *w, worker_counters_t *out) {
+    uint64_t v[WORKER_COUNTERS];
+    uint32_t seq;
+    for (;;) {
+        seq = atomic_load_explicit(&w->ctr_seq, memory_order_acquire);
+        if (seq & 1) {
+            cpu_relax();
+            continue;
+        }
+        for (size_t i = 0; i < WORKER_COUNTERS; i++) {
+            v[i] = atomic_load_explicit(&w->ctr_snap[i], memory_order_relaxed);
+        }
+        /* The loads above complete before the sequence is checked again. */
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&w->ctr_seq, memory_order_relaxed) == seq) break;
+    }
+    memcpy(out, v, sizeof(v));
+}
+
+bool worker_read_perf(const worker_t *w, uint64_t out[PERF_EVENTS]) {
+    if (!atomic_load_explicit(&w->perf_ready, memory_order_acquire)) return false;
+    return perf_counters_read(&w->perf, out);
 }
 
 int worker_start(worker_t *w) {
@@ -344,5 +841,43 @@ void worker_join(worker_t *w) {
 }
 
 void worker_set_tsc_calibration(double cycles_per_ns) {
-    g_cycles_per_ns = cycles_per_ns;
-}
\ No newline at end of file
+    g_ns_per_cycle = 1.0 / cycles_per_ns;
+}
+
+void worker_set_flow_cache_size(size_t entries) {
+    g_flow_cache_entries = entries;
+}
+
+void worker_set_conntrack_size(size_t entries) {
+    g_conntrack_entries = entries;
+}
+
+void worker_set_perf(bool enable) {
+    g_perf = enable;
+}
+
+void worker_set_idle_mode(idle_mode_t mode) {
+    g_idle_mode = mode;
+}
+
+void worker_set_stage_sampling(uint32_t every) {
+    g_stage_sample = every;
+}
+
+const char *worker_stage_name(worker_stage_t stage) {
+    static const char *const names[WORKER_STAGES] = {"rx",       "ring",  "parse",
+                                                     "classify", "neigh", "tx"};
+    return stage < WORKER_STAGES ? names[stage] : "?";
+}
+
+const char *idle_mode_name(idle_mode_t mode) {
+    switch (mode) {
+    case IDLE_MODE_POLL:
+        return "poll";
+    case IDLE_MODE_WAKEUP:
+        return "wakeup";
+    case IDLE_MODE_BACKOFF:
+    default:
+        return "backoff";
+    }
+}
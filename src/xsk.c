@@ -0,0 +1,473 @@
+#define _GNU_SOURCE
+#include "xsk.h"
+#include "latency.h"
+#include "log.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/* The kernel puts the frame XDP_PACKET_HEADROOM + UMEM headroom bytes into the chunk. */
+_Static_assert(PKTBUF_META_SIZE + PKTBUF_HEADROOM >= XDP_PACKET_HEADROOM,
+               "default headroom must leave room for XDP_PACKET_HEADROOM");
+
+/*
+-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+Ring Operations
+- Same scheme as the SPSC rings in ring.c: free-running 32-bit indices,
+  acquire load of the other side's index, release store of our own.
+-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+*/
+
+/* Producer side: number of free slots, at least `want` if possible. */
+static inline uint32_t prod_free(xsk_ring_t *r, uint32_t want) {
+    uint32_t free_entries = r->cached_cons - r->cached_prod;
+    if (free_entries >= want) return free_entries;
+
+    /* cached_cons is kept `size` ahead, so the subtraction yields free slots. */
+    r->cached_cons = __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE) + r->size;
+    return r->cached_cons - r->cached_prod;
+}
+
+static inline void prod_submit(xsk_ring_t *r) {
+    __atomic_store_n(r->producer, r->cached_prod, __ATOMIC_RELEASE);
+}
+
+/* Consumer side: number of filled slots, capped at `max`. */
+static inline uint32_t cons_avail(xsk_ring_t *r, uint32_t max) {
+    uint32_t entries = r->cached_prod - r->cached_cons;
+    if (entries == 0) {
+        r->cached_prod = __atomic_load_n(r->producer, __ATOMIC_ACQUIRE);
+        entries = r->cached_prod - r->cached_cons;
+    }
+    return (entries > max) ? max : entries;
+}
+
+static inline void cons_release(xsk_ring_t *r) {
+    __atomic_store_n(r->consumer, r->cached_cons, __ATOMIC_RELEASE);
+}
+
+static inline bool ring_needs_wakeup(const xsk_ring_t *r) {
+    return (__atomic_load_n(r->flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP) != 0;
+}
+
+static int ring_map(xsk_ring_t *r, int fd, const struct xdp_ring_offset *off, size_t desc_size,
+                    off_t pgoff, bool producer) {
+    r->map_len = off->desc + XSK_RING_SIZE * desc_size;
+    r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        return -1;
+    }
+
+    uint8_t *base = r->map;
+    r->producer = (uint32_t *)(base + off->producer);
+    r->consumer = (uint32_t *)(base + off->consumer);
+    r->flags = (uint32_t *)(base + off->flags);
+    r->descs = base + off->desc;
+    r->size = XSK_RING_SIZE;
+    r->mask = XSK_RING_SIZE - 1;
+    r->cached_prod = *r->producer;
+    r->cached_cons = *r->consumer;
+    if (producer) r->cached_cons += r->size;
+    return 0;
+}
+
+static void ring_unmap(xsk_ring_t *r) {
+    if (r->map) munmap(r->map, r->map_len);
+    r->map = NULL;
+}
+
+/*
+-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+XDP Program
+- Hand-assembled, so there is no libbpf/libxdp or clang dependency:
+
+        r2 = ctx->rx_queue_index
+        r1 = &xsks_map
+        r3 = XDP_PASS                  (action if the slot is empty)
+        return bpf_redirect_map(r1, r2, r3)
+-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+*/
+
+static long sys_bpf(int cmd, union bpf_attr *attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int load_redirect_prog(int map_fd) {
+    struct bpf_insn insns[] = {
+        {.code = BPF_LDX | BPF_MEM | BPF_W,
+         .dst_reg = BPF_REG_2,
+         .src_reg = BPF_REG_1,
+         .off = (int16_t)offsetof(struct xdp_md, rx_queue_index)},
+        {.code = BPF_LD | BPF_DW | BPF_IMM,
+         .dst_reg = BPF_REG_1,
+         .src_reg = BPF_PSEUDO_MAP_FD,
+         .imm = map_fd},
+        {0}, /* Upper half of the 64-bit immediate */
+        {.code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3, .imm = XDP_PASS},
+        {.code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map},
+        {.code = BPF_JMP | BPF_EXIT},
+    };
+    static const char license[] = "GPL";
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.expected_attach_type = BPF_XDP;
+    attr.insns = (uint64_t)(uintptr_t)insns;
+    attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+    attr.license = (uint64_t)(uintptr_t)license;
+    strncpy(attr.prog_name, "upe_xsk_redir", sizeof(attr.prog_name) - 1);
+
+    return (int)sys_bpf(BPF_PROG_LOAD, &attr);
+}
+
+int xdp_prog_attach(xdp_prog_t *p, const char *iface) {
+    if (!p || !iface) return -1;
+
+    p->prog_fd = p->map_fd = p->link_fd = -1;
+    p->ifindex = (int)if_nametoindex(iface);
+    if (p->ifindex == 0) {
+        log_msg(LOG_ERROR, "if_nametoindex(%s) failed: %s", iface, strerror(errno));
+        return -1;
+    }
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = XSK_MAX_QUEUES;
+    strncpy(attr.map_name, "upe_xsks", sizeof(attr.map_name) - 1);
+    p->map_fd = (int)sys_bpf(BPF_MAP_CREATE, &attr);
+    if (p->map_fd < 0) {
+        log_msg(LOG_ERROR, "bpf(MAP_CREATE xskmap) failed: %s", strerror(errno));
+        return -1;
+    }
+
+    p->prog_fd = load_redirect_prog(p->map_fd);
+    if (p->prog_fd < 0) {
+        log_msg(LOG_ERROR, "bpf(PROG_LOAD xdp) failed: %s", strerror(errno));
+        xdp_prog_detach(p);
+        return -1;
+    }
+
+    /* Native (driver) XDP first; generic XDP works on any device, but copies. */
+    static const uint32_t modes[] = {XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE};
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = (uint32_t)p->prog_fd;
+        attr.link_create.target_ifindex = (uint32_t)p->ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = modes[i];
+        p->link_fd = (int)sys_bpf(BPF_LINK_CREATE, &attr);
+        if (p->link_fd >= 0) {
+            log_msg(LOG_INFO, "XDP program attached to %s (%s mode)", iface,
+                    modes[i] == XDP_FLAGS_DRV_MODE ? "driver" : "generic");
+            return 0;
+        }
+    }
+
+    log_msg(LOG_ERROR, "bpf(LINK_CREATE xdp) on %s failed: %s", iface, strerror(errno));
+    xdp_prog_detach(p);
+    return -1;
+}
+
+int xdp_prog_add_xsk(const xdp_prog_t *p, const xsk_t *x) {
+    if (x->queue_id >= XSK_MAX_QUEUES) return -1;
+
+    uint32_t key = x->queue_id;
+    uint32_t val = (uint32_t)x->fd;
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = (uint32_t)p->map_fd;
+    attr.key = (uint64_t)(uintptr_t)&key;
+    attr.value = (uint64_t)(uintptr_t)&val;
+    attr.flags = BPF_ANY;
+
+    if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+        log_msg(LOG_ERROR, "bpf(MAP_UPDATE_ELEM xskmap[%u]) failed: %s", key, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void xdp_prog_detach(xdp_prog_t *p) {
+    if (!p) return;
+    if (p->link_fd >= 0) close(p->link_fd);
+    if (p->prog_fd >= 0) close(p->prog_fd);
+    if (p->map_fd >= 0) close(p->map_fd);
+    p->link_fd = p->prog_fd = p->map_fd = -1;
+}
+
+/*
+-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+Socket
+-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+*/
+
+/* Post pool buffers on the fill ring until XSK_FILL_TARGET are outstanding. */
+static void refill(xsk_t *x) {
+    if (x->fill_posted >= XSK_FILL_TARGET) return;
+
+    uint32_t want = XSK_FILL_TARGET - x->fill_posted;
+    uint32_t room = prod_free(&x->fill, want);
+    if (want > room) want = room;
+
+    uint64_t *addrs = x->fill.descs;
+    uint32_t posted = 0;
+    pktbuf_t *bufs[XSK_BULK_SIZE];
+    while (posted < want) {
+        unsigned int chunk = want - posted < XSK_BULK_SIZE ? want - posted : XSK_BULK_SIZE;
+        unsigned int got = pktbuf_alloc_bulk(x->pool, bufs, chunk);
+        for (unsigned int i = 0; i < got; i++) {
+            addrs[(x->fill.cached_prod + posted + i) & x->fill.mask] =
+                xsk_buf_addr(x->pool, bufs[i]);
+        }
+        posted += got;
+        if (got < chunk) {
+            x->fill_empty++;
+            break;
+        }
+    }
+
+    if (posted == 0) return;
+    x->fill.cached_prod += posted;
+    x->fill_posted += posted;
+    prod_submit(&x->fill);
+}
+
+int xsk_open(xsk_t *x, const char *iface, uint32_t queue_id, pktbuf_pool_t *pool) {
+    if (!x || !iface || !pool) return -1;
+
+    memset(x, 0, sizeof(*x));
+    x->fd = -1;
+    x->queue_id = queue_id;
+    x->pool = pool;
+
+    if (pool->buffers_mmap_len == 0) {
+        log_msg(LOG_ERROR, "AF_XDP needs an mmap-backed packet pool");
+        return -1;
+    }
+    /* A chunk may not exceed a page, and the frame must land at b->data. */
+    size_t data_off = PKTBUF_META_SIZE + pool->headroom;
+    if (pool->stride > 4096 || data_off < XDP_PACKET_HEADROOM) {
+        log_msg(LOG_ERROR, "AF_XDP needs %d..%d byte buffers with >= %d bytes headroom",
+                XDP_PACKET_HEADROOM, 4096, XDP_PACKET_HEADROOM - PKTBUF_META_SIZE);
+        return -1;
+    }
+
+    int ifindex = (int)if_nametoindex(iface);
+    if (ifindex == 0) {
+        log_msg(LOG_ERROR, "if_nametoindex(%s) failed: %s", iface, strerror(errno));
+        return -1;
+    }
+
+    int fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (fd < 0) {
+        log_msg(LOG_ERROR, "socket(AF_XDP) failed: %s", strerror(errno));
+        return -1;
+    }
+    x->fd = fd;
+
+    /* The whole buffer array becomes the UMEM, one chunk per buffer. Headroom
+     * beyond XDP_PACKET_HEADROOM is reserved as UMEM headroom. */
+    struct xdp_umem_reg mr;
+    memset(&mr, 0, sizeof(mr));
+    mr.addr = (uint64_t)(uintptr_t)pool->mem;
+    mr.len = (uint64_t)pool->capacity * pool->stride;
+    mr.chunk_size = (uint32_t)pool->stride;
+    mr.headroom = (uint32_t)(data_off - XDP_PACKET_HEADROOM);
+    mr.flags = XDP_UMEM_UNALIGNED_CHUNK_FLAG;
+    if (setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) < 0) {
+        log_msg(LOG_ERROR, "setsockopt(XDP_UMEM_REG) failed: %s", strerror(errno));
+        goto fail;
+    }
+
+    int ring_size = XSK_RING_SIZE;
+    if (setsockopt(fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) < 0) {
+        log_msg(LOG_ERROR, "setsockopt(XDP ring size) failed: %s", strerror(errno));
+        goto fail;
+    }
+
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof(off);
+    if (getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+        log_msg(LOG_ERROR, "getsockopt(XDP_MMAP_OFFSETS) failed: %s", strerror(errno));
+        goto fail;
+    }
+
+    if (ring_map(&x->rx, fd, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING, false) != 0 ||
+        ring_map(&x->tx, fd, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING, true) != 0 ||
+        ring_map(&x->fill, fd, &off.fr, sizeof(uint64_t), (off_t)XDP_UMEM_PGOFF_FILL_RING,
+                 true) != 0 ||
+        ring_map(&x->comp, fd, &off.cr, sizeof(uint64_t), (off_t)XDP_UMEM_PGOFF_COMPLETION_RING,
+                 false) != 0) {
+        log_msg(LOG_ERROR, "mmap(XDP rings) failed: %s", strerror(errno));
+        goto fail;
+    }
+
+    /* Frames that arrive before the fill ring has buffers are dropped. */
+    refill(x);
+
+    struct sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = (uint32_t)ifindex;
+    sxdp.sxdp_queue_id = queue_id;
+
+    /* Zero-copy needs driver support; copy mode works everywhere. */
+    sxdp.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+    if (bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == 0) {
+        x->zero_copy = true;
+    } else {
+        sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+        if (bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+            log_msg(LOG_ERROR, "bind(AF_XDP %s queue %u) failed: %s", iface, queue_id,
+                    strerror(errno));
+            goto fail;
+        }
+    }
+
+    log_msg(LOG_INFO, "AF_XDP socket on %s queue %u (%s)", iface, queue_id,
+            x->zero_copy ? "zero-copy" : "copy mode");
+    return 0;
+
+fail:
+    xsk_close(x);
+    return -1;
+}
+
+unsigned int xsk_rx_burst(xsk_t *x, pktbuf_t **out, unsigned int max) {
+    uint32_t n = cons_avail(&x->rx, max);
+
+    if (n > 0) {
+        const struct xdp_desc *descs = x->rx.descs;
+        uint64_t now = rdtsc();
+
+        for (uint32_t i = 0; i < n; i++) {
+            const struct xdp_desc *d = &descs[(x->rx.cached_cons + i) & x->rx.mask];
+
+            /* Unaligned mode: chunk base in the low 48 bits, data offset above. */
+            uint64_t base = d->addr & XSK_UNALIGNED_BUF_ADDR_MASK;
+            uint64_t data = base + (d->addr >> XSK_UNALIGNED_BUF_OFFSET_SHIFT);
+            pktbuf_t *b = xsk_addr_buf(x->pool, base);
+
+            /* The frame normally starts exactly at b->data. */
+            uint8_t *frame = x->pool->mem + data;
+            if (frame != b->data) memmove(b->data, frame, d->len);
+
+            b->len = d->len;
+            b->timestamp = now;
+            out[i] = b;
+        }
+
+        x->rx.cached_cons += n;
+        cons_release(&x->rx);
+        x->fill_posted -= n;
+    }
+
+    refill(x);
+
+    /* In copy/need_wakeup mode the kernel stops polling an empty fill ring. */
+    if (ring_needs_wakeup(&x->fill)) {
+        recvfrom(x->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+
+    return n;
+}
+
+void xsk_reap_tx(xsk_t *x) {
+    uint32_t n = cons_avail(&x->comp, XSK_RING_SIZE);
+    if (n == 0) return;
+
+    const uint64_t *addrs = x->comp.descs;
+    pktbuf_t *bufs[XSK_BULK_SIZE];
+    unsigned int count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t addr = addrs[(x->comp.cached_cons + i) & x->comp.mask];
+        bufs[count++] = xsk_addr_buf(x->pool, addr);
+        if (count == XSK_BULK_SIZE) {
+            pktbuf_free_bulk(x->pool, bufs, count);
+            count = 0;
+        }
+    }
+    pktbuf_free_bulk(x->pool, bufs, count);
+
+    x->comp.cached_cons += n;
+    cons_release(&x->comp);
+    x->tx_pending -= n;
+}
+
+unsigned int xsk_tx_burst(xsk_t *x, pktbuf_t *const *bufs, unsigned int n) {
+    xsk_reap_tx(x);
+
+    uint32_t room = prod_free(&x->tx, n);
+    uint32_t sent = (n < room) ? n : room;
+    if (sent < n) x->tx_ring_full++;
+
+    struct xdp_desc *descs = x->tx.descs;
+    for (uint32_t i = 0; i < sent; i++) {
+        struct xdp_desc *d = &descs[(x->tx.cached_prod + i) & x->tx.mask];
+        /* The frame may have grown into the headroom (pktbuf_prepend). */
+        d->addr = xsk_buf_addr(x->pool, bufs[i]) + (uint64_t)(bufs[i]->data - (uint8_t *)bufs[i]);
+        d->len = (uint32_t)bufs[i]->len;
+        d->options = 0;
+    }
+
+    if (sent > 0) {
+        x->tx.cached_prod += sent;
+        x->tx_pending += sent;
+        prod_submit(&x->tx);
+    }
+
+    /* Copy mode always needs the syscall to transmit; zero-copy only when asked. */
+    if (x->tx_pending > 0 && (!x->zero_copy || ring_needs_wakeup(&x->tx))) {
+        if (sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 && errno != EAGAIN &&
+            errno != EBUSY && errno != ENOBUFS) {
+            log_msg_ratelimited(LOG_WARN, "sendto(AF_XDP) failed: %s", strerror(errno));
+        }
+    }
+
+    return sent;
+}
+
+int xsk_wait(const xsk_t *x, int timeout_ms) {
+    struct pollfd pfd = {.fd = x->fd, .events = POLLIN, .revents = 0};
+    return poll(&pfd, 1, timeout_ms);
+}
+
+void xsk_close(xsk_t *x) {
+    if (!x) return;
+
+    /* Buffers still in the fill/RX/TX rings stay with the UMEM memory and are
+     * only reclaimed when the pool itself is destroyed. */
+    ring_unmap(&x->rx);
+    ring_unmap(&x->tx);
+    ring_unmap(&x->fill);
+    ring_unmap(&x->comp);
+    if (x->fd >= 0) close(x->fd);
+    x->fd = -1;
+}
@@ -0,0 +1,458 @@
+/*
+    Benchmark rule_table_match() against the number of rules.
+
+    Tuple space search costs one hash probe per tuple (distinct combination of
+    masks), not per rule: the lookup rate should stay flat as the rule count
+    grows at a fixed tuple count, and fall with the tuple count. Each sweep
+    point builds a table of N rules spread over --tuples mask shapes, compiles
+    it, and looks up a fixed set of IPv4 flow keys, of which --hit-pct are
+    taken from a rule (the rest are random, and mostly miss).
+
+    --linear also times the uncompiled table (the linear scan rule_table_match()
+    falls back to) for rule counts up to LINEAR_MAX_RULES.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "benchmark_test.h"
+#include "classifier.h"
+#include "rule_table.h"
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_POINTS 16
+#define LINEAR_MAX_RULES 10000
+
+/* ── Config ───────────────────────────────────────────────────────── */
+
+typedef struct {
+    size_t rule_counts[MAX_POINTS];
+    size_t num_points;
+    size_t lookups;    /* Per sweep point */
+    size_t flows;      /* Distinct keys looked up */
+    unsigned int tuples;
+    unsigned int hit_pct;
+    bool linear;
+    bool warmup;
+    bool json_output;
+    const char *output_file;
+} bench_config_t;
+
+static bench_config_t default_config(void) {
+    bench_config_t cfg;
+    const size_t counts[] = {10, 100, 1000, 10000, 100000};
+    memcpy(cfg.rule_counts, counts, sizeof(counts));
+    cfg.num_points = sizeof(counts) / sizeof(counts[0]);
+    cfg.lookups = 5000000;
+    cfg.flows = 65536;
+    cfg.tuples = 8;
+    cfg.hit_pct = 90;
+    cfg.linear = false;
+    cfg.warmup = false;
+    cfg.json_output = false;
+    cfg.output_file = NULL;
+    return cfg;
+}
+
+/* ── Rule Set ─────────────────────────────────────────────────────── */
+
+/*
+    Mask shapes of a realistic ACL: host and subnet routes, port-specific
+    service rules, a few source-restricted ones. Rule i uses shape i % tuples.
+*/
+typedef struct {
+    uint8_t dst_prefix;
+    uint8_t src_prefix;
+    bool proto;
+    bool dst_port;
+} rule_shape_t;
+
+static const rule_shape_t SHAPES[] = {
+    {32, 0, true, true},  {24, 0, true, true},  {24, 0, false, false}, {16, 0, true, false},
+    {32, 32, true, true}, {24, 16, true, true}, {8, 0, false, false},  {28, 0, true, true},
+    {16, 16, true, true}, {32, 0, false, false}, {20, 0, true, true},  {24, 24, true, false},
+    {12, 0, true, true},  {32, 24, true, true}, {16, 8, false, false}, {30, 0, true, true},
+};
+#define MAX_TUPLES (sizeof(SHAPES) / sizeof(SHAPES[0]))
+
+static uint32_t xorshift32(uint32_t *x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    return *x;
+}
+
+static uint32_t prefix_mask(uint8_t len) {
+    uint32_t m = 0;
+    ipv4_mask_from_prefix(len, &m);
+    return m;
+}
+
+static void build_rules(rule_t *rules, size_t n, unsigned int tuples, uint32_t seed) {
+    uint32_t x = seed;
+    for (size_t i = 0; i < n; i++) {
+        const rule_shape_t *sh = &SHAPES[i % tuples];
+        rule_t *r = &rules[i];
+        memset(r, 0, sizeof(*r));
+        r->priority = (uint32_t)i;
+        r->ip_ver = 4;
+        r->dst_mask.v4 = prefix_mask(sh->dst_prefix);
+        r->dst_ip.v4 = xorshift32(&x) & r->dst_mask.v4;
+        r->src_mask.v4 = prefix_mask(sh->src_prefix);
+        r->src_ip.v4 = xorshift32(&x) & r->src_mask.v4;
+        if (sh->proto) r->protocol = (xorshift32(&x) & 1) ? 6 : 17;
+        if (sh->dst_port) r->dst_port = (uint16_t)(1 + xorshift32(&x) % 65535);
+        r->action.type = ACT_FWD;
+        r->action.out_ifindex = 1;
+    }
+}
+
+/* Keys: `hit_pct` of them inside a random rule (host bits and wildcards random). */
+static void build_keys(flow_key_t *keys, size_t n, const rule_t *rules, size_t nrules,
+                       unsigned int hit_pct, uint32_t seed) {
+    uint32_t x = seed;
+    for (size_t i = 0; i < n; i++) {
+        flow_key_t *k = &keys[i];
+        memset(k, 0, sizeof(*k));
+        k->ip_ver = 4;
+        k->src_ip.v4 = xorshift32(&x);
+        k->dst_ip.v4 = xorshift32(&x);
+        k->src_port = (uint16_t)(1024 + xorshift32(&x) % 64000);
+        k->dst_port = (uint16_t)(1 + xorshift32(&x) % 65535);
+        k->protocol = (xorshift32(&x) & 1) ? 6 : 17;
+
+        if (xorshift32(&x) % 100 < hit_pct) {
+            const rule_t *r = &rules[xorshift32(&x) % nrules];
+            k->dst_ip.v4 = r->dst_ip.v4 | (k->dst_ip.v4 & ~r->dst_mask.v4);
+            k->src_ip.v4 = r->src_ip.v4 | (k->src_ip.v4 & ~r->src_mask.v4);
+            if (r->protocol) k->protocol = r->protocol;
+            if (r->dst_port) k->dst_port = r->dst_port;
+        }
+    }
+}
+
+/* ── Measurement ──────────────────────────────────────────────────── */
+
+typedef struct {
+    size_t rules;
+    size_t tuples;        /* Of the compiled classifier */
+    double compile_ms;    /* rule_table_add_bulk() + rule_table_compile() */
+    double lookups_per_sec;
+    double ns_per_lookup;
+    double hit_pct;       /* Keys that matched a rule */
+    double linear_ns_per_lookup; /* 0 = not measured */
+} point_result_t;
+
+static volatile uint32_t g_sink; /* Keeps the matches alive. */
+
+/* `lookups` lookups over keys[0..flows), in order. Returns seconds; *hits the matches. */
+static double time_lookups(const rule_table_t *rt, const flow_key_t *keys, size_t flows,
+                           size_t lookups, size_t *hits) {
+    uint32_t sink = 0;
+    size_t matched = 0;
+    size_t j = 0;
+
+    double start = benchmark_get_time();
+    for (size_t i = 0; i < lookups; i++) {
+        const rule_t *r = rule_table_match(rt, &keys[j]);
+        if (r) {
+            sink += r->rule_id;
+            matched++;
+        }
+        if (++j == flows) j = 0;
+    }
+    double dur = benchmark_get_time() - start;
+
+    g_sink = sink;
+    *hits = matched;
+    return dur;
+}
+
+static int run_point(const bench_config_t *cfg, size_t nrules, point_result_t *res) {
+    memset(res, 0, sizeof(*res));
+    res->rules = nrules;
+
+    rule_t *rules = malloc(nrules * sizeof(rule_t));
+    flow_key_t *keys = malloc(cfg->flows * sizeof(flow_key_t));
+    if (!rules || !keys) {
+        free(rules);
+        free(keys);
+        return -1;
+    }
+    build_rules(rules, nrules, cfg->tuples, 2463534242u);
+    build_keys(keys, cfg->flows, rules, nrules, cfg->hit_pct, 88675123u);
+
+    rule_table_t rt;
+    double t0 = benchmark_get_time();
+    if (rule_table_init(&rt, nrules) != 0) {
+        free(rules);
+        free(keys);
+        return -1;
+    }
+    if (rule_table_add_bulk(&rt, rules, nrules) != 0) {
+        rule_table_destroy(&rt);
+        free(rules);
+        free(keys);
+        return -1;
+    }
+    double build_sec = benchmark_get_time() - t0;
+    free(rules);
+
+    /* The uncompiled table matches by linear scan: the baseline the classifier replaces. */
+    size_t hits = 0;
+    if (cfg->linear && nrules <= LINEAR_MAX_RULES) {
+        size_t n = cfg->lookups / 10 > 0 ? cfg->lookups / 10 : 1;
+        res->linear_ns_per_lookup = time_lookups(&rt, keys, cfg->flows, n, &hits) * 1e9 /
+                                    (double)n;
+    }
+
+    t0 = benchmark_get_time();
+    if (rule_table_compile(&rt) != 0) {
+        rule_table_destroy(&rt);
+        free(keys);
+        return -1;
+    }
+    res->compile_ms = (build_sec + benchmark_get_time() - t0) * 1e3;
+    res->tuples = rt.cls ? rt.cls->tuple_count : 0;
+
+    if (cfg->warmup) time_lookups(&rt, keys, cfg->flows, cfg->flows, &hits);
+
+    double dur = time_lookups(&rt, keys, cfg->flows, cfg->lookups, &hits);
+    res->lookups_per_sec = (double)cfg->lookups / dur;
+    res->ns_per_lookup = dur * 1e9 / (double)cfg->lookups;
+    res->hit_pct = (double)hits * 100.0 / (double)cfg->lookups;
+
+    rule_table_destroy(&rt);
+    free(keys);
+    return 0;
+}
+
+/* ── Output ───────────────────────────────────────────────────────── */
+
+static void output_human(const bench_config_t *cfg, const point_result_t *res,
+                         double overhead_ns) {
+    printf("=-> Classifier Lookup Benchmark <-=\n");
+
+    printf("Settings:\n");
+    printf("    Lookups:  %zu per point\n", cfg->lookups);
+    printf("    Flows:    %zu keys\n", cfg->flows);
+    printf("    Tuples:   %u mask shapes\n", cfg->tuples);
+    printf("    Hit rate: %u%% of keys inside a rule\n", cfg->hit_pct);
+    printf("    Warm-up:  %s\n", cfg->warmup ? "Yes" : "No");
+    printf("    Timing overhead: %.1f ns\n\n", overhead_ns);
+
+    printf("%10s %8s %12s %12s %10s %8s", "Rules", "Tuples", "Compile ms", "M lookups/s",
+           "ns/lookup", "Hits");
+    if (cfg->linear) printf(" %12s", "Linear ns");
+    printf("\n");
+    for (size_t i = 0; i < cfg->num_points; i++) {
+        const point_result_t *r = &res[i];
+        printf("%10zu %8zu %12.2f %12.2f %10.1f %7.1f%%", r->rules, r->tuples, r->compile_ms,
+               r->lookups_per_sec / 1e6, r->ns_per_lookup, r->hit_pct);
+        if (cfg->linear && r->linear_ns_per_lookup > 0.0) {
+            printf(" %12.1f", r->linear_ns_per_lookup);
+        }
+        printf("\n");
+    }
+
+    /* Flat is the goal: the lookup depends on the tuples, not the rules. */
+    const point_result_t *first = &res[0];
+    const point_result_t *last = &res[cfg->num_points - 1];
+    if (cfg->num_points > 1 && first->lookups_per_sec > 0.0) {
+        printf("\nAnalysis:\n");
+        printf("    %zu -> %zu rules: %.2fx the lookup rate.\n", first->rules, last->rules,
+               last->lookups_per_sec / first->lookups_per_sec);
+    }
+}
+
+static void output_json(const bench_config_t *cfg, const point_result_t *res, double overhead_ns,
+                        FILE *out) {
+    system_info_t sysinfo;
+    benchmark_get_system_info(&sysinfo);
+
+    json_ctx_t ctx;
+    json_init(&ctx, out);
+    json_begin_object(&ctx);
+
+    json_key_string(&ctx, "benchmark", "classifier_lookup");
+
+    /* System info. */
+    json_begin_nested_object(&ctx, "system_info");
+    json_key_string(&ctx, "cpu_model", sysinfo.cpu_model);
+    json_key_int(&ctx, "num_cores", sysinfo.num_cores);
+    json_key_int(&ctx, "l1d_cache_kb", sysinfo.l1d_cache_kb);
+    json_key_int(&ctx, "l2_cache_kb", sysinfo.l2_cache_kb);
+    json_key_int(&ctx, "l3_cache_kb", sysinfo.l3_cache_kb);
+    json_key_int(&ctx, "numa_nodes", sysinfo.numa_nodes);
+    json_end_object(&ctx);
+
+    /* Config. */
+    json_begin_nested_object(&ctx, "config");
+    json_key_int(&ctx, "lookups", (int64_t)cfg->lookups);
+    json_key_int(&ctx, "flows", (int64_t)cfg->flows);
+    json_key_int(&ctx, "tuples", cfg->tuples);
+    json_key_int(&ctx, "hit_pct", cfg->hit_pct);
+    json_key_bool(&ctx, "linear", cfg->linear);
+    json_key_bool(&ctx, "warmup", cfg->warmup);
+    json_end_object(&ctx);
+
+    /* Results: one object per sweep point, so bm_compare.py can name it. */
+    json_begin_nested_object(&ctx, "results");
+    for (size_t i = 0; i < cfg->num_points; i++) {
+        const point_result_t *r = &res[i];
+        char key[32];
+        snprintf(key, sizeof(key), "rules_%zu", r->rules);
+        json_begin_nested_object(&ctx, key);
+        json_key_int(&ctx, "rules", (int64_t)r->rules);
+        json_key_int(&ctx, "tuples", (int64_t)r->tuples);
+        json_key_double(&ctx, "compile_ms", r->compile_ms);
+        json_key_double(&ctx, "lookups_per_sec", r->lookups_per_sec);
+        json_key_double(&ctx, "ns_per_lookup", r->ns_per_lookup);
+        json_key_double(&ctx, "hit_pct", r->hit_pct);
+        if (r->linear_ns_per_lookup > 0.0) {
+            json_key_double(&ctx, "linear_ns_per_lookup", r->linear_ns_per_lookup);
+        }
+        json_end_object(&ctx);
+    }
+    json_key_double(&ctx, "measurement_overhead_ns", overhead_ns);
+    json_end_object(&ctx); /* results */
+
+    json_end_object(&ctx); /* root */
+    fprintf(out, "\n");
+}
+
+/* ── CLI ──────────────────────────────────────────────────────────── */
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [OPTIONS]\n\n", prog);
+    printf("Options:\n");
+    printf("    -r, --rules=LIST    Rule counts to sweep (default: 10,100,1000,10000,100000)\n");
+    printf("    -n, --lookups=N     Lookups per rule count (default: 5000000)\n");
+    printf("    -f, --flows=N       Distinct flow keys (default: 65536)\n");
+    printf("    -t, --tuples=N      Mask shapes the rules use, 1..%zu (default: 8)\n",
+           MAX_TUPLES);
+    printf("    -H, --hit-pct=N     Keys taken from a rule, percent (default: 90)\n");
+    printf("    -l, --linear        Also time the linear scan (up to %d rules)\n",
+           LINEAR_MAX_RULES);
+    printf("    -W, --warmup        Enable warm-up phase\n");
+    printf("    -j, --json          Output JSON format\n");
+    printf("    -o, --output=FILE   Write to file instead of stdout\n");
+    printf("    -h, --help          Show this help\n\n");
+    printf("Examples:\n");
+    printf("    %s --rules=1000,100000 --tuples=16\n", prog);
+    printf("    %s --warmup --json > out.json\n", prog);
+}
+
+static int parse_args(int argc, char **argv, bench_config_t *cfg) {
+    static struct option long_options[] = {{"rules", required_argument, NULL, 'r'},
+                                           {"lookups", required_argument, NULL, 'n'},
+                                           {"flows", required_argument, NULL, 'f'},
+                                           {"tuples", required_argument, NULL, 't'},
+                                           {"hit-pct", required_argument, NULL, 'H'},
+                                           {"linear", no_argument, NULL, 'l'},
+                                           {"warmup", no_argument, NULL, 'W'},
+                                           {"json", no_argument, NULL, 'j'},
+                                           {"output", required_argument, NULL, 'o'},
+                                           {"help", no_argument, NULL, 'h'},
+                                           {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "r:n:f:t:H:lWjo:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'r':
+            cfg->num_points = benchmark_parse_list("rules", cfg->rule_counts, MAX_POINTS);
+            break;
+        case 'n':
+            cfg->lookups = benchmark_parse_size_t("lookups");
+            if (cfg->lookups == 0) {
+                fprintf(stderr, "Error: lookups must be > 0\n");
+                return -1;
+            }
+            break;
+        case 'f':
+            cfg->flows = benchmark_parse_size_t("flows");
+            if (cfg->flows == 0) {
+                fprintf(stderr, "Error: flows must be > 0\n");
+                return -1;
+            }
+            break;
+        case 't': {
+            int t = benchmark_parse_int("tuples");
+            if (t < 1 || (size_t)t > MAX_TUPLES) {
+                fprintf(stderr, "Error: tuples must be 1-%zu\n", MAX_TUPLES);
+                return -1;
+            }
+            cfg->tuples = (unsigned int)t;
+            break;
+        }
+        case 'H': {
+            int pct = benchmark_parse_int("hit-pct");
+            if (pct < 0 || pct > 100) {
+                fprintf(stderr, "Error: hit-pct must be 0-100\n");
+                return -1;
+            }
+            cfg->hit_pct = (unsigned int)pct;
+            break;
+        }
+        case 'l':
+            cfg->linear = true;
+            break;
+        case 'W':
+            cfg->warmup = true;
+            break;
+        case 'j':
+            cfg->json_output = true;
+            break;
+        case 'o':
+            cfg->output_file = optarg;
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* ── Main ─────────────────────────────────────────────────────────── */
+
+int main(int argc, char **argv) {
+    bench_config_t cfg = default_config();
+    if (parse_args(argc, argv, &cfg) != 0) return EXIT_FAILURE;
+
+    double overhead_ns = benchmark_measure_timing_overhead();
+
+    point_result_t res[MAX_POINTS];
+    for (size_t i = 0; i < cfg.num_points; i++) {
+        if (!cfg.json_output) printf("Rules: %zu...\n", cfg.rule_counts[i]);
+        if (run_point(&cfg, cfg.rule_counts[i], &res[i]) != 0) {
+            fprintf(stderr, "Error: building %zu rules failed\n", cfg.rule_counts[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE *out = stdout;
+    if (cfg.output_file) {
+        out = fopen(cfg.output_file, "w");
+        if (!out) {
+            perror("fopen");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (cfg.json_output) {
+        output_json(&cfg, res, overhead_ns, out);
+    } else {
+        output_human(&cfg, res, overhead_ns);
+    }
+
+    if (cfg.output_file) fclose(out);
+    return EXIT_SUCCESS;
+}
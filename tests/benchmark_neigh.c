@@ -0,0 +1,509 @@
+/*
+    Benchmark neighbour table lookups under concurrent readers and a writer.
+
+    Workers resolve next hops with arp_get_mac() / ndp_get_mac() without a lock:
+    a seqlock makes them retry only while the control thread changes an entry.
+    Each sweep point fills a table with N neighbours, runs R reader threads
+    looking up random ones for --duration-ms, and one writer that changes a MAC
+    --write-rate times per second (every change moves the sequence counter,
+    so readers in the middle of a probe retry).
+
+    Readers should scale linearly: they share the table read-only, and the
+    writer touches the sequence line only --write-rate times per second.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "arp_table.h"
+#include "benchmark_test.h"
+#include "ndp_table.h"
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_POINTS 16
+#define MAX_READERS 64
+
+/* ── Config ───────────────────────────────────────────────────────── */
+
+typedef struct {
+    size_t sizes[MAX_POINTS];   /* Neighbours in the table */
+    size_t num_sizes;
+    size_t readers[MAX_POINTS]; /* Reader thread counts */
+    size_t num_readers;
+    int duration_ms;            /* Per sweep point */
+    size_t write_rate;          /* MAC changes per second, 0 = no writer */
+    int family;                 /* 4: ARP, 6: NDP */
+    bool warmup;
+    bool json_output;
+    const char *output_file;
+} bench_config_t;
+
+static bench_config_t default_config(void) {
+    bench_config_t cfg;
+    const size_t sizes[] = {256, 4096, 65536};
+    const size_t readers[] = {1, 2, 4};
+    memcpy(cfg.sizes, sizes, sizeof(sizes));
+    cfg.num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    memcpy(cfg.readers, readers, sizeof(readers));
+    cfg.num_readers = sizeof(readers) / sizeof(readers[0]);
+    cfg.duration_ms = 1000;
+    cfg.write_rate = 1000;
+    cfg.family = 4;
+    cfg.warmup = false;
+    cfg.json_output = false;
+    cfg.output_file = NULL;
+    return cfg;
+}
+
+/* ── Table ────────────────────────────────────────────────────────── */
+
+/* Neighbours are on-link hosts: consecutive addresses of one subnet. */
+#define NEIGH_BASE_V4 0x0A000000u /* 10.0.0.0 */
+
+typedef struct {
+    int family;
+    size_t size;
+    arp_table_t arp;
+    ndp_table_t ndp;
+} neigh_env_t;
+
+static void neigh_ip6(uint8_t ip[16], size_t i) {
+    /* 2001:db8::<i> */
+    memset(ip, 0, 16);
+    ip[0] = 0x20;
+    ip[1] = 0x01;
+    ip[2] = 0x0d;
+    ip[3] = 0xb8;
+    for (int b = 0; b < 4; b++) {
+        ip[15 - b] = (uint8_t)(i >> (8 * b));
+    }
+}
+
+static void neigh_mac(uint8_t mac[6], size_t i, uint8_t gen) {
+    mac[0] = 0x02;
+    mac[1] = gen;
+    mac[2] = (uint8_t)(i >> 24);
+    mac[3] = (uint8_t)(i >> 16);
+    mac[4] = (uint8_t)(i >> 8);
+    mac[5] = (uint8_t)i;
+}
+
+static void neigh_set(neigh_env_t *env, size_t i, uint8_t gen) {
+    uint8_t mac[6];
+    neigh_mac(mac, i, gen);
+    if (env->family == 6) {
+        uint8_t ip[16];
+        neigh_ip6(ip, i);
+        ndp_update(&env->ndp, ip, mac);
+    } else {
+        arp_update(&env->arp, NEIGH_BASE_V4 + (uint32_t)i, mac);
+    }
+}
+
+/* Capacity: a power of two, at least twice the entries (open addressing). */
+static int neigh_env_init(neigh_env_t *env, int family, size_t size) {
+    size_t capacity = 1;
+    while (capacity < 2 * size) capacity <<= 1;
+
+    env->family = family;
+    env->size = size;
+    int rc = family == 6 ? ndp_table_init(&env->ndp, capacity)
+                         : arp_table_init(&env->arp, capacity);
+    if (rc != 0) return -1;
+
+    for (size_t i = 0; i < size; i++) {
+        neigh_set(env, i, 0);
+    }
+    return 0;
+}
+
+static void neigh_env_destroy(neigh_env_t *env) {
+    if (env->family == 6) {
+        ndp_table_destroy(&env->ndp);
+    } else {
+        arp_table_destroy(&env->arp);
+    }
+}
+
+/* ── Threads ──────────────────────────────────────────────────────── */
+
+typedef struct {
+    neigh_env_t *env;
+    atomic_bool *go;
+    atomic_bool *stop;
+    uint32_t seed;     /* Reader: lookup order */
+    size_t write_rate; /* Writer: changes per second */
+
+    /* Results after the thread is done: */
+    uint64_t ops;
+    uint64_t misses; /* Should stay 0: every looked-up neighbour exists */
+    double duration_sec;
+} thread_ctx_t;
+
+static void *reader_thread(void *arg) {
+    thread_ctx_t *ctx = (thread_ctx_t *)arg;
+    neigh_env_t *env = ctx->env;
+    uint32_t x = ctx->seed;
+    uint64_t ops = 0;
+    uint64_t misses = 0;
+    uint8_t mac[6];
+    uint8_t ip6[16];
+
+    while (!atomic_load_explicit(ctx->go, memory_order_acquire)) {
+    }
+    double start = benchmark_get_time();
+
+    while (!atomic_load_explicit(ctx->stop, memory_order_relaxed)) {
+        /* 64 lookups between checks of the stop flag. */
+        for (int k = 0; k < 64; k++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            size_t i = x % env->size;
+            bool found;
+            if (env->family == 6) {
+                neigh_ip6(ip6, i);
+                found = ndp_get_mac(&env->ndp, ip6, mac);
+            } else {
+                found = arp_get_mac(&env->arp, NEIGH_BASE_V4 + (uint32_t)i, mac);
+            }
+            misses += !found;
+        }
+        ops += 64;
+    }
+
+    ctx->duration_sec = benchmark_get_time() - start;
+    ctx->ops = ops;
+    ctx->misses = misses;
+    return NULL;
+}
+
+/* The writer: one MAC change every 1/write_rate seconds. */
+static void *writer_thread(void *arg) {
+    thread_ctx_t *ctx = (thread_ctx_t *)arg;
+    neigh_env_t *env = ctx->env;
+    double interval = 1.0 / (double)ctx->write_rate;
+    uint32_t x = 2463534242u;
+    uint64_t ops = 0;
+
+    while (!atomic_load_explicit(ctx->go, memory_order_acquire)) {
+    }
+    double start = benchmark_get_time();
+
+    while (!atomic_load_explicit(ctx->stop, memory_order_relaxed)) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        neigh_set(env, x % env->size, (uint8_t)(++ops));
+
+        /* Sleep the gap: the writer must not take a core from the readers. */
+        double due = start + (double)ops * interval;
+        double now = benchmark_get_time();
+        if (due > now) {
+            double gap = due - now;
+            struct timespec ts = {.tv_sec = (time_t)gap,
+                                  .tv_nsec = (long)((gap - (double)(time_t)gap) * 1e9)};
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    ctx->duration_sec = benchmark_get_time() - start;
+    ctx->ops = ops;
+    return NULL;
+}
+
+/* ── Measurement ──────────────────────────────────────────────────── */
+
+typedef struct {
+    size_t size;
+    size_t readers;
+    double lookups_per_sec;  /* All readers */
+    double mean_reader_tput; /* Lookups per second of one reader */
+    double cv;               /* Across readers */
+    double writes_per_sec;
+    uint64_t misses;
+} point_result_t;
+
+static int run_point(const bench_config_t *cfg, size_t size, size_t readers, int duration_ms,
+                     point_result_t *res) {
+    memset(res, 0, sizeof(*res));
+    res->size = size;
+    res->readers = readers;
+
+    neigh_env_t env;
+    if (neigh_env_init(&env, cfg->family, size) != 0) return -1;
+
+    atomic_bool go = false;
+    atomic_bool stop = false;
+    pthread_t threads[MAX_READERS + 1];
+    thread_ctx_t ctx[MAX_READERS + 1];
+    size_t n = readers + (cfg->write_rate > 0 ? 1 : 0);
+
+    for (size_t i = 0; i < n; i++) {
+        memset(&ctx[i], 0, sizeof(ctx[i]));
+        ctx[i].env = &env;
+        ctx[i].go = &go;
+        ctx[i].stop = &stop;
+        ctx[i].seed = 88675123u + (uint32_t)i * 7919u;
+        ctx[i].write_rate = cfg->write_rate;
+        pthread_create(&threads[i], NULL, i < readers ? reader_thread : writer_thread, &ctx[i]);
+    }
+
+    atomic_store_explicit(&go, true, memory_order_release);
+    struct timespec ts = {.tv_sec = duration_ms / 1000,
+                          .tv_nsec = (long)(duration_ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+    atomic_store_explicit(&stop, true, memory_order_relaxed);
+
+    for (size_t i = 0; i < n; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    double tputs[MAX_READERS];
+    for (size_t i = 0; i < readers; i++) {
+        tputs[i] = (double)ctx[i].ops / ctx[i].duration_sec;
+        res->lookups_per_sec += tputs[i];
+        res->misses += ctx[i].misses;
+    }
+    benchmark_calculate_variance(tputs, (int)readers, &res->mean_reader_tput, &res->cv);
+    if (n > readers) res->writes_per_sec = (double)ctx[readers].ops / ctx[readers].duration_sec;
+
+    neigh_env_destroy(&env);
+    return 0;
+}
+
+/* ── Output ───────────────────────────────────────────────────────── */
+
+/* Lookup rate of one reader on the same table size: the base of the scaling factor. */
+static double single_reader_tput(const point_result_t *res, size_t count, size_t size) {
+    for (size_t i = 0; i < count; i++) {
+        if (res[i].size == size && res[i].readers == 1) return res[i].lookups_per_sec;
+    }
+    return 0.0;
+}
+
+static void output_human(const bench_config_t *cfg, const point_result_t *res, size_t count,
+                         double overhead_ns) {
+    printf("=-> Neighbour Table Lookup Benchmark <-=\n");
+
+    printf("Settings:\n");
+    printf("    Table:      %s\n", cfg->family == 6 ? "NDP (ndp_get_mac)" : "ARP (arp_get_mac)");
+    printf("    Duration:   %d ms per point\n", cfg->duration_ms);
+    if (cfg->write_rate > 0) {
+        printf("    Writer:     %zu MAC changes/s\n", cfg->write_rate);
+    } else {
+        printf("    Writer:     none\n");
+    }
+    printf("    Warm-up:    %s\n", cfg->warmup ? "Yes" : "No");
+    printf("    Timing overhead: %.1f ns\n\n", overhead_ns);
+
+    printf("%10s %8s %14s %14s %8s %10s %10s\n", "Entries", "Readers", "M lookups/s",
+           "M/s per reader", "CV", "Scaling", "Writes/s");
+    for (size_t i = 0; i < count; i++) {
+        const point_result_t *r = &res[i];
+        double base = single_reader_tput(res, count, r->size);
+        printf("%10zu %8zu %14.2f %14.2f %8.3f", r->size, r->readers, r->lookups_per_sec / 1e6,
+               r->mean_reader_tput / 1e6, r->cv);
+        if (base > 0.0) {
+            printf(" %9.2fx", r->lookups_per_sec / base);
+        } else {
+            printf(" %10s", "-");
+        }
+        printf(" %10.0f\n", r->writes_per_sec);
+        if (r->misses > 0) {
+            printf("    WARNING: %lu lookups missed a present neighbour\n",
+                   (unsigned long)r->misses);
+        }
+    }
+}
+
+static void output_json(const bench_config_t *cfg, const point_result_t *res, size_t count,
+                        double overhead_ns, FILE *out) {
+    system_info_t sysinfo;
+    benchmark_get_system_info(&sysinfo);
+
+    json_ctx_t ctx;
+    json_init(&ctx, out);
+    json_begin_object(&ctx);
+
+    json_key_string(&ctx, "benchmark", "neigh_lookup");
+
+    /* System info. */
+    json_begin_nested_object(&ctx, "system_info");
+    json_key_string(&ctx, "cpu_model", sysinfo.cpu_model);
+    json_key_int(&ctx, "num_cores", sysinfo.num_cores);
+    json_key_int(&ctx, "l1d_cache_kb", sysinfo.l1d_cache_kb);
+    json_key_int(&ctx, "l2_cache_kb", sysinfo.l2_cache_kb);
+    json_key_int(&ctx, "l3_cache_kb", sysinfo.l3_cache_kb);
+    json_key_int(&ctx, "numa_nodes", sysinfo.numa_nodes);
+    json_end_object(&ctx);
+
+    /* Config. */
+    json_begin_nested_object(&ctx, "config");
+    json_key_string(&ctx, "table", cfg->family == 6 ? "ndp" : "arp");
+    json_key_int(&ctx, "duration_ms", cfg->duration_ms);
+    json_key_int(&ctx, "write_rate", (int64_t)cfg->write_rate);
+    json_key_bool(&ctx, "warmup", cfg->warmup);
+    json_end_object(&ctx);
+
+    /* Results: one object per sweep point, so bm_compare.py can name it. */
+    json_begin_nested_object(&ctx, "results");
+    for (size_t i = 0; i < count; i++) {
+        const point_result_t *r = &res[i];
+        double base = single_reader_tput(res, count, r->size);
+        char key[48];
+        snprintf(key, sizeof(key), "entries_%zu_readers_%zu", r->size, r->readers);
+        json_begin_nested_object(&ctx, key);
+        json_key_int(&ctx, "entries", (int64_t)r->size);
+        json_key_int(&ctx, "readers", (int64_t)r->readers);
+        json_key_double(&ctx, "lookups_per_sec", r->lookups_per_sec);
+        json_key_double(&ctx, "mean_reader_lookups_per_sec", r->mean_reader_tput);
+        json_key_double(&ctx, "coefficient_of_variation", r->cv);
+        if (base > 0.0) json_key_double(&ctx, "scaling_factor", r->lookups_per_sec / base);
+        json_key_double(&ctx, "writes_per_sec", r->writes_per_sec);
+        json_key_int(&ctx, "misses", (int64_t)r->misses);
+        json_end_object(&ctx);
+    }
+    json_key_double(&ctx, "measurement_overhead_ns", overhead_ns);
+    json_end_object(&ctx); /* results */
+
+    json_end_object(&ctx); /* root */
+    fprintf(out, "\n");
+}
+
+/* ── CLI ──────────────────────────────────────────────────────────── */
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [OPTIONS]\n\n", prog);
+    printf("Options:\n");
+    printf("    -s, --sizes=LIST      Neighbours in the table (default: 256,4096,65536)\n");
+    printf("    -r, --readers=LIST    Reader thread counts, max %d (default: 1,2,4)\n",
+           MAX_READERS);
+    printf("    -d, --duration-ms=N   Duration of each point (default: 1000)\n");
+    printf("    -w, --write-rate=N    MAC changes per second, 0 = no writer (default: 1000)\n");
+    printf("    -6, --ipv6            NDP table instead of ARP\n");
+    printf("    -W, --warmup          Enable warm-up phase\n");
+    printf("    -j, --json            Output JSON format\n");
+    printf("    -o, --output=FILE     Write to file instead of stdout\n");
+    printf("    -h, --help            Show this help\n\n");
+    printf("Examples:\n");
+    printf("    %s --readers=1,2,4,8 --write-rate=100000\n", prog);
+    printf("    %s --ipv6 --sizes=1024 --json > out.json\n", prog);
+}
+
+static int parse_args(int argc, char **argv, bench_config_t *cfg) {
+    static struct option long_options[] = {{"sizes", required_argument, NULL, 's'},
+                                           {"readers", required_argument, NULL, 'r'},
+                                           {"duration-ms", required_argument, NULL, 'd'},
+                                           {"write-rate", required_argument, NULL, 'w'},
+                                           {"ipv6", no_argument, NULL, '6'},
+                                           {"warmup", no_argument, NULL, 'W'},
+                                           {"json", no_argument, NULL, 'j'},
+                                           {"output", required_argument, NULL, 'o'},
+                                           {"help", no_argument, NULL, 'h'},
+                                           {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:r:d:w:6Wjo:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            cfg->num_sizes = benchmark_parse_list("sizes", cfg->sizes, MAX_POINTS);
+            break;
+        case 'r':
+            cfg->num_readers = benchmark_parse_list("readers", cfg->readers, MAX_POINTS);
+            for (size_t i = 0; i < cfg->num_readers; i++) {
+                if (cfg->readers[i] > MAX_READERS) {
+                    fprintf(stderr, "Error: readers must be 1-%d\n", MAX_READERS);
+                    return -1;
+                }
+            }
+            break;
+        case 'd':
+            cfg->duration_ms = benchmark_parse_int("duration-ms");
+            if (cfg->duration_ms <= 0) {
+                fprintf(stderr, "Error: duration-ms must be > 0\n");
+                return -1;
+            }
+            break;
+        case 'w':
+            cfg->write_rate = benchmark_parse_size_t("write-rate");
+            break;
+        case '6':
+            cfg->family = 6;
+            break;
+        case 'W':
+            cfg->warmup = true;
+            break;
+        case 'j':
+            cfg->json_output = true;
+            break;
+        case 'o':
+            cfg->output_file = optarg;
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* ── Main ─────────────────────────────────────────────────────────── */
+
+int main(int argc, char **argv) {
+    bench_config_t cfg = default_config();
+    if (parse_args(argc, argv, &cfg) != 0) return EXIT_FAILURE;
+
+    double overhead_ns = benchmark_measure_timing_overhead();
+
+    /* Warm-up: a short point with the most readers, to get every core out of idle. */
+    if (cfg.warmup) {
+        point_result_t warm;
+        if (!cfg.json_output) printf("Warm-up start.\n");
+        run_point(&cfg, cfg.sizes[0], cfg.readers[cfg.num_readers - 1], 200, &warm);
+    }
+
+    point_result_t res[MAX_POINTS * MAX_POINTS];
+    size_t count = 0;
+    for (size_t s = 0; s < cfg.num_sizes; s++) {
+        for (size_t r = 0; r < cfg.num_readers; r++) {
+            if (!cfg.json_output) {
+                printf("Entries: %zu, readers: %zu...\n", cfg.sizes[s], cfg.readers[r]);
+            }
+            if (run_point(&cfg, cfg.sizes[s], cfg.readers[r], cfg.duration_ms, &res[count]) !=
+                0) {
+                fprintf(stderr, "Error: table of %zu entries failed\n", cfg.sizes[s]);
+                return EXIT_FAILURE;
+            }
+            count++;
+        }
+    }
+
+    FILE *out = stdout;
+    if (cfg.output_file) {
+        out = fopen(cfg.output_file, "w");
+        if (!out) {
+            perror("fopen");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (cfg.json_output) {
+        output_json(&cfg, res, count, overhead_ns, out);
+    } else {
+        output_human(&cfg, res, count, overhead_ns);
+    }
+
+    if (cfg.output_file) fclose(out);
+    return EXIT_SUCCESS;
+}
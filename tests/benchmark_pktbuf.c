@@ -12,6 +12,7 @@
 
 #include <getopt.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,6 +26,8 @@ typedef struct {
     int num_threads;         // Number of worker threads.
     size_t ops_per_thread;   // Alloc/free ops per thread.
     size_t pool_capacity;    // Total buffers in global pool.
+    size_t cache_size;       // Per-thread cache (buffers); small values stress the global list.
+    unsigned int burst;      // Buffers per op: 1 = pktbuf_alloc/free, more = the bulk calls.
     bool warmup;             // Enable warm-up phase.
     bool json_output;        // Enable JSON output.
     const char *output_file; // NULL = stdout, otherwise write to file.
@@ -36,6 +39,8 @@ static bench_config_t default_config(void) {
     cfg.num_threads = 4;
     cfg.ops_per_thread = 50000000;
     cfg.pool_capacity = 4096;
+    cfg.cache_size = PKTBUF_CACHE_DEFAULT;
+    cfg.burst = 1;
     cfg.warmup = false;
     cfg.json_output = false;
     cfg.output_file = NULL;
@@ -46,6 +51,7 @@ static bench_config_t default_config(void) {
 typedef struct {
     pktbuf_pool_t *pool;   // Shared pool.
     size_t ops_to_perform; // How many ops this thread should do.
+    unsigned int burst;    // Buffers per op.
     int thread_id;
 
     // Results after thread is done:
@@ -64,8 +70,22 @@ static void *worker_thread(void *arg) {
 
     double start = benchmark_get_time();
 
+    // Burst mode: alloc a burst, touch every buffer, free the burst.
+    if (ctx->burst > 1) {
+        pktbuf_t *bufs[PKTBUF_CACHE_MAX];
+        for (size_t i = 0; i < ctx->ops_to_perform; i++) {
+            unsigned int got = pktbuf_alloc_bulk(ctx->pool, bufs, ctx->burst);
+            for (unsigned int k = 0; k < got; k++) {
+                volatile uint8_t *data = bufs[k]->data;
+                data[0] = (uint8_t)(i & 0xFF);
+            }
+            pktbuf_free_bulk(ctx->pool, bufs, got);
+            completed += (got == ctx->burst);
+        }
+    }
+
     // Alloc buffer, simulate using its data, then free it.
-    for (size_t i = 0; i < ctx->ops_to_perform; i++) {
+    for (size_t i = 0; ctx->burst == 1 && i < ctx->ops_to_perform; i++) {
         pktbuf_t *b = pktbuf_alloc(ctx->pool);
         if (b) {
             /*
@@ -81,7 +101,7 @@ static void *worker_thread(void *arg) {
             completed++;
         } else {
             // Pool exhausted.
-            // Should be: (pool_capacity >= num_threads * LOCAL_CACHE_SIZE).
+            // Should be: (pool_capacity >= num_threads * cache size).
             fprintf(stderr,
                     "WARNING: Thread %d: pktbuf_alloc() returned NULL "
                     "(pool exhausted)\n",
@@ -90,6 +110,7 @@ static void *worker_thread(void *arg) {
     }
 
     double end = benchmark_get_time();
+    pktbuf_thread_flush(); // The thread is about to exit: don't strand its cache.
     ctx->ops_completed = completed;
     ctx->duration_sec = end - start;
     ctx->ops_per_sec = (double)ctx->ops_completed / ctx->duration_sec;
@@ -112,7 +133,7 @@ static void *worker_thread(void *arg) {
     - Steady state: cache warm = much lower latency
     - We only care about steady state.
 */
-static void warmup_phase(pktbuf_pool_t *pool, int num_threads) {
+static void warmup_phase(pktbuf_pool_t *pool, int num_threads, unsigned int burst) {
     printf("Warming up (%d threads)...\n", num_threads);
 
     pthread_t *threads = malloc(sizeof(pthread_t) * (size_t)num_threads);
@@ -124,6 +145,7 @@ static void warmup_phase(pktbuf_pool_t *pool, int num_threads) {
     for (int i = 0; i < num_threads; i++) {
         contexts[i].pool = pool;
         contexts[i].ops_to_perform = warmup_ops;
+        contexts[i].burst = burst;
         contexts[i].thread_id = i;
         contexts[i].ops_completed = 0;
 
@@ -148,20 +170,31 @@ typedef struct {
     double mean_thread_tput;   // Mean per-thread throughput.
     double cv;                 // Coefficient of variation (load balance).
     bool huge_pages_used;
+
+    // Global-list traffic of the measured run (pool telemetry).
+    uint64_t refills;
+    uint64_t flushes;
+    uint64_t cas_retries;
+    uint64_t alloc_failures;
 } benchmark_result_t;
 
 static benchmark_result_t run_benchmark(const bench_config_t *cfg) {
     // Pool sizing must be:
-    // LOCAL_CACHE_SIZE(64) * num_threads with headroom.
+    // cache size (default 64) * num_threads with headroom.
     // Headroom, because there can be imbalance, some threads allocate more,
     // than others.
-    pktbuf_pool_t pool;
+    static pktbuf_pool_t pool;
     pktbuf_pool_init(&pool, cfg->pool_capacity);
+    pktbuf_pool_set_cache_size(&pool, cfg->cache_size);
     bool hugepgs = pool.use_hugepages;
 
     if (cfg->warmup) {
-        warmup_phase(&pool, cfg->num_threads);
+        warmup_phase(&pool, cfg->num_threads, cfg->burst);
     }
+    atomic_store(&pool.refills, 0);
+    atomic_store(&pool.flushes, 0);
+    atomic_store(&pool.cas_retries, 0);
+    atomic_store(&pool.alloc_failures, 0);
 
     pthread_t *threads = malloc(sizeof(pthread_t) * (size_t)cfg->num_threads);
     worker_ctx_t *contexts = malloc(sizeof(worker_ctx_t) * (size_t)cfg->num_threads);
@@ -169,6 +202,7 @@ static benchmark_result_t run_benchmark(const bench_config_t *cfg) {
     for (int i = 0; i < cfg->num_threads; i++) {
         contexts[i].pool = &pool;
         contexts[i].ops_to_perform = cfg->ops_per_thread;
+        contexts[i].burst = cfg->burst;
         contexts[i].thread_id = i;
         contexts[i].ops_completed = 0;
         contexts[i].duration_sec = 0.0;
@@ -204,6 +238,11 @@ static benchmark_result_t run_benchmark(const bench_config_t *cfg) {
     benchmark_calculate_variance(thread_tputs, cfg->num_threads, &result.mean_thread_tput,
                                  &result.cv);
 
+    result.refills = atomic_load(&pool.refills);
+    result.flushes = atomic_load(&pool.flushes);
+    result.cas_retries = atomic_load(&pool.cas_retries);
+    result.alloc_failures = atomic_load(&pool.alloc_failures);
+
     // Cleanup.
     free(thread_tputs);
     free(threads);
@@ -227,6 +266,8 @@ static void output_human(const bench_config_t *cfg, const benchmark_result_t *si
     printf("    Threads:    %d\n", cfg->num_threads);
     printf("    Ops/Thread: %zu\n", cfg->ops_per_thread);
     printf("    Pool Size:  %zu buffers\n", cfg->pool_capacity);
+    printf("    Cache:      %zu buffers/thread\n", cfg->cache_size);
+    printf("    Burst:      %u\n", cfg->burst);
     printf("    Warm-up:    %s\n", cfg->warmup ? "Yes" : "No");
     printf("    Timing overhead   %.1f ns\n\n", overhead_ns);
     printf("    Huge Pages: %s\n", single->huge_pages_used ? "Yes" : "No");
@@ -238,6 +279,15 @@ static void output_human(const bench_config_t *cfg, const benchmark_result_t *si
     printf("    Load balance (CV): %.4f (%.1f%%)\n", multi->cv, multi->cv * 100.0);
     printf("\n");
 
+    // Retries per global-list transfer: the cost of contention on the stack head.
+    uint64_t transfers = multi->refills + multi->flushes;
+    printf("Global free list (%d threads):\n", cfg->num_threads);
+    printf("    Refills: %lu  Flushes: %lu  Alloc failures: %lu\n", (unsigned long)multi->refills,
+           (unsigned long)multi->flushes, (unsigned long)multi->alloc_failures);
+    printf("    CAS retries: %lu (%.3f per transfer)\n", (unsigned long)multi->cas_retries,
+           transfers ? (double)multi->cas_retries / (double)transfers : 0.0);
+    printf("\n");
+
     double scaling_factor = multi->total_ops_per_sec / single->total_ops_per_sec;
     double efficiency = (scaling_factor / (double)cfg->num_threads) * 100.0;
 
@@ -281,6 +331,8 @@ static void output_json(const bench_config_t *cfg, const benchmark_result_t *sin
     json_key_int(&ctx, "num_threads", cfg->num_threads);
     json_key_int(&ctx, "ops_per_thread", (int64_t)cfg->ops_per_thread);
     json_key_int(&ctx, "pool_capacity", (int64_t)cfg->pool_capacity);
+    json_key_int(&ctx, "cache_size", (int64_t)cfg->cache_size);
+    json_key_int(&ctx, "burst", cfg->burst);
     json_key_bool(&ctx, "warmup", cfg->warmup);
     json_key_bool(&ctx, "huge_pages", single->huge_pages_used);
     json_end_object(&ctx);
@@ -299,6 +351,10 @@ static void output_json(const bench_config_t *cfg, const benchmark_result_t *sin
     json_key_double(&ctx, "duration_sec", multi->total_duration_sec);
     json_key_double(&ctx, "mean_thread_ops_per_sec", multi->mean_thread_tput);
     json_key_double(&ctx, "coefficient_of_variation", multi->cv);
+    json_key_int(&ctx, "refills", (int64_t)multi->refills);
+    json_key_int(&ctx, "flushes", (int64_t)multi->flushes);
+    json_key_int(&ctx, "cas_retries", (int64_t)multi->cas_retries);
+    json_key_int(&ctx, "alloc_failures", (int64_t)multi->alloc_failures);
 
     double scaling_factor = multi->total_ops_per_sec / single->total_ops_per_sec;
     json_key_double(&ctx, "scaling_factor", scaling_factor);
@@ -324,6 +380,10 @@ static void print_usage(const char *prog) {
     printf("    -t, --threads=N     Number of threads (default: 4)\n");
     printf("    -n, --ops=N         Operations per thread (default: 50000000)\n");
     printf("    -p, --pool-size=N   Pool capacity (default: 4096)\n");
+    printf("    -c, --cache=N       Per-thread cache size, 2..%d (default: %d)\n", PKTBUF_CACHE_MAX,
+           PKTBUF_CACHE_DEFAULT);
+    printf("    -b, --burst=N       Buffers per op via the bulk API, 1..%d (default: 1)\n",
+           PKTBUF_CACHE_MAX);
     printf("    -w, --warmup        Enable warm-up-phase\n");
     printf("    -j, --json          Output JSON format\n");
     printf("    -o, --output-FILE   Write to file instead of stdout\n");
@@ -331,6 +391,7 @@ static void print_usage(const char *prog) {
     printf("Examples:\n");
     printf("    %s --threads=8 --ops=100000000\n", prog);
     printf("    %s --threads=4  --warmup --json > out.json\n", prog);
+    printf("    %s --threads=$(nproc) --cache=2 --burst=32   (stress the global list)\n", prog);
 }
 
 int main(int argc, char **argv) {
@@ -339,6 +400,8 @@ int main(int argc, char **argv) {
     static struct option long_options[] = {{"threads", required_argument, NULL, 't'},
                                            {"ops", required_argument, NULL, 'n'},
                                            {"pool-size", required_argument, NULL, 'p'},
+                                           {"cache", required_argument, NULL, 'c'},
+                                           {"burst", required_argument, NULL, 'b'},
                                            {"warmup", no_argument, NULL, 'w'},
                                            {"json", no_argument, NULL, 'j'},
                                            {"output", required_argument, NULL, 'o'},
@@ -348,7 +411,7 @@ int main(int argc, char **argv) {
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "t:n:p:wjo:h", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "t:n:p:c:b:wjo:h", long_options, NULL)) != -1) {
         switch (opt) {
         case 't':
             cfg.num_threads = benchmark_parse_int("threads");
@@ -371,6 +434,22 @@ int main(int argc, char **argv) {
                 return EXIT_FAILURE;
             }
             break;
+        case 'c':
+            cfg.cache_size = benchmark_parse_size_t("cache");
+            if (cfg.cache_size < 2 || cfg.cache_size > PKTBUF_CACHE_MAX) {
+                fprintf(stderr, "Error: cache must be 2..%d\n", PKTBUF_CACHE_MAX);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'b': {
+            size_t burst = benchmark_parse_size_t("burst");
+            if (burst == 0 || burst > PKTBUF_CACHE_MAX) {
+                fprintf(stderr, "Error: burst must be 1..%d\n", PKTBUF_CACHE_MAX);
+                return EXIT_FAILURE;
+            }
+            cfg.burst = (unsigned int)burst;
+            break;
+        }
         case 'w':
             cfg.warmup = true;
             break;
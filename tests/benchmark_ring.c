@@ -0,0 +1,403 @@
+/*
+    Benchmark the SPSC ring between two cores, against the burst size.
+
+    One producer thread pushes sequence numbers with ring_push_burst(), one
+    consumer pops them with ring_pop_burst() and checks they arrive in order.
+    With head and tail on their own lines and each side caching the other's
+    index, a burst should cost about one cache line transfer of indices plus
+    the slots it fills: the rate per item grows with the burst until the slot
+    lines dominate.
+
+    The two threads are pinned to --cores (default 0,1). Both spin, so they
+    need a core each: two hyperthreads of one core share L1 and L2, two cores
+    of one socket the LLC, and two sockets pay for the interconnect.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "affinity.h"
+#include "benchmark_test.h"
+#include "ring.h"
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_POINTS 16
+#define MAX_BURST 512
+
+/* ── Config ───────────────────────────────────────────────────────── */
+
+typedef struct {
+    size_t bursts[MAX_POINTS];
+    size_t num_points;
+    size_t ring_size;
+    size_t items; /* Per sweep point */
+    int cores[2]; /* Producer, consumer; -1 = not pinned */
+    bool warmup;
+    bool json_output;
+    const char *output_file;
+} bench_config_t;
+
+static bench_config_t default_config(void) {
+    bench_config_t cfg;
+    const size_t bursts[] = {1, 8, 32, 64, 256};
+    memcpy(cfg.bursts, bursts, sizeof(bursts));
+    cfg.num_points = sizeof(bursts) / sizeof(bursts[0]);
+    cfg.ring_size = 1024;
+    cfg.items = 50000000;
+    cfg.cores[0] = 0;
+    cfg.cores[1] = 1;
+    cfg.warmup = false;
+    cfg.json_output = false;
+    cfg.output_file = NULL;
+    return cfg;
+}
+
+/* ── Threads ──────────────────────────────────────────────────────── */
+
+typedef struct {
+    spsc_ring_t *ring;
+    size_t items;
+    unsigned int burst;
+    int core;
+    atomic_bool *go;
+
+    /* Results after the thread is done: */
+    uint64_t stalls;    /* Producer: pushes into a full ring; consumer: pops of an empty one */
+    uint64_t reordered; /* Consumer: items out of sequence, must stay 0 */
+    double duration_sec;
+} side_ctx_t;
+
+static void *producer_thread(void *arg) {
+    side_ctx_t *ctx = (side_ctx_t *)arg;
+    void *objs[MAX_BURST];
+    uintptr_t seq = 1; /* NULL is not a valid item */
+    uint64_t stalls = 0;
+
+    if (ctx->core >= 0) affinity_pin_self(ctx->core);
+    while (!atomic_load_explicit(ctx->go, memory_order_acquire)) {
+    }
+    double start = benchmark_get_time();
+
+    size_t left = ctx->items;
+    while (left > 0) {
+        unsigned int n = left < ctx->burst ? (unsigned int)left : ctx->burst;
+        for (unsigned int k = 0; k < n; k++) {
+            objs[k] = (void *)(seq + k);
+        }
+        unsigned int pushed = ring_push_burst(ctx->ring, objs, n);
+        if (pushed == 0) stalls++;
+        seq += pushed;
+        left -= pushed;
+    }
+
+    ctx->duration_sec = benchmark_get_time() - start;
+    ctx->stalls = stalls;
+    return NULL;
+}
+
+static void *consumer_thread(void *arg) {
+    side_ctx_t *ctx = (side_ctx_t *)arg;
+    void *objs[MAX_BURST];
+    uintptr_t expect = 1;
+    uint64_t stalls = 0;
+    uint64_t reordered = 0;
+
+    if (ctx->core >= 0) affinity_pin_self(ctx->core);
+    while (!atomic_load_explicit(ctx->go, memory_order_acquire)) {
+    }
+    double start = benchmark_get_time();
+
+    size_t left = ctx->items;
+    while (left > 0) {
+        unsigned int n = ring_pop_burst(ctx->ring, objs, ctx->burst);
+        if (n == 0) {
+            stalls++;
+            continue;
+        }
+        for (unsigned int k = 0; k < n; k++) {
+            uintptr_t v = (uintptr_t)objs[k];
+            reordered += v != expect;
+            expect = v + 1;
+        }
+        left -= n;
+    }
+
+    ctx->duration_sec = benchmark_get_time() - start;
+    ctx->stalls = stalls;
+    ctx->reordered = reordered;
+    return NULL;
+}
+
+/* ── Measurement ──────────────────────────────────────────────────── */
+
+typedef struct {
+    size_t burst;
+    double items_per_sec; /* Until the consumer popped the last one */
+    double ns_per_item;
+    uint64_t producer_stalls;
+    uint64_t consumer_stalls;
+    uint64_t reordered;
+} point_result_t;
+
+static int run_point(const bench_config_t *cfg, size_t burst, size_t items,
+                     point_result_t *res) {
+    memset(res, 0, sizeof(*res));
+    res->burst = burst;
+
+    spsc_ring_t ring;
+    if (ring_init(&ring, cfg->ring_size) != 0) return -1;
+
+    atomic_bool go = false;
+    side_ctx_t prod = {.ring = &ring, .items = items, .burst = (unsigned int)burst,
+                       .core = cfg->cores[0], .go = &go};
+    side_ctx_t cons = prod;
+    cons.core = cfg->cores[1];
+
+    pthread_t threads[2];
+    pthread_create(&threads[0], NULL, producer_thread, &prod);
+    pthread_create(&threads[1], NULL, consumer_thread, &cons);
+    atomic_store_explicit(&go, true, memory_order_release);
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+
+    double dur = cons.duration_sec > prod.duration_sec ? cons.duration_sec : prod.duration_sec;
+    res->items_per_sec = (double)items / dur;
+    res->ns_per_item = dur * 1e9 / (double)items;
+    res->producer_stalls = prod.stalls;
+    res->consumer_stalls = cons.stalls;
+    res->reordered = cons.reordered;
+
+    ring_destroy(&ring);
+    return 0;
+}
+
+/* ── Output ───────────────────────────────────────────────────────── */
+
+static void output_human(const bench_config_t *cfg, const point_result_t *res,
+                         double overhead_ns) {
+    printf("=-> SPSC Ring Benchmark <-=\n");
+
+    printf("Settings:\n");
+    printf("    Ring Size: %zu\n", cfg->ring_size);
+    printf("    Items:     %zu per point\n", cfg->items);
+    if (cfg->cores[0] >= 0) {
+        printf("    Cores:     producer %d, consumer %d\n", cfg->cores[0], cfg->cores[1]);
+    } else {
+        printf("    Cores:     not pinned\n");
+    }
+    printf("    Warm-up:   %s\n", cfg->warmup ? "Yes" : "No");
+    printf("    Timing overhead: %.1f ns\n\n", overhead_ns);
+
+    printf("%8s %12s %10s %14s %14s\n", "Burst", "M items/s", "ns/item", "Full pushes",
+           "Empty pops");
+    for (size_t i = 0; i < cfg->num_points; i++) {
+        const point_result_t *r = &res[i];
+        printf("%8zu %12.2f %10.2f %14lu %14lu\n", r->burst, r->items_per_sec / 1e6,
+               r->ns_per_item, (unsigned long)r->producer_stalls,
+               (unsigned long)r->consumer_stalls);
+        if (r->reordered > 0) {
+            printf("    ERROR: %lu items out of order\n", (unsigned long)r->reordered);
+        }
+    }
+}
+
+static void output_json(const bench_config_t *cfg, const point_result_t *res, double overhead_ns,
+                        FILE *out) {
+    system_info_t sysinfo;
+    benchmark_get_system_info(&sysinfo);
+
+    json_ctx_t ctx;
+    json_init(&ctx, out);
+    json_begin_object(&ctx);
+
+    json_key_string(&ctx, "benchmark", "spsc_ring");
+
+    /* System info. */
+    json_begin_nested_object(&ctx, "system_info");
+    json_key_string(&ctx, "cpu_model", sysinfo.cpu_model);
+    json_key_int(&ctx, "num_cores", sysinfo.num_cores);
+    json_key_int(&ctx, "l1d_cache_kb", sysinfo.l1d_cache_kb);
+    json_key_int(&ctx, "l2_cache_kb", sysinfo.l2_cache_kb);
+    json_key_int(&ctx, "l3_cache_kb", sysinfo.l3_cache_kb);
+    json_key_int(&ctx, "numa_nodes", sysinfo.numa_nodes);
+    json_end_object(&ctx);
+
+    /* Config. */
+    json_begin_nested_object(&ctx, "config");
+    json_key_int(&ctx, "ring_size", (int64_t)cfg->ring_size);
+    json_key_int(&ctx, "items", (int64_t)cfg->items);
+    json_key_int(&ctx, "producer_core", cfg->cores[0]);
+    json_key_int(&ctx, "consumer_core", cfg->cores[1]);
+    json_key_bool(&ctx, "warmup", cfg->warmup);
+    json_end_object(&ctx);
+
+    /* Results: one object per sweep point, so bm_compare.py can name it. */
+    json_begin_nested_object(&ctx, "results");
+    for (size_t i = 0; i < cfg->num_points; i++) {
+        const point_result_t *r = &res[i];
+        char key[32];
+        snprintf(key, sizeof(key), "burst_%zu", r->burst);
+        json_begin_nested_object(&ctx, key);
+        json_key_int(&ctx, "burst", (int64_t)r->burst);
+        json_key_double(&ctx, "items_per_sec", r->items_per_sec);
+        json_key_double(&ctx, "ns_per_item", r->ns_per_item);
+        json_key_int(&ctx, "producer_full", (int64_t)r->producer_stalls);
+        json_key_int(&ctx, "consumer_empty", (int64_t)r->consumer_stalls);
+        json_key_int(&ctx, "reordered", (int64_t)r->reordered);
+        json_end_object(&ctx);
+    }
+    json_key_double(&ctx, "measurement_overhead_ns", overhead_ns);
+    json_end_object(&ctx); /* results */
+
+    json_end_object(&ctx); /* root */
+    fprintf(out, "\n");
+}
+
+/* ── CLI ──────────────────────────────────────────────────────────── */
+
+static bool is_power_of_two(size_t n) {
+    return n != 0 && ((n & (n - 1)) == 0);
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [OPTIONS]\n\n", prog);
+    printf("Options:\n");
+    printf("    -b, --bursts=LIST   Burst sizes to sweep, max %d (default: 1,8,32,64,256)\n",
+           MAX_BURST);
+    printf("    -r, --ring-size=N   Ring size, power of 2 (default: 1024)\n");
+    printf("    -n, --items=N       Items per burst size (default: 50000000)\n");
+    printf("    -c, --cores=P,C     Producer and consumer core, -1 = no pinning (default: 0,1)\n");
+    printf("    -W, --warmup        Enable warm-up phase\n");
+    printf("    -j, --json          Output JSON format\n");
+    printf("    -o, --output=FILE   Write to file instead of stdout\n");
+    printf("    -h, --help          Show this help\n\n");
+    printf("Examples:\n");
+    printf("    %s --bursts=32 --cores=2,3\n", prog);
+    printf("    %s --cores=-1 --json > out.json\n", prog);
+}
+
+static int parse_args(int argc, char **argv, bench_config_t *cfg) {
+    static struct option long_options[] = {{"bursts", required_argument, NULL, 'b'},
+                                           {"ring-size", required_argument, NULL, 'r'},
+                                           {"items", required_argument, NULL, 'n'},
+                                           {"cores", required_argument, NULL, 'c'},
+                                           {"warmup", no_argument, NULL, 'W'},
+                                           {"json", no_argument, NULL, 'j'},
+                                           {"output", required_argument, NULL, 'o'},
+                                           {"help", no_argument, NULL, 'h'},
+                                           {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "b:r:n:c:Wjo:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'b':
+            cfg->num_points = benchmark_parse_list("bursts", cfg->bursts, MAX_POINTS);
+            for (size_t i = 0; i < cfg->num_points; i++) {
+                if (cfg->bursts[i] > MAX_BURST) {
+                    fprintf(stderr, "Error: bursts must be 1-%d\n", MAX_BURST);
+                    return -1;
+                }
+            }
+            break;
+        case 'r':
+            cfg->ring_size = benchmark_parse_size_t("ring-size");
+            if (!is_power_of_two(cfg->ring_size)) {
+                fprintf(stderr, "Error: ring-size must be a power of 2 (got %zu)\n",
+                        cfg->ring_size);
+                return -1;
+            }
+            break;
+        case 'n':
+            cfg->items = benchmark_parse_size_t("items");
+            if (cfg->items == 0) {
+                fprintf(stderr, "Error: items must be > 0\n");
+                return -1;
+            }
+            break;
+        case 'c':
+            if (strcmp(optarg, "-1") == 0) {
+                cfg->cores[0] = cfg->cores[1] = -1;
+            } else if (affinity_parse_core_list(optarg, cfg->cores, 2) != 2) {
+                fprintf(stderr, "Error: cores must be two different core ids, e.g. 0,1\n");
+                return -1;
+            }
+            break;
+        case 'W':
+            cfg->warmup = true;
+            break;
+        case 'j':
+            cfg->json_output = true;
+            break;
+        case 'o':
+            cfg->output_file = optarg;
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    int ncores = affinity_get_num_cores();
+    for (int i = 0; i < 2; i++) {
+        if (cfg->cores[i] >= ncores) {
+            fprintf(stderr, "Warning: core %d not available, threads are not pinned\n",
+                    cfg->cores[i]);
+            cfg->cores[0] = cfg->cores[1] = -1;
+            break;
+        }
+    }
+    return 0;
+}
+
+/* ── Main ─────────────────────────────────────────────────────────── */
+
+int main(int argc, char **argv) {
+    bench_config_t cfg = default_config();
+    if (parse_args(argc, argv, &cfg) != 0) return EXIT_FAILURE;
+
+    double overhead_ns = benchmark_measure_timing_overhead();
+
+    /* Warm-up: a tenth of a point at the largest burst, to get both cores out of idle. */
+    if (cfg.warmup) {
+        point_result_t warm;
+        if (!cfg.json_output) printf("Warm-up start.\n");
+        run_point(&cfg, cfg.bursts[cfg.num_points - 1], cfg.items / 10 + 1, &warm);
+    }
+
+    point_result_t res[MAX_POINTS];
+    for (size_t i = 0; i < cfg.num_points; i++) {
+        if (!cfg.json_output) printf("Burst: %zu...\n", cfg.bursts[i]);
+        if (run_point(&cfg, cfg.bursts[i], cfg.items, &res[i]) != 0) {
+            fprintf(stderr, "Error: ring_init failed\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE *out = stdout;
+    if (cfg.output_file) {
+        out = fopen(cfg.output_file, "w");
+        if (!out) {
+            perror("fopen");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (cfg.json_output) {
+        output_json(&cfg, res, overhead_ns, out);
+    } else {
+        output_human(&cfg, res, overhead_ns);
+    }
+
+    if (cfg.output_file) fclose(out);
+    return EXIT_SUCCESS;
+}
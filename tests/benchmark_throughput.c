@@ -4,26 +4,46 @@
     This benchmark measures the maximum processing speed of UPE. It removes the network hardware
     from the picture by creating a __Synthetic NIC__ (main thread) that generates packets in memory
     and pushes them into SPSC ring buffers.
+
+    Before that, a short single-threaded phase compares the parser alone: one parse_flow_key()
+    call per packet against parse_flow_key_burst(), over buffers that are not in the cache.
+
+    With --pcap the Synthetic NIC replays a capture instead: the file is mmap'd and indexed
+    before the run, and each frame goes through the real RX path (rx_dispatch(): flow hash,
+    RETA, staging batches, early drop) into the worker rings. Real traffic mixes sizes,
+    protocols and flows, which one synthetic packet shape does not.
 */
 
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE /* MAP_POPULATE */
 
 #include "arp_table.h"
 #include "benchmark_test.h"
+#include "latency.h"
 #include "ndp_table.h"
+#include "parser.h"
 #include "pktbuf.h"
 #include "ring.h"
+#include "reta.h"
+#include "rule_file.h"
 #include "rule_table.h"
+#include "rx.h"
 #include "tx.h"
 #include "worker.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
 volatile sig_atomic_t g_stop = 0;
 
@@ -41,6 +61,13 @@ int tx_send_batch(const tx_ctx_t *tx, const uint8_t *const *frames, const size_t
     return count;
 }
 
+/* Dummy pcap backend for rx.c: the replay feeds rx_dispatch() itself, without libpcap. */
+int rx_pcap_run(rx_ctx_t *rx) {
+    (void)rx;
+    return -1;
+}
+void rx_pcap_stop(void) {}
+
 #define MAX_BATCH_SIZE 256
 #define MAX_WORKERS 16
 
@@ -56,6 +83,15 @@ typedef struct {
     bool warmup;
     bool json_output;
     const char *output_file;
+    idle_mode_t idle_mode;
+    size_t rate_pps; /* Producer rate, 0 = as fast as possible */
+
+    /* Trace replay (--pcap): pacing is rate_pps, speed or line_rate_gbps, at most one. */
+    const char *pcap_file;
+    const char *rules_file; /* Rules for the workers, default: one TCP forward rule */
+    double speed;           /* Original timestamps, sped up this many times; 0 = off */
+    double line_rate_gbps;  /* Frames back to back on a link of this rate; 0 = off */
+    int loops;              /* Passes over the trace, 0 = until the duration ends */
 } bench_config_t;
 
 static bench_config_t default_config(void) {
@@ -69,32 +105,59 @@ static bench_config_t default_config(void) {
     cfg.warmup = false;
     cfg.json_output = false;
     cfg.output_file = NULL;
+    cfg.idle_mode = IDLE_MODE_BACKOFF;
+    cfg.rate_pps = 0;
+    cfg.pcap_file = NULL;
+    cfg.rules_file = NULL;
+    cfg.speed = 0.0;
+    cfg.line_rate_gbps = 0.0;
+    cfg.loops = 0;
     return cfg;
 }
 
 /* ── Environment (shared) ─────────────────────────────────────────── */
 
 typedef struct {
-    pktbuf_pool_t pool;
+    pktbuf_classes_t pools; /* Standard class only, unless a trace brings every size */
     spsc_ring_t *rings;
     rule_table_t rt;
     arp_table_t arpt;
     ndp_table_t ndpt;
     tx_ctx_t tx;
     worker_t *workers;
+    double cycles_per_ns;
 } bench_env_t;
 
 static int setup_env(bench_env_t *env, const bench_config_t *cfg) {
-    pktbuf_pool_init(&env->pool, cfg->pool_capacity);
+    env->cycles_per_ns = latency_calibrate_tsc();
+    worker_set_idle_mode(cfg->idle_mode);
+    worker_set_tsc_calibration(env->cycles_per_ns);
+    if (cfg->pcap_file) {
+        /* Small and standard frames get a full pool each, jumbo frames are rare. */
+        size_t jumbo = cfg->pool_capacity / 16 > 64 ? cfg->pool_capacity / 16 : 64;
+        const size_t capacity[PKTBUF_CLASSES] = {cfg->pool_capacity, cfg->pool_capacity, jumbo};
+        if (pktbuf_classes_init(&env->pools, capacity, PKTBUF_HEADROOM, -1) != 0) return -1;
+    } else {
+        const size_t capacity[PKTBUF_CLASSES] = {0, cfg->pool_capacity, 0};
+        if (pktbuf_classes_init(&env->pools, capacity, PKTBUF_HEADROOM, -1) != 0) return -1;
+    }
 
     env->rings = malloc(sizeof(spsc_ring_t) * (size_t)cfg->num_workers);
     for (int i = 0; i < cfg->num_workers; i++) {
         ring_init(&env->rings[i], cfg->ring_size);
     }
 
-    rule_table_init(&env->rt, 1024);
-    rule_t r = {.priority = 10, .protocol = 6, .action = {.type = ACT_FWD, .out_ifindex = 1}};
-    rule_table_add(&env->rt, &r);
+    if (cfg->rules_file) {
+        if (rule_table_load(cfg->rules_file, &env->rt) != 0) {
+            fprintf(stderr, "Error: cannot load rules from %s\n", cfg->rules_file);
+            return -1;
+        }
+    } else {
+        rule_table_init(&env->rt, 1024);
+        rule_t r = {.priority = 10, .protocol = 6, .action = {.type = ACT_FWD, .out_ifindex = 1}};
+        rule_table_add(&env->rt, &r);
+        rule_table_compile(&env->rt);
+    }
 
     arp_table_init(&env->arpt, 1024);
     uint32_t dst_ip = (10U << 24) | (128U << 16) | (0U << 8) | 2U;
@@ -106,9 +169,9 @@ static int setup_env(bench_env_t *env, const bench_config_t *cfg) {
     memset(&env->tx, 0, sizeof(env->tx));
     env->tx.eth_addr[5] = 0xbb;
 
-    env->workers = malloc(sizeof(worker_t) * (size_t)cfg->num_workers);
+    env->workers = aligned_alloc(CACHE_LINE_SIZE, sizeof(worker_t) * (size_t)cfg->num_workers);
     for (int i = 0; i < cfg->num_workers; i++) {
-        worker_init(&env->workers[i], i, -1, &env->rings[i], &env->pool, &env->rt, &env->tx,
+        worker_init(&env->workers[i], i, -1, &env->rings[i], &env->pools, &env->rt, &env->tx,
                     &env->arpt, &env->ndpt);
     }
 
@@ -121,7 +184,7 @@ static void teardown_env(bench_env_t *env, int num_workers) {
     }
     free(env->workers);
 
-    pktbuf_pool_destroy(&env->pool);
+    pktbuf_classes_destroy(&env->pools);
 
     for (int i = 0; i < num_workers; i++) {
         ring_destroy(&env->rings[i]);
@@ -174,6 +237,89 @@ static void build_dummy_packet(pktbuf_t *b, int packet_size) {
     p[12] = 0x50; // Data offset: 5 words (20 bytes).
 }
 
+/* ── Parser Phase ─────────────────────────────────────────────────── */
+
+/*
+    Buffers for the parser phase: ~36 MB, more than the LLC, so every packet's
+    headers come from memory like they do after a NIC DMA.
+*/
+#define PARSER_BUFS 16384
+#define PARSER_PASSES 8
+
+typedef struct {
+    double scalar_cycles; /* TSC cycles per packet */
+    double burst_cycles;
+} parser_result_t;
+
+static volatile uint32_t g_parser_sink; /* Keeps the keys alive. */
+
+static parser_result_t run_parser_phase(const bench_config_t *cfg) {
+    parser_result_t res = {0};
+    pktbuf_pool_t pool;
+    pktbuf_t **order = malloc(PARSER_BUFS * sizeof(pktbuf_t *));
+    if (!order || pktbuf_pool_init(&pool, PARSER_BUFS) != 0) {
+        free(order);
+        return res;
+    }
+    if (pktbuf_alloc_bulk(&pool, order, PARSER_BUFS) != PARSER_BUFS) {
+        pktbuf_pool_destroy(&pool);
+        free(order);
+        return res;
+    }
+
+    for (size_t i = 0; i < PARSER_BUFS; i++) {
+        build_dummy_packet(order[i], cfg->packet_size);
+    }
+
+    /* Buffers come back from a pool in no particular order: shuffle, so the
+     * hardware prefetcher cannot guess the next one. */
+    uint32_t x = 2463534242u;
+    for (size_t i = PARSER_BUFS - 1; i > 0; i--) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        size_t j = x % (i + 1);
+        pktbuf_t *t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    unsigned int burst = (unsigned int)(cfg->batch_size < 64 ? cfg->batch_size : 64);
+    size_t total = (size_t)PARSER_PASSES * (PARSER_BUFS / burst) * burst;
+    flow_key_t keys[64];
+    uint32_t sink = 0;
+
+    uint64_t t0 = rdtsc();
+    for (int pass = 0; pass < PARSER_PASSES; pass++) {
+        for (size_t i = 0; i + burst <= PARSER_BUFS; i += burst) {
+            for (unsigned int k = 0; k < burst; k++) {
+                const pktbuf_t *b = order[i + k];
+                if (parse_flow_key(b->data, b->len, &keys[k]) == 0) sink += keys[k].dst_port;
+            }
+        }
+    }
+    uint64_t t1 = rdtsc();
+    for (int pass = 0; pass < PARSER_PASSES; pass++) {
+        for (size_t i = 0; i + burst <= PARSER_BUFS; i += burst) {
+            uint64_t ok = parse_flow_key_burst(&order[i], burst, keys);
+            for (unsigned int k = 0; k < burst; k++) {
+                if (ok & (1ULL << k)) sink += keys[k].dst_port;
+            }
+        }
+    }
+    uint64_t t2 = rdtsc();
+
+    g_parser_sink = sink;
+    res.scalar_cycles = (double)(t1 - t0) / (double)total;
+    res.burst_cycles = (double)(t2 - t1) / (double)total;
+
+    pktbuf_free_bulk(&pool, order, PARSER_BUFS);
+    pktbuf_thread_flush();
+    pktbuf_pool_destroy(&pool);
+    free(order);
+    return res;
+}
+
 /* ── Producer Loop ────────────────────────────────────────────────── */
 
 /*
@@ -195,13 +341,23 @@ static producer_result_t run_producer(const bench_config_t *cfg, pktbuf_pool_t *
     double start = benchmark_get_time();
     double deadline = start + seconds;
     double now = start;
+    uint64_t offered = 0;
 
     while (now < deadline) {
+        if (cfg->rate_pps > 0) {
+            /* Paced: wait for this batch's send time, so workers see gaps. */
+            double due = start + (double)offered / (double)cfg->rate_pps;
+            while ((now = benchmark_get_time()) < due && now < deadline) {
+            }
+            if (now >= deadline) break;
+        }
+
         int actual = 0;
         for (int i = 0; i < cfg->batch_size; i++) {
             pktbuf_t *b = pktbuf_alloc(pool);
             if (!b) break;
             build_dummy_packet(b, cfg->packet_size);
+            b->timestamp = rdtsc();
             batch[actual++] = b;
         }
 
@@ -215,7 +371,9 @@ static producer_result_t run_producer(const bench_config_t *cfg, pktbuf_pool_t *
         }
 
         unsigned int pushed = ring_push_burst(&rings[ring_idx], batch, (unsigned int)actual);
+        if (cfg->idle_mode == IDLE_MODE_WAKEUP) ring_notify(&rings[ring_idx]);
         result.packets_pushed += pushed;
+        offered += (uint64_t)actual;
 
         if (pushed < (unsigned int)actual) {
             result.ring_full_events++;
@@ -237,15 +395,329 @@ static producer_result_t run_producer(const bench_config_t *cfg, pktbuf_pool_t *
     return result;
 }
 
+/* ── Trace Replay ─────────────────────────────────────────────────── */
+
+/*
+    A pcap file, mapped read-only and indexed once before the run: where each
+    frame sits in the mapping and when it is due under the chosen pacing. The
+    replay loop then does what the NIC and the RX thread do: copy the frame
+    into a pool buffer of its size class, stamp it, rx_dispatch() it.
+
+    The frames are not kept in pktbuf_t's of their own from one pass to the
+    next: the workers rewrite headers in place (MACs, TTL) and give the buffer
+    back to the pool, so each pass takes a fresh copy, like a NIC DMA would.
+*/
+#define PCAP_MAGIC_US 0xa1b2c3d4u
+#define PCAP_MAGIC_NS 0xa1b23c4du
+#define PCAP_FILE_HDR 24
+#define PCAP_REC_HDR 16
+#define PCAP_LINKTYPE_ETHERNET 1
+#define WIRE_OVERHEAD 24 /* Preamble, SFD and IFG (20) + the FCS a capture leaves out (4) */
+
+typedef struct {
+    const uint8_t *data; /* Frame bytes, in the mapping */
+    uint32_t len;
+    uint64_t due_ns;     /* Send time from the start of the pass */
+} trace_pkt_t;
+
+typedef struct {
+    uint8_t *map;
+    size_t map_len;
+    trace_pkt_t *pkts;
+    size_t count;
+    uint64_t bytes;   /* Of one pass */
+    uint64_t span_ns; /* First to last timestamp in the file */
+    uint64_t pass_ns; /* One pass under the pacing, 0 = not paced */
+    uint64_t skipped; /* Records left out: truncated, or larger than a jumbo buffer */
+} trace_t;
+
+static uint32_t pcap_u32(const uint8_t *p, bool swap) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+/* What the replay is paced by, for the output. */
+static const char *pacing_name(const bench_config_t *cfg) {
+    if (cfg->rate_pps > 0) return "rate";
+    if (cfg->speed > 0.0) return "timestamps";
+    if (cfg->line_rate_gbps > 0.0) return "line_rate";
+    return "unlimited";
+}
+
+/*
+    Walk the records of the mapped file: count them (`out` NULL), or fill
+    `out` with their frames and original timestamps in ns.
+*/
+static size_t trace_scan(trace_t *t, bool swap, bool nsec, trace_pkt_t *out) {
+    size_t off = PCAP_FILE_HDR;
+    size_t n = 0;
+    t->skipped = 0;
+
+    while (off + PCAP_REC_HDR <= t->map_len) {
+        const uint8_t *h = t->map + off;
+        uint64_t sec = pcap_u32(h, swap);
+        uint64_t frac = pcap_u32(h + 4, swap);
+        uint32_t caplen = pcap_u32(h + 8, swap);
+        off += PCAP_REC_HDR;
+
+        if (caplen > t->map_len - off) {
+            t->skipped++; /* Cut off at the end of the file */
+            break;
+        }
+        if (caplen <= PKTBUF_MAX_SIZE && caplen > 0) {
+            if (out) {
+                out[n].data = t->map + off;
+                out[n].len = caplen;
+                out[n].due_ns = sec * 1000000000ull + (nsec ? frac : frac * 1000ull);
+            }
+            n++;
+        } else {
+            t->skipped++;
+        }
+        off += caplen;
+    }
+    return n;
+}
+
+/*
+    Map `cfg->pcap_file` and index its frames. The send times become offsets
+    from the start of a pass, in the pacing of `cfg`.
+        Returns 0 if successful, -1 if not.
+*/
+static int trace_load(trace_t *t, const bench_config_t *cfg) {
+    memset(t, 0, sizeof(*t));
+
+    int fd = open(cfg->pcap_file, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: cannot open %s: %s\n", cfg->pcap_file, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < PCAP_FILE_HDR) {
+        fprintf(stderr, "Error: %s is not a pcap file\n", cfg->pcap_file);
+        close(fd);
+        return -1;
+    }
+    t->map_len = (size_t)st.st_size;
+
+    /* Populated up front: no page faults on the replay path. */
+    void *map = mmap(NULL, t->map_len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: mmap of %s failed: %s\n", cfg->pcap_file, strerror(errno));
+        return -1;
+    }
+    t->map = map;
+
+    uint32_t magic;
+    memcpy(&magic, t->map, sizeof(magic));
+    bool swap = magic == __builtin_bswap32(PCAP_MAGIC_US) ||
+                magic == __builtin_bswap32(PCAP_MAGIC_NS);
+    bool nsec = pcap_u32(t->map, swap) == PCAP_MAGIC_NS;
+    if (pcap_u32(t->map, swap) != PCAP_MAGIC_US && !nsec) {
+        fprintf(stderr, "Error: %s: not a pcap file (pcapng is not supported)\n",
+                cfg->pcap_file);
+        goto fail;
+    }
+    if ((pcap_u32(t->map + 20, swap) & 0xFFFF) != PCAP_LINKTYPE_ETHERNET) {
+        fprintf(stderr, "Error: %s: link type is not Ethernet\n", cfg->pcap_file);
+        goto fail;
+    }
+
+    t->count = trace_scan(t, swap, nsec, NULL);
+    if (t->count == 0) {
+        fprintf(stderr, "Error: %s has no frames to replay\n", cfg->pcap_file);
+        goto fail;
+    }
+    t->pkts = malloc(t->count * sizeof(trace_pkt_t));
+    if (!t->pkts) {
+        fprintf(stderr, "Error: malloc of the trace index failed\n");
+        goto fail;
+    }
+    trace_scan(t, swap, nsec, t->pkts);
+
+    /* Captures merged from several interfaces can go back in time: never earlier than the
+     * previous frame. */
+    uint64_t first = t->pkts[0].due_ns;
+    uint64_t last = first;
+    for (size_t i = 0; i < t->count; i++) {
+        if (t->pkts[i].due_ns < last) t->pkts[i].due_ns = last;
+        last = t->pkts[i].due_ns;
+        t->bytes += t->pkts[i].len;
+    }
+    t->span_ns = last - first;
+
+    /* Send times under the pacing. A pass lasts one gap longer than its last frame, so
+     * the next one does not start with a burst. */
+    uint64_t wire_bits = 0;
+    for (size_t i = 0; i < t->count; i++) {
+        trace_pkt_t *p = &t->pkts[i];
+        if (cfg->rate_pps > 0) {
+            p->due_ns = (uint64_t)((double)i * 1e9 / (double)cfg->rate_pps);
+        } else if (cfg->speed > 0.0) {
+            p->due_ns = (uint64_t)((double)(p->due_ns - first) / cfg->speed);
+        } else if (cfg->line_rate_gbps > 0.0) {
+            p->due_ns = (uint64_t)((double)wire_bits / cfg->line_rate_gbps);
+            wire_bits += ((uint64_t)p->len + WIRE_OVERHEAD) * 8;
+        } else {
+            p->due_ns = 0;
+        }
+    }
+    if (cfg->rate_pps > 0) {
+        t->pass_ns = (uint64_t)((double)t->count * 1e9 / (double)cfg->rate_pps);
+    } else if (cfg->speed > 0.0) {
+        double gap = t->count > 1 ? (double)t->span_ns / (double)(t->count - 1) : 1e3;
+        t->pass_ns = (uint64_t)(((double)t->span_ns + gap) / cfg->speed);
+    } else if (cfg->line_rate_gbps > 0.0) {
+        t->pass_ns = (uint64_t)((double)wire_bits / cfg->line_rate_gbps);
+    }
+    return 0;
+
+fail:
+    munmap(t->map, t->map_len);
+    t->map = NULL;
+    return -1;
+}
+
+static void trace_unload(trace_t *t) {
+    free(t->pkts);
+    t->pkts = NULL;
+    if (t->map) munmap(t->map, t->map_len);
+    t->map = NULL;
+}
+
+typedef struct {
+    uint64_t frames;          /* Copied into a buffer and dispatched */
+    uint64_t bytes;
+    uint64_t loops;           /* Passes completed */
+    uint64_t nobuf_drops;     /* Every class that fits was empty */
+    uint64_t early_drops;     /* Dropped at a congested ring (rx_early_drop()) */
+    uint64_t ring_full_drops; /* Did not fit in the ring when the batch was pushed */
+} replay_result_t;
+
+/* Packets pushed into the worker rings so far. */
+static uint64_t rings_pushed(const spsc_ring_t *rings, int n) {
+    uint64_t sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += atomic_load_explicit(&rings[i].head, memory_order_relaxed);
+    }
+    return sum;
+}
+
+/*
+    Replay the trace through `rx` for `seconds` seconds, or `loops` passes
+    (0 = no limit), whichever ends first.
+*/
+static producer_result_t run_replay(const bench_env_t *env, rx_ctx_t *rx, const trace_t *t,
+                                    double seconds, int loops, replay_result_t *rep) {
+    producer_result_t result = {0};
+    memset(rep, 0, sizeof(*rep));
+
+    uint64_t pushed_before = rings_pushed(rx->rings, rx->ring_count);
+    uint64_t nobuf_before = rx->nobuf_drops;
+    uint64_t early_before = rx->early_drops;
+    bool paced = t->pass_ns > 0;
+
+    double start = benchmark_get_time();
+    uint64_t tsc_start = rdtsc();
+    uint64_t tsc_deadline = tsc_start + (uint64_t)(seconds * 1e9 * env->cycles_per_ns);
+    bool done = false;
+
+    for (uint64_t pass = 0; !done && (loops == 0 || pass < (uint64_t)loops); pass++) {
+        uint64_t pass_start = (uint64_t)((double)(pass * t->pass_ns) * env->cycles_per_ns);
+
+        for (size_t i = 0; i < t->count; i++) {
+            const trace_pkt_t *p = &t->pkts[i];
+
+            if (paced) {
+                uint64_t due = tsc_start + pass_start +
+                               (uint64_t)((double)p->due_ns * env->cycles_per_ns);
+                uint64_t now = rdtsc();
+                if (now < due) {
+                    /* Nothing on the wire: what RX staged goes out before the wait, as after
+                     * an empty poll. */
+                    rx_flush(rx);
+                    while ((now = rdtsc()) < due && now < tsc_deadline) {
+                    }
+                }
+                if (now >= tsc_deadline) {
+                    done = true;
+                    break;
+                }
+            } else if ((i & (RX_BURST_SIZE - 1)) == 0) {
+                /* Unpaced: one burst per poll, flushed like rx_pcap_run() does. */
+                rx_flush(rx);
+                if (rdtsc() >= tsc_deadline) {
+                    done = true;
+                    break;
+                }
+            }
+
+            pktbuf_t *b = pktbuf_alloc_len(rx->pools, p->len);
+            if (!b) {
+                rx->nobuf_drops++;
+                continue;
+            }
+            memcpy(b->data, p->data, p->len);
+            b->len = p->len;
+            b->timestamp = rdtsc();
+            rx_dispatch(rx, b);
+
+            rep->frames++;
+            rep->bytes += p->len;
+        }
+        if (!done) rep->loops++;
+    }
+    rx_flush(rx);
+
+    /* What is neither in a ring nor dropped early is staged, held by a RETA move, or was
+     * dropped at a full ring. */
+    uint64_t held = rx->reta ? rx->reta->hold_count : 0;
+    result.packets_pushed = rings_pushed(rx->rings, rx->ring_count) - pushed_before;
+    rep->nobuf_drops = rx->nobuf_drops - nobuf_before;
+    rep->early_drops = rx->early_drops - early_before;
+    rep->ring_full_drops = rep->frames - result.packets_pushed - rep->early_drops - held;
+    result.duration_sec = benchmark_get_time() - start;
+    return result;
+}
+
 /* ── Result ───────────────────────────────────────────────────────── */
 
 typedef struct {
     producer_result_t producer;
+    replay_result_t replay; /* --pcap only */
+    const trace_t *trace;   /* NULL: synthetic packets */
+    parser_result_t parser;
     uint64_t per_worker_pkts[MAX_WORKERS];
+    double per_worker_cpu[MAX_WORKERS]; /* Percent of one core during the measurement */
+    latency_histogram_t latency;        /* Producer -> worker done, measurement only */
     int num_workers;
     bool huge_pages_used;
 } bench_result_t;
 
+/* CPU time a (running) thread has used so far, in seconds. */
+static double thread_cpu_time(pthread_t t) {
+    clockid_t cid;
+    struct timespec ts;
+    if (pthread_getcpuclockid(t, &cid) != 0 || clock_gettime(cid, &ts) != 0) return 0.0;
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Samples recorded since `before` was copied from `now`. Min/max are those of `now`, which
+ * bound the window's: latency_percentile() caps at max_ns. */
+static void latency_since(latency_histogram_t *out, const latency_histogram_t *now,
+                          const latency_histogram_t *before) {
+    latency_histogram_init(out);
+    for (unsigned int i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+        out->buckets[i] = now->buckets[i] - before->buckets[i];
+    }
+    out->total_count = now->total_count - before->total_count;
+    out->sum_ns = now->sum_ns - before->sum_ns;
+    out->min_ns = now->min_ns;
+    out->max_ns = now->max_ns;
+}
+
 /* ── Output ───────────────────────────────────────────────────────── */
 
 static void output_human(const bench_config_t *cfg, const bench_result_t *res, double overhead_ns) {
@@ -260,23 +732,70 @@ static void output_human(const bench_config_t *cfg, const bench_result_t *res, d
     printf("    Pool Size:   %zu buffers\n", cfg->pool_capacity);
     printf("    Ring Size:   %zu per worker\n", cfg->ring_size);
     printf("    Batch Size:  %d\n", cfg->batch_size);
-    printf("    Packet Size: %d bytes\n", cfg->packet_size);
+    if (res->trace) {
+        const trace_t *t = res->trace;
+        printf("    Trace:       %s (%zu frames, %.0f bytes avg, %.3f s captured)\n",
+               cfg->pcap_file, t->count, (double)t->bytes / (double)t->count,
+               (double)t->span_ns / 1e9);
+        if (t->skipped > 0) printf("    Skipped:     %lu records\n", (unsigned long)t->skipped);
+        if (cfg->loops > 0) {
+            printf("    Loops:       %d\n", cfg->loops);
+        } else {
+            printf("    Loops:       until the duration ends\n");
+        }
+    } else {
+        printf("    Packet Size: %d bytes\n", cfg->packet_size);
+    }
     printf("    Warm-up:     %s\n", cfg->warmup ? "Yes" : "No");
+    printf("    Idle mode:   %s\n", idle_mode_name(cfg->idle_mode));
+    if (cfg->rate_pps > 0) {
+        printf("    Rate:        %zu pps\n", cfg->rate_pps);
+    } else if (cfg->speed > 0.0) {
+        printf("    Rate:        %.2fx the capture's timestamps\n", cfg->speed);
+    } else if (cfg->line_rate_gbps > 0.0) {
+        printf("    Rate:        line rate of %.2f Gbit/s\n", cfg->line_rate_gbps);
+    } else {
+        printf("    Rate:        unlimited\n");
+    }
     printf("    Timing overhead: %.1f ns\n\n", overhead_ns);
     printf("    Huge Pages: %s\n", res->huge_pages_used ? "Yes" : "No");
 
+    printf("Parser (cold buffers, TSC cycles/packet):\n");
+    printf("    Per packet: %.1f\n", res->parser.scalar_cycles);
+    printf("    Burst:      %.1f\n\n", res->parser.burst_cycles);
+
     printf("Producer:\n");
     printf("    Packets Pushed: %lu\n", (unsigned long)res->producer.packets_pushed);
     printf("    Throughput:   %.2f Mpps\n", push_mpps);
-    printf("    Ring Full Events: %lu\n\n", (unsigned long)res->producer.ring_full_events);
+    if (res->trace) {
+        const replay_result_t *r = &res->replay;
+        printf("    Frames Replayed: %lu (%.2f Gbit/s), %lu loops\n", (unsigned long)r->frames,
+               (double)r->bytes * 8.0 / dur / 1e9, (unsigned long)r->loops);
+        printf("    Dropped: %lu pool empty, %lu early, %lu ring full\n\n",
+               (unsigned long)r->nobuf_drops, (unsigned long)r->early_drops,
+               (unsigned long)r->ring_full_drops);
+    } else {
+        printf("    Ring Full Events: %lu\n\n", (unsigned long)res->producer.ring_full_events);
+    }
 
     uint64_t total_consumed = 0;
     printf("Consumer (per worker):\n");
     for (int i = 0; i < cfg->num_workers; i++) {
         total_consumed += res->per_worker_pkts[i];
         double wmpps = ((double)res->per_worker_pkts[i] / dur) / 1e6;
-        printf("    Worker %d: %lu packets (%.2f Mpps)\n", i,
-               (unsigned long)res->per_worker_pkts[i], wmpps);
+        printf("    Worker %d: %lu packets (%.2f Mpps), CPU %.1f%%\n", i,
+               (unsigned long)res->per_worker_pkts[i], wmpps, res->per_worker_cpu[i]);
+    }
+
+    /* What the idle mode buys: at a paced rate, busy-poll keeps p99 low for a
+     * full core, sleeping costs latency on every wakeup. */
+    if (res->latency.total_count > 0) {
+        printf("\nLatency (producer -> worker done):\n");
+        printf("    Mean: %lu ns\n", (unsigned long)(res->latency.sum_ns / res->latency.total_count));
+        printf("    p50:  %lu ns\n", (unsigned long)latency_percentile(&res->latency, 0.50));
+        printf("    p99:  %lu ns\n", (unsigned long)latency_percentile(&res->latency, 0.99));
+        printf("    p99.9:  %lu ns\n", (unsigned long)latency_percentile(&res->latency, 0.999));
+        printf("    p99.99: %lu ns\n", (unsigned long)latency_percentile(&res->latency, 0.9999));
     }
 
     double consume_mpps = ((double)total_consumed / dur) / 1e6;
@@ -286,7 +805,19 @@ static void output_human(const bench_config_t *cfg, const bench_result_t *res, d
 
     // Backpressure analysis.
     printf("\nAnalysis:\n");
-    if (res->producer.ring_full_events > 0) {
+    if (res->trace) {
+        const replay_result_t *r = &res->replay;
+        uint64_t lost = r->nobuf_drops + r->early_drops + r->ring_full_drops;
+        if (lost > 0) {
+            printf("    RX dropped %.1f%% of the replayed frames.\n",
+                   (double)lost / (double)(r->frames + r->nobuf_drops) * 100.0);
+            if (r->early_drops + r->ring_full_drops > r->nobuf_drops) {
+                printf("    -> Consumer is the bottleneck.\n");
+            }
+        } else {
+            printf("    No RX drops (workers kept up with the replay).\n");
+        }
+    } else if (res->producer.ring_full_events > 0) {
         double full_percent =
             ((double)res->producer.ring_full_events /
              (double)(res->producer.packets_pushed + res->producer.ring_full_events)) *
@@ -332,12 +863,31 @@ static void output_json(const bench_config_t *cfg, const bench_result_t *res, do
     json_key_int(&ctx, "batch_size", cfg->batch_size);
     json_key_int(&ctx, "packet_size", cfg->packet_size);
     json_key_bool(&ctx, "warmup", cfg->warmup);
+    json_key_string(&ctx, "idle_mode", idle_mode_name(cfg->idle_mode));
+    json_key_int(&ctx, "rate_pps", (int64_t)cfg->rate_pps);
     json_key_bool(&ctx, "huge_pages", res->huge_pages_used);
+    if (res->trace) {
+        json_begin_nested_object(&ctx, "replay");
+        json_key_string(&ctx, "pcap_file", cfg->pcap_file);
+        json_key_int(&ctx, "frames", (int64_t)res->trace->count);
+        json_key_int(&ctx, "bytes", (int64_t)res->trace->bytes);
+        json_key_int(&ctx, "skipped", (int64_t)res->trace->skipped);
+        json_key_string(&ctx, "pacing", pacing_name(cfg));
+        json_key_double(&ctx, "speed", cfg->speed);
+        json_key_double(&ctx, "line_rate_gbps", cfg->line_rate_gbps);
+        json_key_int(&ctx, "loops", cfg->loops);
+        json_end_object(&ctx);
+    }
     json_end_object(&ctx);
 
     /* Results. */
     json_begin_nested_object(&ctx, "results");
 
+    json_begin_nested_object(&ctx, "parser");
+    json_key_double(&ctx, "scalar_cycles_per_pkt", res->parser.scalar_cycles);
+    json_key_double(&ctx, "burst_cycles_per_pkt", res->parser.burst_cycles);
+    json_end_object(&ctx);
+
     json_begin_nested_object(&ctx, "producer");
     json_key_int(&ctx, "packets_pushed", (int64_t)res->producer.packets_pushed);
     json_key_double(&ctx, "throughput_mpps", ((double)res->producer.packets_pushed / dur) / 1e6);
@@ -345,6 +895,19 @@ static void output_json(const bench_config_t *cfg, const bench_result_t *res, do
     json_key_double(&ctx, "duration_sec", dur);
     json_end_object(&ctx);
 
+    if (res->trace) {
+        const replay_result_t *r = &res->replay;
+        json_begin_nested_object(&ctx, "replay");
+        json_key_int(&ctx, "frames", (int64_t)r->frames);
+        json_key_double(&ctx, "throughput_mpps", ((double)r->frames / dur) / 1e6);
+        json_key_double(&ctx, "throughput_gbps", (double)r->bytes * 8.0 / dur / 1e9);
+        json_key_int(&ctx, "loops", (int64_t)r->loops);
+        json_key_int(&ctx, "nobuf_drops", (int64_t)r->nobuf_drops);
+        json_key_int(&ctx, "early_drops", (int64_t)r->early_drops);
+        json_key_int(&ctx, "ring_full_drops", (int64_t)r->ring_full_drops);
+        json_end_object(&ctx);
+    }
+
     json_begin_nested_object(&ctx, "consumer");
 
     uint64_t total_consumed = 0;
@@ -361,11 +924,24 @@ static void output_json(const bench_config_t *cfg, const bench_result_t *res, do
         json_begin_nested_object(&ctx, key);
         json_key_int(&ctx, "packets_in", (int64_t)res->per_worker_pkts[i]);
         json_key_double(&ctx, "throughput_mpps", ((double)res->per_worker_pkts[i] / dur) / 1e6);
+        json_key_double(&ctx, "cpu_pct", res->per_worker_cpu[i]);
         json_end_object(&ctx);
     }
 
     json_end_object(&ctx); /* consumer */
 
+    json_begin_nested_object(&ctx, "latency");
+    json_key_int(&ctx, "samples", (int64_t)res->latency.total_count);
+    json_key_int(&ctx, "mean_ns",
+                 res->latency.total_count
+                     ? (int64_t)(res->latency.sum_ns / res->latency.total_count)
+                     : 0);
+    json_key_int(&ctx, "p50_ns", (int64_t)latency_percentile(&res->latency, 0.50));
+    json_key_int(&ctx, "p99_ns", (int64_t)latency_percentile(&res->latency, 0.99));
+    json_key_int(&ctx, "p999_ns", (int64_t)latency_percentile(&res->latency, 0.999));
+    json_key_int(&ctx, "p9999_ns", (int64_t)latency_percentile(&res->latency, 0.9999));
+    json_end_object(&ctx);
+
     json_key_double(&ctx, "measurement_overhead_ns", overhead_ns);
 
     json_end_object(&ctx); /* results */
@@ -389,6 +965,15 @@ static void print_usage(const char *prog) {
     printf("    -r, --ring-size=N   Ring size per worker, power of 2 (default: 1024)\n");
     printf("    -b, --batch-size=N  Batch size for push/pop (default: 32, max: 256)\n");
     printf("    -s, --packet-size=N Packet size in bytes, min 54 (default: 64)\n");
+    printf("    -i, --idle=MODE     Worker idle mode: poll, backoff or wakeup (default: backoff)\n");
+    printf("    -R, --rate=N        Producer rate in packets/s, 0 = unlimited (default: 0)\n");
+    printf("    -P, --pcap=FILE     Replay a pcap trace through the RX path instead\n");
+    printf("    -S, --speed=X       Replay at X times the trace's timestamps (1 = as captured)\n");
+    printf("    -L, --line-rate=G   Replay frames back to back on a G Gbit/s link\n");
+    printf("    -l, --loops=N       Passes over the trace, 0 = until the duration ends "
+           "(default: 0)\n");
+    printf("    -f, --rules=FILE    Worker rules, text or upe-rulec output "
+           "(default: forward TCP)\n");
     printf("    -W, --warmup        Enable warm-up phase\n");
     printf("    -j, --json          Output JSON format\n");
     printf("    -o, --output=FILE   Write to file instead of stdout\n");
@@ -396,6 +981,9 @@ static void print_usage(const char *prog) {
     printf("Examples:\n");
     printf("    %s --workers=2 --duration=30 --batch-size=64\n", prog);
     printf("    %s --warmup --json > out.json\n", prog);
+    printf("    %s --idle=wakeup --rate=100000\n", prog);
+    printf("    %s --pcap=prod.pcap --speed=1 --loops=3 --rules=prod.rules --json\n", prog);
+    printf("    %s --pcap=prod.pcap --line-rate=10 --workers=4\n", prog);
 }
 
 static int parse_args(int argc, char **argv, bench_config_t *cfg) {
@@ -405,6 +993,13 @@ static int parse_args(int argc, char **argv, bench_config_t *cfg) {
                                            {"ring-size", required_argument, NULL, 'r'},
                                            {"batch-size", required_argument, NULL, 'b'},
                                            {"packet-size", required_argument, NULL, 's'},
+                                           {"idle", required_argument, NULL, 'i'},
+                                           {"rate", required_argument, NULL, 'R'},
+                                           {"pcap", required_argument, NULL, 'P'},
+                                           {"speed", required_argument, NULL, 'S'},
+                                           {"line-rate", required_argument, NULL, 'L'},
+                                           {"loops", required_argument, NULL, 'l'},
+                                           {"rules", required_argument, NULL, 'f'},
                                            {"warmup", no_argument, NULL, 'W'},
                                            {"json", no_argument, NULL, 'j'},
                                            {"output", required_argument, NULL, 'o'},
@@ -412,7 +1007,8 @@ static int parse_args(int argc, char **argv, bench_config_t *cfg) {
                                            {NULL, 0, NULL, 0}};
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "d:w:p:r:b:s:Wjo:h", long_options, NULL)) != -1) {
+    const char *optstring = "d:w:p:r:b:s:i:R:P:S:L:l:f:Wjo:h";
+    while ((opt = getopt_long(argc, argv, optstring, long_options, NULL)) != -1) {
         switch (opt) {
         case 'd':
             cfg->duration_sec = benchmark_parse_int("duration");
@@ -462,6 +1058,48 @@ static int parse_args(int argc, char **argv, bench_config_t *cfg) {
                 return -1;
             }
             break;
+        case 'i':
+            if (strcmp(optarg, "poll") == 0) {
+                cfg->idle_mode = IDLE_MODE_POLL;
+            } else if (strcmp(optarg, "backoff") == 0) {
+                cfg->idle_mode = IDLE_MODE_BACKOFF;
+            } else if (strcmp(optarg, "wakeup") == 0) {
+                cfg->idle_mode = IDLE_MODE_WAKEUP;
+            } else {
+                fprintf(stderr, "Error: idle must be poll, backoff or wakeup\n");
+                return -1;
+            }
+            break;
+        case 'R':
+            cfg->rate_pps = benchmark_parse_size_t("rate");
+            break;
+        case 'P':
+            cfg->pcap_file = optarg;
+            break;
+        case 'S':
+            cfg->speed = benchmark_parse_double("speed");
+            if (cfg->speed <= 0.0) {
+                fprintf(stderr, "Error: speed must be > 0\n");
+                return -1;
+            }
+            break;
+        case 'L':
+            cfg->line_rate_gbps = benchmark_parse_double("line-rate");
+            if (cfg->line_rate_gbps <= 0.0) {
+                fprintf(stderr, "Error: line-rate must be > 0\n");
+                return -1;
+            }
+            break;
+        case 'l':
+            cfg->loops = benchmark_parse_int("loops");
+            if (cfg->loops < 0) {
+                fprintf(stderr, "Error: loops must be >= 0\n");
+                return -1;
+            }
+            break;
+        case 'f':
+            cfg->rules_file = optarg;
+            break;
         case 'W':
             cfg->warmup = true;
             break;
@@ -479,6 +1117,15 @@ static int parse_args(int argc, char **argv, bench_config_t *cfg) {
             return -1;
         }
     }
+
+    if (!cfg->pcap_file && (cfg->speed > 0.0 || cfg->line_rate_gbps > 0.0 || cfg->loops > 0)) {
+        fprintf(stderr, "Error: speed, line-rate and loops need --pcap\n");
+        return -1;
+    }
+    if ((cfg->rate_pps > 0) + (cfg->speed > 0.0) + (cfg->line_rate_gbps > 0.0) > 1) {
+        fprintf(stderr, "Error: rate, speed and line-rate exclude each other\n");
+        return -1;
+    }
     return 0;
 }
 
@@ -488,28 +1135,62 @@ int main(int argc, char **argv) {
     bench_config_t cfg = default_config();
     if (parse_args(argc, argv, &cfg) != 0) return EXIT_FAILURE;
 
+    trace_t trace;
+    if (cfg.pcap_file && trace_load(&trace, &cfg) != 0) return EXIT_FAILURE;
+
     double overhead_ns = benchmark_measure_timing_overhead();
 
+    /* Parser phase first, while no worker competes for the cache. */
+    parser_result_t parser = run_parser_phase(&cfg);
+
     /* Setup. */
     bench_env_t env;
-    setup_env(&env, &cfg);
-    bool hugepgs = env.pool.use_hugepages;
+    if (setup_env(&env, &cfg) != 0) return EXIT_FAILURE;
+    bool hugepgs = env.pools.pool[PKTBUF_CLASS_STD].use_hugepages;
 
     for (int i = 0; i < cfg.num_workers; i++) {
         worker_start(&env.workers[i]);
     }
 
+    /* Replay: the RX context upe runs, with a RETA over the worker rings. */
+    rx_ctx_t rx;
+    reta_t reta;
+    if (cfg.pcap_file) {
+        memset(&rx, 0, sizeof(rx));
+        rx.pools = &env.pools;
+        rx.rings = env.rings;
+        rx.ring_count = (uint16_t)cfg.num_workers;
+        rx.wake_workers = cfg.idle_mode == IDLE_MODE_WAKEUP;
+        if (reta_init(&reta, (uint16_t)cfg.num_workers) != 0) return EXIT_FAILURE;
+        for (int i = 0; i < cfg.num_workers; i++) {
+            reta.done[i] = &env.workers[i].pkts_done;
+        }
+        rx.reta = &reta;
+        if (rx_ctx_setup(&rx) != 0) return EXIT_FAILURE;
+    }
+
     /* Warm-up: run producer for 1s. */
     if (cfg.warmup) {
         printf("Warm-up start for 1s.\n");
-        run_producer(&cfg, &env.pool, env.rings, 1.0);
+        if (cfg.pcap_file) {
+            replay_result_t warm;
+            run_replay(&env, &rx, &trace, 1.0, 0, &warm);
+        } else {
+            run_producer(&cfg, &env.pools.pool[PKTBUF_CLASS_STD], env.rings, 1.0);
+        }
         printf("Warm-up done.\n");
     }
 
     /* Snapshot worker counters before measure. */
     uint64_t pkts_in_before[MAX_WORKERS];
+    double cpu_before[MAX_WORKERS];
+    latency_histogram_t lat_before[MAX_WORKERS];
     for (int i = 0; i < cfg.num_workers; i++) {
-        pkts_in_before[i] = env.workers[i].pkts_in;
+        worker_counters_t c;
+        worker_read_counters(&env.workers[i], &c);
+        pkts_in_before[i] = c.pkts_in;
+        cpu_before[i] = thread_cpu_time(env.workers[i].thread);
+        lat_before[i] = env.workers[i].latency_hist;
     }
 
     if (!cfg.json_output) {
@@ -518,10 +1199,26 @@ int main(int argc, char **argv) {
 
     /* Measurement. */
     bench_result_t result = {0};
-    result.producer = run_producer(&cfg, &env.pool, env.rings, (double)cfg.duration_sec);
+    result.parser = parser;
+    if (cfg.pcap_file) {
+        result.trace = &trace;
+        result.producer = run_replay(&env, &rx, &trace, (double)cfg.duration_sec, cfg.loops,
+                                     &result.replay);
+    } else {
+        result.producer = run_producer(&cfg, &env.pools.pool[PKTBUF_CLASS_STD], env.rings,
+                                       (double)cfg.duration_sec);
+    }
     result.num_workers = cfg.num_workers;
+    latency_histogram_init(&result.latency);
     for (int i = 0; i < cfg.num_workers; i++) {
-        result.per_worker_pkts[i] = env.workers[i].pkts_in - pkts_in_before[i];
+        worker_counters_t c;
+        worker_read_counters(&env.workers[i], &c);
+        result.per_worker_pkts[i] = c.pkts_in - pkts_in_before[i];
+        result.per_worker_cpu[i] = (thread_cpu_time(env.workers[i].thread) - cpu_before[i]) /
+                                   result.producer.duration_sec * 100.0;
+        latency_histogram_t lat;
+        latency_since(&lat, &env.workers[i].latency_hist, &lat_before[i]);
+        latency_histogram_merge(&result.latency, &lat);
     }
 
     /* Stop workers. */
@@ -529,6 +1226,10 @@ int main(int argc, char **argv) {
     for (int i = 0; i < cfg.num_workers; i++) {
         worker_join(&env.workers[i]);
     }
+    if (cfg.pcap_file) {
+        rx_ctx_teardown(&rx);
+        reta_destroy(&reta);
+    }
 
     /* Output. */
     FILE *out = stdout;
@@ -540,7 +1241,7 @@ int main(int argc, char **argv) {
         }
     }
 
-    result.huge_pages_used = env.pool.use_hugepages;
+    result.huge_pages_used = env.pools.pool[PKTBUF_CLASS_STD].use_hugepages;
 
     if (cfg.json_output) {
         output_json(&cfg, &result, overhead_ns, out);
@@ -552,6 +1253,7 @@ int main(int argc, char **argv) {
 
     /* Cleanup. */
     teardown_env(&env, cfg.num_workers);
+    if (cfg.pcap_file) trace_unload(&trace);
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -2,17 +2,46 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <pthread.h>
 #include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "affinity.h"
 #include "arp_table.h"
+#include "classifier.h"
+#include "conntrack.h"
+#include "control.h"
+#include "flow_cache.h"
+#include "json.h"
+#include "latency.h"
+#include "log.h"
+#include "metrics.h"
+#include "mirror.h"
 #include "ndp_table.h"
+#include "neigh_cache.h"
 #include "parser.h"
+#include "perf.h"
 #include "pktbuf.h"
+#include "policer.h"
+#include "qsbr.h"
+#include "reta.h"
 #include "ring.h"
+#include "rule_api.h"
 #include "rule_config.h"
+#include "rule_file.h"
 #include "rule_table.h"
+#include "tx.h"
+#include "xsk.h"
 
 #define GREEN "\033[0;32m"
 #define RED "\033[0;31m"
@@ -103,6 +132,137 @@ int test_ring_buffer(void) {
     return 0;
 }
 
+// Consumer sleeping in ring_wait() must be woken by the producer's
+// ring_notify(), not by the timeout.
+static uint64_t test_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void *ring_notify_thread(void *arg) {
+    spsc_ring_t *r = (spsc_ring_t *)arg;
+    static int item = 1;
+    void *obj = &item;
+
+    // Wait for the consumer to park first.
+    while (atomic_load(&r->waiting) == 0) {
+    }
+    ring_push_burst(r, &obj, 1);
+    ring_notify(r);
+    return NULL;
+}
+
+int test_ring_wait_notify(void) {
+    spsc_ring_t r;
+    TEST_ASSERT(ring_init(&r, 8) == 0);
+
+    // Test 1) Not empty: returns at once, without sleeping
+    int a = 1;
+    void *obj = &a;
+    TEST_ASSERT(ring_push_burst(&r, &obj, 1) == 1);
+    TEST_ASSERT(ring_wait(&r, 1000000) == false);
+    TEST_ASSERT(ring_pop_burst(&r, &obj, 1) == 1);
+
+    // Test 2) Empty and nobody notifies: sleeps for the timeout
+    uint64_t t0 = test_now_ns();
+    TEST_ASSERT(ring_wait(&r, 2000) == true);
+    TEST_ASSERT(test_now_ns() - t0 >= 2000000);
+    TEST_ASSERT(atomic_load(&r.waiting) == 0);
+
+    // Test 3) Woken by the producer long before a 5s timeout
+    pthread_t th;
+    TEST_ASSERT(pthread_create(&th, NULL, ring_notify_thread, &r) == 0);
+    t0 = test_now_ns();
+    TEST_ASSERT(ring_wait(&r, 5000000) == true);
+    TEST_ASSERT(test_now_ns() - t0 < 1000000000ull);
+    pthread_join(th, NULL);
+    TEST_ASSERT(ring_pop_burst(&r, &obj, 1) == 1);
+
+    // Test 4) A notify with no sleeper is a no-op
+    ring_notify(&r);
+    TEST_ASSERT(atomic_load(&r.waiting) == 0);
+
+    ring_destroy(&r);
+    return 0;
+}
+
+typedef struct {
+    int highs;
+    int lows;
+} wm_events_t;
+
+static void test_wm_cb(spsc_ring_t *r, bool high, void *arg) {
+    (void)r;
+    wm_events_t *ev = (wm_events_t *)arg;
+    if (high) {
+        ev->highs++;
+    } else {
+        ev->lows++;
+    }
+}
+
+int test_ring_peek_watermarks(void) {
+    printf("[Test] Ring peek/commit and watermarks...\n");
+
+    spsc_ring_t r;
+    TEST_ASSERT(ring_init(&r, 8) == 0);
+
+    int vals[8];
+    void *objs[8];
+    for (int i = 0; i < 8; i++) {
+        objs[i] = &vals[i];
+    }
+
+    wm_events_t ev = {0, 0};
+    TEST_ASSERT(ring_set_watermarks(&r, 4, 4, test_wm_cb, &ev) == -1); /* low must be < high */
+    TEST_ASSERT(ring_set_watermarks(&r, 9, 1, test_wm_cb, &ev) == -1); /* above capacity */
+    TEST_ASSERT(ring_set_watermarks(&r, 6, 2, test_wm_cb, &ev) == 0);
+
+    // Test 1) Peek sees the entries in place, commit hands them back
+    TEST_ASSERT(ring_push_burst(&r, objs, 5) == 5);
+    TEST_ASSERT(ev.highs == 0);
+    void **slots;
+    TEST_ASSERT(ring_peek_burst(&r, &slots, 3) == 3);
+    TEST_ASSERT(slots[0] == &vals[0] && slots[2] == &vals[2]);
+    TEST_ASSERT(ring_peek_burst(&r, &slots, 3) == 3); /* Nothing consumed yet */
+    TEST_ASSERT(slots[0] == &vals[0]);
+    ring_pop_commit(&r, 3);
+    TEST_ASSERT(ring_occupancy(&r) == 2);
+
+    // Test 2) Crossing the high watermark fires once; the peek stops at the wrap
+    TEST_ASSERT(ring_push_burst(&r, objs, 5) == 5); /* Slots 5..7, then 0..1 */
+    TEST_ASSERT(ev.highs == 1 && ev.lows == 0);
+    TEST_ASSERT(ring_high_water(&r) == 7);
+    TEST_ASSERT(ring_peek_burst(&r, &slots, 8) == 5); /* Slots 3..7, not past the end */
+    TEST_ASSERT(slots[0] == &vals[3] && slots[2] == &vals[0]);
+    ring_pop_commit(&r, 3);
+
+    // Test 3) Hysteresis: still high until the occupancy is down to the low mark
+    ring_check_watermarks(&r); /* 4 left */
+    TEST_ASSERT(ev.highs == 1 && ev.lows == 0);
+    TEST_ASSERT(ring_peek_burst(&r, &slots, 8) == 2); /* Slots 6..7 */
+    TEST_ASSERT(slots[0] == &vals[1]);
+    ring_pop_commit(&r, 2);
+    ring_check_watermarks(&r); /* 2 left */
+    TEST_ASSERT(ev.lows == 1);
+    ring_check_watermarks(&r);
+    TEST_ASSERT(ev.highs == 1 && ev.lows == 1);
+    TEST_ASSERT(ring_peek_burst(&r, &slots, 8) == 2); /* Slots 0..1, after the wrap */
+    TEST_ASSERT(slots[0] == &vals[3] && slots[1] == &vals[4]);
+    ring_pop_commit(&r, 2);
+
+    // Test 4) A stale tail alone does not fire the high watermark
+    TEST_ASSERT(ring_push_burst(&r, objs, 5) == 5);
+    TEST_ASSERT(ev.highs == 1);
+    TEST_ASSERT(ring_push_burst(&r, objs, 1) == 1);
+    TEST_ASSERT(ev.highs == 2);
+    TEST_ASSERT(ring_high_water(&r) == 7);
+
+    ring_destroy(&r);
+    return 0;
+}
+
 // --- 2. Rule Table related tests ---
 int test_rule_priority(void) {
     rule_table_t rt;
@@ -241,6 +401,103 @@ int test_ipv6_packet_parser(void) {
     return 0;
 }
 
+// --- Burst parser ---
+int test_parse_burst(void) {
+    enum { N = 40 };
+    pktbuf_pool_t pool;
+    pktbuf_t *ptrs[N];
+    flow_key_t keys[N];
+    TEST_ASSERT(pktbuf_pool_init(&pool, N) == 0);
+    TEST_ASSERT(pktbuf_alloc_bulk(&pool, ptrs, N) == N);
+
+    // Mixed burst: IPv4 TCP, IPv6 UDP, ARP, truncated IPv4, IPv4 ICMP
+    for (int i = 0; i < N; i++) {
+        pktbuf_t *b = ptrs[i];
+        uint8_t *p = b->data;
+        struct eth_hdr *eth = (struct eth_hdr *)p;
+        memset(p, 0, 128);
+
+        switch (i % 5) {
+        case 0:
+        case 3: {
+            eth->ethertype = htons(0x0800);
+            struct ipv4_hdr *ip = (struct ipv4_hdr *)(p + 14);
+            ip->ver_ihl = 0x45;
+            ip->protocol = 6;
+            ip->src_ip = htonl(0x0a000000u | (uint32_t)i);
+            p[14 + 20 + 1] = (uint8_t)i; // Src port
+            p[14 + 20 + 12] = 0x50;
+            b->len = (i % 5 == 0) ? 60 : 37;
+            break;
+        }
+        case 1: {
+            eth->ethertype = htons(0x86DD);
+            struct ipv6_hdr *ip6 = (struct ipv6_hdr *)(p + 14);
+            ip6->vtf = htonl(0x60000000);
+            ip6->next_header = 17;
+            ip6->dst_addr[15] = (uint8_t)i;
+            p[14 + 40 + 3] = (uint8_t)i; // Dst port
+            b->len = 14 + 40 + 8;
+            break;
+        }
+        case 2:
+            eth->ethertype = htons(0x0806);
+            b->len = 42;
+            break;
+        default: {
+            eth->ethertype = htons(0x0800);
+            struct ipv4_hdr *ip = (struct ipv4_hdr *)(p + 14);
+            ip->ver_ihl = 0x45;
+            ip->protocol = 1;
+            p[34] = 8;
+            b->len = 42;
+            break;
+        }
+        }
+    }
+
+    uint64_t ok = parse_flow_key_burst(ptrs, N, keys);
+
+    // Same result as parsing packet by packet
+    for (int i = 0; i < N; i++) {
+        flow_key_t k;
+        int rc = parse_flow_key(ptrs[i]->data, ptrs[i]->len, &k);
+        TEST_ASSERT((rc == 0) == ((ok >> i) & 1));
+        if (rc != 0) continue;
+        TEST_ASSERT(keys[i].ip_ver == k.ip_ver);
+        TEST_ASSERT(keys[i].protocol == k.protocol);
+        TEST_ASSERT(keys[i].src_port == k.src_port);
+        TEST_ASSERT(keys[i].dst_port == k.dst_port);
+        size_t alen = (k.ip_ver == 4) ? 4 : 16;
+        TEST_ASSERT(memcmp(&keys[i].src_ip, &k.src_ip, alen) == 0);
+        TEST_ASSERT(memcmp(&keys[i].dst_ip, &k.dst_ip, alen) == 0);
+    }
+    TEST_ASSERT(__builtin_popcountll(ok) == 24); // 8 each of IPv4 TCP, IPv6 UDP, ICMP
+    TEST_ASSERT(parse_flow_key_burst(ptrs, 0, keys) == 0);
+
+    // Pointer + length form (mbufs) gives the same keys
+    const uint8_t *raw[N];
+    uint32_t lens[N];
+    flow_key_t bulk_keys[N];
+    for (int i = 0; i < N; i++) {
+        raw[i] = ptrs[i]->data;
+        lens[i] = ptrs[i]->len;
+    }
+    TEST_ASSERT(parse_flow_key_bulk(raw, lens, N, bulk_keys) == ok);
+    for (int i = 0; i < N; i++) {
+        if (!((ok >> i) & 1)) continue;
+        TEST_ASSERT(bulk_keys[i].src_port == keys[i].src_port);
+        TEST_ASSERT(bulk_keys[i].dst_port == keys[i].dst_port);
+        size_t alen = (keys[i].ip_ver == 4) ? 4 : 16;
+        TEST_ASSERT(memcmp(&bulk_keys[i].dst_ip, &keys[i].dst_ip, alen) == 0);
+    }
+
+    pktbuf_free_bulk(&pool, ptrs, N);
+    pktbuf_thread_flush();
+    pktbuf_pool_destroy(&pool);
+    return 0;
+}
+
 // -- Flow Hash (Software RSS) related tests ---
 int test_flow_hash(void) {
     /* -- IPv4 Tests -- */
@@ -298,12 +555,172 @@ int test_flow_hash(void) {
     return 0;
 }
 
+// Per-ring skew (max load / mean load) of flow_hash() over 16 rings
+static double ring_skew(const flow_key_t *keys, int n) {
+    int load[16] = {0};
+    for (int i = 0; i < n; i++) {
+        load[flow_hash(&keys[i]) & 15]++;
+    }
+    int max = 0;
+    for (int r = 0; r < 16; r++) {
+        if (load[r] > max) max = load[r];
+    }
+    return (double)max / ((double)n / 16.0);
+}
+
+int test_flow_hash_distribution(void) {
+    enum { N = 4096 };
+    static flow_key_t keys[N];
+
+    // CRC32C check value ("123456789", with init and final inversion)
+    TEST_ASSERT(~crc32c(0xFFFFFFFFu, "123456789", 9) == 0xE3069283u);
+
+    /* Synthetic traffic with linear structure, each pattern used to collapse
+     * onto a few rings with an XOR of the fields. */
+    const char *names[4] = {"sequential clients", "ip+port stride", "mirrored subnets",
+                            "ipv6 clients"};
+    printf("\n");
+    for (int pat = 0; pat < 4; pat++) {
+        memset(keys, 0, sizeof(keys));
+        for (int i = 0; i < N; i++) {
+            flow_key_t *k = &keys[i];
+            uint32_t u = (uint32_t)i;
+            k->ip_ver = 4;
+            k->protocol = 6;
+            k->dst_ip.v4 = htonl(0xC0A80101u); // 192.168.1.1:443
+            k->dst_port = 443;
+            switch (pat) {
+            case 0: // 10.0.x.y:40000 -> server
+                k->src_ip.v4 = htonl(0x0A000000u + u);
+                k->src_port = 40000;
+                break;
+            case 1: // Address and port step together
+                k->src_ip.v4 = htonl(0x0A000000u + u);
+                k->src_port = (uint16_t)(40000 + u);
+                break;
+            case 2: // 10.0.0.0/20 <-> 10.1.0.0/20, host i to host i
+                k->src_ip.v4 = htonl(0x0A000000u + u);
+                k->dst_ip.v4 = htonl(0x0A010000u + u);
+                k->src_port = 5000;
+                k->dst_port = 5000;
+                break;
+            default: // 2001:db8::x:40000 -> 2001:db8::ffff:443
+                k->ip_ver = 6;
+                k->src_ip.v6[0] = 0x20;
+                k->src_ip.v6[1] = 0x01;
+                k->src_ip.v6[14] = (uint8_t)(u >> 8);
+                k->src_ip.v6[15] = (uint8_t)u;
+                memcpy(k->dst_ip.v6, k->src_ip.v6, 2);
+                k->dst_ip.v6[14] = 0xff;
+                k->dst_ip.v6[15] = 0xff;
+                k->src_port = 40000;
+                break;
+            }
+        }
+        double skew = ring_skew(keys, N);
+        printf("    %-20s skew %.2f over 16 rings\n", names[pat], skew);
+        // Uniform random placement would give ~1.2 at this size
+        TEST_ASSERT(skew < 1.35);
+    }
+
+    return 0;
+}
+
+
+// --- RETA (software RSS indirection) ---
+int test_reta(void) {
+    static reta_t t;
+    atomic_uint_fast64_t done[3];
+    for (int i = 0; i < 3; i++) {
+        atomic_init(&done[i], 0);
+    }
+
+    // Test 1) Any ring count, buckets spread evenly
+    TEST_ASSERT(reta_init(&t, 3) == 0);
+    int per_ring[3] = {0};
+    for (uint32_t b = 0; b < RETA_SIZE; b++) {
+        per_ring[reta_lookup(&t, b)]++;
+    }
+    TEST_ASSERT(per_ring[0] == 171 && per_ring[1] == 171 && per_ring[2] == 170);
+    for (int i = 0; i < 3; i++) {
+        t.done[i] = &done[i];
+    }
+
+    // Test 2) Bucket 4 (ring 1) -> ring 2: held until worker 1 passes the mark
+    pktbuf_t *pkts = aligned_alloc(64, 2 * sizeof(pktbuf_t));
+    TEST_ASSERT(pkts != NULL);
+    TEST_ASSERT(reta_request_move(&t, 4, 2) == 0);
+    TEST_ASSERT(reta_request_move(&t, 5, 2) == -1); // One at a time
+    TEST_ASSERT(reta_move_begin(&t) == 1);
+    reta_arm(&t, 10);
+    atomic_store(&done[1], 9);
+
+    TEST_ASSERT(reta_lookup(&t, 4 + RETA_SIZE) == RETA_HOLD);
+    TEST_ASSERT(reta_hold(&t, &pkts[0]) && reta_hold(&t, &pkts[1]));
+    TEST_ASSERT(reta_lookup(&t, 7) == 1); // Other buckets of ring 1 unaffected
+    TEST_ASSERT(!reta_move_try_finish(&t));
+
+    atomic_store(&done[1], 10);
+    TEST_ASSERT(reta_move_try_finish(&t));
+    TEST_ASSERT(t.hold_count == 2 && t.hold[0] == &pkts[0] && t.hold[1] == &pkts[1]);
+    t.hold_count = 0;
+    TEST_ASSERT(reta_lookup(&t, 4) == 2);
+    TEST_ASSERT(atomic_load(&t.moves) == 1);
+
+    // Test 3) Hold buffer full: the move is given up, bucket stays
+    TEST_ASSERT(reta_request_move(&t, 4, 0) == 0);
+    TEST_ASSERT(reta_move_begin(&t) == 2);
+    reta_arm(&t, 100);
+    for (int i = 0; i < RETA_HOLD_SIZE; i++) {
+        TEST_ASSERT(reta_hold(&t, &pkts[0]));
+    }
+    TEST_ASSERT(!reta_hold(&t, &pkts[1]));
+    TEST_ASSERT(reta_move_abort(&t) == 2);
+    TEST_ASSERT(t.hold_count == RETA_HOLD_SIZE);
+    t.hold_count = 0;
+    TEST_ASSERT(reta_lookup(&t, 4) == 2);
+    TEST_ASSERT(atomic_load(&t.aborts) == 1);
+    free(pkts);
+
+    // Test 4) Rebalance: ring 0 gets the elephant bucket 0 and bucket 3
+    uint64_t load[3] = {1000, 300, 300};
+    size_t backlog[3] = {512, 0, 0};
+    size_t no_backlog[3] = {0, 0, 0};
+    TEST_ASSERT(reta_rebalance(&t, load, no_backlog, 1024) == 0); // Baseline the counters
+    for (int i = 0; i < 900; i++) {
+        reta_lookup(&t, 0);
+    }
+    for (int i = 0; i < 100; i++) {
+        reta_lookup(&t, 3);
+    }
+    // Ring 0 keeps up (no backlog): leave it
+    uint64_t saved[RETA_SIZE];
+    memcpy(saved, t.last_hits, sizeof(saved));
+    TEST_ASSERT(reta_rebalance(&t, load, no_backlog, 1024) == 0);
+
+    // Falls behind: the elephant would only move the hot spot, bucket 3 goes
+    memcpy(t.last_hits, saved, sizeof(saved));
+    TEST_ASSERT(reta_rebalance(&t, load, backlog, 1024) == 1);
+    TEST_ASSERT(reta_move_begin(&t) == 0);
+    TEST_ASSERT(t.moving == 3 && t.move_to == 1);
+
+    // Balanced load: nothing to do
+    atomic_store(&done[0], 1);
+    reta_arm(&t, 0);
+    TEST_ASSERT(reta_move_try_finish(&t));
+    uint64_t even[3] = {500, 450, 480};
+    TEST_ASSERT(reta_rebalance(&t, even, backlog, 1024) == 0);
+
+    reta_destroy(&t);
+    return 0;
+}
+
 // -- Packet Buffer Pool related tests ---
 int test_pktbuf_pool(void) {
     pktbuf_pool_t pool;
     // Test 1) Initialize a small pool
     TEST_ASSERT(pktbuf_pool_init(&pool, 3) == 0);
-    TEST_ASSERT(atomic_load(&pool.top) == 3);
+    TEST_ASSERT(atomic_load(&pool.free_count) == 3);
 
     // Test 2) Allocate all buffers
     pktbuf_t *b1 = pktbuf_alloc(&pool);
@@ -319,7 +736,7 @@ int test_pktbuf_pool(void) {
     pktbuf_free(&pool, b2);
     // Because of thread-local caching, the freed buffer is returned to
     // the t_cache. Global pool is 0 until cache is flushed.
-    TEST_ASSERT(atomic_load(&pool.top) == 0);
+    TEST_ASSERT(atomic_load(&pool.free_count) == 0);
 
     pktbuf_t *b4 = pktbuf_alloc(&pool);
     TEST_ASSERT(b4 == b2); // Freed buffer should be at head at alloc.
@@ -328,6 +745,281 @@ int test_pktbuf_pool(void) {
     return 0;
 }
 
+int test_affinity_core_list(void) {
+    int cores[8];
+
+    // Test 1) Singles and inclusive ranges, in the given order
+    TEST_ASSERT(affinity_parse_core_list("2,4-7,0", cores, 8) == 6);
+    TEST_ASSERT(cores[0] == 2 && cores[1] == 4 && cores[4] == 7 && cores[5] == 0);
+    TEST_ASSERT(affinity_parse_core_list("3", cores, 8) == 1 && cores[0] == 3);
+
+    // Test 2) Malformed lists
+    TEST_ASSERT(affinity_parse_core_list("", cores, 8) == -1);
+    TEST_ASSERT(affinity_parse_core_list("1,", cores, 8) == -1);
+    TEST_ASSERT(affinity_parse_core_list("5-3", cores, 8) == -1);
+    TEST_ASSERT(affinity_parse_core_list("1-", cores, 8) == -1);
+    TEST_ASSERT(affinity_parse_core_list("a", cores, 8) == -1);
+    TEST_ASSERT(affinity_parse_core_list("-1", cores, 8) == -1);
+
+    // Test 3) Duplicates and lists longer than the array
+    TEST_ASSERT(affinity_parse_core_list("1,2,1", cores, 8) == -1);
+    TEST_ASSERT(affinity_parse_core_list("0-3,2", cores, 8) == -1);
+    TEST_ASSERT(affinity_parse_core_list("0-8", cores, 8) == -1);
+    TEST_ASSERT(affinity_parse_core_list("0-7", cores, 8) == 8);
+    return 0;
+}
+
+int test_pktbuf_pool_numa(void) {
+    static pktbuf_pool_t local;
+    static pktbuf_pool_t remote;
+    int self = affinity_self_node();
+
+    // Test 1) A pool on our own node: no remote allocations
+    TEST_ASSERT(pktbuf_pool_init_node(&local, 64, self) == 0);
+    TEST_ASSERT(local.node == self);
+    pktbuf_t *b = pktbuf_alloc(&local);
+    TEST_ASSERT(b != NULL);
+    b->data[0] = 1; // Faulted in at init, usable
+    TEST_ASSERT(atomic_load(&local.remote_allocs) == 0);
+    pktbuf_free(&local, b);
+
+    // Test 2) A pool of another node counts the whole refill as remote.
+    // The node may not exist here, placement then just falls back.
+    TEST_ASSERT(pktbuf_pool_init_node(&remote, 64, self + 1) == 0);
+    b = pktbuf_alloc(&remote);
+    TEST_ASSERT(b != NULL);
+    TEST_ASSERT(atomic_load(&remote.remote_allocs) > 0);
+    pktbuf_free(&remote, b);
+
+    // Test 3) Node out of range
+    TEST_ASSERT(affinity_numa_nodes() >= 1);
+    static pktbuf_pool_t bad;
+    TEST_ASSERT(pktbuf_pool_init_node(&bad, 64, 64) == -1);
+
+    // Move this thread's buffer cache back to `local` before destroying
+    // `remote`; `local` stays alive, later pools flush the cache into it.
+    pktbuf_free(&local, pktbuf_alloc(&local));
+    pktbuf_pool_destroy(&remote);
+    return 0;
+}
+
+int test_pktbuf_bulk(void) {
+    static pktbuf_pool_t pool;
+    TEST_ASSERT(pktbuf_pool_init(&pool, 100) == 0);
+    TEST_ASSERT(pool.cache_size == PKTBUF_CACHE_DEFAULT);
+    TEST_ASSERT(pktbuf_pool_set_cache_size(&pool, 1) == -1);
+    TEST_ASSERT(pktbuf_pool_set_cache_size(&pool, PKTBUF_CACHE_MAX + 1) == -1);
+    TEST_ASSERT(pktbuf_pool_set_cache_size(&pool, 8) == 0);
+
+    // Test 1) A small request goes through the cache: one refill of 4
+    pktbuf_t *bufs[128];
+    TEST_ASSERT(pktbuf_alloc_bulk(&pool, bufs, 3) == 3);
+    TEST_ASSERT(atomic_load(&pool.refills) == 1);
+    TEST_ASSERT(atomic_load(&pool.free_count) == 96);
+
+    // Test 2) A large one takes the cached buffer, then pops the rest in one go.
+    // Only 97 are left: the shortfall is counted.
+    TEST_ASSERT(pktbuf_alloc_bulk(&pool, &bufs[3], 125) == 97);
+    TEST_ASSERT(atomic_load(&pool.free_count) == 0);
+    TEST_ASSERT(atomic_load(&pool.refills) == 2);
+    TEST_ASSERT(atomic_load(&pool.alloc_failures) == 28);
+    for (int i = 0; i < 100; i++) {
+        TEST_ASSERT(bufs[i]->index < pool.capacity && pktbuf_at(&pool, bufs[i]->index) == bufs[i]);
+        for (int j = 0; j < i; j++) {
+            TEST_ASSERT(bufs[i] != bufs[j]);
+        }
+    }
+
+    // Test 3) A single allocation from an empty pool is a failure too
+    TEST_ASSERT(pktbuf_alloc(&pool) == NULL);
+    TEST_ASSERT(atomic_load(&pool.alloc_failures) == 29);
+
+    // Test 4) Bulk free: the cache fills up to 8, the other 92 go back in one push
+    pktbuf_free_bulk(&pool, bufs, 100);
+    TEST_ASSERT(atomic_load(&pool.flushes) == 1);
+    TEST_ASSERT(atomic_load(&pool.free_count) == 92);
+    TEST_ASSERT(bufs[0]->len == 0);
+
+    // Test 5) NULL entries are skipped
+    pktbuf_t *none[2] = {NULL, NULL};
+    pktbuf_free_bulk(&pool, none, 2);
+    TEST_ASSERT(atomic_load(&pool.flushes) == 1);
+    TEST_ASSERT(pktbuf_alloc_bulk(&pool, bufs, 100) == 100);
+    pktbuf_free_bulk(&pool, bufs, 100);
+
+    // `pool` stays alive: this thread's cache still points at it.
+    return 0;
+}
+
+// Many threads hammering the global free list (cache of 2: every other
+// alloc/free goes to it) must never hand out a buffer twice, or lose one.
+#define PKTBUF_STRESS_THREADS 4
+#define PKTBUF_STRESS_ROUNDS 200000
+
+typedef struct {
+    pktbuf_pool_t *pool;
+    atomic_uchar *owned; /* Per buffer index: 1 while some thread holds it */
+    atomic_int *dups;
+    uint32_t seed;
+} pktbuf_stress_ctx_t;
+
+static void *pktbuf_stress_thread(void *arg) {
+    pktbuf_stress_ctx_t *ctx = (pktbuf_stress_ctx_t *)arg;
+    pktbuf_t *bufs[16];
+    uint32_t x = ctx->seed;
+
+    for (int r = 0; r < PKTBUF_STRESS_ROUNDS; r++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        unsigned int n = 1 + (x % 16);
+        unsigned int got = (x & 0x100) ? pktbuf_alloc_bulk(ctx->pool, bufs, n) : 0;
+        if (!(x & 0x100)) {
+            while (got < n && (bufs[got] = pktbuf_alloc(ctx->pool)) != NULL) got++;
+        }
+
+        for (unsigned int i = 0; i < got; i++) {
+            if (atomic_exchange(&ctx->owned[bufs[i]->index], 1) != 0) {
+                atomic_fetch_add(ctx->dups, 1);
+            }
+        }
+        for (unsigned int i = 0; i < got; i++) {
+            atomic_store(&ctx->owned[bufs[i]->index], 0);
+        }
+
+        if (x & 0x200) {
+            pktbuf_free_bulk(ctx->pool, bufs, got);
+        } else {
+            for (unsigned int i = 0; i < got; i++) pktbuf_free(ctx->pool, bufs[i]);
+        }
+    }
+
+    pktbuf_thread_flush();
+    return NULL;
+}
+
+int test_pktbuf_stress(void) {
+    pktbuf_pool_t pool;
+    // Smaller than what all threads can hold at once: the list runs empty too.
+    TEST_ASSERT(pktbuf_pool_init(&pool, 48) == 0);
+    TEST_ASSERT(pktbuf_pool_set_cache_size(&pool, 2) == 0);
+
+    static atomic_uchar owned[48];
+    atomic_int dups;
+    atomic_init(&dups, 0);
+    for (int i = 0; i < 48; i++) atomic_init(&owned[i], 0);
+
+    pthread_t th[PKTBUF_STRESS_THREADS];
+    pktbuf_stress_ctx_t ctx[PKTBUF_STRESS_THREADS];
+    for (int t = 0; t < PKTBUF_STRESS_THREADS; t++) {
+        ctx[t] = (pktbuf_stress_ctx_t){
+            .pool = &pool, .owned = owned, .dups = &dups, .seed = 0x9E3779B9u * (uint32_t)(t + 1)};
+        TEST_ASSERT(pthread_create(&th[t], NULL, pktbuf_stress_thread, &ctx[t]) == 0);
+    }
+    for (int t = 0; t < PKTBUF_STRESS_THREADS; t++) {
+        pthread_join(th[t], NULL);
+    }
+
+    TEST_ASSERT(atomic_load(&dups) == 0);
+    // Every thread flushed its cache: all buffers are back, each exactly once.
+    TEST_ASSERT(atomic_load(&pool.free_count) == 48);
+    pktbuf_t *bufs[48];
+    TEST_ASSERT(pktbuf_alloc_bulk(&pool, bufs, 48) == 48);
+    TEST_ASSERT(pktbuf_alloc(&pool) == NULL);
+    for (int i = 0; i < 48; i++) {
+        for (int j = 0; j < i; j++) {
+            TEST_ASSERT(bufs[i] != bufs[j]);
+        }
+    }
+
+    pktbuf_free_bulk(&pool, bufs, 48);
+    pktbuf_thread_flush();
+    pktbuf_pool_destroy(&pool);
+    return 0;
+}
+
+int test_pktbuf_classes(void) {
+    pktbuf_classes_t c;
+    const size_t cap[PKTBUF_CLASSES] = {4, 2, 1};
+    TEST_ASSERT(pktbuf_classes_init(&c, cap, PKTBUF_HEADROOM, -1) == 0);
+    // Metadata + headroom + 256 B of data
+    TEST_ASSERT(c.pool[PKTBUF_CLASS_SMALL].stride == 512);
+
+    // Test 1) Smallest class that fits
+    TEST_ASSERT(pktbuf_classes_pick(&c, 60) == &c.pool[PKTBUF_CLASS_SMALL]);
+    TEST_ASSERT(pktbuf_classes_pick(&c, 256) == &c.pool[PKTBUF_CLASS_SMALL]);
+    TEST_ASSERT(pktbuf_classes_pick(&c, 1500) == &c.pool[PKTBUF_CLASS_STD]);
+    TEST_ASSERT(pktbuf_classes_pick(&c, 9000) == &c.pool[PKTBUF_CLASS_JUMBO]);
+    TEST_ASSERT(pktbuf_classes_pick(&c, PKTBUF_MAX_SIZE + 1) == NULL);
+
+    // Test 2) Headroom in front of the frame, prepending eats into it
+    pktbuf_t *b = pktbuf_alloc_len(&c, 60);
+    TEST_ASSERT(b != NULL && b->pool == &c.pool[PKTBUF_CLASS_SMALL]);
+    TEST_ASSERT(pktbuf_headroom(b) == PKTBUF_HEADROOM && pktbuf_room(b) == PKTBUF_SMALL_SIZE);
+    uint8_t *frame = b->data;
+    b->len = 60;
+    TEST_ASSERT(pktbuf_prepend(b, 4) == frame - 4);
+    TEST_ASSERT(b->len == 64 && pktbuf_headroom(b) == PKTBUF_HEADROOM - 4);
+    TEST_ASSERT(pktbuf_prepend(b, PKTBUF_HEADROOM) == NULL);
+
+    // Test 3) A freed buffer comes back with its default headroom
+    pktbuf_release(b);
+    TEST_ASSERT(pktbuf_alloc_len(&c, 60) == b);
+    TEST_ASSERT(b->data == frame && b->len == 0);
+
+    // Test 4) An exhausted class falls back to the next larger one
+    pktbuf_t *bufs[8];
+    bufs[0] = b;
+    for (int i = 1; i < 4; i++) {
+        bufs[i] = pktbuf_alloc_len(&c, 60);
+        TEST_ASSERT(bufs[i] != NULL && bufs[i]->pool == &c.pool[PKTBUF_CLASS_SMALL]);
+    }
+    bufs[4] = pktbuf_alloc_len(&c, 60);
+    TEST_ASSERT(bufs[4] != NULL && bufs[4]->pool == &c.pool[PKTBUF_CLASS_STD]);
+    bufs[5] = pktbuf_alloc_len(&c, 9000);
+    TEST_ASSERT(bufs[5] != NULL && bufs[5]->pool == &c.pool[PKTBUF_CLASS_JUMBO]);
+    TEST_ASSERT(pktbuf_alloc_len(&c, 9000) == NULL); // Nothing larger left
+
+    // Test 5) Mixed frees go back to their own pools
+    pktbuf_release_bulk(bufs, 6);
+    pktbuf_thread_flush();
+    for (int k = 0; k < PKTBUF_CLASSES; k++) {
+        TEST_ASSERT(atomic_load(&c.pool[k].free_count) == cap[k]);
+    }
+
+    pktbuf_classes_destroy(&c);
+    return 0;
+}
+
+// --- AF_XDP UMEM addressing over the packet pool ---
+int test_xsk_umem_layout(void) {
+    // Frame data must start at XDP_PACKET_HEADROOM (256) into each chunk
+    TEST_ASSERT(sizeof(pktbuf_t) == PKTBUF_META_SIZE);
+    TEST_ASSERT(PKTBUF_META_SIZE + PKTBUF_HEADROOM == 256);
+
+    pktbuf_pool_t pool;
+    TEST_ASSERT(pktbuf_pool_init(&pool, 8) == 0);
+    // UMEM registration needs a page aligned region of equal chunks
+    TEST_ASSERT(((uintptr_t)pool.mem & 4095) == 0);
+    TEST_ASSERT(pool.stride % 64 == 0 && pool.stride <= 4096);
+
+    pktbuf_t *b = pktbuf_alloc(&pool);
+    TEST_ASSERT(b != NULL);
+    TEST_ASSERT(b->data - (uint8_t *)b == 256);
+
+    uint64_t addr = xsk_buf_addr(&pool, b);
+    TEST_ASSERT(addr % pool.stride == 0);
+    TEST_ASSERT(xsk_addr_buf(&pool, addr) == b);
+    // Any address inside the chunk (e.g. a TX completion for b->data) maps back to b
+    TEST_ASSERT(xsk_addr_buf(&pool, addr + 256) == b);
+    TEST_ASSERT(xsk_addr_buf(&pool, addr + pool.stride - 1) == b);
+
+    pktbuf_free(&pool, b);
+    pktbuf_thread_flush();
+    pktbuf_pool_destroy(&pool);
+    return 0;
+}
+
 // --- IPv4 Checksum & TTL related tests ---
 int test_ipv4_checksum_and_ttl(void) {
     // Build a simple IPv4 header
@@ -361,6 +1053,58 @@ int test_ipv4_checksum_and_ttl(void) {
     return 0;
 }
 
+int test_incremental_checksum(void) {
+    uint32_t seed = 0xC0FFEEu;
+    uint8_t raw[20 + 40]; /* Header with up to 40 bytes of options */
+
+    for (int iter = 0; iter < 5000; iter++) {
+        for (size_t i = 0; i < sizeof(raw); i++) {
+            seed = seed * 1103515245u + 12345u;
+            raw[i] = (uint8_t)(seed >> 16);
+        }
+        size_t ihl = 5 + (size_t)(iter % 11);
+        raw[0] = (uint8_t)(0x40 | ihl);
+        struct ipv4_hdr *ip = (struct ipv4_hdr *)raw;
+        if (ip->ttl < 2) ip->ttl = 2;
+
+        ip->checksum = 0;
+        ip->checksum = ipv4_checksum(ip, ihl * 4);
+
+        // TTL decrement: incremental result equals a full recompute
+        ipv4_dec_ttl(ip);
+        uint16_t incremental = ip->checksum;
+        ip->checksum = 0;
+        TEST_ASSERT(incremental == ipv4_checksum(ip, ihl * 4));
+        ip->checksum = incremental;
+
+        // Address rewrite (NAT): 32-bit replace
+        uint32_t new_src;
+        memcpy(&new_src, raw + 40, sizeof(new_src));
+        ip->checksum = csum_replace32(ip->checksum, ip->src_ip, new_src);
+        ip->src_ip = new_src;
+        TEST_ASSERT(ipv4_checksum(ip, ihl * 4) == 0);
+    }
+
+    // Wide checksum matches the reference at every length and alignment
+    uint8_t buf[1600];
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        seed = seed * 1103515245u + 12345u;
+        buf[i] = (uint8_t)(seed >> 16);
+    }
+    static uint16_t aligned[800]; /* ipv4_checksum() reads 16-bit words directly */
+    for (size_t off = 0; off < 4; off++) {
+        for (size_t len = 0; len <= 1500; len++) {
+            memcpy(aligned, buf + off, len);
+            TEST_ASSERT(inet_checksum(buf + off, len) == ipv4_checksum(aligned, len));
+        }
+    }
+    // All ones (sum overflows 16 bits plenty of times)
+    memset(buf, 0xFF, sizeof(buf));
+    TEST_ASSERT(inet_checksum(buf, sizeof(buf)) == ipv4_checksum(buf, sizeof(buf)));
+
+    return 0;
+}
+
 // --- ARP Table related tests ---
 int test_arp_table(void) {
     arp_table_t arpt;
@@ -520,6 +1264,230 @@ int test_ndp_expiry(void) {
 }
 
 // --- IPv6 Rule Matching related tests ---
+// --- Lock-free neighbour reads ---
+typedef struct {
+    arp_table_t *t;
+    atomic_bool stop;
+} arp_writer_ctx_t;
+
+static void *arp_test_writer(void *arg) {
+    arp_writer_ctx_t *ctx = (arp_writer_ctx_t *)arg;
+    static const uint8_t mac_a[6] = {0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    static const uint8_t mac_b[6] = {0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    uint32_t n = 0;
+
+    while (!atomic_load(&ctx->stop)) {
+        /* Flip the MAC of the watched entry, and churn its probe cluster
+         * (insert + expire shifts entries around it). */
+        arp_update(ctx->t, 0x0A000001, (n & 1) ? mac_a : mac_b);
+        arp_update(ctx->t, 0x0A000001 + 16 * (1 + (n % 4)), mac_a);
+        if ((n % 64) == 0) arp_expire(ctx->t, time(NULL) + ARP_TIMEOUT_SEC + 1);
+        n++;
+    }
+    return NULL;
+}
+
+int test_arp_lockfree_read(void) {
+    arp_table_t arpt;
+    TEST_ASSERT(arp_table_init(&arpt, 16) == 0);
+
+    arp_writer_ctx_t ctx = {.t = &arpt};
+    atomic_init(&ctx.stop, false);
+    pthread_t th;
+    TEST_ASSERT(pthread_create(&th, NULL, arp_test_writer, &ctx) == 0);
+
+    int torn = 0;
+    for (int i = 0; i < 200000; i++) {
+        uint8_t out[6];
+        if (!arp_get_mac(&arpt, 0x0A000001, out)) continue; /* Just expired */
+        /* Either MAC is fine, a mix of both is not. */
+        for (int j = 1; j < 6; j++) {
+            if (out[j] != out[0]) torn++;
+        }
+        if (out[0] != 0x11 && out[0] != 0x22) torn++;
+    }
+
+    atomic_store(&ctx.stop, true);
+    pthread_join(th, NULL);
+    TEST_ASSERT(torn == 0);
+    TEST_ASSERT((atomic_load(&arpt.seq) & 1u) == 0); /* No writer left inside */
+
+    arp_table_destroy(&arpt);
+    return 0;
+}
+
+int test_neigh_cache(void) {
+    static neigh_cache_t nc; /* 8 KB, keep it off the stack */
+    neigh_cache_init(&nc);
+
+    ip_addr_t a;
+    memset(&a, 0, sizeof(a));
+    a.v4 = 0x0A000001;
+    uint8_t mac[6] = {0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0x01};
+    uint8_t out[6];
+
+    TEST_ASSERT(!neigh_cache_get(&nc, 4, &a, 2, out));
+    neigh_cache_put(&nc, 4, &a, 2, mac);
+    TEST_ASSERT(neigh_cache_get(&nc, 4, &a, 2, out));
+    TEST_ASSERT(memcmp(out, mac, 6) == 0);
+
+    /* Table sequence moved on: entry is stale. */
+    TEST_ASSERT(!neigh_cache_get(&nc, 4, &a, 4, out));
+
+    /* Same bytes, other family: a different neighbour. */
+    ip_addr_t a6;
+    memset(&a6, 0, sizeof(a6));
+    memcpy(a6.v6, &a.v4, sizeof(a.v4));
+    TEST_ASSERT(!neigh_cache_get(&nc, 6, &a6, 2, out));
+
+    /* Many next hops: recent ones stay, the cache never grows. */
+    for (uint32_t i = 0; i < 4096; i++) {
+        a.v4 = 0x0A000000 + i;
+        mac[5] = (uint8_t)i;
+        neigh_cache_put(&nc, 4, &a, 6, mac);
+        TEST_ASSERT(neigh_cache_get(&nc, 4, &a, 6, out));
+        TEST_ASSERT(out[5] == (uint8_t)i);
+    }
+    int resident = 0;
+    for (uint32_t i = 0; i < 4096; i++) {
+        a.v4 = 0x0A000000 + i;
+        if (neigh_cache_get(&nc, 4, &a, 6, out)) resident++;
+    }
+    TEST_ASSERT(resident <= NEIGH_CACHE_ENTRIES);
+    TEST_ASSERT(resident > NEIGH_CACHE_ENTRIES / 2); /* Sets are reasonably balanced */
+    return 0;
+}
+
+// --- Control plane related tests ---
+static pktbuf_t *ctrl_arp_frame(pktbuf_pool_t *pool, uint16_t op, uint32_t spa, uint8_t sha_last,
+                                uint32_t tpa) {
+    pktbuf_t *b = pktbuf_alloc(pool);
+    if (!b) return NULL;
+    memset(b->data, 0, 64);
+    struct eth_hdr *eth = (struct eth_hdr *)b->data;
+    struct arp_hdr *arp = (struct arp_hdr *)(b->data + sizeof(struct eth_hdr));
+    memset(eth->dst, 0xff, 6);
+    uint8_t sha[6] = {0x02, 0, 0, 0, 0, sha_last};
+    memcpy(eth->src, sha, 6);
+    eth->ethertype = htons(ETH_TYPE_ARP);
+    arp->htype = htons(ARP_HW_ETHERNET);
+    arp->ptype = htons(ETH_TYPE_IPV4);
+    arp->hlen = ARP_HW_LEN_ETH;
+    arp->plen = ARP_PROTO_LEN;
+    arp->op = htons(op);
+    memcpy(arp->sha, sha, 6);
+    arp->spa = htonl(spa);
+    arp->tpa = htonl(tpa);
+    b->len = sizeof(struct eth_hdr) + sizeof(struct arp_hdr);
+    return b;
+}
+
+int test_control_plane(void) {
+    static pktbuf_pool_t pool;
+    arp_table_t arpt;
+    ndp_table_t ndpt;
+    TEST_ASSERT(pktbuf_pool_init(&pool, 64) == 0);
+    TEST_ASSERT(arp_table_init(&arpt, 16) == 0);
+    TEST_ASSERT(ndp_table_init(&ndpt, 16) == 0);
+
+    /* No socket: every reply that gets past the rate limit counts as dropped. */
+    tx_ctx_t tx = {.sock_fd = -1, .ifindex = 0, .eth_addr = {0x02, 0xaa, 0, 0, 0, 1},
+                   .ip4_addr = 0x0A000001, .ring = NULL};
+    control_plane_t c;
+    TEST_ASSERT(control_init(&c, -1, &tx, &arpt, &ndpt, 2) == 0);
+
+    // Test 1) control_frame(): ARP and NS/NA go to the control plane, others do not
+    pktbuf_t *bufs[8];
+    for (int i = 0; i < 4; i++) {
+        bufs[i] = ctrl_arp_frame(&pool, ARP_OP_REQUEST, 0x0A000002u + (uint32_t)i,
+                                 (uint8_t)(2 + i), 0x0A000001);
+        TEST_ASSERT(bufs[i] && control_frame(bufs[i]));
+    }
+    bufs[4] = ctrl_arp_frame(&pool, ARP_OP_REPLY, 0x0A000009, 9, 0x0A000001);
+    TEST_ASSERT(bufs[4]);
+
+    pktbuf_t *ns = pktbuf_alloc(&pool);
+    TEST_ASSERT(ns);
+    memset(ns->data, 0, 128);
+    struct eth_hdr *eth = (struct eth_hdr *)ns->data;
+    struct ipv6_hdr *ip6 = (struct ipv6_hdr *)(ns->data + sizeof(struct eth_hdr));
+    struct ndp_na_hdr *ndp =
+        (struct ndp_na_hdr *)(ns->data + sizeof(struct eth_hdr) + sizeof(struct ipv6_hdr));
+    eth->ethertype = htons(ETH_TYPE_IPV6);
+    ip6->next_header = IP_PROTO_ICMPV6;
+    ip6->src_addr[0] = 0xfe;
+    ip6->src_addr[1] = 0x80;
+    ip6->src_addr[15] = 0x01;
+    ndp->type = ICMPV6_NEIGHBOR_SOL;
+    uint8_t *opt = (uint8_t *)(ndp + 1);
+    uint8_t ns_mac[6] = {0x02, 0xbb, 0, 0, 0, 0x66};
+    opt[0] = NDP_OPT_SRC_LLADDR;
+    opt[1] = 1;
+    memcpy(opt + 2, ns_mac, 6);
+    ns->len = sizeof(struct eth_hdr) + sizeof(struct ipv6_hdr) + sizeof(struct ndp_na_hdr) + 8;
+    TEST_ASSERT(control_frame(ns));
+    bufs[5] = ns;
+
+    ndp->type = 128; /* Echo request */
+    TEST_ASSERT(!control_frame(ns));
+    ndp->type = ICMPV6_NEIGHBOR_SOL;
+    uint32_t short_len = ns->len;
+    ns->len = 20;
+    TEST_ASSERT(!control_frame(ns));
+    ns->len = short_len;
+
+    // Test 2) One burst: everything is learned in one write section per table,
+    // only 2 of the 4 requests get a reply (the bucket holds 2 tokens)
+    unsigned arp_seq = atomic_load(&arpt.seq);
+    unsigned ndp_seq = atomic_load(&ndpt.seq);
+    control_process(&c, bufs, 6, 5000000000ULL);
+    TEST_ASSERT(atomic_load(&arpt.seq) == arp_seq + 2);
+    TEST_ASSERT(atomic_load(&ndpt.seq) == ndp_seq + 2);
+    TEST_ASSERT(c.arp_frames == 5 && c.ndp_frames == 1);
+    TEST_ASSERT(c.replies_limited == 2);
+    TEST_ASSERT(c.replies_sent + c.replies_dropped == 2);
+
+    uint8_t out[6];
+    for (uint32_t i = 0; i < 4; i++) {
+        TEST_ASSERT(arp_get_mac(&arpt, 0x0A000002u + i, out) && out[5] == 2 + i);
+    }
+    TEST_ASSERT(arp_get_mac(&arpt, 0x0A000009, out) && out[5] == 9);
+    uint8_t fe80_1[16] = {0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01};
+    TEST_ASSERT(ndp_get_mac(&ndpt, fe80_1, out) && memcmp(out, ns_mac, 6) == 0);
+
+    // Test 3) Refreshing known neighbours changes nothing readers can see
+    arp_seq = atomic_load(&arpt.seq);
+    bufs[0] = ctrl_arp_frame(&pool, ARP_OP_REPLY, 0x0A000009, 9, 0x0A000001);
+    TEST_ASSERT(bufs[0]);
+    control_process(&c, bufs, 1, 5100000000ULL);
+    TEST_ASSERT(atomic_load(&arpt.seq) == arp_seq);
+
+    // Test 4) Half a second later the bucket holds one token again
+    for (int i = 0; i < 2; i++) {
+        bufs[i] = ctrl_arp_frame(&pool, ARP_OP_REQUEST, 0x0A000002, 2, 0x0A000001);
+        TEST_ASSERT(bufs[i]);
+    }
+    control_process(&c, bufs, 2, 5500000000ULL);
+    TEST_ASSERT(c.replies_limited == 3);
+    TEST_ASSERT(c.replies_sent + c.replies_dropped == 3);
+
+    // Test 5) Requests for another address are learned from, never answered
+    bufs[0] = ctrl_arp_frame(&pool, ARP_OP_REQUEST, 0x0A000003, 3, 0x0A0000FE);
+    TEST_ASSERT(bufs[0]);
+    control_process(&c, bufs, 1, 9000000000ULL);
+    TEST_ASSERT(c.replies_limited == 3);
+    TEST_ASSERT(c.replies_sent + c.replies_dropped == 3);
+
+    // Test 6) Every frame was freed
+    pktbuf_thread_flush();
+    TEST_ASSERT(atomic_load(&pool.free_count) == 64);
+
+    arp_table_destroy(&arpt);
+    ndp_table_destroy(&ndpt);
+    pktbuf_pool_destroy(&pool);
+    return 0;
+}
+
 int test_ipv6_rule_matching(void) {
     rule_table_t rt;
     TEST_ASSERT(rule_table_init(&rt, 10) == 0);
@@ -589,6 +1557,758 @@ int test_ipv6_rule_matching(void) {
     return 0;
 }
 
+// --- Compiled classifier vs. linear scan ---
+static uint32_t test_rng_state = 0x12345678u;
+static uint32_t test_rand(void) {
+    // xorshift32: deterministic, so failures are reproducible
+    uint32_t x = test_rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    test_rng_state = x;
+    return x;
+}
+
+int test_classifier_matches_linear(void) {
+    // Small value pools so that random keys actually hit rules
+    static const uint16_t ports[] = {0, 22, 53, 80, 443};
+    static const uint8_t protos[] = {0, 6, 17};
+    static const uint8_t v4_prefixes[] = {0, 8, 16, 24, 32};
+    static const uint8_t v6_prefixes[] = {0, 16, 32, 64, 128};
+
+    rule_table_t linear, compiled;
+    TEST_ASSERT(rule_table_init(&linear, 512) == 0);
+    TEST_ASSERT(rule_table_init(&compiled, 512) == 0);
+
+    for (int i = 0; i < 400; i++) {
+        rule_t r;
+        memset(&r, 0, sizeof(r));
+        r.priority = test_rand() % 1000; // duplicates exercise the rule_id tie breaker
+        r.ip_ver = (uint8_t[]){0, 4, 6}[test_rand() % 3];
+        r.protocol = protos[test_rand() % 3];
+        r.src_port = ports[test_rand() % 5];
+        r.dst_port = ports[test_rand() % 5];
+        r.action.type = (test_rand() & 1) ? ACT_FWD : ACT_DROP;
+
+        if (r.ip_ver == 4) {
+            ipv4_mask_from_prefix(v4_prefixes[test_rand() % 5], &r.src_mask.v4);
+            ipv4_mask_from_prefix(v4_prefixes[test_rand() % 5], &r.dst_mask.v4);
+            r.src_ip.v4 = 0x0a000000u | (test_rand() & 0x0303u);
+            r.dst_ip.v4 = 0x0a000000u | (test_rand() & 0x0303u);
+        } else if (r.ip_ver == 6) {
+            ipv6_mask_from_prefix(v6_prefixes[test_rand() % 5], r.src_mask.v6);
+            ipv6_mask_from_prefix(v6_prefixes[test_rand() % 5], r.dst_mask.v6);
+            r.src_ip.v6[0] = 0x20;
+            r.src_ip.v6[15] = (uint8_t)(test_rand() & 3);
+            r.dst_ip.v6[0] = 0x20;
+            r.dst_ip.v6[15] = (uint8_t)(test_rand() & 3);
+        }
+        TEST_ASSERT(rule_table_add(&linear, &r) == 0);
+        TEST_ASSERT(rule_table_add(&compiled, &r) == 0);
+    }
+
+    TEST_ASSERT(rule_table_compile(&compiled) == 0);
+    TEST_ASSERT(compiled.cls != NULL);
+    TEST_ASSERT(linear.cls == NULL);
+    // Far fewer tuples than rules, otherwise there is nothing to gain
+    TEST_ASSERT(compiled.cls->tuple_count < compiled.count / 2);
+
+    int hits = 0;
+    for (int i = 0; i < 20000; i++) {
+        flow_key_t k;
+        memset(&k, 0, sizeof(k));
+        k.ip_ver = (test_rand() & 1) ? 4 : 6;
+        k.protocol = protos[1 + test_rand() % 2];
+        k.src_port = ports[test_rand() % 5];
+        k.dst_port = ports[test_rand() % 5];
+        if (k.ip_ver == 4) {
+            k.src_ip.v4 = 0x0a000000u | (test_rand() & 0x0303u);
+            k.dst_ip.v4 = 0x0a000000u | (test_rand() & 0x0303u);
+        } else {
+            k.src_ip.v6[0] = 0x20;
+            k.src_ip.v6[15] = (uint8_t)(test_rand() & 3);
+            k.dst_ip.v6[0] = 0x20;
+            k.dst_ip.v6[15] = (uint8_t)(test_rand() & 3);
+        }
+
+        const rule_t *a = rule_table_match(&linear, &k);
+        const rule_t *b = rule_table_match(&compiled, &k);
+        TEST_ASSERT((a == NULL) == (b == NULL));
+        if (a) {
+            TEST_ASSERT(a->rule_id == b->rule_id);
+            hits++;
+        }
+    }
+    TEST_ASSERT(hits > 1000);
+
+    // Adding a rule invalidates the compiled classifier
+    rule_t extra;
+    memset(&extra, 0, sizeof(extra));
+    TEST_ASSERT(rule_table_add(&compiled, &extra) == 0);
+    TEST_ASSERT(compiled.cls == NULL);
+
+    rule_table_destroy(&linear);
+    rule_table_destroy(&compiled);
+    return 0;
+}
+
+// --- Incremental rule updates ---
+static void random_rule(rule_t *r) {
+    static const uint16_t ports[] = {0, 22, 53, 80, 443};
+    static const uint8_t protos[] = {0, 6, 17};
+
+    memset(r, 0, sizeof(*r));
+    r->priority = test_rand() % 1000;
+    r->ip_ver = (test_rand() & 1) ? 4 : 0;
+    r->protocol = protos[test_rand() % 3];
+    r->src_port = ports[test_rand() % 5];
+    r->dst_port = ports[test_rand() % 5];
+    r->action.type = ACT_DROP;
+    if (r->ip_ver == 4) {
+        ipv4_mask_from_prefix((uint8_t)(8 * (test_rand() % 5)), &r->dst_mask.v4);
+        r->dst_ip.v4 = 0x0a000000u | (test_rand() & 0x0303u);
+    }
+}
+
+/* Number of random keys `t`'s classifier matches, or -1 if it disagrees with a linear scan. */
+static int classifier_vs_scan(const rule_table_t *t) {
+    static const uint16_t ports[] = {0, 22, 53, 80, 443};
+
+    rule_table_t linear = *t;
+    linear.cls = NULL;
+    int hits = 0;
+    for (int i = 0; i < 20000; i++) {
+        flow_key_t k;
+        memset(&k, 0, sizeof(k));
+        k.ip_ver = 4;
+        k.protocol = (test_rand() & 1) ? 6 : 17;
+        k.src_port = ports[test_rand() % 5];
+        k.dst_port = ports[test_rand() % 5];
+        k.dst_ip.v4 = 0x0a000000u | (test_rand() & 0x0303u);
+
+        const rule_t *a = rule_table_match(&linear, &k);
+        const rule_t *b = rule_table_match(t, &k);
+        if ((a == NULL) != (b == NULL) || (a && a->rule_id != b->rule_id)) return -1;
+        if (a) hits++;
+    }
+    return hits;
+}
+
+int test_rule_table_apply(void) {
+
+    rule_table_t cur, next;
+    TEST_ASSERT(rule_table_init(&cur, 256) == 0);
+    for (int i = 0; i < 200; i++) {
+        rule_t r;
+        random_rule(&r);
+        TEST_ASSERT(rule_table_add(&cur, &r) == 0);
+    }
+    TEST_ASSERT(rule_table_compile(&cur) == 0);
+    uint32_t gen = cur.generation;
+
+    // Test 1) A rule id nobody has: rejected by index, nothing changes.
+    rule_delta_t bad[2];
+    memset(bad, 0, sizeof(bad));
+    bad[0].op = RULE_ADD;
+    bad[1].op = RULE_DELETE;
+    bad[1].rule_id = 500;
+    size_t failed = 0;
+    TEST_ASSERT(rule_table_apply(&next, &cur, bad, 2, &failed) == -1);
+    TEST_ASSERT(failed == 1);
+    TEST_ASSERT(cur.count == 200 && cur.next_id == 200 && cur.generation == gen);
+
+    // Test 2) Delete, modify, add; a rule added and deleted again in the same delta.
+    rule_delta_t d[40];
+    memset(d, 0, sizeof(d));
+    for (uint32_t i = 0; i < 10; i++) {
+        d[i].op = RULE_DELETE;
+        d[i].rule_id = i * 7;
+        d[10 + i].op = RULE_MODIFY;
+        d[10 + i].rule_id = i * 7 + 3;
+        random_rule(&d[10 + i].rule);
+        d[20 + i].op = RULE_ADD;
+        random_rule(&d[20 + i].rule);
+    }
+    d[30].op = RULE_ADD;
+    d[31].op = RULE_DELETE;
+    d[31].rule_id = 210; // The rule d[30] adds
+    TEST_ASSERT(rule_table_apply(&next, &cur, d, 32, &failed) == 0);
+    TEST_ASSERT(next.count == 200 - 10 + 10);
+    TEST_ASSERT(next.next_id == 211);
+    TEST_ASSERT(next.capacity == cur.capacity); // Per-rule counters stay usable
+    TEST_ASSERT(next.generation != gen);
+    TEST_ASSERT(next.cls != NULL);
+    for (uint32_t i = 0; i < 10; i++) {
+        TEST_ASSERT(d[20 + i].rule_id == 200 + i);
+    }
+    TEST_ASSERT(d[30].rule_id == 210);
+
+    bool seen[211] = {false};
+    for (size_t i = 0; i < next.count; i++) {
+        const rule_t *r = &next.rules[i];
+        TEST_ASSERT(r->rule_id < 210 && !seen[r->rule_id]);
+        TEST_ASSERT(r->rule_id >= 70 || r->rule_id % 7 != 0); // Deleted
+        seen[r->rule_id] = true;
+        if (i > 0) { // Still in priority order
+            const rule_t *prev = &next.rules[i - 1];
+            TEST_ASSERT(prev->priority < r->priority ||
+                        (prev->priority == r->priority && prev->rule_id < r->rule_id));
+        }
+        if (r->rule_id < 200 && (r->rule_id >= 70 || r->rule_id % 7 != 3)) {
+            size_t j = 0; // Untouched: the same rule as before
+            while (cur.rules[j].rule_id != r->rule_id) j++;
+            TEST_ASSERT(memcmp(&cur.rules[j], r, sizeof(*r)) == 0);
+        }
+    }
+    for (uint32_t i = 0; i < 10; i++) {
+        TEST_ASSERT(seen[i * 7 + 3] && seen[200 + i]);
+        size_t j = 0; // Modified: same id, the new version
+        while (next.rules[j].rule_id != i * 7 + 3) j++;
+        TEST_ASSERT(next.rules[j].priority == d[10 + i].rule.priority);
+        TEST_ASSERT(next.rules[j].dst_port == d[10 + i].rule.dst_port);
+    }
+
+    // Test 3) Dropped before it is published (publish_rules() out of memory):
+    // `cur` keeps the tuples it shared with `next` and still matches.
+    rule_delta_t mod;
+    memset(&mod, 0, sizeof(mod));
+    mod.op = RULE_MODIFY;
+    mod.rule_id = 1;
+    random_rule(&mod.rule);
+    rule_table_t dropped;
+    TEST_ASSERT(rule_table_apply(&dropped, &cur, &mod, 1, &failed) == 0);
+    rule_table_destroy(&dropped);
+    for (size_t i = 0; i < cur.cls->tuple_count; i++) {
+        TEST_ASSERT(cur.cls->owned[i]);
+    }
+    TEST_ASSERT(classifier_vs_scan(&cur) > 1000);
+
+    // Test 4) The updated classifier, alone once `cur` is gone, agrees with a linear scan.
+    size_t shared = 0;
+    for (size_t i = 0; i < next.cls->tuple_count; i++) {
+        shared += !next.cls->owned[i];
+    }
+    TEST_ASSERT(shared > 0); // Untouched tuples are not built again
+    rule_table_take_over(&next, &cur);
+    for (size_t i = 0; i < next.cls->tuple_count; i++) {
+        TEST_ASSERT(next.cls->owned[i]);
+    }
+    rule_table_destroy(&cur);
+    TEST_ASSERT(classifier_vs_scan(&next) > 1000);
+
+    rule_table_destroy(&next);
+    return 0;
+}
+
+
+int test_flow_cache(void) {
+    flow_cache_t fc;
+    TEST_ASSERT(flow_cache_init(&fc, 16) == 0); /* 2 buckets of 8 ways */
+    TEST_ASSERT(fc.bucket_mask == 1);
+
+    rule_table_t rt;
+    TEST_ASSERT(rule_table_init(&rt, 8) == 0);
+    rule_t r;
+    memset(&r, 0, sizeof(r));
+    TEST_ASSERT(rule_table_add(&rt, &r) == 0);
+    uint32_t gen = rt.generation;
+    TEST_ASSERT(gen != 0);
+
+    flow_key_t k;
+    memset(&k, 0xAB, sizeof(k)); /* Garbage in the unused v6 bytes must not matter. */
+    k.ip_ver = 4;
+    k.src_ip.v4 = 0x0A000001;
+    k.dst_ip.v4 = 0x0A000002;
+    k.src_port = 1000;
+    k.dst_port = 80;
+    k.protocol = 6;
+
+    flow_cache_key_t ck;
+    flow_cache_key(&k, &ck);
+    TEST_ASSERT(ck.src[1] == 0 && ck.dst[1] == 0);
+    uint64_t h = flow_cache_hash(&ck);
+
+    TEST_ASSERT(flow_cache_lookup(&fc, &ck, h, gen) == NULL);
+    flow_cache_entry_t *e = flow_cache_insert(&fc, &ck, h, &rt.rules[0], gen);
+    TEST_ASSERT(e != NULL && !e->mac_valid);
+    TEST_ASSERT(flow_cache_lookup(&fc, &ck, h, gen) == e);
+    TEST_ASSERT(fc.hits == 1 && fc.misses == 1);
+
+    /* Reverse direction is a different flow. */
+    flow_key_t rev = k;
+    rev.src_ip.v4 = k.dst_ip.v4;
+    rev.dst_ip.v4 = k.src_ip.v4;
+    flow_cache_key_t rck;
+    flow_cache_key(&rev, &rck);
+    TEST_ASSERT(flow_cache_lookup(&fc, &rck, flow_cache_hash(&rck), gen) == NULL);
+
+    /* Changing the rule table invalidates the entry, re-insert reuses its way. */
+    TEST_ASSERT(rule_table_add(&rt, &r) == 0);
+    TEST_ASSERT(rt.generation != gen);
+    TEST_ASSERT(flow_cache_lookup(&fc, &ck, h, rt.generation) == NULL);
+    TEST_ASSERT(flow_cache_insert(&fc, &ck, h, &rt.rules[0], rt.generation) == e);
+
+    /* A separately built table (reload) never shares a generation. */
+    rule_table_t rt2;
+    TEST_ASSERT(rule_table_init(&rt2, 8) == 0);
+    TEST_ASSERT(rt2.generation != rt.generation);
+
+    /* Size stays bounded: fill with many flows, hits survive only if inserted. */
+    for (uint32_t i = 0; i < 1000; i++) {
+        k.src_port = (uint16_t)i;
+        flow_cache_key(&k, &ck);
+        h = flow_cache_hash(&ck);
+        TEST_ASSERT(flow_cache_insert(&fc, &ck, h, NULL, rt.generation) != NULL);
+        TEST_ASSERT(flow_cache_lookup(&fc, &ck, h, rt.generation) != NULL);
+    }
+    TEST_ASSERT(fc.evictions >= 1000 - 16);
+
+    /* Neighbour generation moves on learn/change only, not on refresh. */
+    arp_table_t arpt;
+    TEST_ASSERT(arp_table_init(&arpt, 16) == 0);
+    uint8_t mac1[6] = {1, 2, 3, 4, 5, 6};
+    uint8_t mac2[6] = {1, 2, 3, 4, 5, 7};
+    unsigned g0 = atomic_load(&arpt.seq);
+    arp_update(&arpt, 0x0A000002, mac1);
+    unsigned g1 = atomic_load(&arpt.seq);
+    TEST_ASSERT(g1 != g0);
+    arp_update(&arpt, 0x0A000002, mac1);
+    TEST_ASSERT(atomic_load(&arpt.seq) == g1);
+    arp_update(&arpt, 0x0A000002, mac2);
+    TEST_ASSERT(atomic_load(&arpt.seq) != g1);
+
+    arp_table_destroy(&arpt);
+    rule_table_destroy(&rt2);
+    rule_table_destroy(&rt);
+    flow_cache_destroy(&fc);
+    return 0;
+}
+
+static flow_key_t ct_flow(uint8_t proto, uint32_t src, uint16_t sport, uint32_t dst,
+                          uint16_t dport) {
+    flow_key_t k;
+    memset(&k, 0, sizeof(k));
+    k.ip_ver = 4;
+    k.protocol = proto;
+    k.src_ip.v4 = src;
+    k.dst_ip.v4 = dst;
+    k.src_port = sport;
+    k.dst_port = dport;
+    return k;
+}
+
+static conntrack_entry_t *ct_find(conntrack_t *ct, const flow_key_t *k, bool *swapped) {
+    conntrack_key_t ck;
+    conntrack_key(k, &ck);
+    if (swapped) *swapped = ck.swapped;
+    return conntrack_lookup(ct, &ck, conntrack_hash(&ck));
+}
+
+static conntrack_entry_t *ct_add(conntrack_t *ct, const flow_key_t *k, const rule_t *r) {
+    conntrack_key_t ck;
+    conntrack_key(k, &ck);
+    conntrack_entry_t *e = conntrack_insert(ct, &ck, conntrack_hash(&ck), r, 1);
+    conntrack_update(ct, e, false, k->tcp_flags);
+    return e;
+}
+
+int test_conntrack(void) {
+    conntrack_t ct;
+    rule_t r;
+    memset(&r, 0, sizeof(r));
+    TEST_ASSERT(conntrack_init(&ct, 0, 1000) == -1);
+    TEST_ASSERT(conntrack_init(&ct, (size_t)CONNTRACK_ENTRIES_MAX + 1, 1000) == -1);
+    TEST_ASSERT(conntrack_init(&ct, 4, 1000) == 0);
+    TEST_ASSERT(conntrack_memory(&ct) >= 4 * sizeof(conntrack_entry_t));
+
+    // Test 1) Both directions of a flow share one key, told apart by `swapped`.
+    flow_key_t a = ct_flow(IP_PROTO_UDP, 0x0a000001u, 5000, 0x0a000002u, 53);
+    flow_key_t b = ct_flow(IP_PROTO_UDP, 0x0a000002u, 53, 0x0a000001u, 5000);
+    conntrack_key_t ka, kb;
+    conntrack_key(&a, &ka);
+    conntrack_key(&b, &kb);
+    TEST_ASSERT(memcmp(&ka.key, &kb.key, sizeof(ka.key)) == 0);
+    TEST_ASSERT(ka.swapped != kb.swapped);
+    TEST_ASSERT(conntrack_hash(&ka) == conntrack_hash(&kb));
+    flow_key_t other = ct_flow(IP_PROTO_TCP, 0x0a000001u, 5000, 0x0a000002u, 53);
+    conntrack_key(&other, &kb);
+    TEST_ASSERT(memcmp(&ka.key, &kb.key, sizeof(ka.key)) != 0);
+
+    // Test 2) A reply finds the connection and establishes it.
+    TEST_ASSERT(ct_find(&ct, &a, NULL) == NULL);
+    conntrack_entry_t *e = ct_add(&ct, &a, &r);
+    TEST_ASSERT(e->state == CT_NEW && e->rule == &r);
+    bool swapped = false;
+    TEST_ASSERT(ct_find(&ct, &b, &swapped) == e);
+    TEST_ASSERT(swapped != e->orig_swapped); // Reply direction
+    conntrack_update(&ct, e, true, 0);
+    TEST_ASSERT(e->state == CT_ESTABLISHED);
+    TEST_ASSERT(e->expires == 1000 + CONNTRACK_TIMEOUT_UDP);
+    TEST_ASSERT(ct.count == 1 && ct.inserts == 1 && ct.hits == 1);
+
+    // Test 3) A refresh moves the timeout on; the wheel relinks the entry lazily.
+    conntrack_advance(&ct, 1100);
+    TEST_ASSERT(ct_find(&ct, &a, NULL) == e);
+    conntrack_update(&ct, e, false, 0);
+    TEST_ASSERT(e->expires == 1100 + CONNTRACK_TIMEOUT_UDP);
+    conntrack_advance(&ct, 1000 + CONNTRACK_TIMEOUT_UDP + 1); // The old slot comes up
+    TEST_ASSERT(ct.count == 1 && ct.expired == 0);
+    conntrack_advance(&ct, 1100 + CONNTRACK_TIMEOUT_UDP);
+    TEST_ASSERT(ct.count == 0 && ct.expired == 1);
+    TEST_ASSERT(ct_find(&ct, &a, NULL) == NULL);
+
+    // Test 4) FIN shortens an established TCP connection's timeout; SYN reuses it.
+    uint32_t now = 1100 + CONNTRACK_TIMEOUT_UDP;
+    flow_key_t t = ct_flow(IP_PROTO_TCP, 0x0a000001u, 40000, 0x0a000002u, 80);
+    t.tcp_flags = TCP_FLAG_SYN;
+    e = ct_add(&ct, &t, &r);
+    TEST_ASSERT(e->expires == now + CONNTRACK_TIMEOUT_NEW);
+    conntrack_update(&ct, e, true, TCP_FLAG_SYN | TCP_FLAG_ACK);
+    TEST_ASSERT(e->state == CT_ESTABLISHED && e->expires == now + CONNTRACK_TIMEOUT_TCP);
+    conntrack_update(&ct, e, false, TCP_FLAG_FIN | TCP_FLAG_ACK);
+    TEST_ASSERT(e->state == CT_CLOSING && e->expires == now + CONNTRACK_TIMEOUT_CLOSE);
+    conntrack_update(&ct, e, false, TCP_FLAG_SYN);
+    TEST_ASSERT(e->state == CT_NEW);
+    conntrack_update(&ct, e, true, TCP_FLAG_RST);
+    TEST_ASSERT(e->state == CT_CLOSING);
+    conntrack_advance(&ct, now + CONNTRACK_TIMEOUT_CLOSE);
+    TEST_ASSERT(ct.count == 0 && ct.expired == 2);
+
+    // Test 5) A full table evicts the connection closest to timing out.
+    for (uint16_t i = 0; i < 4; i++) {
+        flow_key_t k = ct_flow(IP_PROTO_UDP, 0x0a000001u, (uint16_t)(1000 + i), 0x0a000002u, 53);
+        e = ct_add(&ct, &k, &r);
+        if (i > 0) conntrack_update(&ct, e, true, 0); // Established: lives longer
+    }
+    flow_key_t k5 = ct_flow(IP_PROTO_UDP, 0x0a000001u, 2000, 0x0a000002u, 53);
+    ct_add(&ct, &k5, &r);
+    TEST_ASSERT(ct.count == 4 && ct.evictions == 1);
+    flow_key_t k0 = ct_flow(IP_PROTO_UDP, 0x0a000001u, 1000, 0x0a000002u, 53);
+    TEST_ASSERT(ct_find(&ct, &k0, NULL) == NULL);
+    TEST_ASSERT(ct_find(&ct, &k5, NULL) != NULL);
+    conntrack_destroy(&ct);
+
+    // Test 6) Removals keep every other connection reachable (no tombstones).
+    TEST_ASSERT(conntrack_init(&ct, 512, 0) == 0);
+    for (uint16_t i = 0; i < 512; i++) {
+        flow_key_t k = ct_flow(IP_PROTO_TCP, 0x0a000000u | i, 1, 0x0b000000u, 2);
+        ct_add(&ct, &k, &r);
+    }
+    for (uint16_t i = 0; i < 512; i += 2) {
+        flow_key_t k = ct_flow(IP_PROTO_TCP, 0x0a000000u | i, 1, 0x0b000000u, 2);
+        e = ct_find(&ct, &k, NULL);
+        TEST_ASSERT(e != NULL);
+        conntrack_remove(&ct, e);
+    }
+    TEST_ASSERT(ct.count == 256);
+    for (uint16_t i = 0; i < 512; i++) {
+        flow_key_t k = ct_flow(IP_PROTO_TCP, 0x0a000000u | i, 1, 0x0b000000u, 2);
+        TEST_ASSERT((ct_find(&ct, &k, NULL) != NULL) == (i % 2 == 1));
+    }
+
+    // Test 7) A long pause expires everything in one pass over the wheel.
+    conntrack_advance(&ct, 100000);
+    TEST_ASSERT(ct.count == 0 && ct.expired == 256);
+    conntrack_destroy(&ct);
+    return 0;
+}
+
+int test_policer(void) {
+    // Test 1) Shares add up to the rate and follow the demand.
+    uint64_t share[4];
+    uint64_t none[4] = {0, 0, 0, 0};
+    policer_split(1000, none, 1, share);
+    TEST_ASSERT(share[0] == 1000);
+    policer_split(1000, none, 4, share);
+    TEST_ASSERT(share[0] == 250 && share[1] == 250 && share[2] == 250 && share[3] == 250);
+    uint64_t one[4] = {0, 5000, 0, 0};
+    policer_split(1000, one, 4, share);
+    TEST_ASSERT(share[0] == 62 && share[2] == 62 && share[3] == 62); // The 1/(4n) floor
+    TEST_ASSERT(share[1] == 1000 - 3 * 62);
+    uint64_t skew[3] = {1, 2, 7};
+    policer_split(999, skew, 3, share);
+    TEST_ASSERT(share[0] + share[1] + share[2] == 999);
+    TEST_ASSERT(share[0] < share[1] && share[1] < share[2]);
+
+    // Test 2) 1000 B/s with a 3000 byte burst, on a 1 GHz clock.
+    policer_t p;
+    memset(&p, 0, sizeof(p));
+    policer_configure(&p, 1000, 3000, 1e9);
+    uint64_t now = 5000000000ULL;
+    int conform = 0;
+    for (int i = 0; i < 10; i++) {
+        conform += policer_conform(&p, now, 1000);
+    }
+    TEST_ASSERT(conform == 4); // The burst, and the packet that starts it
+    TEST_ASSERT(!policer_conform(&p, now + 500000000ULL, 1000));
+    TEST_ASSERT(policer_conform(&p, now + 1000000000ULL, 1000));
+
+    // Test 3) Offered at twice the rate for a minute: half of it conforms.
+    conform = 0;
+    for (int i = 0; i < 120; i++) {
+        now += 500000000ULL;
+        conform += policer_conform(&p, now, 1000);
+    }
+    TEST_ASSERT(conform >= 58 && conform <= 61); // Less what the burst still owed
+
+    // Test 4) Rule keys: rate in bits per second, burst in bytes.
+    rule_t r;
+    char err[128];
+    TEST_ASSERT(rule_config_parse_line("action=fwd out_iface=lo rate=8M burst=64k", &r, err,
+                                       sizeof(err)) == 0);
+    TEST_ASSERT(r.action.rate == 1000000 && r.action.burst == 64000);
+    TEST_ASSERT(rule_config_parse_line("action=fwd out_iface=lo rate=80M", &r, err,
+                                       sizeof(err)) == 0);
+    TEST_ASSERT(r.action.burst == 100000); // Default: 10ms at the rate
+    TEST_ASSERT(rule_config_parse_line("action=drop rate=1M", &r, err, sizeof(err)) == -1);
+    TEST_ASSERT(rule_config_parse_line("action=fwd out_iface=lo burst=1k", &r, err,
+                                       sizeof(err)) == -1);
+    TEST_ASSERT(rule_config_parse_line("action=fwd out_iface=lo rate=1T", &r, err,
+                                       sizeof(err)) == -1);
+    TEST_ASSERT(rule_config_parse_line("action=fwd out_iface=lo rate=-5", &r, err,
+                                       sizeof(err)) == -1);
+    return 0;
+}
+
+/* Whole contents of `f`, NUL-terminated; the caller frees it. */
+static char *read_log_file(FILE *f) {
+    fflush(f);
+    long size = ftell(f);
+    char *buf = calloc(1, (size_t)size + 1);
+    rewind(f);
+    size_t n = fread(buf, 1, (size_t)size, f);
+    buf[n] = '\0';
+    return buf;
+}
+
+int test_log_async(void) {
+    FILE *f = tmpfile();
+    TEST_ASSERT(f != NULL);
+    log_set_output(f);
+    log_level_t saved = log_get_level();
+    log_set_level(LOG_DEBUG);
+
+    // Test 1) Records come out formatted as printf would, after the drain.
+    TEST_ASSERT(log_async_start() == 0);
+    TEST_ASSERT(log_thread_attach() == 0);
+    char name[16] = "eth0";
+    log_msg(LOG_WARN, "A %d %u %s %zu %x %#llx %.2f %c |%5.2s|%-4d|%*d| 100%%", -7, 7u, name,
+            (size_t)1234, 255u, 0xabcULL, 3.14159, 'z', "xyz", 42, 3, 5);
+    strcpy(name, "gone"); /* Strings are copied, not referenced */
+    log_msg(LOG_INFO, "B %s %p", (const char *)NULL, (void *)0x1000);
+    log_msg(LOG_INFO, "C %d %d %d %d %d %d %d %d %d", 1, 2, 3, 4, 5, 6, 7, 8, 9); // > 8 args
+    const uint8_t pkt[20] = {0x45, 0x00, 'h', 'i'};
+    log_hexdump(LOG_DEBUG, pkt, sizeof(pkt));
+    uint8_t big[300] = {0};
+    log_hexdump(LOG_DEBUG, big, sizeof(big));
+    log_async_stop();
+
+    char *out = read_log_file(f);
+    TEST_ASSERT(strstr(out, "[WARN] A -7 7 eth0 1234 ff 0xabc 3.14 z |   xy|42  |  5| 100%\n"));
+    TEST_ASSERT(strstr(out, "[INFO] B (null) 0x1000\n"));
+    TEST_ASSERT(strstr(out, "[INFO] C 1 2 3 4 5 6 7 8 9\n"));
+    TEST_ASSERT(strstr(out, "0000  45  00  68  69  "));
+    TEST_ASSERT(strstr(out, "|E.hi"));
+    TEST_ASSERT(strstr(out, "(132 more bytes)"));
+    TEST_ASSERT(strstr(out, "gone") == NULL);
+    free(out);
+
+    // Test 2) A flood: every record is either written or counted as dropped.
+    log_set_level(LOG_INFO);
+    TEST_ASSERT(freopen(NULL, "w+", f) == f);
+    TEST_ASSERT(log_async_start() == 0);
+    TEST_ASSERT(log_thread_attach() == 0);
+    const int FLOOD = 8 * LOG_RING_SLOTS;
+    for (int i = 0; i < FLOOD; i++) {
+        log_msg(LOG_INFO, "flood %d", i);
+    }
+    log_msg(LOG_DEBUG, "flood filtered"); // By level, before the ring: neither written nor dropped
+    uint64_t dropped = log_dropped();
+    log_async_stop();
+
+    out = read_log_file(f);
+    int lines = 0;
+    for (const char *p = strstr(out, "] flood "); p; p = strstr(p + 1, "] flood ")) {
+        lines++;
+    }
+    TEST_ASSERT((uint64_t)lines + dropped == (uint64_t)FLOOD);
+    TEST_ASSERT(dropped == 0 || strstr(out, "messages dropped (ring full)"));
+    TEST_ASSERT(strstr(out, "] flood 0\n")); // The oldest records are kept
+    free(out);
+
+    // Test 3) Rate limit: LOG_RATELIMIT_BURST per second, then one summary line.
+    TEST_ASSERT(freopen(NULL, "w+", f) == f);
+    log_ratelimit_t rl = {0};
+    int passed = 0;
+    for (int i = 0; i < 100; i++) {
+        passed += log_ratelimit(&rl, 100, LOG_WARN, "send failed: %s");
+    }
+    TEST_ASSERT(passed == LOG_RATELIMIT_BURST);
+    TEST_ASSERT(log_ratelimit(&rl, 101, LOG_WARN, "send failed: %s"));
+    out = read_log_file(f);
+    TEST_ASSERT(strstr(out, "[WARN] Suppressed 95 messages like: send failed: %s\n"));
+    free(out);
+
+    log_set_output(NULL);
+    log_set_level(saved);
+    fclose(f);
+    return 0;
+}
+
+int test_tx_ring_oversized(void) {
+    // Needs CAP_NET_RAW and a loopback interface; skipped without them.
+    tx_ctx_t tx;
+    if (tx_init(&tx, "lo") != 0) return 0;
+    if (tx_ring_enable(&tx) != 0) {
+        tx_close(&tx);
+        return 0;
+    }
+
+    // Receiver for a local experimental EtherType, so other loopback traffic is not counted.
+    const uint16_t proto = 0x88b5;
+    int rx = socket(AF_PACKET, SOCK_RAW, htons(proto));
+    TEST_ASSERT(rx >= 0);
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(proto);
+    sll.sll_ifindex = tx.ifindex;
+    TEST_ASSERT(bind(rx, (struct sockaddr *)&sll, sizeof(sll)) == 0);
+    struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
+    setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    // Test 1) A jumbo frame in the middle of a batch is dropped alone.
+    static uint8_t bufs[4][9000];
+    const uint8_t *frames[4];
+    size_t lens[4] = {60, 9000, 60, 60};
+    for (int i = 0; i < 4; i++) {
+        memset(bufs[i], 0, 14);
+        bufs[i][12] = (uint8_t)(proto >> 8);
+        bufs[i][13] = (uint8_t)proto;
+        bufs[i][14] = (uint8_t)i; // Frame number, to check the order
+        frames[i] = bufs[i];
+    }
+    TEST_ASSERT(tx_send_batch(&tx, frames, lens, 4) == 3);
+
+    // Test 2) The frames after it go out, in order.
+    static const uint8_t expect[3] = {0, 2, 3};
+    for (int i = 0; i < 3; i++) {
+        uint8_t buf[128];
+        ssize_t n = recv(rx, buf, sizeof(buf), 0);
+        TEST_ASSERT(n == 60);
+        TEST_ASSERT(buf[14] == expect[i]);
+    }
+
+    close(rx);
+    tx_close(&tx);
+    return 0;
+}
+
+int test_perf_counters(void) {
+    // Test 1) Nothing open: reads fail, close is harmless.
+    perf_counters_t pc;
+    perf_counters_init(&pc);
+    uint64_t v[PERF_EVENTS];
+    TEST_ASSERT(!perf_counters_read(&pc, v));
+    perf_counters_close(&pc);
+
+    // Test 2) Events the machine offers count forward; the rest read as 0.
+    int opened = perf_counters_open(&pc);
+    TEST_ASSERT(opened >= 0 && opened <= PERF_EVENTS);
+    if (opened > 0) {
+        uint64_t before[PERF_EVENTS];
+        TEST_ASSERT(perf_counters_read(&pc, before));
+        volatile uint64_t sink = 0;
+        for (int i = 0; i < 1000000; i++) {
+            sink += (uint64_t)i * 7;
+        }
+        TEST_ASSERT(perf_counters_read(&pc, v));
+        for (int e = 0; e < PERF_EVENTS; e++) {
+            TEST_ASSERT(v[e] >= before[e]);
+        }
+        if (pc.fd[PERF_INSTRUCTIONS] >= 0) {
+            TEST_ASSERT(v[PERF_INSTRUCTIONS] - before[PERF_INSTRUCTIONS] > 1000000);
+        }
+    }
+    perf_counters_close(&pc);
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        TEST_ASSERT(pc.fd[e] == -1);
+    }
+
+    // Test 3) Names, as exported.
+    TEST_ASSERT(strcmp(perf_event_name(PERF_CYCLES), "cycles") == 0);
+    TEST_ASSERT(strcmp(perf_event_name(PERF_LLC_MISSES), "llc_misses") == 0);
+    return 0;
+}
+
+// --- QSBR grace periods ---
+#define QSBR_TEST_LIVE 0x600DF00Du
+#define QSBR_TEST_DEAD 0xDEADBEEFu
+
+typedef struct {
+    qsbr_t *q;
+    _Atomic(uint32_t *) shared;
+    atomic_bool stop;
+    atomic_int bad; /* Reader saw a value the writer had already retired */
+} qsbr_test_ctx_t;
+
+static void *qsbr_test_reader(void *arg) {
+    qsbr_test_ctx_t *ctx = (qsbr_test_ctx_t *)arg;
+    qsbr_online(ctx->q, 0);
+    while (!atomic_load(&ctx->stop)) {
+        qsbr_quiescent(ctx->q, 0);
+        uint32_t *p = atomic_load_explicit(&ctx->shared, memory_order_acquire);
+        /* "Burst": keep using the pointer for a while. */
+        for (int i = 0; i < 100; i++) {
+            if (*(volatile uint32_t *)p != QSBR_TEST_LIVE) atomic_store(&ctx->bad, 1);
+        }
+    }
+    qsbr_offline(ctx->q, 0);
+    return NULL;
+}
+
+int test_qsbr(void) {
+    qsbr_t q;
+    TEST_ASSERT(qsbr_init(&q, 2) == 0);
+
+    /* No reader online: synchronize must not wait. */
+    qsbr_synchronize(&q);
+
+    qsbr_test_ctx_t ctx;
+    ctx.q = &q;
+    uint32_t *first = malloc(sizeof(uint32_t));
+    TEST_ASSERT(first != NULL);
+    *first = QSBR_TEST_LIVE;
+    atomic_init(&ctx.shared, first);
+    atomic_init(&ctx.stop, false);
+    atomic_init(&ctx.bad, 0);
+
+    /* Slot 1 stays offline for the whole test and must never block the writer. */
+    pthread_t th;
+    TEST_ASSERT(pthread_create(&th, NULL, qsbr_test_reader, &ctx) == 0);
+
+    for (int i = 0; i < 2000; i++) {
+        uint32_t *next = malloc(sizeof(uint32_t));
+        TEST_ASSERT(next != NULL);
+        *next = QSBR_TEST_LIVE;
+
+        uint32_t *old = atomic_exchange(&ctx.shared, next);
+        qsbr_synchronize(&q);
+        /* Poison instead of only freeing, so a premature reclaim is visible. */
+        *old = QSBR_TEST_DEAD;
+        free(old);
+    }
+
+    atomic_store(&ctx.stop, true);
+    pthread_join(th, NULL);
+    TEST_ASSERT(atomic_load(&ctx.bad) == 0);
+    TEST_ASSERT(atomic_load(&q.readers[0].seen) == QSBR_OFFLINE);
+
+    free(atomic_load(&ctx.shared));
+    qsbr_destroy(&q);
+    return 0;
+}
+
 int test_rule_config_load(void) {
     const char *tmp = "/tmp/test-rules.conf";
     FILE *f = fopen(tmp, "w");
@@ -632,21 +2352,557 @@ int test_rule_config_load(void) {
     return 0;
 }
 
+int test_rule_file(void) {
+    const char *tmp = "/tmp/test-rules.bin";
+    int lo = (int)if_nametoindex("lo");
+
+    // Test 1) Bulk add: one sort, and the table grows past its initial capacity.
+    rule_t in[300];
+    memset(in, 0, sizeof(in));
+    for (int i = 0; i < 300; i++) {
+        in[i].priority = test_rand() % 100;
+        in[i].ip_ver = (uint8_t[]){0, 4, 6}[test_rand() % 3];
+        in[i].protocol = (uint8_t[]){0, 6, 17}[test_rand() % 3];
+        in[i].dst_port = (uint16_t[]){0, 22, 80}[test_rand() % 3];
+        in[i].action.type = (lo > 0 && (test_rand() & 1)) ? ACT_FWD : ACT_DROP;
+        in[i].action.out_ifindex = in[i].action.type == ACT_FWD ? lo : 0;
+    }
+    rule_table_t heap;
+    TEST_ASSERT(rule_table_init(&heap, 4) == 0);
+    TEST_ASSERT(rule_table_add_bulk(&heap, in, 300) == 0);
+    TEST_ASSERT(heap.count == 300 && heap.capacity >= 300);
+    for (size_t i = 1; i < heap.count; i++) {
+        const rule_t *a = &heap.rules[i - 1], *b = &heap.rules[i];
+        TEST_ASSERT(a->priority < b->priority ||
+                    (a->priority == b->priority && a->rule_id < b->rule_id));
+    }
+
+    // Test 2) A compiled file maps back to the same rules and classifier.
+    TEST_ASSERT(rule_table_compile(&heap) == 0);
+    TEST_ASSERT(rule_file_write(tmp, &heap) == 0);
+    TEST_ASSERT(rule_file_detect(tmp));
+
+    rule_table_t mapped;
+    TEST_ASSERT(rule_table_load(tmp, &mapped) == 0);
+    TEST_ASSERT(mapped.map != NULL && mapped.cls != NULL);
+    TEST_ASSERT(mapped.count == heap.count);
+    TEST_ASSERT(mapped.cls->tuple_count == heap.cls->tuple_count);
+    TEST_ASSERT(mapped.generation != heap.generation);
+
+    for (int i = 0; i < 5000; i++) {
+        flow_key_t k;
+        memset(&k, 0, sizeof(k));
+        k.ip_ver = (test_rand() & 1) ? 4 : 6;
+        k.protocol = (uint8_t[]){6, 17}[test_rand() % 2];
+        k.dst_port = (uint16_t[]){22, 80, 443}[test_rand() % 3];
+
+        const rule_t *a = rule_table_match(&heap, &k);
+        const rule_t *b = rule_table_match(&mapped, &k);
+        TEST_ASSERT((a == NULL) == (b == NULL));
+        TEST_ASSERT(a == NULL || (a->rule_id == b->rule_id &&
+                                  a->action.out_ifindex == b->action.out_ifindex));
+    }
+
+    // Test 3) Adding to a mapped table copies the rules out of the mapping.
+    rule_t extra;
+    memset(&extra, 0, sizeof(extra));
+    extra.priority = 1000; // Sorts last
+    TEST_ASSERT(rule_table_add(&mapped, &extra) == 0);
+    TEST_ASSERT(mapped.map == NULL && mapped.cls == NULL);
+    TEST_ASSERT(mapped.count == 301 && mapped.rules[300].rule_id == 300);
+    rule_table_destroy(&mapped);
+
+    // Test 4) A flipped bit, a truncated file or another version is rejected.
+    FILE *f = fopen(tmp, "r+b");
+    TEST_ASSERT(f != NULL);
+    TEST_ASSERT(fseek(f, -8, SEEK_END) == 0);
+    int c = fgetc(f);
+    TEST_ASSERT(fseek(f, -8, SEEK_END) == 0);
+    fputc(c ^ 0x10, f);
+    fclose(f);
+    TEST_ASSERT(rule_file_load(tmp, &mapped) != 0);
+
+    TEST_ASSERT(rule_file_write(tmp, &heap) == 0);
+    TEST_ASSERT(truncate(tmp, 200) == 0);
+    TEST_ASSERT(rule_file_load(tmp, &mapped) != 0);
+
+    TEST_ASSERT(rule_file_write(tmp, &heap) == 0);
+    f = fopen(tmp, "r+b");
+    TEST_ASSERT(f != NULL);
+    uint32_t version = RULE_FILE_VERSION + 1;
+    TEST_ASSERT(fseek(f, 8, SEEK_SET) == 0);
+    fwrite(&version, sizeof(version), 1, f);
+    fclose(f);
+    TEST_ASSERT(rule_file_load(tmp, &mapped) != 0);
+
+    // Test 5) A text file is not taken for a compiled one.
+    f = fopen(tmp, "w");
+    TEST_ASSERT(f != NULL);
+    fprintf(f, "[rule]\npriority = 1\naction = drop\n");
+    fclose(f);
+    TEST_ASSERT(!rule_file_detect(tmp));
+    TEST_ASSERT(rule_table_load(tmp, &mapped) == 0);
+    TEST_ASSERT(mapped.map == NULL && mapped.count == 1);
+    rule_table_destroy(&mapped);
+
+    rule_table_destroy(&heap);
+    remove(tmp);
+    return 0;
+}
+
+int test_latency_histogram(void) {
+    /* Test 1) Buckets are contiguous: each value is in the same bucket as the one before
+     * or in the next. */
+    for (uint64_t v = 1; v < 200000; v++) {
+        unsigned int d = latency_bucket_index(v) - latency_bucket_index(v - 1);
+        TEST_ASSERT(d <= 1);
+    }
+    TEST_ASSERT(latency_bucket_index(UINT64_MAX) == LATENCY_NUM_BUCKETS - 1);
+    TEST_ASSERT(latency_bucket_index(1ULL << LATENCY_MAX_BITS) == LATENCY_NUM_BUCKETS - 1);
+
+    /* Test 2) A percentile is never below the sample, and above it by at most the
+     * precision. The larger second sample keeps max_ns from capping the result. */
+    uint64_t seed = 42;
+    for (int i = 0; i < 10000; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint64_t v = (seed >> 33) >> (seed & 31); /* Spread over all magnitudes */
+
+        latency_histogram_t h;
+        latency_histogram_init(&h);
+        latency_record_ns(&h, v, 1);
+        latency_record_ns(&h, 1ULL << 40, 1);
+        uint64_t p = latency_percentile(&h, 0.5);
+        TEST_ASSERT(p >= v);
+        TEST_ASSERT(p - v <= v >> LATENCY_PRECISION_BITS);
+    }
+
+    /* Test 3) Percentiles of 1..10000 ns, the top one exact through max_ns. */
+    latency_histogram_t all, a, b;
+    latency_histogram_init(&all);
+    latency_histogram_init(&a);
+    latency_histogram_init(&b);
+    for (uint64_t v = 1; v <= 10000; v++) {
+        latency_record_ns(&all, v, 1);
+        latency_record_ns(v % 3 ? &a : &b, v, 1);
+    }
+    TEST_ASSERT(all.min_ns == 1 && all.max_ns == 10000 && all.total_count == 10000);
+
+    const double pct[] = {0.50, 0.99, 0.999};
+    const uint64_t exact[] = {5000, 9900, 9990};
+    for (int i = 0; i < 3; i++) {
+        uint64_t p = latency_percentile(&all, pct[i]);
+        TEST_ASSERT(p >= exact[i] && p - exact[i] <= exact[i] >> LATENCY_PRECISION_BITS);
+    }
+    TEST_ASSERT(latency_percentile(&all, 0.9999) == 10000);
+    TEST_ASSERT(latency_percentile(&all, 1.0) == 10000);
+
+    /* Test 4) Merging two halves gives the histogram of the whole. */
+    latency_histogram_merge(&a, &b);
+    TEST_ASSERT(memcmp(&a, &all, sizeof(all)) == 0);
+
+    /* Test 5) A sample past the range lands in the last bucket, reported as max_ns. */
+    latency_histogram_t big;
+    latency_histogram_init(&big);
+    TEST_ASSERT(latency_percentile(&big, 0.99) == 0);
+    latency_record_ns(&big, 100, 3);
+    latency_record_ns(&big, 1ULL << 40, 1);
+    TEST_ASSERT(big.total_count == 4 && big.sum_ns == 300 + (1ULL << 40));
+    TEST_ASSERT(big.buckets[LATENCY_NUM_BUCKETS - 1] == 1);
+    TEST_ASSERT(latency_percentile(&big, 0.5) <= 100 + (100 >> LATENCY_PRECISION_BITS));
+    TEST_ASSERT(latency_percentile(&big, 0.99) == 1ULL << 40);
+    return 0;
+}
+
+int test_json_output(void) {
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&buf, &len);
+    TEST_ASSERT(f != NULL);
+
+    json_ctx_t j;
+    json_init(&j, f);
+    json_begin_object(&j);
+    json_begin_nested_array(&j, "rules");
+    for (int i = 0; i < 2; i++) {
+        json_begin_object(&j);
+        json_key_int(&j, "id", i);
+        json_end_object(&j);
+    }
+    json_end_array(&j);
+    json_key_bool(&j, "ok", true);
+    json_end_object(&j);
+    fclose(f);
+
+    const char *want = "{\n"
+                       "    \"rules\": [\n"
+                       "        {\n"
+                       "            \"id\": 0\n"
+                       "        },\n"
+                       "        {\n"
+                       "            \"id\": 1\n"
+                       "        }\n"
+                       "    ],\n"
+                       "    \"ok\": true\n"
+                       "}";
+    TEST_ASSERT(strcmp(buf, want) == 0);
+    free(buf);
+    return 0;
+}
+
+/* Send `req` to the metrics server on UNIX socket `sock`; the whole response in `resp`. */
+static int metrics_get(const char *sock, const char *req, char *resp, size_t size) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, sock);
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0 ||
+        write(fd, req, strlen(req)) != (ssize_t)strlen(req)) {
+        close(fd);
+        return -1;
+    }
+
+    size_t used = 0;
+    ssize_t n;
+    while (used < size - 1 && (n = read(fd, resp + used, size - 1 - used)) > 0) {
+        used += (size_t)n;
+    }
+    resp[used] = '\0';
+    close(fd);
+    return 0;
+}
+
+int test_metrics_server(void) {
+    const char *sock = "/tmp/upe-test-metrics.sock";
+    metrics_server_t m;
+    char resp[1024];
+
+    // Test 1) Invalid addresses are refused.
+    TEST_ASSERT(metrics_server_start(&m, "unix:") == -1);
+    TEST_ASSERT(metrics_server_start(&m, "localhost:http") == -1);
+    TEST_ASSERT(metrics_server_start(&m, "127.0.0.1:70000") == -1);
+
+    char path[64];
+    snprintf(path, sizeof(path), "unix:%s", sock);
+    TEST_ASSERT(metrics_server_start(&m, path) == 0);
+    struct stat st;
+    TEST_ASSERT(stat(sock, &st) == 0 && (st.st_mode & 0777) == 0600); // Owner only
+
+    // Test 2) Nothing published yet: an empty body.
+    TEST_ASSERT(metrics_get(sock, "GET /metrics HTTP/1.0\r\n\r\n", resp, sizeof(resp)) == 0);
+    TEST_ASSERT(strncmp(resp, "HTTP/1.0 200 OK\r\n", 17) == 0);
+    TEST_ASSERT(strstr(resp, "Content-Length: 0\r\n") != NULL);
+
+    // Test 3) Each path gets its format, the latest publish wins.
+    metrics_server_publish(&m, METRICS_PROMETHEUS, strdup("old 1\n"), 6);
+    metrics_server_publish(&m, METRICS_PROMETHEUS, strdup("upe_x 2\n"), 8);
+    metrics_server_publish(&m, METRICS_JSON, strdup("{}\n"), 3);
+
+    TEST_ASSERT(metrics_get(sock, "GET /metrics HTTP/1.1\r\nHost: x\r\n\r\n", resp,
+                            sizeof(resp)) == 0);
+    TEST_ASSERT(strstr(resp, "text/plain; version=0.0.4") != NULL);
+    TEST_ASSERT(strstr(resp, "Content-Length: 8\r\n") != NULL);
+    TEST_ASSERT(strcmp(strstr(resp, "\r\n\r\n") + 4, "upe_x 2\n") == 0);
+
+    TEST_ASSERT(metrics_get(sock, "GET /metrics.json HTTP/1.0\r\n\r\n", resp, sizeof(resp)) ==
+                0);
+    TEST_ASSERT(strstr(resp, "application/json") != NULL);
+    TEST_ASSERT(strcmp(strstr(resp, "\r\n\r\n") + 4, "{}\n") == 0);
+
+    // Test 4) Unknown paths and methods.
+    TEST_ASSERT(metrics_get(sock, "GET /other HTTP/1.0\r\n\r\n", resp, sizeof(resp)) == 0);
+    TEST_ASSERT(strncmp(resp, "HTTP/1.0 404", 12) == 0);
+    TEST_ASSERT(metrics_get(sock, "POST /metrics HTTP/1.0\r\n\r\n", resp, sizeof(resp)) == 0);
+    TEST_ASSERT(strncmp(resp, "HTTP/1.0 404", 12) == 0);
+
+    // Test 5) Stopping removes the socket file.
+    metrics_server_stop(&m);
+    TEST_ASSERT(access(sock, F_OK) != 0);
+    return 0;
+}
+
+typedef struct {
+    const char *sock;
+    const char *req;
+    char resp[256];
+    int rc;
+} rule_api_client_t;
+
+static void *rule_api_client(void *arg) {
+    rule_api_client_t *c = (rule_api_client_t *)arg;
+    c->rc = metrics_get(c->sock, c->req, c->resp, sizeof(c->resp));
+    return NULL;
+}
+
+int test_rule_api(void) {
+    const char *sock = "/tmp/upe-test-rule-api.sock";
+    rule_delta_t d[4];
+    size_t count = 0;
+    char err[128];
+
+    // Test 1) Parsing: commit ends the delta, ids and rule keys are checked.
+    char ok[] = "# comment\n"
+                "add priority=5 protocol=tcp dst_port=22 action=drop\n"
+                "  modify 7 priority=9 action=drop\n"
+                "delete 3\n"
+                "commit\n"
+                "ignored after commit\n";
+    TEST_ASSERT(rule_api_parse(ok, d, 4, &count, err, sizeof(err)) == 1);
+    TEST_ASSERT(count == 3);
+    TEST_ASSERT(d[0].op == RULE_ADD && d[0].rule.priority == 5 && d[0].rule.dst_port == 22);
+    TEST_ASSERT(d[0].rule.protocol == 6);
+    TEST_ASSERT(d[1].op == RULE_MODIFY && d[1].rule_id == 7 && d[1].rule.priority == 9);
+    TEST_ASSERT(d[2].op == RULE_DELETE && d[2].rule_id == 3);
+
+    char no_commit[] = "delete 1";
+    TEST_ASSERT(rule_api_parse(no_commit, d, 4, &count, err, sizeof(err)) == 0);
+    TEST_ASSERT(count == 1 && d[0].rule_id == 1);
+
+    char bad_cmd[] = "delete 1\nreplace 2\n";
+    TEST_ASSERT(rule_api_parse(bad_cmd, d, 4, &count, err, sizeof(err)) == -1);
+    TEST_ASSERT(strstr(err, "line 2") != NULL);
+    char bad_id[] = "delete -1\n";
+    TEST_ASSERT(rule_api_parse(bad_id, d, 4, &count, err, sizeof(err)) == -1);
+    char extra[] = "delete 1 priority=2\n";
+    TEST_ASSERT(rule_api_parse(extra, d, 4, &count, err, sizeof(err)) == -1);
+    char bad_key[] = "add colour=blue\n";
+    TEST_ASSERT(rule_api_parse(bad_key, d, 4, &count, err, sizeof(err)) == -1);
+    char no_iface[] = "add action=fwd\n";
+    TEST_ASSERT(rule_api_parse(no_iface, d, 4, &count, err, sizeof(err)) == -1);
+    char too_many[] = "delete 1\ndelete 2\ndelete 3\n";
+    TEST_ASSERT(rule_api_parse(too_many, d, 2, &count, err, sizeof(err)) == -1);
+
+    // Test 2) Round trip: the delta reaches the poller, its reply the client.
+    rule_api_t a;
+    TEST_ASSERT(rule_api_start(&a, "") == -1);
+    TEST_ASSERT(rule_api_start(&a, sock) == 0);
+    struct stat st;
+    TEST_ASSERT(stat(sock, &st) == 0 && (st.st_mode & 0777) == 0600); // Owner only
+    TEST_ASSERT(rule_api_poll(&a, 10) == NULL);
+
+    rule_api_client_t c = {.sock = sock, .req = "delete 4\ndelete 5\ncommit\n", .rc = -1};
+    pthread_t t;
+    TEST_ASSERT(pthread_create(&t, NULL, rule_api_client, &c) == 0);
+    rule_api_request_t *req = NULL;
+    for (int i = 0; i < 50 && !req; i++) {
+        req = rule_api_poll(&a, 100);
+    }
+    TEST_ASSERT(req != NULL);
+    TEST_ASSERT(req->count == 2 && req->deltas[1].op == RULE_DELETE);
+    TEST_ASSERT(req->deltas[1].rule_id == 5);
+    snprintf(req->reply, req->reply_cap, "ok 1 rules, generation 2\n");
+    rule_api_reply(&a, req);
+    pthread_join(t, NULL);
+    TEST_ASSERT(c.rc == 0);
+    TEST_ASSERT(strcmp(c.resp, "ok 1 rules, generation 2\n") == 0);
+
+    // Test 3) Errors are answered by the server thread alone.
+    TEST_ASSERT(metrics_get(sock, "delete x\ncommit\n", c.resp, sizeof(c.resp)) == 0);
+    TEST_ASSERT(strncmp(c.resp, "error: line 1", 13) == 0);
+    TEST_ASSERT(metrics_get(sock, "commit\n", c.resp, sizeof(c.resp)) == 0);
+    TEST_ASSERT(strcmp(c.resp, "error: empty delta\n") == 0);
+
+    // Test 4) Stopping removes the socket file.
+    rule_api_stop(&a);
+    TEST_ASSERT(access(sock, F_OK) != 0);
+    return 0;
+}
+
+/* Hand `b` (`len` bytes of `fill`) to ring 0 of the mirror, as a worker does. */
+static int mirror_push(mirror_t *m, pktbuf_t *b, size_t len, uint8_t fill) {
+    memset(b->data, fill, len);
+    b->len = len;
+    b->timestamp = 0;
+    if (!mirror_reserve(m)) return -1;
+    pktbuf_ref(b);
+    return ring_push_burst(mirror_ring(m, 0), (void *const *)&b, 1) == 1 ? 0 : -1;
+}
+
+/* Read exactly `len` bytes from `fd`. */
+static int read_full(int fd, uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n <= 0) return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Wait up to 2s for the mirror's output to be open (or closed). */
+static bool mirror_wait_active(const mirror_t *m, bool active) {
+    for (int i = 0; i < 200; i++) {
+        if (atomic_load(&m->active) == active) return true;
+        struct timespec ts = {.tv_sec = 0, .tv_nsec = 10 * 1000 * 1000};
+        nanosleep(&ts, NULL);
+    }
+    return false;
+}
+
+int test_packet_mirror(void) {
+    static pktbuf_pool_t pool;
+    const char *file = "/tmp/upe-test-mirror.pcapng";
+    const char *sock = "/tmp/upe-test-mirror.sock";
+    TEST_ASSERT(pktbuf_pool_init(&pool, 4) == 0);
+
+    // Test 1) A buffer with a second holder goes back to the pool with the last free only.
+    pktbuf_t *a = pktbuf_alloc(&pool);
+    TEST_ASSERT(a != NULL);
+    pktbuf_ref(a);
+    pktbuf_free(&pool, a);
+    pktbuf_t *held[4];
+    unsigned int got = 0;
+    while (got < 4 && (held[got] = pktbuf_alloc(&pool)) != NULL) got++;
+    TEST_ASSERT(got == 3); // `a` is still held
+    for (unsigned int i = 0; i < got; i++) TEST_ASSERT(held[i] != a);
+    pktbuf_release_bulk(held, got);
+    pktbuf_release(a);
+    got = 0;
+    while (got < 4 && (held[got] = pktbuf_alloc(&pool)) != NULL) got++;
+    TEST_ASSERT(got == 4);
+    TEST_ASSERT(atomic_load(&a->refcnt) == 1);
+
+    // Test 2) Rule key and the budget: never more than `budget` buffers taken.
+    rule_t r;
+    char err[128];
+    TEST_ASSERT(rule_config_parse_line("action=drop mirror=1k", &r, err, sizeof(err)) == 0);
+    TEST_ASSERT(r.action.mirror == 1000);
+    TEST_ASSERT(rule_config_parse_line("action=drop mirror=0", &r, err, sizeof(err)) == -1);
+
+    mirror_t m;
+    TEST_ASSERT(mirror_init(&m, file, 0, 1, 2, 1.0) == -1);
+    TEST_ASSERT(mirror_init(&m, file, 1, 1, 2, 1.0) == 0);
+    TEST_ASSERT(atomic_load(&m.active));
+    TEST_ASSERT(mirror_reserve(&m) && mirror_reserve(&m));
+    TEST_ASSERT(!mirror_reserve(&m));
+    mirror_unreserve(&m, 2);
+
+    // Test 3) Written as pcapng from the buffers, which then go back to the pool.
+    // The "worker" releases its reference first: the frame outlives it.
+    TEST_ASSERT(mirror_push(&m, held[0], 60, 0xa1) == 0);
+    TEST_ASSERT(mirror_push(&m, held[1], 61, 0xb2) == 0);
+    TEST_ASSERT(mirror_push(&m, held[2], 60, 0xc3) == -1); // Over the budget
+    pktbuf_release_bulk(held, 4);
+    TEST_ASSERT(mirror_start(&m) == 0);
+    mirror_stop(&m);
+    TEST_ASSERT(m.frames_written == 2 && m.frames_lost == 0);
+    TEST_ASSERT(atomic_load(&m.held) == 0);
+    mirror_destroy(&m);
+
+    got = 0;
+    while (got < 4 && (held[got] = pktbuf_alloc(&pool)) != NULL) got++;
+    TEST_ASSERT(got == 4);
+
+    uint8_t out[512];
+    FILE *f = fopen(file, "rb");
+    TEST_ASSERT(f != NULL);
+    size_t len = fread(out, 1, sizeof(out), f);
+    fclose(f);
+    unlink(file);
+    TEST_ASSERT(len == 28 + 32 + (28 + 60 + 4) + (28 + 64 + 4)); // 61 padded to 64
+    uint32_t w[7];
+    memcpy(w, out, sizeof(w));
+    TEST_ASSERT(w[0] == 0x0A0D0D0Au && w[1] == 28 && w[2] == 0x1A2B3C4Du);
+    memcpy(w, out + 28, 2 * sizeof(uint32_t));
+    TEST_ASSERT(w[0] == 1 && w[1] == 32); // Interface description
+    memcpy(w, out + 60, sizeof(w));
+    TEST_ASSERT(w[0] == 6 && w[1] == 92 && w[5] == 60 && w[6] == 60);
+    TEST_ASSERT(out[60 + 28] == 0xa1 && out[60 + 28 + 59] == 0xa1);
+    memcpy(w, out + 152, sizeof(w));
+    TEST_ASSERT(w[0] == 6 && w[1] == 96 && w[5] == 61);
+    TEST_ASSERT(out[152 + 28 + 60] == 0xb2 && out[152 + 28 + 61] == 0);
+    memcpy(w, out + len - 4, sizeof(uint32_t));
+    TEST_ASSERT(w[0] == 96); // Block length again at the end
+
+    // Test 4) UNIX socket: idle until a client connects, which gets the header
+    // first; a client that leaves stops the sampling again.
+    TEST_ASSERT(mirror_init(&m, "unix:", 1, 1, 8, 1.0) == -1);
+    TEST_ASSERT(mirror_init(&m, "unix:/tmp/upe-test-mirror.sock", 1, 1, 8, 1.0) == 0);
+    struct stat st;
+    TEST_ASSERT(stat(sock, &st) == 0 && (st.st_mode & 0777) == 0600); // Owner only
+    TEST_ASSERT(!atomic_load(&m.active));
+    TEST_ASSERT(mirror_start(&m) == 0);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    TEST_ASSERT(fd >= 0);
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, sock);
+    TEST_ASSERT(connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0);
+    TEST_ASSERT(mirror_wait_active(&m, true));
+    TEST_ASSERT(read_full(fd, out, 60) == 0);
+    memcpy(w, out, sizeof(uint32_t));
+    TEST_ASSERT(w[0] == 0x0A0D0D0Au);
+
+    TEST_ASSERT(mirror_push(&m, held[0], 100, 0xd4) == 0);
+    pktbuf_release(held[0]);
+    TEST_ASSERT(read_full(fd, out, 28 + 100 + 4) == 0);
+    memcpy(w, out, sizeof(w));
+    TEST_ASSERT(w[0] == 6 && w[5] == 100 && out[28] == 0xd4);
+
+    close(fd);
+    TEST_ASSERT(mirror_push(&m, held[1], 100, 0xe5) == 0);
+    pktbuf_release(held[1]);
+    TEST_ASSERT(mirror_wait_active(&m, false));
+    mirror_stop(&m);
+    TEST_ASSERT(m.clients == 1 && m.frames_written == 1 && m.frames_lost == 1);
+    TEST_ASSERT(atomic_load(&m.held) == 0);
+    mirror_destroy(&m);
+    TEST_ASSERT(access(sock, F_OK) != 0);
+
+    pktbuf_release_bulk(&held[2], 2);
+    pktbuf_thread_flush();
+    pktbuf_pool_destroy(&pool);
+    return 0;
+}
+
 int main(void) {
     printf("=-> UPE Component Tests <-=\n");
     RUN_TEST(test_ring_buffer);
+    RUN_TEST(test_ring_wait_notify);
+    RUN_TEST(test_ring_peek_watermarks);
     RUN_TEST(test_rule_priority);
     RUN_TEST(test_tcp_packet_parser);
     RUN_TEST(test_icmp_packet_parser);
     RUN_TEST(test_ipv6_packet_parser);
+    RUN_TEST(test_parse_burst);
     RUN_TEST(test_ipv4_checksum_and_ttl);
+    RUN_TEST(test_incremental_checksum);
     RUN_TEST(test_flow_hash);
+    RUN_TEST(test_flow_hash_distribution);
+    RUN_TEST(test_reta);
     RUN_TEST(test_pktbuf_pool);
+    RUN_TEST(test_pktbuf_pool_numa);
+    RUN_TEST(test_affinity_core_list);
+    RUN_TEST(test_pktbuf_bulk);
+    RUN_TEST(test_pktbuf_stress);
+    RUN_TEST(test_pktbuf_classes);
+    RUN_TEST(test_xsk_umem_layout);
     RUN_TEST(test_arp_table);
     RUN_TEST(test_ndp_table);
     RUN_TEST(test_arp_expiry);
     RUN_TEST(test_ndp_expiry);
+    RUN_TEST(test_arp_lockfree_read);
+    RUN_TEST(test_neigh_cache);
+    RUN_TEST(test_control_plane);
     RUN_TEST(test_ipv6_rule_matching);
+    RUN_TEST(test_classifier_matches_linear);
+    RUN_TEST(test_rule_table_apply);
+    RUN_TEST(test_flow_cache);
+    RUN_TEST(test_conntrack);
+    RUN_TEST(test_policer);
+    RUN_TEST(test_log_async);
+    RUN_TEST(test_perf_counters);
+    RUN_TEST(test_tx_ring_oversized);
+    RUN_TEST(test_qsbr);
     RUN_TEST(test_rule_config_load);
+    RUN_TEST(test_rule_file);
+    RUN_TEST(test_latency_histogram);
+    RUN_TEST(test_json_output);
+    RUN_TEST(test_metrics_server);
+    RUN_TEST(test_rule_api);
+    RUN_TEST(test_packet_mirror);
     return 0;
 }
\ No newline at end of file